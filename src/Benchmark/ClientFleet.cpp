@@ -0,0 +1,599 @@
+// Puts a running multirole under load by having a fleet of headless clients
+// host rooms, join them as duelists or spectators, chat and play each duel
+// to the end, speaking the same CTOS/STOC protocol as the real client.
+// Duelists use the given decks and answer every prompt with the least they
+// can (ending their turns, declining chains and optional effects, picking the
+// first valid choice otherwise), so duels last until someone decks out. The
+// few prompts that can't be answered that way are met with a surrender.
+// Usage: bench-client-fleet <address> <port> <rooms> <spectators per room> <deck.ydk>...
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <boost/asio/connect.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+
+#include "../Multirole/YGOPro/CTOSMsg.hpp"
+#include "../Multirole/YGOPro/Config.hpp"
+#include "../Multirole/YGOPro/Constants.hpp"
+#include "../Multirole/YGOPro/CoreUtils.hpp"
+#include "../Multirole/YGOPro/STOCMsg.hpp"
+
+namespace
+{
+
+using namespace boost::asio;
+using Clock = std::chrono::steady_clock;
+using CTOSType = YGOPro::CTOSMsg::MsgType;
+using STOCType = YGOPro::STOCMsg::MsgType;
+
+#include "../Read.inl"
+
+// A duelist sends a chat message every this many responses.
+constexpr std::size_t RESPONSES_PER_CHAT = 25U;
+
+struct Deck
+{
+	std::vector<uint32_t> main; // Extra deck included, as the client does.
+	std::vector<uint32_t> side;
+};
+
+// Reads a deck in the .ydk format saved by the client.
+bool LoadYdk(const std::string& file, Deck& deck)
+{
+	std::ifstream f(file);
+	if(!f.is_open())
+		return false;
+	std::vector<uint32_t>* current = &deck.main;
+	for(std::string line; std::getline(f, line);)
+	{
+		if(line.rfind("!side", 0U) == 0U)
+			current = &deck.side;
+		else if(line.rfind("#extra", 0U) == 0U || line.rfind("#main", 0U) == 0U)
+			current = &deck.main;
+		else if(const auto code = std::strtoul(line.data(), nullptr, 10); code != 0U)
+			current->push_back(static_cast<uint32_t>(code));
+	}
+	return !deck.main.empty();
+}
+
+template<typename T>
+void Put(std::vector<uint8_t>& out, T value)
+{
+	const auto size = out.size();
+	out.resize(size + sizeof(T));
+	std::memcpy(out.data() + size, &value, sizeof(T));
+}
+
+YGOPro::CTOSMsg MakeMsg(CTOSType type, const void* body = nullptr, std::size_t size = 0U)
+{
+	YGOPro::CTOSMsg msg;
+	const auto length = static_cast<YGOPro::CTOSMsg::LengthType>(size + 1U);
+	std::memcpy(msg.Data(), &length, sizeof(length));
+	std::memcpy(msg.Data() + sizeof(length), &type, sizeof(type));
+	if(size != 0U)
+		std::memcpy(msg.Body(), body, size);
+	return msg;
+}
+
+template<typename T>
+YGOPro::CTOSMsg MakeMsg(CTOSType type, const T& body)
+{
+	return MakeMsg(type, &body, sizeof(T));
+}
+
+template<std::size_t N>
+void CopyName(uint16_t (&dst)[N], const std::string& src)
+{
+	std::fill(std::begin(dst), std::end(dst), uint16_t{});
+	for(std::size_t i = 0U; i < std::min(N - 1U, src.size()); i++)
+		dst[i] = static_cast<uint8_t>(src[i]);
+}
+
+// Least a duelist can answer to a prompt from the core, nothing if it
+// doesn't know how to.
+std::optional<std::vector<uint8_t>> Respond(const uint8_t* msg, std::size_t size)
+{
+	std::vector<uint8_t> r;
+	const uint8_t* ptr = msg;
+	const auto type = Read<uint8_t>(ptr);
+	const auto player = Read<uint8_t>(ptr);
+	switch(type)
+	{
+	case MSG_SELECT_IDLECMD:
+	{
+		// Ends with whether going to battle phase, to end phase and
+		// shuffling are allowed.
+		Put<int32_t>(r, (msg[size - 2U] != 0U) ? 7 : 6);
+		break;
+	}
+	case MSG_SELECT_BATTLECMD:
+	{
+		// Ends with whether going to main phase 2 and to end phase are
+		// allowed.
+		Put<int32_t>(r, (msg[size - 1U] != 0U) ? 3 : 2);
+		break;
+	}
+	case MSG_SELECT_CHAIN:
+	{
+		ptr++; // Special count
+		Put<int32_t>(r, (Read<uint8_t>(ptr) != 0U) ? 0 : -1);
+		break;
+	}
+	case MSG_SELECT_EFFECTYN:
+	case MSG_SELECT_YESNO:
+	case MSG_SELECT_OPTION:
+	case MSG_ANNOUNCE_NUMBER:
+	{
+		Put<int32_t>(r, 0);
+		break;
+	}
+	case MSG_ROCK_PAPER_SCISSORS:
+	{
+		Put<int32_t>(r, 1);
+		break;
+	}
+	case MSG_SORT_CARD:
+	case MSG_SORT_CHAIN:
+	{
+		Put<int32_t>(r, -1);
+		break;
+	}
+	case MSG_SELECT_CARD:
+	case MSG_SELECT_TRIBUTE:
+	{
+		const auto cancelable = Read<uint8_t>(ptr);
+		const auto min = Read<uint32_t>(ptr);
+		if(cancelable != 0U)
+		{
+			Put<int32_t>(r, -1);
+			break;
+		}
+		Put<int32_t>(r, 0); // Indices as 32-bit integers.
+		Put<uint32_t>(r, min);
+		for(uint32_t i = 0U; i < min; i++)
+			Put<uint32_t>(r, i);
+		break;
+	}
+	case MSG_SELECT_UNSELECT_CARD:
+	{
+		const auto finishable = Read<uint8_t>(ptr);
+		const auto cancelable = Read<uint8_t>(ptr);
+		if(finishable != 0U || cancelable != 0U)
+		{
+			Put<int32_t>(r, -1);
+			break;
+		}
+		Put<int32_t>(r, 1);
+		Put<int32_t>(r, 0);
+		break;
+	}
+	case MSG_SELECT_PLACE:
+	case MSG_SELECT_DISFIELD:
+	{
+		const auto count = std::max<uint8_t>(Read<uint8_t>(ptr), 1U);
+		// Set bits are zones that can't be picked, own zones first.
+		const auto flag = Read<uint32_t>(ptr);
+		uint8_t picked = 0U;
+		for(uint32_t bit = 0U; bit < 32U && picked < count; bit++)
+		{
+			if((flag & (1U << bit)) != 0U)
+				continue;
+			const uint32_t field = bit & 0xFU;
+			if(field > 12U || field == 7U)
+				continue;
+			Put<uint8_t>(r, (bit < 16U) ? player : 1U - player);
+			Put<uint8_t>(r, (field < 8U) ? LOCATION_MZONE : LOCATION_SZONE);
+			Put<uint8_t>(r, (field < 8U) ? field : field - 8U);
+			picked++;
+		}
+		if(picked != count)
+			return std::nullopt;
+		break;
+	}
+	case MSG_SELECT_POSITION:
+	{
+		ptr += 4U; // Card code
+		const auto positions = Read<uint8_t>(ptr);
+		Put<int32_t>(r, positions & -positions);
+		break;
+	}
+	case MSG_ANNOUNCE_ATTRIB:
+	{
+		auto count = Read<uint8_t>(ptr);
+		const auto available = Read<uint32_t>(ptr);
+		uint32_t picked = 0U;
+		for(uint32_t bit = 1U; bit != 0U && count > 0U; bit <<= 1U)
+		{
+			if((available & bit) != 0U)
+			{
+				picked |= bit;
+				count--;
+			}
+		}
+		Put<uint32_t>(r, picked);
+		break;
+	}
+	default: // Counters, sums, races and cards to announce.
+	{
+		return std::nullopt;
+	}
+	}
+	return r;
+}
+
+// Time taken by every occurrence of something.
+struct Samples
+{
+	const char* name;
+	std::vector<Clock::duration> samples;
+
+	void Print() const
+	{
+		if(samples.empty())
+			return;
+		auto sorted = samples;
+		std::sort(sorted.begin(), sorted.end());
+		auto Ms = [&](double q) -> double
+		{
+			const auto idx = static_cast<std::size_t>(q * static_cast<double>(sorted.size() - 1U));
+			return std::chrono::duration<double, std::milli>(sorted[idx]).count();
+		};
+		std::printf("%-9s %9zu samples, p50 %9.2fms, p90 %9.2fms, p99 %9.2fms, max %9.2fms\n",
+			name, sorted.size(), Ms(0.5), Ms(0.9), Ms(0.99), Ms(1.0));
+	}
+};
+
+struct Totals
+{
+	std::size_t duels;
+	std::size_t surrenders;
+	std::size_t errors;
+	std::size_t messages; // Every STOC message received.
+	std::size_t bytes;
+	std::size_t responses;
+	Samples join{"join", {}};
+	Samples response{"response", {}}; // Until the next game message.
+	Samples duel{"duel", {}};
+};
+
+struct Room
+{
+	ip::tcp::endpoint endpoint;
+	const Deck* decks[2U];
+	std::size_t spectators;
+	std::size_t joined;
+	uint32_t id;
+	Clock::time_point duelStart;
+};
+
+class Client final : public std::enable_shared_from_this<Client>
+{
+public:
+	enum class Role
+	{
+		HOST,
+		OPPONENT,
+		SPECTATOR,
+	};
+
+	Client(io_context& ioCtx, std::shared_ptr<Room> room, Role role, Totals& t) :
+		ioCtx(ioCtx),
+		socket(ioCtx),
+		room(std::move(room)),
+		role(role),
+		t(t),
+		rng(std::random_device{}())
+	{}
+
+	void Start()
+	{
+		auto self(shared_from_this());
+		start = Clock::now();
+		socket.async_connect(room->endpoint, [this, self](boost::system::error_code ec)
+		{
+			if(ec)
+			{
+				t.errors++;
+				return;
+			}
+			socket.set_option(ip::tcp::no_delay(true));
+			YGOPro::CTOSMsg::PlayerInfo pi{};
+			CopyName(pi.name, (role == Role::SPECTATOR) ? "Spectator" : "Duelist");
+			Send(MakeMsg(CTOSType::PLAYER_INFO, pi));
+			if(role == Role::HOST)
+			{
+				YGOPro::CTOSMsg::CreateGame cg{};
+				auto& hi = cg.hostInfo;
+				hi.allowed = YGOPro::ALLOWED_CARDS_ANY;
+				hi.dontCheckDeck = 1U;
+				hi.startingLP = 8000U;
+				hi.startingDrawCount = 5U;
+				hi.drawCountPerTurn = 1U;
+				hi.handshake = YGOPro::SERVER_HANDSHAKE;
+				hi.version = YGOPro::SERVER_VERSION;
+				hi.t0Count = hi.t1Count = 1;
+				hi.bestOf = 1;
+				hi.duelFlagsHigh = 0x1U; // DUEL_MODE_MR5
+				CopyName(cg.name, "Fleet");
+				Send(MakeMsg(CTOSType::CREATE_GAME, cg));
+			}
+			else
+			{
+				YGOPro::CTOSMsg::JoinGame jg{};
+				jg.version2 = 0x1362U; // NOLINT: Unused, sent by every client
+				jg.id = room->id;
+				jg.version = YGOPro::SERVER_VERSION;
+				Send(MakeMsg(CTOSType::JOIN_GAME, jg));
+			}
+			DoReadHeader();
+		});
+	}
+private:
+	io_context& ioCtx;
+	ip::tcp::socket socket;
+	std::shared_ptr<Room> room;
+	const Role role;
+	Totals& t;
+	std::mt19937 rng;
+	Clock::time_point start;
+	std::optional<Clock::time_point> responded;
+	std::size_t responses{};
+	std::deque<YGOPro::CTOSMsg> outgoing;
+	std::vector<uint8_t> incoming;
+
+	void Send(YGOPro::CTOSMsg&& msg)
+	{
+		const bool writing = !outgoing.empty();
+		outgoing.emplace_back(std::move(msg));
+		if(!writing)
+			DoWrite();
+	}
+
+	void DoWrite()
+	{
+		auto self(shared_from_this());
+		auto& front = outgoing.front();
+		const std::size_t length = YGOPro::CTOSMsg::HEADER_LENGTH + front.GetLength();
+		async_write(socket, buffer(front.Data(), length),
+		[this, self](boost::system::error_code ec, std::size_t /*unused*/)
+		{
+			if(ec)
+				return;
+			outgoing.pop_front();
+			if(!outgoing.empty())
+				DoWrite();
+		});
+	}
+
+	void DoReadHeader()
+	{
+		auto self(shared_from_this());
+		incoming.resize(sizeof(YGOPro::STOCMsg::LengthType));
+		async_read(socket, buffer(incoming),
+		[this, self](boost::system::error_code ec, std::size_t /*unused*/)
+		{
+			if(ec)
+				return;
+			YGOPro::STOCMsg::LengthType length{};
+			std::memcpy(&length, incoming.data(), sizeof(length));
+			if(length == 0U)
+			{
+				t.errors++;
+				return;
+			}
+			DoReadBody(length);
+		});
+	}
+
+	void DoReadBody(std::size_t length)
+	{
+		auto self(shared_from_this());
+		incoming.resize(length);
+		async_read(socket, buffer(incoming),
+		[this, self](boost::system::error_code ec, std::size_t /*unused*/)
+		{
+			if(ec)
+				return;
+			t.messages++;
+			t.bytes += sizeof(YGOPro::STOCMsg::LengthType) + incoming.size();
+			if(HandleMsg(static_cast<STOCType>(incoming[0U]), incoming.data() + 1U, incoming.size() - 1U))
+				DoReadHeader();
+			else
+				socket.close(ec);
+		});
+	}
+
+	void Ready()
+	{
+		const auto& deck = *room->decks[role == Role::HOST ? 0U : 1U];
+		std::vector<uint8_t> body;
+		Put<uint32_t>(body, static_cast<uint32_t>(deck.main.size()));
+		Put<uint32_t>(body, static_cast<uint32_t>(deck.side.size()));
+		for(const auto* part : {&deck.main, &deck.side})
+			for(auto code : *part)
+				Put<uint32_t>(body, code);
+		Send(MakeMsg(CTOSType::UPDATE_DECK, body.data(), body.size()));
+		Send(MakeMsg(CTOSType::READY));
+	}
+
+	void TryStart()
+	{
+		if(role == Role::HOST && room->joined == 2U + room->spectators)
+			Send(MakeMsg(CTOSType::TRY_START));
+	}
+
+	void Chat()
+	{
+		static const std::string text = "Fleet client saying hi";
+		std::vector<uint8_t> body;
+		for(char c : text)
+			Put<uint16_t>(body, static_cast<uint8_t>(c));
+		Put<uint16_t>(body, 0U);
+		Send(MakeMsg(CTOSType::CHAT, body.data(), body.size()));
+	}
+
+	// Returns whether the connection should be kept open.
+	bool HandleMsg(STOCType type, const uint8_t* data, std::size_t size)
+	{
+		switch(type)
+		{
+		case STOCType::CREATE_GAME:
+		{
+			room->id = Read<uint32_t>(data);
+			break;
+		}
+		case STOCType::JOIN_GAME:
+		{
+			t.join.samples.push_back(Clock::now() - start);
+			room->joined++;
+			if(role == Role::HOST)
+			{
+				std::make_shared<Client>(ioCtx, room, Role::OPPONENT, t)->Start();
+				for(std::size_t i = 0U; i < room->spectators; i++)
+					std::make_shared<Client>(ioCtx, room, Role::SPECTATOR, t)->Start();
+			}
+			if(role != Role::SPECTATOR)
+				Ready();
+			TryStart();
+			break;
+		}
+		case STOCType::PLAYER_CHANGE:
+		case STOCType::WATCH_CHANGE:
+		{
+			TryStart();
+			break;
+		}
+		case STOCType::DUEL_START:
+		{
+			if(role == Role::HOST)
+				room->duelStart = Clock::now();
+			break;
+		}
+		case STOCType::CHOOSE_RPS:
+		{
+			Send(MakeMsg(CTOSType::RPS_CHOICE, YGOPro::CTOSMsg::RPSChoice{static_cast<uint8_t>(1U + rng() % 3U)}));
+			break;
+		}
+		case STOCType::CHOOSE_ORDER:
+		{
+			Send(MakeMsg(CTOSType::TURN_CHOICE, YGOPro::CTOSMsg::TurnChoice{1U}));
+			break;
+		}
+		case STOCType::GAME_MSG:
+		{
+			if(responded)
+			{
+				t.response.samples.push_back(Clock::now() - *responded);
+				responded.reset();
+			}
+			if(role == Role::SPECTATOR || size == 0U)
+				break;
+			if(!YGOPro::CoreUtils::DoesMessageRequireAnswer(data[0U]))
+				break;
+			const auto r = Respond(data, size);
+			if(!r)
+			{
+				t.surrenders++;
+				Send(MakeMsg(CTOSType::SURRENDER));
+				break;
+			}
+			Send(MakeMsg(CTOSType::RESPONSE, r->data(), r->size()));
+			responded = Clock::now();
+			t.responses++;
+			if(++responses % RESPONSES_PER_CHAT == 0U)
+				Chat();
+			break;
+		}
+		case STOCType::REMATCH:
+		{
+			Send(MakeMsg(CTOSType::REMATCH, YGOPro::CTOSMsg::Rematch{0U}));
+			break;
+		}
+		case STOCType::DUEL_END:
+		{
+			if(role == Role::HOST)
+			{
+				t.duels++;
+				t.duel.samples.push_back(Clock::now() - room->duelStart);
+			}
+			return false;
+		}
+		case STOCType::ERROR_MSG:
+		{
+			t.errors++;
+			break;
+		}
+		default:
+			break;
+		}
+		return true;
+	}
+};
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+	if(argc < 6)
+	{
+		std::fprintf(stderr, "Usage: %s <address> <port> <rooms> <spectators per room> <deck.ydk>...\n", argv[0]);
+		return 1;
+	}
+	std::vector<Deck> decks;
+	for(int i = 5; i < argc; i++)
+	{
+		if(Deck d{}; LoadYdk(argv[i], d))
+			decks.push_back(std::move(d));
+		else
+			std::fprintf(stderr, "Skipping %s, unable to read it\n", argv[i]);
+	}
+	if(decks.empty())
+		return 1;
+	io_context ioCtx;
+	ip::tcp::resolver resolver(ioCtx);
+	boost::system::error_code ec;
+	const auto results = resolver.resolve(argv[1], argv[2], ec);
+	if(ec || results.empty())
+	{
+		std::fprintf(stderr, "Unable to resolve %s:%s\n", argv[1], argv[2]);
+		return 1;
+	}
+	const std::size_t rooms = std::strtoul(argv[3], nullptr, 10);
+	const std::size_t spectators = std::strtoul(argv[4], nullptr, 10);
+	Totals t{};
+	for(std::size_t i = 0U; i < rooms; i++)
+	{
+		auto room = std::make_shared<Room>();
+		room->endpoint = results.begin()->endpoint();
+		room->decks[0U] = &decks[(2U * i) % decks.size()];
+		room->decks[1U] = &decks[(2U * i + 1U) % decks.size()];
+		room->spectators = spectators;
+		std::make_shared<Client>(ioCtx, std::move(room), Client::Role::HOST, t)->Start();
+	}
+	const auto start = Clock::now();
+	ioCtx.run();
+	const double secs = std::chrono::duration<double>(Clock::now() - start).count();
+	std::printf("%zu/%zu duels finished in %.2fs, %zu surrenders, %zu errors\n",
+		t.duels, rooms, secs, t.surrenders, t.errors);
+	std::printf("%.1f duels/s, %.1f responses/s, %.1f messages/s, %.1f KiB/s received\n",
+		static_cast<double>(t.duels) / secs,
+		static_cast<double>(t.responses) / secs,
+		static_cast<double>(t.messages) / secs,
+		static_cast<double>(t.bytes) / 1024.0 / secs);
+	for(const auto* s : {&t.join, &t.response, &t.duel})
+		s->Print();
+	return 0;
+}
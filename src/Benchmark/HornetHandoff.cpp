@@ -0,0 +1,65 @@
+// Measures round-trip latency of the handoff used between multirole and
+// hornet, by bouncing actions between two processes over a SharedSegment.
+// Built twice, once for each handoff flavor, so they can be compared.
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <vector>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <boost/interprocess/anonymous_shared_memory.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include "../HornetCommon.hpp"
+
+int main(int argc, char* argv[])
+{
+	using namespace Ignis::Hornet;
+	using Clock = std::chrono::steady_clock;
+	const std::size_t iterations = (argc > 1) ? std::strtoul(argv[1], nullptr, 10) : 100000U;
+	ipc::mapped_region r = ipc::anonymous_shared_memory(sizeof(SharedSegment));
+	auto* ss = new (r.get_address()) SharedSegment();
+	const pid_t pid = fork();
+	if(pid < 0)
+		return 1;
+	if(pid == 0) // Behaves like hornet's main loop.
+	{
+		for(;;)
+		{
+			const auto act = WaitWhile(*ss, Action::NO_WORK);
+			Post(*ss, Action::NO_WORK);
+			if(act == Action::EXIT)
+				std::_Exit(0);
+		}
+	}
+	std::vector<Clock::duration> samples;
+	samples.reserve(iterations);
+	for(std::size_t i = 0U; i < iterations; i++)
+	{
+		const auto start = Clock::now();
+		Post(*ss, Action::HEARTBEAT);
+		WaitWhile(*ss, Action::HEARTBEAT);
+		samples.emplace_back(Clock::now() - start);
+	}
+	Post(*ss, Action::EXIT);
+	waitpid(pid, nullptr, 0);
+	ss->~SharedSegment();
+	if(samples.empty())
+		return 0;
+	std::sort(samples.begin(), samples.end());
+	auto Ns = [&](double q) -> long long
+	{
+		const auto idx = static_cast<std::size_t>(q * static_cast<double>(samples.size() - 1U));
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(samples[idx]).count();
+	};
+#ifdef HORNET_SPIN_HANDOFF
+	const char* flavor = "spin";
+#else
+	const char* flavor = "condvar";
+#endif // HORNET_SPIN_HANDOFF
+	std::printf("%s: %zu round-trips, p50 %lldns, p90 %lldns, p99 %lldns, max %lldns\n",
+		flavor, samples.size(), Ns(0.5), Ns(0.9), Ns(0.99), Ns(1.0));
+	return 0;
+}
@@ -0,0 +1,383 @@
+// Measures the protocol and rules code that runs for every message or deck
+// a room handles, each on its own, using the messages, query buffers,
+// duelist names and decks found on a corpus of replays saved by multirole,
+// so that changes to CoreUtils and friends can be compared in isolation.
+// The replays must have been saved uncompressed, that is, with the "none"
+// codec for diskCompression.
+// Usage: bench-hot-paths <cdb> <lflist.conf> <replay>...
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "../Multirole/YGOPro/CardDatabase.hpp"
+#include "../Multirole/YGOPro/Constants.hpp"
+#include "../Multirole/YGOPro/CoreUtils.hpp"
+#include "../Multirole/YGOPro/Deck.hpp"
+#include "../Multirole/YGOPro/LegalityTable.hpp"
+#include "../Multirole/YGOPro/Replay.hpp"
+#include "../Multirole/YGOPro/STOCMsg.hpp"
+#include "../Multirole/YGOPro/StringUtils.hpp"
+#define YGOPRO_BANLIST_PARSER_IMPLEMENTATION
+#include "../Multirole/YGOPro/BanlistParser.hpp"
+
+namespace
+{
+
+using namespace YGOPro::CoreUtils;
+using Clock = std::chrono::steady_clock;
+
+#include "../Read.inl"
+
+// Same as the one written by YGOPro::Replay.
+struct ReplayHeader
+{
+	uint32_t type;
+	uint32_t version;
+	uint32_t flags;
+	uint32_t seed;
+	uint32_t size;
+	uint32_t hash;
+	uint8_t props[8];
+};
+
+constexpr uint32_t REPLAY_COMPRESSED = 0x1U;
+constexpr uint32_t REPLAY_ZSTD_COMPRESSED = 0x80000000U;
+constexpr uint8_t OLD_REPLAY_FORMAT = 231U;
+constexpr auto MIN_RUN_TIME = std::chrono::milliseconds(500);
+
+// What's taken out of a replay to feed the benchmarks.
+struct Fixture
+{
+	std::vector<uint8_t> buffer; // Messages as the core gives them.
+	std::vector<Msg> msgs;
+	std::vector<QueryBuffer> queries; // Out of MSG_UPDATE_DATA.
+	std::vector<std::u16string> names;
+	std::vector<YGOPro::Replay::Duelist> duelists; // Without names.
+	std::array<uint32_t, 2U> teamCounts;
+	std::vector<uint32_t> extraCards;
+	std::vector<std::vector<uint8_t>> responses;
+	uint32_t seed;
+};
+
+bool Load(const std::string& file, Fixture& fx)
+{
+	std::ifstream f(file, std::ios_base::binary);
+	const std::vector<uint8_t> bytes{std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>()};
+	if(bytes.size() < sizeof(ReplayHeader))
+		return false;
+	const uint8_t* ptr = bytes.data();
+	const auto h = Read<ReplayHeader>(ptr);
+	if((h.flags & (REPLAY_COMPRESSED | REPLAY_ZSTD_COMPRESSED)) != 0U ||
+	   bytes.size() - sizeof(ReplayHeader) != h.size)
+		return false;
+	const uint8_t* end = bytes.data() + bytes.size();
+	for(auto& count : fx.teamCounts)
+	{
+		count = Read<uint32_t>(ptr);
+		for(uint32_t i = 0U; i < count; i++)
+		{
+			std::array<char16_t, 20U> name{};
+			std::memcpy(name.data(), ptr, sizeof(name));
+			ptr += sizeof(name);
+			const auto nameEnd = std::find(name.cbegin(), name.cend(), u'\0');
+			fx.names.emplace_back(name.cbegin(), nameEnd);
+		}
+	}
+	ptr += sizeof(uint64_t); // Duel flags.
+	const uint8_t* yrp = nullptr;
+	while(ptr + 5U <= end)
+	{
+		const auto type = Read<uint8_t>(ptr);
+		const auto length = Read<uint32_t>(ptr);
+		if(ptr + length > end)
+			return false;
+		if(type == OLD_REPLAY_FORMAT)
+		{
+			yrp = ptr;
+			ptr += length;
+			continue;
+		}
+		// Rebuild the message along with the length the core prefixes.
+		auto& msg = fx.msgs.emplace_back(1U + length);
+		msg[0U] = type;
+		std::memcpy(msg.data() + 1U, ptr, length);
+		const auto size = static_cast<uint32_t>(msg.size());
+		const auto offset = fx.buffer.size();
+		fx.buffer.resize(offset + sizeof(size) + msg.size());
+		std::memcpy(fx.buffer.data() + offset, &size, sizeof(size));
+		std::memcpy(fx.buffer.data() + offset + sizeof(size), msg.data(), msg.size());
+		// NOTE: con<1> + loc<1> go before the buffer.
+		if(type == MSG_UPDATE_DATA && length > 2U)
+			fx.queries.emplace_back(ptr + 2U, ptr + length);
+		ptr += length;
+	}
+	if(yrp == nullptr)
+		return false;
+	// Decks and responses are only found on the YRP.
+	ptr = yrp;
+	const auto yh = Read<ReplayHeader>(ptr);
+	end = ptr + yh.size;
+	fx.seed = yh.seed;
+	for(const auto count : fx.teamCounts)
+		ptr += sizeof(uint32_t) + 40U * count;
+	ptr += 3U * sizeof(uint32_t) + sizeof(uint64_t); // LP, draws and flags.
+	auto ReadCodes = [&](std::vector<uint32_t>& codes)
+	{
+		codes.resize(Read<uint32_t>(ptr));
+		for(auto& code : codes)
+			code = Read<uint32_t>(ptr);
+	};
+	for(std::size_t i = 0U; i < fx.names.size(); i++)
+	{
+		auto& d = fx.duelists.emplace_back();
+		ReadCodes(d.main);
+		ReadCodes(d.extra);
+	}
+	ReadCodes(fx.extraCards);
+	while(ptr < end)
+	{
+		const auto size = Read<uint8_t>(ptr);
+		fx.responses.emplace_back(ptr, ptr + size);
+		ptr += size;
+	}
+	return ptr == end;
+}
+
+// Calls `f` over the whole corpus until enough time went by, then prints
+// how long each of the `ops` operations `f` does per call took.
+template<typename F>
+void Run(const char* name, std::size_t ops, F&& f)
+{
+	if(ops == 0U)
+	{
+		std::printf("%-24s skipped, nothing to run it on\n", name);
+		return;
+	}
+	f(); // Warm up.
+	std::size_t rounds = 0U;
+	const auto start = Clock::now();
+	Clock::duration elapsed{};
+	do
+	{
+		f();
+		rounds++;
+	}
+	while((elapsed = Clock::now() - start) < MIN_RUN_TIME);
+	const double ns = std::chrono::duration<double, std::nano>(elapsed).count();
+	std::printf("%-24s %10zu ops, %10.1fns per op\n",
+		name, rounds * ops, ns / static_cast<double>(rounds * ops));
+}
+
+// Mirrors Context::LoadDeck.
+std::unique_ptr<YGOPro::Deck> LoadDeck(const YGOPro::CardDatabase& cdb, const YGOPro::Replay::Duelist& d)
+{
+	YGOPro::CodeVector codes;
+	codes.reserve(d.main.size() + d.extra.size());
+	codes.insert(codes.end(), d.main.begin(), d.main.end());
+	codes.insert(codes.end(), d.extra.begin(), d.extra.end());
+	const auto summaries = cdb.Summarize(codes);
+	YGOPro::CodeVector m;
+	YGOPro::CodeVector e;
+	uint32_t err = 0U;
+	for(const auto& summary : summaries)
+	{
+		if(summary.code == 0U)
+		{
+			err = 1U;
+			continue;
+		}
+		if((summary.type & TYPE_TOKEN) != 0U)
+			continue;
+		if((summary.type & (TYPE_FUSION | TYPE_SYNCHRO | TYPE_XYZ)) != 0U ||
+		   ((summary.type & TYPE_LINK) != 0U && (summary.type & TYPE_MONSTER) != 0U))
+			e.push_back(summary.code);
+		else
+			m.push_back(summary.code);
+	}
+	return std::make_unique<YGOPro::Deck>(std::move(m), std::move(e), YGOPro::CodeVector{}, err);
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+	if(argc < 4)
+	{
+		std::fprintf(stderr, "Usage: %s <cdb> <lflist.conf> <uncompressed replay>...\n", argv[0]);
+		return 1;
+	}
+	YGOPro::CardDatabase cdb;
+	if(!cdb.Merge(argv[1]))
+	{
+		std::fprintf(stderr, "Unable to merge %s\n", argv[1]);
+		return 1;
+	}
+	cdb.Seal();
+	std::string lflist;
+	{
+		std::ifstream f(argv[2]);
+		if(!f.is_open())
+		{
+			std::fprintf(stderr, "Unable to open %s\n", argv[2]);
+			return 1;
+		}
+		lflist.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+	}
+	std::vector<Fixture> corpus;
+	for(int i = 3; i < argc; i++)
+	{
+		if(Fixture fx{}; Load(argv[i], fx))
+			corpus.emplace_back(std::move(fx));
+		else
+			std::fprintf(stderr, "Skipping %s, not an uncompressed replay\n", argv[i]);
+	}
+	if(corpus.empty())
+		return 1;
+	std::size_t msgCount = 0U;
+	std::size_t queryCount = 0U;
+	std::size_t nameCount = 0U;
+	std::size_t deckCount = 0U;
+	for(const auto& fx : corpus)
+	{
+		msgCount += fx.msgs.size();
+		queryCount += fx.queries.size();
+		nameCount += fx.names.size();
+		deckCount += fx.duelists.size();
+	}
+	std::printf("%zu replays, %zu messages, %zu queries, %zu decks\n",
+		corpus.size(), msgCount, queryCount, deckCount);
+	// Keeps the results alive so that nothing is optimized away.
+	std::size_t sunk = 0U;
+	Run("SplitToMsgs", msgCount, [&]()
+	{
+		for(const auto& fx : corpus)
+			sunk += SplitToMsgs(fx.buffer.data(), fx.buffer.size()).size();
+	});
+	Run("IterateMsgs", msgCount, [&]()
+	{
+		for(const auto& fx : corpus)
+			for(const auto msg : IterateMsgs(fx.buffer.data(), fx.buffer.size()))
+				sunk += msg.size();
+	});
+	Run("StripMessageForTeam", 2U * msgCount, [&]()
+	{
+		Msg out;
+		for(const auto& fx : corpus)
+		{
+			for(const auto& msg : fx.msgs)
+			{
+				for(uint8_t team = 0U; team < 2U; team++)
+				{
+					StripMessageForTeam(team, MsgView(msg.data(), msg.size()), out);
+					sunk += out.size();
+				}
+			}
+		}
+	});
+	Run("DeserializeLocationQuery", queryCount, [&]()
+	{
+		for(const auto& fx : corpus)
+			for(const auto& qb : fx.queries)
+				sunk += DeserializeLocationQueryBuffer(qb).size();
+	});
+	std::vector<QueryOptVector> deserialized;
+	for(const auto& fx : corpus)
+		for(const auto& qb : fx.queries)
+			deserialized.emplace_back(DeserializeLocationQueryBuffer(qb));
+	Run("SerializeLocationQuery", 2U * queryCount, [&]()
+	{
+		for(const auto& qs : deserialized)
+			sunk += SerializeLocationQuery(qs, false).size() + SerializeLocationQuery(qs, true).size();
+	});
+	Run("STOCMsg construct", msgCount, [&]()
+	{
+		for(const auto& fx : corpus)
+			for(const auto& msg : fx.msgs)
+				sunk += YGOPro::STOCMsg(YGOPro::STOCMsg::MsgType::GAME_MSG, msg).Length();
+	});
+	std::vector<YGOPro::STOCMsg> stocMsgs;
+	for(const auto& fx : corpus)
+		for(const auto& msg : fx.msgs)
+			stocMsgs.emplace_back(YGOPro::STOCMsg::MsgType::GAME_MSG, msg);
+	Run("STOCMsg copy", stocMsgs.size(), [&]()
+	{
+		for(const auto& msg : stocMsgs)
+			sunk += YGOPro::STOCMsg(msg).Length();
+	});
+	Run("UTF16ToUTF8", nameCount, [&]()
+	{
+		std::string out;
+		for(const auto& fx : corpus)
+		{
+			for(const auto& name : fx.names)
+			{
+				out.clear();
+				YGOPro::UTF16ToUTF8(name, out);
+				sunk += out.size();
+			}
+		}
+	});
+	Run("ParseForBanlists", 1U, [&]()
+	{
+		YGOPro::BanlistMap banlists;
+		std::istringstream stream(lflist);
+		YGOPro::ParseForBanlists(stream, banlists);
+		sunk += banlists.size();
+	});
+	YGOPro::BanlistMap banlists;
+	{
+		std::istringstream stream(lflist);
+		YGOPro::ParseForBanlists(stream, banlists);
+	}
+	const YGOPro::BanlistPtr banlist = banlists.empty() ? nullptr : banlists.begin()->second;
+	const auto legality = cdb.Legality(banlist, YGOPro::ALLOWED_CARDS_OCG_TCG, 0);
+	Run("LoadDeck", deckCount, [&]()
+	{
+		for(const auto& fx : corpus)
+			for(const auto& d : fx.duelists)
+				sunk += LoadDeck(cdb, d)->Main().size();
+	});
+	std::vector<std::unique_ptr<YGOPro::Deck>> decks;
+	for(const auto& fx : corpus)
+		for(const auto& d : fx.duelists)
+			decks.emplace_back(LoadDeck(cdb, d));
+	Run("LegalityTable::Check", decks.size(), [&]()
+	{
+		for(const auto& deck : decks)
+			sunk += static_cast<std::size_t>(legality->Check(*deck).verdict);
+	});
+	Run("Replay::Serialize", corpus.size(), [&]()
+	{
+		for(const auto& fx : corpus)
+		{
+			YGOPro::HostInfo info{};
+			YGOPro::Replay replay(0U, fx.seed, info, fx.extraCards);
+			std::size_t i = 0U;
+			for(uint8_t team = 0U; team < 2U; team++)
+			{
+				for(uint8_t pos = 0U; pos < fx.teamCounts[team]; pos++, i++)
+				{
+					auto d = fx.duelists[i];
+					d.name = YGOPro::UTF16ToUTF8(fx.names[i]);
+					replay.AddDuelist(team, pos, std::move(d));
+				}
+			}
+			for(const auto& msg : fx.msgs)
+				replay.RecordMsg(msg);
+			for(const auto& response : fx.responses)
+				replay.RecordResponse(response);
+			replay.Serialize({YGOPro::Replay::Codec::NONE, -1});
+			sunk += replay.Bytes().size();
+		}
+	});
+	std::printf("%zu\n", sunk % 2U); // See `sunk`.
+	return 0;
+}
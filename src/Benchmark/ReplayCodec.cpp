@@ -0,0 +1,59 @@
+// Measures how long each replay codec takes to compress a corpus of real
+// replays and how small it leaves them. The replays must have been saved
+// uncompressed, that is, with the "none" codec for diskCompression.
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+#include "../Multirole/YGOPro/Replay.hpp"
+
+int main(int argc, char* argv[])
+{
+	using Clock = std::chrono::steady_clock;
+	using Codec = YGOPro::Replay::Codec;
+	std::vector<std::vector<uint8_t>> corpus;
+	std::size_t corpusSize = 0U;
+	for(int i = 1; i < argc; i++)
+	{
+		std::ifstream f(argv[i], std::ios_base::binary);
+		if(!f.is_open())
+		{
+			std::fprintf(stderr, "Unable to open %s\n", argv[i]);
+			return 1;
+		}
+		auto& raw = corpus.emplace_back(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+		corpusSize += raw.size();
+	}
+	if(corpus.empty())
+	{
+		std::fprintf(stderr, "Usage: %s <uncompressed replay>...\n", argv[0]);
+		return 1;
+	}
+	const std::vector<std::pair<const char*, YGOPro::Replay::Compression>> codecs =
+	{
+		{"lzma", {Codec::LZMA, 1}},
+		{"lzma", {Codec::LZMA, 5}},
+		{"lzma", {Codec::LZMA, 9}},
+#ifdef MULTIROLE_ZSTD
+		{"zstd", {Codec::ZSTD, 1}},
+		{"zstd", {Codec::ZSTD, 3}},
+		{"zstd", {Codec::ZSTD, 9}},
+		{"zstd", {Codec::ZSTD, 19}},
+#endif // MULTIROLE_ZSTD
+	};
+	std::printf("%zu replays, %zu bytes\n", corpus.size(), corpusSize);
+	for(const auto& [name, comp] : codecs)
+	{
+		std::size_t compSize = 0U;
+		const auto start = Clock::now();
+		for(const auto& raw : corpus)
+			compSize += YGOPro::Replay::Compress(raw, comp).size();
+		const auto ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+		std::printf("%s level %d: %.1fms, %.1fms per replay, %zu bytes (%.1f%%)\n",
+			name, comp.level, ms, ms / static_cast<double>(corpus.size()), compSize,
+			100.0 * static_cast<double>(compSize) / static_cast<double>(corpusSize));
+	}
+	return 0;
+}
@@ -0,0 +1,470 @@
+// Plays back a corpus of replays saved by multirole on a core, feeding the
+// recorded responses and running every message through what rooms do with
+// them (distributing, stripping and querying) against a sink that drops
+// them, so that changes to the wrappers or CoreUtils can be measured.
+// Usage: bench-replay-core <shared|hornet> <core> <script dir> <cdb[,cdb...]> <replay>...
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <lzma.h>
+#ifdef MULTIROLE_ZSTD
+#include <zstd.h>
+#endif // MULTIROLE_ZSTD
+
+#include "../Multirole/Core/DLWrapper.hpp"
+#include "../Multirole/Core/HornetWrapper.hpp"
+#include "../Multirole/Core/IScriptSupplier.hpp"
+#include "../Multirole/YGOPro/CardDatabase.hpp"
+#include "../Multirole/YGOPro/Constants.hpp"
+#include "../Multirole/YGOPro/CoreUtils.hpp"
+#include "../Multirole/YGOPro/STOCMsg.hpp"
+
+namespace
+{
+
+using namespace Ignis::Multirole;
+using namespace YGOPro::CoreUtils;
+using Clock = std::chrono::steady_clock;
+
+#include "../Read.inl"
+
+// Same as the one written by YGOPro::Replay.
+struct ReplayHeader
+{
+	uint32_t type;
+	uint32_t version;
+	uint32_t flags;
+	uint32_t seed;
+	uint32_t size;
+	uint32_t hash;
+	uint8_t props[8];
+};
+
+constexpr uint32_t REPLAY_COMPRESSED = 0x1U;
+constexpr uint32_t REPLAY_ZSTD_COMPRESSED = 0x80000000U;
+constexpr uint8_t OLD_REPLAY_FORMAT = 231U;
+
+// What's needed out of a YRP to play its duel again.
+struct Duel
+{
+	std::string file;
+	uint32_t seed;
+	uint64_t flags;
+	OCG_Player player;
+	std::array<uint32_t, 2U> teamCounts;
+	std::vector<std::vector<uint32_t>> mains; // In (team, pos) order.
+	std::vector<std::vector<uint32_t>> extras;
+	std::vector<uint32_t> extraCards;
+	std::vector<std::vector<uint8_t>> responses;
+};
+
+class ScriptDir final : public Core::IScriptSupplier
+{
+public:
+	ScriptDir(const std::string& path)
+	{
+		using namespace boost::filesystem;
+		for(const auto& e : recursive_directory_iterator(path))
+		{
+			if(!is_regular_file(e) || e.path().extension() != ".lua")
+				continue;
+			std::ifstream f(e.path().string(), std::ios_base::binary);
+			scripts.emplace(e.path().filename().string(), std::make_shared<const std::string>(
+				std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>()));
+		}
+	}
+
+	Script ScriptFromFilePath(std::string_view fp) const override
+	{
+		if(const auto it = scripts.find(std::string(fp)); it != scripts.end())
+			return it->second;
+		return nullptr;
+	}
+
+	std::string SharedTableName() const override
+	{
+		return {};
+	}
+private:
+	std::unordered_map<std::string, Script> scripts;
+};
+
+bool Decompress(const ReplayHeader& h, const uint8_t* data, std::size_t size, std::vector<uint8_t>& out)
+{
+	out.resize(h.size);
+	if((h.flags & REPLAY_COMPRESSED) != 0U)
+	{
+		// Rebuild the header of the .lzma format, which the SDK leaves out.
+		std::vector<uint8_t> in(13U + size);
+		std::memcpy(in.data(), h.props, 5U);
+		const uint64_t rawSize = h.size;
+		std::memcpy(in.data() + 5U, &rawSize, sizeof(rawSize));
+		std::memcpy(in.data() + 13U, data, size);
+		lzma_stream s = LZMA_STREAM_INIT;
+		if(lzma_alone_decoder(&s, UINT64_MAX) != LZMA_OK)
+			return false;
+		s.next_in = in.data();
+		s.avail_in = in.size();
+		s.next_out = out.data();
+		s.avail_out = out.size();
+		const lzma_ret r = lzma_code(&s, LZMA_FINISH);
+		lzma_end(&s);
+		return (r == LZMA_OK || r == LZMA_STREAM_END) && s.avail_out == 0U;
+	}
+	if((h.flags & REPLAY_ZSTD_COMPRESSED) != 0U)
+	{
+#ifdef MULTIROLE_ZSTD
+		return ZSTD_decompress(out.data(), out.size(), data, size) == out.size();
+#else
+		return false;
+#endif // MULTIROLE_ZSTD
+	}
+	if(size != h.size)
+		return false;
+	std::memcpy(out.data(), data, size);
+	return true;
+}
+
+// Reads the YRP carried inside a YRPX as its last message.
+bool Load(const std::string& file, Duel& d)
+{
+	std::ifstream f(file, std::ios_base::binary);
+	const std::vector<uint8_t> bytes{std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>()};
+	if(bytes.size() < sizeof(ReplayHeader))
+		return false;
+	const uint8_t* ptr = bytes.data();
+	const auto h = Read<ReplayHeader>(ptr);
+	std::vector<uint8_t> body;
+	if(!Decompress(h, ptr, bytes.size() - sizeof(ReplayHeader), body))
+		return false;
+	// Skip duelists and duel flags, then look for the YRP.
+	ptr = body.data();
+	const uint8_t* end = body.data() + body.size();
+	for(int team = 0; team < 2; team++)
+		ptr += 40U * Read<uint32_t>(ptr);
+	ptr += sizeof(uint64_t);
+	const uint8_t* yrp = nullptr;
+	uint32_t yrpSize = 0U;
+	while(ptr + 5U <= end)
+	{
+		const auto type = Read<uint8_t>(ptr);
+		const auto length = Read<uint32_t>(ptr);
+		if(type == OLD_REPLAY_FORMAT)
+		{
+			yrp = ptr;
+			yrpSize = length;
+		}
+		ptr += length;
+	}
+	if(yrp == nullptr || yrpSize < sizeof(ReplayHeader))
+		return false;
+	ptr = yrp;
+	end = yrp + yrpSize;
+	d.file = file;
+	d.seed = Read<ReplayHeader>(ptr).seed;
+	for(auto& count : d.teamCounts)
+	{
+		count = Read<uint32_t>(ptr);
+		ptr += 40U * count;
+	}
+	d.player.startingLP = Read<uint32_t>(ptr);
+	d.player.startingDrawCount = Read<uint32_t>(ptr);
+	d.player.drawCountPerTurn = Read<uint32_t>(ptr);
+	d.flags = Read<uint64_t>(ptr);
+	auto ReadCodes = [&](std::vector<uint32_t>& codes)
+	{
+		codes.resize(Read<uint32_t>(ptr));
+		for(auto& code : codes)
+			code = Read<uint32_t>(ptr);
+	};
+	const std::size_t duelists = d.teamCounts[0U] + d.teamCounts[1U];
+	d.mains.resize(duelists);
+	d.extras.resize(duelists);
+	for(std::size_t i = 0U; i < duelists; i++)
+	{
+		ReadCodes(d.mains[i]);
+		ReadCodes(d.extras[i]);
+	}
+	ReadCodes(d.extraCards);
+	while(ptr < end)
+	{
+		const auto size = Read<uint8_t>(ptr);
+		d.responses.emplace_back(ptr, ptr + size);
+		ptr += size;
+	}
+	return ptr == end;
+}
+
+// Time taken by every call made on one stage.
+struct Stage
+{
+	const char* name;
+	std::vector<Clock::duration> samples;
+
+	template<typename F>
+	auto Time(F&& f)
+	{
+		struct Done
+		{
+			Stage& s;
+			Clock::time_point start;
+			~Done()
+			{
+				s.samples.push_back(Clock::now() - start);
+			}
+		} done{*this, Clock::now()};
+		return f();
+	}
+
+	void Print() const
+	{
+		if(samples.empty())
+			return;
+		auto sorted = samples;
+		std::sort(sorted.begin(), sorted.end());
+		auto Us = [&](double q) -> double
+		{
+			const auto idx = static_cast<std::size_t>(q * static_cast<double>(sorted.size() - 1U));
+			return std::chrono::duration<double, std::micro>(sorted[idx]).count();
+		};
+		std::printf("%-10s %9zu calls, p50 %8.1fus, p90 %8.1fus, p99 %8.1fus, max %8.1fus\n",
+			name, sorted.size(), Us(0.5), Us(0.9), Us(0.99), Us(1.0));
+	}
+};
+
+struct Totals
+{
+	std::size_t duels;
+	std::size_t messages;
+	std::size_t sunk; // Bytes that would have been sent.
+	Stage create{"create", {}};
+	Stage core{"core", {}};
+	Stage distribute{"distribute", {}};
+	Stage query{"query", {}};
+	Stage duel{"duel", {}};
+};
+
+// Mirrors Context::Process as far as the core and the messages go.
+void Play(Core::IWrapper& core, YGOPro::CardDatabase& cdb, ScriptDir& scripts, const Duel& d, Totals& t)
+{
+	using DuelStatus = Core::IWrapper::DuelStatus;
+	auto Sink = [&](const YGOPro::STOCMsg& msg)
+	{
+		t.sunk += msg.Length();
+	};
+	auto GameMsg = [](MsgView msg)
+	{
+		return YGOPro::STOCMsg{YGOPro::STOCMsg::MsgType::GAME_MSG, msg.data(), msg.size()};
+	};
+	void* duel = t.create.Time([&]()
+	{
+		void* duel = core.CreateDuel({cdb, scripts, nullptr, d.seed, d.flags, d.player, d.player});
+		for(const auto* file : {"constant.lua", "utility.lua"})
+			if(auto scr = scripts.ScriptFromFilePath(file); scr && !scr->empty())
+				core.LoadScript(duel, file, *scr);
+		std::vector<OCG_NewCardInfo> cards;
+		OCG_NewCardInfo nci{};
+		nci.pos = POS_FACEDOWN_DEFENSE;
+		for(auto code : d.extraCards)
+		{
+			nci.code = code;
+			cards.push_back(nci);
+		}
+		std::size_t i = 0U;
+		for(uint8_t team = 0U; team < 2U; team++)
+		{
+			for(uint8_t pos = 0U; pos < d.teamCounts[team]; pos++, i++)
+			{
+				nci.team = nci.con = team;
+				nci.duelist = pos;
+				nci.loc = LOCATION_DECK;
+				for(auto code : d.mains[i])
+				{
+					nci.code = code;
+					cards.push_back(nci);
+				}
+				nci.loc = LOCATION_EXTRA;
+				for(auto code : d.extras[i])
+				{
+					nci.code = code;
+					cards.push_back(nci);
+				}
+			}
+		}
+		core.AddCards(duel, cards);
+		core.Start(duel);
+		return duel;
+	});
+	std::vector<QueryRequest> pending;
+	QueryBuffer owner;
+	QueryBuffer stripped;
+	std::array<Msg, 3U> strippedMsgs;
+	auto Flush = [&]()
+	{
+		t.query.Time([&]()
+		{
+			for(const auto& reqVar : pending)
+			{
+				if(std::holds_alternative<QuerySingleRequest>(reqVar))
+				{
+					const auto& req = std::get<QuerySingleRequest>(reqVar);
+					const auto full = core.Query(duel, {req.flags, req.con, req.loc, req.seq, 0U});
+					TranscodeSingleQuery(full, owner, stripped);
+					Sink(GameMsg(MakeUpdateCardMsg(req.con, req.loc, req.seq, owner)));
+					Sink(GameMsg(MakeUpdateCardMsg(req.con, req.loc, req.seq, stripped)));
+					continue;
+				}
+				const auto& req = std::get<QueryLocationRequest>(reqVar);
+				const auto full = core.QueryLocation(duel, {req.flags, req.con, req.loc, 0U, 0U});
+				if(req.loc == LOCATION_DECK)
+					continue;
+				if(req.loc == LOCATION_EXTRA)
+				{
+					Sink(GameMsg(MakeUpdateDataMsg(req.con, req.loc, full)));
+					continue;
+				}
+				TranscodeLocationQuery(full, owner, stripped);
+				Sink(GameMsg(MakeUpdateDataMsg(req.con, req.loc, owner)));
+				Sink(GameMsg(MakeUpdateDataMsg(req.con, req.loc, stripped)));
+			}
+		});
+		pending.clear();
+	};
+	auto Queue = [&](const std::vector<QueryRequest>& qreqs)
+	{
+		for(const auto& reqVar : qreqs)
+			if(std::find(pending.begin(), pending.end(), reqVar) == pending.end())
+				pending.push_back(reqVar);
+	};
+	auto Distribute = [&](MsgView msg)
+	{
+		t.distribute.Time([&]()
+		{
+			switch(GetMessageDistributionType(msg))
+			{
+			case MsgDistType::MSG_DIST_TYPE_SPECIFIC_TEAM_DUELIST_STRIPPED:
+				StripMessageForTeam(GetMessageReceivingTeam(msg), msg, strippedMsgs[0U]);
+				Sink(GameMsg(strippedMsgs[0U]));
+				break;
+			case MsgDistType::MSG_DIST_TYPE_EVERYONE_STRIPPED:
+				StripMessageForEveryone(msg, strippedMsgs[0U], strippedMsgs[1U], strippedMsgs[2U]);
+				for(const auto& sMsg : strippedMsgs)
+					Sink(GameMsg(sMsg));
+				break;
+			default:
+				Sink(GameMsg(msg));
+				break;
+			}
+		});
+	};
+	t.duel.Time([&]()
+	{
+		std::size_t response = 0U;
+		for(bool won = false; !won;)
+		{
+			const auto [status, view] = t.core.Time([&]()
+			{
+				return core.ProcessAndGetMessages(duel);
+			});
+			for(const auto msg : IterateMsgs(view.data, view.size))
+			{
+				t.messages++;
+				const auto preQreqs = GetPreDistQueryRequests(msg);
+				Queue(preQreqs);
+				const uint8_t msgType = GetMessageType(msg);
+				if(!preQreqs.empty() || msgType == MSG_WIN || DoesMessageRequireAnswer(msgType))
+					Flush();
+				Distribute(msg);
+				Queue(GetPostDistQueryRequests(msg));
+				won = won || msgType == MSG_WIN;
+			}
+			Flush();
+			if(status == DuelStatus::DUEL_STATUS_END)
+				break;
+			if(status == DuelStatus::DUEL_STATUS_WAITING)
+			{
+				if(response == d.responses.size())
+					break;
+				const auto& r = d.responses[response++];
+				core.SetResponse(duel, {r.data(), r.size()});
+			}
+		}
+	});
+	core.DestroyDuel(duel);
+	t.duels++;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+	if(argc < 6)
+	{
+		std::fprintf(stderr, "Usage: %s <shared|hornet> <core> <script dir> <cdb[,cdb...]> <replay>...\n", argv[0]);
+		return 1;
+	}
+	const std::string_view type = argv[1];
+	std::shared_ptr<Core::IWrapper> core;
+	if(type == "shared")
+		core = std::make_shared<Core::DLWrapper>(argv[2]);
+	else if(type == "hornet")
+		core = std::make_shared<Core::HornetWrapper>(argv[2]);
+	else
+	{
+		std::fprintf(stderr, "Unknown core type %s\n", argv[1]);
+		return 1;
+	}
+	ScriptDir scripts(argv[3]);
+	YGOPro::CardDatabase cdb;
+	for(std::string_view list = argv[4]; !list.empty();)
+	{
+		const auto comma = std::min(list.find(','), list.size());
+		if(!cdb.Merge(std::string(list.substr(0U, comma))))
+		{
+			std::fprintf(stderr, "Unable to merge %s\n", std::string(list.substr(0U, comma)).data());
+			return 1;
+		}
+		list.remove_prefix(std::min(comma + 1U, list.size()));
+	}
+	cdb.Seal();
+	if(type == "hornet")
+		cdb.PublishSharedTable();
+	std::vector<Duel> duels;
+	for(int i = 5; i < argc; i++)
+	{
+		if(Duel d{}; Load(argv[i], d))
+			duels.push_back(std::move(d));
+		else
+			std::fprintf(stderr, "Skipping %s, unable to read it\n", argv[i]);
+	}
+	Totals t{};
+	const auto start = Clock::now();
+	for(const auto& d : duels)
+	{
+		try
+		{
+			Play(*core, cdb, scripts, d, t);
+		}
+		catch(const std::exception& e)
+		{
+			std::fprintf(stderr, "Core exception on %s: %s\n", d.file.data(), e.what());
+		}
+	}
+	const double secs = std::chrono::duration<double>(Clock::now() - start).count();
+	std::printf("%zu duels, %zu messages, %zu bytes sunk in %.2fs\n", t.duels, t.messages, t.sunk, secs);
+	std::printf("%.1f duels/s, %.1f messages/s\n",
+		static_cast<double>(t.duels) / secs, static_cast<double>(t.messages) / secs);
+	for(const auto* s : {&t.create, &t.core, &t.distribute, &t.query, &t.duel})
+		s->Print();
+	return 0;
+}
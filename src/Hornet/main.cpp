@@ -1,18 +1,59 @@
 #ifndef _WIN32
 #include <csignal>
+#include <poll.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif // __linux__
 #endif // _WIN32
 
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 #include <boost/interprocess/shared_memory_object.hpp>
 #include <boost/interprocess/mapped_region.hpp>
-#include <boost/interprocess/sync/scoped_lock.hpp>
 
 #include "../DLOpen.hpp"
+#include "../HornetCardTable.hpp"
 #include "../HornetCommon.hpp"
+#include "../HornetScriptTable.hpp"
 #include "../ocgapi_types.h"
 #include "../Read.inl"
 #include "../Write.inl"
 
-static Ignis::Hornet::SharedSegment* hss{nullptr};
+// Slot served by the calling thread.
+static thread_local Ignis::Hornet::SharedSegment* hss{nullptr};
+static thread_local std::size_t hssIndex{0U};
+static const char* shmName{nullptr};
+
+// Overflow object of the slot served by the calling thread, only created
+// once a result doesn't fit in the segment.
+struct Overflow
+{
+	ipc::shared_memory_object shm;
+	ipc::mapped_region region;
+};
+static thread_local std::unique_ptr<Overflow> overflow;
+
+// Card and script tables published by multirole, mapped by name and kept
+// alive for as long as there is a duel using them.
+struct SharedTable
+{
+	ipc::shared_memory_object shm;
+	ipc::mapped_region region;
+};
+using SharedTablePtr = std::shared_ptr<SharedTable>;
+static std::unordered_map<std::string, std::weak_ptr<SharedTable>> sharedTables;
+static std::unordered_map<OCG_Duel, std::vector<SharedTablePtr>> duelTables;
+static std::mutex mSharedTables;
 
 // Shared object variables
 static void* handle{nullptr};
@@ -24,14 +65,8 @@ static void* handle{nullptr};
 // Methods
 void NotifyAndWait(Ignis::Hornet::Action act)
 {
-	Ignis::Hornet::Action recvAct = Ignis::Hornet::Action::NO_WORK;
-	{
-		Ignis::Hornet::LockType lock(hss->mtx);
-		hss->act = act;
-		hss->cv.notify_one();
-		hss->cv.wait(lock, [&](){return hss->act != act;});
-		recvAct = hss->act;
-	}
+	Ignis::Hornet::Post(*hss, act);
+	const auto recvAct = Ignis::Hornet::WaitWhile(*hss, act);
 	// The only scenario where this would not be CB_DONE is when
 	// multirole declares this horned as hanged. We have to terminate to
 	// guarantee that the resources will not be in usage when multirole
@@ -40,6 +75,60 @@ void NotifyAndWait(Ignis::Hornet::Action act)
 		std::terminate();
 }
 
+// Writes a length-prefixed result, spilling its data onto the overflow
+// object if it doesn't fit in the segment.
+void WriteSized(uint8_t* wptr, const uint8_t* data, uint32_t length)
+{
+	const auto size = static_cast<std::size_t>(length);
+	Write<uint32_t>(wptr, length);
+	if(size <= Ignis::Hornet::BytesLeft(*hss, wptr))
+	{
+		std::memcpy(wptr, data, size);
+		return;
+	}
+	if(!overflow || overflow->region.get_size() < size)
+	{
+		// Grow in 1 MiB steps to avoid remapping for every bigger result.
+		constexpr std::size_t STEP = 1U << 20U;
+		const auto name = Ignis::Hornet::OverflowName(shmName, hssIndex);
+		auto ovf = std::make_unique<Overflow>();
+		ovf->shm = ipc::shared_memory_object(ipc::open_or_create, name.data(), ipc::read_write);
+		ovf->shm.truncate(static_cast<ipc::offset_t>((size + STEP - 1U) / STEP * STEP));
+		ovf->region = ipc::mapped_region(ovf->shm, ipc::read_write);
+		overflow = std::move(ovf);
+	}
+	std::memcpy(overflow->region.get_address(), data, size);
+}
+
+// Reads length-prefixed data written by multirole, taking it from the
+// overflow object if it didn't fit in the segment. Returns null if the
+// overflow object couldn't be mapped.
+const uint8_t* ReadSized(const uint8_t* rptr, uint32_t& length)
+{
+	length = Read<uint32_t>(rptr);
+	const auto size = static_cast<std::size_t>(length);
+	if(size <= Ignis::Hornet::BytesLeft(*hss, rptr))
+		return rptr;
+	if(!overflow || overflow->region.get_size() < size)
+	{
+		try
+		{
+			const auto name = Ignis::Hornet::OverflowName(shmName, hssIndex);
+			auto ovf = std::make_unique<Overflow>();
+			ovf->shm = ipc::shared_memory_object(ipc::open_only, name.data(), ipc::read_write);
+			ovf->region = ipc::mapped_region(ovf->shm, ipc::read_write);
+			overflow = std::move(ovf);
+		}
+		catch(const ipc::interprocess_exception& e)
+		{
+			return nullptr;
+		}
+		if(overflow->region.get_size() < size)
+			return nullptr;
+	}
+	return static_cast<const uint8_t*>(overflow->region.get_address());
+}
+
 void DataReader(void* payload, uint32_t code, OCG_CardData* data)
 {
 	auto* wptr = hss->bytes.data();
@@ -50,26 +139,81 @@ void DataReader(void* payload, uint32_t code, OCG_CardData* data)
 	data->setcodes = reinterpret_cast<uint16_t*>(hss->bytes.data() + sizeof(OCG_CardData));
 }
 
+void TableDataReader(void* payload, uint32_t code, OCG_CardData* data)
+{
+	Ignis::Hornet::CardTableLookup(payload, code, *data);
+}
+
+void TableDataReaderDone(void* /*unused*/, OCG_CardData* /*unused*/)
+{}
+
+int TableScriptReader(void* payload, OCG_Duel duel, const char* name)
+{
+	const auto script = Ignis::Hornet::ScriptTableLookup(payload, name);
+	if(script.empty())
+		return 0;
+	return OCG_LoadScript(duel, script.data(), static_cast<uint32_t>(script.size()), name);
+}
+
+// Maps a table given its name and expected magic, both written by multirole
+// as part of the duel creation request.
+SharedTablePtr MapSharedTable(const uint8_t*& rptr, uint32_t magic)
+{
+	const auto nameSz = Read<std::size_t>(rptr);
+	if(nameSz == 0U)
+		return nullptr;
+	std::string name(reinterpret_cast<const char*>(rptr), nameSz);
+	rptr += nameSz;
+	std::scoped_lock lock(mSharedTables);
+	if(auto search = sharedTables.find(name); search != sharedTables.end())
+		if(auto table = search->second.lock(); table)
+			return table;
+	try
+	{
+		auto table = std::make_shared<SharedTable>();
+		table->shm = ipc::shared_memory_object(ipc::open_only, name.data(), ipc::read_only);
+		table->region = ipc::mapped_region(table->shm, ipc::read_only);
+		// NOTE: Both table headers start with their magic.
+		if(table->region.get_size() < sizeof(uint32_t) ||
+		   *static_cast<const uint32_t*>(table->region.get_address()) != magic)
+			return nullptr;
+		// Forget about tables that are no longer in use.
+		for(auto it = sharedTables.begin(); it != sharedTables.end();)
+			it = it->second.expired() ? sharedTables.erase(it) : std::next(it);
+		sharedTables[name] = table;
+		return table;
+	}
+	catch(const ipc::interprocess_exception& e)
+	{
+		// Fallback to calling back multirole instead.
+		return nullptr;
+	}
+}
+
 int ScriptReader(void* payload, OCG_Duel duel, const char* name)
 {
 	const std::size_t nameSz = std::strlen(name) + 1U;
 	auto* wptr = hss->bytes.data();
+	if(sizeof(void*) + sizeof(std::size_t) + nameSz > Ignis::Hornet::BytesLeft(*hss, wptr))
+		return 0;
 	Write<void*>(wptr, payload);
 	Write<std::size_t>(wptr, nameSz);
 	std::memcpy(wptr, name, nameSz);
 	NotifyAndWait(Ignis::Hornet::Action::CB_SCRIPT_READER);
-	const auto* rptr = hss->bytes.data();
-	const auto size = Read<std::size_t>(rptr);
-	if(size == 0U)
+	// NOTE: Scripts bigger than the segment come through the overflow object.
+	uint32_t size = 0U;
+	const auto* data = reinterpret_cast<const char*>(ReadSized(hss->bytes.data(), size));
+	if(data == nullptr || size == 0U)
 		return 0;
-	const char* data = reinterpret_cast<const char*>(rptr);
 	return OCG_LoadScript(duel, data, size, name);
 }
 
 void LogHandler(void* payload, const char* str, int t)
 {
-	const std::size_t strSz = std::strlen(str) + 1U;
+	// NOTE: Truncated to what fits in the segment.
 	auto* wptr = hss->bytes.data();
+	const auto room = Ignis::Hornet::BytesLeft(*hss, wptr) - sizeof(void*) - sizeof(int) - sizeof(std::size_t);
+	const std::size_t strSz = std::min(std::strlen(str) + 1U, room);
 	Write<void*>(wptr, payload);
 	Write<int>(wptr, t);
 	Write<std::size_t>(wptr, strSz);
@@ -106,17 +250,15 @@ int LoadSO(const char* soPath)
 	return 0;
 }
 
-void MainLoop()
+void MainLoop(Ignis::Hornet::SharedSegment* slots, std::size_t index)
 {
 	using namespace Ignis::Hornet;
+	hss = slots + index;
+	hssIndex = index;
 	bool quit = false;
 	do
 	{
-		{
-			LockType lock(hss->mtx);
-			hss->cv.wait(lock, [&](){return hss->act != Action::NO_WORK;});
-		}
-		switch(hss->act)
+		switch(WaitWhile(*hss, Action::NO_WORK))
 		{
 		case Action::EXIT:
 		{
@@ -141,8 +283,27 @@ void MainLoop()
 			opts.scriptReader = &ScriptReader;
 			opts.logHandler = &LogHandler;
 			opts.cardReaderDone = &DataReaderDone;
+			std::vector<SharedTablePtr> tables;
+			if(auto t = MapSharedTable(rptr, Ignis::Hornet::CARD_TABLE_MAGIC); t)
+			{
+				opts.cardReader = &TableDataReader;
+				opts.payload1 = t->region.get_address();
+				opts.cardReaderDone = &TableDataReaderDone;
+				tables.emplace_back(std::move(t));
+			}
+			if(auto t = MapSharedTable(rptr, Ignis::Hornet::SCRIPT_TABLE_MAGIC); t)
+			{
+				opts.scriptReader = &TableScriptReader;
+				opts.payload2 = t->region.get_address();
+				tables.emplace_back(std::move(t));
+			}
 			OCG_Duel duel = nullptr;
 			int r = OCG_CreateDuel(&duel, opts);
+			if(r == OCG_DUEL_CREATION_SUCCESS && !tables.empty())
+			{
+				std::scoped_lock lock(mSharedTables);
+				duelTables[duel] = std::move(tables);
+			}
 			auto* wptr = hss->bytes.data();
 			Write<int>(wptr, r);
 			Write<OCG_Duel>(wptr, duel);
@@ -151,7 +312,10 @@ void MainLoop()
 		case Action::OCG_DESTROY_DUEL:
 		{
 			const auto* rptr = hss->bytes.data();
-			OCG_DestroyDuel(Read<OCG_Duel>(rptr));
+			const auto duel = Read<OCG_Duel>(rptr);
+			OCG_DestroyDuel(duel);
+			std::scoped_lock lock(mSharedTables);
+			duelTables.erase(duel);
 			break;
 		}
 		case Action::OCG_DUEL_NEW_CARD:
@@ -161,6 +325,18 @@ void MainLoop()
 			OCG_DuelNewCard(duel, Read<OCG_NewCardInfo>(rptr));
 			break;
 		}
+		case Action::OCG_DUEL_NEW_CARDS:
+		{
+			// NOTE: Copied out first, as callbacks overwrite the segment.
+			static thread_local std::vector<OCG_NewCardInfo> infos;
+			const auto* rptr = hss->bytes.data();
+			const auto duel = Read<OCG_Duel>(rptr);
+			infos.resize(Read<std::size_t>(rptr));
+			std::memcpy(infos.data(), rptr, infos.size() * sizeof(OCG_NewCardInfo));
+			for(const auto& info : infos)
+				OCG_DuelNewCard(duel, info);
+			break;
+		}
 		case Action::OCG_START_DUEL:
 		{
 			const auto* rptr = hss->bytes.data();
@@ -183,16 +359,28 @@ void MainLoop()
 			uint32_t msgLength = 0U;
 			auto* msgPtr = OCG_DuelGetMessage(duel, &msgLength);
 			auto* wptr = hss->bytes.data();
-			Write<uint32_t>(wptr, msgLength);
-			std::memcpy(wptr, msgPtr, static_cast<std::size_t>(msgLength));
+			WriteSized(wptr, static_cast<const uint8_t*>(msgPtr), msgLength);
+			break;
+		}
+		case Action::OCG_DUEL_PROCESS_AND_GET_MESSAGE:
+		{
+			const auto* rptr = hss->bytes.data();
+			const auto duel = Read<OCG_Duel>(rptr);
+			int r = OCG_DuelProcess(duel);
+			uint32_t msgLength = 0U;
+			auto* msgPtr = OCG_DuelGetMessage(duel, &msgLength);
+			auto* wptr = hss->bytes.data();
+			Write<int>(wptr, r);
+			WriteSized(wptr, static_cast<const uint8_t*>(msgPtr), msgLength);
 			break;
 		}
 		case Action::OCG_DUEL_SET_RESPONSE:
 		{
 			const auto* rptr = hss->bytes.data();
 			const auto duel = Read<OCG_Duel>(rptr);
-			const auto length = Read<std::size_t>(rptr);
-			OCG_DuelSetResponse(duel, rptr, length);
+			uint32_t length = 0U;
+			if(const auto* data = ReadSized(rptr, length); data != nullptr)
+				OCG_DuelSetResponse(duel, data, length);
 			break;
 		}
 		case Action::OCG_LOAD_SCRIPT:
@@ -202,9 +390,9 @@ void MainLoop()
 			const auto nameSize = Read<std::size_t>(rptr);
 			const auto* name = reinterpret_cast<const char*>(rptr);
 			rptr += nameSize;
-			const auto strSize = Read<std::size_t>(rptr);
-			const auto* str = reinterpret_cast<const char*>(rptr);
-			int r = OCG_LoadScript(duel, str, strSize, name);
+			uint32_t strSize = 0U;
+			const auto* str = reinterpret_cast<const char*>(ReadSized(rptr, strSize));
+			int r = (str != nullptr) ? OCG_LoadScript(duel, str, strSize, name) : 0;
 			auto* wptr = hss->bytes.data();
 			Write<int>(wptr, r);
 			break;
@@ -227,8 +415,7 @@ void MainLoop()
 			uint32_t qLength = 0U;
 			auto* qPtr = OCG_DuelQuery(duel, &qLength, info);
 			auto* wptr = hss->bytes.data();
-			Write<uint32_t>(wptr, qLength);
-			std::memcpy(wptr, qPtr, static_cast<std::size_t>(qLength));
+			WriteSized(wptr, static_cast<const uint8_t*>(qPtr), qLength);
 			break;
 		}
 		case Action::OCG_DUEL_QUERY_LOCATION:
@@ -239,8 +426,7 @@ void MainLoop()
 			uint32_t qLength = 0U;
 			auto* qPtr = OCG_DuelQueryLocation(duel, &qLength, info);
 			auto* wptr = hss->bytes.data();
-			Write<uint32_t>(wptr, qLength);
-			std::memcpy(wptr, qPtr, static_cast<std::size_t>(qLength));
+			WriteSized(wptr, static_cast<const uint8_t*>(qPtr), qLength);
 			break;
 		}
 		case Action::OCG_DUEL_QUERY_FIELD:
@@ -250,8 +436,55 @@ void MainLoop()
 			uint32_t qLength = 0U;
 			auto* qPtr = OCG_DuelQueryField(duel, &qLength);
 			auto* wptr = hss->bytes.data();
-			Write<uint32_t>(wptr, qLength);
-			std::memcpy(wptr, qPtr, static_cast<std::size_t>(qLength));
+			WriteSized(wptr, static_cast<const uint8_t*>(qPtr), qLength);
+			break;
+		}
+		case Action::OCG_DUEL_QUERY_BATCH:
+		{
+			// NOTE: Results are gathered apart and written as a single
+			// one, so that together they can spill onto the overflow.
+			static thread_local std::vector<uint8_t> results;
+			results.clear();
+			auto Append = [](const void* data, uint32_t length)
+			{
+				const auto size = results.size();
+				results.resize(size + sizeof(length) + length);
+				std::memcpy(results.data() + size, &length, sizeof(length));
+				if(length != 0U)
+					std::memcpy(results.data() + size + sizeof(length), data, length);
+			};
+			const auto* rptr = hss->bytes.data();
+			const auto duel = Read<OCG_Duel>(rptr);
+			const auto count = Read<uint32_t>(rptr);
+			for(uint32_t i = 0U; i < count; i++)
+			{
+				const auto kind = Read<QueryKind>(rptr);
+				const auto info = Read<OCG_QueryInfo>(rptr);
+				uint32_t qLength = 0U;
+				switch(kind)
+				{
+				case QueryKind::COUNT:
+				{
+					const uint32_t c = OCG_DuelQueryCount(duel, info.con, info.loc);
+					Append(&c, sizeof(c));
+					break;
+				}
+				case QueryKind::SINGLE:
+				{
+					auto* qPtr = OCG_DuelQuery(duel, &qLength, info);
+					Append(qPtr, qLength);
+					break;
+				}
+				case QueryKind::LOCATION:
+				{
+					auto* qPtr = OCG_DuelQueryLocation(duel, &qLength, info);
+					Append(qPtr, qLength);
+					break;
+				}
+				}
+			}
+			auto* wptr = hss->bytes.data();
+			WriteSized(wptr, results.data(), static_cast<uint32_t>(results.size()));
 			break;
 		}
 		// Explicitly ignore these, in case we ever add more functionality...
@@ -262,29 +495,73 @@ void MainLoop()
 		case Action::CB_LOG_HANDLER:
 		case Action::CB_DATA_READER_DONE:
 		case Action::CB_DONE:
+		case Action::ZYGOTE_FORK:
 			break;
 		}
-		hss->act = Action::NO_WORK;
-		hss->cv.notify_one();
+		Post(*hss, Action::NO_WORK);
 	}while(!quit);
 }
 
-int main(int argc, char* argv[])
+#ifdef __linux__
+// Exits as soon as `parent` does, so that hornet isn't left orphaned
+// waiting on a segment nobody will ever post to again. Unlike
+// PR_SET_PDEATHSIG this is tied to the parent process rather than to the
+// thread that launched hornet, which might exit way before multirole does.
+void WatchParent(pid_t parent)
+{
+#ifdef SYS_pidfd_open
+	if(const int fd = static_cast<int>(syscall(SYS_pidfd_open, parent, 0)); fd >= 0)
+	{
+		pollfd pfd{fd, POLLIN, 0};
+		while(poll(&pfd, 1U, -1) < 0 && errno == EINTR);
+		_exit(0);
+	}
+#endif // SYS_pidfd_open
+	// NOTE: Orphans are adopted by another process once their parent exits.
+	while(getppid() == parent)
+		sleep(1U);
+	_exit(0);
+}
+#endif // __linux__
+
+// Serves the segment `name`, or the anonymous one inherited as `segmentFd`
+// if not -1, which is still named `name` for everything else.
+int Serve(const char* name, std::size_t slotCount, [[maybe_unused]] int segmentFd = -1)
 {
-	if(argc < 3)
-		return 1;
-	if(int r = LoadSO(argv[1]); r != 0)
-		return 2;
-#ifndef _WIN32
-	if(signal(SIGINT, [](int /*unused*/){}) == SIG_ERR)
-		return 3;
-#endif // _WIN32
 	try
 	{
-		ipc::shared_memory_object shm(ipc::open_only, argv[2], ipc::read_write);
-		ipc::mapped_region r(shm, ipc::read_write);
-		hss = static_cast<Ignis::Hornet::SharedSegment*>(r.get_address());
-		MainLoop();
+		ipc::shared_memory_object shm;
+		ipc::mapped_region r;
+		Ignis::Hornet::SharedSegment* slots = nullptr;
+#ifdef __linux__
+		if(segmentFd >= 0)
+		{
+			void* addr = mmap(nullptr, sizeof(Ignis::Hornet::SharedSegment) * slotCount,
+				PROT_READ | PROT_WRITE, MAP_SHARED, segmentFd, 0);
+			close(segmentFd);
+			if(addr == MAP_FAILED)
+			{
+				DLOpen::UnloadObject(handle);
+				return 4;
+			}
+			slots = static_cast<Ignis::Hornet::SharedSegment*>(addr);
+			std::thread(WatchParent, getppid()).detach();
+		}
+#endif // __linux__
+		if(slots == nullptr)
+		{
+			shm = ipc::shared_memory_object(ipc::open_only, name, ipc::read_write);
+			r = ipc::mapped_region(shm, ipc::read_write);
+			slots = static_cast<Ignis::Hornet::SharedSegment*>(r.get_address());
+		}
+		shmName = name;
+		// Each slot is served by its own thread.
+		std::vector<std::thread> threads;
+		for(std::size_t i = 1U; i < slotCount; i++)
+			threads.emplace_back(MainLoop, slots, i);
+		MainLoop(slots, 0U);
+		for(auto& t : threads)
+			t.join();
 	}
 	catch(const ipc::interprocess_exception& e)
 	{
@@ -294,3 +571,82 @@ int main(int argc, char* argv[])
 	DLOpen::UnloadObject(handle);
 	return 0;
 }
+
+#ifndef _WIN32
+// Serves fork requests on the control segment `ctlName` with the core
+// already loaded, so children share its pages copy-on-write instead of
+// loading it again. Returns true on the forked child, along with the
+// segment it has to serve.
+bool ZygoteLoop(const char* ctlName, std::string& name, std::size_t& slotCount)
+{
+	using namespace Ignis::Hornet;
+	ipc::shared_memory_object shm(ipc::open_only, ctlName, ipc::read_write);
+	ipc::mapped_region r(shm, ipc::read_write);
+	auto* ctl = static_cast<SharedSegment*>(r.get_address());
+	// Children are reaped automatically, multirole only polls for them.
+	if(signal(SIGCHLD, SIG_IGN) == SIG_ERR)
+		return false;
+	for(;;)
+	{
+		switch(WaitWhile(*ctl, Action::NO_WORK))
+		{
+		case Action::EXIT:
+			return false;
+		case Action::ZYGOTE_FORK:
+		{
+			const auto* rptr = ctl->bytes.data();
+			const auto nameSz = Read<std::size_t>(rptr);
+			name.assign(reinterpret_cast<const char*>(rptr), nameSz);
+			rptr += nameSz;
+			slotCount = std::max<std::size_t>(Read<std::size_t>(rptr), 1U);
+			const pid_t pid = fork();
+			if(pid == 0)
+			{
+				signal(SIGCHLD, SIG_DFL);
+				return true;
+			}
+			auto* wptr = ctl->bytes.data();
+			Write<pid_t>(wptr, pid);
+			break;
+		}
+		default:
+			break;
+		}
+		Post(*ctl, Action::NO_WORK);
+	}
+}
+#endif // _WIN32
+
+int main(int argc, char* argv[])
+{
+	if(argc < 3)
+		return 1;
+	if(int r = LoadSO(argv[1]); r != 0)
+		return 2;
+#ifndef _WIN32
+	if(signal(SIGINT, [](int /*unused*/){}) == SIG_ERR)
+		return 3;
+	if(argc > 3 && std::strcmp(argv[3], "zygote") == 0)
+	{
+		std::string name;
+		std::size_t slotCount = 1U;
+		try
+		{
+			if(!ZygoteLoop(argv[2], name, slotCount))
+			{
+				DLOpen::UnloadObject(handle);
+				return 0;
+			}
+		}
+		catch(const ipc::interprocess_exception& e)
+		{
+			DLOpen::UnloadObject(handle);
+			return 4;
+		}
+		return Serve(name.data(), slotCount);
+	}
+#endif // _WIN32
+	const std::size_t slotCount = (argc > 3) ? std::max(std::strtoul(argv[3], nullptr, 10), 1UL) : 1U;
+	const int segmentFd = (argc > 4) ? std::atoi(argv[4]) : -1;
+	return Serve(argv[2], slotCount, segmentFd);
+}
@@ -0,0 +1,74 @@
+#ifndef HORNETCARDTABLE_HPP
+#define HORNETCARDTABLE_HPP
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#include "ocgapi_types.h"
+
+namespace Ignis::Hornet
+{
+
+// Read-only table with every card of a database. Multirole publishes it on
+// shared memory so that hornet can answer card data requests locally.
+// Layout: CardTableHeader, `count` CardTableEntry sorted by card code and
+// then the zero-terminated setcodes referenced by the entries.
+struct CardTableHeader
+{
+	uint32_t magic;
+	uint32_t count;
+};
+
+struct CardTableEntry
+{
+	OCG_CardData data; // NOTE: setcodes pointer is meaningless here.
+	uint32_t setcodesIndex;
+};
+
+constexpr uint32_t CARD_TABLE_MAGIC = 0x42544443U; // "CDTB"
+
+inline std::size_t CardTableSize(std::size_t count, std::size_t setcodesCount)
+{
+	return sizeof(CardTableHeader) + sizeof(CardTableEntry) * count +
+		sizeof(uint16_t) * setcodesCount;
+}
+
+inline const CardTableEntry* CardTableEntries(const void* table)
+{
+	const auto* ptr = static_cast<const uint8_t*>(table);
+	return reinterpret_cast<const CardTableEntry*>(ptr + sizeof(CardTableHeader));
+}
+
+inline const uint16_t* CardTableSetcodes(const void* table)
+{
+	const auto& header = *static_cast<const CardTableHeader*>(table);
+	return reinterpret_cast<const uint16_t*>(CardTableEntries(table) + header.count);
+}
+
+// Fills `data` with the card matching `code`, same as a database would,
+// a card not present on the table is returned zeroed with no setcodes.
+inline void CardTableLookup(const void* table, uint32_t code, OCG_CardData& data)
+{
+	static constexpr uint16_t NO_SETCODES = 0U;
+	const auto& header = *static_cast<const CardTableHeader*>(table);
+	const auto* first = CardTableEntries(table);
+	const auto* last = first + header.count;
+	const auto* it = std::lower_bound(first, last, code,
+	[](const CardTableEntry& e, uint32_t c)
+	{
+		return e.data.code < c;
+	});
+	if(it == last || it->data.code != code)
+	{
+		std::memset(&data, 0, sizeof(OCG_CardData));
+		data.setcodes = const_cast<uint16_t*>(&NO_SETCODES);
+		return;
+	}
+	data = it->data;
+	// NOTE: Core never writes to setcodes.
+	data.setcodes = const_cast<uint16_t*>(CardTableSetcodes(table) + it->setcodesIndex);
+}
+
+} // namespace Ignis::Hornet
+
+#endif // HORNETCARDTABLE_HPP
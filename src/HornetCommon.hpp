@@ -1,17 +1,39 @@
 #ifndef HORNETCOMMON_HPP
 #define HORNETCOMMON_HPP
 #include <array>
+#include <chrono>
+#include <limits>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <boost/interprocess/interprocess_fwd.hpp>
+
+#ifndef HORNET_SPIN_HANDOFF
+#include <boost/date_time/posix_time/posix_time_types.hpp>
 #include <boost/interprocess/sync/interprocess_condition.hpp>
 #include <boost/interprocess/sync/interprocess_mutex.hpp>
 #include <boost/interprocess/sync/scoped_lock.hpp>
+#else
+#include <atomic>
+#include <thread>
+#ifdef __linux__
+#include <climits>
+#include <ctime>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif // __linux__
+#endif // HORNET_SPIN_HANDOFF
+
+#ifndef HORNET_SPIN_MAX_ITERATIONS
+#define HORNET_SPIN_MAX_ITERATIONS 4096U
+#endif // HORNET_SPIN_MAX_ITERATIONS
 
 namespace ipc = boost::interprocess;
 
 namespace Ignis::Hornet
 {
 
-using LockType = ipc::scoped_lock<ipc::interprocess_mutex>;
-
 enum class Action : uint8_t
 {
 	// Any function that calls DataReader also calls DataReaderDone.
@@ -24,30 +46,228 @@ enum class Action : uint8_t
 	OCG_CREATE_DUEL, // Callbacks: ScriptReader
 	OCG_DESTROY_DUEL, // Callbacks: none
 	OCG_DUEL_NEW_CARD, // Callbacks: DataReader, ScriptReader
+	OCG_DUEL_NEW_CARDS, // Callbacks: DataReader, ScriptReader
 	OCG_START_DUEL, // Callbacks: none
 	OCG_DUEL_PROCESS, // Callbacks: DataReader, ScriptReader
 	OCG_DUEL_GET_MESSAGE, // Callbacks: none
+	OCG_DUEL_PROCESS_AND_GET_MESSAGE, // Callbacks: DataReader, ScriptReader
 	OCG_DUEL_SET_RESPONSE, // Callbacks: none
 	OCG_LOAD_SCRIPT, // Callbacks: ScriptReader
 	OCG_DUEL_QUERY_COUNT, // Callbacks: none
 	OCG_DUEL_QUERY, // Callbacks: none
 	OCG_DUEL_QUERY_LOCATION, // Callbacks: none
 	OCG_DUEL_QUERY_FIELD, // Callbacks: none
+	OCG_DUEL_QUERY_BATCH, // Callbacks: none
 	CB_DATA_READER, // Callbacks: doesn't apply
 	CB_SCRIPT_READER, // Callbacks: doesn't apply
 	CB_LOG_HANDLER, // Callbacks: doesn't apply
 	CB_DATA_READER_DONE, // Callbacks: doesn't apply
 	CB_DONE, // Callbacks: doesn't apply
+	ZYGOTE_FORK, // Callbacks: doesn't apply
+};
+
+// Queries of OCG_DUEL_QUERY_BATCH, each one a kind followed by its info.
+enum class QueryKind : uint8_t
+{
+	COUNT = 0U, // Only the team and location of the info are used.
+	SINGLE,
+	LOCATION,
 };
 
+#ifndef HORNET_SPIN_HANDOFF
+
+using LockType = ipc::scoped_lock<ipc::interprocess_mutex>;
+
 struct SharedSegment
 {
 	ipc::interprocess_mutex mtx;
 	ipc::interprocess_condition cv;
 	Action act{Action::NO_WORK};
-	std::array<uint8_t, std::numeric_limits<uint16_t>::max()*2U> bytes{};
+	bool interrupted{false}; // See Interrupt.
+	// NOTE: Left uninitialized on purpose, so that its pages are only
+	// committed once something is actually written to them.
+	std::array<uint8_t, std::numeric_limits<uint16_t>::max()*2U> bytes;
 };
 
+// Publishes an action to the other side and wakes it up.
+inline void Post(SharedSegment& ss, Action act)
+{
+	LockType lock(ss.mtx);
+	ss.act = act;
+	ss.cv.notify_one();
+}
+
+// Blocks until the published action is different from `act`, returns it.
+inline Action WaitWhile(SharedSegment& ss, Action act)
+{
+	LockType lock(ss.mtx);
+	ss.cv.wait(lock, [&](){return ss.act != act;});
+	return ss.act;
+}
+
+// Same as above but gives up after `timeout` has passed, or right away
+// once the segment is interrupted.
+inline std::optional<Action> WaitWhile(SharedSegment& ss, Action act, std::chrono::milliseconds timeout)
+{
+	auto deadline = boost::posix_time::microsec_clock::universal_time();
+	deadline += boost::posix_time::milliseconds(timeout.count());
+	LockType lock(ss.mtx);
+	ss.cv.timed_wait(lock, deadline, [&](){return ss.act != act || ss.interrupted;});
+	if(ss.act == act)
+		return std::nullopt;
+	return ss.act;
+}
+
+// Makes the timed waits on the segment give up from now on, used by
+// multirole once the other side is known to be gone.
+inline void Interrupt(SharedSegment& ss)
+{
+	LockType lock(ss.mtx);
+	ss.interrupted = true;
+	ss.cv.notify_all();
+}
+
+#else
+
+// Spin-then-park handoff: the action is an atomic word that the waiting side
+// polls for a short, adaptive amount of iterations before parking on a futex
+// (or yielding, on platforms that lack one). Compared to the mutex and
+// condition variable pair this avoids syscalls entirely on quick handoffs.
+struct SharedSegment
+{
+	std::atomic<uint32_t> act{static_cast<uint32_t>(Action::NO_WORK)};
+	std::atomic<uint32_t> parked{0U};
+	std::atomic<bool> interrupted{false}; // See Interrupt.
+	// NOTE: Left uninitialized on purpose, so that its pages are only
+	// committed once something is actually written to them.
+	std::array<uint8_t, std::numeric_limits<uint16_t>::max()*2U> bytes;
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free);
+
+namespace Detail
+{
+
+// Number of iterations to spin before parking, adjusted per thread
+// depending on whether or not spinning has been paying off.
+inline thread_local uint32_t spinBudget = HORNET_SPIN_MAX_ITERATIONS / 4U;
+
+inline void CpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	asm volatile("yield");
+#endif
+}
+
+inline void Park(std::atomic<uint32_t>& word, uint32_t old, std::chrono::nanoseconds timeout)
+{
+#ifdef __linux__
+	using namespace std::chrono;
+	timespec ts{};
+	ts.tv_sec = static_cast<time_t>(duration_cast<seconds>(timeout).count());
+	ts.tv_nsec = static_cast<long>((timeout % seconds(1)).count());
+	// NOTE: Not using FUTEX_PRIVATE_FLAG as the word lives in memory
+	// shared between processes.
+	syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT, old, &ts, nullptr, 0);
+#else
+	(void)word; (void)old; (void)timeout;
+	std::this_thread::yield();
+#endif // __linux__
+}
+
+inline void Unpark(std::atomic<uint32_t>& word)
+{
+#ifdef __linux__
+	syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+#else
+	(void)word;
+#endif // __linux__
+}
+
+inline std::optional<Action> SpinThenPark(SharedSegment& ss, Action act, std::chrono::nanoseconds timeout, bool interruptible)
+{
+	const auto old = static_cast<uint32_t>(act);
+	for(uint32_t i = 0U; i < spinBudget; i++)
+	{
+		if(const auto v = ss.act.load(std::memory_order_acquire); v != old)
+		{
+			spinBudget = std::min(spinBudget * 2U, HORNET_SPIN_MAX_ITERATIONS);
+			return Action{static_cast<uint8_t>(v)};
+		}
+		CpuRelax();
+	}
+	spinBudget = std::max(spinBudget / 2U, 16U);
+	using Clock = std::chrono::steady_clock;
+	const auto deadline = Clock::now() + timeout;
+	ss.parked.fetch_add(1U);
+	uint32_t v = old;
+	for(;;)
+	{
+		if((v = ss.act.load()) != old)
+			break;
+		const auto now = Clock::now();
+		if(now >= deadline || (interruptible && ss.interrupted.load()))
+			break;
+		Park(ss.act, old, deadline - now);
+	}
+	ss.parked.fetch_sub(1U);
+	if(v == old)
+		return std::nullopt;
+	return Action{static_cast<uint8_t>(v)};
+}
+
+} // namespace Detail
+
+// Publishes an action to the other side and wakes it up if it was parked.
+inline void Post(SharedSegment& ss, Action act)
+{
+	ss.act.store(static_cast<uint32_t>(act));
+	if(ss.parked.load() != 0U)
+		Detail::Unpark(ss.act);
+}
+
+// Blocks until the published action is different from `act`, returns it.
+inline Action WaitWhile(SharedSegment& ss, Action act)
+{
+	using namespace std::chrono;
+	for(;;)
+		if(auto r = Detail::SpinThenPark(ss, act, hours(1), false); r)
+			return *r;
+}
+
+// Same as above but gives up after `timeout` has passed, or right away
+// once the segment is interrupted.
+inline std::optional<Action> WaitWhile(SharedSegment& ss, Action act, std::chrono::milliseconds timeout)
+{
+	return Detail::SpinThenPark(ss, act, timeout, true);
+}
+
+// Makes the timed waits on the segment give up from now on, used by
+// multirole once the other side is known to be gone.
+inline void Interrupt(SharedSegment& ss)
+{
+	ss.interrupted.store(true);
+	Detail::Unpark(ss.act);
+}
+
+#endif // HORNET_SPIN_HANDOFF
+
+// Amount of bytes left on the segment starting from `ptr`.
+inline std::size_t BytesLeft(const SharedSegment& ss, const uint8_t* ptr)
+{
+	return static_cast<std::size_t>(ss.bytes.data() + ss.bytes.size() - ptr);
+}
+
+// Length-prefixed results that don't fit in the segment are instead
+// written by hornet onto this per-slot shared memory object, which only
+// exists once a slot needed it.
+inline std::string OverflowName(std::string_view shmName, std::size_t slot)
+{
+	return std::string(shmName).append("Ovf").append(std::to_string(slot));
+}
+
 } // namespace Ignis::Hornet
 
 #endif // HORNETCOMMON_HPP
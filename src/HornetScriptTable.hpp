@@ -0,0 +1,73 @@
+#ifndef HORNETSCRIPTTABLE_HPP
+#define HORNETSCRIPTTABLE_HPP
+#include <algorithm>
+#include <cstdint>
+#include <string_view>
+
+namespace Ignis::Hornet
+{
+
+// Read-only table with the contents of every script. Multirole publishes a
+// new version of it on shared memory each time scripts are reloaded, so that
+// hornet can hand them to the core without copying them into its segment.
+// Layout: ScriptTableHeader, `count` ScriptTableEntry sorted by name and
+// then a blob with all names and contents, which entries point into.
+struct ScriptTableHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t count;
+};
+
+struct ScriptTableEntry
+{
+	uint64_t nameOffset;
+	uint64_t nameSize;
+	uint64_t dataOffset;
+	uint64_t dataSize;
+};
+
+constexpr uint32_t SCRIPT_TABLE_MAGIC = 0x42544353U; // "SCTB"
+
+inline std::size_t ScriptTableSize(std::size_t count, std::size_t blobSize)
+{
+	return sizeof(ScriptTableHeader) + sizeof(ScriptTableEntry) * count + blobSize;
+}
+
+inline const ScriptTableEntry* ScriptTableEntries(const void* table)
+{
+	const auto* ptr = static_cast<const uint8_t*>(table);
+	return reinterpret_cast<const ScriptTableEntry*>(ptr + sizeof(ScriptTableHeader));
+}
+
+inline const char* ScriptTableBlob(const void* table)
+{
+	const auto& header = *static_cast<const ScriptTableHeader*>(table);
+	return reinterpret_cast<const char*>(ScriptTableEntries(table) + header.count);
+}
+
+// Returns the contents of the script with the given name, empty if there's
+// no such script on the table.
+inline std::string_view ScriptTableLookup(const void* table, std::string_view name)
+{
+	const auto& header = *static_cast<const ScriptTableHeader*>(table);
+	const char* blob = ScriptTableBlob(table);
+	const auto* first = ScriptTableEntries(table);
+	const auto* last = first + header.count;
+	auto NameOf = [&](const ScriptTableEntry& e) -> std::string_view
+	{
+		return {blob + e.nameOffset, static_cast<std::size_t>(e.nameSize)};
+	};
+	const auto* it = std::lower_bound(first, last, name,
+	[&](const ScriptTableEntry& e, std::string_view n)
+	{
+		return NameOf(e) < n;
+	});
+	if(it == last || NameOf(*it) != name)
+		return {};
+	return {blob + it->dataOffset, static_cast<std::size_t>(it->dataSize)};
+}
+
+} // namespace Ignis::Hornet
+
+#endif // HORNETSCRIPTTABLE_HPP
@@ -0,0 +1,153 @@
+#include "AdaptivePool.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include "Room/Stats.hpp"
+
+namespace Ignis::Multirole
+{
+
+// Longest a retired thread keeps running before noticing it.
+constexpr auto RETIRE_CHECK = std::chrono::milliseconds(100);
+
+// Fills in and bounds the options, as many threads as there's room for
+// being the most if unset.
+inline AdaptivePool::Options Bound(AdaptivePool::Options o, std::size_t capacity)
+{
+	if(o.maxThreads == 0U || o.maxThreads > capacity)
+		o.maxThreads = capacity;
+	o.minThreads = std::clamp<std::size_t>(o.minThreads, 1U, o.maxThreads);
+	o.interval = std::max(o.interval, std::chrono::milliseconds(100));
+	o.targetBusyPercent = std::clamp(o.targetBusyPercent, 1U, 100U);
+	return o;
+}
+
+// public
+
+AdaptivePool::AdaptivePool(
+	boost::asio::io_context& workCtx,
+	boost::asio::io_context& timerCtx,
+	Options options,
+	bool inProcessCore)
+	:
+	workCtx(workCtx),
+	timer(timerCtx),
+	capacity([&]()
+	{
+		const std::size_t cpus = std::max(1U, std::thread::hardware_concurrency());
+		const std::size_t n = (options.maxThreads == 0U) ? cpus * 4U : options.maxThreads;
+		return inProcessCore ? std::min(n, cpus) : n;
+	}()),
+	opts(Bound(options, capacity)),
+	target(0U),
+	threads(capacity),
+	alive(std::make_unique<std::atomic<bool>[]>(capacity)),
+	lastSliceUs(0U),
+	lastCoreUs(0U)
+{}
+
+AdaptivePool::~AdaptivePool()
+{
+	Stop();
+	Join();
+}
+
+void AdaptivePool::Start(std::size_t n)
+{
+	const auto& stats = Room::Stats::Get();
+	lastSliceUs = stats.SliceUs().Sum();
+	lastCoreUs = stats.SliceCoreUs();
+	const auto o = GetOptions();
+	Resize(std::clamp(n, o.minThreads, o.maxThreads));
+	Room::Stats::Get().RecordRoomThreads(target, 0U, 0U);
+	DoSample();
+}
+
+void AdaptivePool::Stop()
+{
+	timer.cancel();
+}
+
+void AdaptivePool::SetLimits(std::size_t minThreads, std::size_t maxThreads, unsigned int targetBusyPercent)
+{
+	std::scoped_lock lock(mOpts);
+	opts = Bound({minThreads, maxThreads, opts.interval, targetBusyPercent}, capacity);
+}
+
+void AdaptivePool::Join()
+{
+	for(auto& t : threads)
+		if(t.joinable())
+			t.join();
+}
+
+// private
+
+AdaptivePool::Options AdaptivePool::GetOptions()
+{
+	std::scoped_lock lock(mOpts);
+	return opts;
+}
+
+void AdaptivePool::Resize(std::size_t n)
+{
+	target = n;
+	for(std::size_t i = 0U; i < n; i++)
+	{
+		// NOTE: A thread that is about to retire might still be flagged
+		// as alive, it is then launched again on the next resize.
+		if(alive[i])
+			continue;
+		if(threads[i].joinable())
+			threads[i].join();
+		alive[i] = true;
+		threads[i] = std::thread(&AdaptivePool::Work, this, i);
+	}
+}
+
+void AdaptivePool::Work(std::size_t index)
+{
+	while(index < target && !workCtx.stopped())
+		workCtx.run_one_for(RETIRE_CHECK);
+	alive[index] = false;
+}
+
+void AdaptivePool::DoSample()
+{
+	timer.expires_after(GetOptions().interval);
+	timer.async_wait([this](boost::system::error_code ec)
+	{
+		if(ec || workCtx.stopped())
+			return;
+		using namespace std::chrono;
+		const auto o = GetOptions();
+		const auto& stats = Room::Stats::Get();
+		const auto sliceUs = stats.SliceUs().Sum();
+		const auto coreUs = stats.SliceCoreUs();
+		const double intervalUs = static_cast<double>(duration_cast<microseconds>(o.interval).count());
+		// Threads' worth of time spent processing and blocked on the core.
+		const double busy = static_cast<double>(sliceUs - lastSliceUs) / intervalUs;
+		const double blocked = static_cast<double>(coreUs - lastCoreUs) / intervalUs;
+		lastSliceUs = sliceUs;
+		lastCoreUs = coreUs;
+		const std::size_t current = target;
+		const auto wanted = static_cast<std::size_t>(std::ceil(busy * 100.0 / o.targetBusyPercent));
+		std::size_t next = current;
+		if(wanted > current)
+			next = wanted;
+		else if(wanted < current)
+			next = current - 1U; // Shrinks slowly, bursts are common.
+		next = std::clamp(next, o.minThreads, o.maxThreads);
+		if(next != current)
+			Resize(next);
+		const auto Percent = [current](double v)
+		{
+			return static_cast<unsigned int>(std::min(v * 100.0 / static_cast<double>(current), 100.0));
+		};
+		Room::Stats::Get().RecordRoomThreads(next, Percent(busy), Percent(blocked));
+		DoSample();
+	});
+}
+
+} // namespace Ignis::Multirole
@@ -0,0 +1,77 @@
+#ifndef ADAPTIVEPOOL_HPP
+#define ADAPTIVEPOOL_HPP
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+namespace Ignis::Multirole
+{
+
+// Threads running the rooms io_context, as many as the rooms keep busy.
+// Every interval the time rooms spent processing, and the part of it spent
+// blocked on core calls, tell how many threads would be busy for the
+// target share of their time, which the pool then grows to right away or
+// shrinks towards one thread at a time. Threads blocked on a hornet don't
+// use a CPU, but an in-process core does, so with in-process cores the pool
+// doesn't grow past the amount of CPUs. The limits can be changed while
+// running, but never past the most threads there was room for at first.
+// Decisions are recorded on Room::Stats.
+class AdaptivePool final
+{
+public:
+	struct Options
+	{
+		std::size_t minThreads;
+		std::size_t maxThreads;
+		std::chrono::milliseconds interval;
+		unsigned int targetBusyPercent;
+	};
+
+	// Samples on `timerCtx`, the threads run `workCtx`.
+	AdaptivePool(
+		boost::asio::io_context& workCtx,
+		boost::asio::io_context& timerCtx,
+		Options options,
+		bool inProcessCore);
+	~AdaptivePool();
+
+	// Launches `threads` threads and starts adapting.
+	void Start(std::size_t threads);
+
+	// Stops adapting, the threads keep running.
+	void Stop();
+
+	// Takes effect on the next sample, the interval is kept.
+	void SetLimits(std::size_t minThreads, std::size_t maxThreads, unsigned int targetBusyPercent);
+
+	// Waits until the threads are done, which is once workCtx runs out of
+	// work.
+	void Join();
+private:
+	boost::asio::io_context& workCtx;
+	boost::asio::steady_timer timer;
+	const std::size_t capacity; // Most threads ever running.
+	Options opts;
+	std::mutex mOpts;
+	std::atomic<std::size_t> target;
+	// Slot i is running a thread if alive[i], it retires once i >= target.
+	std::vector<std::thread> threads;
+	std::unique_ptr<std::atomic<bool>[]> alive;
+	uint64_t lastSliceUs;
+	uint64_t lastCoreUs;
+
+	Options GetOptions();
+	void Resize(std::size_t n);
+	void Work(std::size_t index);
+	void DoSample();
+};
+
+} // namespace Ignis::Multirole
+
+#endif // ADAPTIVEPOOL_HPP
@@ -0,0 +1,134 @@
+#include "CrashRegistry.hpp"
+
+#include <atomic>
+#include <csignal>
+#include <fstream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif // _WIN32
+
+namespace Ignis::Multirole::Core
+{
+
+namespace
+{
+
+thread_local const CrashRegistry::Scope* tlsScope = nullptr;
+std::atomic<int> handlerFd{-1};
+
+void WriteHex(uint64_t v, char* out)
+{
+	constexpr const char* HEX_DIGITS = "0123456789abcdef";
+	for(int i = 15; i >= 0; i--, v >>= 4U)
+		out[i] = HEX_DIGITS[v & 0xFU];
+	out[16] = '\n';
+}
+
+} // namespace
+
+// public
+
+CrashRegistry::Scope::Scope(const Signature& sig) :
+	lines(),
+	prev(tlsScope)
+{
+	WriteHex(sig.host, lines.data());
+	WriteHex(sig.pool, lines.data() + LINE_SIZE);
+	tlsScope = this;
+}
+
+CrashRegistry::Scope::~Scope()
+{
+	tlsScope = prev;
+}
+
+CrashRegistry::CrashRegistry(std::string_view path) :
+	path(path),
+	fd(-1)
+{
+	if(this->path.empty())
+		return;
+	std::ifstream f(this->path);
+	for(std::string line; std::getline(f, line);)
+	{
+		try
+		{
+			sigs.insert(std::stoull(line, nullptr, 16));
+		}
+		catch(const std::exception&)
+		{
+			// Skip lines cut short by a crash.
+		}
+	}
+#ifndef _WIN32
+	fd = open(this->path.data(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+#endif // _WIN32
+}
+
+CrashRegistry::~CrashRegistry()
+{
+#ifndef _WIN32
+	if(fd < 0)
+		return;
+	int expected = fd;
+	handlerFd.compare_exchange_strong(expected, -1);
+	close(fd);
+#endif // _WIN32
+}
+
+bool CrashRegistry::Contains(const Signature& sig) const
+{
+	std::scoped_lock lock(mtx);
+	return (sig.host != 0U && sigs.count(sig.host) != 0U) ||
+		(sig.pool != 0U && sigs.count(sig.pool) != 0U);
+}
+
+void CrashRegistry::Add(const Signature& sig)
+{
+	std::array<char, Scope::LINE_SIZE * 2U> lines{};
+	WriteHex(sig.host, lines.data());
+	WriteHex(sig.pool, lines.data() + Scope::LINE_SIZE);
+	std::scoped_lock lock(mtx);
+	const bool newHost = sig.host != 0U && sigs.insert(sig.host).second;
+	const bool newPool = sig.pool != 0U && sigs.insert(sig.pool).second;
+	if(!newHost && !newPool)
+		return;
+#ifndef _WIN32
+	if(fd >= 0)
+		(void)!write(fd, lines.data(), lines.size());
+#else
+	if(!path.empty())
+		std::ofstream(path, std::ios_base::app).write(lines.data(), lines.size());
+#endif // _WIN32
+}
+
+void CrashRegistry::CatchFatalSignals()
+{
+#ifndef _WIN32
+	if(fd < 0)
+		return;
+	handlerFd.store(fd);
+	struct sigaction sa{};
+	sa.sa_handler = &CrashRegistry::OnFatalSignal;
+	sa.sa_flags = SA_RESETHAND | SA_NODEFER;
+	sigemptyset(&sa.sa_mask);
+	for(const int sig : {SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT})
+		sigaction(sig, &sa, nullptr);
+#endif // _WIN32
+}
+
+// private
+
+void CrashRegistry::OnFatalSignal(int sig)
+{
+#ifndef _WIN32
+	// NOTE: Only async-signal-safe functions past this point.
+	if(const int f = handlerFd.load(); f >= 0 && tlsScope != nullptr)
+		(void)!write(f, tlsScope->lines.data(), tlsScope->lines.size());
+#endif // _WIN32
+	std::raise(sig);
+}
+
+} // namespace Ignis::Multirole::Core
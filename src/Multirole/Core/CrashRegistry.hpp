@@ -0,0 +1,71 @@
+#ifndef CRASHREGISTRY_HPP
+#define CRASHREGISTRY_HPP
+#include <array>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+
+namespace Ignis::Multirole::Core
+{
+
+// Keeps track of which kinds of duels crashed the core before, persisted
+// onto a file so that it survives crashes that take the whole process down.
+class CrashRegistry final
+{
+public:
+	// Describes a duel as far as crashing the core is concerned, `host`
+	// covers the room options and `pool` the cards used on it. Zero on
+	// either means there's nothing to tell about it.
+	struct Signature
+	{
+		uint64_t host;
+		uint64_t pool;
+	};
+
+	// Marks the calling thread as working on a duel with the given
+	// signature for the lifetime of the object, so that a fatal signal
+	// raised meanwhile records it before the process dies.
+	class Scope final
+	{
+	public:
+		Scope(const Signature& sig);
+		~Scope();
+
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+	private:
+		static constexpr std::size_t LINE_SIZE = 17U; // 16 hex digits + '\n'.
+		std::array<char, LINE_SIZE * 2U> lines;
+		const Scope* prev;
+
+		friend class CrashRegistry;
+	};
+
+	// Loads all signatures recorded on the file at `path`, if empty
+	// nothing is persisted.
+	CrashRegistry(std::string_view path);
+	~CrashRegistry();
+
+	// Returns true if either part of the signature was recorded before.
+	bool Contains(const Signature& sig) const;
+
+	// Records both parts of the signature.
+	void Add(const Signature& sig);
+
+	// Installs handlers for fatal signals that append the signature of
+	// the scope active on the crashing thread before letting it die.
+	void CatchFatalSignals();
+private:
+	const std::string path;
+	std::unordered_set<uint64_t> sigs;
+	mutable std::mutex mtx;
+	int fd; // Used by the signal handlers and Add.
+
+	static void OnFatalSignal(int sig);
+};
+
+} // namespace Ignis::Multirole::Core
+
+#endif // CRASHREGISTRY_HPP
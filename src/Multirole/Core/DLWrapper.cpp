@@ -1,6 +1,7 @@
 #include "DLWrapper.hpp"
 
 #include <cstring> // std::memcpy
+#include <memory>
 
 #include "IDataSupplier.hpp"
 #include "IScriptSupplier.hpp"
@@ -11,6 +12,11 @@
 namespace Ignis::Multirole::Core
 {
 
+inline OCG_Duel Unwrap(IWrapper::Duel duel)
+{
+	return static_cast<Detail::DuelHandle*>(duel)->duel;
+}
+
 // Core callbacks
 static void DataReader(void* payload, uint32_t code, OCG_CardData* data)
 {
@@ -20,10 +26,10 @@ static void DataReader(void* payload, uint32_t code, OCG_CardData* data)
 static int ScriptReader(void* payload, OCG_Duel duel, const char* name)
 {
 	auto& ssd = *static_cast<Detail::ScriptSupplierData*>(payload);
-	std::string script = ssd.supplier.ScriptFromFilePath(name);
-	if(script.empty())
+	const auto script = ssd.supplier.ScriptFromFilePath(name);
+	if(!script || script->empty())
 		return 0;
-	return ssd.OCG_LoadScript(duel, script.data(), script.length(), name);
+	return ssd.OCG_LoadScript(duel, script->data(), script->length(), name);
 }
 
 static void LogHandler(void* payload, const char* str, int t)
@@ -72,9 +78,8 @@ std::pair<int, int> DLWrapper::Version()
 
 IWrapper::Duel DLWrapper::CreateDuel(const DuelOptions& opts)
 {
-	OCG_Duel duel{nullptr};
-	std::scoped_lock lock(ssdMutex);
-	auto ssdIter = ssdList.insert(ssdList.end(), {opts.scriptSupplier, OCG_LoadScript});
+	auto handle = std::make_unique<Detail::DuelHandle>(
+		Detail::DuelHandle{nullptr, {opts.scriptSupplier, OCG_LoadScript}});
 	OCG_DuelOptions options =
 	{
 		opts.seed,
@@ -84,73 +89,74 @@ IWrapper::Duel DLWrapper::CreateDuel(const DuelOptions& opts)
 		&DataReader,
 		&opts.dataSupplier,
 		&ScriptReader,
-		&*ssdIter,
+		&handle->ssd,
 		&LogHandler,
 		opts.optLogger,
 		&DataReaderDone,
 		&opts.dataSupplier
 	};
-	if(OCG_CreateDuel(&duel, options) != OCG_DUEL_CREATION_SUCCESS)
-	{
-		ssdList.erase(ssdIter);
+	if(OCG_CreateDuel(&handle->duel, options) != OCG_DUEL_CREATION_SUCCESS)
 		throw Core::Exception(I18N::DLWRAPPER_EXCEPT_CREATE_DUEL);
-	}
-	ssdMap.insert({duel, ssdIter});
-	return duel;
+	return handle.release();
 }
 
 void DLWrapper::DestroyDuel(Duel duel)
 {
-	{
-		std::scoped_lock lock(ssdMutex);
-		ssdMap.erase(duel);
-	}
-	OCG_DestroyDuel(duel);
+	std::unique_ptr<Detail::DuelHandle> handle(static_cast<Detail::DuelHandle*>(duel));
+	OCG_DestroyDuel(handle->duel);
 }
 
 void DLWrapper::AddCard(Duel duel, const OCG_NewCardInfo& info)
 {
-	OCG_DuelNewCard(duel, info);
+	OCG_DuelNewCard(Unwrap(duel), info);
 }
 
 void DLWrapper::Start(Duel duel)
 {
-	OCG_StartDuel(duel);
+	OCG_StartDuel(Unwrap(duel));
 }
 
 IWrapper::DuelStatus DLWrapper::Process(Duel duel)
 {
-	return DuelStatus{OCG_DuelProcess(duel)};
+	return DuelStatus{OCG_DuelProcess(Unwrap(duel))};
 }
 
 IWrapper::Buffer DLWrapper::GetMessages(Duel duel)
 {
 	uint32_t length = 0U;
-	auto* pointer = OCG_DuelGetMessage(duel, &length);
+	auto* pointer = OCG_DuelGetMessage(Unwrap(duel), &length);
 	Buffer buffer(static_cast<Buffer::size_type>(length));
 	std::memcpy(buffer.data(), pointer, static_cast<std::size_t>(length));
 	return buffer;
 }
 
-void DLWrapper::SetResponse(Duel duel, const Buffer& buffer)
+std::pair<IWrapper::DuelStatus, IWrapper::BufferView> DLWrapper::ProcessAndGetMessages(Duel duel)
+{
+	const auto status = DuelStatus{OCG_DuelProcess(Unwrap(duel))};
+	uint32_t length = 0U;
+	const auto* pointer = static_cast<const uint8_t*>(OCG_DuelGetMessage(Unwrap(duel), &length));
+	return {status, {pointer, static_cast<std::size_t>(length)}};
+}
+
+void DLWrapper::SetResponse(Duel duel, BufferView buffer)
 {
-	OCG_DuelSetResponse(duel, buffer.data(), buffer.size());
+	OCG_DuelSetResponse(Unwrap(duel), buffer.data, buffer.size);
 }
 
 int DLWrapper::LoadScript(Duel duel, std::string_view name, std::string_view str)
 {
-	return OCG_LoadScript(duel, str.data(), str.size(), name.data());
+	return OCG_LoadScript(Unwrap(duel), str.data(), str.size(), name.data());
 }
 
 std::size_t DLWrapper::QueryCount(Duel duel, uint8_t team, uint32_t loc)
 {
-	return static_cast<std::size_t>(OCG_DuelQueryCount(duel, team, loc));
+	return static_cast<std::size_t>(OCG_DuelQueryCount(Unwrap(duel), team, loc));
 }
 
 IWrapper::Buffer DLWrapper::Query(Duel duel, const QueryInfo& info)
 {
 	uint32_t length = 0U;
-	auto* pointer = OCG_DuelQuery(duel, &length, info);
+	auto* pointer = OCG_DuelQuery(Unwrap(duel), &length, info);
 	Buffer buffer(static_cast<Buffer::size_type>(length));
 	std::memcpy(buffer.data(), pointer, static_cast<std::size_t>(length));
 	return buffer;
@@ -159,7 +165,7 @@ IWrapper::Buffer DLWrapper::Query(Duel duel, const QueryInfo& info)
 IWrapper::Buffer DLWrapper::QueryLocation(Duel duel, const QueryInfo& info)
 {
 	uint32_t length = 0U;
-	auto* pointer = OCG_DuelQueryLocation(duel, &length, info);
+	auto* pointer = OCG_DuelQueryLocation(Unwrap(duel), &length, info);
 	Buffer buffer(static_cast<Buffer::size_type>(length));
 	std::memcpy(buffer.data(), pointer, static_cast<std::size_t>(length));
 	return buffer;
@@ -168,7 +174,7 @@ IWrapper::Buffer DLWrapper::QueryLocation(Duel duel, const QueryInfo& info)
 IWrapper::Buffer DLWrapper::QueryField(Duel duel)
 {
 	uint32_t length = 0;
-	auto* pointer = OCG_DuelQueryField(duel, &length);
+	auto* pointer = OCG_DuelQueryField(Unwrap(duel), &length);
 	Buffer buffer(static_cast<Buffer::size_type>(length));
 	std::memcpy(buffer.data(), pointer, static_cast<std::size_t>(length));
 	return buffer;
@@ -1,8 +1,5 @@
 #ifndef DLWRAPPER_HPP
 #define DLWRAPPER_HPP
-#include <list>
-#include <map>
-#include <mutex>
 #include "IWrapper.hpp"
 
 namespace Ignis::Multirole::Core
@@ -17,6 +14,17 @@ struct ScriptSupplierData
 	int (*OCG_LoadScript)(OCG_Duel, const char*, uint32_t, const char*);
 };
 
+// What DLWrapper hands out as a duel. The script supplier core callback
+// must know which OCG_LoadScript function to call in order to pass the
+// correct data to the core, so that data is allocated along with the duel
+// and given to the core as the callback payload, without having to keep
+// track of it anywhere else.
+struct DuelHandle
+{
+	OCG_Duel duel;
+	ScriptSupplierData ssd;
+};
+
 } // namespace Detail
 
 class DLWrapper final : public IWrapper
@@ -34,7 +42,8 @@ public:
 
 	DuelStatus Process(Duel duel) override;
 	Buffer GetMessages(Duel duel) override;
-	void SetResponse(Duel duel, const Buffer& buffer) override;
+	std::pair<DuelStatus, BufferView> ProcessAndGetMessages(Duel duel) override;
+	void SetResponse(Duel duel, BufferView buffer) override;
 	int LoadScript(Duel duel, std::string_view name, std::string_view str) override;
 
 	std::size_t QueryCount(Duel duel, uint8_t team, uint32_t loc) override;
@@ -48,17 +57,6 @@ private:
 #define OCGFUNC(ret, name, args) ret (*name) args{nullptr};
 #include "../../ocgapi_funcs.inl"
 #undef OCGFUNC
-
-	// The script supplier core callback must know which OCG_LoadScript
-	// function to call in order to pass the correct data to the core,
-	// this is achieved by saving both the script supplier as well as the
-	// function pointer in the same struct. We own that information through
-	// the list, but since the list has no associated duel, we must also
-	// save the iterator in a map when we actually get the necessary key,
-	// in this case, the duel pointer after duel creation has succeeded.
-	std::list<Detail::ScriptSupplierData> ssdList;
-	std::map<Duel, std::list<Detail::ScriptSupplierData>::iterator> ssdMap;
-	std::mutex ssdMutex;
 };
 
 } // namespace Ignis::Multirole::Core
@@ -0,0 +1,145 @@
+#include "ExitWatcher.hpp"
+
+#include <array>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif // __linux__
+
+namespace Ignis::Multirole::Core
+{
+
+#ifdef __linux__
+inline int OpenPidFd(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+	return static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+#else
+	(void)pid;
+	return -1;
+#endif // SYS_pidfd_open
+}
+#endif // __linux__
+
+// public
+
+ExitWatcher& ExitWatcher::Get()
+{
+	static ExitWatcher instance;
+	return instance;
+}
+
+bool ExitWatcher::Watch([[maybe_unused]] Process::Data proc, [[maybe_unused]] Handler handler)
+{
+#ifdef __linux__
+	if(epollFd < 0)
+		return false;
+	// NOTE: Fails if the process was already reaped, which whoever asked
+	// notices anyway the next time they poll it.
+	const int fd = OpenPidFd(proc);
+	if(fd < 0)
+		return false;
+	std::scoped_lock lock(mtx);
+	epoll_event ev{};
+	ev.events = EPOLLIN;
+	ev.data.u64 = ++nextId;
+	if(epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) != 0)
+	{
+		close(fd);
+		return false;
+	}
+	entries.emplace(nextId, Entry{proc, fd, std::move(handler)});
+	return true;
+#else
+	return false;
+#endif // __linux__
+}
+
+void ExitWatcher::Unwatch([[maybe_unused]] Process::Data proc)
+{
+#ifdef __linux__
+	std::scoped_lock lock(mtx);
+	for(auto it = entries.begin(); it != entries.end(); ++it)
+	{
+		if(it->second.proc != proc)
+			continue;
+		epoll_ctl(epollFd, EPOLL_CTL_DEL, it->second.fd, nullptr);
+		close(it->second.fd);
+		entries.erase(it);
+		return;
+	}
+#endif // __linux__
+}
+
+// private
+
+ExitWatcher::ExitWatcher() :
+	epollFd(-1),
+	stopFd(-1),
+	nextId(0U)
+{
+#ifdef __linux__
+	epollFd = epoll_create1(EPOLL_CLOEXEC);
+	stopFd = eventfd(0U, EFD_CLOEXEC);
+	epoll_event ev{};
+	ev.events = EPOLLIN;
+	ev.data.u64 = 0U;
+	if(epollFd < 0 || stopFd < 0 || epoll_ctl(epollFd, EPOLL_CTL_ADD, stopFd, &ev) != 0)
+	{
+		if(epollFd >= 0)
+			close(epollFd);
+		if(stopFd >= 0)
+			close(stopFd);
+		epollFd = stopFd = -1;
+		return;
+	}
+	thread = std::thread(&ExitWatcher::Run, this);
+#endif // __linux__
+}
+
+ExitWatcher::~ExitWatcher()
+{
+#ifdef __linux__
+	if(epollFd < 0)
+		return;
+	const uint64_t one = 1U;
+	[[maybe_unused]] const auto w = write(stopFd, &one, sizeof(one));
+	thread.join();
+	for(const auto& kv : entries)
+		close(kv.second.fd);
+	close(stopFd);
+	close(epollFd);
+#endif // __linux__
+}
+
+void ExitWatcher::Run()
+{
+#ifdef __linux__
+	std::array<epoll_event, 16U> events{};
+	for(;;)
+	{
+		const int n = epoll_wait(epollFd, events.data(), static_cast<int>(events.size()), -1);
+		for(int i = 0; i < n; i++)
+		{
+			const auto id = events[static_cast<std::size_t>(i)].data.u64;
+			if(id == 0U)
+				return;
+			std::scoped_lock lock(mtx);
+			// NOTE: Might have been unwatched since epoll_wait returned.
+			auto it = entries.find(id);
+			if(it == entries.end())
+				continue;
+			epoll_ctl(epollFd, EPOLL_CTL_DEL, it->second.fd, nullptr);
+			close(it->second.fd);
+			const auto handler = std::move(it->second.handler);
+			entries.erase(it);
+			handler();
+		}
+	}
+#endif // __linux__
+}
+
+} // namespace Ignis::Multirole::Core
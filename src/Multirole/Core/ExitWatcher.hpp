@@ -0,0 +1,58 @@
+#ifndef EXITWATCHER_HPP
+#define EXITWATCHER_HPP
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#include "../../Process.hpp"
+
+namespace Ignis::Multirole::Core
+{
+
+// Process-wide watcher that calls back as soon as a watched process exits,
+// instead of that being noticed the next time someone polls for it. Every
+// process is watched from a single thread through its pidfd, so this only
+// works on Linux 5.3 onwards; elsewhere processes can't be watched and
+// whoever asked has to keep polling them.
+class ExitWatcher final
+{
+public:
+	using Handler = std::function<void()>;
+
+	static ExitWatcher& Get();
+
+	// Calls `handler` from the watcher thread once `proc` exits, unless it
+	// was unwatched before. Returns false if `proc` can't be watched.
+	bool Watch(Process::Data proc, Handler handler);
+
+	// Stops watching `proc`, once this returns its handler is not running
+	// and won't be called anymore.
+	void Unwatch(Process::Data proc);
+private:
+	struct Entry
+	{
+		Process::Data proc;
+		int fd;
+		Handler handler;
+	};
+
+	int epollFd;
+	int stopFd;
+	std::thread thread;
+	// NOTE: Keyed by an id rather than the pidfd, as a pidfd number can be
+	// reused while a stale event for it is still being handled.
+	std::unordered_map<uint64_t, Entry> entries;
+	uint64_t nextId; // 0 is reserved for stopping.
+	std::mutex mtx; // used for entries and nextId, held while handlers run.
+
+	ExitWatcher();
+	~ExitWatcher();
+
+	void Run();
+};
+
+} // namespace Ignis::Multirole::Core
+
+#endif // EXITWATCHER_HPP
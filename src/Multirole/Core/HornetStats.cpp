@@ -0,0 +1,143 @@
+#include "HornetStats.hpp"
+
+#include "../../HornetCommon.hpp"
+
+namespace Ignis::Multirole::Core
+{
+
+inline uint64_t ToMicroseconds(std::chrono::steady_clock::duration d)
+{
+	using namespace std::chrono;
+	return static_cast<uint64_t>(duration_cast<microseconds>(d).count());
+}
+
+// Shard the calling thread records onto, handed out round-robin.
+inline std::size_t ThisThreadShard()
+{
+	static std::atomic<std::size_t> next{};
+	thread_local const std::size_t shard =
+		next.fetch_add(1U, std::memory_order_relaxed) % HornetStats::SHARD_COUNT;
+	return shard;
+}
+
+// public
+
+void HornetStats::Histogram::Record(uint64_t value)
+{
+	std::size_t b = 0U;
+	for(uint64_t v = value; v > 1U && b < BUCKET_COUNT - 1U; v >>= 1U)
+		b++;
+	auto& s = shards[ThisThreadShard()];
+	s.buckets[b].fetch_add(1U, std::memory_order_relaxed);
+	s.count.fetch_add(1U, std::memory_order_relaxed);
+	s.sum.fetch_add(value, std::memory_order_relaxed);
+}
+
+uint64_t HornetStats::Histogram::Count() const
+{
+	uint64_t ret = 0U;
+	for(const auto& s : shards)
+		ret += s.count.load(std::memory_order_relaxed);
+	return ret;
+}
+
+uint64_t HornetStats::Histogram::Sum() const
+{
+	uint64_t ret = 0U;
+	for(const auto& s : shards)
+		ret += s.sum.load(std::memory_order_relaxed);
+	return ret;
+}
+
+std::array<uint64_t, HornetStats::BUCKET_COUNT> HornetStats::Histogram::Buckets() const
+{
+	std::array<uint64_t, BUCKET_COUNT> ret{};
+	for(const auto& s : shards)
+		for(std::size_t i = 0U; i < BUCKET_COUNT; i++)
+			ret[i] += s.buckets[i].load(std::memory_order_relaxed);
+	return ret;
+}
+
+void HornetStats::Counter::Add(int64_t delta)
+{
+	shards[ThisThreadShard()].value.fetch_add(delta, std::memory_order_relaxed);
+}
+
+int64_t HornetStats::Counter::Value() const
+{
+	int64_t ret = 0;
+	for(const auto& s : shards)
+		ret += s.value.load(std::memory_order_relaxed);
+	return ret;
+}
+
+HornetStats& HornetStats::Get()
+{
+	static HornetStats instance;
+	return instance;
+}
+
+std::string_view HornetStats::ActionName(Hornet::Action act)
+{
+	using namespace Hornet;
+	switch(act)
+	{
+#define X(a) case Action::a: return #a;
+	X(NO_WORK)
+	X(HEARTBEAT)
+	X(EXIT)
+	X(OCG_GET_VERSION)
+	X(OCG_CREATE_DUEL)
+	X(OCG_DESTROY_DUEL)
+	X(OCG_DUEL_NEW_CARD)
+	X(OCG_DUEL_NEW_CARDS)
+	X(OCG_START_DUEL)
+	X(OCG_DUEL_PROCESS)
+	X(OCG_DUEL_GET_MESSAGE)
+	X(OCG_DUEL_PROCESS_AND_GET_MESSAGE)
+	X(OCG_DUEL_SET_RESPONSE)
+	X(OCG_LOAD_SCRIPT)
+	X(OCG_DUEL_QUERY_COUNT)
+	X(OCG_DUEL_QUERY)
+	X(OCG_DUEL_QUERY_LOCATION)
+	X(OCG_DUEL_QUERY_FIELD)
+	X(OCG_DUEL_QUERY_BATCH)
+	X(CB_DATA_READER)
+	X(CB_SCRIPT_READER)
+	X(CB_LOG_HANDLER)
+	X(CB_DATA_READER_DONE)
+	X(CB_DONE)
+	X(ZYGOTE_FORK)
+#undef X
+	}
+	return {};
+}
+
+void HornetStats::RecordCall(Hornet::Action act, std::chrono::steady_clock::duration d, uint64_t callbacks)
+{
+	auto& s = stats[static_cast<std::size_t>(act)];
+	s.latencyUs.Record(ToMicroseconds(d));
+	s.callbacks.Record(callbacks);
+}
+
+void HornetStats::RecordCallback(Hornet::Action act, std::chrono::steady_clock::duration d)
+{
+	stats[static_cast<std::size_t>(act)].serveUs.Record(ToMicroseconds(d));
+}
+
+void HornetStats::AddProcesses(int64_t delta)
+{
+	processes.Add(delta);
+}
+
+const HornetStats::ActionStats& HornetStats::Of(Hornet::Action act) const
+{
+	return stats[static_cast<std::size_t>(act)];
+}
+
+int64_t HornetStats::Processes() const
+{
+	return processes.Value();
+}
+
+} // namespace Ignis::Multirole::Core
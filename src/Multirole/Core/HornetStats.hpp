@@ -0,0 +1,98 @@
+#ifndef HORNETSTATS_HPP
+#define HORNETSTATS_HPP
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string_view>
+
+namespace Ignis::Hornet
+{
+
+enum class Action : uint8_t;
+
+} // namespace Ignis::Hornet
+
+namespace Ignis::Multirole::Core
+{
+
+// Process-wide statistics of the calls done to hornet processes, recorded
+// by HornetWrapper and read by the stats endpoint.
+class HornetStats final
+{
+public:
+	// Power of two buckets, bucket 0 counts values lower than 2, bucket
+	// N counts values in [2^N, 2^(N+1)) and the last one anything bigger.
+	static constexpr std::size_t BUCKET_COUNT = 24U;
+
+	// Counters and histograms are split in shards, each thread recording
+	// onto its own so that they don't contend for the same cache lines.
+	// Shards are only added together when read.
+	static constexpr std::size_t SHARD_COUNT = 8U;
+
+	class Histogram final
+	{
+	public:
+		void Record(uint64_t value);
+
+		uint64_t Count() const;
+		uint64_t Sum() const;
+		std::array<uint64_t, BUCKET_COUNT> Buckets() const;
+	private:
+		struct alignas(64) Shard
+		{
+			std::array<std::atomic<uint64_t>, BUCKET_COUNT> buckets{};
+			std::atomic<uint64_t> count{};
+			std::atomic<uint64_t> sum{};
+		};
+		std::array<Shard, SHARD_COUNT> shards;
+	};
+
+	// Either a monotonic counter or a gauge, depending on whether it is
+	// only ever added to or not.
+	class Counter final
+	{
+	public:
+		void Add(int64_t delta);
+
+		int64_t Value() const;
+	private:
+		struct alignas(64) Shard
+		{
+			std::atomic<int64_t> value{};
+		};
+		std::array<Shard, SHARD_COUNT> shards;
+	};
+
+	// NOTE: Must be bigger than the amount of actions there are.
+	static constexpr std::size_t ACTION_COUNT = 32U;
+
+	struct ActionStats
+	{
+		Histogram latencyUs; // Wall-clock time of each top-level call.
+		Histogram callbacks; // Amount of callbacks served in each call.
+		Histogram serveUs; // Time spent serving a callback.
+	};
+
+	static HornetStats& Get();
+
+	static std::string_view ActionName(Hornet::Action act);
+
+	void RecordCall(Hornet::Action act, std::chrono::steady_clock::duration d, uint64_t callbacks);
+	void RecordCallback(Hornet::Action act, std::chrono::steady_clock::duration d);
+
+	// Records hornet processes started, or gone if negative.
+	void AddProcesses(int64_t delta);
+
+	const ActionStats& Of(Hornet::Action act) const;
+	int64_t Processes() const;
+private:
+	std::array<ActionStats, ACTION_COUNT> stats;
+	Counter processes;
+
+	HornetStats() = default;
+};
+
+} // namespace Ignis::Multirole::Core
+
+#endif // HORNETSTATS_HPP
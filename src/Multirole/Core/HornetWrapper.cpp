@@ -1,7 +1,8 @@
 #include "HornetWrapper.hpp"
 
-#include <boost/date_time/posix_time/posix_time_types.hpp>
-
+#include "ExitWatcher.hpp"
+#include "HornetStats.hpp"
+#include "HornetZygote.hpp"
 #include "IDataSupplier.hpp"
 #include "IScriptSupplier.hpp"
 #include "ILogger.hpp"
@@ -10,14 +11,18 @@
 #define PROCESS_IMPLEMENTATION
 #include "../../Process.hpp"
 
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#endif // _WIN32
+
+#include <algorithm>
+
+
 #ifndef MULTIROLE_HORNET_MAX_LOOP_COUNT
 #define MULTIROLE_HORNET_MAX_LOOP_COUNT 512U
 #endif // MULTIROLE_HORNET_MAX_LOOP_COUNT
 
-#ifndef MULTIROLE_HORNET_MAX_WAIT_COUNT
-#define MULTIROLE_HORNET_MAX_WAIT_COUNT 5U
-#endif // MULTIROLE_HORNET_MAX_WAIT_COUNT
-
 namespace Ignis::Multirole::Core
 {
 
@@ -31,71 +36,205 @@ inline std::string MakeHornetName(uintptr_t addr)
 	return std::string(buf.data());
 }
 
-inline ipc::shared_memory_object MakeShm(const std::string& str)
+// Longest a wait goes without checking whether the process is dead or
+// hanged, only matters for processes the exit watcher can't watch as
+// otherwise waits are interrupted as soon as the process exits.
+constexpr auto WAIT_SLICE = std::chrono::milliseconds(250U);
+
+// Loading the core might take longer than replying to a call is allowed to.
+constexpr auto STARTUP_TIMEOUT = std::chrono::seconds(60U);
+
+// Time to wait before checking again, until `deadline` at most.
+inline std::chrono::milliseconds NextWait(std::chrono::steady_clock::time_point deadline)
+{
+	using namespace std::chrono;
+	const auto left = duration_cast<milliseconds>(deadline - steady_clock::now());
+	return std::clamp(left, milliseconds(1), WAIT_SLICE);
+}
+
+inline ipc::shared_memory_object MakeShm(const std::string& str, std::size_t slotCount)
 {
 	// Make sure the shared memory object doesn't exist before attempting
 	// to create it again.
 	ipc::shared_memory_object::remove(str.data());
 	ipc::shared_memory_object shm(ipc::create_only, str.data(), ipc::read_write);
-	shm.truncate(sizeof(Hornet::SharedSegment));
+	shm.truncate(sizeof(Hornet::SharedSegment) * slotCount);
 	return shm;
 }
 
+#ifdef __linux__
+// Anonymous segment that hornet inherits instead of opening it by name, so
+// there's nothing left behind to clean up if multirole crashes. Returns -1
+// if it can't be made, in which case a named segment is used instead.
+inline int MakeMemFd(std::size_t size)
+{
+	const int fd = memfd_create("hornet", MFD_CLOEXEC);
+	if(fd < 0)
+		return -1;
+	if(ftruncate(fd, static_cast<off_t>(size)) != 0)
+	{
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+#endif // __linux__
+
 // public
 
-HornetWrapper::HornetWrapper(std::string_view absFilePath) :
+HornetWrapper::HornetWrapper(
+	std::string_view absFilePath,
+	std::size_t slotCount,
+	HornetZygote* zygote,
+	std::chrono::milliseconds hangTimeout,
+	bool anonymous,
+	bool hugePages)
+	:
 	shmName(MakeHornetName(reinterpret_cast<uintptr_t>(this))),
-	shm(MakeShm(shmName)),
-	region(shm, ipc::read_write),
+	slotCount(std::max<std::size_t>(slotCount, 1U)),
+	anonymousSize(0U),
 	hss(nullptr),
-	hanged(false)
+	proc(),
+	forked(false),
+	hanged(false),
+	exited(false),
+	hangTimeout(std::max(hangTimeout, std::chrono::milliseconds(1)))
 {
-	void* addr = region.get_address();
-	hss = new (addr) Hornet::SharedSegment();
-	const auto p = Process::Launch("./hornet", absFilePath.data(), shmName.data());
-	if(!p.second)
+	const std::size_t segmentSize = sizeof(Hornet::SharedSegment) * this->slotCount;
+	int segmentFd = -1;
+#ifdef __linux__
+	// NOTE: Forked hornets are children of the zygote, they can't inherit it.
+	if(anonymous && zygote == nullptr && (segmentFd = MakeMemFd(segmentSize)) >= 0)
 	{
-		DestroySharedSegment();
-		throw std::runtime_error(I18N::HWRAPPER_UNABLE_TO_LAUNCH);
+		void* addr = mmap(nullptr, segmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, segmentFd, 0);
+		if(addr == MAP_FAILED)
+		{
+			close(segmentFd);
+			segmentFd = -1;
+		}
+		else
+		{
+			hss = static_cast<Hornet::SharedSegment*>(addr);
+			anonymousSize = segmentSize;
+		}
+	}
+#else
+	(void)anonymous;
+#endif // __linux__
+	if(hss == nullptr)
+	{
+		shm = MakeShm(shmName, this->slotCount);
+		region = ipc::mapped_region(shm, ipc::read_write);
+		hss = static_cast<Hornet::SharedSegment*>(region.get_address());
+	}
+	// NOTE: Default-initializing so the segment bytes are left untouched.
+	for(std::size_t i = 0U; i < this->slotCount; i++)
+		new (hss + i) Hornet::SharedSegment;
+#ifdef MADV_HUGEPAGE
+	// Trades committing pages lazily for less TLB pressure on busy slots.
+	// NOTE: Only the pages fully within each payload are advised, so the
+	// headers, which are touched on every call, are left as they were.
+	if(hugePages)
+	{
+		const auto pageSize = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+		for(std::size_t i = 0U; i < this->slotCount; i++)
+		{
+			const auto first = reinterpret_cast<uintptr_t>(hss[i].bytes.data());
+			const auto last = first + hss[i].bytes.size();
+			const auto begin = (first + pageSize - 1U) / pageSize * pageSize;
+			const auto end = last / pageSize * pageSize;
+			if(begin < end)
+				madvise(reinterpret_cast<void*>(begin), end - begin, MADV_HUGEPAGE);
+		}
+	}
+#else
+	(void)hugePages;
+#endif // MADV_HUGEPAGE
+	freeSlots.reserve(this->slotCount);
+	for(std::size_t i = this->slotCount; i > 0U; i--)
+		freeSlots.push_back(i - 1U);
+	if(zygote != nullptr)
+	{
+		try
+		{
+			proc = zygote->Fork(shmName, this->slotCount);
+			forked = true;
+		}
+		catch(const std::runtime_error& e)
+		{
+			DestroySharedSegment();
+			throw;
+		}
+	}
+	else
+	{
+		const auto slotCountStr = std::to_string(this->slotCount);
+#ifdef __linux__
+		const auto p = (segmentFd >= 0) ?
+			Process::LaunchWithFd(segmentFd, "./hornet", absFilePath.data(), shmName.data(),
+				slotCountStr.data(), std::to_string(segmentFd).data()) :
+			Process::Launch("./hornet", absFilePath.data(), shmName.data(), slotCountStr.data());
+		// NOTE: Only hornet needs it from now on, the mapping stays.
+		if(segmentFd >= 0)
+			close(segmentFd);
+#else
+		const auto p = Process::Launch("./hornet", absFilePath.data(), shmName.data(), slotCountStr.data());
+#endif // __linux__
+		if(!p.second)
+		{
+			DestroySharedSegment();
+			throw std::runtime_error(I18N::HWRAPPER_UNABLE_TO_LAUNCH);
+		}
+		proc = p.first;
 	}
-	proc = p.first;
+	// NOTE: Waits are still given up on after each slice if the process
+	// can't be watched, so failing to watch it is not an error.
+	ExitWatcher::Get().Watch(proc, [this](){OnProcExit();});
 	try
 	{
-		NotifyAndWait(Hornet::Action::HEARTBEAT);
+		// Make sure every slot is being served.
+		for(std::size_t i = 0U; i < this->slotCount; i++)
+			NotifyAndWait(hss[i], Hornet::Action::HEARTBEAT, std::max<std::chrono::milliseconds>(this->hangTimeout, STARTUP_TIMEOUT));
 	}
 	catch(Core::Exception& e)
 	{
 		// NOTE: Not necessary to check hanged or kill as HEARTBEAT is
 		// under our control.
-		Process::CleanUp(proc);
+		ExitWatcher::Get().Unwatch(proc);
+		CleanUpProc();
 		DestroySharedSegment();
 		throw std::runtime_error(I18N::HWRAPPER_HEARTBEAT_FAILURE);
 	}
+	HornetStats::Get().AddProcesses(1);
 }
 
 HornetWrapper::~HornetWrapper()
 {
+	ExitWatcher::Get().Unwatch(proc);
 	// Even if process was hanged, there is no guarantee that it will be now
 	// and that hornet is not performing a wait on the condition variable.
 	// This avoids deadlocking when calling the shared segment destructor.
-	{
-		Hornet::LockType lock(hss->mtx);
-		hss->act = Hornet::Action::EXIT;
-		hss->cv.notify_one();
-	}
+	for(std::size_t i = 0U; i < slotCount; i++)
+		Hornet::Post(hss[i], Hornet::Action::EXIT);
 	// If process is hanged we can't guarantee it'll handle our notification.
 	// Kill anyways.
-	if(hanged && Process::IsRunning(proc))
+	if(hanged && IsProcRunning())
 		Process::Kill(proc);
-	Process::CleanUp(proc);
+	CleanUpProc();
 	DestroySharedSegment();
+	HornetStats::Get().AddProcesses(-1);
+}
+
+Process::Data HornetWrapper::Proc() const
+{
+	return proc;
 }
 
 std::pair<int, int> HornetWrapper::Version()
 {
-	std::scoped_lock lock(mtx);
-	NotifyAndWait(Hornet::Action::OCG_GET_VERSION);
-	const auto* rptr = hss->bytes.data();
+	const SlotGuard slot(*this);
+	NotifyAndWait(*slot, Hornet::Action::OCG_GET_VERSION);
+	const auto* rptr = slot->bytes.data();
 	return
 	{
 		Read<int>(rptr),
@@ -105,8 +244,8 @@ std::pair<int, int> HornetWrapper::Version()
 
 IWrapper::Duel HornetWrapper::CreateDuel(const DuelOptions& opts)
 {
-	std::scoped_lock lock(mtx);
-	auto* wptr = hss->bytes.data();
+	const SlotGuard slot(*this);
+	auto* wptr = slot->bytes.data();
 	Write<OCG_DuelOptions>(wptr,
 	{
 		opts.seed,
@@ -122,8 +261,17 @@ IWrapper::Duel HornetWrapper::CreateDuel(const DuelOptions& opts)
 		nullptr, // NOTE: Set on Hornet
 		&opts.dataSupplier
 	});
-	NotifyAndWait(Hornet::Action::OCG_CREATE_DUEL);
-	const auto* rptr = hss->bytes.data();
+	const auto tableName = opts.dataSupplier.SharedTableName();
+	Write<std::size_t>(wptr, tableName.size());
+	if(!tableName.empty())
+		std::memcpy(wptr, tableName.data(), tableName.size());
+	wptr += tableName.size();
+	const auto scriptTableName = opts.scriptSupplier.SharedTableName();
+	Write<std::size_t>(wptr, scriptTableName.size());
+	if(!scriptTableName.empty())
+		std::memcpy(wptr, scriptTableName.data(), scriptTableName.size());
+	NotifyAndWait(*slot, Hornet::Action::OCG_CREATE_DUEL);
+	const auto* rptr = slot->bytes.data();
 	if(Read<int>(rptr) != OCG_DUEL_CREATION_SUCCESS)
 		throw Core::Exception(I18N::HWRAPPER_EXCEPT_CREATE_DUEL);
 	return Read<OCG_Duel>(rptr);
@@ -131,130 +279,211 @@ IWrapper::Duel HornetWrapper::CreateDuel(const DuelOptions& opts)
 
 void HornetWrapper::DestroyDuel(Duel duel)
 {
-	std::scoped_lock lock(mtx);
-	auto* wptr = hss->bytes.data();
+	const SlotGuard slot(*this);
+	auto* wptr = slot->bytes.data();
 	Write<OCG_Duel>(wptr, duel);
-	NotifyAndWait(Hornet::Action::OCG_DESTROY_DUEL);
+	NotifyAndWait(*slot, Hornet::Action::OCG_DESTROY_DUEL);
+	std::scoped_lock lock(mMsgBuffers);
+	msgBuffers.erase(duel);
 }
 
 void HornetWrapper::AddCard(Duel duel, const OCG_NewCardInfo& info)
 {
-	std::scoped_lock lock(mtx);
-	auto* wptr = hss->bytes.data();
+	const SlotGuard slot(*this);
+	auto* wptr = slot->bytes.data();
 	Write<OCG_Duel>(wptr, duel);
 	Write<OCG_NewCardInfo>(wptr, info);
-	NotifyAndWait(Hornet::Action::OCG_DUEL_NEW_CARD);
+	NotifyAndWait(*slot, Hornet::Action::OCG_DUEL_NEW_CARD);
+}
+
+void HornetWrapper::AddCards(Duel duel, const std::vector<OCG_NewCardInfo>& infos)
+{
+	// Cards that fit in the segment along with the duel and their count.
+	constexpr std::size_t MAX_BATCH =
+		(sizeof(Hornet::SharedSegment::bytes) - sizeof(OCG_Duel) - sizeof(std::size_t)) /
+		sizeof(OCG_NewCardInfo);
+	const SlotGuard slot(*this);
+	for(std::size_t first = 0U; first < infos.size(); first += MAX_BATCH)
+	{
+		const auto count = std::min(infos.size() - first, MAX_BATCH);
+		auto* wptr = slot->bytes.data();
+		Write<OCG_Duel>(wptr, duel);
+		Write<std::size_t>(wptr, count);
+		std::memcpy(wptr, infos.data() + first, count * sizeof(OCG_NewCardInfo));
+		NotifyAndWait(*slot, Hornet::Action::OCG_DUEL_NEW_CARDS);
+	}
 }
 
 void HornetWrapper::Start(Duel duel)
 {
-	std::scoped_lock lock(mtx);
-	auto* wptr = hss->bytes.data();
+	const SlotGuard slot(*this);
+	auto* wptr = slot->bytes.data();
 	Write<OCG_Duel>(wptr, duel);
-	NotifyAndWait(Hornet::Action::OCG_START_DUEL);
+	NotifyAndWait(*slot, Hornet::Action::OCG_START_DUEL);
 }
 
 IWrapper::DuelStatus HornetWrapper::Process(Duel duel)
 {
-	std::scoped_lock lock(mtx);
-	auto* wptr = hss->bytes.data();
+	const SlotGuard slot(*this);
+	auto* wptr = slot->bytes.data();
 	Write<OCG_Duel>(wptr, duel);
-	NotifyAndWait(Hornet::Action::OCG_DUEL_PROCESS);
-	const auto* rptr = hss->bytes.data();
+	NotifyAndWait(*slot, Hornet::Action::OCG_DUEL_PROCESS);
+	const auto* rptr = slot->bytes.data();
 	return DuelStatus{Read<int>(rptr)};
 }
 
 IWrapper::Buffer HornetWrapper::GetMessages(Duel duel)
 {
-	std::scoped_lock lock(mtx);
-	auto* wptr = hss->bytes.data();
+	const SlotGuard slot(*this);
+	auto* wptr = slot->bytes.data();
 	Write<OCG_Duel>(wptr, duel);
-	NotifyAndWait(Hornet::Action::OCG_DUEL_GET_MESSAGE);
-	const auto* rptr = hss->bytes.data();
-	const auto size = static_cast<std::size_t>(Read<uint32_t>(rptr));
-	Buffer buffer(size);
-	std::memcpy(buffer.data(), rptr, size);
+	NotifyAndWait(*slot, Hornet::Action::OCG_DUEL_GET_MESSAGE);
+	const auto* rptr = slot->bytes.data();
+	Buffer buffer;
+	ReadSized(*slot, rptr, buffer);
 	return buffer;
 }
 
-void HornetWrapper::SetResponse(Duel duel, const Buffer& buffer)
+std::pair<IWrapper::DuelStatus, IWrapper::BufferView> HornetWrapper::ProcessAndGetMessages(Duel duel)
 {
-	std::scoped_lock lock(mtx);
-	auto* wptr = hss->bytes.data();
+	const SlotGuard slot(*this);
+	auto* wptr = slot->bytes.data();
 	Write<OCG_Duel>(wptr, duel);
-	Write<std::size_t>(wptr, buffer.size());
-	std::memcpy(wptr, buffer.data(), buffer.size());
-	NotifyAndWait(Hornet::Action::OCG_DUEL_SET_RESPONSE);
+	NotifyAndWait(*slot, Hornet::Action::OCG_DUEL_PROCESS_AND_GET_MESSAGE);
+	const auto* rptr = slot->bytes.data();
+	const auto status = DuelStatus{Read<int>(rptr)};
+	// NOTE: The slot is released as soon as we return, so messages are
+	// copied into a buffer kept per duel which only grows when needed.
+	Buffer* buffer = nullptr;
+	{
+		std::scoped_lock lock(mMsgBuffers);
+		buffer = &msgBuffers[duel];
+	}
+	ReadSized(*slot, rptr, *buffer);
+	return {status, {buffer->data(), buffer->size()}};
+}
+
+void HornetWrapper::SetResponse(Duel duel, BufferView buffer)
+{
+	const SlotGuard slot(*this);
+	auto* wptr = slot->bytes.data();
+	Write<OCG_Duel>(wptr, duel);
+	if(!WriteSized(*slot, wptr, buffer.data, buffer.size))
+		throw Core::Exception(I18N::HWRAPPER_EXCEPT_OVERFLOW);
+	NotifyAndWait(*slot, Hornet::Action::OCG_DUEL_SET_RESPONSE);
 }
 
 int HornetWrapper::LoadScript(Duel duel, std::string_view name, std::string_view str)
 {
-	std::scoped_lock lock(mtx);
-	auto* wptr = hss->bytes.data();
+	const SlotGuard slot(*this);
+	auto* wptr = slot->bytes.data();
 	Write<OCG_Duel>(wptr, duel);
+	// NOTE: Only the script is spilled, its name has to fit.
+	if(sizeof(std::size_t) + name.size() + sizeof(uint32_t) > Hornet::BytesLeft(*slot, wptr))
+		return 0;
 	Write<std::size_t>(wptr, name.size());
 	std::memcpy(wptr, name.data(), name.size());
 	wptr += name.size();
-	Write<std::size_t>(wptr, str.size());
-	std::memcpy(wptr, str.data(), str.size());
-	NotifyAndWait(Hornet::Action::OCG_LOAD_SCRIPT);
-	const auto* rptr = hss->bytes.data();
+	if(!WriteSized(*slot, wptr, str.data(), str.size()))
+		return 0;
+	NotifyAndWait(*slot, Hornet::Action::OCG_LOAD_SCRIPT);
+	const auto* rptr = slot->bytes.data();
 	return Read<int>(rptr);
 }
 
 std::size_t HornetWrapper::QueryCount(Duel duel, uint8_t team, uint32_t loc)
 {
-	std::scoped_lock lock(mtx);
-	auto* wptr = hss->bytes.data();
+	const SlotGuard slot(*this);
+	auto* wptr = slot->bytes.data();
 	Write<OCG_Duel>(wptr, duel);
 	Write<uint8_t>(wptr, team);
 	Write<uint32_t>(wptr, loc);
-	NotifyAndWait(Hornet::Action::OCG_DUEL_QUERY_COUNT);
-	const auto* rptr = hss->bytes.data();
+	NotifyAndWait(*slot, Hornet::Action::OCG_DUEL_QUERY_COUNT);
+	const auto* rptr = slot->bytes.data();
 	return static_cast<std::size_t>(Read<uint32_t>(rptr));
 }
 
 IWrapper::Buffer HornetWrapper::Query(Duel duel, const QueryInfo& info)
 {
-	std::scoped_lock lock(mtx);
-	auto* wptr = hss->bytes.data();
+	const SlotGuard slot(*this);
+	auto* wptr = slot->bytes.data();
 	Write<OCG_Duel>(wptr, duel);
 	Write<OCG_QueryInfo>(wptr, info);
-	NotifyAndWait(Hornet::Action::OCG_DUEL_QUERY);
-	const auto* rptr = hss->bytes.data();
-	const auto size = static_cast<std::size_t>(Read<uint32_t>(rptr));
-	Buffer buffer(size);
-	std::memcpy(buffer.data(), rptr, size);
+	NotifyAndWait(*slot, Hornet::Action::OCG_DUEL_QUERY);
+	const auto* rptr = slot->bytes.data();
+	Buffer buffer;
+	ReadSized(*slot, rptr, buffer);
 	return buffer;
 }
 
 IWrapper::Buffer HornetWrapper::QueryLocation(Duel duel, const QueryInfo& info)
 {
-	std::scoped_lock lock(mtx);
-	auto* wptr = hss->bytes.data();
+	const SlotGuard slot(*this);
+	auto* wptr = slot->bytes.data();
 	Write<OCG_Duel>(wptr, duel);
 	Write<OCG_QueryInfo>(wptr, info);
-	NotifyAndWait(Hornet::Action::OCG_DUEL_QUERY_LOCATION);
-	const auto* rptr = hss->bytes.data();
-	const auto size = static_cast<std::size_t>(Read<uint32_t>(rptr));
-	Buffer buffer(size);
-	std::memcpy(buffer.data(), rptr, size);
+	NotifyAndWait(*slot, Hornet::Action::OCG_DUEL_QUERY_LOCATION);
+	const auto* rptr = slot->bytes.data();
+	Buffer buffer;
+	ReadSized(*slot, rptr, buffer);
 	return buffer;
 }
 
 IWrapper::Buffer HornetWrapper::QueryField(Duel duel)
 {
-	std::scoped_lock lock(mtx);
-	auto* wptr = hss->bytes.data();
+	const SlotGuard slot(*this);
+	auto* wptr = slot->bytes.data();
 	Write<OCG_Duel>(wptr, duel);
-	NotifyAndWait(Hornet::Action::OCG_DUEL_QUERY_FIELD);
-	const auto* rptr = hss->bytes.data();
-	auto size = static_cast<std::size_t>(Read<uint32_t>(rptr));
-	Buffer buffer(size);
-	std::memcpy(buffer.data(), rptr, size);
+	NotifyAndWait(*slot, Hornet::Action::OCG_DUEL_QUERY_FIELD);
+	const auto* rptr = slot->bytes.data();
+	Buffer buffer;
+	ReadSized(*slot, rptr, buffer);
 	return buffer;
 }
 
+void HornetWrapper::QueryBatch(Duel duel, const std::vector<BatchQuery>& queries, std::vector<Buffer>& out)
+{
+	// Queries that fit in the segment along with the duel and their count.
+	constexpr std::size_t MAX_BATCH =
+		(sizeof(Hornet::SharedSegment::bytes) - sizeof(OCG_Duel) - sizeof(uint32_t)) /
+		(sizeof(Hornet::QueryKind) + sizeof(OCG_QueryInfo));
+	out.resize(queries.size());
+	const SlotGuard slot(*this);
+	Buffer results; // Length-prefixed results of a whole batch.
+	for(std::size_t first = 0U; first < queries.size(); first += MAX_BATCH)
+	{
+		const auto count = std::min(queries.size() - first, MAX_BATCH);
+		auto* wptr = slot->bytes.data();
+		Write<OCG_Duel>(wptr, duel);
+		Write<uint32_t>(wptr, static_cast<uint32_t>(count));
+		for(std::size_t i = first; i < first + count; i++)
+		{
+			const auto kind = [k = queries[i].kind]()
+			{
+				switch(k)
+				{
+				case BatchQuery::Kind::COUNT: return Hornet::QueryKind::COUNT;
+				case BatchQuery::Kind::SINGLE: return Hornet::QueryKind::SINGLE;
+				case BatchQuery::Kind::LOCATION: break;
+				}
+				return Hornet::QueryKind::LOCATION;
+			}();
+			Write<Hornet::QueryKind>(wptr, kind);
+			Write<OCG_QueryInfo>(wptr, queries[i].info);
+		}
+		NotifyAndWait(*slot, Hornet::Action::OCG_DUEL_QUERY_BATCH);
+		const auto* rptr = slot->bytes.data();
+		ReadSized(*slot, rptr, results);
+		const auto* result = results.data();
+		for(std::size_t i = first; i < first + count; i++)
+		{
+			const auto size = static_cast<std::size_t>(Read<uint32_t>(result));
+			out[i].assign(result, result + size);
+			result += size;
+		}
+	}
+}
+
 void HornetWrapper::DestroySharedSegment()
 {
 	// NOTE: From Boost.Interprocess documentation:
@@ -263,19 +492,126 @@ void HornetWrapper::DestroySharedSegment()
 	// they have exited their respective wait functions.
 	// If this is called while Hornet is waiting on the condition variable
 	// the calling thread will hang, or worse, the whole process will crash.
-	hss->~SharedSegment();
+	for(std::size_t i = 0U; i < slotCount; i++)
+	{
+		hss[i].~SharedSegment();
+		ipc::shared_memory_object::remove(Hornet::OverflowName(shmName, i).data());
+	}
+#ifndef _WIN32
+	if(anonymousSize != 0U)
+	{
+		munmap(hss, anonymousSize);
+		return;
+	}
+#endif // _WIN32
 	ipc::shared_memory_object::remove(shmName.data());
 }
 
-void HornetWrapper::NotifyAndWait(Hornet::Action act)
+void HornetWrapper::OnProcExit()
 {
-	// Time to wait before checking for process being dead
-	auto NowPlusOffset = []() -> boost::posix_time::ptime
+	exited = true;
+	for(std::size_t i = 0U; i < slotCount; i++)
+		Hornet::Interrupt(hss[i]);
+}
+
+bool HornetWrapper::IsProcRunning() const
+{
+	return forked ? Process::IsAlive(proc) : Process::IsRunning(proc);
+}
+
+void HornetWrapper::CleanUpProc() const
+{
+	if(forked)
+		Process::WaitUntilGone(proc);
+	else
+		Process::CleanUp(proc);
+}
+
+void HornetWrapper::ReadSized(const Hornet::SharedSegment& ss, const uint8_t* rptr, Buffer& out) const
+{
+	const auto size = static_cast<std::size_t>(Read<uint32_t>(rptr));
+	out.resize(size);
+	if(size <= Hornet::BytesLeft(ss, rptr))
 	{
-		auto now = boost::posix_time::second_clock::universal_time();
-		now += boost::posix_time::seconds(10U);
-		return now;
-	};
+		std::memcpy(out.data(), rptr, size);
+		return;
+	}
+	const auto name = Hornet::OverflowName(shmName, static_cast<std::size_t>(&ss - hss));
+	try
+	{
+		ipc::shared_memory_object ovf(ipc::open_only, name.data(), ipc::read_only);
+		ipc::mapped_region region(ovf, ipc::read_only, 0, size);
+		std::memcpy(out.data(), region.get_address(), size);
+	}
+	catch(const ipc::interprocess_exception& e)
+	{
+		throw Core::Exception(I18N::HWRAPPER_EXCEPT_OVERFLOW);
+	}
+}
+
+bool HornetWrapper::WriteSized(Hornet::SharedSegment& ss, uint8_t* wptr, const void* data, std::size_t size) const
+{
+	auto* sizePtr = wptr;
+	Write<uint32_t>(wptr, static_cast<uint32_t>(size));
+	if(size <= Hornet::BytesLeft(ss, wptr))
+	{
+		std::memcpy(wptr, data, size);
+		return true;
+	}
+	const auto name = Hornet::OverflowName(shmName, static_cast<std::size_t>(&ss - hss));
+	try
+	{
+		ipc::shared_memory_object ovf(ipc::open_or_create, name.data(), ipc::read_write);
+		// NOTE: Never shrunk, as hornet might have it mapped already.
+		ipc::offset_t current = 0;
+		if(!ovf.get_size(current) || current < static_cast<ipc::offset_t>(size))
+			ovf.truncate(static_cast<ipc::offset_t>(size));
+		ipc::mapped_region region(ovf, ipc::read_write, 0, size);
+		std::memcpy(region.get_address(), data, size);
+		return true;
+	}
+	catch(const ipc::interprocess_exception& e)
+	{
+		Write<uint32_t>(sizePtr, 0U);
+		return false;
+	}
+}
+
+HornetWrapper::SlotGuard::SlotGuard(HornetWrapper& hw) : hw(hw)
+{
+	std::unique_lock lock(hw.mtx);
+	hw.cv.wait(lock, [&](){return !hw.freeSlots.empty();});
+	ss = &hw.hss[hw.freeSlots.back()];
+	hw.freeSlots.pop_back();
+}
+
+HornetWrapper::SlotGuard::~SlotGuard()
+{
+	{
+		std::scoped_lock lock(hw.mtx);
+		hw.freeSlots.push_back(static_cast<std::size_t>(ss - hw.hss));
+	}
+	hw.cv.notify_one();
+}
+
+Hornet::SharedSegment& HornetWrapper::SlotGuard::operator*() const
+{
+	return *ss;
+}
+
+Hornet::SharedSegment* HornetWrapper::SlotGuard::operator->() const
+{
+	return ss;
+}
+
+void HornetWrapper::NotifyAndWait(Hornet::SharedSegment& ss, Hornet::Action act, std::chrono::milliseconds timeout)
+{
+	if(timeout.count() == 0)
+		timeout = hangTimeout;
+	using Clock = std::chrono::steady_clock;
+	const auto callAct = act;
+	const auto callStart = Clock::now();
+	auto& stats = HornetStats::Get();
 	Hornet::Action recvAct = Hornet::Action::NO_WORK;
 	std::size_t loopCount = 0U;
 	do
@@ -287,96 +623,110 @@ void HornetWrapper::NotifyAndWait(Hornet::Action act)
 		}
 		// Atomically fetch next action, if any.
 		{
-			std::size_t waitCount = 0U;
-			Hornet::LockType lock(hss->mtx);
-			hss->act = act;
-			hss->cv.notify_one();
-			while(!hss->cv.timed_wait(lock, NowPlusOffset(), [&](){return hss->act != act;}))
+			Hornet::Post(ss, act);
+			const auto deadline = Clock::now() + timeout;
+			std::optional<Hornet::Action> next;
+			while(!(next = Hornet::WaitWhile(ss, act, NextWait(deadline))))
 			{
-				if(!Process::IsRunning(proc))
-					throw Core::Exception(I18N::HWRAPPER_EXCEPT_PROC_CRASHED);
-				if(waitCount++ <= MULTIROLE_HORNET_MAX_WAIT_COUNT)
+				if(exited || !IsProcRunning())
+					throw Core::Exception(I18N::HWRAPPER_EXCEPT_PROC_CRASHED, true);
+				if(Clock::now() < deadline)
 					continue;
 				hanged = true;
 				throw Core::Exception(I18N::HWRAPPER_EXCEPT_PROC_UNRESPONSIVE);
 			}
-			recvAct = hss->act;
-		}
-		// If action sent by hornet requires handling then it should be
-		// implemented here and hornet should always be notified back,
-		// otherwise it'll wait endlessly.
-		switch(recvAct)
-		{
-		case Hornet::Action::CB_DATA_READER:
-		{
-			const auto* rptr = hss->bytes.data();
-			auto* supplier = static_cast<IDataSupplier*>(Read<void*>(rptr));
-			const OCG_CardData data = supplier->DataFromCode(Read<uint32_t>(rptr));
-			auto* wptr = hss->bytes.data();
-			Write<OCG_CardData>(wptr, data);
-			if(data.setcodes != nullptr)
-				for(uint16_t* wptr2 = data.setcodes; *wptr2 != 0U; wptr2++)
-					Write<uint16_t>(wptr, *wptr2);
-			Write<uint16_t>(wptr, 0U);
-			act = Hornet::Action::CB_DONE;
-			break;
-		}
-		case Hornet::Action::CB_SCRIPT_READER:
-		{
-			const auto* rptr = hss->bytes.data();
-			auto* supplier = static_cast<IScriptSupplier*>(Read<void*>(rptr));
-			const auto nameSz = Read<std::size_t>(rptr);
-			const std::string_view nameSv(reinterpret_cast<const char*>(rptr), nameSz);
-			std::string script = supplier->ScriptFromFilePath(nameSv);
-			auto* wptr = hss->bytes.data();
-			Write<std::size_t>(wptr, script.size());
-			if(!script.empty())
-				std::memcpy(wptr, script.data(), script.size());
-			act = Hornet::Action::CB_DONE;
-			break;
+			recvAct = *next;
 		}
-		case Hornet::Action::CB_LOG_HANDLER:
+		const auto serveStart = Clock::now();
+		if(ServeCallback(ss, recvAct))
 		{
-			const auto* rptr = hss->bytes.data();
-			auto* logger = static_cast<ILogger*>(Read<void*>(rptr));
-			const auto type = ILogger::LogType{Read<int>(rptr)};
-			const auto strSz = Read<std::size_t>(rptr);
-			const std::string_view strSv(reinterpret_cast<const char*>(rptr), strSz);
-			if(logger != nullptr)
-				logger->Log(type, strSv);
 			act = Hornet::Action::CB_DONE;
-			break;
-		}
-		case Hornet::Action::CB_DATA_READER_DONE:
-		{
-			const auto* rptr = hss->bytes.data();
-			auto* supplier = static_cast<IDataSupplier*>(Read<void*>(rptr));
-			const auto data = Read<OCG_CardData>(rptr);
-			supplier->DataUsageDone(data);
-			act = Hornet::Action::CB_DONE;
-			break;
-		}
-		// Explicitly ignore these, in case we ever add more functionality...
-		case Hornet::Action::NO_WORK:
-		case Hornet::Action::HEARTBEAT:
-		case Hornet::Action::EXIT:
-		case Hornet::Action::OCG_GET_VERSION:
-		case Hornet::Action::OCG_CREATE_DUEL:
-		case Hornet::Action::OCG_DESTROY_DUEL:
-		case Hornet::Action::OCG_DUEL_NEW_CARD:
-		case Hornet::Action::OCG_START_DUEL:
-		case Hornet::Action::OCG_DUEL_PROCESS:
-		case Hornet::Action::OCG_DUEL_GET_MESSAGE:
-		case Hornet::Action::OCG_DUEL_SET_RESPONSE:
-		case Hornet::Action::OCG_LOAD_SCRIPT:
-		case Hornet::Action::OCG_DUEL_QUERY_COUNT:
-		case Hornet::Action::OCG_DUEL_QUERY:
-		case Hornet::Action::OCG_DUEL_QUERY_LOCATION:
-		case Hornet::Action::OCG_DUEL_QUERY_FIELD:
-		case Hornet::Action::CB_DONE:
-			break;
+			stats.RecordCallback(recvAct, Clock::now() - serveStart);
 		}
 	}while(recvAct != Hornet::Action::NO_WORK);
+	// NOTE: Last loop is the one that received NO_WORK, not a callback.
+	stats.RecordCall(callAct, Clock::now() - callStart, loopCount - 1U);
+}
+
+bool HornetWrapper::ServeCallback(Hornet::SharedSegment& ss, Hornet::Action recvAct)
+{
+	// If action sent by hornet requires handling then it should be
+	// implemented here and hornet should always be notified back,
+	// otherwise it'll wait endlessly.
+	switch(recvAct)
+	{
+	case Hornet::Action::CB_DATA_READER:
+	{
+		const auto* rptr = ss.bytes.data();
+		auto* supplier = static_cast<IDataSupplier*>(Read<void*>(rptr));
+		const OCG_CardData data = supplier->DataFromCode(Read<uint32_t>(rptr));
+		auto* wptr = ss.bytes.data();
+		Write<OCG_CardData>(wptr, data);
+		if(data.setcodes != nullptr)
+			for(uint16_t* wptr2 = data.setcodes; *wptr2 != 0U; wptr2++)
+				Write<uint16_t>(wptr, *wptr2);
+		Write<uint16_t>(wptr, 0U);
+		return true;
+	}
+	case Hornet::Action::CB_SCRIPT_READER:
+	{
+		const auto* rptr = ss.bytes.data();
+		auto* supplier = static_cast<IScriptSupplier*>(Read<void*>(rptr));
+		const auto nameSz = Read<std::size_t>(rptr);
+		const std::string_view nameSv(reinterpret_cast<const char*>(rptr), nameSz);
+		const auto script = supplier->ScriptFromFilePath(nameSv);
+		auto* wptr = ss.bytes.data();
+		// NOTE: A script that couldn't be spilled is handed over as missing.
+		if(script)
+			WriteSized(ss, wptr, script->data(), script->size());
+		else
+			Write<uint32_t>(wptr, 0U);
+		return true;
+	}
+	case Hornet::Action::CB_LOG_HANDLER:
+	{
+		const auto* rptr = ss.bytes.data();
+		auto* logger = static_cast<ILogger*>(Read<void*>(rptr));
+		const auto type = ILogger::LogType{Read<int>(rptr)};
+		const auto strSz = Read<std::size_t>(rptr);
+		const std::string_view strSv(reinterpret_cast<const char*>(rptr), strSz);
+		if(logger != nullptr)
+			logger->Log(type, strSv);
+		return true;
+	}
+	case Hornet::Action::CB_DATA_READER_DONE:
+	{
+		const auto* rptr = ss.bytes.data();
+		auto* supplier = static_cast<IDataSupplier*>(Read<void*>(rptr));
+		const auto data = Read<OCG_CardData>(rptr);
+		supplier->DataUsageDone(data);
+		return true;
+	}
+	// Explicitly ignore these, in case we ever add more functionality...
+	case Hornet::Action::NO_WORK:
+	case Hornet::Action::HEARTBEAT:
+	case Hornet::Action::EXIT:
+	case Hornet::Action::OCG_GET_VERSION:
+	case Hornet::Action::OCG_CREATE_DUEL:
+	case Hornet::Action::OCG_DESTROY_DUEL:
+	case Hornet::Action::OCG_DUEL_NEW_CARD:
+	case Hornet::Action::OCG_DUEL_NEW_CARDS:
+	case Hornet::Action::OCG_START_DUEL:
+	case Hornet::Action::OCG_DUEL_PROCESS:
+	case Hornet::Action::OCG_DUEL_GET_MESSAGE:
+	case Hornet::Action::OCG_DUEL_PROCESS_AND_GET_MESSAGE:
+	case Hornet::Action::OCG_DUEL_SET_RESPONSE:
+	case Hornet::Action::OCG_LOAD_SCRIPT:
+	case Hornet::Action::OCG_DUEL_QUERY_COUNT:
+	case Hornet::Action::OCG_DUEL_QUERY:
+	case Hornet::Action::OCG_DUEL_QUERY_LOCATION:
+	case Hornet::Action::OCG_DUEL_QUERY_FIELD:
+	case Hornet::Action::OCG_DUEL_QUERY_BATCH:
+	case Hornet::Action::CB_DONE:
+	case Hornet::Action::ZYGOTE_FORK:
+		break;
+	}
+	return false;
 }
 
 } // namespace Ignis::Multirole::Core
@@ -2,7 +2,12 @@
 #define HORNETWRAPPER_HPP
 #include "IWrapper.hpp"
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <mutex>
+#include <unordered_map>
+#include <vector>
 #include <boost/interprocess/mapped_region.hpp>
 #include <boost/interprocess/shared_memory_object.hpp>
 
@@ -19,39 +24,105 @@ struct SharedSegment;
 namespace Ignis::Multirole::Core
 {
 
+class HornetZygote;
+
 class HornetWrapper final : public IWrapper
 {
 public:
-	HornetWrapper(std::string_view absFilePath);
+	// Launches a hornet process that can serve `slotCount` calls at once,
+	// calls on different duels are free to use any of the slots. If a
+	// zygote is given the process is forked from it instead.
+	// Calls are given up on, and the process deemed hanged, if it doesn't
+	// reply within `hangTimeout`; a crash is noticed right away instead.
+	// If `anonymous` is set, the shared segment is an anonymous memory file
+	// inherited by the process rather than a named object, when supported
+	// (Linux only, and never for processes forked by a zygote).
+	// If `hugePages` is set, the payload of each slot is advised to be
+	// backed by transparent huge pages, when supported.
+	HornetWrapper(
+		std::string_view absFilePath,
+		std::size_t slotCount = 1U,
+		HornetZygote* zygote = nullptr,
+		std::chrono::milliseconds hangTimeout = std::chrono::seconds(60),
+		bool anonymous = false,
+		bool hugePages = false);
 	~HornetWrapper();
 
+	// Process serving the calls.
+	Process::Data Proc() const;
+
 	std::pair<int, int> Version() override;
 
 	Duel CreateDuel(const DuelOptions& opts) override;
 	void DestroyDuel(Duel duel) override;
 	void AddCard(Duel duel, const NewCardInfo& info) override;
+	void AddCards(Duel duel, const std::vector<NewCardInfo>& infos) override;
 	void Start(Duel duel) override;
 
 	DuelStatus Process(Duel duel) override;
 	Buffer GetMessages(Duel duel) override;
-	void SetResponse(Duel duel, const Buffer& buffer) override;
+	std::pair<DuelStatus, BufferView> ProcessAndGetMessages(Duel duel) override;
+	void SetResponse(Duel duel, BufferView buffer) override;
 	int LoadScript(Duel duel, std::string_view name, std::string_view str) override;
 
 	std::size_t QueryCount(Duel duel, uint8_t team, uint32_t loc) override;
 	Buffer Query(Duel duel, const QueryInfo& info) override;
 	Buffer QueryLocation(Duel duel, const QueryInfo& info) override;
 	Buffer QueryField(Duel duel) override;
+	void QueryBatch(Duel duel, const std::vector<BatchQuery>& queries, std::vector<Buffer>& out) override;
 private:
+	// Acquires exclusive usage of a free slot for the guard's lifetime.
+	class SlotGuard
+	{
+	public:
+		SlotGuard(HornetWrapper& hw);
+		~SlotGuard();
+
+		Hornet::SharedSegment& operator*() const;
+		Hornet::SharedSegment* operator->() const;
+	private:
+		HornetWrapper& hw;
+		Hornet::SharedSegment* ss;
+	};
+
 	const std::string shmName;
+	const std::size_t slotCount;
 	boost::interprocess::shared_memory_object shm;
 	boost::interprocess::mapped_region region;
-	Hornet::SharedSegment* hss;
+	std::size_t anonymousSize; // Of the segment if anonymous, 0 otherwise.
+	Hornet::SharedSegment* hss; // Array of slotCount segments.
 	Process::Data proc;
-	bool hanged;
-	std::mutex mtx;
+	bool forked; // Whether or not proc was forked by a zygote.
+	std::atomic<bool> hanged;
+	std::atomic<bool> exited; // Set by the exit watcher.
+	const std::chrono::milliseconds hangTimeout;
+	std::vector<std::size_t> freeSlots;
+	std::mutex mtx; // used for freeSlots.
+	std::condition_variable cv;
+	std::unordered_map<Duel, Buffer> msgBuffers;
+	std::mutex mMsgBuffers;
 
 	void DestroySharedSegment();
-	void NotifyAndWait(Hornet::Action act);
+	// Called from the exit watcher, interrupts every wait on the process.
+	void OnProcExit();
+	bool IsProcRunning() const;
+	void CleanUpProc() const;
+	// Posts `act` and serves callbacks until hornet is done with it, each
+	// reply has to come within `timeout`, or hangTimeout if it is zero.
+	void NotifyAndWait(Hornet::SharedSegment& ss, Hornet::Action act, std::chrono::milliseconds timeout = {});
+
+	// Handles a callback hornet asked for, returns false if `recvAct` is
+	// not a callback.
+	bool ServeCallback(Hornet::SharedSegment& ss, Hornet::Action recvAct);
+
+	// Copies a length-prefixed result written by hornet at `rptr`, taking
+	// it from the slot's overflow object if it didn't fit in the segment.
+	void ReadSized(const Hornet::SharedSegment& ss, const uint8_t* rptr, Buffer& out) const;
+
+	// Writes length-prefixed data for hornet at `wptr`, spilling it onto
+	// the slot's overflow object if it doesn't fit in the segment. Returns
+	// false, having written an empty one instead, if it couldn't.
+	bool WriteSized(Hornet::SharedSegment& ss, uint8_t* wptr, const void* data, std::size_t size) const;
 };
 
 } // namespace Ignis::Multirole::Core
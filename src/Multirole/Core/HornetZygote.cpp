@@ -0,0 +1,124 @@
+#include "HornetZygote.hpp"
+
+#include "../I18N.hpp"
+#include "../../HornetCommon.hpp"
+#define PROCESS_IMPLEMENTATION
+#include "../../Process.hpp"
+
+#ifndef MULTIROLE_HORNET_ZYGOTE_MAX_WAIT_COUNT
+#define MULTIROLE_HORNET_ZYGOTE_MAX_WAIT_COUNT 5U
+#endif // MULTIROLE_HORNET_ZYGOTE_MAX_WAIT_COUNT
+
+namespace Ignis::Multirole::Core
+{
+
+#include "../../Read.inl"
+#include "../../Write.inl"
+
+inline std::string MakeZygoteName(uintptr_t addr)
+{
+	std::array<char, 31U> buf{};
+	std::snprintf(buf.data(), buf.size(), "HornetZygote0x%lX", addr);
+	return std::string(buf.data());
+}
+
+inline ipc::shared_memory_object MakeCtlShm(const std::string& str)
+{
+	ipc::shared_memory_object::remove(str.data());
+	ipc::shared_memory_object shm(ipc::create_only, str.data(), ipc::read_write);
+	shm.truncate(sizeof(Hornet::SharedSegment));
+	return shm;
+}
+
+// public
+
+HornetZygote::HornetZygote(std::string_view absFilePath) :
+	shmName(MakeZygoteName(reinterpret_cast<uintptr_t>(this))),
+	shm(MakeCtlShm(shmName)),
+	region(shm, ipc::read_write),
+	ctl(nullptr),
+	proc(),
+	hanged(false)
+{
+#ifdef _WIN32
+	(void)absFilePath;
+	DestroySharedSegment();
+	throw std::runtime_error(I18N::HWRAPPER_ZYGOTE_UNSUPPORTED);
+#else
+	ctl = new (region.get_address()) Hornet::SharedSegment;
+	const auto p = Process::Launch("./hornet", absFilePath.data(), shmName.data(), "zygote");
+	if(!p.second)
+	{
+		DestroySharedSegment();
+		throw std::runtime_error(I18N::HWRAPPER_UNABLE_TO_LAUNCH);
+	}
+	proc = p.first;
+	if(!Call(Hornet::Action::HEARTBEAT))
+	{
+		if(Process::IsRunning(proc))
+			Process::Kill(proc);
+		Process::CleanUp(proc);
+		DestroySharedSegment();
+		throw std::runtime_error(I18N::HWRAPPER_HEARTBEAT_FAILURE);
+	}
+#endif // _WIN32
+}
+
+HornetZygote::~HornetZygote()
+{
+	// NOTE: Already forked hornets are unaffected by the zygote exiting.
+	Hornet::Post(*ctl, Hornet::Action::EXIT);
+	if(hanged && Process::IsRunning(proc))
+		Process::Kill(proc);
+	Process::CleanUp(proc);
+	DestroySharedSegment();
+}
+
+Process::Data HornetZygote::Proc() const
+{
+	return proc;
+}
+
+Process::Data HornetZygote::Fork(std::string_view shmName, std::size_t slotCount)
+{
+	std::scoped_lock lock(mtx);
+	if(hanged)
+		throw std::runtime_error(I18N::HWRAPPER_EXCEPT_ZYGOTE_FORK);
+	auto* wptr = ctl->bytes.data();
+	Write<std::size_t>(wptr, shmName.size());
+	std::memcpy(wptr, shmName.data(), shmName.size());
+	wptr += shmName.size();
+	Write<std::size_t>(wptr, slotCount);
+	if(!Call(Hornet::Action::ZYGOTE_FORK))
+	{
+		hanged = true;
+		throw std::runtime_error(I18N::HWRAPPER_EXCEPT_ZYGOTE_FORK);
+	}
+	const auto* rptr = ctl->bytes.data();
+	const auto pid = Read<Process::Data>(rptr);
+	if(pid <= 0)
+		throw std::runtime_error(I18N::HWRAPPER_EXCEPT_ZYGOTE_FORK);
+	return pid;
+}
+
+// private
+
+void HornetZygote::DestroySharedSegment()
+{
+	if(ctl != nullptr)
+		ctl->~SharedSegment();
+	ipc::shared_memory_object::remove(shmName.data());
+}
+
+bool HornetZygote::Call(Hornet::Action act)
+{
+	constexpr auto WAIT_OFFSET = std::chrono::seconds(10U);
+	Hornet::Post(*ctl, act);
+	std::size_t waitCount = 0U;
+	while(!Hornet::WaitWhile(*ctl, act, WAIT_OFFSET))
+		if(!Process::IsRunning(proc) || waitCount++ > MULTIROLE_HORNET_ZYGOTE_MAX_WAIT_COUNT)
+			return false;
+	return true;
+}
+
+} // namespace Ignis::Multirole::Core
@@ -0,0 +1,56 @@
+#ifndef HORNETZYGOTE_HPP
+#define HORNETZYGOTE_HPP
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/interprocess/shared_memory_object.hpp>
+
+#include "../../Process.hpp"
+
+namespace Ignis::Hornet
+{
+
+enum class Action : uint8_t;
+struct SharedSegment;
+
+} // namespace Ignis::Hornet
+
+namespace Ignis::Multirole::Core
+{
+
+// Long-lived hornet process that loads the core once and then forks a new
+// hornet for each wrapper that asks for it, so that all of them share the
+// core's text and relocated data copy-on-write instead of loading it again.
+class HornetZygote final
+{
+public:
+	HornetZygote(std::string_view absFilePath);
+	~HornetZygote();
+
+	// Process that forks the hornets.
+	Process::Data Proc() const;
+
+	// Forks a hornet that serves `slotCount` slots from the shared memory
+	// object named `shmName`. NOTE: The returned process is not a child of
+	// this one, check it with Process::IsAlive instead.
+	Process::Data Fork(std::string_view shmName, std::size_t slotCount);
+private:
+	const std::string shmName;
+	boost::interprocess::shared_memory_object shm;
+	boost::interprocess::mapped_region region;
+	Hornet::SharedSegment* ctl;
+	Process::Data proc;
+	bool hanged;
+	std::mutex mtx; // used for ctl and hanged.
+
+	void DestroySharedSegment();
+
+	// Posts an action and waits for the zygote to be done with it,
+	// returns false if it died or stopped responding.
+	bool Call(Hornet::Action act);
+};
+
+} // namespace Ignis::Multirole::Core
+
+#endif // HORNETZYGOTE_HPP
@@ -1,5 +1,7 @@
 #ifndef IDATASUPPLIER_HPP
 #define IDATASUPPLIER_HPP
+#include <string_view>
+
 #include "../../ocgapi_types.h"
 
 namespace Ignis::Multirole::Core
@@ -12,6 +14,10 @@ public:
 
 	virtual const CardData& DataFromCode(uint32_t code) const = 0;
 	virtual void DataUsageDone(const CardData& data) const = 0;
+
+	// Name of the shared memory table holding all cards this supplier can
+	// provide (see Core::SharedCardTable), empty if there is none.
+	virtual std::string_view SharedTableName() const = 0;
 protected:
 	inline ~IDataSupplier() = default;
 };
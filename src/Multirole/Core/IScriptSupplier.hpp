@@ -1,5 +1,6 @@
 #ifndef ISCRIPTSUPPLIER_HPP
 #define ISCRIPTSUPPLIER_HPP
+#include <memory>
 #include <string>
 #include <string_view>
 
@@ -9,7 +10,16 @@ namespace Ignis::Multirole::Core
 class IScriptSupplier
 {
 public:
-	virtual std::string ScriptFromFilePath(std::string_view fp) const = 0;
+	// Scripts never change once loaded, so they are shared rather than
+	// copied and can be read for as long as they are held.
+	using Script = std::shared_ptr<const std::string>;
+
+	// Gets the script with the given name, null if there is none.
+	virtual Script ScriptFromFilePath(std::string_view fp) const = 0;
+
+	// Name of the shared memory table holding all scripts this supplier can
+	// provide (see Core::SharedScriptTable), empty if there is none.
+	virtual std::string SharedTableName() const = 0;
 protected:
 	inline ~IScriptSupplier() = default;
 };
@@ -1,6 +1,7 @@
 #ifndef IWRAPPER_HPP
 #define IWRAPPER_HPP
 #include <cstdint>
+#include <cstring>
 #include <vector>
 #include <stdexcept>
 #include <string_view>
@@ -18,14 +19,31 @@ class ILogger;
 class Exception final : public std::runtime_error
 {
 public:
-	Exception(std::string_view whatArg) : std::runtime_error(whatArg.data())
+	// `crashed` tells the core died while handling the call, rather than
+	// the call failing or the core hanging.
+	Exception(std::string_view whatArg, bool crashed = false) :
+		std::runtime_error(whatArg.data()),
+		crashed(crashed)
 	{}
+
+	bool Crashed() const
+	{
+		return crashed;
+	}
+private:
+	bool crashed;
 };
 
 class IWrapper
 {
 public:
 	using Buffer = std::vector<uint8_t>;
+	// Non-owning view over memory owned by the wrapper or the core.
+	struct BufferView
+	{
+		const uint8_t* data;
+		std::size_t size;
+	};
 	using Duel = OCG_Duel;
 	using NewCardInfo = OCG_NewCardInfo;
 	using Player = OCG_Player;
@@ -38,6 +56,19 @@ public:
 		DUEL_STATUS_CONTINUE,
 	};
 
+	// One of the queries made by QueryBatch.
+	struct BatchQuery
+	{
+		enum class Kind : uint8_t
+		{
+			COUNT, // QueryCount of the team and location of `info`.
+			SINGLE, // Query.
+			LOCATION, // QueryLocation.
+		};
+		Kind kind;
+		QueryInfo info;
+	};
+
 	struct DuelOptions
 	{
 		IDataSupplier& dataSupplier;
@@ -54,17 +85,59 @@ public:
 	virtual Duel CreateDuel(const DuelOptions& opts) = 0;
 	virtual void DestroyDuel(Duel duel) = 0;
 	virtual void AddCard(Duel duel, const NewCardInfo& info) = 0;
+	// Same as calling AddCard for each card in order, but done in as few
+	// steps as possible so that out-of-process cores don't do one
+	// round-trip per card.
+	virtual void AddCards(Duel duel, const std::vector<NewCardInfo>& infos)
+	{
+		for(const auto& info : infos)
+			AddCard(duel, info);
+	}
 	virtual void Start(Duel duel) = 0;
 
 	virtual DuelStatus Process(Duel duel) = 0;
 	virtual Buffer GetMessages(Duel duel) = 0;
-	virtual void SetResponse(Duel duel, const Buffer& buffer) = 0;
+	// Same as calling Process followed by GetMessages, but done in a
+	// single step so that out-of-process cores only do one round-trip.
+	// The messages are borrowed rather than copied out, the view is only
+	// valid until the next call made on the same duel.
+	virtual std::pair<DuelStatus, BufferView> ProcessAndGetMessages(Duel duel) = 0;
+	virtual void SetResponse(Duel duel, BufferView buffer) = 0;
 	virtual int LoadScript(Duel duel, std::string_view name, std::string_view str) = 0;
 
 	virtual std::size_t QueryCount(Duel duel, uint8_t team, uint32_t loc) = 0;
 	virtual Buffer Query(Duel duel, const QueryInfo& info) = 0;
 	virtual Buffer QueryLocation(Duel duel, const QueryInfo& info) = 0;
 	virtual Buffer QueryField(Duel duel) = 0;
+	// Makes every query in order, same as making each of them on its own,
+	// but done in as few steps as possible so that out-of-process cores
+	// don't do one round-trip per query. The result of each query is left
+	// in the buffer of `out` at the same index, counts as a uint32_t. `out`
+	// is resized to fit and its buffers are reused.
+	virtual void QueryBatch(Duel duel, const std::vector<BatchQuery>& queries, std::vector<Buffer>& out)
+	{
+		out.resize(queries.size());
+		for(std::size_t i = 0U; i < queries.size(); i++)
+		{
+			const auto& q = queries[i];
+			switch(q.kind)
+			{
+			case BatchQuery::Kind::COUNT:
+			{
+				const auto count = static_cast<uint32_t>(QueryCount(duel, q.info.con, q.info.loc));
+				out[i].resize(sizeof(count));
+				std::memcpy(out[i].data(), &count, sizeof(count));
+				break;
+			}
+			case BatchQuery::Kind::SINGLE:
+				out[i] = Query(duel, q.info);
+				break;
+			case BatchQuery::Kind::LOCATION:
+				out[i] = QueryLocation(duel, q.info);
+				break;
+			}
+		}
+	}
 protected:
 	inline ~IWrapper() = default;
 };
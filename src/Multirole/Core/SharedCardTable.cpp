@@ -0,0 +1,69 @@
+#include "SharedCardTable.hpp"
+
+#include <algorithm>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include "../../HornetCardTable.hpp"
+
+namespace Ignis::Multirole::Core
+{
+
+namespace ipc = boost::interprocess;
+
+inline ipc::shared_memory_object MakeShm(const std::string& str)
+{
+	ipc::shared_memory_object::remove(str.data());
+	return ipc::shared_memory_object(ipc::create_only, str.data(), ipc::read_write);
+}
+
+// public
+
+SharedCardTable::SharedCardTable(std::string_view name, std::vector<OCG_CardData> cards) :
+	name(name),
+	shm(MakeShm(this->name))
+{
+	std::sort(cards.begin(), cards.end(), [](const auto& a, const auto& b)
+	{
+		return a.code < b.code;
+	});
+	std::size_t setcodesCount = 0U;
+	for(const auto& cd : cards)
+	{
+		if(cd.setcodes != nullptr)
+			for(const uint16_t* sc = cd.setcodes; *sc != 0U; sc++)
+				setcodesCount++;
+		setcodesCount++; // Terminator.
+	}
+	shm.truncate(static_cast<ipc::offset_t>(Hornet::CardTableSize(cards.size(), setcodesCount)));
+	ipc::mapped_region region(shm, ipc::read_write);
+	auto* base = region.get_address();
+	auto& header = *static_cast<Hornet::CardTableHeader*>(base);
+	header.magic = Hornet::CARD_TABLE_MAGIC;
+	header.count = static_cast<uint32_t>(cards.size());
+	auto* entry = const_cast<Hornet::CardTableEntry*>(Hornet::CardTableEntries(base));
+	auto* setcodes = const_cast<uint16_t*>(Hornet::CardTableSetcodes(base));
+	uint32_t setcodesIndex = 0U;
+	for(const auto& cd : cards)
+	{
+		entry->data = cd;
+		entry->data.setcodes = nullptr;
+		entry->setcodesIndex = setcodesIndex;
+		if(cd.setcodes != nullptr)
+			for(const uint16_t* sc = cd.setcodes; *sc != 0U; sc++)
+				setcodes[setcodesIndex++] = *sc;
+		setcodes[setcodesIndex++] = 0U;
+		entry++;
+	}
+}
+
+SharedCardTable::~SharedCardTable()
+{
+	ipc::shared_memory_object::remove(name.data());
+}
+
+std::string_view SharedCardTable::Name() const
+{
+	return name;
+}
+
+} // namespace Ignis::Multirole::Core
@@ -0,0 +1,30 @@
+#ifndef SHAREDCARDTABLE_HPP
+#define SHAREDCARDTABLE_HPP
+#include <string>
+#include <string_view>
+#include <vector>
+#include <boost/interprocess/shared_memory_object.hpp>
+
+#include "../../ocgapi_types.h"
+
+namespace Ignis::Multirole::Core
+{
+
+// Owns a named shared memory object holding a read-only table of cards,
+// laid out as described on HornetCardTable.hpp, which is mapped by hornet
+// processes to avoid calling back to multirole for each card lookup.
+class SharedCardTable
+{
+public:
+	SharedCardTable(std::string_view name, std::vector<OCG_CardData> cards);
+	~SharedCardTable();
+
+	std::string_view Name() const;
+private:
+	const std::string name;
+	boost::interprocess::shared_memory_object shm;
+};
+
+} // namespace Ignis::Multirole::Core
+
+#endif // SHAREDCARDTABLE_HPP
@@ -0,0 +1,73 @@
+#include "SharedScriptTable.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include "../../HornetScriptTable.hpp"
+
+namespace Ignis::Multirole::Core
+{
+
+namespace ipc = boost::interprocess;
+
+inline ipc::shared_memory_object MakeShm(const std::string& str)
+{
+	ipc::shared_memory_object::remove(str.data());
+	return ipc::shared_memory_object(ipc::create_only, str.data(), ipc::read_write);
+}
+
+// public
+
+SharedScriptTable::SharedScriptTable(std::string_view name, uint32_t version, const ScriptMap& scripts) :
+	name(name),
+	shm(MakeShm(this->name))
+{
+	std::vector<const ScriptMap::value_type*> sorted;
+	sorted.reserve(scripts.size());
+	std::size_t blobSize = 0U;
+	for(const auto& kv : scripts)
+	{
+		sorted.push_back(&kv);
+		blobSize += kv.first.size() + kv.second.size();
+	}
+	std::sort(sorted.begin(), sorted.end(), [](const auto* a, const auto* b)
+	{
+		return a->first < b->first;
+	});
+	shm.truncate(static_cast<ipc::offset_t>(Hornet::ScriptTableSize(sorted.size(), blobSize)));
+	ipc::mapped_region region(shm, ipc::read_write);
+	auto* base = region.get_address();
+	auto& header = *static_cast<Hornet::ScriptTableHeader*>(base);
+	header.magic = Hornet::SCRIPT_TABLE_MAGIC;
+	header.version = version;
+	header.count = static_cast<uint32_t>(sorted.size());
+	auto* entry = const_cast<Hornet::ScriptTableEntry*>(Hornet::ScriptTableEntries(base));
+	auto* blob = const_cast<char*>(Hornet::ScriptTableBlob(base));
+	uint64_t offset = 0U;
+	for(const auto* kv : sorted)
+	{
+		entry->nameOffset = offset;
+		entry->nameSize = kv->first.size();
+		std::memcpy(blob + offset, kv->first.data(), kv->first.size());
+		offset += kv->first.size();
+		entry->dataOffset = offset;
+		entry->dataSize = kv->second.size();
+		std::memcpy(blob + offset, kv->second.data(), kv->second.size());
+		offset += kv->second.size();
+		entry++;
+	}
+}
+
+SharedScriptTable::~SharedScriptTable()
+{
+	ipc::shared_memory_object::remove(name.data());
+}
+
+std::string_view SharedScriptTable::Name() const
+{
+	return name;
+}
+
+} // namespace Ignis::Multirole::Core
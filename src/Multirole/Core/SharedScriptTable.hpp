@@ -0,0 +1,30 @@
+#ifndef SHAREDSCRIPTTABLE_HPP
+#define SHAREDSCRIPTTABLE_HPP
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <boost/interprocess/shared_memory_object.hpp>
+
+namespace Ignis::Multirole::Core
+{
+
+// Owns a named shared memory object holding a read-only table of scripts,
+// laid out as described on HornetScriptTable.hpp, which is mapped by hornet
+// processes to load scripts without calling back to multirole.
+class SharedScriptTable
+{
+public:
+	using ScriptMap = std::unordered_map<std::string_view /*name*/, std::string_view /*script*/>;
+
+	SharedScriptTable(std::string_view name, uint32_t version, const ScriptMap& scripts);
+	~SharedScriptTable();
+
+	std::string_view Name() const;
+private:
+	const std::string name;
+	boost::interprocess::shared_memory_object shm;
+};
+
+} // namespace Ignis::Multirole::Core
+
+#endif // SHAREDSCRIPTTABLE_HPP
@@ -0,0 +1,267 @@
+#include "ClusterRegistry.hpp"
+
+#include <cctype>
+#include <exception>
+#include <unordered_map>
+
+#include <boost/asio/bind_executor.hpp>
+#include <boost/asio/connect.hpp>
+#include <boost/asio/dispatch.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/json.hpp>
+#include <fmt/format.h>
+
+#include "../Workaround.hpp"
+
+namespace Ignis::Multirole::Endpoint
+{
+
+constexpr auto POLL_INTERVAL = std::chrono::seconds(2);
+// Polls taking longer than this are given up on.
+constexpr auto POLL_TIMEOUT = std::chrono::seconds(5);
+// Rooms of nodes that didn't answer for this long aren't listed anymore.
+constexpr auto PEER_STALE_AFTER = std::chrono::seconds(10);
+constexpr std::size_t MAX_RESPONSE_SIZE = 32U * 1024U * 1024U;
+constexpr std::string_view LOCAL_LISTING_TARGET = "/local";
+
+template<typename T>
+inline T Number(const boost::json::object& o, std::string_view key)
+{
+	return o.at(key).to_number<T>();
+}
+
+// public
+
+ClusterRegistry::ClusterRegistry(boost::asio::io_context& ioCtx, const Lobby& lobby, std::vector<Node> nodes) :
+	lobby(lobby),
+	strand(boost::asio::make_strand(ioCtx)),
+	pollTimer(strand),
+	generation(0U)
+{
+	for(auto& n : nodes)
+	{
+		peers.push_back(Peer
+		{
+			std::move(n),
+			boost::asio::ip::tcp::resolver(strand),
+			boost::asio::ip::tcp::socket(strand),
+			{}, // request
+			{}, // response
+			{}, // etag
+			false, // polling
+			{}, // polled
+			{}, // seen
+			{} // rooms
+		});
+	}
+	DoPoll();
+}
+
+void ClusterRegistry::Stop()
+{
+	boost::asio::dispatch(strand, [this]()
+	{
+		pollTimer.cancel();
+		for(auto& p : peers)
+		{
+			boost::system::error_code ignore;
+			p.resolver.cancel();
+			p.socket.close(ignore);
+		}
+	});
+}
+
+void ClusterRegistry::CollectRooms(const std::function<void(const Lobby::RoomProps&)>& f) const
+{
+	const auto now = std::chrono::steady_clock::now();
+	std::scoped_lock lock(mRooms);
+	Lobby::RoomProps props{};
+	for(const auto& p : peers)
+	{
+		if(p.seen + PEER_STALE_AFTER < now)
+			continue;
+		for(const auto& r : p.rooms)
+		{
+			props.id = r.id;
+			props.hostInfo = &r.hostInfo;
+			props.notes = &r.notes;
+			props.passworded = r.passworded;
+			props.listing = &r.listing;
+			f(props);
+		}
+	}
+}
+
+// private
+
+void ClusterRegistry::DoPoll()
+{
+	const auto now = std::chrono::steady_clock::now();
+	for(auto& p : peers)
+	{
+		if(!p.polling)
+		{
+			Poll(p);
+		}
+		else if(p.polled + POLL_TIMEOUT < now)
+		{
+			// Aborts the poll, which finishes it.
+			boost::system::error_code ignore;
+			p.resolver.cancel();
+			p.socket.close(ignore);
+		}
+	}
+	pollTimer.expires_after(POLL_INTERVAL);
+	pollTimer.async_wait([this](boost::system::error_code ec)
+	{
+		if(!ec)
+			DoPoll();
+	});
+}
+
+void ClusterRegistry::Poll(Peer& p)
+{
+	p.polling = true;
+	p.polled = std::chrono::steady_clock::now();
+	p.request = fmt::format(
+		"GET {:s} HTTP/1.1\r\n"
+		"Host: {:s}\r\n"
+		"{:s}"
+		"Connection: close\r\n\r\n",
+		LOCAL_LISTING_TARGET,
+		p.node.listingHost,
+		p.etag.empty() ? std::string() : fmt::format("If-None-Match: {:s}\r\n", p.etag));
+	p.response.clear();
+	const auto port = std::to_string(p.node.listingPort);
+	p.resolver.async_resolve(p.node.listingHost, port, boost::asio::bind_executor(strand,
+	[this, &p](boost::system::error_code ec, boost::asio::ip::tcp::resolver::results_type results)
+	{
+		if(ec)
+			return Finish(p, false);
+		boost::asio::async_connect(p.socket, results, boost::asio::bind_executor(strand,
+		[this, &p](boost::system::error_code ec, const boost::asio::ip::tcp::endpoint& /*unused*/)
+		{
+			if(ec)
+				return Finish(p, false);
+			Workaround::SetCloseOnExec(p.socket.native_handle());
+			boost::asio::async_write(p.socket, boost::asio::buffer(p.request), boost::asio::bind_executor(strand,
+			[this, &p](boost::system::error_code ec, std::size_t /*unused*/)
+			{
+				if(ec)
+					return Finish(p, false);
+				// The listing closes the connection once the response is
+				// written, as it was asked to.
+				auto buffer = boost::asio::dynamic_buffer(p.response, MAX_RESPONSE_SIZE);
+				boost::asio::async_read(p.socket, buffer, boost::asio::bind_executor(strand,
+				[this, &p](boost::system::error_code ec, std::size_t /*unused*/)
+				{
+					Finish(p, ec == boost::asio::error::eof);
+				}));
+			}));
+		}));
+	}));
+}
+
+void ClusterRegistry::Finish(Peer& p, bool answered)
+{
+	p.polling = false;
+	boost::system::error_code ignore;
+	p.socket.close(ignore);
+	if(!answered)
+		return;
+	const std::string_view response(p.response);
+	const auto end = response.find("\r\n\r\n");
+	if(end == std::string_view::npos)
+		return;
+	const auto statusLine = response.substr(0U, response.find("\r\n"));
+	if(statusLine.find(" 304 ") != std::string_view::npos)
+	{
+		std::scoped_lock lock(mRooms);
+		p.seen = std::chrono::steady_clock::now();
+		return;
+	}
+	if(statusLine.find(" 200 ") == std::string_view::npos)
+		return;
+	std::string headers(response.substr(0U, end + 2U));
+	for(auto& c : headers)
+		c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+	if(!ParseListing(p, response.substr(end + 4U)))
+		return;
+	p.etag.clear();
+	if(const auto pos = headers.find("\r\netag:"); pos != std::string::npos)
+	{
+		const auto first = headers.find('"', pos);
+		const auto last = headers.find('"', first + 1U);
+		if(first != std::string::npos && last != std::string::npos)
+			p.etag = headers.substr(first, last - first + 1U);
+	}
+}
+
+bool ClusterRegistry::ParseListing(Peer& p, std::string_view body)
+{
+	std::vector<RemoteRoom> rooms;
+	try
+	{
+		const auto listing = boost::json::parse(body);
+		for(const auto& v : listing.at("rooms").as_array())
+		{
+			const auto& o = v.as_object();
+			RemoteRoom r{};
+			r.id = Number<uint32_t>(o, "roomid");
+			// Rooms have to be from the node that listed them, so that
+			// no other node can shadow them.
+			if(lobby.NodeOf(r.id) != p.node.id)
+				continue;
+			auto& hi = r.hostInfo;
+			const auto duelFlags = Number<uint64_t>(o, "duel_flag");
+			hi.banlistHash = Number<uint32_t>(o, "banlist_hash");
+			hi.allowed = Number<uint8_t>(o, "rule");
+			hi.dontCheckDeck = static_cast<uint8_t>(o.at("no_check").as_bool());
+			hi.dontShuffleDeck = static_cast<uint8_t>(o.at("no_shuffle").as_bool());
+			hi.startingLP = Number<uint32_t>(o, "start_lp");
+			hi.startingDrawCount = Number<uint8_t>(o, "start_hand");
+			hi.drawCountPerTurn = Number<uint8_t>(o, "draw_count");
+			hi.timeLimitInSeconds = Number<uint16_t>(o, "time_limit");
+			hi.duelFlagsHigh = static_cast<uint32_t>(duelFlags >> 32U);
+			hi.duelFlagsLow = static_cast<uint32_t>(duelFlags);
+			hi.t0Count = Number<int32_t>(o, "team1");
+			hi.t1Count = Number<int32_t>(o, "team2");
+			hi.bestOf = Number<int32_t>(o, "best_of");
+			hi.forb = Number<int32_t>(o, "forbidden_types");
+			hi.extraRules = Number<uint16_t>(o, "extra_rules");
+			r.notes = o.at("roomnotes").as_string().data();
+			r.passworded = o.at("needpass").as_bool();
+			r.listing.started = o.at("istart").as_string() == "start";
+			for(const auto& u : o.at("users").as_array())
+			{
+				const auto& uo = u.as_object();
+				r.listing.duelists.emplace(Number<uint8_t>(uo, "pos"), uo.at("name").as_string().data());
+			}
+			r.json = boost::json::serialize(o);
+			rooms.push_back(std::move(r));
+		}
+	}
+	catch(const std::exception& /*unused*/)
+	{
+		return false;
+	}
+	// Rooms that didn't change keep their generation, so the listing
+	// doesn't serialize them again.
+	std::unordered_map<uint32_t, const RemoteRoom*> previous;
+	for(const auto& r : p.rooms)
+		previous.emplace(r.id, &r);
+	for(auto& r : rooms)
+	{
+		if(auto it = previous.find(r.id); it != previous.end() && it->second->json == r.json)
+			r.listing.generation = it->second->listing.generation;
+		else
+			r.listing.generation = ++generation;
+	}
+	std::scoped_lock lock(mRooms);
+	p.rooms = std::move(rooms);
+	p.seen = std::chrono::steady_clock::now();
+	return true;
+}
+
+} // namespace Ignis::Multirole::Endpoint
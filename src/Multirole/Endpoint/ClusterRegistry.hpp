@@ -0,0 +1,82 @@
+#ifndef ENDPOINT_CLUSTERREGISTRY_HPP
+#define ENDPOINT_CLUSTERREGISTRY_HPP
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/strand.hpp>
+
+#include "../Lobby.hpp"
+
+namespace Ignis::Multirole::Endpoint
+{
+
+// Rooms of the other nodes of a cluster, so that the listing of any node
+// can show every room of the cluster. The local listing of each node (see
+// LobbyListing) is polled periodically, and the rooms of nodes that don't
+// answer for a while are dropped until they do again.
+class ClusterRegistry final
+{
+public:
+	struct Node
+	{
+		uint32_t id;
+		std::string listingHost;
+		unsigned short listingPort;
+	};
+
+	ClusterRegistry(boost::asio::io_context& ioCtx, const Lobby& lobby, std::vector<Node> nodes);
+	void Stop();
+
+	// Same as Lobby::CollectRooms, for the rooms of the other nodes.
+	void CollectRooms(const std::function<void(const Lobby::RoomProps&)>& f) const;
+private:
+	struct RemoteRoom
+	{
+		uint32_t id;
+		YGOPro::HostInfo hostInfo;
+		std::string notes;
+		bool passworded;
+		Room::Instance::ListingProps listing;
+		std::string json; // As listed by its node, to tell if it changed.
+	};
+
+	struct Peer
+	{
+		Node node;
+		boost::asio::ip::tcp::resolver resolver;
+		boost::asio::ip::tcp::socket socket;
+		std::string request;
+		std::string response;
+		std::string etag; // Of the last listing received.
+		bool polling;
+		std::chrono::steady_clock::time_point polled; // Last poll started.
+		std::chrono::steady_clock::time_point seen; // Last poll answered.
+		std::vector<RemoteRoom> rooms; // Guarded by mRooms.
+	};
+
+	const Lobby& lobby;
+	boost::asio::strand<boost::asio::io_context::executor_type> strand;
+	boost::asio::steady_timer pollTimer;
+	std::deque<Peer> peers;
+	uint64_t generation; // Given to rooms that changed.
+	mutable std::mutex mRooms;
+
+	void DoPoll();
+	void Poll(Peer& p);
+	void Finish(Peer& p, bool answered);
+
+	// Reads the rooms of a full listing, returns false if it's malformed.
+	bool ParseListing(Peer& p, std::string_view body);
+};
+
+} // namespace Ignis::Multirole::Endpoint
+
+#endif // ENDPOINT_CLUSTERREGISTRY_HPP
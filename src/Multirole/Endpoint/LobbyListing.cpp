@@ -1,29 +1,398 @@
 #include "LobbyListing.hpp"
 
+#include <algorithm>
+#include <cctype> // std::tolower
+#include <charconv> // std::from_chars
+#include <cstring> // std::memmove
+#include <limits>
+#include <optional>
+#include <string_view>
+
+#include <boost/asio/bind_executor.hpp>
+#include <boost/asio/post.hpp>
 #include <boost/asio/write.hpp>
 #include <boost/json.hpp>
 #include <fmt/format.h> // fmt::to_string
+#include <zlib.h>
 
+#include "ClusterRegistry.hpp"
+#include "../LoadMonitor.hpp"
 #include "../Lobby.hpp"
 #include "../Workaround.hpp"
 
 namespace Ignis::Multirole::Endpoint
 {
 
+#include "../../Write.inl"
+
+// Shortest interval rooms are serialized again at.
+constexpr auto MIN_SERIALIZE_INTERVAL = std::chrono::milliseconds(100);
+
+// Compresses `str` with gzip, returns an empty string on failure.
+inline std::string Gzip(std::string_view str)
+{
+	z_stream zs{};
+	// NOTE: 15 window bits plus 16 to write a gzip header and trailer.
+	if(deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK)
+		return {};
+	std::string out(deflateBound(&zs, static_cast<uLong>(str.size())), '\0');
+	zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(str.data()));
+	zs.avail_in = static_cast<uInt>(str.size());
+	zs.next_out = reinterpret_cast<Bytef*>(out.data());
+	zs.avail_out = static_cast<uInt>(out.size());
+	const int ret = deflate(&zs, Z_FINISH);
+	out.resize(zs.total_out);
+	deflateEnd(&zs);
+	if(ret != Z_STREAM_END)
+		return {};
+	return out;
+}
+
+constexpr auto KEEP_ALIVE_TIMEOUT = std::chrono::seconds(30);
+constexpr std::size_t MAX_QUEUED_EVENTS = 64U;
+constexpr std::string_view FEED_TARGET = "/events";
+constexpr std::string_view LOCAL_TARGET = "/local"; // See ClusterRegistry.
+
+// Appends a server-sent event, `data` must not have line breaks.
+inline void AppendEvent(std::string& out, std::string_view event, std::string_view data)
+{
+	out.append("event: ").append(event).append("\ndata: ").append(data).append("\n\n");
+}
+
+// Gets the value of the given header field from lowercase request headers,
+// or an empty string if the field isn't there.
+inline std::string_view HeaderValue(std::string_view headers, std::string_view field)
+{
+	for(std::size_t pos = headers.find("\r\n"); pos != std::string_view::npos;)
+	{
+		const auto first = pos + 2U;
+		const auto last = headers.find("\r\n", first);
+		const auto line = headers.substr(first, last - first);
+		if(line.size() > field.size() && line.substr(0U, field.size()) == field && line[field.size()] == ':')
+			return line.substr(field.size() + 1U);
+		pos = last;
+	}
+	return {};
+}
+
+// Subset of the listing asked for through the query string of a request,
+// such as "/?banlist_hash=123&started=0&after=40&limit=50".
+struct Filter
+{
+	std::optional<uint32_t> banlistHash;
+	std::optional<int32_t> bestOf;
+	std::optional<uint8_t> rule;
+	std::optional<bool> passworded;
+	std::optional<bool> started;
+	uint32_t after = 0U; // Only rooms with a greater ID are listed.
+	std::size_t limit = std::numeric_limits<std::size_t>::max();
+	bool any = false; // Whether or not anything was asked for.
+
+	template<typename E>
+	bool Matches(const E& e) const
+	{
+		return (!banlistHash || e.banlistHash == *banlistHash) &&
+		       (!bestOf || e.bestOf == *bestOf) &&
+		       (!rule || e.rule == *rule) &&
+		       (!passworded || e.passworded == *passworded) &&
+		       (!started || e.started == *started);
+	}
+};
+
+template<typename T>
+inline bool ParseParam(std::string_view value, T& out)
+{
+	return std::from_chars(value.data(), value.data() + value.size(), out).ec == std::errc{};
+}
+
+// Parses the parameters of a query string, ignoring unknown or malformed
+// ones.
+inline Filter ParseFilter(std::string_view query)
+{
+	Filter f;
+	while(!query.empty())
+	{
+		const auto amp = query.find('&');
+		const auto param = query.substr(0U, amp);
+		query = (amp == std::string_view::npos) ? std::string_view{} : query.substr(amp + 1U);
+		const auto eq = param.find('=');
+		if(eq == std::string_view::npos)
+			continue;
+		const auto key = param.substr(0U, eq);
+		const auto value = param.substr(eq + 1U);
+		uint64_t v = 0U;
+		if(!ParseParam(value, v))
+			continue;
+		if(key == "banlist_hash")
+			f.banlistHash = static_cast<uint32_t>(v);
+		else if(key == "best_of")
+			f.bestOf = static_cast<int32_t>(v);
+		else if(key == "rule")
+			f.rule = static_cast<uint8_t>(v);
+		else if(key == "needpass")
+			f.passworded = v != 0U;
+		else if(key == "started")
+			f.started = v != 0U;
+		else if(key == "after")
+			f.after = static_cast<uint32_t>(v);
+		else if(key == "limit")
+			f.limit = static_cast<std::size_t>(v);
+		else
+			continue;
+		f.any = true;
+	}
+	return f;
+}
+
+// Rooms of a snapshot that pass a filter, in listing order.
+template<typename E>
+struct Selection
+{
+	std::vector<const E*> rooms;
+	uint32_t next = 0U; // Cursor to continue from, 0 if these are the last.
+};
+
+// Picks the rooms of `s` that pass the filter, at most `limit` of them.
+template<typename S>
+inline auto Select(const S& s, const Filter& f)
+{
+	Selection<typename decltype(s.rooms)::value_type> sel;
+	// Returns false once the page is full and another room matched.
+	const auto visit = [&](const auto& e)
+	{
+		if(!f.Matches(e))
+			return true;
+		if(sel.rooms.size() == f.limit)
+		{
+			sel.next = sel.rooms.empty() ? f.after : sel.rooms.back()->id;
+			return false;
+		}
+		sel.rooms.push_back(&e);
+		return true;
+	};
+	const auto first = std::lower_bound(s.rooms.begin(), s.rooms.end(), f.after,
+		[](const auto& e, uint32_t id){return e.id <= id;});
+	if(f.banlistHash)
+	{
+		// Only rooms with the asked banlist need to be looked at.
+		if(auto search = s.byBanlist.find(*f.banlistHash); search != s.byBanlist.end())
+		{
+			const auto& positions = search->second;
+			const auto start = static_cast<std::size_t>(first - s.rooms.begin());
+			for(auto it = std::lower_bound(positions.begin(), positions.end(), start);
+				it != positions.end() && visit(s.rooms[*it]); ++it);
+		}
+	}
+	else
+	{
+		for(auto it = first; it != s.rooms.end() && visit(*it); ++it);
+	}
+	return sel;
+}
+
+// Writes the JSON listing of the given rooms, with the cursor to continue
+// from if there is one, the relays if there are any (`relays` being the
+// already serialized array) and whether or not this node is busy.
+template<typename E>
+inline void SerializeJson(const std::vector<const E*>& rooms, uint32_t next, const std::string& relays, bool busy, std::string& out)
+{
+	out = "{\"rooms\":[";
+	for(std::size_t i = 0U; i < rooms.size(); i++)
+	{
+		if(i != 0U)
+			out += ',';
+		out += *rooms[i]->json;
+	}
+	out += ']';
+	if(next != 0U)
+		fmt::format_to(std::back_inserter(out), ",\"next\":{:d}", next);
+	if(!relays.empty())
+		out.append(",\"relays\":").append(relays);
+	if(busy)
+		out += ",\"busy\":true";
+	out += '}';
+}
+
+// Binary listing layout, all integers little-endian:
+//   Header:
+//     u32 magic ("MRLB"), u16 version, u16 record size, u16 user size,
+//     u16 flags (LISTING_HEADER_FLAG_*), u32 room count, u32 user count, u32 string table size,
+//     u32 cursor to continue from (0 if none).
+//   Room records, fixed size:
+//     u32 id, u32 banlist hash, u64 duel flags, i32 forbidden types,
+//     u32 starting LP, i32 team 1 count, i32 team 2 count, i32 best of,
+//     u16 time limit, u16 extra rules, u8 starting hand, u8 draw count,
+//     u8 rule, u8 flags (LISTING_FLAG_*), u32 offset of the room strings
+//     in the string table, u16 notes length, u8 user count, u8 reserved,
+//     u32 index of the first user of the room.
+//   Users, fixed size:
+//     u32 name offset from the room strings, u16 name length, u8 position,
+//     u8 reserved.
+//   String table: UTF-8, not null terminated. Each room has its notes
+//   followed by the names of its users.
+// Fields are only ever appended to records, so that clients can skip
+// what they don't know by using the sizes in the header.
+constexpr uint32_t LISTING_MAGIC = 0x424C524DU; // "MRLB"
+constexpr uint16_t LISTING_VERSION = 1U;
+constexpr std::size_t LISTING_HEADER_SIZE = 28U;
+constexpr std::size_t LISTING_RECORD_SIZE = 56U;
+constexpr std::size_t LISTING_USER_SIZE = 8U;
+constexpr std::size_t LISTING_STRINGS_OFFSET_POS = 44U; // In a record.
+constexpr std::size_t LISTING_USER_COUNT_POS = 50U; // In a record.
+constexpr std::size_t LISTING_FIRST_USER_POS = 52U; // In a record.
+constexpr std::string_view BINARY_CONTENT_TYPE = "application/x-multirole-listing";
+
+constexpr uint16_t LISTING_HEADER_FLAG_BUSY = 0x1U;
+
+constexpr uint8_t LISTING_FLAG_NEEDPASS   = 0x1U;
+constexpr uint8_t LISTING_FLAG_STARTED    = 0x2U;
+constexpr uint8_t LISTING_FLAG_NO_CHECK   = 0x4U;
+constexpr uint8_t LISTING_FLAG_NO_SHUFFLE = 0x8U;
+
+// Makes the record of a room followed by its users and strings, with the
+// string offset and first user index left to be set once it is placed.
+inline std::string MakeBinaryRoom(
+	uint32_t id,
+	const YGOPro::HostInfo& hi,
+	std::string_view notes,
+	bool passworded,
+	const Room::Instance::ListingProps& listing)
+{
+	const auto users = listing.duelists.size();
+	std::size_t stringsSize = notes.size();
+	for(const auto& kv : listing.duelists)
+		stringsSize += kv.second.size();
+	std::string out(LISTING_RECORD_SIZE + users * LISTING_USER_SIZE + stringsSize, '\0');
+	auto* ptr = reinterpret_cast<uint8_t*>(out.data());
+	Write<uint32_t>(ptr, id);
+	Write<uint32_t>(ptr, hi.banlistHash);
+	Write<uint64_t>(ptr, YGOPro::HostInfo::OrDuelFlags(hi.duelFlagsHigh, hi.duelFlagsLow));
+	Write<int32_t>(ptr, hi.forb);
+	Write<uint32_t>(ptr, hi.startingLP);
+	Write<int32_t>(ptr, hi.t0Count);
+	Write<int32_t>(ptr, hi.t1Count);
+	Write<int32_t>(ptr, hi.bestOf);
+	Write<uint16_t>(ptr, hi.timeLimitInSeconds);
+	Write<uint16_t>(ptr, hi.extraRules);
+	Write<uint8_t>(ptr, hi.startingDrawCount);
+	Write<uint8_t>(ptr, hi.drawCountPerTurn);
+	Write<uint8_t>(ptr, hi.allowed);
+	Write<uint8_t>(ptr, static_cast<uint8_t>(
+		(passworded ? LISTING_FLAG_NEEDPASS : 0U) |
+		(listing.started ? LISTING_FLAG_STARTED : 0U) |
+		((hi.dontCheckDeck != 0U) ? LISTING_FLAG_NO_CHECK : 0U) |
+		((hi.dontShuffleDeck != 0U) ? LISTING_FLAG_NO_SHUFFLE : 0U)));
+	Write<uint32_t>(ptr, 0U); // Strings offset.
+	Write<uint16_t>(ptr, static_cast<uint16_t>(notes.size()));
+	Write<uint8_t>(ptr, static_cast<uint8_t>(users));
+	Write<uint8_t>(ptr, 0U);
+	Write<uint32_t>(ptr, 0U); // First user.
+	auto nameOffset = static_cast<uint32_t>(notes.size());
+	for(const auto& [pos, name] : listing.duelists)
+	{
+		Write<uint32_t>(ptr, nameOffset);
+		Write<uint16_t>(ptr, static_cast<uint16_t>(name.size()));
+		Write<uint8_t>(ptr, pos);
+		Write<uint8_t>(ptr, 0U);
+		nameOffset += static_cast<uint32_t>(name.size());
+	}
+	std::memcpy(ptr, notes.data(), notes.size());
+	ptr += notes.size();
+	for(const auto& kv : listing.duelists)
+	{
+		std::memcpy(ptr, kv.second.data(), kv.second.size());
+		ptr += kv.second.size();
+	}
+	return out;
+}
+
+// Writes the binary listing of the given rooms.
+template<typename E>
+inline void SerializeBinary(const std::vector<const E*>& rooms, uint32_t next, bool busy, std::string& out)
+{
+	std::size_t users = 0U;
+	std::size_t strings = 0U;
+	for(const auto* e : rooms)
+	{
+		const auto& b = *e->binary;
+		const auto count = static_cast<uint8_t>(b[LISTING_USER_COUNT_POS]);
+		users += count;
+		strings += b.size() - LISTING_RECORD_SIZE - count * LISTING_USER_SIZE;
+	}
+	out.assign(LISTING_HEADER_SIZE + rooms.size() * LISTING_RECORD_SIZE +
+		users * LISTING_USER_SIZE + strings, '\0');
+	auto* base = reinterpret_cast<uint8_t*>(out.data());
+	auto* ptr = base;
+	Write<uint32_t>(ptr, LISTING_MAGIC);
+	Write<uint16_t>(ptr, LISTING_VERSION);
+	Write<uint16_t>(ptr, static_cast<uint16_t>(LISTING_RECORD_SIZE));
+	Write<uint16_t>(ptr, static_cast<uint16_t>(LISTING_USER_SIZE));
+	Write<uint16_t>(ptr, busy ? LISTING_HEADER_FLAG_BUSY : uint16_t{0U});
+	Write<uint32_t>(ptr, static_cast<uint32_t>(rooms.size()));
+	Write<uint32_t>(ptr, static_cast<uint32_t>(users));
+	Write<uint32_t>(ptr, static_cast<uint32_t>(strings));
+	Write<uint32_t>(ptr, next);
+	auto* record = ptr;
+	auto* user = record + rooms.size() * LISTING_RECORD_SIZE;
+	auto* string = user + users * LISTING_USER_SIZE;
+	uint32_t userIndex = 0U;
+	uint32_t stringOffset = 0U;
+	for(const auto* e : rooms)
+	{
+		const auto* b = reinterpret_cast<const uint8_t*>(e->binary->data());
+		const auto count = static_cast<std::size_t>(b[LISTING_USER_COUNT_POS]);
+		const auto usersSize = count * LISTING_USER_SIZE;
+		const auto stringsSize = e->binary->size() - LISTING_RECORD_SIZE - usersSize;
+		std::memcpy(record, b, LISTING_RECORD_SIZE);
+		ptr = record + LISTING_STRINGS_OFFSET_POS;
+		Write<uint32_t>(ptr, stringOffset);
+		ptr = record + LISTING_FIRST_USER_POS;
+		Write<uint32_t>(ptr, userIndex);
+		std::memcpy(user, b + LISTING_RECORD_SIZE, usersSize);
+		std::memcpy(string, b + LISTING_RECORD_SIZE + usersSize, stringsSize);
+		record += LISTING_RECORD_SIZE;
+		user += usersSize;
+		string += stringsSize;
+		userIndex += static_cast<uint32_t>(count);
+		stringOffset += static_cast<uint32_t>(stringsSize);
+	}
+}
+
 // public
 
 LobbyListing::LobbyListing(
 	boost::asio::io_context& ioCtx,
+	Reactors& reactors,
 	unsigned short port,
-	Lobby& lobby)
+	Lobby& lobby,
+	const std::vector<std::string>& relays,
+	const ClusterRegistry* cluster,
+	const LoadMonitor& load,
+	std::chrono::milliseconds serializeInterval)
 	:
-	acceptor(ioCtx, boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v6(), port)),
 	serializeTimer(ioCtx),
+	serializeInterval(std::max(serializeInterval, MIN_SERIALIZE_INTERVAL)),
 	lobby(lobby),
-	serialized(std::make_shared<std::string>())
+	cluster(cluster),
+	load(load),
+	startTime(static_cast<uint64_t>(std::chrono::system_clock::now().time_since_epoch().count())),
+	stopped(false),
+	sweep(0U)
 {
-	Workaround::SetCloseOnExec(acceptor.native_handle());
-	DoAccept();
+	if(!relays.empty())
+	{
+		boost::json::array a;
+		for(const auto& r : relays)
+			a.emplace_back(r);
+		relaysJson = boost::json::serialize(a);
+	}
+	serialized = MakeSnapshot({}, false);
+	if(reactors.empty())
+		acceptors.push_back(MakeAcceptor(ioCtx, port, false));
+	for(auto& reactor : reactors)
+		acceptors.push_back(MakeAcceptor(reactor, port, true));
+	for(auto& acceptor : acceptors)
+		DoAccept(acceptor);
 	DoSerialize();
 }
 
@@ -33,34 +402,59 @@ LobbyListing::~LobbyListing()
 
 void LobbyListing::Stop()
 {
-	acceptor.close();
+	for(auto& acceptor : acceptors)
+		acceptor.close();
 	serializeTimer.cancel();
+	{
+		std::scoped_lock lock(mSubscribers);
+		subscribers.clear();
+	}
+	std::scoped_lock lock(mConnections);
+	stopped = true;
+	for(const auto& w : connections)
+		if(auto c = w.lock(); c)
+			c->Close();
+	connections.clear();
+}
+
+void LobbyListing::SetSerializeInterval(std::chrono::milliseconds interval)
+{
+	serializeInterval.store(std::max(interval, MIN_SERIALIZE_INTERVAL), std::memory_order_relaxed);
 }
 
 // private
 
 void LobbyListing::DoSerialize()
 {
-	serializeTimer.expires_after(std::chrono::seconds(2));
+	serializeTimer.expires_after(serializeInterval.load(std::memory_order_relaxed));
 	serializeTimer.async_wait([this](boost::system::error_code ec)
 	{
 		if(ec)
 			return;
-		auto ComposeHeader = [](std::size_t length, std::string_view mime)
-		{
-			constexpr const char* HTTP_HEADER_FORMAT_STRING =
-			"HTTP/1.0 200 OK\r\n"
-			"Content-Length: {:d}\r\n"
-			"Content-Type: {:s}\r\n\r\n";
-			return fmt::format(HTTP_HEADER_FORMAT_STRING, length, mime);
-		};
-		boost::json::monotonic_resource mr;
-		boost::json::object j(&mr);
-		auto& ar = *j.emplace("rooms", boost::json::array(&mr)).first->value().if_array();
-		lobby.CollectRooms([&](const Lobby::RoomProps& rp)
+		// Only rooms that changed since the last sweep get serialized again,
+		// the document is rebuilt only if any room changed, came or went.
+		bool changed = false;
+		sweep++;
+		listed.clear();
+		std::string feed; // Events for subscribers of the feed.
+		bool local = true;
+		const auto visit = [&](const Lobby::RoomProps& rp)
 		{
+			auto [it, inserted] = fragments.try_emplace(rp.id);
+			auto& f = it->second;
+			f.sweep = sweep;
+			const auto& listing = *rp.listing;
+			if(!inserted && f.generation == listing.generation)
+			{
+				listed.push_back(f.entry);
+				return;
+			}
+			changed = true;
+			const bool added = inserted;
+			f.generation = listing.generation;
 			const auto& hi = *rp.hostInfo;
-			auto& room = *ar.emplace_back(boost::json::object(21U, &mr)).if_object();
+			boost::json::monotonic_resource mr;
+			boost::json::object room(21U, &mr);
 			room.emplace("roomid", rp.id);
 			room.emplace("roomname", ""); // NOTE: UNUSED but expected atm
 			room.emplace("roomnotes", *rp.notes);
@@ -80,81 +474,379 @@ void LobbyListing::DoSerialize()
 			room.emplace("no_check", static_cast<bool>(hi.dontCheckDeck));
 			room.emplace("no_shuffle", static_cast<bool>(hi.dontShuffleDeck));
 			room.emplace("banlist_hash", hi.banlistHash);
-			room.emplace("istart", rp.started ? "start" : "waiting");
-			auto& ac = *room.emplace("users", boost::json::array(rp.duelists.size(), &mr)).first->value().if_array();
+			room.emplace("istart", listing.started ? "start" : "waiting");
+			const auto& duelists = listing.duelists;
+			auto& ac = *room.emplace("users", boost::json::array(duelists.size(), &mr)).first->value().if_array();
 			std::size_t i = 0U;
-			for(const auto& kv : rp.duelists)
+			for(const auto& kv : duelists)
 			{
 				auto& client = ac[i].emplace_object();
 				client.emplace("name", kv.second);
 				client.emplace("pos", kv.first);
 				i++;
 			}
-		});
-		const std::string strJ = boost::json::serialize(j); // DUMP EET
+			auto json = std::make_shared<const std::string>(boost::json::serialize(room));
+			AppendEvent(feed, added ? "room-added" : "room-changed", *json);
+			auto binary = std::make_shared<const std::string>(
+				MakeBinaryRoom(rp.id, hi, *rp.notes, rp.passworded, listing));
+			f.entry = Snapshot::Entry{rp.id, hi.banlistHash, hi.bestOf, hi.allowed, rp.passworded, listing.started, local, std::move(json), std::move(binary)};
+			listed.push_back(f.entry);
+		};
+		lobby.CollectRooms(visit);
+		if(cluster != nullptr)
+		{
+			local = false;
+			cluster->CollectRooms(visit);
+		}
+		// Forget rooms that are gone.
+		for(auto it = fragments.begin(), last = fragments.end(); it != last;)
 		{
-			std::scoped_lock lock(mSerialized);
-			serialized = std::make_shared<std::string>(
-				ComposeHeader(strJ.size(), "application/json") + strJ
-			);
+			if(it->second.sweep == sweep)
+			{
+				++it;
+				continue;
+			}
+			AppendEvent(feed, "room-removed", fmt::format("{{\"roomid\":{:d}}}", it->first));
+			it = fragments.erase(it);
+			changed = true;
+		}
+		// Load changing is published as well, even if no room did.
+		const bool busy = load.GetLevel() != LoadMonitor::Level::NORMAL;
+		if(busy != GetSnapshot()->busy)
+		{
+			AppendEvent(feed, "node-load", busy ? "{\"busy\":true}" : "{\"busy\":false}");
+			changed = true;
+		}
+		if(!changed)
+		{
+			DoSerialize();
+			return;
+		}
+		auto snapshot = MakeSnapshot(std::move(listed), busy);
+		listed = {};
+		auto events = std::make_shared<const std::string>(std::move(feed));
+		// The new snapshot and the events leading to it are published at
+		// once, so that subscribing always gets a consistent start.
+		std::scoped_lock lock(mSubscribers);
+		{
+			std::scoped_lock lock2(mSerialized);
+			serialized = std::move(snapshot);
+		}
+		for(auto it = subscribers.begin(); it != subscribers.end();)
+		{
+			if(auto c = it->lock(); c)
+			{
+				c->Push(events);
+				++it;
+				continue;
+			}
+			it = subscribers.erase(it);
 		}
 		DoSerialize();
 	});
 }
 
-void LobbyListing::DoAccept()
+std::shared_ptr<const LobbyListing::Snapshot> LobbyListing::GetSnapshot()
+{
+	std::scoped_lock lock(mSerialized);
+	return serialized;
+}
+
+bool LobbyListing::Track(const std::shared_ptr<Connection>& c)
+{
+	std::scoped_lock lock(mConnections);
+	if(stopped)
+		return false;
+	connections.erase(std::remove_if(connections.begin(), connections.end(),
+		[](const auto& w){return w.expired();}), connections.end());
+	connections.push_back(c);
+	return true;
+}
+
+std::shared_ptr<const std::string> LobbyListing::Subscribe(const std::shared_ptr<Connection>& c)
+{
+	auto start = std::make_shared<std::string>(
+		"HTTP/1.1 200 OK\r\n"
+		"Content-Type: text/event-stream\r\n"
+		"Cache-Control: no-cache\r\n"
+		"Connection: keep-alive\r\n\r\n");
+	std::scoped_lock lock(mSubscribers);
+	subscribers.push_back(c);
+	AppendEvent(*start, "snapshot", GetSnapshot()->plain);
+	return start;
+}
+
+std::shared_ptr<const LobbyListing::Snapshot> LobbyListing::MakeSnapshot(std::vector<Snapshot::Entry> rooms, bool busy) const
+{
+	auto snapshot = std::make_shared<Snapshot>();
+	snapshot->sweep = sweep;
+	snapshot->busy = busy;
+	std::sort(rooms.begin(), rooms.end(), [](const auto& a, const auto& b){return a.id < b.id;});
+	std::vector<const Snapshot::Entry*> all(rooms.size());
+	std::vector<const Snapshot::Entry*> local;
+	for(std::size_t i = 0U; i < rooms.size(); i++)
+	{
+		all[i] = &rooms[i];
+		snapshot->byBanlist[rooms[i].banlistHash].push_back(i);
+		if(rooms[i].local)
+			local.push_back(&rooms[i]);
+	}
+	std::string json;
+	SerializeJson(all, 0U, relaysJson, busy, json);
+	if(cluster != nullptr)
+	{
+		SerializeJson(local, 0U, {}, busy, snapshot->local);
+		snapshot->localETag = fmt::format("\"{:x}-{:x}-local\"", startTime, sweep);
+	}
+	SerializeBinary(all, 0U, busy, snapshot->binary);
+	snapshot->binaryETag = fmt::format("\"{:x}-{:x}-bin\"", startTime, sweep);
+	snapshot->rooms = std::move(rooms);
+	// Compressed once here rather than for each client that polls.
+	snapshot->plainETag = fmt::format("\"{:x}-{:x}\"", startTime, sweep);
+	snapshot->gzipped = Gzip(json);
+	snapshot->plain = std::move(json);
+	snapshot->gzippedETag = fmt::format("\"{:x}-{:x}-gz\"", startTime, sweep);
+	return snapshot;
+}
+
+void LobbyListing::DoAccept(boost::asio::ip::tcp::acceptor& acceptor)
 {
 	acceptor.async_accept(
-	[this](const boost::system::error_code& ec, boost::asio::ip::tcp::socket socket)
+	[this, &acceptor](const boost::system::error_code& ec, boost::asio::ip::tcp::socket socket)
 	{
 		if(!acceptor.is_open())
 			return;
 		if(!ec)
 		{
 			Workaround::SetCloseOnExec(socket.native_handle());
-			std::scoped_lock lock(mSerialized);
-			std::make_shared<Connection>(std::move(socket), serialized)->DoRead();
+			if(auto c = std::make_shared<Connection>(*this, std::move(socket)); Track(c))
+				c->DoRead();
 		}
-		DoAccept();
+		DoAccept(acceptor);
 	});
 }
 
 LobbyListing::Connection::Connection(
-	boost::asio::ip::tcp::socket socket,
-	std::shared_ptr<std::string> data)
+	LobbyListing& listing,
+	boost::asio::ip::tcp::socket socket)
 	:
+	listing(listing),
 	socket(std::move(socket)),
-	outgoing(std::move(data)),
+	strand(this->socket.get_executor()),
+	idleTimer(strand),
 	incoming(),
-	writeCalled(false)
+	received(0U),
+	body(nullptr),
+	streaming(false)
 {}
 
 void LobbyListing::Connection::DoRead()
 {
 	auto self(shared_from_this());
-	socket.async_read_some(boost::asio::buffer(incoming),
-	[this, self](boost::system::error_code ec, std::size_t /*unused*/)
+	if(!streaming)
+	{
+		idleTimer.expires_after(KEEP_ALIVE_TIMEOUT);
+		idleTimer.async_wait([this, self](boost::system::error_code ec)
+		{
+			if(!ec)
+				socket.close(ec);
+		});
+	}
+	auto buffer = boost::asio::buffer(incoming.data() + received, incoming.size() - received);
+	socket.async_read_some(buffer, boost::asio::bind_executor(strand,
+	[this, self](boost::system::error_code ec, std::size_t bytesRead)
 	{
 		if(ec)
+		{
+			idleTimer.cancel();
+			return;
+		}
+		// Anything sent by subscribers is just ignored, reading is only
+		// kept to notice when they leave.
+		if(streaming)
+		{
+			DoRead();
+			return;
+		}
+		received += bytesRead;
+		HandleRequest();
+	}));
+}
+
+void LobbyListing::Connection::Push(std::shared_ptr<const std::string> e)
+{
+	auto self(shared_from_this());
+	boost::asio::post(strand, [this, self, e = std::move(e)]()
+	{
+		if(!streaming)
 			return;
-		if(!writeCalled)
+		// Drop subscribers that can't keep up rather than buffering.
+		if(events.size() >= MAX_QUEUED_EVENTS)
 		{
-			writeCalled = true;
-			DoWrite();
+			boost::system::error_code ignore;
+			socket.close(ignore);
+			return;
 		}
-		DoRead();
+		events.push_back(std::move(e));
+		if(events.size() == 1U)
+			DoWriteEvents();
 	});
 }
 
-void LobbyListing::Connection::DoWrite()
+void LobbyListing::Connection::Close()
 {
 	auto self(shared_from_this());
-	boost::asio::async_write(socket, boost::asio::buffer(*outgoing),
-	[this, self](boost::system::error_code ec, std::size_t /*unused*/)
+	boost::asio::post(strand, [this, self]()
+	{
+		idleTimer.cancel();
+		boost::system::error_code ignore;
+		socket.close(ignore);
+	});
+}
+
+void LobbyListing::Connection::HandleRequest()
+{
+	const std::string_view request(incoming.data(), received);
+	const auto end = request.find("\r\n\r\n");
+	if(end == std::string_view::npos)
+	{
+		// Give up on requests whose headers don't fit.
+		if(received == incoming.size())
+			idleTimer.cancel();
+		else
+			DoRead();
+		return;
+	}
+	std::string headers(request.substr(0U, end + 2U));
+	for(auto& c : headers)
+		c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+	const std::string_view requestLine = std::string_view(headers).substr(0U, headers.find("\r\n"));
+	std::string_view query;
+	bool local = false; // Whether or not another node of the cluster asks.
+	if(const auto first = requestLine.find(' '); first != std::string_view::npos)
+	{
+		const auto target = requestLine.substr(first + 1U, requestLine.find(' ', first + 1U) - first - 1U);
+		if(const auto q = target.find('?'); q != std::string_view::npos)
+			query = target.substr(q + 1U);
+		const auto path = target.substr(0U, target.find('?'));
+		local = listing.cluster != nullptr && path == LOCAL_TARGET;
+		if(path == FEED_TARGET)
+		{
+			streaming = true;
+			received = 0U;
+			idleTimer.cancel();
+			events.push_back(listing.Subscribe(shared_from_this()));
+			DoWriteEvents();
+			DoRead();
+			return;
+		}
+	}
+	const auto connection = HeaderValue(headers, "connection");
+	const bool keepAlive = (requestLine.find("http/1.1") != std::string_view::npos) ?
+		connection.find("close") == std::string_view::npos :
+		connection.find("keep-alive") != std::string_view::npos;
+	snapshot = listing.GetSnapshot();
+	// Native clients can ask for the binary layout instead of JSON.
+	const bool binary = !local &&
+		HeaderValue(headers, "accept").find(BINARY_CONTENT_TYPE) != std::string_view::npos;
+	// Filtered listings are made for each request and aren't compressed,
+	// they are expected to be small.
+	const auto filter = local ? Filter{} : ParseFilter(query);
+	const bool gzipped = !filter.any && !binary && !local &&
+		HeaderValue(headers, "accept-encoding").find("gzip") != std::string_view::npos &&
+		!snapshot->gzipped.empty();
+	std::string filteredETag;
+	if(filter.any)
+	{
+		filteredETag = fmt::format("\"{:x}-{:x}-{:x}{:s}\"", listing.startTime, snapshot->sweep,
+			std::hash<std::string_view>{}(query), binary ? "-bin" : "");
+	}
+	const auto& etag = filter.any ? filteredETag :
+		local ? snapshot->localETag :
+		binary ? snapshot->binaryETag :
+		gzipped ? snapshot->gzippedETag : snapshot->plainETag;
+	// NOTE: ETags only have lowercase hexadecimal digits so they can be
+	// looked for in the lowercase headers.
+	if(HeaderValue(headers, "if-none-match").find(etag) != std::string_view::npos)
+	{
+		constexpr const char* HTTP_HEADER_FORMAT_STRING =
+		"HTTP/1.1 304 Not Modified\r\n"
+		"ETag: {:s}\r\n"
+		"Vary: Accept, Accept-Encoding\r\n"
+		"Connection: {:s}\r\n\r\n";
+		header = fmt::format(HTTP_HEADER_FORMAT_STRING, etag, keepAlive ? "keep-alive" : "close");
+		body = nullptr;
+	}
+	else
+	{
+		constexpr const char* HTTP_HEADER_FORMAT_STRING =
+		"HTTP/1.1 200 OK\r\n"
+		"Content-Length: {:d}\r\n"
+		"Content-Type: {:s}\r\n"
+		"{:s}"
+		"ETag: {:s}\r\n"
+		"Vary: Accept, Accept-Encoding\r\n"
+		"Connection: {:s}\r\n\r\n";
+		if(filter.any)
+		{
+			const auto sel = Select(*snapshot, filter);
+			if(binary)
+				SerializeBinary(sel.rooms, sel.next, snapshot->busy, filtered);
+			else
+				SerializeJson(sel.rooms, sel.next, listing.relaysJson, snapshot->busy, filtered);
+			body = &filtered;
+		}
+		else
+		{
+			body = local ? &snapshot->local :
+				binary ? &snapshot->binary :
+				gzipped ? &snapshot->gzipped : &snapshot->plain;
+		}
+		header = fmt::format(HTTP_HEADER_FORMAT_STRING, body->size(),
+			binary ? BINARY_CONTENT_TYPE : "application/json",
+			gzipped ? "Content-Encoding: gzip\r\n" : "", etag, keepAlive ? "keep-alive" : "close");
+	}
+	// Keep whatever was read past this request for the next one.
+	received -= end + 4U;
+	std::memmove(incoming.data(), incoming.data() + end + 4U, received);
+	DoWrite(keepAlive);
+}
+
+void LobbyListing::Connection::DoWrite(bool keepAlive)
+{
+	auto self(shared_from_this());
+	std::array<boost::asio::const_buffer, 2U> buffers
 	{
+		boost::asio::buffer(header),
+		(body != nullptr) ? boost::asio::buffer(*body) : boost::asio::const_buffer()
+	};
+	boost::asio::async_write(socket, buffers, boost::asio::bind_executor(strand,
+	[this, self, keepAlive](boost::system::error_code ec, std::size_t /*unused*/)
+	{
+		snapshot.reset();
+		if(!ec && keepAlive)
+		{
+			HandleRequest();
+			return;
+		}
+		idleTimer.cancel();
 		if(!ec)
 			socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
-	});
+	}));
+}
+
+void LobbyListing::Connection::DoWriteEvents()
+{
+	auto self(shared_from_this());
+	boost::asio::async_write(socket, boost::asio::buffer(*events.front()), boost::asio::bind_executor(strand,
+	[this, self](boost::system::error_code ec, std::size_t /*unused*/)
+	{
+		if(ec)
+			return;
+		events.pop_front();
+		if(!events.empty())
+			DoWriteEvents();
+	}));
 }
 
 } // namespace Ignis::Multirole::Endpoint
@@ -1,48 +1,169 @@
 #ifndef LOBBYLISTING_HPP
 #define LOBBYLISTING_HPP
+#include <atomic>
+#include <chrono>
+#include <deque>
 #include <memory>
 #include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
 
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/asio/steady_timer.hpp>
+#include <boost/asio/strand.hpp>
+
+#include "Reactors.hpp"
 
 namespace Ignis::Multirole
 {
 
+class LoadMonitor;
 class Lobby;
 
 namespace Endpoint
 {
 
+class ClusterRegistry;
+
 class LobbyListing final
 {
 public:
-	LobbyListing(boost::asio::io_context& ioCtx, unsigned short port, Lobby& lobby);
+	// If there are `reactors` each one accepts connections on its own,
+	// otherwise they are accepted on `ioCtx`. `relays` are the addresses
+	// of the relays serving spectators of this instance, which are
+	// advertised along with the rooms. The rooms of the other nodes of the
+	// cluster are listed as well if there's a `cluster`. The listing says
+	// the node is busy whenever `load` isn't normal. Rooms are serialized
+	// again every `serializeInterval`.
+	LobbyListing(
+		boost::asio::io_context& ioCtx,
+		Reactors& reactors,
+		unsigned short port,
+		Lobby& lobby,
+		const std::vector<std::string>& relays,
+		const ClusterRegistry* cluster,
+		const LoadMonitor& load,
+		std::chrono::milliseconds serializeInterval);
 	~LobbyListing();
 
 	void Stop();
+
+	// Takes effect after the serialization that is already scheduled.
+	void SetSerializeInterval(std::chrono::milliseconds interval);
 private:
+	// Bodies for the same listing along with their strong ETags, and the
+	// rooms they were made of so that requests can ask for a subset.
+	struct Snapshot
+	{
+		// Fields a listing can be filtered with, plus the serialized room.
+		struct Entry
+		{
+			uint32_t id;
+			uint32_t banlistHash;
+			int32_t bestOf;
+			uint8_t rule;
+			bool passworded;
+			bool started;
+			bool local; // Whether or not the room is hosted by this node.
+			std::shared_ptr<const std::string> json;
+			// Record, duelists and strings of the room in the binary
+			// layout, see LobbyListing.cpp.
+			std::shared_ptr<const std::string> binary;
+		};
+		uint64_t sweep;
+		bool busy; // Whether or not this node was busy.
+		std::vector<Entry> rooms; // Sorted by ID, used as pagination cursor.
+		// Positions in `rooms` of the rooms using each banlist, ascending.
+		std::unordered_map<uint32_t, std::vector<std::size_t>> byBanlist;
+		std::string plain;
+		std::string plainETag;
+		std::string gzipped; // Empty if compression failed.
+		std::string gzippedETag;
+		std::string binary; // Same listing in the binary layout.
+		std::string binaryETag;
+		std::string local; // Rooms of this node only, for the cluster.
+		std::string localETag;
+	};
+
+	// Serves requests one after the other for as long as the client keeps
+	// the connection alive and isn't idle for too long. Requesting the feed
+	// instead turns the connection into a stream of server-sent events
+	// with a full snapshot followed by the rooms that were added, changed
+	// or removed on each sweep.
 	class Connection final : public std::enable_shared_from_this<Connection>
 	{
 	public:
-		Connection(boost::asio::ip::tcp::socket socket, std::shared_ptr<std::string> data);
+		Connection(LobbyListing& listing, boost::asio::ip::tcp::socket socket);
 		void DoRead();
+
+		// Queues events to be streamed, if the client subscribed.
+		void Push(std::shared_ptr<const std::string> events);
+		// Closes the connection from its strand, whatever it is doing.
+		void Close();
 	private:
+		LobbyListing& listing;
 		boost::asio::ip::tcp::socket socket;
-		std::shared_ptr<std::string> outgoing;
-		std::array<char, 256> incoming;
-		bool writeCalled;
+		boost::asio::strand<boost::asio::ip::tcp::socket::executor_type> strand;
+		boost::asio::steady_timer idleTimer;
+		std::array<char, 2048> incoming;
+		std::size_t received; // Bytes of incoming requests read so far.
+		std::shared_ptr<const Snapshot> snapshot; // Kept until written.
+		std::string header;
+		const std::string* body; // Owned by `snapshot`, null if none.
+		std::string filtered; // Body made for requests with a query.
+		bool streaming; // Whether or not the client subscribed to the feed.
+		std::deque<std::shared_ptr<const std::string>> events;
 
-		void DoWrite();
+		// Answers the first complete request read, if any, otherwise
+		// keeps reading.
+		void HandleRequest();
+		void DoWrite(bool keepAlive);
+		void DoWriteEvents();
 	};
 
-	boost::asio::ip::tcp::acceptor acceptor;
+	std::deque<boost::asio::ip::tcp::acceptor> acceptors;
 	boost::asio::steady_timer serializeTimer;
+	std::atomic<std::chrono::milliseconds> serializeInterval;
 	Lobby& lobby;
-	std::shared_ptr<std::string> serialized;
+	const ClusterRegistry* cluster; // Null if not clustered.
+	const LoadMonitor& load;
+	std::string relaysJson; // Empty if there are no relays.
+	const uint64_t startTime; // Keeps ETags unique across restarts.
+	std::shared_ptr<const Snapshot> serialized;
 	std::mutex mSerialized;
+	std::vector<std::weak_ptr<Connection>> subscribers;
+	std::mutex mSubscribers; // Also held while publishing a new snapshot.
+	// Every connection accepted, so that stopping can close them rather
+	// than wait for subscribers to leave or keep-alive ones to time out.
+	std::vector<std::weak_ptr<Connection>> connections;
+	std::mutex mConnections;
+	bool stopped; // Guarded by mConnections.
+
+	// Serialized listing of a single room, kept until the room changes.
+	struct Fragment
+	{
+		uint64_t generation; // See Room::Instance::ListingProps.
+		uint64_t sweep; // Last sweep the room was seen on.
+		Snapshot::Entry entry;
+	};
+	std::unordered_map<uint32_t, Fragment> fragments;
+	std::vector<Snapshot::Entry> listed; // Fragments seen on this sweep.
+	uint64_t sweep;
+
+	std::shared_ptr<const Snapshot> GetSnapshot();
+
+	// Keeps track of a new connection, returns false if already stopped.
+	bool Track(const std::shared_ptr<Connection>& c);
+
+	// Registers a connection to the feed, returns the start of the stream
+	// to send it, which includes a snapshot all further events build upon.
+	std::shared_ptr<const std::string> Subscribe(const std::shared_ptr<Connection>& c);
+	// Sorts the rooms and builds the full listing and indexes out of them.
+	std::shared_ptr<const Snapshot> MakeSnapshot(std::vector<Snapshot::Entry> rooms, bool busy) const;
 
-	void DoAccept();
+	void DoAccept(boost::asio::ip::tcp::acceptor& acceptor);
 	void DoSerialize();
 };
 
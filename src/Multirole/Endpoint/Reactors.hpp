@@ -0,0 +1,48 @@
+#ifndef ENDPOINT_REACTORS_HPP
+#define ENDPOINT_REACTORS_HPP
+#include <deque>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+
+#include "SocketHandoff.hpp"
+#include "../Workaround.hpp"
+
+namespace Ignis::Multirole::Endpoint
+{
+
+// Io contexts that are each run by a single thread, every one of them
+// has its own acceptor for each endpoint and serves the rooms created
+// through it. Empty if all sockets share the same io context instead.
+using Reactors = std::deque<boost::asio::io_context>;
+
+// Creates an acceptor listening on `port`. If `reusePort` is set, several
+// acceptors can listen on the same port and the kernel balances incoming
+// connections between them. Sockets taken from a previous process are
+// used first, and every acceptor is registered to be handed off later.
+inline boost::asio::ip::tcp::acceptor MakeAcceptor(
+	boost::asio::io_context& ioCtx,
+	unsigned short port,
+	bool reusePort)
+{
+	if(auto inherited = SocketHandoff::Take(port); inherited)
+	{
+		boost::asio::ip::tcp::acceptor acceptor(ioCtx, inherited->protocol, inherited->fd);
+		SocketHandoff::Add(port, acceptor.native_handle());
+		return acceptor;
+	}
+	const boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::tcp::v6(), port);
+	boost::asio::ip::tcp::acceptor acceptor(ioCtx, endpoint.protocol());
+	acceptor.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+	if(reusePort)
+		Workaround::SetReusePort(acceptor.native_handle());
+	acceptor.bind(endpoint);
+	acceptor.listen();
+	Workaround::SetCloseOnExec(acceptor.native_handle());
+	SocketHandoff::Add(port, acceptor.native_handle());
+	return acceptor;
+}
+
+} // namespace Ignis::Multirole::Endpoint
+
+#endif // ENDPOINT_REACTORS_HPP
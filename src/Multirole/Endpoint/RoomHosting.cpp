@@ -1,14 +1,20 @@
 #include "RoomHosting.hpp"
 
-#include <boost/asio/read.hpp>
+#include <cstring> // strnlen
+
+#include <boost/asio/bind_executor.hpp>
+#include <boost/asio/dispatch.hpp>
 #include <boost/asio/write.hpp>
+#include <fmt/format.h>
 
 #include "../I18N.hpp"
+#include "../LoadMonitor.hpp"
 #include "../Lobby.hpp"
 #include "../STOCMsgFactory.hpp"
 #include "../Workaround.hpp"
 #include "../Room/Client.hpp"
 #include "../Room/Instance.hpp"
+#include "../Room/Stats.hpp"
 #include "../Service/BanlistProvider.hpp"
 #include "../YGOPro/Config.hpp"
 #include "../YGOPro/StringUtils.hpp"
@@ -63,9 +69,23 @@ template<typename Buffer>
 inline std::string Utf16BufferToStr(const Buffer& buffer)
 {
 	using namespace YGOPro;
-	return UTF16ToUTF8(BufferToUTF16(buffer, sizeof(Buffer)));
+	return UTF16BufferToUTF8(buffer, sizeof(Buffer));
 }
 
+// Moves the socket onto another io context, so its operations complete
+// there instead.
+inline boost::asio::ip::tcp::socket MoveSocket(
+	boost::asio::ip::tcp::socket& socket,
+	boost::asio::io_context& ioCtx)
+{
+	const auto protocol = boost::asio::ip::tcp::v6();
+	return boost::asio::ip::tcp::socket(ioCtx, protocol, socket.release());
+}
+
+// Buckets are only forgotten once this many are kept, and then only the
+// ones that are full again anyway.
+constexpr std::size_t BUCKETS_PRUNE_THRESHOLD = 4096U;
+
 inline YGOPro::STOCMsg SrvMsg(const char* const str)
 {
 	return STOCMsgFactory::MakeChat(CHAT_MSG_TYPE_ERROR, str);
@@ -73,7 +93,19 @@ inline YGOPro::STOCMsg SrvMsg(const char* const str)
 
 // public
 
-RoomHosting::RoomHosting(boost::asio::io_context& ioCtx, Service& svc, Lobby& lobby, unsigned short port)
+RoomHosting::RoomHosting(
+	boost::asio::io_context& ioCtx,
+	boost::asio::io_context& roomIoCtx,
+	Reactors& reactors,
+	Service& svc,
+	Lobby& lobby,
+	unsigned short port,
+	const Tuning& tuning,
+	bool queryDeltas,
+	KeepAlive keepAlive,
+	std::string relayToken,
+	const std::map<uint32_t, std::string>& nodeAddresses,
+	const LoadMonitor& load)
 	:
 	prebuiltMsgs({
 		STOCMsgFactory::MakeVersionError(YGOPro::SERVER_VERSION),
@@ -83,19 +115,43 @@ RoomHosting::RoomHosting(boost::asio::io_context& ioCtx, Service& svc, Lobby& lo
 		SrvMsg(I18N::CLIENT_ROOM_HOSTING_INVALID_MSG),
 		STOCMsgFactory::MakeJoinError(Error::JOIN_NOT_FOUND),
 		SrvMsg(I18N::CLIENT_ROOM_HOSTING_KICKED_BEFORE),
+		SrvMsg(I18N::CLIENT_ROOM_HOSTING_BUSY),
 	}),
-	ioCtx(ioCtx),
 	svc(svc),
 	lobby(lobby),
-	acceptor(ioCtx, boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v6(), port))
+	tuning(std::make_shared<const Tuning>(tuning)),
+	queryDeltas(queryDeltas),
+	keepAlive(keepAlive),
+	pinnedRooms(!reactors.empty()),
+	relayToken(std::move(relayToken)),
+	load(load),
+	pendingHandshakes(0U)
 {
-	Workaround::SetCloseOnExec(acceptor.native_handle());
-	DoAccept();
+	for(const auto& [node, address] : nodeAddresses)
+	{
+		if(node != lobby.NodeId())
+		{
+			const auto str = fmt::format(I18N::CLIENT_ROOM_HOSTING_OTHER_NODE, address);
+			redirectMsgs.emplace(node, STOCMsgFactory::MakeChat(CHAT_MSG_TYPE_ERROR, str));
+		}
+	}
+	if(!pinnedRooms)
+		listeners.push_back({roomIoCtx, MakeAcceptor(ioCtx, port, false)});
+	for(auto& reactor : reactors)
+		listeners.push_back({reactor, MakeAcceptor(reactor, port, true)});
+	for(auto& l : listeners)
+		DoAccept(l);
 }
 
 void RoomHosting::Stop()
 {
-	acceptor.close();
+	for(auto& l : listeners)
+		l.acceptor.close();
+}
+
+void RoomHosting::SetTuning(const Tuning& t)
+{
+	std::atomic_store(&tuning, std::make_shared<const Tuning>(t));
 }
 
 const YGOPro::STOCMsg& RoomHosting::GetPrebuiltMsg(PrebuiltMsgId id) const
@@ -110,11 +166,14 @@ Lobby& RoomHosting::GetLobby() const
 	return lobby;
 }
 
-Room::Instance::CreateInfo RoomHosting::GetBaseRoomCreateInfo(uint32_t banlistHash) const
+Room::Instance::CreateInfo RoomHosting::GetBaseRoomCreateInfo(
+	boost::asio::io_context& roomIoCtx,
+	uint32_t banlistHash) const
 {
+	const auto t = GetTuning();
 	return Room::Instance::CreateInfo
 	{
-		ioCtx,
+		roomIoCtx,
 		{}, // notes
 		{}, // password
 		svc,
@@ -122,80 +181,178 @@ Room::Instance::CreateInfo RoomHosting::GetBaseRoomCreateInfo(uint32_t banlistHa
 		0U, // seed
 		svc.banlistProvider.GetBanlistByHash(banlistHash),
 		{}, // hostInfo
-		{} // limits
+		{}, // limits
+		t->processBudget,
+		queryDeltas,
+		t->costLimits,
+		t->memoryBudget,
+		t->sendLimits,
+		t->chatLimits,
+		t->idleTimeouts,
+		{} // expiryHook
 	};
 }
 
 // private
 
-void RoomHosting::DoAccept()
+std::shared_ptr<const RoomHosting::Tuning> RoomHosting::GetTuning() const
+{
+	return std::atomic_load(&tuning);
+}
+
+bool RoomHosting::TakeToken(const AdmissionLimits& admission, const boost::asio::ip::address& addr)
+{
+	const auto now = std::chrono::steady_clock::now();
+	const auto Refill = [&](Bucket& b)
+	{
+		const std::chrono::duration<double> elapsed = now - b.last;
+		b.tokens = std::min(admission.connectionBurst,
+			b.tokens + elapsed.count() * admission.connectionsPerSecond);
+		b.last = now;
+	};
+	std::scoped_lock lock(mBuckets);
+	if(buckets.size() >= BUCKETS_PRUNE_THRESHOLD)
+	{
+		for(auto it = buckets.begin(); it != buckets.end();)
+		{
+			Refill(it->second);
+			if(it->second.tokens >= admission.connectionBurst)
+				it = buckets.erase(it);
+			else
+				++it;
+		}
+	}
+	auto [it, inserted] = buckets.try_emplace(addr, Bucket{admission.connectionBurst, now});
+	if(!inserted)
+		Refill(it->second);
+	if(it->second.tokens < 1.0)
+		return false;
+	it->second.tokens -= 1.0;
+	return true;
+}
+
+void RoomHosting::DoAccept(Listener& l)
 {
-	acceptor.async_accept(
-	[this](const boost::system::error_code& ec, boost::asio::ip::tcp::socket socket)
+	l.acceptor.async_accept(
+	[this, &l](const boost::system::error_code& ec, boost::asio::ip::tcp::socket socket)
 	{
-		if(!acceptor.is_open())
+		if(!l.acceptor.is_open())
 			return;
 		if(!ec)
 		{
-			Workaround::SetCloseOnExec(socket.native_handle());
-			std::make_shared<Connection>(*this, std::move(socket))->DoReadHeader();
+			// Connections over the limits are dropped right away, without
+			// spending anything else on them.
+			boost::system::error_code ignore;
+			const auto endpoint = socket.remote_endpoint(ignore);
+			const auto t = GetTuning();
+			const bool admitted = !ignore &&
+				pendingHandshakes.load(std::memory_order_relaxed) < t->admission.maxPendingHandshakes &&
+				TakeToken(t->admission, endpoint.address());
+			Room::Stats::Get().RecordAccept(admitted);
+			if(admitted)
+			{
+				Workaround::SetCloseOnExec(socket.native_handle());
+				if(keepAlive.idle.count() != 0)
+				{
+					socket.set_option(boost::asio::socket_base::keep_alive(true), ignore);
+					Workaround::SetKeepAliveTiming(socket.native_handle(),
+						static_cast<int>(keepAlive.idle.count()),
+						static_cast<int>(keepAlive.interval.count()),
+						keepAlive.count);
+				}
+				std::make_shared<Connection>(*this, l.roomIoCtx, std::move(socket))->Start();
+			}
+			else
+			{
+				socket.close(ignore);
+			}
 		}
-		DoAccept();
+		DoAccept(l);
 	});
 }
 
 RoomHosting::Connection::Connection(
-	const RoomHosting& roomHosting,
+	RoomHosting& roomHosting,
+	boost::asio::io_context& roomIoCtx,
 	boost::asio::ip::tcp::socket socket)
 	:
 	roomHosting(roomHosting),
-	socket(std::move(socket))
-{}
+	roomIoCtx(roomIoCtx),
+	socket(std::move(socket)),
+	strand(this->socket.get_executor()),
+	deadline(strand)
+{
+	roomHosting.pendingHandshakes.fetch_add(1U, std::memory_order_relaxed);
+}
 
+RoomHosting::Connection::~Connection()
+{
+	roomHosting.pendingHandshakes.fetch_sub(1U, std::memory_order_relaxed);
+}
 
-void RoomHosting::Connection::DoReadHeader()
+void RoomHosting::Connection::Start()
 {
 	auto self(shared_from_this());
-	auto buffer = boost::asio::buffer(incoming.Data(), YGOPro::CTOSMsg::HEADER_LENGTH);
-	boost::asio::async_read(socket, buffer,
-	[this, self](boost::system::error_code ec, std::size_t /*unused*/)
+	// Bounds both the handshake and writing any error back.
+	deadline.expires_after(roomHosting.GetTuning()->admission.handshakeTimeout);
+	deadline.async_wait([this, self](boost::system::error_code ec)
 	{
-		if(!ec && incoming.IsHeaderValid())
-			DoReadBody();
+		if(!ec)
+			socket.close(ec);
+	});
+	boost::asio::dispatch(strand, [this, self]()
+	{
+		DoRead();
 	});
 }
 
-void RoomHosting::Connection::DoReadBody()
+
+void RoomHosting::Connection::DoRead()
 {
-	auto self(shared_from_this());
-	auto buffer = boost::asio::buffer(incoming.Body(), incoming.GetLength());
-	boost::asio::async_read(socket, buffer,
-	[this, self](boost::system::error_code ec, std::size_t /*unused*/)
+	using Result = YGOPro::CTOSMsgReader::Result;
+	for(Result r; (r = reader.Next(incoming)) != Result::INCOMPLETE;)
 	{
-		if(ec)
+		if(r == Result::INVALID)
 			return;
-		if(const auto status = HandleMsg(); status == Status::STATUS_CONTINUE)
+		if(const auto status = HandleMsg(); status == Status::STATUS_MOVED)
 		{
-			DoReadHeader();
+			Room::Stats::Get().RecordHandshake(true);
+			deadline.cancel();
+			return;
 		}
 		else if(status == Status::STATUS_ERROR)
 		{
+			Room::Stats::Get().RecordHandshake(false);
 			DoReadEnd();
 			DoWrite();
+			return;
 		}
-	});
+	}
+	const auto [data, size] = reader.WritableArea();
+	auto self(shared_from_this());
+	socket.async_read_some(boost::asio::buffer(data, size), boost::asio::bind_executor(strand,
+	[this, self](boost::system::error_code ec, std::size_t bytesRead)
+	{
+		if(ec)
+		{
+			deadline.cancel();
+			return;
+		}
+		reader.Commit(bytesRead);
+		DoRead();
+	}));
 }
 
 void RoomHosting::Connection::DoReadEnd()
 {
 	auto self(shared_from_this());
 	auto buffer = boost::asio::buffer(incoming.Data(), YGOPro::CTOSMsg::MSG_MAX_LENGTH);
-	socket.async_read_some(buffer,
+	socket.async_read_some(buffer, boost::asio::bind_executor(strand,
 	[this, self](boost::system::error_code ec, std::size_t /*unused*/)
 	{
 		if(!ec)
 			DoReadEnd();
-	});
+	}));
 }
 
 void RoomHosting::Connection::DoWrite()
@@ -203,7 +360,7 @@ void RoomHosting::Connection::DoWrite()
 	assert(!outgoing.empty());
 	auto self(shared_from_this());
 	const auto& front = outgoing.front();
-	boost::asio::async_write(socket, boost::asio::buffer(front.Data(), front.Length()),
+	boost::asio::async_write(socket, boost::asio::buffer(front.Data(), front.Length()), boost::asio::bind_executor(strand,
 	[this, self](boost::system::error_code ec, std::size_t /*unused*/)
 	{
 		if(ec)
@@ -213,7 +370,7 @@ void RoomHosting::Connection::DoWrite()
 			DoWrite();
 		else
 			socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
-	});
+	}));
 }
 
 RoomHosting::Connection::Status RoomHosting::Connection::HandleMsg()
@@ -244,9 +401,16 @@ RoomHosting::Connection::Status RoomHosting::Connection::HandleMsg()
 			PushToWriteQueue(PrebuiltMsgId::PREBUILT_MSG_VERSION_MISMATCH);
 			return Status::STATUS_ERROR;
 		}
+		// Rooms that already exist keep running smoothly instead.
+		if(roomHosting.load.GetLevel() == LoadMonitor::Level::SATURATED)
+		{
+			PushToWriteQueue(PrebuiltMsgId::PREBUILT_SERVER_BUSY);
+			PushToWriteQueue(PrebuiltMsgId::PREBUILT_GENERIC_JOIN_ERROR);
+			return Status::STATUS_ERROR;
+		}
 		*std::rbegin(p->notes) = '\0'; // Guarantee null-terminated string.
 		// Get "template" information that will be modified and used.
-		auto info = roomHosting.GetBaseRoomCreateInfo(p->hostInfo.banlistHash);
+		auto info = roomHosting.GetBaseRoomCreateInfo(roomIoCtx, p->hostInfo.banlistHash);
 		// Set our custom info.
 		info.hostInfo = p->hostInfo;
 		info.limits = LimitsFromFlags(info.hostInfo.extraRules);
@@ -266,11 +430,18 @@ RoomHosting::Connection::Status RoomHosting::Connection::HandleMsg()
 		// Make new room with the set parameters, missing parameters will be
 		// filled by the lobby.
 		auto room = roomHosting.GetLobby().MakeRoom(info);
+		if(!room)
+		{
+			PushToWriteQueue(PrebuiltMsgId::PREBUILT_SERVER_BUSY);
+			PushToWriteQueue(PrebuiltMsgId::PREBUILT_GENERIC_JOIN_ERROR);
+			return Status::STATUS_ERROR;
+		}
 		// Add the client to the newly created room.
 		auto client = std::make_shared<Room::Client>(
 			std::move(room),
 			std::move(socket),
-			std::move(name));
+			std::move(name),
+			std::move(reader));
 		client->RegisterToOwner();
 		client->Start();
 		return Status::STATUS_MOVED;
@@ -286,7 +457,12 @@ RoomHosting::Connection::Status RoomHosting::Connection::HandleMsg()
 		auto room = roomHosting.GetLobby().GetRoomById(p->id);
 		if(!room)
 		{
-			PushToWriteQueue(PrebuiltMsgId::PREBUILT_ROOM_NOT_FOUND);
+			// Rooms of other nodes show up on the listing of this one.
+			const auto& redirects = roomHosting.redirectMsgs;
+			if(auto it = redirects.find(roomHosting.GetLobby().NodeOf(p->id)); it != redirects.end())
+				outgoing.push(it->second);
+			else
+				PushToWriteQueue(PrebuiltMsgId::PREBUILT_ROOM_NOT_FOUND);
 			PushToWriteQueue(PrebuiltMsgId::PREBUILT_GENERIC_JOIN_ERROR);
 			return Status::STATUS_ERROR;
 		}
@@ -301,10 +477,45 @@ RoomHosting::Connection::Status RoomHosting::Connection::HandleMsg()
 			PushToWriteQueue(PrebuiltMsgId::PREBUILT_GENERIC_JOIN_ERROR);
 			return Status::STATUS_ERROR;
 		}
+		// Serve the client from the reactor the room is pinned to.
+		if(auto& ctx = room->Strand().context(); roomHosting.pinnedRooms && &ctx != &roomIoCtx)
+			socket = MoveSocket(socket, ctx);
+		auto client = std::make_shared<Room::Client>(
+			std::move(room),
+			std::move(socket),
+			std::move(name),
+			std::move(reader));
+		client->RegisterToOwner();
+		client->Start();
+		return Status::STATUS_MOVED;
+	}
+	case YGOPro::CTOSMsg::MsgType::RELAY_SUBSCRIBE:
+	{
+		auto p = incoming.GetRelaySubscribe();
+		const auto& token = roomHosting.relayToken;
+		if(!p || token.empty() ||
+		   std::string_view(p->token, strnlen(p->token, sizeof(p->token))) != token)
+		{
+			PushToWriteQueue(PrebuiltMsgId::PREBUILT_INVALID_MSG);
+			PushToWriteQueue(PrebuiltMsgId::PREBUILT_GENERIC_JOIN_ERROR);
+			return Status::STATUS_ERROR;
+		}
+		// Only public rooms are relayed, as anyone can join the relay.
+		auto room = roomHosting.GetLobby().GetRoomById(p->id);
+		if(!room || room->IsPrivate())
+		{
+			PushToWriteQueue(PrebuiltMsgId::PREBUILT_ROOM_NOT_FOUND);
+			PushToWriteQueue(PrebuiltMsgId::PREBUILT_GENERIC_JOIN_ERROR);
+			return Status::STATUS_ERROR;
+		}
+		if(auto& ctx = room->Strand().context(); roomHosting.pinnedRooms && &ctx != &roomIoCtx)
+			socket = MoveSocket(socket, ctx);
 		auto client = std::make_shared<Room::Client>(
 			std::move(room),
 			std::move(socket),
-			std::move(name));
+			std::move(name),
+			std::move(reader),
+			true);
 		client->RegisterToOwner();
 		client->Start();
 		return Status::STATUS_MOVED;
@@ -1,20 +1,30 @@
 #ifndef ENDPOINT_ROOMHOSTING_HPP
 #define ENDPOINT_ROOMHOSTING_HPP
+#include <atomic>
+#include <chrono>
+#include <map>
 #include <mutex>
 #include <memory>
+#include <queue>
 #include <set>
+#include <string>
 
 #include <boost/asio/io_context.hpp>
 #include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/strand.hpp>
 
+#include "Reactors.hpp"
 #include "../Service.hpp"
 #include "../Room/Instance.hpp"
 #include "../YGOPro/CTOSMsg.hpp"
+#include "../YGOPro/CTOSMsgReader.hpp"
 #include "../YGOPro/STOCMsg.hpp"
 
 namespace Ignis::Multirole
 {
 
+class LoadMonitor;
 class Lobby;
 
 namespace Endpoint
@@ -32,21 +42,96 @@ public:
 		PREBUILT_INVALID_MSG,
 		PREBUILT_GENERIC_JOIN_ERROR,
 		PREBUILT_KICKED_BEFORE,
+		PREBUILT_SERVER_BUSY,
 		PREBUILT_MSG_COUNT
 	};
 
-	RoomHosting(boost::asio::io_context& ioCtx, Service& svc, Lobby& lobby, unsigned short port);
+	// Bounds on connections that didn't make it into a room yet.
+	struct AdmissionLimits
+	{
+		std::size_t maxPendingHandshakes; // Across all addresses.
+		double connectionsPerSecond; // Refill rate of each address bucket.
+		double connectionBurst; // Size of each address bucket.
+		std::chrono::milliseconds handshakeTimeout; // To create or join.
+	};
+
+	// TCP keep-alive of client connections: probes are sent after `idle`
+	// without traffic, every `interval`, and the connection is dropped
+	// after `count` of them go unanswered. Disabled if `idle` is zero.
+	struct KeepAlive
+	{
+		std::chrono::seconds idle;
+		std::chrono::seconds interval;
+		int count;
+	};
+
+	// Settings that can change while running, rooms and connections take
+	// the ones current when they are created. Rooms give the strand back
+	// after processing their duel for `processBudget`, report (and maybe
+	// throttle) duels going over `costLimits`, keep what they hold within
+	// `memoryBudget`, limit what is queued for their clients with
+	// `sendLimits` and how often they chat with `chatLimits`, and are
+	// closed once idle for as long as `idleTimeouts` allow. Connections are
+	// accepted and given time to create or join a room according to
+	// `admission`.
+	struct Tuning
+	{
+		std::chrono::microseconds processBudget;
+		Room::Context::CostLimits costLimits;
+		Room::Context::MemoryBudget memoryBudget;
+		Room::Client::SendLimits sendLimits;
+		Room::Client::ChatLimits chatLimits;
+		Room::Instance::IdleTimeouts idleTimeouts;
+		AdmissionLimits admission;
+	};
+
+	// Rooms get their strands from `roomIoCtx`, so that duel processing
+	// happens apart from the context that serves the sockets. If there are
+	// `reactors` each one accepts connections on its own, rooms are pinned
+	// to the reactor they were created on and so are the clients that join
+	// them, `ioCtx` and `roomIoCtx` are left unused then. Rooms send card
+	// updates as deltas of what clients already got if `queryDeltas` is
+	// set. Connections are kept alive with `keepAlive`. Relays subscribing
+	// to public rooms must present `relayToken`, none are accepted if
+	// empty. Clients joining a room of another node of the cluster are told
+	// which of the `nodeAddresses` to connect to instead. No rooms are
+	// created while `load` is saturated.
+	RoomHosting(
+		boost::asio::io_context& ioCtx,
+		boost::asio::io_context& roomIoCtx,
+		Reactors& reactors,
+		Service& svc,
+		Lobby& lobby,
+		unsigned short port,
+		const Tuning& tuning,
+		bool queryDeltas,
+		KeepAlive keepAlive,
+		std::string relayToken,
+		const std::map<uint32_t, std::string>& nodeAddresses,
+		const LoadMonitor& load);
 	void Stop();
 
+	// Replaces the tuning, rooms and connections that exist already keep
+	// the one they were created with.
+	void SetTuning(const Tuning& t);
+
 	const YGOPro::STOCMsg& GetPrebuiltMsg(PrebuiltMsgId id) const;
 	Lobby& GetLobby() const;
-	Room::Instance::CreateInfo GetBaseRoomCreateInfo(uint32_t banlistHash) const;
+	Room::Instance::CreateInfo GetBaseRoomCreateInfo(
+		boost::asio::io_context& roomIoCtx,
+		uint32_t banlistHash) const;
 private:
 	class Connection final : public std::enable_shared_from_this<Connection>
 	{
 	public:
-		Connection(const RoomHosting& roomHosting, boost::asio::ip::tcp::socket socket);
-		void DoReadHeader();
+		Connection(
+			RoomHosting& roomHosting,
+			boost::asio::io_context& roomIoCtx,
+			boost::asio::ip::tcp::socket socket);
+		~Connection();
+
+		// Starts the handshake deadline and reading.
+		void Start();
 	private:
 		enum class Status
 		{
@@ -55,13 +140,17 @@ private:
 			STATUS_ERROR,
 		};
 
-		const RoomHosting& roomHosting;
+		RoomHosting& roomHosting;
+		boost::asio::io_context& roomIoCtx; // Where created rooms run.
 		boost::asio::ip::tcp::socket socket;
+		boost::asio::strand<boost::asio::ip::tcp::socket::executor_type> strand;
+		boost::asio::steady_timer deadline;
 		std::string name;
+		YGOPro::CTOSMsgReader reader;
 		YGOPro::CTOSMsg incoming;
 		std::queue<YGOPro::STOCMsg> outgoing;
 
-		void DoReadBody();
+		void DoRead();
 		void DoWrite();
 		void DoReadEnd();
 
@@ -72,12 +161,40 @@ private:
 		YGOPro::STOCMsg,
 		static_cast<std::size_t>(PrebuiltMsgId::PREBUILT_MSG_COUNT)
 	> prebuiltMsgs;
-	boost::asio::io_context& ioCtx;
+	std::map<uint32_t, YGOPro::STOCMsg> redirectMsgs; // By cluster node.
+	// Accepts connections whose created rooms run on `roomIoCtx`.
+	struct Listener
+	{
+		boost::asio::io_context& roomIoCtx;
+		boost::asio::ip::tcp::acceptor acceptor;
+	};
+
 	Service& svc;
 	Lobby& lobby;
-	boost::asio::ip::tcp::acceptor acceptor;
+	std::shared_ptr<const Tuning> tuning; // Accessed atomically.
+	const bool queryDeltas;
+	const KeepAlive keepAlive;
+	const bool pinnedRooms; // Whether or not rooms are pinned to reactors.
+	const std::string relayToken;
+	const LoadMonitor& load;
+	std::deque<Listener> listeners;
+	std::atomic<std::size_t> pendingHandshakes;
+
+	// Connection tokens left for each address, refilled over time.
+	struct Bucket
+	{
+		double tokens;
+		std::chrono::steady_clock::time_point last; // Last refill.
+	};
+	std::map<boost::asio::ip::address, Bucket> buckets;
+	std::mutex mBuckets;
+
+	std::shared_ptr<const Tuning> GetTuning() const;
+
+	// Takes a token from the bucket of the address, if there are any.
+	bool TakeToken(const AdmissionLimits& admission, const boost::asio::ip::address& addr);
 
-	void DoAccept();
+	void DoAccept(Listener& l);
 };
 
 } // namespace Endpoint
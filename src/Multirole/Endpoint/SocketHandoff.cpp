@@ -0,0 +1,304 @@
+#include "SocketHandoff.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdlib> // std::getenv
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cstring> // std::memcpy, std::strncpy
+
+#include <boost/asio/local/stream_protocol.hpp>
+#endif // _WIN32
+#include <spdlog/spdlog.h>
+
+#include "../I18N.hpp"
+
+namespace Ignis::Multirole::Endpoint
+{
+
+namespace
+{
+
+// Most file descriptors a single message can carry on Linux (SCM_MAX_FD).
+constexpr std::size_t MAX_SOCKETS = 253U;
+
+struct Registry
+{
+	std::mutex mtx;
+	std::multimap<unsigned short, SocketHandoff::Inherited> taken;
+	std::vector<std::pair<unsigned short, int>> listening;
+};
+
+Registry& GetRegistry()
+{
+	static Registry r;
+	return r;
+}
+
+#ifndef _WIN32
+// Protocol of a listening socket by its address family, nothing if it
+// isn't a TCP socket that is listening.
+std::optional<SocketHandoff::Inherited> Inspect(int fd, unsigned short& port)
+{
+	sockaddr_storage addr{};
+	socklen_t len = sizeof(addr);
+	int type = 0;
+	socklen_t typeLen = sizeof(type);
+	int listening = 0;
+	socklen_t listeningLen = sizeof(listening);
+	if(getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len) != 0 ||
+	   getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &typeLen) != 0 ||
+	   getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &listening, &listeningLen) != 0 ||
+	   type != SOCK_STREAM || listening == 0)
+		return std::nullopt;
+	if(addr.ss_family == AF_INET6)
+	{
+		port = ntohs(reinterpret_cast<const sockaddr_in6&>(addr).sin6_port);
+		return SocketHandoff::Inherited{boost::asio::ip::tcp::v6(), fd};
+	}
+	if(addr.ss_family == AF_INET)
+	{
+		port = ntohs(reinterpret_cast<const sockaddr_in&>(addr).sin_port);
+		return SocketHandoff::Inherited{boost::asio::ip::tcp::v4(), fd};
+	}
+	return std::nullopt;
+}
+
+// Takes the sockets systemd passed to this process, see sd_listen_fds(3).
+std::size_t TakeFromSystemd(Registry& r)
+{
+	constexpr int SD_LISTEN_FDS_START = 3;
+	const char* pid = std::getenv("LISTEN_PID");
+	const char* fds = std::getenv("LISTEN_FDS");
+	if(pid == nullptr || fds == nullptr || std::atol(pid) != static_cast<long>(getpid()))
+		return 0U;
+	const int count = std::atoi(fds);
+	// Children (such as hornets) must not take them as well.
+	unsetenv("LISTEN_PID");
+	unsetenv("LISTEN_FDS");
+	unsetenv("LISTEN_FDNAMES");
+	std::size_t taken = 0U;
+	for(int fd = SD_LISTEN_FDS_START; fd < SD_LISTEN_FDS_START + count; fd++)
+	{
+		unsigned short port = 0U;
+		if(auto i = Inspect(fd, port); i)
+		{
+			r.taken.emplace(port, *i);
+			taken++;
+		}
+	}
+	return taken;
+}
+
+// Takes the sockets of the process serving handoffs on `path` and waits
+// until it closes the connection, which it does once it stopped.
+std::size_t TakeFromPrevious(Registry& r, const std::string& path)
+{
+	sockaddr_un addr{};
+	if(path.empty() || path.size() >= sizeof(addr.sun_path))
+		return 0U;
+	addr.sun_family = AF_UNIX;
+	std::strncpy(addr.sun_path, path.data(), sizeof(addr.sun_path) - 1U);
+	const int s = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(s == -1)
+		return 0U;
+	if(connect(s, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0)
+	{
+		close(s);
+		return 0U;
+	}
+	std::array<uint16_t, MAX_SOCKETS> ports{};
+	iovec iov{ports.data(), sizeof(ports)};
+	alignas(cmsghdr) std::array<char, CMSG_SPACE(sizeof(int) * MAX_SOCKETS)> control{};
+	msghdr msg{};
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1U;
+	msg.msg_control = control.data();
+	msg.msg_controllen = control.size();
+	std::size_t taken = 0U;
+	if(const auto received = recvmsg(s, &msg, MSG_CMSG_CLOEXEC); received > 0)
+	{
+		const auto count = static_cast<std::size_t>(received) / sizeof(uint16_t);
+		for(auto* c = CMSG_FIRSTHDR(&msg); c != nullptr; c = CMSG_NXTHDR(&msg, c))
+		{
+			if(c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS)
+				continue;
+			const std::size_t n = (c->cmsg_len - CMSG_LEN(0U)) / sizeof(int);
+			for(std::size_t i = 0U; i < n; i++)
+			{
+				int fd = -1;
+				std::memcpy(&fd, CMSG_DATA(c) + i * sizeof(int), sizeof(int));
+				unsigned short port = 0U;
+				auto inherited = Inspect(fd, port);
+				if(i >= count || !inherited)
+				{
+					close(fd);
+					continue;
+				}
+				r.taken.emplace(ports[i], *inherited);
+				taken++;
+			}
+		}
+		for(char c; read(s, &c, 1U) > 0;);
+	}
+	close(s);
+	return taken;
+}
+#endif // _WIN32
+
+} // namespace
+
+#ifndef _WIN32
+class SocketHandoff::Server final : public std::enable_shared_from_this<Server>
+{
+public:
+	Server(boost::asio::io_context& ioCtx, const std::string& path, std::function<void()> onHandoff) :
+		acceptor(ioCtx),
+		onHandoff(std::move(onHandoff))
+	{
+		// NOTE: The previous process might have left its socket behind.
+		unlink(path.data());
+		const boost::asio::local::stream_protocol::endpoint endpoint(path);
+		acceptor.open(endpoint.protocol());
+		acceptor.bind(endpoint);
+		acceptor.listen();
+	}
+
+	void DoAccept()
+	{
+		auto self(shared_from_this());
+		acceptor.async_accept(
+		[this, self](const boost::system::error_code& ec, boost::asio::local::stream_protocol::socket peer)
+		{
+			if(!acceptor.is_open())
+				return;
+			if(ec)
+			{
+				DoAccept();
+				return;
+			}
+			Send(peer.native_handle());
+			onHandoff();
+			// The new process continues once this is closed.
+		});
+	}
+
+	void Close()
+	{
+		boost::system::error_code ignore;
+		acceptor.close(ignore);
+	}
+private:
+	boost::asio::local::stream_protocol::acceptor acceptor;
+	std::function<void()> onHandoff;
+
+	static void Send(int peer)
+	{
+		auto& r = GetRegistry();
+		std::scoped_lock lock(r.mtx);
+		const std::size_t count = std::min(r.listening.size(), MAX_SOCKETS);
+		if(count == 0U)
+			return;
+		std::array<uint16_t, MAX_SOCKETS> ports{};
+		std::array<int, MAX_SOCKETS> fds{};
+		for(std::size_t i = 0U; i < count; i++)
+			std::tie(ports[i], fds[i]) = r.listening[i];
+		spdlog::info(I18N::SOCKET_HANDOFF_SENDING, count);
+		iovec iov{ports.data(), count * sizeof(uint16_t)};
+		alignas(cmsghdr) std::array<char, CMSG_SPACE(sizeof(int) * MAX_SOCKETS)> control{};
+		msghdr msg{};
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1U;
+		msg.msg_control = control.data();
+		msg.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+		auto* c = CMSG_FIRSTHDR(&msg);
+		c->cmsg_level = SOL_SOCKET;
+		c->cmsg_type = SCM_RIGHTS;
+		c->cmsg_len = CMSG_LEN(sizeof(int) * count);
+		std::memcpy(CMSG_DATA(c), fds.data(), sizeof(int) * count);
+		if(sendmsg(peer, &msg, MSG_NOSIGNAL) == -1)
+			spdlog::error(I18N::SOCKET_HANDOFF_SEND_FAILED);
+	}
+};
+#else
+class SocketHandoff::Server final
+{
+public:
+	void Close()
+	{}
+};
+#endif // _WIN32
+
+// public
+
+SocketHandoff::SocketHandoff(std::string path) :
+	path(std::move(path))
+{
+#ifndef _WIN32
+	auto& r = GetRegistry();
+	std::scoped_lock lock(r.mtx);
+	if(const auto taken = TakeFromSystemd(r); taken != 0U)
+		spdlog::info(I18N::SOCKET_HANDOFF_SYSTEMD, taken);
+	else if(const auto taken = TakeFromPrevious(r, this->path); taken != 0U)
+		spdlog::info(I18N::SOCKET_HANDOFF_TAKEN, taken);
+#endif // _WIN32
+}
+
+SocketHandoff::~SocketHandoff()
+{
+	Stop();
+}
+
+std::optional<SocketHandoff::Inherited> SocketHandoff::Take(unsigned short port)
+{
+	auto& r = GetRegistry();
+	std::scoped_lock lock(r.mtx);
+	auto it = r.taken.find(port);
+	if(it == r.taken.end())
+		return std::nullopt;
+	auto inherited = it->second;
+	r.taken.erase(it);
+	return inherited;
+}
+
+void SocketHandoff::Add(unsigned short port, int fd)
+{
+	auto& r = GetRegistry();
+	std::scoped_lock lock(r.mtx);
+	r.listening.emplace_back(port, fd);
+}
+
+void SocketHandoff::Serve(
+	[[maybe_unused]] boost::asio::io_context& ioCtx,
+	[[maybe_unused]] std::function<void()> onHandoff)
+{
+#ifndef _WIN32
+	{
+		auto& r = GetRegistry();
+		std::scoped_lock lock(r.mtx);
+		for(const auto& kv : r.taken)
+			close(kv.second.fd);
+		r.taken.clear();
+	}
+	if(path.empty())
+		return;
+	server = std::make_shared<Server>(ioCtx, path, std::move(onHandoff));
+	server->DoAccept();
+#endif // _WIN32
+}
+
+void SocketHandoff::Stop()
+{
+	if(server)
+		server->Close();
+}
+
+} // namespace Ignis::Multirole::Endpoint
@@ -0,0 +1,56 @@
+#ifndef ENDPOINT_SOCKETHANDOFF_HPP
+#define ENDPOINT_SOCKETHANDOFF_HPP
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+
+namespace Ignis::Multirole::Endpoint
+{
+
+// Passes the listening sockets of a running process on to the process
+// replacing it, so that connections keep being queued and accepted across
+// a restart instead of being refused. The new process connects to the
+// Unix socket the old one serves on `path`, takes its listening sockets
+// and waits for it to stop, which lets the old process finish its started
+// duels meanwhile. Sockets passed through systemd socket activation are
+// taken as well. Does nothing on Windows.
+class SocketHandoff final
+{
+public:
+	struct Inherited
+	{
+		boost::asio::ip::tcp protocol;
+		int fd;
+	};
+
+	// Takes the listening sockets of the process serving on `path`, if
+	// any, blocking until that process stopped.
+	explicit SocketHandoff(std::string path);
+	~SocketHandoff();
+
+	// Listening socket bound to `port` taken from the previous process or
+	// systemd, if there's one left. See MakeAcceptor.
+	static std::optional<Inherited> Take(unsigned short port);
+
+	// Registers a listening socket so that it is handed off later.
+	static void Add(unsigned short port, int fd);
+
+	// Closes the sockets that were taken but not used, and then serves
+	// handoffs on `path` from `ioCtx`, calling `onHandoff` right after the
+	// sockets are sent, after which the new process continues.
+	void Serve(boost::asio::io_context& ioCtx, std::function<void()> onHandoff);
+	void Stop();
+private:
+	class Server;
+
+	const std::string path;
+	std::shared_ptr<Server> server;
+};
+
+} // namespace Ignis::Multirole::Endpoint
+
+#endif // ENDPOINT_SOCKETHANDOFF_HPP
@@ -0,0 +1,483 @@
+#include "SpectatorRelay.hpp"
+
+#include <algorithm>
+#include <cstring> // std::memcpy, std::memmove
+#include <string_view>
+
+#include <boost/asio/bind_executor.hpp>
+#include <boost/asio/connect.hpp>
+#include <boost/asio/dispatch.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/write.hpp>
+#include <spdlog/spdlog.h>
+
+#include "Reactors.hpp"
+#include "../I18N.hpp"
+#include "../STOCMsgFactory.hpp"
+#include "../Workaround.hpp"
+#include "../YGOPro/Config.hpp"
+#include "../YGOPro/StringUtils.hpp"
+
+namespace Ignis::Multirole::Endpoint
+{
+
+namespace
+{
+
+constexpr std::size_t MAX_WRITE_BATCH_MSGS = 64U;
+constexpr std::size_t MAX_WRITE_BATCH_BYTES = 64U * 1024U;
+constexpr std::size_t STOC_HEADER_LENGTH =
+	sizeof(YGOPro::STOCMsg::LengthType) + sizeof(YGOPro::STOCMsg::MsgType);
+
+template<typename T>
+void AppendCTOSMsg(std::vector<uint8_t>& out, YGOPro::CTOSMsg::MsgType type, const T& msg)
+{
+	const auto length = static_cast<YGOPro::CTOSMsg::LengthType>(sizeof(type) + sizeof(T));
+	const std::size_t offset = out.size();
+	out.resize(offset + sizeof(length) + sizeof(type) + sizeof(T));
+	uint8_t* ptr = out.data() + offset;
+	std::memcpy(ptr, &length, sizeof(length));
+	std::memcpy(ptr + sizeof(length), &type, sizeof(type));
+	std::memcpy(ptr + sizeof(length) + sizeof(type), &msg, sizeof(T));
+}
+
+constexpr bool SameVersion(
+	const YGOPro::ClientVersion& v1,
+	const YGOPro::ClientVersion& v2)
+{
+	return v1.client.major == v2.client.major &&
+		v1.client.minor == v2.client.minor &&
+		v1.core.major == v2.core.major &&
+		v1.core.minor == v2.core.minor;
+}
+
+} // namespace
+
+// public
+
+SpectatorRelay::SpectatorRelay(
+	boost::asio::io_context& ioCtx,
+	unsigned short port,
+	Origin origin,
+	Room::Client::SendLimits limits)
+	:
+	ioCtx(ioCtx),
+	acceptor(MakeAcceptor(ioCtx, port, false)),
+	origin(std::move(origin)),
+	limits(limits)
+{
+	DoAccept();
+}
+
+void SpectatorRelay::Stop()
+{
+	acceptor.close();
+	std::scoped_lock lock(mUpstreams);
+	for(auto& kv : upstreams)
+	{
+		if(auto u = kv.second.lock(); u)
+			boost::asio::post(u->GetStrand(), [u](){u->Close();});
+	}
+}
+
+// private
+
+std::shared_ptr<SpectatorRelay::Upstream> SpectatorRelay::GetUpstream(uint32_t id)
+{
+	std::scoped_lock lock(mUpstreams);
+	auto& w = upstreams[id];
+	if(auto u = w.lock(); u && !u->Closed())
+		return u;
+	auto u = std::make_shared<Upstream>(*this, id);
+	w = u;
+	u->Start();
+	return u;
+}
+
+void SpectatorRelay::Forget(uint32_t id, const Upstream& u)
+{
+	std::scoped_lock lock(mUpstreams);
+	// NOTE: The room might have been subscribed to again already.
+	if(auto it = upstreams.find(id); it != upstreams.end())
+	{
+		if(auto current = it->second.lock(); !current || current.get() == &u)
+			upstreams.erase(it);
+	}
+}
+
+void SpectatorRelay::DoAccept()
+{
+	acceptor.async_accept(
+	[this](const boost::system::error_code& ec, boost::asio::ip::tcp::socket socket)
+	{
+		if(!acceptor.is_open())
+			return;
+		if(!ec)
+		{
+			Workaround::SetCloseOnExec(socket.native_handle());
+			std::make_shared<Viewer>(*this, std::move(socket))->Start();
+		}
+		DoAccept();
+	});
+}
+
+// Upstream
+
+SpectatorRelay::Upstream::Upstream(SpectatorRelay& relay, uint32_t id)
+	:
+	relay(relay),
+	id(id),
+	strand(relay.ioCtx.get_executor()),
+	resolver(strand),
+	socket(strand),
+	incoming(STOC_HEADER_LENGTH + YGOPro::STOCMsg::MAX_PAYLOAD_SIZE),
+	received(0U),
+	closed(false)
+{
+	using namespace YGOPro;
+	CTOSMsg::PlayerInfo pi{};
+	UTF8ToUTF16("Relay", pi.name);
+	AppendCTOSMsg(subscription, CTOSMsg::MsgType::PLAYER_INFO, pi);
+	CTOSMsg::RelaySubscribe rs{};
+	rs.id = id;
+	std::memcpy(rs.token, relay.origin.token.data(),
+		std::min(relay.origin.token.size(), sizeof(rs.token)));
+	AppendCTOSMsg(subscription, CTOSMsg::MsgType::RELAY_SUBSCRIBE, rs);
+}
+
+void SpectatorRelay::Upstream::Start()
+{
+	auto self(shared_from_this());
+	const auto& o = relay.origin;
+	resolver.async_resolve(o.host, std::to_string(o.port), boost::asio::bind_executor(strand,
+	[this, self](boost::system::error_code ec, boost::asio::ip::tcp::resolver::results_type results)
+	{
+		if(ec)
+			return Fail(ec);
+		boost::asio::async_connect(socket, results, boost::asio::bind_executor(strand,
+		[this, self](boost::system::error_code ec, const boost::asio::ip::tcp::endpoint& /*unused*/)
+		{
+			if(ec)
+				return Fail(ec);
+			Workaround::SetCloseOnExec(socket.native_handle());
+			boost::asio::async_write(socket, boost::asio::buffer(subscription), boost::asio::bind_executor(strand,
+			[this, self](boost::system::error_code ec, std::size_t /*unused*/)
+			{
+				if(ec)
+					return Fail(ec);
+				DoRead();
+			}));
+		}));
+	}));
+}
+
+void SpectatorRelay::Upstream::Add(const std::shared_ptr<Viewer>& v)
+{
+	if(closed)
+	{
+		v->Disconnect();
+		return;
+	}
+	viewers.insert(v);
+	v->CatchUp(kept);
+}
+
+void SpectatorRelay::Upstream::Remove(const std::shared_ptr<Viewer>& v)
+{
+	if(viewers.erase(v) != 0U && viewers.empty())
+		Close();
+}
+
+void SpectatorRelay::Upstream::Close()
+{
+	if(closed.exchange(true))
+		return;
+	boost::system::error_code ignore;
+	resolver.cancel();
+	socket.close(ignore);
+	for(const auto& v : viewers)
+		v->Disconnect();
+	viewers.clear();
+	relay.Forget(id, *this);
+}
+
+bool SpectatorRelay::Upstream::Closed() const
+{
+	return closed;
+}
+
+SpectatorRelay::Strand& SpectatorRelay::Upstream::GetStrand()
+{
+	return strand;
+}
+
+void SpectatorRelay::Upstream::DoRead()
+{
+	auto self(shared_from_this());
+	auto buffer = boost::asio::buffer(incoming.data() + received, incoming.size() - received);
+	socket.async_read_some(buffer, boost::asio::bind_executor(strand,
+	[this, self](boost::system::error_code ec, std::size_t bytesRead)
+	{
+		if(ec)
+			return Fail(ec);
+		received += bytesRead;
+		std::size_t consumed = 0U;
+		while(!closed && received - consumed >= STOC_HEADER_LENGTH)
+		{
+			const uint8_t* ptr = incoming.data() + consumed;
+			YGOPro::STOCMsg::LengthType length{};
+			std::memcpy(&length, ptr, sizeof(length));
+			if(length == 0U)
+				return Close();
+			if(received - consumed < sizeof(length) + length)
+				break;
+			YGOPro::STOCMsg::MsgType type{};
+			std::memcpy(&type, ptr + sizeof(length), sizeof(type));
+			Handle(YGOPro::STOCMsg(type, ptr + STOC_HEADER_LENGTH, length - sizeof(type)));
+			consumed += sizeof(length) + length;
+		}
+		if(closed)
+			return;
+		std::memmove(incoming.data(), incoming.data() + consumed, received - consumed);
+		received -= consumed;
+		DoRead();
+	}));
+}
+
+void SpectatorRelay::Upstream::Handle(YGOPro::STOCMsg msg)
+{
+	using MsgType = YGOPro::STOCMsg::MsgType;
+	if(static_cast<MsgType>(msg.Data()[2U]) == MsgType::RELAY_SNAPSHOT)
+	{
+		// Viewers already got everything the snapshot is made of, it is
+		// only kept for those that come later.
+		if(msg.Length() > STOC_HEADER_LENGTH && msg.Data()[STOC_HEADER_LENGTH] != 0U)
+		{
+			snapshot.emplace();
+		}
+		else if(snapshot)
+		{
+			kept = std::move(*snapshot);
+			snapshot.reset();
+		}
+		return;
+	}
+	if(snapshot)
+	{
+		snapshot->push_back(std::move(msg));
+		return;
+	}
+	kept.push_back(msg);
+	bool dropped = false;
+	for(auto it = viewers.begin(); it != viewers.end();)
+	{
+		if((*it)->Send(msg))
+			++it;
+		else
+			it = viewers.erase(it), dropped = true;
+	}
+	if(dropped && viewers.empty())
+		Close();
+}
+
+void SpectatorRelay::Upstream::Fail(const boost::system::error_code& ec)
+{
+	if(ec != boost::asio::error::operation_aborted && ec != boost::asio::error::eof)
+		spdlog::warn(I18N::SPECTATOR_RELAY_UPSTREAM_ERROR, id, ec.message());
+	Close();
+}
+
+// Viewer
+
+SpectatorRelay::Viewer::Viewer(SpectatorRelay& relay, boost::asio::ip::tcp::socket socket)
+	:
+	relay(relay),
+	socket(std::move(socket)),
+	strand(this->socket.get_executor()),
+	outgoingBytes(0U),
+	catchUpMsgs(0U),
+	catchUpBytes(0U),
+	writing(false),
+	disconnecting(false)
+{}
+
+void SpectatorRelay::Viewer::Start()
+{
+	auto self(shared_from_this());
+	boost::asio::dispatch(strand, [this, self]()
+	{
+		DoRead();
+	});
+}
+
+void SpectatorRelay::Viewer::CatchUp(const std::deque<YGOPro::STOCMsg>& msgs)
+{
+	for(const auto& msg : msgs)
+	{
+		outgoing.push_back(msg);
+		outgoingBytes += msg.Length();
+		catchUpBytes += msg.Length();
+	}
+	catchUpMsgs += msgs.size();
+	if(!writing && !outgoing.empty())
+		DoWrite();
+}
+
+bool SpectatorRelay::Viewer::Send(const YGOPro::STOCMsg& msg)
+{
+	if(disconnecting)
+		return true;
+	const auto& limits = relay.limits;
+	const std::size_t msgs = outgoing.size() - catchUpMsgs + 1U;
+	const std::size_t bytes = outgoingBytes - catchUpBytes + msg.Length();
+	if((limits.maxMsgs != 0U && msgs > limits.maxMsgs) ||
+	   (limits.maxBytes != 0U && bytes > limits.maxBytes))
+	{
+		boost::system::error_code ignore;
+		socket.close(ignore);
+		disconnecting = true;
+		return false;
+	}
+	outgoing.push_back(msg);
+	outgoingBytes += msg.Length();
+	if(!writing)
+		DoWrite();
+	return true;
+}
+
+void SpectatorRelay::Viewer::Disconnect()
+{
+	disconnecting = true;
+	if(!writing)
+		Shutdown();
+}
+
+SpectatorRelay::Strand& SpectatorRelay::Viewer::GetStrand()
+{
+	return upstream ? upstream->GetStrand() : strand;
+}
+
+void SpectatorRelay::Viewer::DoRead()
+{
+	using Result = YGOPro::CTOSMsgReader::Result;
+	for(Result r; (r = reader.Next(incoming)) != Result::INCOMPLETE;)
+	{
+		if(r == Result::INVALID || !HandleMsg())
+			return;
+		if(upstream || disconnecting)
+			return;
+	}
+	const auto [data, size] = reader.WritableArea();
+	auto self(shared_from_this());
+	socket.async_read_some(boost::asio::buffer(data, size), boost::asio::bind_executor(strand,
+	[this, self](boost::system::error_code ec, std::size_t bytesRead)
+	{
+		if(ec)
+			return;
+		reader.Commit(bytesRead);
+		DoRead();
+	}));
+}
+
+void SpectatorRelay::Viewer::DoReadEnd()
+{
+	auto self(shared_from_this());
+	auto buffer = boost::asio::buffer(incoming.Data(), YGOPro::CTOSMsg::MSG_MAX_LENGTH);
+	socket.async_read_some(buffer, boost::asio::bind_executor(GetStrand(),
+	[this, self](boost::system::error_code ec, std::size_t /*unused*/)
+	{
+		if(!ec)
+			return DoReadEnd();
+		if(upstream)
+			upstream->Remove(self);
+	}));
+}
+
+void SpectatorRelay::Viewer::DoWrite()
+{
+	writing = true;
+	writeBuffers.clear();
+	std::size_t bytes = 0U;
+	for(const auto& msg : outgoing)
+	{
+		if(writeBuffers.size() == MAX_WRITE_BATCH_MSGS ||
+		   (!writeBuffers.empty() && bytes + msg.Length() > MAX_WRITE_BATCH_BYTES))
+			break;
+		writeBuffers.emplace_back(msg.Data(), msg.Length());
+		bytes += msg.Length();
+	}
+	auto self(shared_from_this());
+	boost::asio::async_write(socket, writeBuffers, boost::asio::bind_executor(GetStrand(),
+	[this, self](boost::system::error_code ec, std::size_t /*unused*/)
+	{
+		writing = false;
+		if(ec)
+		{
+			if(upstream)
+				upstream->Remove(self);
+			return;
+		}
+		for(std::size_t i = writeBuffers.size(); i != 0U; i--)
+		{
+			const std::size_t length = outgoing.front().Length();
+			outgoingBytes -= length;
+			if(catchUpMsgs != 0U)
+			{
+				catchUpMsgs--;
+				catchUpBytes -= length;
+			}
+			outgoing.pop_front();
+		}
+		if(!outgoing.empty())
+			DoWrite();
+		else if(disconnecting)
+			Shutdown();
+	}));
+}
+
+void SpectatorRelay::Viewer::Shutdown()
+{
+	boost::system::error_code ignore;
+	socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignore);
+}
+
+bool SpectatorRelay::Viewer::HandleMsg()
+{
+	switch(incoming.GetType())
+	{
+	case YGOPro::CTOSMsg::MsgType::PLAYER_INFO:
+	{
+		return incoming.GetPlayerInfo().has_value();
+	}
+	case YGOPro::CTOSMsg::MsgType::JOIN_GAME:
+	{
+		auto p = incoming.GetJoinGame();
+		if(!p)
+			return false;
+		if(!SameVersion(p->version, YGOPro::SERVER_VERSION))
+		{
+			outgoing.push_back(STOCMsgFactory::MakeVersionError(YGOPro::SERVER_VERSION));
+			outgoingBytes += outgoing.back().Length();
+			disconnecting = true;
+			DoWrite();
+			return true;
+		}
+		// From now on everything is done from the strand of the upstream.
+		auto u = relay.GetUpstream(p->id);
+		auto self(shared_from_this());
+		boost::asio::dispatch(u->GetStrand(), [this, self, u]()
+		{
+			upstream = u;
+			upstream->Add(self);
+			DoReadEnd();
+		});
+		return true;
+	}
+	default:
+	{
+		return false;
+	}
+	}
+}
+
+} // namespace Ignis::Multirole::Endpoint
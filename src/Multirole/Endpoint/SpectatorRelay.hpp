@@ -0,0 +1,148 @@
+#ifndef ENDPOINT_SPECTATORRELAY_HPP
+#define ENDPOINT_SPECTATORRELAY_HPP
+#include <atomic>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/strand.hpp>
+
+#include "../Room/Client.hpp"
+#include "../YGOPro/CTOSMsg.hpp"
+#include "../YGOPro/CTOSMsgReader.hpp"
+#include "../YGOPro/STOCMsg.hpp"
+
+namespace Ignis::Multirole::Endpoint
+{
+
+// Serves spectators of the public rooms of another instance (the origin),
+// so that big audiences don't have to be served by the instance running
+// the duel. Spectators join the same way they would on the origin, and
+// the relay subscribes once to each room they ask for, keeping the last
+// snapshot the origin sent of the room plus everything sent after it,
+// which is what spectators that join later get first.
+class SpectatorRelay final
+{
+public:
+	struct Origin
+	{
+		std::string host;
+		unsigned short port;
+		std::string token; // See RoomHosting.
+	};
+
+	// Spectators that go past `limits` are disconnected.
+	SpectatorRelay(
+		boost::asio::io_context& ioCtx,
+		unsigned short port,
+		Origin origin,
+		Room::Client::SendLimits limits);
+	void Stop();
+private:
+	using Strand = boost::asio::strand<boost::asio::ip::tcp::socket::executor_type>;
+
+	class Viewer;
+
+	// Subscription to a single room of the origin along with the viewers
+	// it serves, all of which is handled on its strand. Closes once the
+	// origin closes it or there's no one left watching.
+	class Upstream final : public std::enable_shared_from_this<Upstream>
+	{
+	public:
+		Upstream(SpectatorRelay& relay, uint32_t id);
+		void Start();
+
+		// Sends everything kept to the viewer and then whatever comes next.
+		// These and Close are only called from the strand.
+		void Add(const std::shared_ptr<Viewer>& v);
+		void Remove(const std::shared_ptr<Viewer>& v);
+		void Close();
+
+		bool Closed() const;
+		Strand& GetStrand();
+	private:
+		SpectatorRelay& relay;
+		const uint32_t id;
+		Strand strand;
+		boost::asio::ip::tcp::resolver resolver;
+		boost::asio::ip::tcp::socket socket;
+		std::vector<uint8_t> subscription;
+		std::vector<uint8_t> incoming;
+		std::size_t received;
+		std::deque<YGOPro::STOCMsg> kept;
+		std::optional<std::deque<YGOPro::STOCMsg>> snapshot; // Being received.
+		std::set<std::shared_ptr<Viewer>> viewers;
+		std::atomic<bool> closed;
+
+		void DoRead();
+		void Handle(YGOPro::STOCMsg msg);
+		void Fail(const boost::system::error_code& ec);
+	};
+
+	// Spectator connected to the relay, handed over to the upstream of the
+	// room it joins, from whose strand it is served from then on.
+	class Viewer final : public std::enable_shared_from_this<Viewer>
+	{
+	public:
+		Viewer(SpectatorRelay& relay, boost::asio::ip::tcp::socket socket);
+		void Start();
+
+		// Queues what was kept by the upstream, which doesn't count towards
+		// the limits, as it is bounded by the origin's snapshots anyway.
+		void CatchUp(const std::deque<YGOPro::STOCMsg>& msgs);
+
+		// Returns false if the viewer went past the limits, in which case
+		// it is closed.
+		bool Send(const YGOPro::STOCMsg& msg);
+
+		// Disconnects once everything queued is written.
+		void Disconnect();
+	private:
+		SpectatorRelay& relay;
+		boost::asio::ip::tcp::socket socket;
+		Strand strand; // Used until handed to `upstream`.
+		YGOPro::CTOSMsgReader reader;
+		YGOPro::CTOSMsg incoming;
+		std::shared_ptr<Upstream> upstream;
+		std::deque<YGOPro::STOCMsg> outgoing;
+		std::size_t outgoingBytes;
+		std::size_t catchUpMsgs; // Front of `outgoing` queued by CatchUp.
+		std::size_t catchUpBytes;
+		std::vector<boost::asio::const_buffer> writeBuffers;
+		bool writing;
+		bool disconnecting;
+
+		Strand& GetStrand();
+		void DoRead();
+		void DoReadEnd();
+		void DoWrite();
+		void Shutdown();
+
+		// Returns false if the connection should be dropped.
+		bool HandleMsg();
+	};
+
+	boost::asio::io_context& ioCtx;
+	boost::asio::ip::tcp::acceptor acceptor;
+	const Origin origin;
+	const Room::Client::SendLimits limits;
+	std::map<uint32_t, std::weak_ptr<Upstream>> upstreams;
+	std::mutex mUpstreams;
+
+	// Returns the upstream of the room, subscribing to it if needed.
+	std::shared_ptr<Upstream> GetUpstream(uint32_t id);
+	void Forget(uint32_t id, const Upstream& u);
+
+	void DoAccept();
+};
+
+} // namespace Ignis::Multirole::Endpoint
+
+#endif // ENDPOINT_SPECTATORRELAY_HPP
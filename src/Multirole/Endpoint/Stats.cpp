@@ -0,0 +1,367 @@
+#include "Stats.hpp"
+
+#include <charconv>
+#include <iterator>
+#include <string_view>
+#include <type_traits>
+#include <variant>
+
+#include <boost/asio/write.hpp>
+#include <boost/json.hpp>
+#include <fmt/format.h>
+
+#include "../Lobby.hpp"
+#include "../Workaround.hpp"
+#include "../Core/HornetStats.hpp"
+#include "../Room/State.hpp"
+#include "../Room/Stats.hpp"
+#include "../Room/Trace.hpp"
+#include "../../HornetCommon.hpp"
+
+namespace Ignis::Multirole::Endpoint
+{
+
+// Names of the alternatives of Room::StateVariant, in the same order.
+constexpr std::array<std::string_view, 7U> STATE_NAMES =
+{
+	"ChoosingTurn",
+	"Closing",
+	"Dueling",
+	"Rematching",
+	"RockPaperScissor",
+	"Sidedecking",
+	"Waiting",
+};
+static_assert(STATE_NAMES.size() == std::variant_size_v<Room::StateVariant>);
+static_assert(STATE_NAMES.size() <= Room::Stats::STATE_COUNT);
+constexpr std::size_t DUELING_STATE_INDEX = 2U;
+static_assert(std::is_same_v<std::variant_alternative_t<DUELING_STATE_INDEX, Room::StateVariant>, Room::State::Dueling>);
+
+constexpr const char* HTTP_HEADER_FORMAT_STRING =
+"HTTP/1.0 200 OK\r\n"
+"Content-Length: {:d}\r\n"
+"Content-Type: {:s}\r\n\r\n";
+
+constexpr std::string_view HTTP_FORBIDDEN =
+"HTTP/1.0 403 Forbidden\r\n"
+"Content-Length: 0\r\n\r\n";
+
+constexpr std::string_view HTTP_NOT_FOUND =
+"HTTP/1.0 404 Not Found\r\n"
+"Content-Length: 0\r\n\r\n";
+
+inline boost::json::object SerializeHistogram(const Core::HornetStats::Histogram& h)
+{
+	boost::json::object o;
+	o.emplace("count", h.Count());
+	o.emplace("sum", h.Sum());
+	auto& ar = o.emplace("buckets", boost::json::array()).first->value().as_array();
+	for(const auto b : h.Buckets())
+		ar.emplace_back(b);
+	return o;
+}
+
+inline std::string SerializeStats()
+{
+	using Core::HornetStats;
+	const auto& stats = HornetStats::Get();
+	boost::json::object j;
+	auto& hornet = j.emplace("hornet", boost::json::object()).first->value().as_object();
+	for(std::size_t i = 0U; i < HornetStats::ACTION_COUNT; i++)
+	{
+		const auto act = static_cast<Hornet::Action>(i);
+		const auto name = HornetStats::ActionName(act);
+		const auto& as = stats.Of(act);
+		if(name.empty() || (as.latencyUs.Count() == 0U && as.serveUs.Count() == 0U))
+			continue;
+		auto& a = hornet.emplace(name, boost::json::object()).first->value().as_object();
+		if(as.latencyUs.Count() != 0U)
+		{
+			a.emplace("latency_us", SerializeHistogram(as.latencyUs));
+			a.emplace("callbacks", SerializeHistogram(as.callbacks));
+		}
+		if(as.serveUs.Count() != 0U)
+			a.emplace("serve_us", SerializeHistogram(as.serveUs));
+	}
+	const auto& rstats = Room::Stats::Get();
+	auto& rooms = j.emplace("rooms", boost::json::object()).first->value().as_object();
+	rooms.emplace("process_slice_us", SerializeHistogram(rstats.SliceUs()));
+	rooms.emplace("process_core_us", rstats.SliceCoreUs());
+	rooms.emplace("process_yields", rstats.Yields());
+	rooms.emplace("process_yields_per_duel", SerializeHistogram(rstats.YieldsPerDuel()));
+	rooms.emplace("replays_queued", rstats.ReplaysQueued());
+	rooms.emplace("replays_dropped", rstats.ReplaysDropped());
+	auto& states = rooms.emplace("by_state", boost::json::object()).first->value().as_object();
+	for(std::size_t i = 0U; i < STATE_NAMES.size(); i++)
+		states.emplace(STATE_NAMES[i], rstats.RoomsInState(i));
+	rooms.emplace("send_queue_msgs", SerializeHistogram(rstats.SendQueueMsgs()));
+	rooms.emplace("send_queue_bytes", SerializeHistogram(rstats.SendQueueBytes()));
+	auto& memory = rooms.emplace("memory", boost::json::object()).first->value().as_object();
+	memory.emplace("bytes", rstats.RoomMemory());
+	memory.emplace("duel_peak_bytes", SerializeHistogram(rstats.DuelMemoryPeak()));
+	memory.emplace("compactions", rstats.MemoryCompactions());
+	memory.emplace("spectators_dropped", rstats.MemorySpectatorsDropped());
+	memory.emplace("duels_ended", rstats.MemoryDuelsEnded());
+	rooms.emplace("idle_closed", rstats.IdleClosed());
+	j.emplace("hornet_processes", stats.Processes());
+	if(const auto threads = rstats.RoomThreads(); threads != 0)
+	{
+		auto& pool = j.emplace("room_threads", boost::json::object()).first->value().as_object();
+		pool.emplace("threads", threads);
+		pool.emplace("busy_percent", rstats.RoomThreadsBusyPercent());
+		pool.emplace("blocked_percent", rstats.RoomThreadsBlockedPercent());
+		pool.emplace("resizes", rstats.RoomThreadsResizes());
+	}
+	auto& hosting = j.emplace("room_hosting", boost::json::object()).first->value().as_object();
+	hosting.emplace("admitted", rstats.Admitted());
+	hosting.emplace("rejected", rstats.Rejected());
+	hosting.emplace("joined", rstats.Joined());
+	hosting.emplace("handshake_errors", rstats.HandshakeErrors());
+	auto& reloads = j.emplace("reload_ms", boost::json::object()).first->value().as_object();
+	for(const auto& [path, h] : rstats.ReloadMs())
+		reloads.emplace(path, SerializeHistogram(*h));
+	const std::string strJ = boost::json::serialize(j);
+	return fmt::format(HTTP_HEADER_FORMAT_STRING, strJ.size(), "application/json") + strJ;
+}
+
+// Writes a histogram in the Prometheus text format, `labels` being either
+// empty or a comma-terminated list of extra labels.
+inline void WriteHistogram(
+	std::string& out,
+	std::string_view name,
+	std::string_view labels,
+	const Core::HornetStats::Histogram& h)
+{
+	const auto buckets = h.Buckets();
+	uint64_t cumulative = 0U;
+	for(std::size_t i = 0U; i < buckets.size(); i++)
+	{
+		cumulative += buckets[i];
+		// Values are integers, so bucket N holds the ones up to 2^(N+1)-1.
+		if(i + 1U == buckets.size())
+			fmt::format_to(std::back_inserter(out), "{}_bucket{{{}le=\"+Inf\"}} {}\n", name, labels, cumulative);
+		else
+			fmt::format_to(std::back_inserter(out), "{}_bucket{{{}le=\"{}\"}} {}\n", name, labels, (uint64_t{2U} << i) - 1U, cumulative);
+	}
+	const auto bare = labels.empty() ? std::string() : fmt::format("{{{}}}", labels.substr(0U, labels.size() - 1U));
+	fmt::format_to(std::back_inserter(out), "{}_sum{} {}\n", name, bare, h.Sum());
+	fmt::format_to(std::back_inserter(out), "{}_count{} {}\n", name, bare, h.Count());
+}
+
+inline void WriteType(std::string& out, std::string_view name, std::string_view type)
+{
+	fmt::format_to(std::back_inserter(out), "# TYPE {} {}\n", name, type);
+}
+
+template<typename T>
+inline void WriteSingle(std::string& out, std::string_view name, std::string_view type, T value)
+{
+	WriteType(out, name, type);
+	fmt::format_to(std::back_inserter(out), "{} {}\n", name, value);
+}
+
+// Same statistics as SerializeStats, in the Prometheus text format.
+inline std::string SerializeMetrics()
+{
+	using Core::HornetStats;
+	const auto& stats = HornetStats::Get();
+	const auto& rstats = Room::Stats::Get();
+	std::string out;
+	WriteType(out, "multirole_rooms", "gauge");
+	for(std::size_t i = 0U; i < STATE_NAMES.size(); i++)
+		fmt::format_to(std::back_inserter(out), "multirole_rooms{{state=\"{}\"}} {}\n", STATE_NAMES[i], rstats.RoomsInState(i));
+	WriteSingle(out, "multirole_duels_active", "gauge", rstats.RoomsInState(DUELING_STATE_INDEX));
+	WriteSingle(out, "multirole_hornet_processes", "gauge", stats.Processes());
+	struct
+	{
+		const char* name;
+		const HornetStats::Histogram HornetStats::ActionStats::*h;
+	} constexpr HORNET_HISTOGRAMS[] =
+	{
+		{"multirole_hornet_call_latency_us", &HornetStats::ActionStats::latencyUs},
+		{"multirole_hornet_call_callbacks", &HornetStats::ActionStats::callbacks},
+		{"multirole_hornet_callback_serve_us", &HornetStats::ActionStats::serveUs},
+	};
+	for(const auto& hh : HORNET_HISTOGRAMS)
+	{
+		WriteType(out, hh.name, "histogram");
+		for(std::size_t i = 0U; i < HornetStats::ACTION_COUNT; i++)
+		{
+			const auto act = static_cast<Hornet::Action>(i);
+			const auto name = HornetStats::ActionName(act);
+			const auto& h = stats.Of(act).*hh.h;
+			if(name.empty() || h.Count() == 0U)
+				continue;
+			WriteHistogram(out, hh.name, fmt::format("action=\"{}\",", name), h);
+		}
+	}
+	WriteType(out, "multirole_process_slice_us", "histogram");
+	WriteHistogram(out, "multirole_process_slice_us", {}, rstats.SliceUs());
+	WriteSingle(out, "multirole_process_core_us_total", "counter", rstats.SliceCoreUs());
+	WriteSingle(out, "multirole_process_yields_total", "counter", rstats.Yields());
+	WriteType(out, "multirole_process_yields_per_duel", "histogram");
+	WriteHistogram(out, "multirole_process_yields_per_duel", {}, rstats.YieldsPerDuel());
+	WriteType(out, "multirole_client_send_queue_msgs", "histogram");
+	WriteHistogram(out, "multirole_client_send_queue_msgs", {}, rstats.SendQueueMsgs());
+	WriteType(out, "multirole_client_send_queue_bytes", "histogram");
+	WriteHistogram(out, "multirole_client_send_queue_bytes", {}, rstats.SendQueueBytes());
+	WriteSingle(out, "multirole_rooms_idle_closed_total", "counter", rstats.IdleClosed());
+	WriteSingle(out, "multirole_room_memory_bytes", "gauge", rstats.RoomMemory());
+	WriteType(out, "multirole_duel_memory_peak_bytes", "histogram");
+	WriteHistogram(out, "multirole_duel_memory_peak_bytes", {}, rstats.DuelMemoryPeak());
+	WriteType(out, "multirole_room_memory_actions_total", "counter");
+	fmt::format_to(std::back_inserter(out), "multirole_room_memory_actions_total{{action=\"compact\"}} {}\n", rstats.MemoryCompactions());
+	fmt::format_to(std::back_inserter(out), "multirole_room_memory_actions_total{{action=\"drop_spectator\"}} {}\n", rstats.MemorySpectatorsDropped());
+	fmt::format_to(std::back_inserter(out), "multirole_room_memory_actions_total{{action=\"end_duel\"}} {}\n", rstats.MemoryDuelsEnded());
+	WriteType(out, "multirole_connections_total", "counter");
+	fmt::format_to(std::back_inserter(out), "multirole_connections_total{{result=\"admitted\"}} {}\n", rstats.Admitted());
+	fmt::format_to(std::back_inserter(out), "multirole_connections_total{{result=\"rejected\"}} {}\n", rstats.Rejected());
+	WriteType(out, "multirole_handshakes_total", "counter");
+	fmt::format_to(std::back_inserter(out), "multirole_handshakes_total{{result=\"joined\"}} {}\n", rstats.Joined());
+	fmt::format_to(std::back_inserter(out), "multirole_handshakes_total{{result=\"error\"}} {}\n", rstats.HandshakeErrors());
+	if(const auto threads = rstats.RoomThreads(); threads != 0)
+	{
+		WriteSingle(out, "multirole_room_threads", "gauge", threads);
+		WriteSingle(out, "multirole_room_threads_busy_percent", "gauge", rstats.RoomThreadsBusyPercent());
+		WriteSingle(out, "multirole_room_threads_blocked_percent", "gauge", rstats.RoomThreadsBlockedPercent());
+		WriteSingle(out, "multirole_room_threads_resizes_total", "counter", rstats.RoomThreadsResizes());
+	}
+	WriteSingle(out, "multirole_replays_queued", "gauge", rstats.ReplaysQueued());
+	WriteSingle(out, "multirole_replays_dropped_total", "counter", rstats.ReplaysDropped());
+	WriteType(out, "multirole_reload_ms", "histogram");
+	for(const auto& [path, h] : rstats.ReloadMs())
+		WriteHistogram(out, "multirole_reload_ms", fmt::format("repo=\"{}\",", path), *h);
+	return fmt::format(HTTP_HEADER_FORMAT_STRING, out.size(), "text/plain; version=0.0.4") + out;
+}
+
+// Whether or not `addr` is a loopback address, also if v4-mapped.
+inline bool IsLoopback(const boost::asio::ip::address& addr)
+{
+	using namespace boost::asio::ip;
+	if(addr.is_v6() && addr.to_v6().is_v4_mapped())
+		return make_address_v4(v4_mapped, addr.to_v6()).is_loopback();
+	return addr.is_loopback();
+}
+
+// Whether or not the peer of `socket` is on this same host.
+inline bool IsLocalPeer(const boost::asio::ip::tcp::socket& socket)
+{
+	boost::system::error_code ec;
+	const auto endpoint = socket.remote_endpoint(ec);
+	return !ec && IsLoopback(endpoint.address());
+}
+
+// Handles a request to trace the next duel of a room, its ID being what
+// follows the request path, up to the first non-digit. Only taken from
+// peers on this same host, as traces are written onto its disk.
+inline std::string SerializeTraceRequest(const Lobby& lobby, const boost::asio::ip::tcp::socket& socket, std::string_view idStr)
+{
+	if(!IsLocalPeer(socket))
+		return std::string(HTTP_FORBIDDEN);
+	uint32_t roomId{};
+	if(std::from_chars(idStr.data(), idStr.data() + idStr.size(), roomId).ec != std::errc{} ||
+	   !lobby.GetRoomById(roomId))
+		return std::string(HTTP_NOT_FOUND);
+	const std::string out = Room::DuelTrace::Request(roomId) ?
+		fmt::format("Tracing next duel of room {}\n", roomId) :
+		"Tracing is not built in\n";
+	return fmt::format(HTTP_HEADER_FORMAT_STRING, out.size(), "text/plain") + out;
+}
+
+// Handles a request to read the tuning again, only taken from peers on
+// this same host as it changes how the node runs.
+inline std::string SerializeReloadRequest(const Stats::ReloadHook& reload, const boost::asio::ip::tcp::socket& socket)
+{
+	if(!IsLocalPeer(socket))
+		return std::string(HTTP_FORBIDDEN);
+	const std::string out = reload() ?
+		"Tuning reloaded\n" :
+		"Tuning not reloaded, see the log\n";
+	return fmt::format(HTTP_HEADER_FORMAT_STRING, out.size(), "text/plain") + out;
+}
+
+// public
+
+Stats::Stats(boost::asio::io_context& ioCtx, unsigned short port, const Lobby& lobby, ReloadHook reload) :
+	acceptor(ioCtx, boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v6(), port)),
+	lobby(lobby),
+	reload(std::move(reload))
+{
+	Workaround::SetCloseOnExec(acceptor.native_handle());
+	DoAccept();
+}
+
+void Stats::Stop()
+{
+	acceptor.close();
+}
+
+// private
+
+void Stats::DoAccept()
+{
+	acceptor.async_accept(
+	[this](const boost::system::error_code& ec, boost::asio::ip::tcp::socket socket)
+	{
+		if(!acceptor.is_open())
+			return;
+		if(!ec)
+		{
+			Workaround::SetCloseOnExec(socket.native_handle());
+			std::make_shared<Connection>(lobby, reload, std::move(socket))->DoRead();
+		}
+		DoAccept();
+	});
+}
+
+Stats::Connection::Connection(const Lobby& lobby, const ReloadHook& reload, boost::asio::ip::tcp::socket socket) :
+	lobby(lobby),
+	reload(reload),
+	socket(std::move(socket)),
+	incoming(),
+	writeCalled(false)
+{}
+
+void Stats::Connection::DoRead()
+{
+	auto self(shared_from_this());
+	socket.async_read_some(boost::asio::buffer(incoming),
+	[this, self](boost::system::error_code ec, std::size_t bytesRead)
+	{
+		if(ec)
+			return;
+		if(!writeCalled)
+		{
+			writeCalled = true;
+			// Anything but a request for the metrics, for tracing a room
+			// or for reloading the tuning (both POSTs) gets the JSON.
+			constexpr std::string_view METRICS_REQUEST = "GET /metrics";
+			constexpr std::string_view TRACE_REQUEST = "POST /trace/";
+			constexpr std::string_view RELOAD_REQUEST = "POST /reload";
+			const std::string_view request(incoming.data(), bytesRead);
+			if(request.substr(0U, METRICS_REQUEST.size()) == METRICS_REQUEST)
+				outgoing = SerializeMetrics();
+			else if(request.substr(0U, TRACE_REQUEST.size()) == TRACE_REQUEST)
+				outgoing = SerializeTraceRequest(lobby, socket, request.substr(TRACE_REQUEST.size()));
+			else if(request.substr(0U, RELOAD_REQUEST.size()) == RELOAD_REQUEST)
+				outgoing = SerializeReloadRequest(reload, socket);
+			else
+				outgoing = SerializeStats();
+			DoWrite();
+		}
+		DoRead();
+	});
+}
+
+void Stats::Connection::DoWrite()
+{
+	auto self(shared_from_this());
+	boost::asio::async_write(socket, boost::asio::buffer(outgoing),
+	[this, self](boost::system::error_code ec, std::size_t /*unused*/)
+	{
+		if(!ec)
+			socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+	});
+}
+
+} // namespace Ignis::Multirole::Endpoint
@@ -0,0 +1,60 @@
+#ifndef STATSENDPOINT_HPP
+#define STATSENDPOINT_HPP
+#include <array>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+
+namespace Ignis::Multirole
+{
+
+class Lobby;
+
+namespace Endpoint
+{
+
+// Serves process-wide statistics as JSON to anyone connecting, or in the
+// Prometheus text format to a request for /metrics. From this same host, a
+// POST to /trace/<room ID> has the next duel of that room traced instead,
+// and a POST to /reload has the tuning read again.
+class Stats final
+{
+public:
+	// Reads the tuning again and applies it, returns whether it could.
+	using ReloadHook = std::function<bool()>;
+
+	Stats(boost::asio::io_context& ioCtx, unsigned short port, const Lobby& lobby, ReloadHook reload);
+
+	void Stop();
+private:
+	class Connection final : public std::enable_shared_from_this<Connection>
+	{
+	public:
+		Connection(const Lobby& lobby, const ReloadHook& reload, boost::asio::ip::tcp::socket socket);
+		void DoRead();
+	private:
+		const Lobby& lobby;
+		const ReloadHook& reload;
+		boost::asio::ip::tcp::socket socket;
+		std::array<char, 256> incoming;
+		std::string outgoing;
+		bool writeCalled;
+
+		void DoWrite();
+	};
+
+	boost::asio::ip::tcp::acceptor acceptor;
+	const Lobby& lobby;
+	const ReloadHook reload;
+
+	void DoAccept();
+};
+
+} // namespace Endpoint
+
+} // namespace Ignis::Multirole
+
+#endif // STATSENDPOINT_HPP
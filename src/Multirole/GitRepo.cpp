@@ -1,11 +1,16 @@
 #include "GitRepo.hpp"
 
+#include <algorithm>
+#include <iterator>
+
+#include <boost/asio/post.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/json/value.hpp>
 #include <spdlog/spdlog.h>
 
 #include "I18N.hpp"
 #include "libgit2.hpp"
+#include "Room/Stats.hpp"
 
 namespace Ignis::Multirole
 {
@@ -18,6 +23,42 @@ int CredCb(git_cred** out, const char* /*unused*/, const char* /*unused*/, unsig
 	return git_cred_userpass_plaintext_new(out, cred.first.c_str(), cred.second.c_str());
 }
 
+std::chrono::milliseconds GetDebounce(const boost::json::value& opts)
+{
+	constexpr std::chrono::milliseconds DEFAULT_DEBOUNCE{1000};
+	if(const auto* const ms = opts.as_object().if_contains("webhookDebounceMs"); ms)
+		return std::chrono::milliseconds(ms->to_number<unsigned int>());
+	return DEFAULT_DEBOUNCE;
+}
+
+std::vector<std::string> GetPaths(const boost::json::value& opts)
+{
+	std::vector<std::string> paths;
+	if(const auto* const ps = opts.as_object().if_contains("paths"); ps)
+		for(const auto& p : ps->as_array())
+			paths.emplace_back(p.as_string().data());
+	return paths;
+}
+
+git_strarray MakeStrArray(const std::vector<char*>& strs)
+{
+	return git_strarray{const_cast<char**>(strs.data()), strs.size()};
+}
+
+void SetDepth([[maybe_unused]] git_fetch_options& opts, [[maybe_unused]] int depth)
+{
+#if LIBGIT2_VER_MAJOR > 1 || (LIBGIT2_VER_MAJOR == 1 && LIBGIT2_VER_MINOR >= 7)
+	opts.depth = depth;
+#endif
+}
+
+BlobId ToBlobId(const git_oid& oid)
+{
+	BlobId id;
+	std::copy(std::begin(oid.id), std::end(oid.id), id.begin());
+	return id;
+}
+
 std::string NormalizeDirPath(std::string_view str)
 {
 	std::string tmp(str);
@@ -33,7 +74,18 @@ GitRepo::GitRepo(boost::asio::io_context& ioCtx, const boost::json::value& opts)
 	token(opts.at("webhookToken").as_string().data()),
 	remote(opts.at("remote").as_string().data()),
 	path(NormalizeDirPath(opts.at("path").as_string().data())),
-	repo(nullptr)
+	debounce(GetDebounce(opts)),
+	depth([&]()
+	{
+		const auto* const d = opts.as_object().if_contains("depth");
+		return (d != nullptr) ? d->to_number<int>() : 0;
+	}()),
+	paths(GetPaths(opts)),
+	repo(nullptr),
+	pathspec(nullptr),
+	updateIoCtx(1),
+	updateIoCtxGuard(boost::asio::make_work_guard(updateIoCtx)),
+	updateTimer(updateIoCtx)
 {
 	if(const auto* const cred = opts.as_object().if_contains("credentials"); cred)
 	{
@@ -43,38 +95,63 @@ GitRepo::GitRepo(boost::asio::io_context& ioCtx, const boost::json::value& opts)
 	}
 	if(!boost::filesystem::is_directory(path))
 		throw std::runtime_error(I18N::GIT_REPO_PATH_IS_NOT_DIR);
+	for(const auto& p : paths)
+		pathPtrs.push_back(const_cast<char*>(p.data()));
+	if(!paths.empty())
+	{
+		const git_strarray ps = MakeStrArray(pathPtrs);
+		Git::Check(git_pathspec_new(&pathspec, &ps));
+	}
+#if LIBGIT2_VER_MAJOR < 1 || (LIBGIT2_VER_MAJOR == 1 && LIBGIT2_VER_MINOR < 7)
+	if(depth > 0)
+		spdlog::warn(I18N::GIT_REPO_SHALLOW_UNSUPPORTED);
+#endif
 	if(!CheckIfRepoExists())
 	{
 		spdlog::info(I18N::GIT_REPO_DOES_NOT_EXIST);
 		Clone();
-		return;
 	}
-	spdlog::info(I18N::GIT_REPO_EXISTS);
-	Git::Check(git_repository_open(&repo, path.data()));
-	spdlog::info(I18N::GIT_REPO_CHECKING_UPDATES);
-	try
-	{
-		Fetch();
-		ResetToFetchHead();
-	}
-	catch(...)
+	else
 	{
-		git_repository_free(repo);
-		throw;
+		spdlog::info(I18N::GIT_REPO_EXISTS);
+		Git::Check(git_repository_open(&repo, path.data()));
+		spdlog::info(I18N::GIT_REPO_CHECKING_UPDATES);
+		try
+		{
+			Fetch();
+			ResetToFetchHead();
+		}
+		catch(...)
+		{
+			git_repository_free(repo);
+			git_pathspec_free(pathspec);
+			throw;
+		}
+		spdlog::info(I18N::GIT_REPO_UPDATE_COMPLETED);
 	}
-	spdlog::info(I18N::GIT_REPO_UPDATE_COMPLETED);
+	updateThread = std::thread([this](){updateIoCtx.run();});
 }
 
 GitRepo::~GitRepo()
 {
+	// NOTE: An update already running is finished, pending ones dropped.
+	updateIoCtx.stop();
+	if(updateThread.joinable())
+		updateThread.join();
 	git_repository_free(repo);
+	git_pathspec_free(pathspec);
 }
 
 void GitRepo::AddObserver(IGitRepoObserver& obs)
 {
 	observers.emplace_back(&obs);
-	if(const PathVector pv = GetTrackedFiles(); !pv.empty())
-		obs.OnAdd(path, pv);
+	BlobIdVector ids;
+	if(const PathVector pv = GetTrackedFiles(ids); !pv.empty())
+	{
+		const auto start = std::chrono::steady_clock::now();
+		obs.OnAdd(path, pv, ids);
+		Room::Stats::Get().RecordReload(path, std::chrono::steady_clock::now() - start);
+	}
 }
 
 // private
@@ -87,6 +164,21 @@ void GitRepo::Callback(std::string_view payload)
 		spdlog::error(I18N::GIT_REPO_WEBHOOK_NO_TOKEN);
 		return;
 	}
+	boost::asio::post(updateIoCtx, [this]()
+	{
+		// Rearming cancels the wait of an earlier webhook, if any, so
+		// that a single update covers all of them.
+		updateTimer.expires_after(debounce);
+		updateTimer.async_wait([this](const boost::system::error_code& ec)
+		{
+			if(!ec)
+				Update();
+		});
+	});
+}
+
+void GitRepo::Update()
+{
 	try
 	{
 		Fetch();
@@ -94,8 +186,12 @@ void GitRepo::Callback(std::string_view payload)
 		ResetToFetchHead();
 		spdlog::info(I18N::GIT_REPO_FINISHED_UPDATING);
 		if(!diff.removed.empty() || !diff.added.empty())
+		{
+			const auto start = std::chrono::steady_clock::now();
 			for(auto& obs : observers)
 				obs->OnDiff(path, diff);
+			Room::Stats::Get().RecordReload(path, std::chrono::steady_clock::now() - start);
+		}
 	}
 	catch(const std::exception& e)
 	{
@@ -121,7 +217,13 @@ void GitRepo::Clone()
 		cloneOpts.fetch_opts.callbacks.credentials = &CredCb;
 		cloneOpts.fetch_opts.callbacks.payload = credPtr.get();
 	}
-	Git::Check(git_clone(&repo, remote.c_str(), path.c_str(), &cloneOpts));
+	SetDepth(cloneOpts.fetch_opts, depth);
+	cloneOpts.checkout_opts.paths = MakeStrArray(pathPtrs);
+	if(const int err = git_clone(&repo, remote.c_str(), path.c_str(), &cloneOpts); err != 0)
+	{
+		git_pathspec_free(pathspec);
+		Git::Check(err);
+	}
 	spdlog::info(I18N::GIT_REPO_CLONING_COMPLETED);
 }
 
@@ -134,6 +236,7 @@ void GitRepo::Fetch()
 		fetchOpts.callbacks.credentials = &CredCb;
 		fetchOpts.callbacks.payload = credPtr.get();
 	}
+	SetDepth(fetchOpts, depth);
 	auto remote = Git::MakeUnique(git_remote_lookup, repo, "origin");
 	Git::Check(git_remote_fetch(remote.get(), nullptr, &fetchOpts, nullptr));
 }
@@ -144,8 +247,10 @@ void GitRepo::ResetToFetchHead()
 	git_oid oid;
 	Git::Check(git_reference_name_to_id(&oid, repo, "FETCH_HEAD"));
 	auto commit = Git::MakeUnique(git_commit_lookup, repo, &oid);
+	git_checkout_options checkoutOpts = GIT_CHECKOUT_OPTIONS_INIT;
+	checkoutOpts.paths = MakeStrArray(pathPtrs);
 	Git::Check(git_reset(repo, reinterpret_cast<git_object*>(commit.get()),
-	                     GIT_RESET_HARD, nullptr));
+	                     GIT_RESET_HARD, &checkoutOpts));
 }
 
 GitDiff GitRepo::GetFilesDiff() const
@@ -157,29 +262,35 @@ GitDiff GitRepo::GetFilesDiff() const
 		if(git_oid_iszero(&delta->old_file.id) == 1)
 		{
 			diff.added.emplace_back(delta->new_file.path);
+			diff.addedIds.emplace_back(ToBlobId(delta->new_file.id));
 		}
 		else if(git_oid_iszero(&delta->new_file.id) == 1)
 		{
 			diff.removed.emplace_back(delta->old_file.path);
 		}
-		else
+		else if(git_oid_equal(&delta->old_file.id, &delta->new_file.id) == 0)
 		{
 			diff.removed.emplace_back(delta->old_file.path);
 			diff.added.emplace_back(delta->new_file.path);
+			diff.addedIds.emplace_back(ToBlobId(delta->new_file.id));
 		}
+		// NOTE: Files whose mode changed but not their contents are left
+		// out, as nobody needs to load them again.
 		return 0;
 	};
 	auto obj1 = Git::MakeUnique(git_revparse_single, repo, "HEAD");
 	auto obj2 = Git::MakeUnique(git_revparse_single, repo, "FETCH_HEAD");
 	auto t1 = Git::Peel<git_tree>(std::move(obj1));
 	auto t2 = Git::Peel<git_tree>(std::move(obj2));
-	auto obj3 = Git::MakeUnique(git_diff_tree_to_tree, repo, t1.get(), t2.get(), nullptr);
+	git_diff_options diffOpts = GIT_DIFF_OPTIONS_INIT;
+	diffOpts.pathspec = MakeStrArray(pathPtrs);
+	auto obj3 = Git::MakeUnique(git_diff_tree_to_tree, repo, t1.get(), t2.get(), &diffOpts);
 	GitDiff diff;
 	Git::Check(git_diff_foreach(obj3.get(), FileCb, nullptr, nullptr, nullptr, &diff));
 	return diff;
 }
 
-PathVector GitRepo::GetTrackedFiles() const
+PathVector GitRepo::GetTrackedFiles(BlobIdVector& ids) const
 {
 	// git ls-files
 	PathVector pv;
@@ -189,7 +300,10 @@ PathVector GitRepo::GetTrackedFiles() const
 	for(std::size_t i = 0; i < entryCount; i++)
 	{
 		entry = git_index_get_byindex(index.get(), i);
+		if(pathspec != nullptr && git_pathspec_matches_path(pathspec, 0U, entry->path) == 0)
+			continue;
 		pv.emplace_back(entry->path);
+		ids.emplace_back(ToBlobId(entry->id));
 	}
 	return pv;
 }
@@ -1,13 +1,18 @@
 #ifndef GITREPO_HPP
 #define GITREPO_HPP
+#include <chrono>
 #include <string>
+#include <thread>
 #include <vector>
 
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/steady_timer.hpp>
 #include <boost/json/fwd.hpp>
 
 #include "IGitRepoObserver.hpp"
 #include "Endpoint/Webhook.hpp"
 
+struct git_pathspec;
 struct git_repository;
 
 namespace Ignis::Multirole
@@ -27,25 +32,45 @@ public:
 	GitRepo& operator=(const GitRepo&) = delete;
 	GitRepo& operator=(GitRepo&&) = delete;
 
+	// Must be called before webhooks are served.
 	void AddObserver(IGitRepoObserver& obs);
 private:
 	const std::string token;
 	const std::string remote;
 	const std::string path;
+	// How long to wait for more webhooks before updating, so that a burst
+	// of pushes is served by a single update.
+	const std::chrono::milliseconds debounce;
+	// History fetched, in commits, everything if zero.
+	const int depth;
+	// Only files matching these pathspecs are checked out, listed and
+	// diffed, every file if empty.
+	const std::vector<std::string> paths;
+	std::vector<char*> pathPtrs; // Of `paths`, as libgit2 takes them.
 	std::unique_ptr<Credentials> credPtr;
 	git_repository* repo;
+	git_pathspec* pathspec;
 	std::vector<IGitRepoObserver*> observers;
 
+	// Updates run on their own thread, so that a slow fetch or observer
+	// doesn't hold up webhooks or updates of other repositories.
+	boost::asio::io_context updateIoCtx;
+	boost::asio::executor_work_guard<boost::asio::io_context::executor_type> updateIoCtxGuard;
+	boost::asio::steady_timer updateTimer;
+	std::thread updateThread;
+
 	// Endpoint::Webhook override
 	void Callback(std::string_view payload) override;
 
+	void Update();
+
 	bool CheckIfRepoExists() const;
 	void Clone();
 	void Fetch();
 	void ResetToFetchHead();
 
 	GitDiff GetFilesDiff() const;
-	std::vector<std::string> GetTrackedFiles() const;
+	std::vector<std::string> GetTrackedFiles(BlobIdVector& ids) const;
 };
 
 } // namespace Ignis::Multirole
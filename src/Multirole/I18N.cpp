@@ -13,12 +13,25 @@ Str GIT_REPO_WEBHOOK_NO_TOKEN = "Webhook payload doesn't have the token";
 Str GIT_REPO_FINISHED_UPDATING = "Finished updating";
 Str GIT_REPO_UPDATE_EXCEPT = "Exception ocurred while updating repo: {0}";
 Str GIT_REPO_CLONING_COMPLETED = "Cloning completed!";
+Str GIT_REPO_SHALLOW_UNSUPPORTED = "This libgit2 can't do shallow fetches, fetching all history";
 
 Str MULTIROLE_INCORRECT_CORE_TYPE = "Incorrect type of core";
+Str MULTIROLE_INCORRECT_QUEUE_FULL_POLICY = "Incorrect policy for a full replay queue";
+Str MULTIROLE_INCORRECT_REPLAY_CODEC = "Incorrect or unsupported replay codec";
+Str MULTIROLE_INCORRECT_REPLAY_STORAGE = "Incorrect replay storage";
+Str MULTIROLE_INCORRECT_FSYNC_POLICY = "Incorrect fsync policy for replay packs";
+Str MULTIROLE_INCORRECT_CLUSTER_NODE = "Cluster node IDs must fit in the cluster node bits (1 to 16)";
+Str MULTIROLE_INCORRECT_LOG_LEVEL = "Incorrect log level";
 Str MULTIROLE_ADDING_REPO = "Adding repository '{0}'...";
 Str MULTIROLE_SETUP_SIGNAL = "Setting up signal handling...";
 Str MULTIROLE_SIGNAL_RECEIVED = "SIGTERM received";
+Str MULTIROLE_RELOADING_TUNING = "Reloading tuning...";
+Str MULTIROLE_TUNING_RELOADED = "Tuning reloaded, new rooms and connections will use it";
+Str MULTIROLE_TUNING_RELOAD_FAILED = "Could not reload tuning, keeping the current one: {0}";
 Str MULTIROLE_HOSTING_THREADS_NUM = "Hosting will use {0} threads";
+Str MULTIROLE_ROOMS_THREADS_NUM = "Rooms will use {0} threads";
+Str MULTIROLE_ROOMS_THREADS_ADAPTIVE = "Rooms will start with {0} threads, adapting to how busy they are";
+Str MULTIROLE_REACTORS_NUM = "Sockets and rooms will be spread among {0} reactors";
 Str MULTIROLE_INIT_SUCCESS = "Initialization finished successfully!";
 Str MULTIROLE_CLEANING_UP = "Closing acceptors and repositories...";
 Str MULTIROLE_UNFINISHED_DUELS =
@@ -27,7 +40,19 @@ Str MULTIROLE_UNFINISHED_DUELS =
 "you can terminate the process safely now (SIGTERM/SIGKILL) "
 "Remaining duels: {0}";
 
+Str LOAD_MONITOR_LEVEL_CHANGED =
+"Load is now {0}: CPU at {1}%, {2} hornets, {3}% of file "
+"descriptors in use, {4} replays queued.";
+
+Str LOBBY_OUT_OF_IDS = "Lobby: Every room ID is taken, refusing to make a new room";
+
+Str PLACEMENT_NUMA_NODE_UNKNOWN = "Placement: NUMA node {0} has no CPUs, io threads won't be pinned";
+Str PLACEMENT_CGROUP_SETUP_FAILED = "Placement: Could not set up hornet cgroup {0}: {1}";
+Str PLACEMENT_CGROUP_MOVE_FAILED = "Placement: Could not move hornet {0} onto cgroup {1}";
+Str PLACEMENT_PIN_FAILED = "Placement: Could not pin to the configured CPUs";
+
 Str MAIN_SERVER_INIT_FAILURE = "Could not initialize server: {0}\n";
+Str MAIN_INCORRECT_LOG_OVERFLOW_POLICY = "Incorrect overflow policy for the log queue";
 
 Str DLWRAPPER_EXCEPT_CREATE_DUEL = "OCG_CreateDuel failed!";
 
@@ -37,6 +62,9 @@ Str HWRAPPER_EXCEPT_CREATE_DUEL = DLWRAPPER_EXCEPT_CREATE_DUEL;
 Str HWRAPPER_EXCEPT_MAX_LOOP_COUNT = "Max loop count reached";
 Str HWRAPPER_EXCEPT_PROC_CRASHED = "Process is not running";
 Str HWRAPPER_EXCEPT_PROC_UNRESPONSIVE = "Process is unresponsive";
+Str HWRAPPER_EXCEPT_OVERFLOW = "Could not read result from overflow object";
+Str HWRAPPER_EXCEPT_ZYGOTE_FORK = "Zygote was unable to fork";
+Str HWRAPPER_ZYGOTE_UNSUPPORTED = "Zygote is not supported on this platform";
 
 Str CLIENT_ROOM_HOSTING_INVALID_NAME = "Invalid name. Try filling in your name.";
 Str CLIENT_ROOM_HOSTING_NOT_FOUND = "Room not found. Try refreshing the list!";
@@ -44,30 +72,77 @@ Str CLIENT_ROOM_HOSTING_INVALID_MSG =
 "Invalid message before connecting to room. Please report this error!";
 Str CLIENT_ROOM_HOSTING_KICKED_BEFORE =
 "Unable to join. You were kicked from this room before.";
+Str CLIENT_ROOM_HOSTING_OTHER_NODE =
+"This room is hosted on another server. Connect to {0} to join it.";
+Str CLIENT_ROOM_HOSTING_BUSY =
+"This server is too busy to host new rooms right now. You can still join existing rooms, or try again later.";
 
 Str CLIENT_ROOM_MSG_RETRY_ERROR =
 "Error while processing your response. Make sure you have the lastest client.";
 
+// NOTE: Room messages are logged often when cores misbehave, so they are
+// kept as key=value fields in order to be filtered and aggregated easily.
 Str ROOM_DUELING_CORE_EXCEPT_CREATION =
-"Core exception at creation (Replay ID: {0}): {1}";
+"room={0} replay={1} action=core_except stage=creation what=\"{2}\"";
 Str ROOM_DUELING_CORE_EXCEPT_EXTRA_CARDS =
-"Core exception at extra cards addition (Replay ID: {0}): {1}";
+"room={0} replay={1} action=core_except stage=extra_cards what=\"{2}\"";
 Str ROOM_DUELING_CORE_EXCEPT_STARTING =
-"Core exception at starting (Replay ID: {0}): {1}";
+"room={0} replay={1} action=core_except stage=starting what=\"{2}\"";
 Str ROOM_DUELING_CORE_EXCEPT_RESPONSE =
-"Core exception at response setting (Replay ID: {0}): {1}";
+"room={0} replay={1} action=core_except stage=response what=\"{2}\"";
 Str ROOM_DUELING_CORE_EXCEPT_PROCESSING =
-"Core exception at processing (Replay ID: {0}): {1}";
+"room={0} replay={1} action=core_except stage=processing what=\"{2}\"";
 Str ROOM_DUELING_CORE_EXCEPT_DESTRUCTOR =
-"Core exception at destruction (Replay ID: {0}): {1}";
+"room={0} replay={1} action=core_except stage=destruction what=\"{2}\"";
 Str ROOM_DUELING_MSG_RETRY_RECEIVED =
-"MSG_RETRY received from core (Replay ID: {0})";
+"room={0} replay={1} action=msg_retry";
+Str ROOM_DUELING_CORE_RESTORING =
+"room={0} replay={1} action=core_restore responses={2}";
+Str ROOM_DUELING_CORE_EXCEPT_RESTORING =
+"room={0} replay={1} action=core_except stage=restoration what=\"{2}\"";
+Str ROOM_DUELING_CORE_RESTORE_DIVERGED =
+"room={0} replay={1} action=core_restore_diverged";
+Str ROOM_DUELING_CORE_RESTORE_SAME_CORE =
+"room={0} replay={1} action=core_restore_unavailable";
+Str ROOM_DUELING_PROCESS_BUDGET_HIT =
+"room={0} replay={1} action=budget_hit";
+Str ROOM_DUELING_COST_EXCEEDED =
+"room={0} replay={1} action=cost_exceeded dispatch_ms={2} core_ms={3} distribute_ms={4} bytes={5} msgs={6}";
+Str ROOM_DUELING_BUDGET_THROTTLED =
+"room={0} replay={1} action=budget_throttled budget_us={2}";
+Str ROOM_DUELING_MEMORY_SOFT =
+"room={0} replay={1} action=memory_soft bytes={2} soft_bytes={3}";
+Str ROOM_DUELING_MEMORY_HARD =
+"room={0} replay={1} action=memory_exceeded bytes={2} hard_bytes={3}";
+Str ROOM_DUELING_CORE_EXCEPT_PREPARING =
+"room={0} action=core_except stage=preparing what=\"{1}\"";
 Str CLIENT_ROOM_REPLAY_TOO_BIG =
-"Unable to send replay, its size exceeds the maximum capacity.";
+"Replay too big to be sent at once, it is sent in parts instead, which your client might not support.";
 Str CLIENT_ROOM_CORE_EXCEPT =
 "Internal scripting engine error! This incident has been reported.";
+Str CLIENT_ROOM_CORE_RESTORED =
+"Internal scripting engine error! The duel has been restored.";
+Str CLIENT_ROOM_MEMORY_EXCEEDED =
+"The duel was using too much memory on the server and has been ended.";
 
 Str CLIENT_ROOM_KICKED = "{0} has been kicked.";
+Str CLIENT_ROOM_CHAT_THROTTLED = "You are chatting too fast, your messages are being dropped.";
+Str CLIENT_ROOM_IDLE = "The room has been closed for being inactive for too long.";
+
+Str ROOM_IDLE_CLOSED = "room={0} action=idle_closed";
+
+Str ROOM_TRACE_COULD_NOT_WRITE =
+"room={0} replay={1} action=trace_write_failed path=\"{2}\"";
+
+Str ROOM_CLIENT_SPECTATOR_FELL_BEHIND =
+"Disconnecting spectator {0}, it fell behind with {1} messages ({2} bytes) queued";
+
+Str SPECTATOR_RELAY_UPSTREAM_ERROR = "SpectatorRelay: Could not relay room {0}: {1}";
+
+Str SOCKET_HANDOFF_SYSTEMD = "SocketHandoff: Took {0} listening sockets from systemd";
+Str SOCKET_HANDOFF_TAKEN = "SocketHandoff: Took {0} listening sockets from the previous process";
+Str SOCKET_HANDOFF_SENDING = "SocketHandoff: Handing {0} listening sockets off to a new process";
+Str SOCKET_HANDOFF_SEND_FAILED = "SocketHandoff: Could not send listening sockets";
 
 Str BANLIST_PROVIDER_LOADING_ONE = "BanlistProvider: Loading up {0}...";
 Str BANLIST_PROVIDER_COULD_NOT_LOAD_ONE = "BanlistProvider: Couldn't load banlist: {0}";
@@ -77,12 +152,22 @@ Str CORE_PROVIDER_PATH_IS_FILE_NOT_DIR = "CoreProvider: Temporary directory path
 Str CORE_PROVIDER_WRONG_CORE_TYPE = "CoreProvider: No other core type is implemented";
 Str CORE_PROVIDER_CORE_NOT_FOUND_IN_REPO = "CoreProvider: Core not found in repository!";
 Str CORE_PROVIDER_COPYING_CORE_FILE = "CoreProvider: Copying core from '{0}' to '{1}'...";
-Str CORE_PROVIDER_FAILED_TO_COPY_CORE_FILE = "CoreProvider: Failed to copy core file! Re-testing old one";
-Str CORE_PROVIDER_VERSION_REPORTED = "CoreProvider: Version reported by core: {0}.{1}";
+Str CORE_PROVIDER_FAILED_TO_COPY_CORE_FILE = "CoreProvider: Failed to copy core file: {0}. Re-testing old one";
+Str CORE_PROVIDER_VERSION_REPORTED = "CoreProvider: Version reported by core: {0}.{1} (generation {2})";
+Str CORE_PROVIDER_GENERATION_UNUSED = "CoreProvider: Generation {0} (version {1}.{2}) no longer in use, removing '{3}'";
 Str CORE_PROVIDER_ERROR_WHILE_TESTING = "CoreProvider: Error while testing core '{0}': {1}";
+Str CORE_PROVIDER_POOL_LOAD_FAILED = "CoreProvider: Could not load core for the pool: {0}";
+Str CORE_PROVIDER_ZYGOTE_LAUNCH_FAILED = "CoreProvider: Could not launch zygote, cores will be launched normally: {0}";
+Str CORE_PROVIDER_ZYGOTE_FORK_FAILED = "CoreProvider: Could not fork core from zygote, launching it normally: {0}";
 
 Str DATA_PROVIDER_LOADING_ONE = "DataProvider: Loading up {0}...";
 Str DATA_PROVIDER_COULD_NOT_MERGE = "DataProvider: Couldn't merge database";
+Str DATA_PROVIDER_COULD_NOT_SEAL = "DataProvider: Couldn't build card table: {0}";
+Str DATA_PROVIDER_COULD_NOT_READ = "DataProvider: Couldn't read database file";
+Str DATA_PROVIDER_COULD_NOT_CREATE_SNAPSHOT_DIR = "DataProvider: Couldn't create snapshot directory";
+Str DATA_PROVIDER_BAD_SNAPSHOT = "DataProvider: Ignoring snapshot {0}: {1}";
+Str DATA_PROVIDER_COULD_NOT_WRITE_SNAPSHOT = "DataProvider: Couldn't write snapshot {0}: {1}";
+Str DATA_PROVIDER_COULD_NOT_PUBLISH = "DataProvider: Couldn't publish shared card table: {0}";
 
 Str REPLAY_MANAGER_NOT_SAVING_REPLAYS = "ReplayManager: Not saving replays, replays ID will always be 0";
 Str REPLAY_MANAGER_COULD_NOT_CREATE_DIR = "ReplayManager: Could not create replay directory";
@@ -94,9 +179,16 @@ Str REPLAY_MANAGER_LASTID_SIZE_CORRUPTED =
 Str REPLAY_MANAGER_UNABLE_TO_SAVE = "ReplayManager: Unable to save replay '{0}'";
 Str REPLAY_MANAGER_CANNOT_OPEN_LASTID = "ReplayManager: lastId cannot be opened for reading";
 Str REPLAY_MANAGER_CANNOT_WRITE_ID = "ReplayManager: Unable to write next replay ID to file";
+Str REPLAY_MANAGER_QUEUE_FULL_DROPPING = "ReplayManager: Too many replays being written, dropping replay {0}";
+Str REPLAY_MANAGER_CLIENT_CODEC_NOT_LZMA = "ReplayManager: Replays sent to clients must be compressed with lzma";
+Str REPLAY_MANAGER_UNABLE_TO_OPEN_PACK = "ReplayManager: Unable to open a pack for replay {0}";
+Str REPLAY_MANAGER_UNABLE_TO_INDEX = "ReplayManager: Unable to add replay {0} to the index: {1}";
 
 Str SCRIPT_PROVIDER_LOADING_FILES = "ScriptProvider: Loading {0} files...";
 Str SCRIPT_PROVIDER_COULD_NOT_OPEN = "ScriptProvider: Couldn't open file '{0}'";
 Str SCRIPT_PROVIDER_TOTAL_FILES_LOADED = "ScriptProvider: Loaded {0} files";
+Str SCRIPT_PROVIDER_COULD_NOT_PUBLISH = "ScriptProvider: Couldn't publish shared script table: {0}";
+Str SCRIPT_PROVIDER_COULD_NOT_CREATE_BYTECODE_DIR = "ScriptProvider: Couldn't create bytecode directory";
+Str SCRIPT_PROVIDER_COULD_NOT_COMPILE = "ScriptProvider: Couldn't compile '{0}', serving its source";
 
 } // namespace Ignis::Multirole::I18N
@@ -18,17 +18,40 @@ extern Str GIT_REPO_WEBHOOK_NO_TOKEN;
 extern Str GIT_REPO_FINISHED_UPDATING;
 extern Str GIT_REPO_UPDATE_EXCEPT;
 extern Str GIT_REPO_CLONING_COMPLETED;
+extern Str GIT_REPO_SHALLOW_UNSUPPORTED;
 
 extern Str MULTIROLE_INCORRECT_CORE_TYPE;
+extern Str MULTIROLE_INCORRECT_QUEUE_FULL_POLICY;
+extern Str MULTIROLE_INCORRECT_REPLAY_CODEC;
+extern Str MULTIROLE_INCORRECT_REPLAY_STORAGE;
+extern Str MULTIROLE_INCORRECT_FSYNC_POLICY;
+extern Str MULTIROLE_INCORRECT_CLUSTER_NODE;
+extern Str MULTIROLE_INCORRECT_LOG_LEVEL;
 extern Str MULTIROLE_ADDING_REPO;
 extern Str MULTIROLE_SETUP_SIGNAL;
 extern Str MULTIROLE_SIGNAL_RECEIVED;
+extern Str MULTIROLE_RELOADING_TUNING;
+extern Str MULTIROLE_TUNING_RELOADED;
+extern Str MULTIROLE_TUNING_RELOAD_FAILED;
 extern Str MULTIROLE_HOSTING_THREADS_NUM;
+extern Str MULTIROLE_ROOMS_THREADS_NUM;
+extern Str MULTIROLE_ROOMS_THREADS_ADAPTIVE;
+extern Str MULTIROLE_REACTORS_NUM;
 extern Str MULTIROLE_INIT_SUCCESS;
 extern Str MULTIROLE_CLEANING_UP;
 extern Str MULTIROLE_UNFINISHED_DUELS;
 
+extern Str LOAD_MONITOR_LEVEL_CHANGED;
+
+extern Str LOBBY_OUT_OF_IDS;
+
+extern Str PLACEMENT_NUMA_NODE_UNKNOWN;
+extern Str PLACEMENT_CGROUP_SETUP_FAILED;
+extern Str PLACEMENT_CGROUP_MOVE_FAILED;
+extern Str PLACEMENT_PIN_FAILED;
+
 extern Str MAIN_SERVER_INIT_FAILURE;
+extern Str MAIN_INCORRECT_LOG_OVERFLOW_POLICY;
 
 extern Str DLWRAPPER_EXCEPT_CREATE_DUEL;
 
@@ -39,11 +62,16 @@ extern Str HWRAPPER_EXCEPT_CREATE_DUEL;
 extern Str HWRAPPER_EXCEPT_MAX_LOOP_COUNT;
 extern Str HWRAPPER_EXCEPT_PROC_CRASHED;
 extern Str HWRAPPER_EXCEPT_PROC_UNRESPONSIVE;
+extern Str HWRAPPER_EXCEPT_OVERFLOW;
+extern Str HWRAPPER_EXCEPT_ZYGOTE_FORK;
+extern Str HWRAPPER_ZYGOTE_UNSUPPORTED;
 
 extern Str CLIENT_ROOM_HOSTING_INVALID_NAME;
 extern Str CLIENT_ROOM_HOSTING_NOT_FOUND;
 extern Str CLIENT_ROOM_HOSTING_INVALID_MSG;
 extern Str CLIENT_ROOM_HOSTING_KICKED_BEFORE;
+extern Str CLIENT_ROOM_HOSTING_OTHER_NODE;
+extern Str CLIENT_ROOM_HOSTING_BUSY;
 
 extern Str CLIENT_ROOM_MSG_RETRY_ERROR;
 
@@ -54,10 +82,37 @@ extern Str ROOM_DUELING_CORE_EXCEPT_RESPONSE;
 extern Str ROOM_DUELING_CORE_EXCEPT_PROCESSING;
 extern Str ROOM_DUELING_CORE_EXCEPT_DESTRUCTOR;
 extern Str ROOM_DUELING_MSG_RETRY_RECEIVED;
+extern Str ROOM_DUELING_CORE_RESTORING;
+extern Str ROOM_DUELING_CORE_EXCEPT_RESTORING;
+extern Str ROOM_DUELING_CORE_RESTORE_DIVERGED;
+extern Str ROOM_DUELING_CORE_RESTORE_SAME_CORE;
+extern Str ROOM_DUELING_PROCESS_BUDGET_HIT;
+extern Str ROOM_DUELING_COST_EXCEEDED;
+extern Str ROOM_DUELING_BUDGET_THROTTLED;
+extern Str ROOM_DUELING_MEMORY_SOFT;
+extern Str ROOM_DUELING_MEMORY_HARD;
+extern Str ROOM_DUELING_CORE_EXCEPT_PREPARING;
 extern Str CLIENT_ROOM_REPLAY_TOO_BIG;
 extern Str CLIENT_ROOM_CORE_EXCEPT;
+extern Str CLIENT_ROOM_CORE_RESTORED;
+extern Str CLIENT_ROOM_MEMORY_EXCEEDED;
 
 extern Str CLIENT_ROOM_KICKED;
+extern Str CLIENT_ROOM_CHAT_THROTTLED;
+extern Str CLIENT_ROOM_IDLE;
+
+extern Str ROOM_IDLE_CLOSED;
+
+extern Str ROOM_TRACE_COULD_NOT_WRITE;
+
+extern Str ROOM_CLIENT_SPECTATOR_FELL_BEHIND;
+
+extern Str SPECTATOR_RELAY_UPSTREAM_ERROR;
+
+extern Str SOCKET_HANDOFF_SYSTEMD;
+extern Str SOCKET_HANDOFF_TAKEN;
+extern Str SOCKET_HANDOFF_SENDING;
+extern Str SOCKET_HANDOFF_SEND_FAILED;
 
 extern Str BANLIST_PROVIDER_LOADING_ONE;
 extern Str BANLIST_PROVIDER_COULD_NOT_LOAD_ONE;
@@ -69,10 +124,20 @@ extern Str CORE_PROVIDER_CORE_NOT_FOUND_IN_REPO;
 extern Str CORE_PROVIDER_COPYING_CORE_FILE;
 extern Str CORE_PROVIDER_FAILED_TO_COPY_CORE_FILE;
 extern Str CORE_PROVIDER_VERSION_REPORTED;
+extern Str CORE_PROVIDER_GENERATION_UNUSED;
 extern Str CORE_PROVIDER_ERROR_WHILE_TESTING;
+extern Str CORE_PROVIDER_POOL_LOAD_FAILED;
+extern Str CORE_PROVIDER_ZYGOTE_LAUNCH_FAILED;
+extern Str CORE_PROVIDER_ZYGOTE_FORK_FAILED;
 
 extern Str DATA_PROVIDER_LOADING_ONE;
 extern Str DATA_PROVIDER_COULD_NOT_MERGE;
+extern Str DATA_PROVIDER_COULD_NOT_SEAL;
+extern Str DATA_PROVIDER_COULD_NOT_READ;
+extern Str DATA_PROVIDER_COULD_NOT_CREATE_SNAPSHOT_DIR;
+extern Str DATA_PROVIDER_BAD_SNAPSHOT;
+extern Str DATA_PROVIDER_COULD_NOT_WRITE_SNAPSHOT;
+extern Str DATA_PROVIDER_COULD_NOT_PUBLISH;
 
 extern Str REPLAY_MANAGER_NOT_SAVING_REPLAYS;
 extern Str REPLAY_MANAGER_COULD_NOT_CREATE_DIR;
@@ -83,10 +148,17 @@ extern Str REPLAY_MANAGER_LASTID_SIZE_CORRUPTED;
 extern Str REPLAY_MANAGER_UNABLE_TO_SAVE;
 extern Str REPLAY_MANAGER_CANNOT_OPEN_LASTID;
 extern Str REPLAY_MANAGER_CANNOT_WRITE_ID;
+extern Str REPLAY_MANAGER_QUEUE_FULL_DROPPING;
+extern Str REPLAY_MANAGER_CLIENT_CODEC_NOT_LZMA;
+extern Str REPLAY_MANAGER_UNABLE_TO_OPEN_PACK;
+extern Str REPLAY_MANAGER_UNABLE_TO_INDEX;
 
 extern Str SCRIPT_PROVIDER_LOADING_FILES;
 extern Str SCRIPT_PROVIDER_COULD_NOT_OPEN;
 extern Str SCRIPT_PROVIDER_TOTAL_FILES_LOADED;
+extern Str SCRIPT_PROVIDER_COULD_NOT_PUBLISH;
+extern Str SCRIPT_PROVIDER_COULD_NOT_CREATE_BYTECODE_DIR;
+extern Str SCRIPT_PROVIDER_COULD_NOT_COMPILE;
 
 } // namespace Ignis::Multirole::I18N
 
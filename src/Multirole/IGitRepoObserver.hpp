@@ -1,5 +1,6 @@
 #ifndef IGITREPOOBSERVER_HPP
 #define IGITREPOOBSERVER_HPP
+#include <array>
 #include <string>
 #include <string_view>
 #include <vector>
@@ -8,18 +9,23 @@ namespace Ignis::Multirole
 {
 
 using PathVector = std::vector<std::string>;
+// Git object id of a file, the same for every file with the same contents.
+using BlobId = std::array<unsigned char, 20U>;
+using BlobIdVector = std::vector<BlobId>;
 
 struct GitDiff
 {
 	// NOTE: filenames that were only modified will be present in both vectors
 	PathVector removed;
 	PathVector added;
+	BlobIdVector addedIds; // Of each added file, in the same order.
 };
 
 class IGitRepoObserver
 {
 public:
-	virtual void OnAdd(std::string_view path, const PathVector& fileList) = 0;
+	// `ids` has the blob of each file on `fileList`, in the same order.
+	virtual void OnAdd(std::string_view path, const PathVector& fileList, const BlobIdVector& ids) = 0;
 	virtual void OnDiff(std::string_view path, const GitDiff& diff) = 0;
 protected:
 	inline ~IGitRepoObserver() = default;
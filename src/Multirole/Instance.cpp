@@ -1,11 +1,16 @@
 #include "Instance.hpp"
 
 #include <csignal>
+#include <algorithm>
 #include <cstdlib> // Exit flags
+#include <exception>
+#include <fstream>
+#include <optional>
 #include <thread>
 
 #include <boost/asio/dispatch.hpp>
 #include <boost/asio/thread_pool.hpp>
+#include <boost/json/stream_parser.hpp>
 #include <boost/json/value.hpp>
 #include <spdlog/spdlog.h>
 
@@ -14,6 +19,9 @@
 namespace Ignis::Multirole
 {
 
+// Same file main reads the configuration from.
+constexpr const char* CONFIG_FILE = "config.json";
+
 constexpr unsigned int GetConcurrency(int hint)
 {
 	if(hint <= 0)
@@ -21,77 +29,487 @@ constexpr unsigned int GetConcurrency(int hint)
 	return static_cast<unsigned int>(hint);
 }
 
+inline std::vector<boost::asio::executor_work_guard<boost::asio::io_context::executor_type>>
+MakeWorkGuards(Endpoint::Reactors& reactors)
+{
+	std::vector<boost::asio::executor_work_guard<boost::asio::io_context::executor_type>> ret;
+	ret.reserve(reactors.size());
+	for(auto& reactor : reactors)
+		ret.push_back(boost::asio::make_work_guard(reactor));
+	return ret;
+}
+
 inline Service::CoreProvider::CoreType GetCoreType(std::string_view str)
 {
 	auto ret = Service::CoreProvider::CoreType::SHARED;
 	if(str == "hornet")
 		ret = Service::CoreProvider::CoreType::HORNET;
+	else if(str == "hybrid")
+		ret = Service::CoreProvider::CoreType::HYBRID;
 	else if(str != "shared")
 		throw std::runtime_error(I18N::MULTIROLE_INCORRECT_CORE_TYPE);
 	return ret;
 }
 
+inline Service::CoreProvider::HybridOptions GetHybridOptions(const boost::json::value& cfg)
+{
+	Service::CoreProvider::HybridOptions ret
+	{
+		cfg.at("crashRegistryPath").as_string(),
+		cfg.at("isolateExtraRules").as_bool(),
+		{}
+	};
+	for(const auto& hash : cfg.at("isolateBanlists").as_array())
+		ret.isolateBanlists.push_back(hash.to_number<uint32_t>());
+	return ret;
+}
+
+inline Service::ReplayManager::WriteOptions GetReplayWriteOptions(
+	const boost::json::value& cfg,
+	std::size_t maxQueued)
+{
+	using QueueFullPolicy = Service::ReplayManager::QueueFullPolicy;
+	const std::string_view whenFull = cfg.at("whenQueueFull").as_string();
+	if(whenFull != "inline" && whenFull != "drop")
+		throw std::runtime_error(I18N::MULTIROLE_INCORRECT_QUEUE_FULL_POLICY);
+	return Service::ReplayManager::WriteOptions
+	{
+		cfg.at("writerThreads").to_number<std::size_t>(),
+		maxQueued,
+		(whenFull == "drop") ? QueueFullPolicy::DROP : QueueFullPolicy::WRITE_INLINE
+	};
+}
+
+inline Service::ReplayManager::Compression GetReplayCompression(const boost::json::value& cfg)
+{
+	using Codec = YGOPro::Replay::Codec;
+	const std::string_view codecStr = cfg.at("codec").as_string();
+	const auto codec = [&]() -> Codec
+	{
+		if(codecStr == "none")
+			return Codec::NONE;
+		if(codecStr == "lzma")
+			return Codec::LZMA;
+#ifdef MULTIROLE_ZSTD
+		if(codecStr == "zstd")
+			return Codec::ZSTD;
+#endif // MULTIROLE_ZSTD
+		throw std::runtime_error(I18N::MULTIROLE_INCORRECT_REPLAY_CODEC);
+	}();
+	return Service::ReplayManager::Compression{codec, cfg.at("level").to_number<int>()};
+}
+
+inline Service::ReplayManager::PackOptions GetReplayPackOptions(const boost::json::value& cfg)
+{
+	using FsyncPolicy = Service::ReplayManager::FsyncPolicy;
+	const std::string_view storage = cfg.at("storage").as_string();
+	if(storage != "files" && storage != "packs")
+		throw std::runtime_error(I18N::MULTIROLE_INCORRECT_REPLAY_STORAGE);
+	const auto& pack = cfg.at("pack");
+	const std::string_view fsyncStr = pack.at("fsync").as_string();
+	const auto fsync = [&]() -> FsyncPolicy
+	{
+		if(fsyncStr == "never")
+			return FsyncPolicy::NEVER;
+		if(fsyncStr == "rotate")
+			return FsyncPolicy::ON_ROTATE;
+		if(fsyncStr == "always")
+			return FsyncPolicy::ALWAYS;
+		throw std::runtime_error(I18N::MULTIROLE_INCORRECT_FSYNC_POLICY);
+	}();
+	return Service::ReplayManager::PackOptions
+	{
+		storage == "packs",
+		pack.at("maxSize").to_number<uint64_t>(),
+		std::chrono::seconds(pack.at("maxAgeS").to_number<uint64_t>()),
+		fsync
+	};
+}
+
+inline Room::Client::SendLimits GetSendLimits(const boost::json::value& cfg)
+{
+	return Room::Client::SendLimits
+	{
+		cfg.at("maxMessages").to_number<std::size_t>(),
+		cfg.at("maxBytes").to_number<std::size_t>()
+	};
+}
+
+inline Room::Client::ChatLimits GetChatLimits(const boost::json::value& cfg)
+{
+	return Room::Client::ChatLimits
+	{
+		cfg.at("perSecond").to_number<double>(),
+		cfg.at("burst").to_number<double>()
+	};
+}
+
+inline Room::Context::CostLimits GetCostLimits(const boost::json::value& cfg)
+{
+	using namespace std::chrono;
+	return Room::Context::CostLimits
+	{
+		milliseconds(cfg.at("dispatchMs").to_number<int64_t>()),
+		milliseconds(cfg.at("coreMs").to_number<int64_t>()),
+		cfg.at("bytes").to_number<uint64_t>(),
+		cfg.at("messages").to_number<uint64_t>(),
+		microseconds(cfg.at("throttledBudgetUs").to_number<int64_t>())
+	};
+}
+
+inline Room::Context::MemoryBudget GetMemoryBudget(const boost::json::value& cfg)
+{
+	return Room::Context::MemoryBudget
+	{
+		cfg.at("softBytes").to_number<uint64_t>(),
+		cfg.at("hardBytes").to_number<uint64_t>()
+	};
+}
+
+inline Room::Instance::IdleTimeouts GetIdleTimeouts(const boost::json::value& cfg)
+{
+	using namespace std::chrono;
+	return Room::Instance::IdleTimeouts
+	{
+		seconds(cfg.at("waiting").to_number<int64_t>()),
+		seconds(cfg.at("choosing").to_number<int64_t>()),
+		seconds(cfg.at("dueling").to_number<int64_t>()),
+		seconds(cfg.at("sidedecking").to_number<int64_t>()),
+		seconds(cfg.at("rematching").to_number<int64_t>())
+	};
+}
+
+// Bits of room IDs taken by the node ID, 0 if not clustered.
+inline unsigned int GetClusterNodeBits(const boost::json::value& cfg)
+{
+	const auto bits = cfg.at("nodeBits").to_number<unsigned int>();
+	const auto id = cfg.at("nodeId").to_number<uint32_t>();
+	if(bits == 0U)
+		return bits;
+	if(bits > 16U || id >= (1U << bits))
+		throw std::runtime_error(I18N::MULTIROLE_INCORRECT_CLUSTER_NODE);
+	return bits;
+}
+
+inline std::map<uint32_t, std::string> GetClusterNodeAddresses(const boost::json::value& cfg)
+{
+	std::map<uint32_t, std::string> addresses;
+	if(GetClusterNodeBits(cfg) == 0U)
+		return addresses;
+	for(const auto& n : cfg.at("nodes").as_array())
+		addresses.emplace(n.at("id").to_number<uint32_t>(), n.at("hostingAddress").as_string().data());
+	return addresses;
+}
+
+// Only made if there are other nodes to get rooms from.
+inline std::unique_ptr<Endpoint::ClusterRegistry> MakeClusterRegistry(
+	boost::asio::io_context& ioCtx,
+	const Lobby& lobby,
+	const boost::json::value& cfg)
+{
+	std::vector<Endpoint::ClusterRegistry::Node> nodes;
+	if(GetClusterNodeBits(cfg) != 0U)
+	{
+		for(const auto& n : cfg.at("nodes").as_array())
+		{
+			const auto id = n.at("id").to_number<uint32_t>();
+			if(id == lobby.NodeId())
+				continue;
+			nodes.push_back(
+			{
+				id,
+				n.at("listingHost").as_string().data(),
+				n.at("listingPort").to_number<unsigned short>()
+			});
+		}
+	}
+	if(nodes.empty())
+		return nullptr;
+	return std::make_unique<Endpoint::ClusterRegistry>(ioCtx, lobby, std::move(nodes));
+}
+
+inline std::vector<std::string> GetAdvertisedRelays(const boost::json::value& cfg)
+{
+	std::vector<std::string> relays;
+	for(const auto& r : cfg.at("advertised").as_array())
+		relays.emplace_back(r.as_string());
+	return relays;
+}
+
+inline Endpoint::RoomHosting::AdmissionLimits GetAdmissionLimits(const boost::json::value& cfg)
+{
+	return Endpoint::RoomHosting::AdmissionLimits
+	{
+		cfg.at("maxPendingHandshakes").to_number<std::size_t>(),
+		cfg.at("connectionsPerSecond").to_number<double>(),
+		cfg.at("connectionBurst").to_number<double>(),
+		std::chrono::milliseconds(cfg.at("handshakeTimeoutMs").to_number<int64_t>())
+	};
+}
+
+inline Endpoint::RoomHosting::Tuning GetRoomTuning(const boost::json::value& cfg)
+{
+	return Endpoint::RoomHosting::Tuning
+	{
+		std::chrono::microseconds(cfg.at("roomProcessBudgetUs").to_number<int64_t>()),
+		GetCostLimits(cfg.at("roomCostLimits")),
+		GetMemoryBudget(cfg.at("roomMemoryBudget")),
+		GetSendLimits(cfg.at("roomClientSendLimits")),
+		GetChatLimits(cfg.at("roomClientChatLimits")),
+		GetIdleTimeouts(cfg.at("roomIdleTimeoutsS")),
+		GetAdmissionLimits(cfg.at("roomHostingAdmission"))
+	};
+}
+
+inline Endpoint::RoomHosting::KeepAlive GetKeepAlive(const boost::json::value& cfg)
+{
+	using namespace std::chrono;
+	return Endpoint::RoomHosting::KeepAlive
+	{
+		seconds(cfg.at("idleS").to_number<int64_t>()),
+		seconds(cfg.at("intervalS").to_number<int64_t>()),
+		cfg.at("count").to_number<int>()
+	};
+}
+
+inline std::unique_ptr<AdaptivePool> MakeAdaptivePool(
+	boost::asio::io_context& rIoCtx,
+	boost::asio::io_context& lIoCtx,
+	const boost::json::value& cfg)
+{
+	const auto& acfg = cfg.at("adaptiveRooms");
+	if(!acfg.at("enabled").as_bool())
+		return nullptr;
+	const auto& limits = cfg.at("tuning").at("roomThreads");
+	const bool inProcessCore =
+		GetCoreType(cfg.at("coreProvider").at("coreType").as_string()) == Service::CoreProvider::CoreType::SHARED;
+	return std::make_unique<AdaptivePool>(
+		rIoCtx,
+		lIoCtx,
+		AdaptivePool::Options
+		{
+			limits.at("minThreads").to_number<std::size_t>(),
+			limits.at("maxThreads").to_number<std::size_t>(),
+			std::chrono::milliseconds(acfg.at("intervalMs").to_number<int64_t>()),
+			limits.at("targetBusyPercent").to_number<unsigned int>()
+		},
+		inProcessCore);
+}
+
+inline std::vector<unsigned int> GetCpus(const boost::json::value& cfg)
+{
+	std::vector<unsigned int> ret;
+	for(const auto& cpu : cfg.as_array())
+		ret.push_back(cpu.to_number<unsigned int>());
+	return ret;
+}
+
+inline Placement::Options GetPlacementOptions(const boost::json::value& cfg)
+{
+	const auto& cgroup = cfg.at("hornetCgroup");
+	return Placement::Options
+	{
+		GetCpus(cfg.at("hornetCpus")),
+		cgroup.at("path").as_string().data(),
+		cgroup.at("cpuMax").as_string().data(),
+		cgroup.at("memoryMax").as_string().data(),
+		GetCpus(cfg.at("ioCpus")),
+		cfg.at("ioNumaNode").to_number<int>()
+	};
+}
+
+inline LoadMonitor::Marks GetLoadMarks(const boost::json::value& cfg)
+{
+	return LoadMonitor::Marks
+	{
+		cfg.at("cpuPercent").to_number<unsigned int>(),
+		cfg.at("hornets").to_number<std::size_t>(),
+		cfg.at("fdPercent").to_number<unsigned int>(),
+		cfg.at("replaysQueued").to_number<std::size_t>()
+	};
+}
+
+inline spdlog::level::level_enum GetLogLevel(std::string_view str)
+{
+	const auto level = spdlog::level::from_str(std::string(str));
+	if(level == spdlog::level::off && str != "off")
+		throw std::runtime_error(I18N::MULTIROLE_INCORRECT_LOG_LEVEL);
+	return level;
+}
+
 // public
 
 Instance::Instance(const boost::json::value& cfg) :
 	whIoCtx(),
 	lIoCtx(),
 	lIoCtxGuard(boost::asio::make_work_guard(lIoCtx)),
+	rIoCtx(),
+	rIoCtxGuard(boost::asio::make_work_guard(rIoCtx)),
+	reactors(cfg.at("reactorCount").to_number<std::size_t>()),
+	reactorGuards(MakeWorkGuards(reactors)),
+	handoff(cfg.at("socketHandoffPath").as_string().data()),
 	hostingConcurrency(GetConcurrency(cfg.at("concurrencyHint").to_number<int>())),
+	roomsConcurrency(GetConcurrency(cfg.at("roomsConcurrencyHint").to_number<int>())),
+	placement(GetPlacementOptions(cfg.at("placement"))),
+	adaptiveRooms(MakeAdaptivePool(rIoCtx, lIoCtx, cfg)),
 	banlistProvider(cfg.at("banlistProvider").at("fileRegex").as_string()),
 	coreProvider(
 		cfg.at("coreProvider").at("fileRegex").as_string(),
 		cfg.at("coreProvider").at("tmpPath").as_string(),
 		GetCoreType(cfg.at("coreProvider").at("coreType").as_string()),
-		cfg.at("coreProvider").at("loadPerRoom").as_bool()),
-	dataProvider(cfg.at("dataProvider").at("fileRegex").as_string()),
+		cfg.at("coreProvider").at("loadPerRoom").as_bool(),
+		cfg.at("coreProvider").at("poolSize").to_number<std::size_t>(),
+		cfg.at("coreProvider").at("duelsPerHornet").to_number<std::size_t>(),
+		cfg.at("coreProvider").at("useZygote").as_bool(),
+		std::chrono::milliseconds(cfg.at("coreProvider").at("hangTimeoutMs").to_number<int64_t>()),
+		cfg.at("coreProvider").at("anonymousSegments").as_bool(),
+		cfg.at("coreProvider").at("hugePages").as_bool(),
+		GetHybridOptions(cfg.at("coreProvider").at("hybrid")),
+		placement),
+	dataProvider(
+		cfg.at("dataProvider").at("fileRegex").as_string(),
+		cfg.at("dataProvider").at("snapshotPath").as_string()),
 	replayManager(
 		cfg.at("replayManager").at("save").as_bool(),
-		cfg.at("replayManager").at("path").as_string()),
-	scriptProvider(cfg.at("scriptProvider").at("fileRegex").as_string()),
+		cfg.at("replayManager").at("path").as_string(),
+		cfg.at("replayManager").at("idBlockSize").to_number<uint64_t>(),
+		GetReplayWriteOptions(
+			cfg.at("replayManager"),
+			cfg.at("tuning").at("replaysMaxQueued").to_number<std::size_t>()),
+		GetReplayCompression(cfg.at("replayManager").at("clientCompression")),
+		GetReplayCompression(cfg.at("replayManager").at("diskCompression")),
+		GetReplayPackOptions(cfg.at("replayManager")),
+		cfg.at("replayManager").at("index").as_bool()),
+	scriptProvider(
+		cfg.at("scriptProvider").at("fileRegex").as_string(),
+		cfg.at("scriptProvider").at("bytecodeCompiler").as_string(),
+		cfg.at("scriptProvider").at("bytecodePath").as_string()),
 	service({banlistProvider, coreProvider, dataProvider,
 		replayManager, scriptProvider}),
-	lobby(),
+	lobby(
+		GetClusterNodeBits(cfg.at("cluster")),
+		cfg.at("cluster").at("nodeId").to_number<uint32_t>()),
+	clusterRegistry(MakeClusterRegistry(lIoCtx, lobby, cfg.at("cluster"))),
+	loadMonitor(
+		lIoCtx,
+		std::chrono::milliseconds(cfg.at("loadShedding").at("sampleIntervalMs").to_number<int64_t>()),
+		GetLoadMarks(cfg.at("tuning").at("loadShedding").at("soft")),
+		GetLoadMarks(cfg.at("tuning").at("loadShedding").at("hard"))),
 	lobbyListing(
 		lIoCtx,
+		reactors,
 		cfg.at("lobbyListingPort").to_number<unsigned short>(),
-		lobby),
+		lobby,
+		GetAdvertisedRelays(cfg.at("spectatorRelays")),
+		clusterRegistry.get(),
+		loadMonitor,
+		std::chrono::milliseconds(cfg.at("tuning").at("lobbyListingIntervalMs").to_number<int64_t>())),
 	roomHosting(
 		lIoCtx,
+		rIoCtx,
+		reactors,
 		service,
 		lobby,
-		cfg.at("roomHostingPort").to_number<unsigned short>()),
+		cfg.at("roomHostingPort").to_number<unsigned short>(),
+		GetRoomTuning(cfg.at("tuning")),
+		cfg.at("roomQueryDeltas").as_bool(),
+		GetKeepAlive(cfg.at("roomKeepAlive")),
+		cfg.at("spectatorRelays").at("token").as_string().data(),
+		GetClusterNodeAddresses(cfg.at("cluster")),
+		loadMonitor),
+	stats(lIoCtx, cfg.at("statsPort").to_number<unsigned short>(), lobby, [this]()
+	{
+		return ReloadTuning();
+	}),
 	signalSet(lIoCtx)
 {
-	// Load up and update repositories while also adding them to the std::map
-	for(const auto& opts : cfg.at("repos").as_array())
+	spdlog::set_level(GetLogLevel(cfg.at("tuning").at("logLevel").as_string()));
+	Room::DuelTrace::Configure(
 	{
-		auto name = opts.at("name").as_string().data();
-		spdlog::info(I18N::MULTIROLE_ADDING_REPO, name);
-		repos.emplace(
-			std::piecewise_construct,
-			std::forward_as_tuple(name),
-			std::forward_as_tuple(whIoCtx, opts));
-	}
-	// Register respective providers on their observed repositories
+		cfg.at("roomTracing").at("path").as_string().data(),
+		cfg.at("roomTracing").at("sampleEvery").to_number<uint64_t>()
+	});
+	// Observers of each repository, in the order they are registered
+	std::map<std::string, std::vector<IGitRepoObserver*>> observers;
+	for(const auto& opts : cfg.at("repos").as_array())
+		observers[opts.at("name").as_string().data()];
 	auto RegRepos = [&](IGitRepoObserver& obs, const boost::json::value& v)
 	{
 		for(const auto& observed : v.at("observedRepos").as_array())
-			repos.at(observed.as_string().data()).AddObserver(obs);
+			observers.at(observed.as_string().data()).push_back(&obs);
 	};
 	RegRepos(dataProvider, cfg.at("dataProvider"));
 	RegRepos(scriptProvider, cfg.at("scriptProvider"));
 	RegRepos(banlistProvider, cfg.at("banlistProvider"));
 	RegRepos(coreProvider, cfg.at("coreProvider"));
+	// Load up and update repositories and then register their providers,
+	// each repository on its own thread as none depends on the others.
+	// NOTE: Providers observing several repositories serialize their
+	// loads on their own.
+	for(const auto& opts : cfg.at("repos").as_array())
+		repos[opts.at("name").as_string().data()];
+	std::vector<std::thread> loaders;
+	std::vector<std::exception_ptr> errors(repos.size());
+	for(auto& [name, repo] : repos)
+	{
+		const auto& opts = *std::find_if(
+			cfg.at("repos").as_array().begin(),
+			cfg.at("repos").as_array().end(),
+			[&n = name](const boost::json::value& v)
+		{
+			return v.at("name").as_string() == n;
+		});
+		loaders.emplace_back([&, &error = errors[loaders.size()], &name = name, &repo = repo, &opts = opts]()
+		{
+			try
+			{
+				spdlog::info(I18N::MULTIROLE_ADDING_REPO, name);
+				repo = std::make_unique<GitRepo>(whIoCtx, opts);
+				for(auto* obs : observers.at(name))
+					repo->AddObserver(*obs);
+			}
+			catch(...)
+			{
+				error = std::current_exception();
+			}
+		});
+	}
+	for(auto& loader : loaders)
+		loader.join();
+	for(const auto& error : errors)
+		if(error)
+			std::rethrow_exception(error);
+	// Serve spectators of another instance, if configured to.
+	if(const auto& relaying = cfg.at("relaying"); relaying.at("port").to_number<unsigned short>() != 0U)
+	{
+		spectatorRelay = std::make_unique<Endpoint::SpectatorRelay>(
+			lIoCtx,
+			relaying.at("port").to_number<unsigned short>(),
+			Endpoint::SpectatorRelay::Origin
+			{
+				relaying.at("originHost").as_string().data(),
+				relaying.at("originPort").to_number<unsigned short>(),
+				relaying.at("token").as_string().data()
+			},
+			GetSendLimits(cfg.at("tuning").at("roomClientSendLimits")));
+	}
 	// Register signal
 	spdlog::info(I18N::MULTIROLE_SETUP_SIGNAL);
 	signalSet.add(SIGTERM);
-	signalSet.async_wait([this](std::error_code /*unused*/, int /*unused*/)
+#ifdef SIGHUP
+	signalSet.add(SIGHUP);
+#endif // SIGHUP
+	DoWaitSignal();
+	spdlog::info(I18N::MULTIROLE_HOSTING_THREADS_NUM, hostingConcurrency);
+	spdlog::info(adaptiveRooms ? I18N::MULTIROLE_ROOMS_THREADS_ADAPTIVE : I18N::MULTIROLE_ROOMS_THREADS_NUM, roomsConcurrency);
+	if(!reactors.empty())
+		spdlog::info(I18N::MULTIROLE_REACTORS_NUM, reactors.size());
+	// Hand the listening sockets off to the next process that asks for
+	// them, stopping right after as if SIGTERM was received.
+	handoff.Serve(lIoCtx, [this]()
 	{
-		spdlog::info(I18N::MULTIROLE_SIGNAL_RECEIVED);
 		Stop();
 	});
-	spdlog::info(I18N::MULTIROLE_HOSTING_THREADS_NUM, hostingConcurrency);
 	spdlog::info(I18N::MULTIROLE_INIT_SUCCESS);
 }
 
@@ -100,22 +518,132 @@ int Instance::Run()
 	std::thread webhooks([&]{whIoCtx.run();});
 	boost::asio::thread_pool threads(hostingConcurrency);
 	for(unsigned int i = 0U; i < hostingConcurrency; i++)
-		boost::asio::dispatch(threads, [&]{lIoCtx.run();});
+	{
+		boost::asio::dispatch(threads, [&]
+		{
+			placement.PinIoThread();
+			lIoCtx.run();
+		});
+	}
+	// Rooms run on their own threads so that a slow core call doesn't keep
+	// the hosting threads from serving sockets of other rooms.
+	// NOTE: Either a fixed amount of them or an adaptive one.
+	std::optional<boost::asio::thread_pool> roomThreads;
+	if(adaptiveRooms)
+	{
+		adaptiveRooms->Start(roomsConcurrency);
+	}
+	else
+	{
+		roomThreads.emplace(roomsConcurrency);
+		for(unsigned int i = 0U; i < roomsConcurrency; i++)
+			boost::asio::dispatch(*roomThreads, [&]{rIoCtx.run();});
+	}
+	// Reactors serve their own sockets and rooms, one thread each.
+	boost::asio::thread_pool reactorThreads(std::max<std::size_t>(1U, reactors.size()));
+	for(auto& reactor : reactors)
+	{
+		boost::asio::dispatch(reactorThreads, [&p = placement, &r = reactor]
+		{
+			p.PinIoThread();
+			r.run();
+		});
+	}
 	webhooks.join();
 	threads.join();
+	if(roomThreads)
+		roomThreads->join();
+	else
+		adaptiveRooms->Join();
+	reactorThreads.join();
 	return EXIT_SUCCESS;
 }
 
 // private
 
+void Instance::DoWaitSignal()
+{
+	signalSet.async_wait([this](std::error_code ec, int sig)
+	{
+		if(ec)
+			return;
+#ifdef SIGHUP
+		if(sig == SIGHUP)
+		{
+			ReloadTuning();
+			DoWaitSignal();
+			return;
+		}
+#endif // SIGHUP
+		spdlog::info(I18N::MULTIROLE_SIGNAL_RECEIVED);
+		Stop();
+	});
+}
+
+bool Instance::ReloadTuning()
+{
+	std::scoped_lock lock(mTuning);
+	spdlog::info(I18N::MULTIROLE_RELOADING_TUNING);
+	try
+	{
+		std::ifstream f(CONFIG_FILE);
+		boost::json::stream_parser p;
+		for(std::string l; std::getline(f, l);)
+			p.write(l);
+		p.finish();
+		ApplyTuning(p.release().at("tuning"));
+	}
+	catch(const std::exception& e)
+	{
+		spdlog::error(I18N::MULTIROLE_TUNING_RELOAD_FAILED, e.what());
+		return false;
+	}
+	spdlog::info(I18N::MULTIROLE_TUNING_RELOADED);
+	return true;
+}
+
+void Instance::ApplyTuning(const boost::json::value& cfg)
+{
+	const auto logLevel = GetLogLevel(cfg.at("logLevel").as_string());
+	const std::chrono::milliseconds listingInterval(cfg.at("lobbyListingIntervalMs").to_number<int64_t>());
+	const auto& threads = cfg.at("roomThreads");
+	const auto minThreads = threads.at("minThreads").to_number<std::size_t>();
+	const auto maxThreads = threads.at("maxThreads").to_number<std::size_t>();
+	const auto targetBusyPercent = threads.at("targetBusyPercent").to_number<unsigned int>();
+	const auto roomTuning = GetRoomTuning(cfg);
+	const auto softMarks = GetLoadMarks(cfg.at("loadShedding").at("soft"));
+	const auto hardMarks = GetLoadMarks(cfg.at("loadShedding").at("hard"));
+	const auto replaysMaxQueued = cfg.at("replaysMaxQueued").to_number<std::size_t>();
+	// Nothing is applied until all of it was read.
+	spdlog::set_level(logLevel);
+	lobbyListing.SetSerializeInterval(listingInterval);
+	if(adaptiveRooms)
+		adaptiveRooms->SetLimits(minThreads, maxThreads, targetBusyPercent);
+	roomHosting.SetTuning(roomTuning);
+	loadMonitor.SetMarks(softMarks, hardMarks);
+	replayManager.SetMaxQueued(replaysMaxQueued);
+}
+
 void Instance::Stop()
 {
 	spdlog::info(I18N::MULTIROLE_CLEANING_UP);
 	whIoCtx.stop(); // Finishes execution of thread created in Instance::Run
 	lIoCtxGuard.reset(); // Allows hosting threads to finish execution
+	rIoCtxGuard.reset(); // Same for rooms threads, once all rooms are done
+	if(adaptiveRooms)
+		adaptiveRooms->Stop();
+	reactorGuards.clear(); // Same for reactors threads
 	repos.clear(); // Closes repositories (so other process can acquire locks)
+	handoff.Stop();
+	signalSet.cancel();
 	lobbyListing.Stop();
+	if(clusterRegistry)
+		clusterRegistry->Stop();
+	loadMonitor.Stop();
 	roomHosting.Stop();
+	if(spectatorRelay)
+		spectatorRelay->Stop();
+	stats.Stop();
 	const auto startedRoomsCount = lobby.GetStartedRoomsCount();
 	lobby.CloseNonStartedRooms();
 	if(startedRoomsCount > 0U)
@@ -1,16 +1,26 @@
 #ifndef SERVERINSTANCE_HPP
 #define SERVERINSTANCE_HPP
 #include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
 
 #include <boost/asio/io_context.hpp>
 #include <boost/asio/signal_set.hpp>
 #include <boost/json/fwd.hpp>
 
+#include "AdaptivePool.hpp"
 #include "GitRepo.hpp"
+#include "LoadMonitor.hpp"
 #include "Lobby.hpp"
+#include "Placement.hpp"
 #include "Service.hpp"
+#include "Endpoint/ClusterRegistry.hpp"
 #include "Endpoint/LobbyListing.hpp"
 #include "Endpoint/RoomHosting.hpp"
+#include "Endpoint/SocketHandoff.hpp"
+#include "Endpoint/SpectatorRelay.hpp"
+#include "Endpoint/Stats.hpp"
 #include "Service/BanlistProvider.hpp"
 #include "Service/CoreProvider.hpp"
 #include "Service/DataProvider.hpp"
@@ -29,7 +39,15 @@ private:
 	boost::asio::io_context whIoCtx; // Webhooks Io Context
 	boost::asio::io_context lIoCtx; // Lobby Io Context
 	boost::asio::executor_work_guard<boost::asio::io_context::executor_type> lIoCtxGuard;
+	boost::asio::io_context rIoCtx; // Rooms Io Context (duel processing)
+	boost::asio::executor_work_guard<boost::asio::io_context::executor_type> rIoCtxGuard;
+	Endpoint::Reactors reactors; // Each one runs on its own thread.
+	std::vector<boost::asio::executor_work_guard<boost::asio::io_context::executor_type>> reactorGuards;
+	Endpoint::SocketHandoff handoff; // Before anything that listens.
 	unsigned int hostingConcurrency;
+	unsigned int roomsConcurrency;
+	Placement placement;
+	std::unique_ptr<AdaptivePool> adaptiveRooms; // Optional, runs rIoCtx.
 	Service::BanlistProvider banlistProvider;
 	Service::CoreProvider coreProvider;
 	Service::DataProvider dataProvider;
@@ -38,12 +56,22 @@ private:
 	Service::ScriptProvider scriptProvider;
 	Service service;
 	Lobby lobby;
+	std::unique_ptr<Endpoint::ClusterRegistry> clusterRegistry; // Optional.
+	LoadMonitor loadMonitor;
 	Endpoint::LobbyListing lobbyListing;
 	Endpoint::RoomHosting roomHosting;
+	Endpoint::Stats stats;
+	std::unique_ptr<Endpoint::SpectatorRelay> spectatorRelay; // Optional.
 	boost::asio::signal_set signalSet;
-	std::map<std::string, GitRepo> repos;
+	std::map<std::string, std::unique_ptr<GitRepo>> repos;
+	std::mutex mTuning; // Keeps reloads from interleaving.
 
 	void DoWaitSignal();
+	// Reads the tuning section of the configuration file again and applies
+	// it, logging whether it could.
+	bool ReloadTuning();
+	// Applies the whole tuning or, if any of it is wrong, none of it.
+	void ApplyTuning(const boost::json::value& cfg);
 	void Stop();
 };
 
@@ -0,0 +1,149 @@
+#include "LoadMonitor.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <system_error>
+
+#ifdef __linux__
+#include <sys/resource.h>
+
+#include <filesystem>
+#endif // __linux__
+#include <spdlog/spdlog.h>
+
+#include "I18N.hpp"
+#include "Core/HornetStats.hpp"
+#include "Room/Stats.hpp"
+
+namespace Ignis::Multirole
+{
+
+constexpr std::string_view LevelName(LoadMonitor::Level l)
+{
+	switch(l)
+	{
+	case LoadMonitor::Level::NORMAL: return "normal";
+	case LoadMonitor::Level::BUSY: return "busy";
+	case LoadMonitor::Level::SATURATED: return "saturated";
+	}
+	return "";
+}
+
+template<typename T>
+constexpr bool Reaches(T value, T mark)
+{
+	return mark != 0U && value >= mark;
+}
+
+// public
+
+LoadMonitor::LoadMonitor(
+	boost::asio::io_context& ioCtx,
+	std::chrono::milliseconds interval,
+	Marks soft,
+	Marks hard)
+	:
+	timer(ioCtx),
+	interval(std::max(interval, std::chrono::milliseconds(100))),
+	soft(soft),
+	hard(hard),
+	level(Level::NORMAL),
+	cpuBusy(0U),
+	cpuTotal(0U)
+{
+	TakeSample(); // Sets the CPU times the first sample is relative to.
+	DoSample();
+}
+
+void LoadMonitor::Stop()
+{
+	timer.cancel();
+}
+
+void LoadMonitor::SetMarks(Marks softMarks, Marks hardMarks)
+{
+	std::scoped_lock lock(mMarks);
+	soft = softMarks;
+	hard = hardMarks;
+}
+
+LoadMonitor::Level LoadMonitor::GetLevel() const
+{
+	return level.load(std::memory_order_relaxed);
+}
+
+// private
+
+LoadMonitor::Sample LoadMonitor::TakeSample()
+{
+	Sample s{};
+	s.hornets = static_cast<std::size_t>(std::max<int64_t>(Core::HornetStats::Get().Processes(), 0));
+	s.replaysQueued = static_cast<std::size_t>(std::max<int64_t>(Room::Stats::Get().ReplaysQueued(), 0));
+#ifdef __linux__
+	// NOTE: The first line of /proc/stat adds up the time every CPU spent
+	// on each kind of work, in order: user, nice, system, idle, iowait,
+	// irq, softirq and steal.
+	if(std::ifstream stat("/proc/stat"); stat)
+	{
+		std::string cpu;
+		uint64_t times[8U] = {};
+		stat >> cpu;
+		for(auto& t : times)
+			stat >> t;
+		if(stat && cpu == "cpu")
+		{
+			uint64_t total = 0U;
+			for(const auto t : times)
+				total += t;
+			const uint64_t busy = total - times[3U] - times[4U];
+			if(total > cpuTotal && busy >= cpuBusy)
+				s.cpuPercent = static_cast<unsigned int>((busy - cpuBusy) * 100U / (total - cpuTotal));
+			cpuBusy = busy;
+			cpuTotal = total;
+		}
+	}
+	if(rlimit lim{}; getrlimit(RLIMIT_NOFILE, &lim) == 0 && lim.rlim_cur != RLIM_INFINITY && lim.rlim_cur != 0U)
+	{
+		std::error_code ec;
+		std::size_t open = 0U;
+		for(std::filesystem::directory_iterator it("/proc/self/fd", ec), last; !ec && it != last; it.increment(ec))
+			open++;
+		if(!ec)
+			s.fdPercent = static_cast<unsigned int>(open * 100U / lim.rlim_cur);
+	}
+#endif // __linux__
+	return s;
+}
+
+void LoadMonitor::DoSample()
+{
+	timer.expires_after(interval);
+	timer.async_wait([this](boost::system::error_code ec)
+	{
+		if(ec)
+			return;
+		const auto s = TakeSample();
+		const auto Over = [&s](const Marks& m)
+		{
+			return Reaches(s.cpuPercent, m.cpuPercent) ||
+			       Reaches(s.hornets, m.hornets) ||
+			       Reaches(s.fdPercent, m.fdPercent) ||
+			       Reaches(s.replaysQueued, m.replaysQueued);
+		};
+		const auto next = [&]()
+		{
+			std::scoped_lock lock(mMarks);
+			return Over(hard) ? Level::SATURATED :
+				Over(soft) ? Level::BUSY : Level::NORMAL;
+		}();
+		if(level.exchange(next, std::memory_order_relaxed) != next)
+		{
+			spdlog::info(I18N::LOAD_MONITOR_LEVEL_CHANGED, LevelName(next),
+				s.cpuPercent, s.hornets, s.fdPercent, s.replaysQueued);
+		}
+		DoSample();
+	});
+}
+
+} // namespace Ignis::Multirole
@@ -0,0 +1,74 @@
+#ifndef LOADMONITOR_HPP
+#define LOADMONITOR_HPP
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+namespace Ignis::Multirole
+{
+
+// Samples how loaded the node is, so that it can shed new rooms before
+// every room it hosts starts lagging. Past any soft mark the node is busy,
+// which the listing advertises, and past any hard mark it is saturated,
+// which makes room hosting refuse new rooms while still letting clients
+// join the existing ones.
+class LoadMonitor final
+{
+public:
+	enum class Level
+	{
+		NORMAL = 0,
+		BUSY,
+		SATURATED
+	};
+
+	// Marks of each signal, a signal is not checked if its mark is 0.
+	struct Marks
+	{
+		unsigned int cpuPercent; // Of all CPUs, used by the whole system.
+		std::size_t hornets; // Live hornet processes.
+		unsigned int fdPercent; // Of the open file descriptors limit.
+		std::size_t replaysQueued; // Waiting to be written.
+	};
+
+	LoadMonitor(
+		boost::asio::io_context& ioCtx,
+		std::chrono::milliseconds interval,
+		Marks soft,
+		Marks hard);
+	void Stop();
+
+	// Takes effect on the next sample.
+	void SetMarks(Marks softMarks, Marks hardMarks);
+
+	Level GetLevel() const;
+private:
+	struct Sample
+	{
+		unsigned int cpuPercent;
+		std::size_t hornets;
+		unsigned int fdPercent;
+		std::size_t replaysQueued;
+	};
+
+	boost::asio::steady_timer timer;
+	const std::chrono::milliseconds interval;
+	Marks soft;
+	Marks hard;
+	std::mutex mMarks;
+	std::atomic<Level> level;
+	// CPU times of the previous sample, to tell usage since then.
+	uint64_t cpuBusy;
+	uint64_t cpuTotal;
+
+	Sample TakeSample();
+	void DoSample();
+};
+
+} // namespace Ignis::Multirole
+
+#endif // LOADMONITOR_HPP
@@ -1,10 +1,17 @@
 #include "Lobby.hpp"
 
 #include <chrono>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+#include "I18N.hpp"
 
 namespace Ignis::Multirole
 {
 
+constexpr auto ID_REUSE_DELAY = std::chrono::minutes(1);
+
 std::chrono::time_point<std::chrono::system_clock>::rep TimeNowInt()
 {
 	return std::chrono::system_clock::now().time_since_epoch().count();
@@ -12,14 +19,29 @@ std::chrono::time_point<std::chrono::system_clock>::rep TimeNowInt()
 
 // public
 
-Lobby::Lobby() : rng(static_cast<std::mt19937::result_type>(TimeNowInt()))
+Lobby::Lobby(unsigned int nodeBits, uint32_t nodeId) :
+	nodeBits(nodeBits),
+	nodeId(nodeId),
+	rng(static_cast<std::mt19937::result_type>(TimeNowInt())),
+	nextId(1U)
 {}
 
+uint32_t Lobby::NodeOf(uint32_t id) const
+{
+	return (nodeBits == 0U) ? 0U : id >> (32U - nodeBits);
+}
+
+uint32_t Lobby::NodeId() const
+{
+	return nodeId;
+}
+
 std::shared_ptr<Room::Instance> Lobby::GetRoomById(uint32_t id) const
 {
-	std::shared_lock lock(mRooms);
-	auto search = rooms.find(id);
-	if(search != rooms.end())
+	const auto& shard = ShardOf(id);
+	std::shared_lock lock(shard.mRooms);
+	auto search = shard.rooms.find(id);
+	if(search != shard.rooms.end())
 		return search->second.lock();
 	return nullptr;
 }
@@ -27,59 +49,116 @@ std::shared_ptr<Room::Instance> Lobby::GetRoomById(uint32_t id) const
 std::size_t Lobby::GetStartedRoomsCount() const
 {
 	std::size_t count = 0U;
-	std::shared_lock lock(mRooms);
-	for(const auto& kv : rooms)
-		if(auto room = kv.second.lock(); room)
-			count += static_cast<std::size_t>(room->Started());
+	ForEachRoom([&](uint32_t /*unused*/, const Room::Instance& room)
+	{
+		count += static_cast<std::size_t>(room.Started());
+	});
 	return count;
 }
 
 std::shared_ptr<Room::Instance> Lobby::MakeRoom(Room::Instance::CreateInfo& info)
 {
-	std::scoped_lock lock(mRooms);
-	for(uint32_t newId = 1U; true; newId++)
 	{
-		if(rooms.count(newId) == 0U)
+		std::scoped_lock lock(mIds);
+		const auto id = AcquireId();
+		if(!id)
 		{
-			info.id = newId;
-			break;
+			spdlog::error(I18N::LOBBY_OUT_OF_IDS);
+			return nullptr;
 		}
+		info.id = *id;
+		info.seed = rng();
 	}
-	info.seed = rng();
+	info.expiryHook = [this, id = info.id]()
+	{
+		Unregister(id);
+	};
 	auto room = std::make_shared<Room::Instance>(info);
-	rooms.emplace(info.id, room);
+	auto& shard = ShardOf(info.id);
+	std::scoped_lock lock(shard.mRooms);
+	shard.rooms.emplace(info.id, room);
 	return room;
 }
 
 void Lobby::CollectRooms(const std::function<void(const RoomProps&)>& f)
 {
 	RoomProps props{};
-	std::shared_lock lock(mRooms);
-	for(auto it = rooms.begin(), last = rooms.end(); it != last;)
+	ForEachRoom([&](uint32_t id, const Room::Instance& r)
 	{
-		if(auto room = it->second.lock(); room)
-		{
-			props.id = it->first;
-			auto& r = *room;
-			props.hostInfo = &r.HostInfo();
-			props.notes = &r.Notes();
-			props.passworded = r.IsPrivate();
-			props.started = r.Started();
-			props.duelists = r.DuelistNames();
-			f(props);
-			++it;
-			continue;
-		}
-		it = rooms.erase(it);
-	}
+		const auto listing = r.Listing();
+		props.id = id;
+		props.hostInfo = &r.HostInfo();
+		props.notes = &r.Notes();
+		props.passworded = r.IsPrivate();
+		props.listing = listing.get();
+		f(props);
+	});
 }
 
 void Lobby::CloseNonStartedRooms()
 {
-	std::scoped_lock lock(mRooms);
-	for(auto& kv : rooms)
-		if(auto room = kv.second.lock(); room)
-			room->TryClose();
+	ForEachRoom([&](uint32_t /*unused*/, Room::Instance& room)
+	{
+		room.TryClose();
+	});
+}
+
+// private
+
+Lobby::Shard& Lobby::ShardOf(uint32_t id)
+{
+	return shards[id % SHARD_COUNT];
+}
+
+const Lobby::Shard& Lobby::ShardOf(uint32_t id) const
+{
+	return shards[id % SHARD_COUNT];
+}
+
+std::optional<uint32_t> Lobby::AcquireId()
+{
+	if(!freedIds.empty() &&
+	   freedIds.front().second + ID_REUSE_DELAY <= std::chrono::steady_clock::now())
+	{
+		const uint32_t id = freedIds.front().first;
+		freedIds.pop_front();
+		return id;
+	}
+	// NOTE: Every ID given is either in use or waiting to be reused, so
+	// wrapping around would hand out the same ID twice.
+	if(nextId >= (uint64_t{1U} << (32U - nodeBits)))
+		return std::nullopt;
+	const auto id = static_cast<uint32_t>(nextId++);
+	return (nodeBits == 0U) ? id : id | (nodeId << (32U - nodeBits));
+}
+
+void Lobby::Unregister(uint32_t id)
+{
+	{
+		auto& shard = ShardOf(id);
+		std::scoped_lock lock(shard.mRooms);
+		shard.rooms.erase(id);
+	}
+	std::scoped_lock lock(mIds);
+	freedIds.emplace_back(id, std::chrono::steady_clock::now());
+}
+
+template<typename F>
+void Lobby::ForEachRoom(F&& f) const
+{
+	std::vector<std::pair<uint32_t, std::shared_ptr<Room::Instance>>> live;
+	for(const auto& shard : shards)
+	{
+		{
+			std::shared_lock lock(shard.mRooms);
+			for(const auto& kv : shard.rooms)
+				if(auto room = kv.second.lock(); room)
+					live.emplace_back(kv.first, std::move(room));
+		}
+		for(const auto& [id, room] : live)
+			f(id, *room);
+		live.clear();
+	}
 }
 
 } // namespace Ignis::Multirole
@@ -1,7 +1,12 @@
 #ifndef LOBBY_HPP
 #define LOBBY_HPP
+#include <array>
+#include <chrono>
+#include <deque>
 #include <functional>
 #include <list>
+#include <mutex>
+#include <optional>
 #include <shared_mutex>
 #include <random>
 #include <unordered_map>
@@ -14,35 +19,76 @@ namespace Ignis::Multirole
 class Lobby final
 {
 public:
-	// Queried data about the room used for listing.
+	// Queried data about the room used for listing. Everything is either
+	// immutable or part of the published listing state of the room, so
+	// collecting rooms never waits on their strands.
 	struct RoomProps
 	{
 		uint32_t id;
 		const YGOPro::HostInfo* hostInfo;
 		const std::string* notes;
-		bool passworded : 1;
-		bool started : 1;
-		std::map<uint8_t, std::string> duelists;
+		bool passworded;
+		const Room::Instance::ListingProps* listing;
 	};
 
-	Lobby();
+	// Rooms get `nodeId` in the upper `nodeBits` bits of their IDs, so that
+	// IDs given by different nodes of a cluster never collide.
+	Lobby(unsigned int nodeBits = 0U, uint32_t nodeId = 0U);
+
+	// Node of the cluster that gave the ID, always 0 if not clustered.
+	uint32_t NodeOf(uint32_t id) const;
+	uint32_t NodeId() const;
 
 	std::shared_ptr<Room::Instance> GetRoomById(uint32_t id) const;
 	std::size_t GetStartedRoomsCount() const;
 
-	// Creates a single room and adds it to the dictionary.
+	// Creates a single room and adds it to the dictionary, the room removes
+	// itself once destroyed. IDs of removed rooms are given to new rooms
+	// again only after a while, so that clients with a stale listing don't
+	// end up joining the wrong room. Returns null if there is no ID left.
 	std::shared_ptr<Room::Instance> MakeRoom(Room::Instance::CreateInfo& info);
 
-	// Removes dead rooms from the dictionary and calls function f for each
-	// non-dead room with its properties as argument.
+	// Calls function f for each non-dead room with its properties as
+	// argument.
 	void CollectRooms(const std::function<void(const RoomProps&)>& f);
 
 	// Attempts to close all rooms whose state is not Waiting.
 	void CloseNonStartedRooms();
 private:
+	// Rooms are spread among shards by their ID, so that lookups, creation
+	// and removal of rooms in different shards don't contend for a lock.
+	struct Shard
+	{
+		std::unordered_map<uint32_t, std::weak_ptr<Room::Instance>> rooms;
+		mutable std::shared_mutex mRooms;
+	};
+	static constexpr std::size_t SHARD_COUNT = 16U;
+
+	const unsigned int nodeBits;
+	const uint32_t nodeId;
+	std::array<Shard, SHARD_COUNT> shards;
 	std::mt19937 rng;
-	std::unordered_map<uint32_t, std::weak_ptr<Room::Instance>> rooms;
-	mutable std::shared_mutex mRooms;
+	uint64_t nextId; // Lowest ID never given to a room.
+	// IDs of removed rooms along with when they were removed, oldest first.
+	std::deque<std::pair<uint32_t, std::chrono::steady_clock::time_point>> freedIds;
+	std::mutex mIds; // used for rng, nextId and freedIds.
+
+	Shard& ShardOf(uint32_t id);
+	const Shard& ShardOf(uint32_t id) const;
+
+	// Gives the oldest freed ID that can be reused already, or a new one if
+	// there's any left below the node bits. mIds must be held.
+	std::optional<uint32_t> AcquireId();
+
+	// Expiry hook of every room, removes it from its shard.
+	void Unregister(uint32_t id);
+
+	// Calls `f(id, room)` for each non-dead room. The rooms of each shard
+	// are taken before calling f without holding any lock, because if f
+	// happened to drop the last reference to a room, its expiry hook would
+	// try to lock the shard.
+	template<typename F>
+	void ForEachRoom(F&& f) const;
 };
 
 } // namespace Ignis::Multirole
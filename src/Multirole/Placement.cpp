@@ -0,0 +1,153 @@
+#include "Placement.hpp"
+
+#include <fstream>
+#include <system_error>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+
+#include <filesystem>
+#endif // __linux__
+#include <spdlog/spdlog.h>
+
+#include "I18N.hpp"
+
+namespace Ignis::Multirole
+{
+
+#ifdef __linux__
+// Parses a CPU list as found on sysfs, such as "0-3,8,10-11".
+inline std::vector<unsigned int> ParseCpuList(const std::string& str)
+{
+	std::vector<unsigned int> cpus;
+	std::size_t pos = 0U;
+	while(pos < str.size())
+	{
+		std::size_t end = str.find(',', pos);
+		if(end == std::string::npos)
+			end = str.size();
+		const auto range = str.substr(pos, end - pos);
+		unsigned int first = 0U;
+		unsigned int last = 0U;
+		if(const auto dash = range.find('-'); dash != std::string::npos)
+		{
+			first = static_cast<unsigned int>(std::stoul(range.substr(0U, dash)));
+			last = static_cast<unsigned int>(std::stoul(range.substr(dash + 1U)));
+		}
+		else if(!range.empty() && range != "\n")
+		{
+			first = last = static_cast<unsigned int>(std::stoul(range));
+		}
+		else
+		{
+			pos = end + 1U;
+			continue;
+		}
+		for(unsigned int cpu = first; cpu <= last; cpu++)
+			cpus.push_back(cpu);
+		pos = end + 1U;
+	}
+	return cpus;
+}
+
+inline cpu_set_t MakeCpuSet(const std::vector<unsigned int>& cpus)
+{
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for(const auto cpu : cpus)
+		if(cpu < CPU_SETSIZE)
+			CPU_SET(cpu, &set);
+	return set;
+}
+
+// Writes `value` onto a file of the cgroup at `dir`.
+inline bool WriteCgroupFile(const std::string& dir, std::string_view file, std::string_view value)
+{
+	std::ofstream f(std::string(dir).append("/").append(file));
+	f << value;
+	f.flush();
+	return static_cast<bool>(f);
+}
+#endif // __linux__
+
+// public
+
+Placement::Placement(Options&& options) :
+	opts(std::move(options)),
+	nextIoCpu(0U)
+{
+#ifdef __linux__
+	if(opts.ioCpus.empty() && opts.ioNumaNode >= 0)
+	{
+		const auto path = "/sys/devices/system/node/node" + std::to_string(opts.ioNumaNode) + "/cpulist";
+		std::string list;
+		if(std::ifstream f(path); f)
+			std::getline(f, list);
+		try
+		{
+			ioNodeCpus = ParseCpuList(list);
+		}
+		catch(const std::exception& /*unused*/)
+		{
+			ioNodeCpus.clear();
+		}
+		if(ioNodeCpus.empty())
+			spdlog::warn(I18N::PLACEMENT_NUMA_NODE_UNKNOWN, opts.ioNumaNode);
+	}
+	if(opts.hornetCgroup.empty())
+		return;
+	std::error_code ec;
+	std::filesystem::create_directories(opts.hornetCgroup, ec);
+	if(ec)
+	{
+		spdlog::error(I18N::PLACEMENT_CGROUP_SETUP_FAILED, opts.hornetCgroup, ec.message());
+		return;
+	}
+	// NOTE: Fails unless the controllers are enabled on the parent cgroup,
+	// see cgroup.subtree_control.
+	if(!opts.hornetCpuMax.empty() && !WriteCgroupFile(opts.hornetCgroup, "cpu.max", opts.hornetCpuMax))
+		spdlog::error(I18N::PLACEMENT_CGROUP_SETUP_FAILED, opts.hornetCgroup, "cpu.max");
+	if(!opts.hornetMemoryMax.empty() && !WriteCgroupFile(opts.hornetCgroup, "memory.max", opts.hornetMemoryMax))
+		spdlog::error(I18N::PLACEMENT_CGROUP_SETUP_FAILED, opts.hornetCgroup, "memory.max");
+#endif // __linux__
+}
+
+void Placement::PlaceHornet([[maybe_unused]] Process::Data proc) const
+{
+#ifdef __linux__
+	if(!opts.hornetCgroup.empty() &&
+	   !WriteCgroupFile(opts.hornetCgroup, "cgroup.procs", std::to_string(proc)))
+		spdlog::warn(I18N::PLACEMENT_CGROUP_MOVE_FAILED, proc, opts.hornetCgroup);
+	if(opts.hornetCpus.empty())
+		return;
+	const auto set = MakeCpuSet(opts.hornetCpus);
+	if(sched_setaffinity(proc, sizeof(set), &set) != 0)
+		spdlog::warn(I18N::PLACEMENT_PIN_FAILED);
+#endif // __linux__
+}
+
+void Placement::PinIoThread()
+{
+#ifdef __linux__
+	cpu_set_t set;
+	if(!opts.ioCpus.empty())
+	{
+		const auto i = nextIoCpu.fetch_add(1U, std::memory_order_relaxed);
+		set = MakeCpuSet({opts.ioCpus[i % opts.ioCpus.size()]});
+	}
+	else if(!ioNodeCpus.empty())
+	{
+		// NOTE: The whole node, the scheduler balances threads within it.
+		set = MakeCpuSet(ioNodeCpus);
+	}
+	else
+	{
+		return;
+	}
+	if(pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+		spdlog::warn(I18N::PLACEMENT_PIN_FAILED);
+#endif // __linux__
+}
+
+} // namespace Ignis::Multirole
@@ -0,0 +1,50 @@
+#ifndef PLACEMENT_HPP
+#define PLACEMENT_HPP
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "../Process.hpp"
+
+namespace Ignis::Multirole
+{
+
+// Keeps hornet processes from competing with the io threads for the same
+// CPUs, so that a runaway core doesn't make networking lag. Hornets can be
+// moved onto a cgroup (v2) that caps their CPU and memory usage and pinned
+// to a set of CPUs, while io threads can be pinned to CPUs of their own.
+// Linux only, does nothing elsewhere.
+class Placement final
+{
+public:
+	struct Options
+	{
+		std::vector<unsigned int> hornetCpus; // Empty to not pin hornets.
+		// Directory of the cgroup hornets are moved onto, created if it
+		// doesn't exist. Empty to leave them on multirole's own.
+		std::string hornetCgroup;
+		std::string hornetCpuMax; // Written onto cpu.max if not empty.
+		std::string hornetMemoryMax; // Written onto memory.max if not empty.
+		std::vector<unsigned int> ioCpus; // Each io thread takes the next one.
+		// If ioCpus is empty and this is not negative, io threads are pinned
+		// to every CPU of this NUMA node instead.
+		int ioNumaNode;
+	};
+
+	explicit Placement(Options&& options);
+
+	// Moves a freshly launched hornet process onto its cgroup and CPUs.
+	// Processes forked by it afterwards stay there as well.
+	void PlaceHornet(Process::Data proc) const;
+
+	// Pins the calling thread, meant to be called once by each io thread.
+	void PinIoThread();
+private:
+	const Options opts;
+	std::vector<unsigned int> ioNodeCpus;
+	std::atomic<std::size_t> nextIoCpu;
+};
+
+} // namespace Ignis::Multirole
+
+#endif // PLACEMENT_HPP
@@ -1,30 +1,84 @@
 #include "Client.hpp"
 
+#include <algorithm>
+#include <cstring>
+
 #include <boost/asio/bind_executor.hpp>
-#include <boost/asio/read.hpp>
 #include <boost/asio/write.hpp>
+#include <spdlog/spdlog.h>
 
 #include "Instance.hpp"
+#include "SpectatorFeed.hpp"
+#include "Stats.hpp"
+#include "../I18N.hpp"
+#include "../STOCMsgFactory.hpp"
 #include "../YGOPro/StringUtils.hpp"
 
 namespace Ignis::Multirole::Room
 {
 
+// Limits of how much queued data is written at once, the first message is
+// always written regardless of its size.
+constexpr std::size_t MAX_WRITE_BATCH_MSGS = 64U;
+constexpr std::size_t MAX_WRITE_BATCH_BYTES = 64U * 1024U;
+
+// Size of the data on each part sent by SendChunked.
+constexpr std::size_t MAX_CHUNK_SIZE =
+	32U * 1024U - sizeof(YGOPro::STOCMsg::ChunkHeader);
+
+namespace
+{
+
+YGOPro::STOCMsg MakeChunk(YGOPro::STOCMsg::MsgType type, const std::vector<uint8_t>& data, std::size_t offset)
+{
+	using ChunkHeader = YGOPro::STOCMsg::ChunkHeader;
+	const std::size_t size = std::min(MAX_CHUNK_SIZE, data.size() - offset);
+	const ChunkHeader header{static_cast<uint32_t>(data.size()), static_cast<uint32_t>(offset)};
+	std::vector<uint8_t> part(sizeof(ChunkHeader) + size);
+	std::memcpy(part.data(), &header, sizeof(ChunkHeader));
+	std::memcpy(part.data() + sizeof(ChunkHeader), data.data() + offset, size);
+	return YGOPro::STOCMsg{type, part};
+}
+
+} // namespace
+
 Client::Client(
 	std::shared_ptr<Instance> r,
 	boost::asio::ip::tcp::socket socket,
-	std::string name)
+	std::string name,
+	YGOPro::CTOSMsgReader reader,
+	bool relay)
 	:
 	room(std::move(r)),
 	strand(room->Strand()),
 	socket(std::move(socket)),
 	name(std::move(name)),
+	relay(relay),
+	limits(room->ClientSendLimits()),
+	chatLimits(room->ClientChatLimits()),
+	chatTokens(chatLimits.burst),
+	chatRefill(std::chrono::steady_clock::now()),
+	chatThrottled(false),
 	connectionLost(false),
 	disconnecting(false),
+	fellBehind(false),
 	position(POSITION_SPECTATOR),
-	ready(false)
+	ready(false),
+	reader(std::move(reader)),
+	outgoingBytes(0U),
+	writing(false),
+	writingQueued(0U),
+	feed(nullptr),
+	feedCursor(0U),
+	feedStop(0U)
 {}
 
+Client::~Client()
+{
+	if(feed != nullptr)
+		feed->RemoveReader(*this);
+}
+
 void Client::RegisterToOwner()
 {
 	room->Add(shared_from_this());
@@ -37,8 +91,8 @@ void Client::Start()
 	[this, self]()
 	{
 		room->Dispatch(Event::Join{*this});
+		DoRead();
 	});
-	DoReadHeader();
 }
 
 std::string Client::Name() const
@@ -56,6 +110,11 @@ bool Client::Ready() const
 	return ready;
 }
 
+bool Client::IsRelay() const
+{
+	return relay;
+}
+
 const YGOPro::Deck* Client::OriginalDeck() const
 {
 	return originalDeck.get();
@@ -68,6 +127,11 @@ const YGOPro::Deck* Client::CurrentDeck() const
 	return currentDeck.get();
 }
 
+const Client::Presence* Client::CachedPresence() const
+{
+	return presence ? &*presence : nullptr;
+}
+
 void Client::MarkKicked() const
 {
 	room->AddKicked(socket.remote_endpoint().address());
@@ -75,14 +139,23 @@ void Client::MarkKicked() const
 
 void Client::SetPosition(const PosType& p)
 {
+	if(position != p)
+		presence.reset();
 	position = p;
 }
 
 void Client::SetReady(bool r)
 {
+	if(ready != r)
+		presence.reset();
 	ready = r;
 }
 
+void Client::SetCachedPresence(Presence p)
+{
+	presence = std::move(p);
+}
+
 void Client::SetOriginalDeck(std::unique_ptr<YGOPro::Deck>&& newDeck)
 {
 	originalDeck = std::move(newDeck);
@@ -93,59 +166,157 @@ void Client::SetCurrentDeck(std::unique_ptr<YGOPro::Deck>&& newDeck)
 	currentDeck = std::move(newDeck);
 }
 
-void Client::Send(const YGOPro::STOCMsg& msg)
+void Client::Send(YGOPro::STOCMsg msg)
+{
+	if(connectionLost || fellBehind || !socket.is_open())
+		return;
+	if(position == POSITION_SPECTATOR && OverLimits(1U, msg.Length()))
+	{
+		FallBehind();
+		return;
+	}
+	outgoingBytes += msg.Length();
+	room->AccountSent(msg.Length());
+	if(transfer || stream)
+	{
+		held.push_back({std::move(msg), FeedEnd()});
+		return;
+	}
+	outgoing.push_back({std::move(msg), FeedEnd()});
+	if(!writing)
+		DoWrite();
+}
+
+void Client::SendChunked(YGOPro::STOCMsg::MsgType type, std::shared_ptr<const std::vector<uint8_t>> data)
+{
+	if(connectionLost || fellBehind || !socket.is_open() || data->empty())
+		return;
+	room->AccountSent(data->size());
+	if(transfer || stream)
+	{
+		// Rare enough to not bother pacing it, queue all of its parts now.
+		for(std::size_t offset = 0U; offset < data->size(); offset += MAX_CHUNK_SIZE)
+		{
+			const auto& q = held.emplace_back(Queued{MakeChunk(type, *data, offset), FeedEnd()});
+			outgoingBytes += q.msg.Length();
+		}
+		return;
+	}
+	transfer.emplace(Transfer{type, std::move(data), 0U, FeedEnd()});
+	QueueNextChunk();
+	if(!writing)
+		DoWrite();
+}
+
+void Client::SendStream(std::shared_ptr<const std::vector<YGOPro::STOCMsg>> msgs)
 {
-	if(connectionLost || !socket.is_open())
+	if(connectionLost || fellBehind || !socket.is_open() || msgs->empty())
 		return;
-	std::scoped_lock lock(mOutgoing);
-	const bool writeInProgress = !outgoing.empty();
-	outgoing.push(msg);
-	if(!writeInProgress)
+	std::size_t bytes = 0U;
+	for(const auto& msg : *msgs)
+		bytes += msg.Length();
+	room->AccountSent(bytes);
+	if(transfer || stream)
+	{
+		for(const auto& msg : *msgs)
+			held.push_back({msg, FeedEnd()});
+		outgoingBytes += bytes;
+		return;
+	}
+	stream.emplace(Stream{std::move(msgs), 0U, FeedEnd()});
+	QueueNextBatch();
+	if(!writing)
 		DoWrite();
 }
 
+void Client::ReadFeed(SpectatorFeed& f)
+{
+	feedStop = UINT64_MAX;
+	if(feed == &f)
+		return;
+	if(feed != nullptr)
+		LeaveFeed();
+	feed = &f;
+	feedCursor = f.End();
+	f.AddReader(*this);
+}
+
+uint64_t Client::FeedCursor() const
+{
+	return feedCursor;
+}
+
+void Client::DrainFeed()
+{
+	if(connectionLost || fellBehind || !socket.is_open())
+		return;
+	if(position == POSITION_SPECTATOR && OverLimits(0U, 0U))
+	{
+		FallBehind();
+		return;
+	}
+	if(!writing)
+		DoWrite();
+}
+
+void Client::StopFeed()
+{
+	feedStop = feed->End();
+	if(!writing && feedCursor >= feedStop)
+		LeaveFeed();
+}
+
+std::size_t Client::QueuedBytes() const
+{
+	return outgoingBytes;
+}
+
+std::size_t Client::FeedBacklogBytes() const
+{
+	if(feed == nullptr)
+		return 0U;
+	return feed->BytesSince(feedCursor);
+}
+
 void Client::Disconnect()
 {
-	std::scoped_lock lock(mOutgoing);
-	if(outgoing.empty())
+	if(!writing && !FeedPending())
+	{
 		Shutdown();
-	else
-		disconnecting = true;
+		return;
+	}
+	disconnecting = true;
+	if(!writing)
+		DoWrite();
 }
 
-void Client::DoReadHeader()
+void Client::DoRead()
 {
-	auto buffer = boost::asio::buffer(incoming.Data(), YGOPro::CTOSMsg::HEADER_LENGTH);
-	auto self(shared_from_this());
-	boost::asio::async_read(socket, buffer, boost::asio::bind_executor(strand,
-	[this, self](boost::system::error_code ec, std::size_t /*unused*/)
+	using Result = YGOPro::CTOSMsgReader::Result;
+	for(Result r; (r = reader.Next(incoming)) != Result::INCOMPLETE;)
 	{
-		if(!ec && incoming.IsHeaderValid())
-		{
-			DoReadBody();
-		}
-		else if(ec != boost::asio::error::operation_aborted)
+		if(r == Result::INVALID)
 		{
+			// NOTE: Removed here as well, as no read handler might be
+			// left to do it if this is the first read.
 			connectionLost = true;
 			room->Dispatch(Event::ConnectionLost{*this});
+			room->Remove(shared_from_this());
+			return;
 		}
-		room->Remove(self);
-	}));
-}
-
-void Client::DoReadBody()
-{
-	auto buffer = boost::asio::buffer(incoming.Body(), incoming.GetLength());
+		// Unlike Endpoint::RoomHosting, we dont want to finish connection
+		// if the message is not properly handled. Just ignore it.
+		HandleMsg();
+	}
+	const auto [data, size] = reader.WritableArea();
 	auto self(shared_from_this());
-	boost::asio::async_read(socket, buffer, boost::asio::bind_executor(strand,
-	[this, self](boost::system::error_code ec, std::size_t /*unused*/)
+	socket.async_read_some(boost::asio::buffer(data, size), boost::asio::bind_executor(strand,
+	[this, self](boost::system::error_code ec, std::size_t bytesRead)
 	{
 		if(!ec)
 		{
-			// Unlike Endpoint::RoomHosting, we dont want to finish connection
-			// if the message is not properly handled. Just ignore it.
-			HandleMsg();
-			DoReadHeader();
+			reader.Commit(bytesRead);
+			DoRead();
 		}
 		else if(ec != boost::asio::error::operation_aborted)
 		{
@@ -158,20 +329,166 @@ void Client::DoReadBody()
 
 void Client::DoWrite()
 {
+	// NOTE: Queued messages are never moved in memory while being written,
+	// as the deque is only ever appended to or popped from its front, and
+	// the feed keeps its messages until our cursor moves past them.
+	Stats::Get().RecordSendQueue(outgoing.size() + held.size(), outgoingBytes);
+	writeBuffers.clear();
+	std::size_t bytes = 0U;
+	auto Add = [&](const YGOPro::STOCMsg& msg) -> bool
+	{
+		if(writeBuffers.size() == MAX_WRITE_BATCH_MSGS ||
+		   (!writeBuffers.empty() && bytes + msg.Length() > MAX_WRITE_BATCH_BYTES))
+			return false;
+		writeBuffers.emplace_back(msg.Data(), msg.Length());
+		bytes += msg.Length();
+		return true;
+	};
+	// Feed messages go before whatever was sent directly after them,
+	// including parts of a transfer or stream not queued yet.
+	uint64_t cursor = feedCursor;
+	auto it = outgoing.cbegin();
+	for(;;)
+	{
+		uint64_t until = FeedEnd();
+		if(it != outgoing.cend())
+			until = std::min(until, it->feedPos);
+		else if(transfer)
+			until = std::min(until, transfer->feedPos);
+		else if(stream)
+			until = std::min(until, stream->feedPos);
+		if(feed != nullptr && cursor < until)
+		{
+			if(!Add(feed->At(cursor)))
+				break;
+			cursor++;
+		}
+		else if(it != outgoing.cend())
+		{
+			if(!Add(it->msg))
+				break;
+			++it;
+		}
+		else
+		{
+			break;
+		}
+	}
+	if(writeBuffers.empty())
+		return;
+	writing = true;
+	writingQueued = static_cast<std::size_t>(it - outgoing.cbegin());
 	auto self(shared_from_this());
-	const auto& front = outgoing.front();
-	boost::asio::async_write(socket, boost::asio::buffer(front.Data(), front.Length()),
-	[this, self](boost::system::error_code ec, std::size_t /*unused*/)
+	boost::asio::async_write(socket, writeBuffers, boost::asio::bind_executor(strand,
+	[this, self, fed = cursor - feedCursor, start = room->Trace().Now()](boost::system::error_code ec, std::size_t /*unused*/)
 	{
+		writing = false;
 		if(ec)
 			return;
-		std::scoped_lock lock(mOutgoing);
-		outgoing.pop();
-		if(!outgoing.empty())
+		room->Trace().Complete("socket_write", start);
+		const auto end = outgoing.begin() + std::exchange(writingQueued, 0U);
+		for(auto it = outgoing.begin(); it != end; ++it)
+			outgoingBytes -= it->msg.Length();
+		outgoing.erase(outgoing.begin(), end);
+		feedCursor += fed;
+		if(outgoing.empty() && transfer)
+			QueueNextChunk();
+		else if(outgoing.empty() && stream)
+			QueueNextBatch();
+		if(feed != nullptr && (fellBehind || feedCursor >= feedStop))
+			LeaveFeed();
+		if(!outgoing.empty() || FeedPending())
 			DoWrite();
 		else if(disconnecting)
 			Shutdown();
-	});
+	}));
+}
+
+void Client::QueueNextChunk()
+{
+	const auto& data = *transfer->data;
+	const auto& q = outgoing.emplace_back(Queued{MakeChunk(transfer->type, data, transfer->offset), transfer->feedPos});
+	outgoingBytes += q.msg.Length();
+	transfer->offset = std::min(transfer->offset + MAX_CHUNK_SIZE, data.size());
+	if(transfer->offset != data.size())
+		return;
+	transfer.reset();
+	ReleaseHeld();
+}
+
+void Client::QueueNextBatch()
+{
+	const auto& msgs = *stream->msgs;
+	std::size_t bytes = 0U;
+	for(std::size_t count = 0U; stream->next < msgs.size(); stream->next++, count++)
+	{
+		const auto& msg = msgs[stream->next];
+		if(count == MAX_WRITE_BATCH_MSGS ||
+		   (count != 0U && bytes + msg.Length() > MAX_WRITE_BATCH_BYTES))
+			break;
+		outgoing.push_back({msg, stream->feedPos});
+		bytes += msg.Length();
+	}
+	outgoingBytes += bytes;
+	if(stream->next != msgs.size())
+		return;
+	stream.reset();
+	ReleaseHeld();
+}
+
+void Client::ReleaseHeld()
+{
+	for(auto& m : held)
+		outgoing.push_back(std::move(m));
+	held.clear();
+}
+
+void Client::FallBehind()
+{
+	spdlog::info(I18N::ROOM_CLIENT_SPECTATOR_FELL_BEHIND, name, outgoing.size(), outgoingBytes);
+	fellBehind = true;
+	// NOTE: Messages being written must outlive the write operation.
+	outgoing.erase(outgoing.begin() + writingQueued, outgoing.end());
+	outgoingBytes = 0U;
+	for(const auto& q : outgoing)
+		outgoingBytes += q.msg.Length();
+	transfer.reset();
+	stream.reset();
+	held.clear();
+	if(feed != nullptr && !writing)
+		LeaveFeed();
+	Shutdown();
+}
+
+uint64_t Client::FeedEnd() const
+{
+	if(feed == nullptr)
+		return 0U;
+	return std::min(feed->End(), feedStop);
+}
+
+bool Client::FeedPending() const
+{
+	return feed != nullptr && feedCursor < FeedEnd();
+}
+
+void Client::LeaveFeed()
+{
+	feed->RemoveReader(*this);
+	feed = nullptr;
+}
+
+bool Client::OverLimits(std::size_t msgs, std::size_t bytes) const
+{
+	msgs += outgoing.size() + held.size();
+	bytes += outgoingBytes;
+	if(feed != nullptr)
+	{
+		msgs += static_cast<std::size_t>(FeedEnd() - feedCursor);
+		bytes += feed->BytesSince(feedCursor);
+	}
+	return (limits.maxMsgs != 0U && msgs > limits.maxMsgs) ||
+		(limits.maxBytes != 0U && bytes > limits.maxBytes);
 }
 
 void Client::Shutdown()
@@ -180,15 +497,36 @@ void Client::Shutdown()
 	socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignore);
 }
 
+bool Client::TakeChatToken()
+{
+	if(chatLimits.perSecond == 0.0)
+		return true;
+	using namespace std::chrono;
+	const auto now = steady_clock::now();
+	const duration<double> elapsed = now - chatRefill;
+	chatRefill = now;
+	chatTokens = std::min(chatLimits.burst, chatTokens + elapsed.count() * chatLimits.perSecond);
+	if(chatTokens < 1.0)
+	{
+		if(!std::exchange(chatThrottled, true))
+			Send(STOCMsgFactory::MakeChat(CHAT_MSG_TYPE_ERROR, I18N::CLIENT_ROOM_CHAT_THROTTLED));
+		return false;
+	}
+	chatTokens -= 1.0;
+	chatThrottled = false;
+	return true;
+}
+
 void Client::HandleMsg()
 {
+	const DuelTrace::Span span(room->Trace(), "handle_msg");
 	switch(incoming.GetType())
 	{
 	case YGOPro::CTOSMsg::MsgType::RESPONSE:
 	{
 		std::vector<uint8_t> data(incoming.GetLength());
 		std::memcpy(data.data(), incoming.Body(), data.size());
-		room->Dispatch(Event::Response{*this, data});
+		room->Dispatch(Event::Response{*this, std::move(data)});
 		break;
 	}
 	case YGOPro::CTOSMsg::MsgType::UPDATE_DECK:
@@ -211,7 +549,7 @@ void Client::HandleMsg()
 		{
 			//Send DECK_INVALID_SIZE to the client
 		}
-		room->Dispatch(Event::UpdateDeck{*this, main, side});
+		room->Dispatch(Event::UpdateDeck{*this, std::move(main), std::move(side)});
 		break;
 	}
 	case YGOPro::CTOSMsg::MsgType::RPS_CHOICE:
@@ -238,8 +576,9 @@ void Client::HandleMsg()
 	case YGOPro::CTOSMsg::MsgType::CHAT:
 	{
 		using namespace YGOPro;
-		auto str16 = BufferToUTF16(incoming.Body(), incoming.GetLength());
-		auto str = UTF16ToUTF8(str16);
+		if(!TakeChatToken())
+			break;
+		const auto str = UTF16BufferToUTF8(incoming.Body(), incoming.GetLength());
 		room->Dispatch(Event::Chat{*this, str});
 		break;
 	}
@@ -1,13 +1,17 @@
 #ifndef ROOM_CLIENT_HPP
 #define ROOM_CLIENT_HPP
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <optional>
 #include <utility>
-#include <queue>
-#include <mutex>
+#include <vector>
 
 #include <boost/asio/io_context_strand.hpp>
 #include <boost/asio/ip/tcp.hpp>
 
 #include "../YGOPro/CTOSMsg.hpp"
+#include "../YGOPro/CTOSMsgReader.hpp"
 #include "../YGOPro/Deck.hpp"
 #include "../YGOPro/STOCMsg.hpp"
 
@@ -15,6 +19,7 @@ namespace Ignis::Multirole::Room
 {
 
 class Instance;
+class SpectatorFeed;
 
 class Client final : public std::enable_shared_from_this<Client>
 {
@@ -22,7 +27,37 @@ public:
 	using PosType = std::pair<uint8_t, uint8_t>;
 	static constexpr PosType POSITION_SPECTATOR = {UINT8_MAX, UINT8_MAX};
 
-	Client(std::shared_ptr<Instance> r, boost::asio::ip::tcp::socket socket, std::string name);
+	// Limits of the messages queued for writing, zero meaning unlimited.
+	// Spectators that go past them are disconnected, duelists never are.
+	struct SendLimits
+	{
+		std::size_t maxMsgs;
+		std::size_t maxBytes;
+	};
+
+	// Chat messages a client can send, as a bucket of `burst` messages
+	// refilled at `perSecond`, zero meaning unlimited. Chat past it is
+	// dropped.
+	struct ChatLimits
+	{
+		double perSecond;
+		double burst;
+	};
+
+	// PlayerEnter and PlayerChange messages announcing this client as a
+	// duelist, see Context::PresenceOf.
+	using Presence = std::pair<YGOPro::STOCMsg, YGOPro::STOCMsg>;
+
+	// `reader` might already hold bytes read from the socket, which are
+	// handled before reading anything else. A `relay` spectates on behalf
+	// of the spectators of another instance and never becomes a duelist.
+	Client(
+		std::shared_ptr<Instance> r,
+		boost::asio::ip::tcp::socket socket,
+		std::string name,
+		YGOPro::CTOSMsgReader reader = {},
+		bool relay = false);
+	~Client();
 	void RegisterToOwner();
 	void Start();
 
@@ -30,9 +65,13 @@ public:
 	std::string Name() const;
 	PosType Position() const;
 	bool Ready() const;
+	bool IsRelay() const;
 	const YGOPro::Deck* OriginalDeck() const;
 	// Returns current deck or original (NOTE: this might still be nullptr)
 	const YGOPro::Deck* CurrentDeck() const;
+	// Presence messages stored by the room, nullptr if there's none or
+	// the position or ready state changed since they were stored.
+	const Presence* CachedPresence() const;
 
 	// Set this client as kicked from the room its in, preventing its IP
 	// from joining in the future.
@@ -41,11 +80,50 @@ public:
 	// Setters
 	void SetPosition(const PosType& p);
 	void SetReady(bool r);
+	void SetCachedPresence(Presence p);
 	void SetOriginalDeck(std::unique_ptr<YGOPro::Deck>&& newDeck);
 	void SetCurrentDeck(std::unique_ptr<YGOPro::Deck>&& newDeck);
 
-	// Adds a message to the queue that is written to the client socket
-	void Send(const YGOPro::STOCMsg& msg);
+	// Adds a message to the queue that is written to the client socket.
+	// NOTE: Like the rest of the setters, must be called from the strand
+	// of the room, which is where the queue is handled.
+	void Send(YGOPro::STOCMsg msg);
+
+	// Sends `data` split into `type` messages, each prefixed with the
+	// total size and where its part starts (STOCMsg::ChunkHeader). Parts
+	// are queued one at a time as the previous one is written, so a big
+	// transfer never takes over the queue nor counts towards the send
+	// limits, and messages sent meanwhile are held back until the last
+	// part so that they keep their order.
+	void SendChunked(YGOPro::STOCMsg::MsgType type, std::shared_ptr<const std::vector<uint8_t>> data);
+
+	// Sends already built messages a batch at a time as the previous one
+	// is written, holding back messages sent meanwhile the same way
+	// SendChunked does, so that the queue never holds all of them at once.
+	void SendStream(std::shared_ptr<const std::vector<YGOPro::STOCMsg>> msgs);
+
+	// Starts writing the messages appended to `feed` from now on along with
+	// the ones sent directly, in the order they were sent.
+	// NOTE: If still writing what was on the feed before it was closed,
+	// resumes from there, nothing is appended to a closed feed.
+	void ReadFeed(SpectatorFeed& feed);
+
+	// Called by SpectatorFeed. Position of the next feed message to write,
+	// writes what was appended (or falls behind), and stops reading at the
+	// current end of the feed, respectively.
+	uint64_t FeedCursor() const;
+	void DrainFeed();
+	void StopFeed();
+
+	// Bytes of the messages queued for writing, and of the feed messages
+	// left to write, respectively.
+	std::size_t QueuedBytes() const;
+	std::size_t FeedBacklogBytes() const;
+
+	// Drops everything not being written already and disconnects, used
+	// when a spectator goes past the send limits or its room past its
+	// memory budget.
+	void FallBehind();
 
 	// Tries to disconnect immediately if there are no messages in the queue,
 	// sets a flag if there are messages in the queue to disconnect
@@ -56,27 +134,96 @@ private:
 	boost::asio::io_context::strand& strand;
 	boost::asio::ip::tcp::socket socket;
 	std::string name;
+	const bool relay;
+	const SendLimits limits;
+	const ChatLimits chatLimits;
+	double chatTokens;
+	std::chrono::steady_clock::time_point chatRefill;
+	bool chatThrottled; // Whether the client was told it's being throttled.
 	bool connectionLost;
 	bool disconnecting;
+	bool fellBehind;
 	PosType position;
 	bool ready;
+	std::optional<Presence> presence;
 	std::unique_ptr<YGOPro::Deck> originalDeck;
 	std::unique_ptr<YGOPro::Deck> currentDeck;
 
 	// Message data
+	YGOPro::CTOSMsgReader reader;
 	YGOPro::CTOSMsg incoming;
-	std::queue<YGOPro::STOCMsg> outgoing;
-	std::mutex mOutgoing;
+	struct Queued
+	{
+		YGOPro::STOCMsg msg;
+		uint64_t feedPos; // Feed messages before this one are written first.
+	};
+	std::deque<Queued> outgoing;
+	std::size_t outgoingBytes;
+	bool writing;
+	std::size_t writingQueued; // Messages of `outgoing` being written.
+	// Feed being read, the position of the next message to write from it
+	// and where to stop reading.
+	SpectatorFeed* feed;
+	uint64_t feedCursor;
+	uint64_t feedStop;
+	// Data being sent by SendChunked, while set there's always a part of
+	// it on `outgoing`, and messages sent are put on `held` instead.
+	struct Transfer
+	{
+		YGOPro::STOCMsg::MsgType type;
+		std::shared_ptr<const std::vector<uint8_t>> data;
+		std::size_t offset;
+		uint64_t feedPos;
+	};
+	std::optional<Transfer> transfer;
+	// Messages being sent by SendStream, held back messages are handled
+	// the same as for `transfer`.
+	struct Stream
+	{
+		std::shared_ptr<const std::vector<YGOPro::STOCMsg>> msgs;
+		std::size_t next;
+		uint64_t feedPos;
+	};
+	std::optional<Stream> stream;
+	std::deque<Queued> held;
+	// Buffers of the messages at the front of `outgoing` that are being
+	// written at once.
+	std::vector<boost::asio::const_buffer> writeBuffers;
 
 	// Asynchronous calls
-	void DoReadHeader();
-	void DoReadBody();
+	void DoRead();
 	void DoWrite();
 
+	// Queues the next part of `transfer` onto `outgoing`, followed by the
+	// held messages if it was the last one.
+	void QueueNextChunk();
+
+	// Queues the next batch of `stream` onto `outgoing`, followed by the
+	// held messages if it was the last one.
+	void QueueNextBatch();
+
+	// Moves the held messages onto `outgoing`.
+	void ReleaseHeld();
+
+	// Position past the last feed message this client should write, and
+	// whether there's any left to write, respectively.
+	uint64_t FeedEnd() const;
+	bool FeedPending() const;
+
+	// Stops reading the feed right away.
+	void LeaveFeed();
+
+	// Whether the messages queued, plus the given ones, go past the send
+	// limits.
+	bool OverLimits(std::size_t msgs, std::size_t bytes) const;
+
 	// Shuts down socket immediately, disallowing any read or writes,
 	// doing that starts the graceful connection closure.
 	void Shutdown();
 
+	// Takes a token from the chat bucket, false if there's none left.
+	bool TakeChatToken();
+
 	// Handles received CTOS message
 	void HandleMsg();
 };
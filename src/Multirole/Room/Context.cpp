@@ -1,12 +1,18 @@
 #include "Context.hpp"
 
+#include <boost/asio/post.hpp>
+#include <spdlog/spdlog.h>
+
+#include "Instance.hpp"
 #include "../I18N.hpp"
+#include "../Core/IWrapper.hpp"
 #include "../STOCMsgFactory.hpp"
 #include "../Service/DataProvider.hpp"
 #include "../YGOPro/Banlist.hpp"
 #include "../YGOPro/CardDatabase.hpp"
 #include "../YGOPro/Constants.hpp"
 #include "../YGOPro/Deck.hpp"
+#include "../YGOPro/LegalityTable.hpp"
 
 namespace Ignis::Multirole::Room
 {
@@ -15,12 +21,18 @@ Context::Context(CreateInfo&& info)
 	:
 	STOCMsgFactory(info.hostInfo.t0Count),
 	svc(info.svc),
+	room(info.room),
 	tagg(info.tagg),
 	id(info.id),
 	banlist(std::move(info.banlist)),
 	hostInfo(info.hostInfo),
 	limits(info.limits),
+	processBudget(info.processBudget),
+	queryDeltas(info.queryDeltas),
+	costLimits(info.costLimits),
+	memoryBudget(info.memoryBudget),
 	cdb(svc.dataProvider.GetDatabase()),
+	legality(cdb->Legality(banlist, hostInfo.allowed, hostInfo.forb)),
 	neededWins(static_cast<int32_t>(std::ceil(hostInfo.bestOf / 2.0F))),
 	joinMsg(YGOPro::STOCMsg::JoinGame{hostInfo}),
 	retryErrorMsg(MakeChat(CHAT_MSG_TYPE_ERROR, I18N::CLIENT_ROOM_MSG_RETRY_ERROR))
@@ -28,6 +40,27 @@ Context::Context(CreateInfo&& info)
 	rng.seed(info.seed);
 }
 
+Context::~Context()
+{
+	UntrackMemory();
+	if(nextDuelPtr == nullptr)
+		return;
+	// NOTE: The room can be dropped from any thread, so the prepared duel
+	// is destroyed on the room threads instead of blocking on the core here.
+	boost::asio::post(room.Strand().context(),
+	[c = std::move(core), duelPtr = nextDuelPtr, id = id]()
+	{
+		try
+		{
+			c->DestroyDuel(duelPtr);
+		}
+		catch(Core::Exception& e)
+		{
+			spdlog::info(I18N::ROOM_DUELING_CORE_EXCEPT_PREPARING, id, e.what());
+		}
+	});
+}
+
 const YGOPro::HostInfo& Context::HostInfo() const
 {
 	return hostInfo;
@@ -44,6 +77,45 @@ std::map<uint8_t, std::string> Context::GetDuelistsNames() const
 	return ret;
 }
 
+const Core::CrashRegistry::Signature& Context::CrashSignature() const
+{
+	return crashSig;
+}
+
+void Context::AccountDispatch(std::chrono::steady_clock::duration d)
+{
+	duelCost.dispatch += d;
+}
+
+void Context::AccountSent(std::size_t bytes)
+{
+	duelCost.bytes += bytes;
+}
+
+DuelTrace& Context::Trace()
+{
+	return trace;
+}
+
+void Context::SetSpectatorFeedOpen(bool open)
+{
+	if(spectatorFeed.IsOpen() == open)
+		return;
+	if(!open)
+	{
+		spectatorFeed.Close();
+		return;
+	}
+	spectatorFeed.Open();
+	for(auto* c : spectators)
+		c->ReadFeed(spectatorFeed);
+}
+
+void Context::FlushSpectatorFeed()
+{
+	spectatorFeed.Flush();
+}
+
 // private
 
 uint8_t Context::GetSwappedTeam(uint8_t team) const
@@ -73,6 +145,12 @@ void Context::SendToTeam(uint8_t team, const YGOPro::STOCMsg& msg)
 
 void Context::SendToSpectators(const YGOPro::STOCMsg& msg)
 {
+	if(spectatorFeed.IsOpen())
+	{
+		spectatorFeed.Append(msg);
+		AccountSent(msg.Length() * spectators.size());
+		return;
+	}
 	for(const auto& c : spectators)
 		c->Send(msg);
 }
@@ -95,14 +173,32 @@ void Context::SendToAllExcept(Client& client, const YGOPro::STOCMsg& msg)
 	SendToSpectators(msg);
 }
 
+void Context::SendChunkedToAll(YGOPro::STOCMsg::MsgType type, const std::vector<uint8_t>& data)
+{
+	const auto shared = std::make_shared<const std::vector<uint8_t>>(data);
+	for(const auto& kv : duelists)
+		kv.second->SendChunked(type, shared);
+	for(const auto& c : spectators)
+		c->SendChunked(type, shared);
+}
+
+const Client::Presence& Context::PresenceOf(Client& client)
+{
+	if(const auto* p = client.CachedPresence(); p != nullptr)
+		return *p;
+	client.SetCachedPresence({MakePlayerEnter(client), MakePlayerChange(client)});
+	return *client.CachedPresence();
+}
+
 void Context::SendDuelistsInfo(Client& client)
 {
 	for(const auto& kv : duelists)
 	{
 		if(kv.second == &client)
 			continue; // Skip itself
-		client.Send(MakePlayerEnter(*kv.second));
-		client.Send(MakePlayerChange(*kv.second));
+		const auto& [enter, change] = PresenceOf(*kv.second);
+		client.Send(enter);
+		client.Send(change);
 	}
 }
 
@@ -110,6 +206,8 @@ void Context::SetupAsSpectator(Client& client)
 {
 	spectators.insert(&client);
 	client.SetPosition(Client::POSITION_SPECTATOR);
+	if(spectatorFeed.IsOpen())
+		client.ReadFeed(spectatorFeed);
 	client.Send(joinMsg);
 	client.Send(MakeTypeChange(client, false));
 	SendDuelistsInfo(client);
@@ -123,10 +221,10 @@ void Context::MakeAndSendChat(Client& client, std::string_view msg)
 	}
 	else
 	{
-		SendToTeam(client.Position().first, MakeChat(client, true, msg));
-		const auto stocMsg = MakeChat(client, false, msg);
-		SendToTeam(1U - client.Position().first, stocMsg);
-		SendToSpectators(stocMsg);
+		const auto [teamMsg, othersMsg] = MakeDuelistChat(client, msg);
+		SendToTeam(client.Position().first, teamMsg);
+		SendToTeam(1U - client.Position().first, othersMsg);
+		SendToSpectators(othersMsg);
 	}
 }
 
@@ -143,36 +241,32 @@ std::unique_ptr<YGOPro::Deck> Context::LoadDeck(
 			return true;
 		return false;
 	};
+	// Both lists are looked up at once, main deck first.
+	YGOPro::CodeVector codes;
+	codes.reserve(main.size() + side.size());
+	codes.insert(codes.end(), main.begin(), main.end());
+	codes.insert(codes.end(), side.begin(), side.end());
+	const auto summaries = cdb->Summarize(codes);
 	YGOPro::CodeVector m;
 	YGOPro::CodeVector e;
 	YGOPro::CodeVector s;
 	uint32_t err = 0U;
-	for(const auto code : main)
+	for(std::size_t i = 0U; i < codes.size(); i++)
 	{
-		const auto& data = cdb->DataFromCode(code);
-		if(data.code == 0U)
+		const auto& summary = summaries[i];
+		if(summary.code == 0U)
 		{
-			err = code;
+			err = codes[i];
 			continue;
 		}
-		if((data.type & TYPE_TOKEN) != 0U)
+		if((summary.type & TYPE_TOKEN) != 0U)
 			continue;
-		if(IsExtraDeckCardType(data.type))
-			e.push_back(code);
+		if(i >= main.size())
+			s.push_back(summary.code);
+		else if(IsExtraDeckCardType(summary.type))
+			e.push_back(summary.code);
 		else
-			m.push_back(code);
-	}
-	for(const auto code : side)
-	{
-		const auto& data = cdb->DataFromCode(code);
-		if(data.code == 0U)
-		{
-			err = code;
-			continue;
-		}
-		if((data.type & TYPE_TOKEN) != 0U)
-			continue;
-		s.push_back(code);
+			m.push_back(summary.code);
 	}
 	return std::make_unique<YGOPro::Deck>(
 		std::move(m),
@@ -211,103 +305,24 @@ std::unique_ptr<YGOPro::STOCMsg> Context::CheckDeck(const YGOPro::Deck& deck) co
 	if(const auto p = OutOfBound(limits.side, deck.Side()); p.second)
 		return MakeErrorLimitsPtr(DECK_BAD_SIDE_COUNT, p.first, limits.side);
 	// Check per-code properties.
-	// Get un-aliased map that will be updated a bit later...
-	auto aliased = deck.GetCodeMap();
-	// Make copy of "un-aliased" card codes.
-	const auto codes = [&aliased]()
-	{
-		std::set<uint32_t> ret;
-		for(const auto& kv : aliased)
-			ret.insert(kv.first);
-		return ret;
-	}();
-	// Save alias mapping while updating map to only store aliased counts.
-	const auto aliases = [&]()
-	{
-		std::map<uint32_t, uint32_t> ret;
-		for(auto it = aliased.begin(), last = aliased.end(); it != last;)
-		{
-			uint32_t code = it->first;
-			if(uint32_t alias = cdb->DataFromCode(code).alias; alias != 0U)
-			{
-				ret[code] = alias;
-				aliased[alias] = aliased[alias] + it->second;
-				it = aliased.erase(it);
-			}
-			else
-			{
-				++it;
-			}
-		}
-		return ret;
-	}();
-	// Fetch actual count of particular card even if aliased.
-	auto GetTotalCount = [&aliased, &aliases](uint32_t code) -> std::size_t
-	{
-		if(auto search = aliases.find(code); search != aliases.end())
-			return aliased[search->second];
-		return aliased[code];
-	};
-	// Custom predicates...
-	//	true if card scope is unnofficial and not allowed.
-	auto CheckUnofficial = [](uint32_t scope, uint8_t allowed) constexpr -> bool
-	{
-		switch(allowed)
-		{
-		case ALLOWED_CARDS_OCG_ONLY:
-		case ALLOWED_CARDS_TCG_ONLY:
-		case ALLOWED_CARDS_OCG_TCG:
-			return scope > SCOPE_OCG_TCG;
-		default:
-			return false;
-		}
-	};
-	//	true if card scope is prerelease and they are not allowed.
-	auto CheckPrelease = [](uint32_t scope, uint8_t allowed) constexpr -> bool
-	{
-		return allowed == ALLOWED_CARDS_WITH_PRERELEASE &&
-		       ((scope & SCOPE_OFFICIAL) == 0U);
-	};
-	//	true if only ocg are allowed and scope is not ocg (its tcg).
-	auto CheckOCG = [](uint32_t scope, uint8_t allowed) constexpr -> bool
-	{
-		return allowed == ALLOWED_CARDS_OCG_ONLY && ((scope & SCOPE_OCG) == 0U);
-	};
-	//	true if only tcg are allowed and scope is not tcg (its ocg).
-	auto CheckTCG = [](uint32_t scope, uint8_t allowed) constexpr -> bool
-	{
-		return allowed == ALLOWED_CARDS_TCG_ONLY && ((scope & SCOPE_TCG) == 0U);
-	};
-	//	true if card code and its count is banlisted.
-	auto CheckBanlist = [&](uint32_t code, std::size_t count, const Banlist& bl) -> bool
-	{
-		const auto& d = bl.Dict();
-		const auto eit = d.end();
-		auto it = d.find(code);
-		if(it == eit)
-			if(auto search = aliases.find(code); search != aliases.end())
-				it = d.find(search->second);
-		return ((it != eit) && static_cast<int32_t>(count) > it->second) ||
-		       ((it == eit) && bl.IsWhitelist());
-	};
-	for(const auto code : codes)
+	switch(const auto r = legality->Check(deck); r.verdict)
 	{
-		const uint32_t totalCount = GetTotalCount(code);
-		if(totalCount > 3U)
-			return MakeErrorPtr(CARD_MORE_THAN_3, code);
-		if((cdb->DataFromCode(code).type & hostInfo.forb) != 0U)
-			return MakeErrorPtr(CARD_FORBIDDEN_TYPE, code);
-		const auto& ced = cdb->ExtraFromCode(code);
-		if(CheckUnofficial(ced.scope, hostInfo.allowed))
-			return MakeErrorPtr(CARD_UNOFFICIAL, code);
-		if(CheckPrelease(ced.scope, hostInfo.allowed))
-			return MakeErrorPtr(CARD_UNOFFICIAL, code);
-		if(CheckOCG(ced.scope, hostInfo.allowed))
-			return MakeErrorPtr(CARD_TCG_ONLY, code);
-		if(CheckTCG(ced.scope, hostInfo.allowed))
-			return MakeErrorPtr(CARD_OCG_ONLY, code);
-		if((banlist != nullptr) && CheckBanlist(code, totalCount, *banlist))
-			return MakeErrorPtr(CARD_BANLISTED, code);
+	case LegalityTable::Verdict::OK:
+		break;
+	case LegalityTable::Verdict::UNKNOWN:
+		return MakeErrorPtr(CARD_UNKNOWN, r.code);
+	case LegalityTable::Verdict::MORE_THAN_3:
+		return MakeErrorPtr(CARD_MORE_THAN_3, r.code);
+	case LegalityTable::Verdict::FORBIDDEN_TYPE:
+		return MakeErrorPtr(CARD_FORBIDDEN_TYPE, r.code);
+	case LegalityTable::Verdict::UNOFFICIAL:
+		return MakeErrorPtr(CARD_UNOFFICIAL, r.code);
+	case LegalityTable::Verdict::TCG_ONLY:
+		return MakeErrorPtr(CARD_TCG_ONLY, r.code);
+	case LegalityTable::Verdict::OCG_ONLY:
+		return MakeErrorPtr(CARD_OCG_ONLY, r.code);
+	case LegalityTable::Verdict::BANLISTED:
+		return MakeErrorPtr(CARD_BANLISTED, r.code);
 	}
 	return nullptr;
 }
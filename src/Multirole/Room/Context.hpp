@@ -1,14 +1,22 @@
 #ifndef ROOM_CONTEXT_HPP
 #define ROOM_CONTEXT_HPP
+#include <chrono>
 #include <map>
+#include <memory_resource>
 #include <set>
 #include <shared_mutex>
 #include <random>
+#include <type_traits>
 
 #include "State.hpp"
+#include "../Core/CrashRegistry.hpp"
+#include "../Core/IWrapper.hpp"
 #include "Event.hpp"
+#include "SpectatorFeed.hpp"
+#include "Trace.hpp"
 #include "../Service.hpp"
 #include "../STOCMsgFactory.hpp"
+#include "../YGOPro/QueryDeltas.hpp"
 
 namespace YGOPro
 {
@@ -16,6 +24,7 @@ namespace YGOPro
 class Banlist;
 using BanlistPtr = std::shared_ptr<Banlist>;
 class CardDatabase;
+class LegalityTable;
 
 } // namespace YGOPro
 
@@ -25,21 +34,49 @@ namespace Ignis::Multirole
 namespace Room
 {
 
+class Instance;
 class TimerAggregator;
 
 class Context : public STOCMsgFactory
 {
 public:
+	// Costs of a single duel past which the room is reported as slow, zero
+	// meaning unchecked. Once reported, the processing budget of the room
+	// drops to `throttledBudget` for the rest of its life, unless zero.
+	struct CostLimits
+	{
+		std::chrono::microseconds dispatch; // Handling events of the duel.
+		std::chrono::microseconds core; // Of the above, within core calls.
+		uint64_t bytes; // Queued for the clients.
+		uint64_t msgs; // Produced by the core.
+		std::chrono::microseconds throttledBudget;
+	};
+
+	// Bytes a room can hold for its duel, zero meaning unchecked, see
+	// MemoryUsage. Past `soft` the spectator cache is compacted and then
+	// the spectators with the biggest backlogs are dropped, past `hard` the
+	// duel is ended (and its replay sent) right away.
+	struct MemoryBudget
+	{
+		uint64_t soft;
+		uint64_t hard;
+	};
+
 	// Data passed on the ctor.
 	struct CreateInfo
 	{
 		Service& svc;
+		Instance& room;
 		TimerAggregator& tagg;
 		uint32_t id;
 		uint32_t seed;
 		YGOPro::BanlistPtr banlist;
 		YGOPro::HostInfo hostInfo;
 		YGOPro::DeckLimits limits;
+		std::chrono::microseconds processBudget; // Zero means unlimited.
+		bool queryDeltas;
+		CostLimits costLimits;
+		MemoryBudget memoryBudget;
 	};
 
 	struct DuelFinishReason
@@ -52,15 +89,36 @@ public:
 			REASON_WRONG_RESPONSE,
 			REASON_CONNECTION_LOST,
 			REASON_CORE_CRASHED,
+			REASON_MEMORY_EXCEEDED,
+			REASON_IDLE,
 		} reason;
 		uint8_t winner; // 2 == DRAW
 	};
 
 	Context(CreateInfo&& info);
+	~Context();
 
 	const YGOPro::HostInfo& HostInfo() const;
 	std::map<uint8_t, std::string> GetDuelistsNames() const;
 
+	// Signature of the duel, to be recorded if the core crashes while
+	// handling the room.
+	const Core::CrashRegistry::Signature& CrashSignature() const;
+
+	// Account what handling an event of the room took and what was queued
+	// for its clients, checked against the cost limits while dueling.
+	void AccountDispatch(std::chrono::steady_clock::duration d);
+	void AccountSent(std::size_t bytes);
+
+	// Trace of the current duel, see DuelTrace.
+	DuelTrace& Trace();
+
+	// Messages for spectators go through a SpectatorFeed while dueling,
+	// opened and closed as the room enters and leaves that state. The
+	// feed is flushed after each event is handled.
+	void SetSpectatorFeedOpen(bool open);
+	void FlushSpectatorFeed();
+
 	/*** STATE AND EVENT HANDLERS ***/
 	// State/ChoosingTurn.cpp
 	StateOpt operator()(State::ChoosingTurn& s);
@@ -73,7 +131,10 @@ public:
 	// State/Dueling.cpp
 	StateOpt operator()(State::Dueling& s);
 	StateOpt operator()(State::Dueling& s, const Event::ConnectionLost& e);
+	StateOpt operator()(State::Dueling& s, const Event::Idle&);
 	StateOpt operator()(State::Dueling& s, const Event::Join& e);
+	StateOpt operator()(State::Dueling& s, const Event::Migrate&);
+	StateOpt operator()(State::Dueling& s, const Event::ProcessMore&);
 	StateOpt operator()(State::Dueling& s, const Event::Response& e);
 	StateOpt operator()(State::Dueling& s, const Event::Surrender& e);
 	StateOpt operator()(State::Dueling& s, const Event::TimerExpired& e);
@@ -111,6 +172,17 @@ public:
 		return std::nullopt;
 	}
 
+	// Idle rooms are closed, see Instance::IdleTimeouts. While dueling,
+	// the duel is ended first.
+	template<typename S>
+	inline StateOpt operator()(S&, const Event::Idle&)
+	{
+		if constexpr(std::is_same_v<S, State::Closing>)
+			return std::nullopt;
+		else
+			return CloseIdle(!std::is_same_v<S, State::Waiting>);
+	}
+
 	// Ignore rest of state entries.
 	template<typename S>
 	inline StateOpt operator()(S&)
@@ -120,19 +192,25 @@ public:
 
 	// Ignore rest of state and event combinations.
 	template<typename S, typename E>
-	inline StateOpt operator()(S&, E&)
+	inline StateOpt operator()(S&, const E&)
 	{
 		return std::nullopt;
 	}
 private:
 	// Creation options and resources.
 	Service& svc;
+	Instance& room;
 	TimerAggregator& tagg;
 	const uint32_t id;
 	const YGOPro::BanlistPtr banlist;
 	const YGOPro::HostInfo hostInfo;
 	const YGOPro::DeckLimits limits;
+	std::chrono::microseconds processBudget; // Lowered if throttled.
+	const bool queryDeltas;
+	const CostLimits costLimits;
+	const MemoryBudget memoryBudget;
 	const std::shared_ptr<YGOPro::CardDatabase> cdb;
+	const std::shared_ptr<const YGOPro::LegalityTable> legality;
 	const int32_t neededWins;
 	const YGOPro::STOCMsg joinMsg;
 	const YGOPro::STOCMsg retryErrorMsg;
@@ -141,12 +219,60 @@ private:
 	std::map<Client::PosType, Client*> duelists;
 	mutable std::shared_mutex mDuelists;
 	std::set<Client*> spectators;
+	SpectatorFeed spectatorFeed;
 
 	// Additional data used by room states.
 	uint8_t isTeam1GoingFirst{};
 	std::mt19937 rng{};
 	std::array<int32_t, 2U> wins{};
 
+	// Core kept across the games of the room, plus a duel created ahead of
+	// time on it for the next game, with the base scripts already loaded.
+	std::shared_ptr<Core::IWrapper> core;
+	std::size_t coreGen{};
+	bool coreIsolated{};
+	Core::CrashRegistry::Signature crashSig{};
+	void* nextDuelPtr{};
+	uint32_t nextSeed{};
+
+	// Scratch buffers reused while distributing messages of a duel.
+	YGOPro::CoreUtils::QueryBuffer ownerQueryBuffer;
+	YGOPro::CoreUtils::QueryBuffer strippedQueryBuffer;
+	std::array<YGOPro::CoreUtils::Msg, 3U> strippedMsgs; // Team 0/1, spectators.
+	// Query requests of the core batch being distributed that were not
+	// carried out yet, without duplicates.
+	std::vector<YGOPro::CoreUtils::QueryRequest> pendingQueries;
+	// Queries made to the core at once and their results.
+	std::vector<Core::IWrapper::BatchQuery> batchQueries;
+	std::vector<Core::IWrapper::Buffer> batchResults;
+	// Card queries sent to the owner and to everyone else, respectively.
+	std::array<YGOPro::QueryDeltas, 2U> sentQueries;
+
+	// Backs the containers of the duel being played (State::Dueling and its
+	// replay), so that they don't go through the global allocator, which
+	// is shared with every other io thread. Only used from the strand.
+	std::pmr::unsynchronized_pool_resource duelArena;
+
+	// What the current duel has cost so far, see CostLimits.
+	struct DuelCost
+	{
+		std::chrono::steady_clock::duration dispatch;
+		std::chrono::steady_clock::duration core;
+		std::chrono::steady_clock::duration distribute;
+		uint64_t bytes;
+		uint64_t msgs;
+		bool reported;
+	} duelCost{};
+	// Memory held by the current duel, see MemoryBudget.
+	struct DuelMemory
+	{
+		std::size_t current; // As last added to Stats.
+		std::size_t peak;
+		std::size_t lastActed; // When soft budget actions were last taken.
+		bool reported;
+	} duelMemory{};
+	DuelTrace trace;
+
 	// Get correctly swapped teams based on team1 going first or not.
 	uint8_t GetSwappedTeam(uint8_t team) const;
 
@@ -158,9 +284,15 @@ private:
 	void SendToSpectators(const YGOPro::STOCMsg& msg);
 	void SendToAll(const YGOPro::STOCMsg& msg);
 	void SendToAllExcept(Client& client, const YGOPro::STOCMsg& msg);
+	void SendChunkedToAll(YGOPro::STOCMsg::MsgType type, const std::vector<uint8_t>& data);
 
-	// Creates the PlayerEnter and TypeChange messages for each duelist
-	// and sends that information to the given client.
+	// Returns the PlayerEnter and PlayerChange messages of a duelist,
+	// building them only if the client has none cached (its position or
+	// ready state changed since they were last built).
+	const Client::Presence& PresenceOf(Client& client);
+
+	// Sends the PlayerEnter and PlayerChange messages of each duelist
+	// to the given client.
 	void SendDuelistsInfo(Client& client);
 
 	// Adds given client to the spectators set, sends the join message as
@@ -181,10 +313,48 @@ private:
 	std::unique_ptr<YGOPro::STOCMsg> CheckDeck(const YGOPro::Deck& deck) const;
 
 	/*** STATE SPECIFIC FUNCTIONS ***/
+	// State/Closing.cpp
+	// Lets the clients know the room is closed for being idle, and that
+	// the duel ended if it `started`.
+	StateOpt CloseIdle(bool started);
 	// State/Dueling.cpp
+	// Gets the core kept by the room, replacing it if outdated.
+	std::shared_ptr<Core::IWrapper> AcquireCore();
+	// Records the duel as one that crashes the core, if `e` was a crash.
+	void ReportCrash(const Core::Exception& e);
+	// Creates the duel for the next game ahead of time, if not done yet.
+	void PrepareDuel();
+	// Destroys the duel created ahead of time, if any.
+	void DiscardPreparedDuel();
+	// Stops keeping the core around, done once the room won't duel anymore.
+	void ReleaseCore();
+	// Creates a duel on the given core with the room options and loads
+	// the base scripts onto it.
+	void* CreateBaseDuel(Core::IWrapper& c, uint32_t seed);
 	Client& GetCurrentTeamClient(State::Dueling& s, uint8_t team);
+	// Processes the duel until a response is needed or the processing
+	// budget runs out, in which case it resumes later on the room strand.
 	std::optional<DuelFinishReason> Process(State::Dueling& s);
+	// Rebuilds the duel on a fresh core from the data recorded on the
+	// replay, fast-forwarding all responses without sending anything to
+	// clients, messages already handled are skipped on next Process.
+	bool Restore(State::Dueling& s);
 	StateVariant Finish(State::Dueling& s, const DuelFinishReason& dfr);
+	// Reports the room if the duel went over any of the cost limits, and
+	// throttles it if set to.
+	void CheckCost(const State::Dueling& s);
+	// Bytes held for the duel: the spectator cache and its snapshot, the
+	// spectator feed, the replay, what is queued for the clients and the
+	// events waiting on the strand. Message payloads shared by several of
+	// them are counted by each one, so it's an upper bound.
+	std::size_t MemoryUsage(const State::Dueling& s) const;
+	// Updates what the duel holds on Stats and returns it.
+	std::size_t TrackMemory(const State::Dueling& s);
+	// Releases what the duel held from Stats, once it's over.
+	void UntrackMemory();
+	// Sends the duel start and then the spectator cache between catch up
+	// messages, what a spectator joining mid-duel needs to be up to date.
+	void SendDuelCatchUp(State::Dueling& s, Client& client);
 	static const YGOPro::STOCMsg& SaveToSpectatorCache(
 		State::Dueling& s,
 		YGOPro::STOCMsg&& msg);
@@ -39,11 +39,20 @@ struct ConnectionLost
 	Client& client;
 };
 
+struct Idle
+{};
+
 struct Join
 {
 	Client& client;
 };
 
+struct Migrate
+{};
+
+struct ProcessMore
+{};
+
 struct Ready
 {
 	Client& client;
@@ -59,7 +68,7 @@ struct Rematch
 struct Response
 {
 	Client& client;
-	const std::vector<uint8_t>& data;
+	std::vector<uint8_t> data;
 };
 
 struct Surrender
@@ -96,8 +105,8 @@ struct TryStart
 struct UpdateDeck
 {
 	Client& client;
-	const std::vector<uint32_t>& main;
-	const std::vector<uint32_t>& side;
+	std::vector<uint32_t> main;
+	std::vector<uint32_t> side;
 };
 
 } // namespace Event
@@ -108,7 +117,10 @@ using EventVariant = std::variant<
 	Event::ChooseTurn,
 	Event::Close,
 	Event::ConnectionLost,
+	Event::Idle,
 	Event::Join,
+	Event::Migrate,
+	Event::ProcessMore,
 	Event::Ready,
 	Event::Rematch,
 	Event::Response,
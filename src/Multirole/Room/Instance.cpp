@@ -1,18 +1,84 @@
 #include "Instance.hpp"
 
+#include <optional>
+#include <type_traits>
+
+#include <boost/asio/post.hpp>
+
+#include "Stats.hpp"
+
 namespace Ignis::Multirole::Room
 {
 
+template<typename E, typename = void>
+struct HasClient : std::false_type
+{};
+
+template<typename E>
+struct HasClient<E, std::void_t<decltype(std::declval<const E&>().client)>> : std::true_type
+{};
+
+// Whether the event counts as activity, see Instance::IdleTimeouts.
+inline bool IsActivity(const EventVariant& e)
+{
+	return std::visit([](const auto& ev)
+	{
+		using E = std::decay_t<decltype(ev)>;
+		if constexpr(std::is_same_v<E, Event::Join> || std::is_same_v<E, Event::ProcessMore>)
+			return true;
+		else if constexpr(HasClient<E>::value)
+			return ev.client.Position() != Client::POSITION_SPECTATOR;
+		else
+			return false;
+	}, e);
+}
+
+// Whether handling the event might call into the core, either for the
+// duel itself or to get the next one ready. Only those are blamed on the
+// duel if the process crashes meanwhile, see Core::CrashRegistry.
+inline bool MightCallCore(const EventVariant& e)
+{
+	return std::visit([](const auto& ev)
+	{
+		using E = std::decay_t<decltype(ev)>;
+		return !(std::is_same_v<E, Event::Chat> ||
+		         std::is_same_v<E, Event::Close> ||
+		         std::is_same_v<E, Event::Join> ||
+		         std::is_same_v<E, Event::Ready> ||
+		         std::is_same_v<E, Event::ToDuelist> ||
+		         std::is_same_v<E, Event::ToObserver> ||
+		         std::is_same_v<E, Event::TryKick>);
+	}, e);
+}
+
 Instance::Instance(CreateInfo& info)
 	:
 	strand(info.ioCtx),
 	tagg(*this),
+	idleTimer(*this),
 	notes(std::move(info.notes)),
 	pass(std::move(info.pass)),
 	isPrivate(!pass.empty()),
-	ctx({info.svc, tagg, info.id, info.seed, std::move(info.banlist), info.hostInfo, info.limits}),
-	state(State::Waiting{nullptr})
-{}
+	sendLimits(info.sendLimits),
+	chatLimits(info.chatLimits),
+	idleTimeouts(info.idleTimeouts),
+	expiryHook(std::move(info.expiryHook)),
+	ctx({info.svc, *this, tagg, info.id, info.seed, std::move(info.banlist), info.hostInfo, info.limits, info.processBudget, info.queryDeltas, info.costLimits, info.memoryBudget}),
+	state(State::Waiting{nullptr}),
+	listing(std::make_shared<const ListingProps>(ListingProps{0U, false, {}})),
+	pendingEvents(0U),
+	lastActivity(std::chrono::steady_clock::now())
+{
+	Stats::Get().AddRoomsInState(state.index(), 1);
+	idleTimer.Arm(IdleTimeout());
+}
+
+Instance::~Instance()
+{
+	Stats::Get().AddRoomsInState(state.index(), -1);
+	if(expiryHook)
+		expiryHook();
+}
 
 bool Instance::IsPrivate() const
 {
@@ -21,7 +87,7 @@ bool Instance::IsPrivate() const
 
 bool Instance::Started() const
 {
-	return !std::holds_alternative<State::Waiting>(state);
+	return Listing()->started;
 }
 
 const std::string& Instance::Notes() const
@@ -34,9 +100,9 @@ const YGOPro::HostInfo& Instance::HostInfo() const
 	return ctx.HostInfo();
 }
 
-std::map<uint8_t, std::string> Instance::DuelistNames() const
+std::shared_ptr<const Instance::ListingProps> Instance::Listing() const
 {
-	return ctx.GetDuelistsNames();
+	return std::atomic_load(&listing);
 }
 
 bool Instance::CheckPassword(std::string_view str) const
@@ -60,6 +126,33 @@ void Instance::TryClose()
 	});
 }
 
+void Instance::TryMigrate()
+{
+	auto self(shared_from_this());
+	boost::asio::post(strand,
+	[this, self]()
+	{
+		Dispatch(Event::Migrate{});
+	});
+}
+
+void Instance::PostDispatch(EventVariant e)
+{
+	auto self(shared_from_this());
+	pendingEvents.fetch_add(1U, std::memory_order_relaxed);
+	boost::asio::post(strand,
+	[this, self, e = std::move(e)]() mutable
+	{
+		pendingEvents.fetch_sub(1U, std::memory_order_relaxed);
+		Dispatch(std::move(e));
+	});
+}
+
+std::size_t Instance::PendingEvents() const
+{
+	return pendingEvents.load(std::memory_order_relaxed);
+}
+
 void Instance::AddKicked(const boost::asio::ip::address& addr)
 {
 	std::scoped_lock lock(mKicked);
@@ -83,13 +176,134 @@ boost::asio::io_context::strand& Instance::Strand()
 	return strand;
 }
 
-void Instance::Dispatch(const EventVariant& e)
+const Client::SendLimits& Instance::ClientSendLimits() const
+{
+	return sendLimits;
+}
+
+const Client::ChatLimits& Instance::ClientChatLimits() const
+{
+	return chatLimits;
+}
+
+void Instance::AccountSent(std::size_t bytes)
+{
+	ctx.AccountSent(bytes);
+}
+
+DuelTrace& Instance::Trace()
 {
+	return ctx.Trace();
+}
+
+void Instance::Dispatch(EventVariant e)
+{
+	const DuelTrace::Span span(ctx.Trace(), "dispatch");
+	std::optional<Core::CrashRegistry::Scope> scope;
+	if(MightCallCore(e))
+		scope.emplace(ctx.CrashSignature());
+	const auto start = std::chrono::steady_clock::now();
+	// Only while waiting can duelists come and go, and leaving that state
+	// is what starts (or closes) the room.
+	const bool wasWaiting = std::holds_alternative<State::Waiting>(state);
+	const bool active = IsActivity(e);
+	bool changed = false;
 	for(StateOpt newState = std::visit(ctx, state, e); newState;)
 	{
+		changed = true;
+		auto& stats = Stats::Get();
+		stats.AddRoomsInState(state.index(), -1);
 		state = std::move(*newState);
+		stats.AddRoomsInState(state.index(), 1);
+		ctx.SetSpectatorFeedOpen(std::holds_alternative<State::Dueling>(state));
 		newState = std::visit(ctx, state);
 	}
+	ctx.FlushSpectatorFeed();
+	ctx.AccountDispatch(std::chrono::steady_clock::now() - start);
+	if(active || changed)
+		lastActivity = start;
+	if(changed)
+		idleTimer.Arm(IdleTimeout());
+	if(!wasWaiting)
+		return;
+	// NOTE: Only the strand publishes, so it can read `listing` as is.
+	const bool started = !std::holds_alternative<State::Waiting>(state);
+	auto duelists = ctx.GetDuelistsNames();
+	if(listing->started == started && listing->duelists == duelists)
+		return;
+	std::atomic_store(&listing, std::make_shared<const ListingProps>(
+		ListingProps{listing->generation + 1U, started, std::move(duelists)}));
+}
+
+// private
+
+Instance::IdleTimer::IdleTimer(Instance& room) :
+	room(room),
+	wheel(boost::asio::use_service<TimerWheel>(room.Strand().context()))
+{}
+
+Instance::IdleTimer::~IdleTimer()
+{
+	wheel.Cancel(*this);
+}
+
+void Instance::IdleTimer::Arm(TimerWheel::Clock::duration timeout)
+{
+	if(timeout == TimerWheel::Clock::duration::zero())
+		wheel.Cancel(*this);
+	else
+		wheel.Arm(*this, timeout);
+}
+
+std::function<void()> Instance::IdleTimer::Expire()
+{
+	// NOTE: Same as TimerAggregator, the room might be going away already.
+	return [wroom = room.weak_from_this()]()
+	{
+		auto room = wroom.lock();
+		if(!room)
+			return;
+		auto& strand = room->Strand();
+		boost::asio::post(strand, [room = std::move(room)]()
+		{
+			room->CheckIdle();
+		});
+	};
+}
+
+std::chrono::seconds Instance::IdleTimeout() const
+{
+	return std::visit([this](const auto& s)
+	{
+		using S = std::decay_t<decltype(s)>;
+		if constexpr(std::is_same_v<S, State::Waiting>)
+			return idleTimeouts.waiting;
+		else if constexpr(std::is_same_v<S, State::RockPaperScissor> || std::is_same_v<S, State::ChoosingTurn>)
+			return idleTimeouts.choosing;
+		else if constexpr(std::is_same_v<S, State::Dueling>)
+			return idleTimeouts.dueling;
+		else if constexpr(std::is_same_v<S, State::Sidedecking>)
+			return idleTimeouts.sidedecking;
+		else if constexpr(std::is_same_v<S, State::Rematching>)
+			return idleTimeouts.rematching;
+		else
+			return std::chrono::seconds{};
+	}, state);
+}
+
+void Instance::CheckIdle()
+{
+	const auto timeout = IdleTimeout();
+	if(timeout.count() == 0)
+		return;
+	const auto idle = std::chrono::steady_clock::now() - lastActivity;
+	if(idle < timeout)
+	{
+		idleTimer.Arm(timeout - idle);
+		return;
+	}
+	Stats::Get().RecordIdleClose();
+	Dispatch(Event::Idle{});
 }
 
 } // namespace Ignis::Multirole::Room
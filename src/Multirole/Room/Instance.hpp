@@ -1,5 +1,10 @@
 #ifndef ROOM_INSTANCE_HPP
 #define ROOM_INSTANCE_HPP
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
 #include <set>
 #include <string>
 #include <string_view>
@@ -19,6 +24,19 @@ namespace Room
 class Instance final : public std::enable_shared_from_this<Instance>
 {
 public:
+	// Time a room can go without activity in each state before it's
+	// closed, zero meaning forever. Activity is anything done by its
+	// duelists, clients joining, duel processing and moving to another
+	// state, but not spectators chatting.
+	struct IdleTimeouts
+	{
+		std::chrono::seconds waiting;
+		std::chrono::seconds choosing; // RockPaperScissor and ChoosingTurn.
+		std::chrono::seconds dueling;
+		std::chrono::seconds sidedecking;
+		std::chrono::seconds rematching;
+	};
+
 	// Data passed on the ctor.
 	struct CreateInfo
 	{
@@ -31,15 +49,36 @@ public:
 		YGOPro::BanlistPtr banlist;
 		YGOPro::HostInfo hostInfo;
 		YGOPro::DeckLimits limits;
+		std::chrono::microseconds processBudget;
+		bool queryDeltas;
+		Context::CostLimits costLimits;
+		Context::MemoryBudget memoryBudget;
+		Client::SendLimits sendLimits;
+		Client::ChatLimits chatLimits;
+		IdleTimeouts idleTimeouts;
+		std::function<void()> expiryHook; // Called once the room is destroyed.
+	};
+
+	// State of the room shown on the lobby listing. A new one is published
+	// by the room strand whenever any of it changes, so that the listing
+	// can read it from any thread without taking locks.
+	struct ListingProps
+	{
+		// Changes on every publication, so that listings can be cached
+		// in between.
+		uint64_t generation;
+		bool started; // Whether or not the room state is not Waiting.
+		std::map<uint8_t, std::string> duelists; // Names by index.
 	};
 
 	// Ctor and registering.
 	Instance(CreateInfo& info);
+	~Instance();
 
 	// Get whether or not the room is private (has password set).
 	bool IsPrivate() const;
 
-	// Check if the room state is not Waiting.
+	// Check if the room state is not Waiting, as last published.
 	bool Started() const;
 
 	// Get the notes of the room.
@@ -48,8 +87,8 @@ public:
 	// Get the game options of the room.
 	const YGOPro::HostInfo& HostInfo() const;
 
-	// Get each duelist index along with their name.
-	std::map<uint8_t, std::string> DuelistNames() const;
+	// Get the latest published listing state of the room.
+	std::shared_ptr<const ListingProps> Listing() const;
 
 	// Check if the given string matches the set password,
 	// always return true if the password is empty.
@@ -61,27 +100,75 @@ public:
 	// Tries to remove the room if its not started.
 	void TryClose();
 
+	// Moves the duel onto a fresh core, if there's one going on.
+	void TryMigrate();
+
+	// Dispatches the event only after other work queued on the strand had
+	// its chance to run.
+	void PostDispatch(EventVariant e);
+
+	// Events posted with PostDispatch that didn't run yet.
+	std::size_t PendingEvents() const;
+
 	// Adds an IP to the kicked list, checked with CheckKicked.
 	void AddKicked(const boost::asio::ip::address& addr);
 
 	void Add(const std::shared_ptr<Client>& client);
 	void Remove(const std::shared_ptr<Client>& client);
 	boost::asio::io_context::strand& Strand();
-	void Dispatch(const EventVariant& e);
+	const Client::SendLimits& ClientSendLimits() const;
+	const Client::ChatLimits& ClientChatLimits() const;
+	// Accounts bytes queued for a client of the room, see Context.
+	void AccountSent(std::size_t bytes);
+	// Trace of the current duel of the room, see Context.
+	DuelTrace& Trace();
+	void Dispatch(EventVariant e);
 private:
+	// Checks whether the room went idle once the timeout of its state
+	// elapsed, see IdleTimeouts.
+	class IdleTimer final : public TimerWheel::Entry
+	{
+	public:
+		IdleTimer(Instance& room);
+		~IdleTimer() override;
+
+		// Arms the timer, or cancels it if `timeout` is zero.
+		void Arm(TimerWheel::Clock::duration timeout);
+	private:
+		Instance& room;
+		TimerWheel& wheel;
+
+		std::function<void()> Expire() override;
+	};
+
 	boost::asio::io_context::strand strand;
 	TimerAggregator tagg;
+	IdleTimer idleTimer;
 	const std::string notes;
 	const std::string pass;
 	const bool isPrivate;
+	const Client::SendLimits sendLimits;
+	const Client::ChatLimits chatLimits;
+	const IdleTimeouts idleTimeouts;
+	const std::function<void()> expiryHook;
 	Context ctx;
 	StateVariant state;
+	std::shared_ptr<const ListingProps> listing; // Accessed atomically.
+	std::atomic<std::size_t> pendingEvents;
+	std::chrono::steady_clock::time_point lastActivity;
 
 	std::set<std::shared_ptr<Client>> clients;
 	std::mutex mClients;
 
 	std::set<boost::asio::ip::address> kicked;
 	mutable std::mutex mKicked;
+
+	// Timeout of the current state, see IdleTimeouts.
+	std::chrono::seconds IdleTimeout() const;
+
+	// Closes the room if it's been idle for long enough, otherwise checks
+	// again once it could be.
+	void CheckIdle();
 };
 
 } // namespace Room
@@ -0,0 +1,86 @@
+#include "SpectatorFeed.hpp"
+
+#include <algorithm>
+#include <vector>
+
+#include "Client.hpp"
+
+namespace Ignis::Multirole::Room
+{
+
+bool SpectatorFeed::IsOpen() const
+{
+	return open;
+}
+
+void SpectatorFeed::Open()
+{
+	open = true;
+}
+
+void SpectatorFeed::Close()
+{
+	open = false;
+	// NOTE: Readers might leave while being stopped.
+	const std::vector<Client*> rs(readers.begin(), readers.end());
+	for(auto* c : rs)
+		c->StopFeed();
+}
+
+uint64_t SpectatorFeed::End() const
+{
+	return base + entries.size();
+}
+
+const YGOPro::STOCMsg& SpectatorFeed::At(uint64_t pos) const
+{
+	return entries[static_cast<std::size_t>(pos - base)].msg;
+}
+
+std::size_t SpectatorFeed::BytesSince(uint64_t from) const
+{
+	if(from >= End())
+		return 0U;
+	return bytes - entries[static_cast<std::size_t>(from - base)].bytes;
+}
+
+std::size_t SpectatorFeed::HeldBytes() const
+{
+	return BytesSince(base);
+}
+
+void SpectatorFeed::Append(const YGOPro::STOCMsg& msg)
+{
+	entries.push_back({msg, bytes});
+	bytes += msg.Length();
+	appended = true;
+}
+
+void SpectatorFeed::AddReader(Client& c)
+{
+	readers.insert(&c);
+}
+
+void SpectatorFeed::RemoveReader(Client& c)
+{
+	readers.erase(&c);
+}
+
+void SpectatorFeed::Flush()
+{
+	if(appended)
+	{
+		appended = false;
+		// NOTE: Readers might leave if they fell behind.
+		const std::vector<Client*> rs(readers.begin(), readers.end());
+		for(auto* c : rs)
+			c->DrainFeed();
+	}
+	uint64_t slowest = End();
+	for(const auto* c : readers)
+		slowest = std::min(slowest, c->FeedCursor());
+	for(; base < slowest; base++)
+		entries.pop_front();
+}
+
+} // namespace Ignis::Multirole::Room
@@ -0,0 +1,66 @@
+#ifndef ROOM_SPECTATOR_FEED_HPP
+#define ROOM_SPECTATOR_FEED_HPP
+#include <cstdint>
+#include <deque>
+#include <set>
+
+#include "../YGOPro/STOCMsg.hpp"
+
+namespace Ignis::Multirole::Room
+{
+
+class Client;
+
+// Append-only log of the messages every spectator gets while dueling.
+// Each spectator keeps a cursor into it and writes from there as its
+// socket allows, so sending something to all of them is a single append
+// instead of a queue operation per spectator. Messages are dropped once
+// every reader wrote them. Only used from the strand of the room.
+class SpectatorFeed
+{
+public:
+	bool IsOpen() const;
+
+	// While closed, readers are stopped at the current end, so they don't
+	// get what is appended once it opens again.
+	void Open();
+	void Close();
+
+	// Position past the last message appended.
+	uint64_t End() const;
+
+	// Message at `pos`, which must be between the slowest reader and End.
+	const YGOPro::STOCMsg& At(uint64_t pos) const;
+
+	// Bytes of the messages between `from` and End.
+	std::size_t BytesSince(uint64_t from) const;
+
+	// Bytes of the messages kept for the slowest reader.
+	std::size_t HeldBytes() const;
+
+	void Append(const YGOPro::STOCMsg& msg);
+
+	// Called by Client, see Client::ReadFeed and Client::LeaveFeed.
+	void AddReader(Client& c);
+	void RemoveReader(Client& c);
+
+	// Lets readers know there's something new for them and drops what
+	// every one of them already wrote.
+	void Flush();
+private:
+	struct Entry
+	{
+		YGOPro::STOCMsg msg;
+		std::size_t bytes; // Of this and every message before it.
+	};
+	std::deque<Entry> entries;
+	uint64_t base{}; // Position of the first entry.
+	std::size_t bytes{};
+	std::set<Client*> readers;
+	bool open{};
+	bool appended{};
+};
+
+} // namespace Ignis::Multirole::Room
+
+#endif // ROOM_SPECTATOR_FEED_HPP
@@ -3,9 +3,12 @@
 #include <array>
 #include <chrono>
 #include <deque>
+#include <memory>
+#include <memory_resource>
 #include <optional>
 #include <set>
 #include <variant>
+#include <vector>
 
 #include "../YGOPro/Replay.hpp"
 #include "../YGOPro/STOCMsg.hpp"
@@ -44,12 +47,24 @@ struct Dueling
 	std::unique_ptr<YGOPro::Replay> replay;
 	std::array<uint8_t, 2U> currentPos;
 	std::array<uint8_t, 2U> retryCount;
-	std::vector<uint8_t> lastHint;
-	std::vector<uint8_t> lastRequest;
+	// NOTE: Containers are allocated from the arena of the room context.
+	std::pmr::vector<uint8_t> lastHint;
+	std::pmr::vector<uint8_t> lastRequest;
 	Client* replier;
 	std::optional<uint32_t> matchKillReason;
-	std::deque<YGOPro::STOCMsg> spectatorCache;
+	std::pmr::deque<YGOPro::STOCMsg> spectatorCache;
+	// Copy of the cache streamed to joining spectators, shared by all of
+	// them until the cache changes. Not allocated from the arena, as it
+	// can outlive the duel.
+	std::shared_ptr<const std::vector<YGOPro::STOCMsg>> spectatorSnapshot;
 	std::array<std::chrono::milliseconds, 2U> timeRemaining;
+	std::size_t msgsSinceResponse; // Messages handled since last response.
+	std::size_t skipMsgs; // Messages already handled before a restore.
+	uint8_t coreRestores;
+	bool yielded; // Processing gave the strand back and will resume later.
+	std::size_t yields; // Times processing ran out of budget this duel.
+	bool checkpointPending; // A turn started since the cache was compacted.
+	std::size_t spectatorCacheBytes; // Of the messages on the cache.
 };
 
 struct Rematching
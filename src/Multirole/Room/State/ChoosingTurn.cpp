@@ -1,6 +1,5 @@
 #include "../Context.hpp"
 
-#include "../../Service/CoreProvider.hpp"
 #include "../../YGOPro/Constants.hpp"
 
 namespace Ignis::Multirole::Room
@@ -9,6 +8,7 @@ namespace Ignis::Multirole::Room
 StateOpt Context::operator()(State::ChoosingTurn& s)
 {
 	s.turnChooser->Send(MakeAskIfGoingFirst());
+	PrepareDuel();
 	return std::nullopt;
 }
 
@@ -33,20 +33,31 @@ StateOpt Context::operator()(State::ChoosingTurn& s, const Event::ChooseTurn& e)
 		}
 		return {uint8_t(0U), uint8_t(0U)};
 	};
+	// Nothing allocated from the arena outlives the duel, so whatever the
+	// last one left pooled is given back now.
+	duelArena.release();
 	return State::Dueling
 	{
-		svc.coreProvider.GetCore(),
+		AcquireCore(),
 		nullptr,
 		0U,
 		nullptr,
 		DecidePlayerOrder(),
 		{uint8_t(0U), uint8_t(0U)},
-		{},
-		{},
+		std::pmr::vector<uint8_t>(&duelArena),
+		std::pmr::vector<uint8_t>(&duelArena),
 		nullptr,
 		std::nullopt,
+		std::pmr::deque<YGOPro::STOCMsg>(&duelArena),
+		nullptr,
 		{},
-		{}
+		0U,
+		0U,
+		0U,
+		false,
+		0U,
+		false,
+		0U
 	};
 }
 
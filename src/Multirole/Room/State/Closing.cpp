@@ -1,5 +1,10 @@
 #include "../Context.hpp"
 
+#include <spdlog/spdlog.h>
+
+#include "../../I18N.hpp"
+#include "../../YGOPro/Constants.hpp"
+
 namespace Ignis::Multirole::Room
 {
 
@@ -11,6 +16,7 @@ StateOpt Context::operator()(State::Closing& /*unused*/)
 	for(const auto& c : spectators)
 		c->Disconnect();
 	spectators.clear();
+	ReleaseCore();
 	return std::nullopt;
 }
 
@@ -20,4 +26,15 @@ StateOpt Context::operator()(State::Closing& /*unused*/, const Event::Join& e)
 	return std::nullopt;
 }
 
+// private
+
+StateOpt Context::CloseIdle(bool started)
+{
+	spdlog::info(I18N::ROOM_IDLE_CLOSED, id);
+	SendToAll(MakeChat(CHAT_MSG_TYPE_ERROR, I18N::CLIENT_ROOM_IDLE));
+	if(started)
+		SendToAll(MakeDuelEnd());
+	return State::Closing{};
+}
+
 } // namespace Ignis::Multirole::Room
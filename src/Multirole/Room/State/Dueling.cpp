@@ -1,10 +1,16 @@
 #include "../Context.hpp"
 
+#include <algorithm> // std::find, std::sort
+#include <cstring> // std::memcpy
+#include <type_traits>
 #include <spdlog/spdlog.h>
 
+#include "../Instance.hpp"
+#include "../Stats.hpp"
 #include "../TimerAggregator.hpp"
 #include "../../I18N.hpp"
 #include "../../Core/IWrapper.hpp"
+#include "../../Service/CoreProvider.hpp"
 #include "../../Service/ReplayManager.hpp"
 #include "../../Service/ScriptProvider.hpp"
 #include "../../YGOPro/CardDatabase.hpp"
@@ -15,6 +21,7 @@ namespace Ignis::Multirole::Room
 {
 
 constexpr auto GRACE_PERIOD = std::chrono::seconds(5);
+constexpr uint8_t MAX_CORE_RESTORES = 2U;
 
 inline void ResetTimers(State::Dueling& s, uint32_t limitInSeconds)
 {
@@ -30,14 +37,37 @@ constexpr auto CORE_EXC_REASON = Context::DuelFinishReason
 	2U // NOLINT: Draw.
 };
 
-StateOpt Context::operator()(State::Dueling& s)
+// Recorded onto the replay index.
+inline const char* FinishReasonName(Context::DuelFinishReason::Reason reason)
+{
+	using Reason = Context::DuelFinishReason::Reason;
+	switch(reason)
+	{
+	case Reason::REASON_DUEL_WON: return "duel_won";
+	case Reason::REASON_SURRENDERED: return "surrendered";
+	case Reason::REASON_TIMED_OUT: return "timed_out";
+	case Reason::REASON_WRONG_RESPONSE: return "wrong_response";
+	case Reason::REASON_CONNECTION_LOST: return "connection_lost";
+	case Reason::REASON_CORE_CRASHED: return "core_crashed";
+	case Reason::REASON_MEMORY_EXCEEDED: return "memory_exceeded";
+	case Reason::REASON_IDLE: return "idle";
+	}
+	return "unknown";
+}
+
+// FNV-1a, mixing in each value as a whole.
+inline void HashMix(uint64_t& h, uint64_t v)
+{
+	constexpr uint64_t FNV_PRIME = 0x100000001B3U;
+	h = (h ^ v) * FNV_PRIME;
+}
+
+// Extra rules are enabled by adding custom cards with the rulesets to
+// the game as playable cards, they trigger immediately after the duel
+// starts.
+inline std::vector<uint32_t> ExtraRuleCards(const YGOPro::HostInfo& hostInfo)
 {
 	using namespace YGOPro;
-	const auto seed = static_cast<uint32_t>(rng());
-	// Enable extra rules for the duel.
-	// These are controlled simply by adding custom cards
-	// with the rulesets to the game as playable cards, they will
-	// trigger immediately after the duel starts.
 	std::vector<uint32_t> extraCards;
 #define X(f, c) if(hostInfo.extraRules & (f)) extraCards.push_back(c)
 	// NOTE: no lint used because we dont want clang-tidy to complain
@@ -55,8 +85,105 @@ StateOpt Context::operator()(State::Dueling& s)
 	X(EXTRA_RULE_DECK_MASTER,        300U);       // NOLINT
 	X(EXTRA_RULE_ACTION_DUEL,        151999999U); // NOLINT
 #undef X
+	return extraCards;
+}
+
+inline Service::CoreProvider::DuelTraits MakeDuelTraits(
+	const YGOPro::HostInfo& hostInfo,
+	const std::map<Client::PosType, Client*>& duelists)
+{
+	constexpr uint64_t FNV_OFFSET_BASIS = 0xCBF29CE484222325U;
+	// NOTE: Only rooms with extra rules get a host signature, otherwise a
+	// single crash would mark every room on the same master rule.
+	uint64_t host = 0U;
+	if(hostInfo.extraRules != 0U)
+	{
+		host = FNV_OFFSET_BASIS;
+		HashMix(host, YGOPro::HostInfo::OrDuelFlags(hostInfo.duelFlagsHigh, hostInfo.duelFlagsLow));
+		HashMix(host, hostInfo.extraRules);
+	}
+	// NOTE: Each card runs its script once no matter how many copies
+	// there are, so only the set of cards added to the duel is hashed.
+	auto codes = ExtraRuleCards(hostInfo);
+	for(const auto& kv : duelists)
+	{
+		if(const auto* deck = kv.second->CurrentDeck(); deck != nullptr)
+		{
+			codes.insert(codes.end(), deck->Main().begin(), deck->Main().end());
+			codes.insert(codes.end(), deck->Extra().begin(), deck->Extra().end());
+		}
+	}
+	std::sort(codes.begin(), codes.end());
+	codes.erase(std::unique(codes.begin(), codes.end()), codes.end());
+	uint64_t pool = FNV_OFFSET_BASIS;
+	for(const auto code : codes)
+		HashMix(pool, code);
+	return {{host, pool}, hostInfo.extraRules, hostInfo.banlistHash};
+}
+
+// Whether or not clients are known to leave the information they have
+// about cards alone when handling a message of the given type, so that
+// query deltas sent afterwards can still build on it.
+inline bool LeavesCardsUntouched(uint8_t msgType)
+{
+	switch(msgType)
+	{
+	case MSG_HINT:
+	case MSG_WAITING:
+	case MSG_NEW_TURN:
+	case MSG_NEW_PHASE:
+	case MSG_SELECT_BATTLECMD:
+	case MSG_SELECT_IDLECMD:
+	case MSG_SELECT_EFFECTYN:
+	case MSG_SELECT_YESNO:
+	case MSG_SELECT_OPTION:
+	case MSG_SELECT_CHAIN:
+	case MSG_SELECT_PLACE:
+	case MSG_SELECT_DISFIELD:
+	case MSG_ROCK_PAPER_SCISSORS:
+	case MSG_ANNOUNCE_RACE:
+	case MSG_ANNOUNCE_ATTRIB:
+	case MSG_ANNOUNCE_NUMBER:
+	{
+		return true;
+	}
+	default:
+	{
+		return false;
+	}
+	}
+}
+
+// Type of the core message wrapped by a GAME_MSG in the spectator cache.
+inline uint8_t GetCachedMessageType(const YGOPro::STOCMsg& msg)
+{
+	constexpr std::size_t HEADER_SIZE = sizeof(uint16_t) + sizeof(uint8_t);
+	return msg.Data()[HEADER_SIZE];
+}
+
+StateOpt Context::operator()(State::Dueling& s)
+{
+	using namespace YGOPro;
+	for(auto& sq : sentQueries)
+		sq.Clear();
+	duelCost = {};
+	// Take the duel created ahead of time if it was made on this same core.
+	void* preparedDuelPtr = nullptr;
+	uint32_t seed{};
+	if(nextDuelPtr != nullptr && s.core == core)
+	{
+		preparedDuelPtr = std::exchange(nextDuelPtr, nullptr);
+		seed = nextSeed;
+	}
+	else
+	{
+		seed = static_cast<uint32_t>(rng());
+	}
+	// Enable extra rules for the duel.
+	const auto extraCards = ExtraRuleCards(hostInfo);
 	// Construct replay.
 	s.replayId = svc.replayManager.NewId();
+	trace.Start(id, s.replayId);
 	auto CurrentTime = []()
 	{
 		using namespace std::chrono;
@@ -67,41 +194,25 @@ StateOpt Context::operator()(State::Dueling& s)
 		static_cast<uint32_t>(CurrentTime()),
 		seed,
 		hostInfo,
-		extraCards
+		extraCards,
+		&duelArena
 	);
 	// Create core duel with room's options.
-	const OCG_Player popt =
-	{
-		hostInfo.startingLP,
-		hostInfo.startingDrawCount,
-		hostInfo.drawCountPerTurn
-	};
-	const Core::IWrapper::DuelOptions dopts =
-	{
-		*cdb,
-		svc.scriptProvider,
-		nullptr, // TODO
-		seed,
-		HostInfo::OrDuelFlags(hostInfo.duelFlagsHigh, hostInfo.duelFlagsLow),
-		popt,
-		popt
-	};
 	try
 	{
-		s.duelPtr = s.core->CreateDuel(dopts);
-		auto LoadScript = [&](std::string_view file)
-		{
-			if(auto scr = svc.scriptProvider.ScriptFromFilePath(file); !scr.empty())
-				s.core->LoadScript(s.duelPtr, file, scr);
-		};
-		LoadScript("constant.lua");
-		LoadScript("utility.lua");
+		if(preparedDuelPtr != nullptr)
+			s.duelPtr = preparedDuelPtr;
+		else
+			s.duelPtr = CreateBaseDuel(*s.core, seed);
 	}
 	catch(Core::Exception& e)
 	{
-		spdlog::error(I18N::ROOM_DUELING_CORE_EXCEPT_CREATION, s.replayId, e.what());
+		spdlog::error(I18N::ROOM_DUELING_CORE_EXCEPT_CREATION, id, s.replayId, e.what());
+		ReportCrash(e);
 		return Finish(s, CORE_EXC_REASON);
 	}
+	// Cards are added in batches, a single step for out-of-process cores.
+	std::vector<OCG_NewCardInfo> cards;
 	OCG_NewCardInfo nci{};
 	try
 	{
@@ -109,12 +220,14 @@ StateOpt Context::operator()(State::Dueling& s)
 		for(auto code : extraCards)
 		{
 			nci.code = code;
-			s.core->AddCard(s.duelPtr, nci);
+			cards.push_back(nci);
 		}
+		s.core->AddCards(s.duelPtr, cards);
 	}
 	catch(Core::Exception& e)
 	{
-		spdlog::error(I18N::ROOM_DUELING_CORE_EXCEPT_EXTRA_CARDS, s.replayId, e.what());
+		spdlog::error(I18N::ROOM_DUELING_CORE_EXCEPT_EXTRA_CARDS, id, s.replayId, e.what());
+		ReportCrash(e);
 		return Finish(s, CORE_EXC_REASON);
 	}
 	// Add main and extra deck cards for all players.
@@ -129,6 +242,7 @@ StateOpt Context::operator()(State::Dueling& s)
 	try
 	{
 		const auto teamCount = GetTeamCounts();
+		cards.clear();
 		for(const auto& kv : duelists)
 		{
 			const uint8_t t = kv.first.first;
@@ -140,13 +254,13 @@ StateOpt Context::operator()(State::Dueling& s)
 			for(auto code : finalMainDeck)
 			{
 				nci.code = code;
-				s.core->AddCard(s.duelPtr, nci);
+				cards.push_back(nci);
 			}
 			nci.loc = LOCATION_EXTRA;
 			for(auto code : deck.Extra())
 			{
 				nci.code = code;
-				s.core->AddCard(s.duelPtr, nci);
+				cards.push_back(nci);
 			}
 			s.replay->AddDuelist(nci.team, nci.duelist,
 			{
@@ -155,15 +269,37 @@ StateOpt Context::operator()(State::Dueling& s)
 				deck.Extra()
 			});
 		}
+		s.core->AddCards(s.duelPtr, cards);
 		s.core->Start(s.duelPtr);
+		// Everything that is queried to start the duel is done at once:
+		// the deck and extra deck counts of each team, followed by their
+		// decks to record and extra decks to send.
+		using Kind = Core::IWrapper::BatchQuery::Kind;
+		batchQueries.clear();
+		for(uint8_t team = 0U; team < 2U; team++)
+		{
+			batchQueries.push_back({Kind::COUNT, {0U, team, LOCATION_DECK, 0U, 0U}});
+			batchQueries.push_back({Kind::COUNT, {0U, team, LOCATION_EXTRA, 0U, 0U}});
+		}
+		for(uint8_t team = 0U; team < 2U; team++)
+			batchQueries.push_back({Kind::LOCATION, {0x1181FFF, team, LOCATION_DECK, 0U, 0U}});
+		for(uint8_t team = 0U; team < 2U; team++)
+			batchQueries.push_back({Kind::LOCATION, {0x381FFF, team, LOCATION_EXTRA, 0U, 0U}});
+		s.core->QueryBatch(s.duelPtr, batchQueries, batchResults);
+		auto Count = [&](std::size_t i) -> std::size_t
+		{
+			uint32_t count = 0U;
+			std::memcpy(&count, batchResults[i].data(), sizeof(count));
+			return count;
+		};
 		// Create and send MSG_START message to clients.
 		auto msgStart = CoreUtils::MakeStartMsg(
 			{
 				hostInfo.startingLP,
-				s.core->QueryCount(s.duelPtr, 0U, LOCATION_DECK),
-				s.core->QueryCount(s.duelPtr, 0U, LOCATION_EXTRA),
-				s.core->QueryCount(s.duelPtr, 1U, LOCATION_DECK),
-				s.core->QueryCount(s.duelPtr, 1U, LOCATION_EXTRA),
+				Count(0U),
+				Count(1U),
+				Count(2U),
+				Count(3U),
 			});
 		s.replay->RecordMsg(msgStart);
 		SendToTeam(GetSwappedTeam(0U), MakeGameMsg(msgStart));
@@ -174,43 +310,28 @@ StateOpt Context::operator()(State::Dueling& s)
 		// Record queries for deck data.
 		auto RecordDecks = [&](uint8_t team)
 		{
-			const Core::IWrapper::QueryInfo qInfo =
-			{
-				0x1181FFF,
-				team,
-				LOCATION_DECK,
-				0U,
-				0U
-			};
 			using namespace YGOPro::CoreUtils;
-			const auto buffer = s.core->QueryLocation(s.duelPtr, qInfo);
-			s.replay->RecordMsg(MakeUpdateDataMsg(qInfo.con, qInfo.loc, buffer));
+			const auto& buffer = batchResults[4U + team];
+			s.replay->RecordMsg(MakeUpdateDataMsg(team, LOCATION_DECK, buffer));
 		};
 		RecordDecks(0U);
 		RecordDecks(1U);
 		// Send extra deck queries.
 		auto SendExtraDecks = [&](uint8_t team)
 		{
-			const Core::IWrapper::QueryInfo qInfo =
-			{
-				0x381FFF,
-				team,
-				LOCATION_EXTRA,
-				0U,
-				0U
-			};
 			using namespace YGOPro::CoreUtils;
-			const auto buffer = s.core->QueryLocation(s.duelPtr, qInfo);
-			const auto msg = MakeUpdateDataMsg(qInfo.con, qInfo.loc, buffer);
+			const auto& buffer = batchResults[6U + team];
+			const auto msg = MakeUpdateDataMsg(team, LOCATION_EXTRA, buffer);
 			s.replay->RecordMsg(msg);
-			SendToTeam(GetSwappedTeam(qInfo.con), MakeGameMsg(msg));
+			SendToTeam(GetSwappedTeam(team), MakeGameMsg(msg));
 		};
 		SendExtraDecks(0U);
 		SendExtraDecks(1U);
 	}
 	catch(Core::Exception& e)
 	{
-		spdlog::error(I18N::ROOM_DUELING_CORE_EXCEPT_STARTING, s.replayId, e.what());
+		spdlog::error(I18N::ROOM_DUELING_CORE_EXCEPT_STARTING, id, s.replayId, e.what());
+		ReportCrash(e);
 		return Finish(s, CORE_EXC_REASON);
 	}
 	// Start processing the duel.
@@ -233,20 +354,62 @@ StateOpt Context::operator()(State::Dueling& s, const Event::ConnectionLost& e)
 	return Finish(s, DuelFinishReason{Reason::REASON_CONNECTION_LOST, winner});
 }
 
+StateOpt Context::operator()(State::Dueling& s, const Event::Idle& /*unused*/)
+{
+	using Reason = DuelFinishReason::Reason;
+	spdlog::info(I18N::ROOM_IDLE_CLOSED, id);
+	SendToAll(MakeChat(CHAT_MSG_TYPE_ERROR, I18N::CLIENT_ROOM_IDLE));
+	// Whoever the duel is waiting on is the one stalling it.
+	const uint8_t winner = (s.replier != nullptr) ? 1U - s.replier->Position().first : 2U;
+	return Finish(s, DuelFinishReason{Reason::REASON_IDLE, winner});
+}
+
 StateOpt Context::operator()(State::Dueling& s, const Event::Join& e)
 {
+	// Relays keep only the last snapshot of the room, so it's marked as one.
+	if(e.client.IsRelay())
+		e.client.Send(MakeRelaySnapshot(true));
 	SetupAsSpectator(e.client);
-	e.client.Send(MakeDuelStart());
-	e.client.Send(MakeCatchUp(true));
-	for(const auto& msg : s.spectatorCache)
-		e.client.Send(msg);
-	e.client.Send(MakeCatchUp(false));
+	SendDuelCatchUp(s, e.client);
+	if(e.client.IsRelay())
+		e.client.Send(MakeRelaySnapshot(false));
+	return std::nullopt;
+}
+
+StateOpt Context::operator()(State::Dueling& s, const Event::Migrate& /*unused*/)
+{
+	auto oldCore = s.core;
+	auto* oldDuelPtr = s.duelPtr;
+	if(!Restore(s))
+		return std::nullopt;
+	try
+	{
+		oldCore->DestroyDuel(oldDuelPtr);
+	}
+	catch(Core::Exception& e)
+	{
+		spdlog::info(I18N::ROOM_DUELING_CORE_EXCEPT_DESTRUCTOR, id, s.replayId, e.what());
+	}
+	// Brings the new core up to where the old one was waiting.
+	if(const auto dfrOpt = Process(s); dfrOpt)
+		return Finish(s, *dfrOpt);
+	return std::nullopt;
+}
+
+StateOpt Context::operator()(State::Dueling& s, const Event::ProcessMore& /*unused*/)
+{
+	// NOTE: Stale if processing already resumed through other means.
+	if(!s.yielded)
+		return std::nullopt;
+	if(const auto dfrOpt = Process(s); dfrOpt)
+		return Finish(s, *dfrOpt);
 	return std::nullopt;
 }
 
 StateOpt Context::operator()(State::Dueling& s, const Event::Response& e)
 {
-	if(s.replier != &e.client)
+	// NOTE: Responses are not expected while processing is still ongoing.
+	if(s.replier != &e.client || s.yielded)
 		return std::nullopt;
 	if(hostInfo.timeLimitInSeconds != 0U)
 	{
@@ -257,14 +420,19 @@ StateOpt Context::operator()(State::Dueling& s, const Event::Response& e)
 		tagg.Cancel(team);
 	}
 	s.replay->RecordResponse(e.data);
+	s.msgsSinceResponse = s.skipMsgs = 0U;
 	try
 	{
-		s.core->SetResponse(s.duelPtr, e.data);
+		const DuelTrace::Span span(trace, "set_response");
+		s.core->SetResponse(s.duelPtr, {e.data.data(), e.data.size()});
 	}
 	catch(Core::Exception& e)
 	{
-		spdlog::error(I18N::ROOM_DUELING_CORE_EXCEPT_RESPONSE, s.replayId, e.what());
-		return Finish(s, CORE_EXC_REASON);
+		spdlog::error(I18N::ROOM_DUELING_CORE_EXCEPT_RESPONSE, id, s.replayId, e.what());
+		ReportCrash(e);
+		if(s.coreRestores++ >= MAX_CORE_RESTORES || !Restore(s))
+			return Finish(s, CORE_EXC_REASON);
+		SendToAll(MakeChat(CHAT_MSG_TYPE_ERROR, I18N::CLIENT_ROOM_CORE_RESTORED));
 	}
 	if(const auto dfrOpt = Process(s); dfrOpt)
 		return Finish(s, *dfrOpt);
@@ -293,6 +461,104 @@ StateOpt Context::operator()(State::Dueling& s, const Event::TimerExpired& e)
 
 // private
 
+std::shared_ptr<Core::IWrapper> Context::AcquireCore()
+{
+	const auto traits = MakeDuelTraits(hostInfo, duelists);
+	const bool isolate = svc.coreProvider.ShouldIsolate(traits);
+	if(const auto gen = svc.coreProvider.Generation(); !core || gen != coreGen || isolate != coreIsolated)
+	{
+		DiscardPreparedDuel();
+		core = svc.coreProvider.GetCore(traits);
+		coreGen = gen;
+		coreIsolated = isolate;
+	}
+	crashSig = traits.sig;
+	return core;
+}
+
+void Context::ReportCrash(const Core::Exception& e)
+{
+	// NOTE: Hangs and failed calls say nothing about the duel crashing.
+	if(e.Crashed())
+		svc.coreProvider.ReportCrash(crashSig);
+}
+
+void Context::PrepareDuel()
+{
+	if(nextDuelPtr != nullptr && svc.coreProvider.Generation() == coreGen)
+		return;
+	try
+	{
+		auto c = AcquireCore();
+		nextSeed = static_cast<uint32_t>(rng());
+		nextDuelPtr = CreateBaseDuel(*c, nextSeed);
+	}
+	catch(const std::exception& e)
+	{
+		// Not fatal, the duel will just be created when the game starts.
+		spdlog::info(I18N::ROOM_DUELING_CORE_EXCEPT_PREPARING, id, e.what());
+		ReleaseCore();
+	}
+}
+
+void Context::DiscardPreparedDuel()
+{
+	if(nextDuelPtr == nullptr)
+		return;
+	try
+	{
+		core->DestroyDuel(std::exchange(nextDuelPtr, nullptr));
+	}
+	catch(Core::Exception& e)
+	{
+		spdlog::info(I18N::ROOM_DUELING_CORE_EXCEPT_PREPARING, id, e.what());
+	}
+}
+
+void Context::ReleaseCore()
+{
+	DiscardPreparedDuel();
+	core.reset();
+}
+
+void* Context::CreateBaseDuel(Core::IWrapper& c, uint32_t seed)
+{
+	using namespace YGOPro;
+	const OCG_Player popt =
+	{
+		hostInfo.startingLP,
+		hostInfo.startingDrawCount,
+		hostInfo.drawCountPerTurn
+	};
+	const Core::IWrapper::DuelOptions dopts =
+	{
+		*cdb,
+		svc.scriptProvider,
+		nullptr, // TODO
+		seed,
+		HostInfo::OrDuelFlags(hostInfo.duelFlagsHigh, hostInfo.duelFlagsLow),
+		popt,
+		popt
+	};
+	void* duelPtr = c.CreateDuel(dopts);
+	try
+	{
+		auto LoadScript = [&](std::string_view file)
+		{
+			if(auto scr = svc.scriptProvider.ScriptFromFilePath(file); scr && !scr->empty())
+				c.LoadScript(duelPtr, file, *scr);
+		};
+		LoadScript("constant.lua");
+		LoadScript("utility.lua");
+	}
+	catch(...)
+	{
+		c.DestroyDuel(duelPtr);
+		throw;
+	}
+	return duelPtr;
+}
+
 Client& Context::GetCurrentTeamClient(State::Dueling& s, uint8_t team)
 {
 	return *duelists[{team, s.currentPos[team]}];
@@ -301,7 +567,26 @@ Client& Context::GetCurrentTeamClient(State::Dueling& s, uint8_t team)
 std::optional<Context::DuelFinishReason> Context::Process(State::Dueling& s)
 {
 	using namespace YGOPro::CoreUtils;
-	auto PreAnalyzeMsg = [&](const Msg& msg) -> bool
+	using Clock = std::chrono::steady_clock;
+	// Time spent within core calls during this slice.
+	Clock::duration sliceCore{};
+	auto TimeCore = [&](const char* name, auto&& f)
+	{
+		const DuelTrace::Span span(trace, name);
+		const auto start = Clock::now();
+		if constexpr(std::is_void_v<decltype(f())>)
+		{
+			f();
+			sliceCore += Clock::now() - start;
+		}
+		else
+		{
+			auto r = f();
+			sliceCore += Clock::now() - start;
+			return r;
+		}
+	};
+	auto PreAnalyzeMsg = [&](MsgView msg) -> bool
 	{
 		uint8_t msgType = GetMessageType(msg);
 		if(msgType == MSG_RETRY)
@@ -310,15 +595,15 @@ std::optional<Context::DuelFinishReason> Context::Process(State::Dueling& s)
 			{
 				s.replier->Send(retryErrorMsg);
 				if(!s.lastHint.empty())
-					s.replier->Send(MakeGameMsg(s.lastHint));
-				s.replier->Send(MakeGameMsg(s.lastRequest));
+					s.replier->Send(MakeGameMsg(MsgView(s.lastHint.data(), s.lastHint.size())));
+				s.replier->Send(MakeGameMsg(MsgView(s.lastRequest.data(), s.lastRequest.size())));
 				s.replay->PopBackResponse();
 				return false;
 			}
 		}
 		else if(msgType == MSG_HINT && msg[1U] == 3U) // NOLINT: HINT_SELECTMSG
 		{
-			s.lastHint = msg;
+			s.lastHint.assign(msg.begin(), msg.end());
 		}
 		else if(msgType == MSG_TAG_SWAP)
 		{
@@ -336,19 +621,41 @@ std::optional<Context::DuelFinishReason> Context::Process(State::Dueling& s)
 		else if(msgType == MSG_NEW_TURN)
 		{
 			ResetTimers(s, hostInfo.timeLimitInSeconds);
+			s.checkpointPending = true;
 		}
 		else if(DoesMessageRequireAnswer(msgType))
 		{
 			uint8_t team = GetSwappedTeam(GetMessageReceivingTeam(msg));
 			s.replier = &GetCurrentTeamClient(s, team);
-			s.lastRequest = msg;
+			s.lastRequest.assign(msg.begin(), msg.end());
 		}
 		return true;
 	};
 	auto ProcessQueryRequests = [&](const std::vector<QueryRequest>& qreqs)
 	{
+		if(qreqs.empty())
+			return;
+		// Every request is queried at once, then distributed one by one.
+		using Kind = Core::IWrapper::BatchQuery::Kind;
+		batchQueries.clear();
 		for(const auto& reqVar : qreqs)
 		{
+			if(std::holds_alternative<QuerySingleRequest>(reqVar))
+			{
+				const auto& req = std::get<QuerySingleRequest>(reqVar);
+				batchQueries.push_back({Kind::SINGLE, {req.flags, req.con, req.loc, req.seq, 0U}});
+			}
+			else /*if(std::holds_alternative<QueryLocationRequest>(reqVar))*/
+			{
+				const auto& req = std::get<QueryLocationRequest>(reqVar);
+				batchQueries.push_back({Kind::LOCATION, {req.flags, req.con, req.loc, 0U, 0U}});
+			}
+		}
+		TimeCore("query_batch", [&](){s.core->QueryBatch(s.duelPtr, batchQueries, batchResults);});
+		for(std::size_t i = 0U; i < qreqs.size(); i++)
+		{
+			const auto& reqVar = qreqs[i];
+			const auto& fullBuffer = batchResults[i];
 			if(std::holds_alternative<QuerySingleRequest>(reqVar))
 			{
 				const auto& req = std::get<QuerySingleRequest>(reqVar);
@@ -356,22 +663,19 @@ std::optional<Context::DuelFinishReason> Context::Process(State::Dueling& s)
 				{
 					return MakeGameMsg(MakeUpdateCardMsg(req.con, req.loc, req.seq, qb));
 				};
-				const Core::IWrapper::QueryInfo qInfo =
+				auto Changed = [&](std::size_t view, QueryBuffer& qb) -> bool
 				{
-					req.flags,
-					req.con,
-					req.loc,
-					req.seq,
-					0U
+					return !queryDeltas ||
+						sentQueries[view].EncodeSingle(req.con, req.loc, req.seq, qb);
 				};
-				const auto fullBuffer = s.core->Query(s.duelPtr, qInfo);
-				const auto query = DeserializeSingleQueryBuffer(fullBuffer);
-				const auto ownerBuffer = SerializeSingleQuery(query, false);
-				const auto strippedBuffer = SerializeSingleQuery(query, true);
+				TranscodeSingleQuery(fullBuffer, ownerQueryBuffer, strippedQueryBuffer);
 				s.replay->RecordMsg(MakeUpdateCardMsg(req.con, req.loc, req.seq, fullBuffer));
-				auto strippedMsg = MakeMsg(strippedBuffer);
 				uint8_t team = GetSwappedTeam(req.con);
-				SendToTeam(team, MakeMsg(ownerBuffer));
+				if(Changed(0U, ownerQueryBuffer))
+					SendToTeam(team, MakeMsg(ownerQueryBuffer));
+				if(!Changed(1U, strippedQueryBuffer))
+					continue;
+				auto strippedMsg = MakeMsg(strippedQueryBuffer);
 				SendToTeam(1U - team, strippedMsg);
 				SendToSpectators(SaveToSpectatorCache(s, std::move(strippedMsg)));
 			}
@@ -382,43 +686,46 @@ std::optional<Context::DuelFinishReason> Context::Process(State::Dueling& s)
 				{
 					return MakeGameMsg(MakeUpdateDataMsg(req.con, req.loc, qb));
 				};
-				const Core::IWrapper::QueryInfo qInfo =
+				auto Changed = [&](std::size_t view, QueryBuffer& qb) -> bool
 				{
-					req.flags,
-					req.con,
-					req.loc,
-					0U,
-					0U
+					return !queryDeltas ||
+						sentQueries[view].EncodeLocation(req.con, req.loc, qb);
 				};
 				uint8_t team = GetSwappedTeam(req.con);
-				const auto fullBuffer = s.core->QueryLocation(s.duelPtr, qInfo);
 				s.replay->RecordMsg(MakeUpdateDataMsg(req.con, req.loc, fullBuffer));
 				if(req.loc == LOCATION_DECK)
 					continue;
 				if(req.loc == LOCATION_EXTRA)
 				{
-					SendToTeam(team, MakeMsg(fullBuffer));
+					ownerQueryBuffer.assign(fullBuffer.begin(), fullBuffer.end());
+					if(Changed(0U, ownerQueryBuffer))
+						SendToTeam(team, MakeMsg(ownerQueryBuffer));
 					continue;
 				}
-				const auto query = DeserializeLocationQueryBuffer(fullBuffer);
-				const auto ownerBuffer = SerializeLocationQuery(query, false);
-				const auto strippedBuffer = SerializeLocationQuery(query, true);
-				auto strippedMsg = MakeMsg(strippedBuffer);
-				SendToTeam(team, MakeMsg(ownerBuffer));
+				TranscodeLocationQuery(fullBuffer, ownerQueryBuffer, strippedQueryBuffer);
+				if(Changed(0U, ownerQueryBuffer))
+					SendToTeam(team, MakeMsg(ownerQueryBuffer));
+				if(!Changed(1U, strippedQueryBuffer))
+					continue;
+				auto strippedMsg = MakeMsg(strippedQueryBuffer);
 				SendToTeam(1U - team, strippedMsg);
 				SendToSpectators(SaveToSpectatorCache(s, std::move(strippedMsg)));
 			}
 		}
 	};
-	auto DistributeMsg = [&](const Msg& msg)
+	auto DistributeMsg = [&](MsgView msg)
 	{
 		s.replay->RecordMsg(msg);
+		if(queryDeltas && !LeavesCardsUntouched(GetMessageType(msg)))
+			for(auto& sq : sentQueries)
+				sq.Clear();
 		switch(GetMessageDistributionType(msg))
 		{
 		case MsgDistType::MSG_DIST_TYPE_SPECIFIC_TEAM_DUELIST_STRIPPED:
 		{
 			uint8_t team = GetMessageReceivingTeam(msg);
-			const auto sMsg = StripMessageForTeam(team, msg);
+			auto& sMsg = strippedMsgs[0U];
+			StripMessageForTeam(team, msg, sMsg);
 			auto& client = GetCurrentTeamClient(s, GetSwappedTeam(team));
 			client.Send(MakeGameMsg(sMsg));
 			break;
@@ -446,16 +753,11 @@ std::optional<Context::DuelFinishReason> Context::Process(State::Dueling& s)
 		}
 		case MsgDistType::MSG_DIST_TYPE_EVERYONE_STRIPPED:
 		{
-			const std::array<Msg, 2U> sMsgs =
-			{
-				StripMessageForTeam(0U, msg),
-				StripMessageForTeam(1U, msg)
-			};
+			auto& sMsgs = strippedMsgs;
+			StripMessageForEveryone(msg, sMsgs[0U], sMsgs[1U], sMsgs[2U]);
 			SendToTeam(GetSwappedTeam(0U), MakeGameMsg(sMsgs[0U]));
 			SendToTeam(GetSwappedTeam(1U), MakeGameMsg(sMsgs[1U]));
-			SendToSpectators(
-				SaveToSpectatorCache(s,
-					MakeGameMsg(StripMessageForTeam(1U, sMsgs[0U]))));
+			SendToSpectators(SaveToSpectatorCache(s, MakeGameMsg(sMsgs[2U])));
 			break;
 		}
 		case MsgDistType::MSG_DIST_TYPE_EVERYONE:
@@ -465,13 +767,13 @@ std::optional<Context::DuelFinishReason> Context::Process(State::Dueling& s)
 		}
 		}
 	};
-	auto PostAnalyzeMsg = [&](const Msg& msg) -> std::optional<DuelFinishReason>
+	auto PostAnalyzeMsg = [&](MsgView msg) -> std::optional<DuelFinishReason>
 	{
 		using Reason = DuelFinishReason::Reason;
 		uint8_t msgType = GetMessageType(msg);
 		if(msgType == MSG_RETRY)
 		{
-			spdlog::error(I18N::ROOM_DUELING_MSG_RETRY_RECEIVED, s.replayId);
+			spdlog::error(I18N::ROOM_DUELING_MSG_RETRY_RECEIVED, id, s.replayId);
 			uint8_t winner = 1U - s.replier->Position().first;
 			return DuelFinishReason{Reason::REASON_WRONG_RESPONSE, winner};
 		}
@@ -499,33 +801,325 @@ std::optional<Context::DuelFinishReason> Context::Process(State::Dueling& s)
 		}
 		return std::nullopt;
 	};
-	auto ProcessSingleMsg = [&](const Msg& msg) -> std::optional<DuelFinishReason>
+	// Queries are answered with the state the core has at the end of the
+	// batch regardless of when they are made, so rather than refreshing
+	// the same thing after several messages, requests are queued and only
+	// carried out once before a message that needs the clients to be up
+	// to date, or at the end of the batch.
+	auto QueueQueryRequests = [&](const std::vector<QueryRequest>& qreqs)
+	{
+		for(const auto& reqVar : qreqs)
+		{
+			const auto it = std::find(pendingQueries.begin(), pendingQueries.end(), reqVar);
+			if(it == pendingQueries.end())
+				pendingQueries.push_back(reqVar);
+		}
+	};
+	auto FlushQueryRequests = [&]()
+	{
+		ProcessQueryRequests(pendingQueries);
+		pendingQueries.clear();
+	};
+	// Replaces the spectator cache with what a late spectator needs to
+	// get to the current state of the duel: MSG_START, every MSG_NEW_TURN
+	// (clients count turns with them), the MSG_NEW_PHASE of the current
+	// turn and then the public field, so that the cache grows with the
+	// length of the turn rather than the length of the duel.
+	// NOTE: Only valid at the end of a batch, as that's the state the
+	// core is on regardless of the messages it generated.
+	auto CheckpointSpectatorCache = [&]()
+	{
+		s.checkpointPending = false;
+		auto& cache = s.spectatorCache;
+		if(cache.empty())
+			return;
+		std::pmr::deque<YGOPro::STOCMsg> kept(cache.get_allocator());
+		kept.emplace_back(std::move(cache.front()));
+		std::optional<YGOPro::STOCMsg> phase;
+		for(auto it = std::next(cache.begin()); it != cache.end(); ++it)
+		{
+			const uint8_t msgType = GetCachedMessageType(*it);
+			if(msgType == MSG_NEW_TURN)
+			{
+				phase.reset();
+				kept.emplace_back(std::move(*it));
+			}
+			else if(msgType == MSG_NEW_PHASE)
+			{
+				phase.emplace(std::move(*it));
+			}
+		}
+		if(phase)
+			kept.emplace_back(std::move(*phase));
+		const auto field = TimeCore("query_field", [&](){return s.core->QueryField(s.duelPtr);});
+		Msg reload;
+		reload.reserve(1U + field.size());
+		reload.push_back(MSG_RELOAD_FIELD);
+		reload.insert(reload.end(), field.begin(), field.end());
+		kept.emplace_back(MakeGameMsg(reload));
+		static constexpr std::array<std::pair<uint32_t, uint32_t>, 5U> PUBLIC_LOCATIONS =
+		{{
+			{LOCATION_MZONE, 0x3081FFF},
+			{LOCATION_SZONE, 0x30681FFF},
+			{LOCATION_HAND, 0x3781FFF},
+			{LOCATION_GRAVE, 0x381FFF},
+			{LOCATION_REMOVED, 0x381FFF},
+		}};
+		batchQueries.clear();
+		for(uint8_t con = 0U; con < 2U; con++)
+			for(const auto& [loc, flags] : PUBLIC_LOCATIONS)
+				batchQueries.push_back({Core::IWrapper::BatchQuery::Kind::LOCATION, {flags, con, loc, 0U, 0U}});
+		TimeCore("query_batch", [&](){s.core->QueryBatch(s.duelPtr, batchQueries, batchResults);});
+		for(std::size_t i = 0U; i < batchQueries.size(); i++)
+		{
+			const auto& info = batchQueries[i].info;
+			TranscodeLocationQuery(batchResults[i], ownerQueryBuffer, strippedQueryBuffer);
+			kept.emplace_back(MakeGameMsg(MakeUpdateDataMsg(info.con, info.loc, strippedQueryBuffer)));
+		}
+		cache = std::move(kept);
+		s.spectatorCacheBytes = 0U;
+		for(const auto& m : cache)
+			s.spectatorCacheBytes += m.Length();
+		s.spectatorSnapshot.reset();
+		for(auto* c : spectators)
+		{
+			if(!c->IsRelay())
+				continue;
+			c->Send(MakeRelaySnapshot(true));
+			c->Send(joinMsg);
+			c->Send(MakeTypeChange(*c, false));
+			SendDuelistsInfo(*c);
+			SendDuelCatchUp(s, *c);
+			c->Send(MakeRelaySnapshot(false));
+		}
+		// Spectators that join from now on get full queries, so deltas
+		// meant for them can't build on anything sent before.
+		if(queryDeltas)
+			sentQueries[1U].Clear();
+	};
+	// Keeps what the duel holds within the memory budget. Past the soft
+	// budget the spectator cache is compacted without waiting for the next
+	// turn and then, while still past it, spectators are dropped starting
+	// from the one with the biggest backlog (they can join again and catch
+	// up from the compacted cache). Those actions are only taken again once
+	// the duel grew by another quarter of the soft budget, as what can't be
+	// trimmed (such as the replay) would otherwise trigger them on every
+	// batch. Past the hard budget the duel is ended.
+	// NOTE: Only valid at the end of a batch, see CheckpointSpectatorCache.
+	auto CheckMemory = [&]() -> std::optional<DuelFinishReason>
+	{
+		auto usage = TrackMemory(s);
+		auto Over = [&](uint64_t limit)
+		{
+			return limit != 0U && usage > limit;
+		};
+		if(Over(memoryBudget.soft) && usage >= duelMemory.lastActed + memoryBudget.soft / 4U)
+		{
+			auto& stats = Stats::Get();
+			if(!duelMemory.reported)
+			{
+				duelMemory.reported = true;
+				spdlog::warn(I18N::ROOM_DUELING_MEMORY_SOFT, id, s.replayId, usage, memoryBudget.soft);
+			}
+			CheckpointSpectatorCache();
+			stats.RecordMemoryCompaction();
+			usage = TrackMemory(s);
+			auto Backlog = [](const Client* c)
+			{
+				return c->QueuedBytes() + c->FeedBacklogBytes();
+			};
+			std::vector<Client*> bySize(spectators.begin(), spectators.end());
+			std::sort(bySize.begin(), bySize.end(), [&](const Client* a, const Client* b)
+			{
+				return Backlog(a) > Backlog(b);
+			});
+			for(auto* c : bySize)
+			{
+				if(!Over(memoryBudget.soft) || Backlog(c) == 0U)
+					break;
+				c->FallBehind();
+				stats.RecordMemorySpectatorDropped();
+				// Drops the feed messages only this spectator was behind on.
+				FlushSpectatorFeed();
+				usage = TrackMemory(s);
+			}
+			duelMemory.lastActed = usage;
+		}
+		if(!Over(memoryBudget.hard))
+			return std::nullopt;
+		spdlog::error(I18N::ROOM_DUELING_MEMORY_HARD, id, s.replayId, usage, memoryBudget.hard);
+		Stats::Get().RecordMemoryDuelEnded();
+		return DuelFinishReason{DuelFinishReason::Reason::REASON_MEMORY_EXCEEDED, 2U};
+	};
+	auto ProcessSingleMsg = [&](MsgView msg) -> std::optional<DuelFinishReason>
 	{
 		if(!PreAnalyzeMsg(msg))
 			return std::nullopt;
-		ProcessQueryRequests(GetPreDistQueryRequests(msg));
-		DistributeMsg(msg);
-		ProcessQueryRequests(GetPostDistQueryRequests(msg));
+		const auto preQreqs = GetPreDistQueryRequests(msg);
+		QueueQueryRequests(preQreqs);
+		const uint8_t msgType = GetMessageType(msg);
+		if(!preQreqs.empty() || msgType == MSG_WIN || DoesMessageRequireAnswer(msgType))
+			FlushQueryRequests();
+		{
+			const DuelTrace::Span span(trace, "distribute");
+			DistributeMsg(msg);
+		}
+		QueueQueryRequests(GetPostDistQueryRequests(msg));
 		return PostAnalyzeMsg(msg);
 	};
-	try
+	const auto sliceStart = Clock::now();
+	auto EndSlice = [&](bool yielded)
+	{
+		const auto d = Clock::now() - sliceStart;
+		Stats::Get().RecordSlice(d, sliceCore, yielded);
+		duelCost.core += sliceCore;
+		duelCost.distribute += d - sliceCore;
+		CheckCost(s);
+	};
+	s.yielded = false;
+	for(;;)
 	{
-		for(;;)
+		try
 		{
-			Core::IWrapper::DuelStatus status = s.core->Process(s.duelPtr);
-			for(const auto& msg : SplitToMsgs(s.core->GetMessages(s.duelPtr)))
-				if(auto dfrOpt = ProcessSingleMsg(msg); dfrOpt)
+			for(;;)
+			{
+				const auto [status, view] = TimeCore("process", [&](){return s.core->ProcessAndGetMessages(s.duelPtr);});
+				for(const auto msg : IterateMsgs(view.data, view.size))
+				{
+					duelCost.msgs++;
+					// Skip what clients already got before the core was restored.
+					if(s.msgsSinceResponse++ < s.skipMsgs)
+						continue;
+					if(auto dfrOpt = ProcessSingleMsg(msg); dfrOpt)
+					{
+						FlushQueryRequests();
+						EndSlice(false);
+						return dfrOpt;
+					}
+				}
+				FlushQueryRequests();
+				if(s.checkpointPending)
+					CheckpointSpectatorCache();
+				if(auto dfrOpt = CheckMemory(); dfrOpt)
+				{
+					EndSlice(false);
 					return dfrOpt;
-			if(status != Core::IWrapper::DuelStatus::DUEL_STATUS_CONTINUE)
-				break;
+				}
+				if(status != Core::IWrapper::DuelStatus::DUEL_STATUS_CONTINUE)
+					break;
+				if(processBudget.count() != 0 && Clock::now() - sliceStart >= processBudget)
+				{
+					// Let other rooms sharing our thread run, then continue.
+					EndSlice(true);
+					if(s.yields++ == 0U)
+						spdlog::info(I18N::ROOM_DUELING_PROCESS_BUDGET_HIT, id, s.replayId);
+					s.yielded = true;
+					room.PostDispatch(Event::ProcessMore{});
+					return std::nullopt;
+				}
+			}
+			EndSlice(false);
+			return std::nullopt;
+		}
+		catch(Core::Exception& e)
+		{
+			pendingQueries.clear();
+			spdlog::error(I18N::ROOM_DUELING_CORE_EXCEPT_PROCESSING, id, s.replayId, e.what());
+			ReportCrash(e);
+			if(s.coreRestores++ >= MAX_CORE_RESTORES || !Restore(s))
+			{
+				EndSlice(false);
+				return CORE_EXC_REASON;
+			}
+			SendToAll(MakeChat(CHAT_MSG_TYPE_ERROR, I18N::CLIENT_ROOM_CORE_RESTORED));
+		}
+	}
+}
+
+bool Context::Restore(State::Dueling& s)
+{
+	using namespace YGOPro;
+	using DuelStatus = Core::IWrapper::DuelStatus;
+	auto core = svc.coreProvider.GetCore(MakeDuelTraits(hostInfo, duelists));
+	if(core == s.core)
+	{
+		spdlog::error(I18N::ROOM_DUELING_CORE_RESTORE_SAME_CORE, id, s.replayId);
+		return false;
+	}
+	const std::size_t responseCount = s.replay->ResponseCount();
+	spdlog::info(I18N::ROOM_DUELING_CORE_RESTORING, id, s.replayId, responseCount);
+	void* duelPtr = nullptr;
+	auto Discard = [&]()
+	{
+		if(duelPtr == nullptr)
+			return;
+		try
+		{
+			core->DestroyDuel(duelPtr);
+		}
+		catch(Core::Exception& e)
+		{
+			spdlog::info(I18N::ROOM_DUELING_CORE_EXCEPT_DESTRUCTOR, id, s.replayId, e.what());
+		}
+	};
+	try
+	{
+		// Mirrors what was done when the duel was first created.
+		duelPtr = CreateBaseDuel(*core, s.replay->Seed());
+		std::vector<OCG_NewCardInfo> cards;
+		OCG_NewCardInfo nci{};
+		nci.pos = POS_FACEDOWN_DEFENSE;
+		for(auto code : s.replay->ExtraCards())
+		{
+			nci.code = code;
+			cards.push_back(nci);
+		}
+		s.replay->ForEachDuelist([&](uint8_t team, uint8_t pos, const Replay::Duelist& d)
+		{
+			nci.team = nci.con = team;
+			nci.duelist = pos;
+			nci.loc = LOCATION_DECK;
+			for(auto code : d.main)
+			{
+				nci.code = code;
+				cards.push_back(nci);
+			}
+			nci.loc = LOCATION_EXTRA;
+			for(auto code : d.extra)
+			{
+				nci.code = code;
+				cards.push_back(nci);
+			}
+		});
+		core->AddCards(duelPtr, cards);
+		core->Start(duelPtr);
+		// Fast-forward every response, dropping all generated messages.
+		for(std::size_t i = 0U; i < responseCount; i++)
+		{
+			auto status = DuelStatus::DUEL_STATUS_CONTINUE;
+			while(status == DuelStatus::DUEL_STATUS_CONTINUE)
+				status = core->ProcessAndGetMessages(duelPtr).first;
+			if(status != DuelStatus::DUEL_STATUS_WAITING)
+			{
+				spdlog::error(I18N::ROOM_DUELING_CORE_RESTORE_DIVERGED, id, s.replayId);
+				Discard();
+				return false;
+			}
+			const auto [data, size] = s.replay->Response(i);
+			core->SetResponse(duelPtr, {data, size});
 		}
 	}
 	catch(Core::Exception& e)
 	{
-		spdlog::error(I18N::ROOM_DUELING_CORE_EXCEPT_PROCESSING, s.replayId, e.what());
-		return CORE_EXC_REASON;
+		spdlog::error(I18N::ROOM_DUELING_CORE_EXCEPT_RESTORING, id, s.replayId, e.what());
+		Discard();
+		return false;
 	}
-	return std::nullopt;
+	s.core = std::move(core);
+	s.duelPtr = duelPtr;
+	s.skipMsgs = s.msgsSinceResponse;
+	s.msgsSinceResponse = 0U;
+	return true;
 }
 
 StateVariant Context::Finish(State::Dueling& s, const DuelFinishReason& dfr)
@@ -542,11 +1136,24 @@ StateVariant Context::Finish(State::Dueling& s, const DuelFinishReason& dfr)
 		}
 		catch(Core::Exception& e)
 		{
-			spdlog::info(I18N::ROOM_DUELING_CORE_EXCEPT_DESTRUCTOR, s.replayId, e.what());
+			spdlog::info(I18N::ROOM_DUELING_CORE_EXCEPT_DESTRUCTOR, id, s.replayId, e.what());
 		}
 	}
 	tagg.Cancel(0U);
 	tagg.Cancel(1U);
+	Stats::Get().RecordDuel(s.yields);
+	UntrackMemory();
+	trace.Finish();
+	// Keep the core for the next game unless it misbehaved.
+	if(dfr.reason == Reason::REASON_CORE_CRASHED)
+	{
+		ReleaseCore();
+	}
+	else if(s.core != core)
+	{
+		DiscardPreparedDuel();
+		core = s.core;
+	}
 	auto SendWinMsg = [&](uint8_t reason)
 	{
 		const std::vector<uint8_t> winMsg =
@@ -560,10 +1167,15 @@ StateVariant Context::Finish(State::Dueling& s, const DuelFinishReason& dfr)
 	};
 	auto SendReplay = [&]()
 	{
-		s.replay->Serialize();
-		svc.replayManager.Save(s.replayId, *s.replay);
+		s.replay->Serialize(svc.replayManager.ClientCompression());
+		svc.replayManager.Save(s.replayId, *s.replay,
+			{id, hostInfo.banlistHash, FinishReasonName(dfr.reason)});
 		if(s.replay->Bytes().size() > YGOPro::STOCMsg::MAX_PAYLOAD_SIZE)
+		{
+			// Clients that don't know of chunks just ignore them.
 			SendToAll(MakeChat(CHAT_MSG_TYPE_ERROR, I18N::CLIENT_ROOM_REPLAY_TOO_BIG));
+			SendChunkedToAll(YGOPro::STOCMsg::MsgType::REPLAY_CHUNK, s.replay->Bytes());
+		}
 		else
 			SendToAll(MakeSendReplay(s.replay->Bytes()));
 		SendToAll(MakeOpenReplayPrompt());
@@ -615,6 +1227,21 @@ StateVariant Context::Finish(State::Dueling& s, const DuelFinishReason& dfr)
 			return State::Rematching{turnDecider, {}};
 		return State::Sidedecking{turnDecider, {}};
 	}
+	case Reason::REASON_IDLE:
+	{
+		SendWinMsg(WIN_REASON_TIMED_OUT);
+		SendReplay();
+		SendToAll(MakeDuelEnd());
+		return State::Closing{};
+	}
+	case Reason::REASON_MEMORY_EXCEEDED:
+	{
+		SendToAll(MakeChat(CHAT_MSG_TYPE_ERROR, I18N::CLIENT_ROOM_MEMORY_EXCEEDED));
+		SendWinMsg(WIN_REASON_INTERNAL_ERROR);
+		SendReplay();
+		SendToAll(MakeDuelEnd());
+		return State::Closing{};
+	}
 	default: // So compiler doesn't complain
 	{
 		SendReplay();
@@ -624,10 +1251,88 @@ StateVariant Context::Finish(State::Dueling& s, const DuelFinishReason& dfr)
 	}
 }
 
+void Context::CheckCost(const State::Dueling& s)
+{
+	using namespace std::chrono;
+	if(duelCost.reported)
+		return;
+	auto Over = [](auto value, auto limit)
+	{
+		return limit != decltype(limit){} && value > limit;
+	};
+	if(!Over(duelCost.dispatch, costLimits.dispatch) &&
+	   !Over(duelCost.core, costLimits.core) &&
+	   !Over(duelCost.bytes, costLimits.bytes) &&
+	   !Over(duelCost.msgs, costLimits.msgs))
+		return;
+	duelCost.reported = true;
+	auto Ms = [](steady_clock::duration d)
+	{
+		return duration_cast<milliseconds>(d).count();
+	};
+	spdlog::warn(I18N::ROOM_DUELING_COST_EXCEEDED, id, s.replayId,
+		Ms(duelCost.dispatch), Ms(duelCost.core), Ms(duelCost.distribute),
+		duelCost.bytes, duelCost.msgs);
+	const auto throttled = costLimits.throttledBudget;
+	if(throttled.count() == 0 || (processBudget.count() != 0 && processBudget <= throttled))
+		return;
+	processBudget = throttled;
+	spdlog::warn(I18N::ROOM_DUELING_BUDGET_THROTTLED, id, s.replayId, throttled.count());
+}
+
+std::size_t Context::MemoryUsage(const State::Dueling& s) const
+{
+	std::size_t usage = s.spectatorCacheBytes + spectatorFeed.HeldBytes();
+	if(s.spectatorSnapshot)
+		usage += s.spectatorSnapshot->size() * sizeof(YGOPro::STOCMsg);
+	if(s.replay)
+		usage += s.replay->MemoryUsage();
+	for(const auto& kv : duelists)
+		usage += kv.second->QueuedBytes();
+	for(const auto* c : spectators)
+		usage += c->QueuedBytes();
+	return usage + room.PendingEvents() * sizeof(EventVariant);
+}
+
+std::size_t Context::TrackMemory(const State::Dueling& s)
+{
+	const auto usage = MemoryUsage(s);
+	Stats::Get().AddRoomMemory(static_cast<int64_t>(usage) - static_cast<int64_t>(duelMemory.current));
+	duelMemory.current = usage;
+	duelMemory.peak = std::max(duelMemory.peak, usage);
+	return usage;
+}
+
+void Context::UntrackMemory()
+{
+	if(duelMemory.peak == 0U)
+		return;
+	auto& stats = Stats::Get();
+	stats.AddRoomMemory(-static_cast<int64_t>(duelMemory.current));
+	stats.RecordDuelMemory(duelMemory.peak);
+	duelMemory = {};
+}
+
+void Context::SendDuelCatchUp(State::Dueling& s, Client& client)
+{
+	client.Send(MakeDuelStart());
+	client.Send(MakeCatchUp(true));
+	if(!s.spectatorSnapshot)
+	{
+		const auto& cache = s.spectatorCache;
+		s.spectatorSnapshot =
+			std::make_shared<const std::vector<YGOPro::STOCMsg>>(cache.begin(), cache.end());
+	}
+	client.SendStream(s.spectatorSnapshot);
+	client.Send(MakeCatchUp(false));
+}
+
 const YGOPro::STOCMsg& Context::SaveToSpectatorCache(
 	State::Dueling& s,
 	YGOPro::STOCMsg&& msg)
 {
+	s.spectatorSnapshot.reset();
+	s.spectatorCacheBytes += msg.Length();
 	s.spectatorCache.emplace_back(msg);
 	return s.spectatorCache.back();
 }
@@ -8,6 +8,7 @@ namespace Ignis::Multirole::Room
 StateOpt Context::operator()(State::RockPaperScissor& /*unused*/)
 {
 	SendRPS();
+	PrepareDuel();
 	return std::nullopt;
 }
 
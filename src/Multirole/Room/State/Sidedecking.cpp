@@ -13,6 +13,7 @@ StateOpt Context::operator()(State::Sidedecking& /*unused*/)
 	SendToTeam(0U, msg);
 	SendToTeam(1U, msg);
 	SendToSpectators(MakeSidedeckWait());
+	PrepareDuel();
 	return std::nullopt;
 }
 
@@ -43,10 +43,11 @@ StateOpt Context::operator()(State::Waiting& s, const Event::Join& e)
 	}
 	e.client.Send(joinMsg);
 	std::scoped_lock lock(mDuelists);
-	if(TryEmplaceDuelist(e.client))
+	if(!e.client.IsRelay() && TryEmplaceDuelist(e.client))
 	{
-		SendToAll(MakePlayerEnter(e.client));
-		SendToAll(MakePlayerChange(e.client));
+		const auto& [enter, change] = PresenceOf(e.client);
+		SendToAll(enter);
+		SendToAll(change);
 		e.client.Send(MakeTypeChange(e.client, s.host == &e.client));
 		e.client.Send(MakeWatchChange(spectators.size()));
 		SendDuelistsInfo(e.client);
@@ -69,8 +70,9 @@ StateOpt Context::operator()(State::Waiting& s, const Event::ToDuelist& e)
 		if(TryEmplaceDuelist(e.client))
 		{
 			spectators.erase(&e.client);
-			SendToAll(MakePlayerEnter(e.client));
-			SendToAll(MakePlayerChange(e.client));
+			const auto& [enter, change] = PresenceOf(e.client);
+			SendToAll(enter);
+			SendToAll(change);
 			SendToAll(MakeWatchChange(spectators.size()));
 			e.client.Send(MakeTypeChange(e.client, s.host == &e.client));
 		}
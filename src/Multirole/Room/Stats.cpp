@@ -0,0 +1,232 @@
+#include "Stats.hpp"
+
+namespace Ignis::Multirole::Room
+{
+
+// public
+
+Stats& Stats::Get()
+{
+	static Stats instance;
+	return instance;
+}
+
+void Stats::AddRoomsInState(std::size_t state, int64_t delta)
+{
+	roomsInState[state].Add(delta);
+}
+
+void Stats::RecordSlice(std::chrono::steady_clock::duration d, std::chrono::steady_clock::duration core, bool yielded)
+{
+	using namespace std::chrono;
+	sliceUs.Record(static_cast<uint64_t>(duration_cast<microseconds>(d).count()));
+	sliceCoreUs.Add(duration_cast<microseconds>(core).count());
+	if(yielded)
+		yields.Add(1);
+}
+
+void Stats::RecordDuel(uint64_t yields)
+{
+	yieldsPerDuel.Record(yields);
+}
+
+void Stats::AddRoomMemory(int64_t delta)
+{
+	roomMemory.Add(delta);
+}
+
+void Stats::RecordDuelMemory(std::size_t peak)
+{
+	duelMemoryPeak.Record(peak);
+}
+
+void Stats::RecordMemoryCompaction()
+{
+	memoryCompactions.Add(1);
+}
+
+void Stats::RecordMemorySpectatorDropped()
+{
+	memorySpectatorsDropped.Add(1);
+}
+
+void Stats::RecordMemoryDuelEnded()
+{
+	memoryDuelsEnded.Add(1);
+}
+
+void Stats::RecordIdleClose()
+{
+	idleClosed.Add(1);
+}
+
+void Stats::RecordSendQueue(std::size_t msgs, std::size_t bytes)
+{
+	sendQueueMsgs.Record(msgs);
+	sendQueueBytes.Record(bytes);
+}
+
+void Stats::RecordAccept(bool admitted)
+{
+	(admitted ? this->admitted : rejected).Add(1);
+}
+
+void Stats::RecordHandshake(bool joined)
+{
+	(joined ? this->joined : handshakeErrors).Add(1);
+}
+
+void Stats::AddReplaysQueued(int64_t delta)
+{
+	replaysQueued.Add(delta);
+}
+
+void Stats::RecordReplayDropped()
+{
+	replaysDropped.Add(1);
+}
+
+void Stats::RecordReload(std::string_view path, std::chrono::steady_clock::duration d)
+{
+	using namespace std::chrono;
+	std::scoped_lock lock(mReloadMs);
+	auto it = reloadMs.find(path);
+	if(it == reloadMs.end())
+		it = reloadMs.try_emplace(std::string(path)).first;
+	it->second.Record(static_cast<uint64_t>(duration_cast<milliseconds>(d).count()));
+}
+
+void Stats::RecordRoomThreads(std::size_t threads, unsigned int busyPercent, unsigned int blockedPercent)
+{
+	const auto n = static_cast<int64_t>(threads);
+	if(const auto prev = roomThreads.exchange(n, std::memory_order_relaxed); prev != 0 && prev != n)
+		roomThreadsResizes.Add(1);
+	roomThreadsBusyPercent.store(busyPercent, std::memory_order_relaxed);
+	roomThreadsBlockedPercent.store(blockedPercent, std::memory_order_relaxed);
+}
+
+int64_t Stats::RoomsInState(std::size_t state) const
+{
+	return roomsInState[state].Value();
+}
+
+const Stats::Histogram& Stats::SliceUs() const
+{
+	return sliceUs;
+}
+
+uint64_t Stats::SliceCoreUs() const
+{
+	return static_cast<uint64_t>(sliceCoreUs.Value());
+}
+
+const Stats::Histogram& Stats::YieldsPerDuel() const
+{
+	return yieldsPerDuel;
+}
+
+const Stats::Histogram& Stats::SendQueueMsgs() const
+{
+	return sendQueueMsgs;
+}
+
+const Stats::Histogram& Stats::SendQueueBytes() const
+{
+	return sendQueueBytes;
+}
+
+uint64_t Stats::Yields() const
+{
+	return static_cast<uint64_t>(yields.Value());
+}
+
+int64_t Stats::RoomMemory() const
+{
+	return roomMemory.Value();
+}
+
+const Stats::Histogram& Stats::DuelMemoryPeak() const
+{
+	return duelMemoryPeak;
+}
+
+uint64_t Stats::MemoryCompactions() const
+{
+	return static_cast<uint64_t>(memoryCompactions.Value());
+}
+
+uint64_t Stats::MemorySpectatorsDropped() const
+{
+	return static_cast<uint64_t>(memorySpectatorsDropped.Value());
+}
+
+uint64_t Stats::MemoryDuelsEnded() const
+{
+	return static_cast<uint64_t>(memoryDuelsEnded.Value());
+}
+
+uint64_t Stats::IdleClosed() const
+{
+	return static_cast<uint64_t>(idleClosed.Value());
+}
+
+uint64_t Stats::Admitted() const
+{
+	return static_cast<uint64_t>(admitted.Value());
+}
+
+uint64_t Stats::Rejected() const
+{
+	return static_cast<uint64_t>(rejected.Value());
+}
+
+uint64_t Stats::Joined() const
+{
+	return static_cast<uint64_t>(joined.Value());
+}
+
+uint64_t Stats::HandshakeErrors() const
+{
+	return static_cast<uint64_t>(handshakeErrors.Value());
+}
+
+int64_t Stats::ReplaysQueued() const
+{
+	return replaysQueued.Value();
+}
+
+uint64_t Stats::ReplaysDropped() const
+{
+	return static_cast<uint64_t>(replaysDropped.Value());
+}
+
+std::vector<std::pair<std::string, const Stats::Histogram*>> Stats::ReloadMs() const
+{
+	std::vector<std::pair<std::string, const Histogram*>> ret;
+	std::scoped_lock lock(mReloadMs);
+	for(const auto& kv : reloadMs)
+		ret.emplace_back(kv.first, &kv.second);
+	return ret;
+}
+
+int64_t Stats::RoomThreads() const
+{
+	return roomThreads.load(std::memory_order_relaxed);
+}
+
+int64_t Stats::RoomThreadsBusyPercent() const
+{
+	return roomThreadsBusyPercent.load(std::memory_order_relaxed);
+}
+
+int64_t Stats::RoomThreadsBlockedPercent() const
+{
+	return roomThreadsBlockedPercent.load(std::memory_order_relaxed);
+}
+
+uint64_t Stats::RoomThreadsResizes() const
+{
+	return static_cast<uint64_t>(roomThreadsResizes.Value());
+}
+
+} // namespace Ignis::Multirole::Room
@@ -0,0 +1,143 @@
+#ifndef ROOM_STATS_HPP
+#define ROOM_STATS_HPP
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "../Core/HornetStats.hpp"
+
+namespace Ignis::Multirole::Room
+{
+
+// Process-wide statistics of rooms, of the connections that make them and
+// of the data they use, recorded by the rooms, the room hosting endpoint,
+// the replay manager and the repositories, and read by the stats endpoint.
+class Stats final
+{
+public:
+	using Histogram = Core::HornetStats::Histogram;
+	using Counter = Core::HornetStats::Counter;
+
+	// NOTE: Must not be smaller than the amount of room states there are.
+	static constexpr std::size_t STATE_COUNT = 8U;
+
+	static Stats& Get();
+
+	// Records rooms entering the state with the given index in
+	// StateVariant, or leaving it if negative.
+	void AddRoomsInState(std::size_t state, int64_t delta);
+
+	// Records one uninterrupted run of core processing, `core` being the
+	// part of it spent blocked on core calls and `yielded` whether or not
+	// it stopped because it ran out of budget.
+	void RecordSlice(std::chrono::steady_clock::duration d, std::chrono::steady_clock::duration core, bool yielded);
+
+	// Records the amount of times a finished duel ran out of budget.
+	void RecordDuel(uint64_t yields);
+
+	// Records bytes held by rooms for their duels, or released if
+	// negative, see Context::MemoryBudget.
+	void AddRoomMemory(int64_t delta);
+
+	// Records the most bytes a finished duel held at once.
+	void RecordDuelMemory(std::size_t peak);
+
+	// Records an action taken by a room over its soft memory budget, and
+	// a duel ended for going over its hard one, respectively.
+	void RecordMemoryCompaction();
+	void RecordMemorySpectatorDropped();
+	void RecordMemoryDuelEnded();
+
+	// Records a room closed for being idle, see Instance::IdleTimeouts.
+	void RecordIdleClose();
+
+	// Records how much a client had queued to send when writing to it.
+	void RecordSendQueue(std::size_t msgs, std::size_t bytes);
+
+	// Records a connection accepted by the room hosting endpoint,
+	// `admitted` being whether or not it was within the limits.
+	void RecordAccept(bool admitted);
+
+	// Records a handshake that ended up with the client in a room or, if
+	// `joined` is false, with an error sent back.
+	void RecordHandshake(bool joined);
+
+	// Records replays queued to be written, or written if negative.
+	void AddReplaysQueued(int64_t delta);
+
+	// Records a replay not saved because too many were queued.
+	void RecordReplayDropped();
+
+	// Records the time the observers of the repository at `path` took to
+	// load its files.
+	void RecordReload(std::string_view path, std::chrono::steady_clock::duration d);
+
+	// Records a decision of the adaptive room threads pool, see AdaptivePool.
+	void RecordRoomThreads(std::size_t threads, unsigned int busyPercent, unsigned int blockedPercent);
+
+	int64_t RoomsInState(std::size_t state) const;
+	const Histogram& SliceUs() const;
+	uint64_t SliceCoreUs() const; // Sum of the core part of every slice.
+	const Histogram& YieldsPerDuel() const;
+	const Histogram& SendQueueMsgs() const;
+	const Histogram& SendQueueBytes() const;
+	uint64_t Yields() const;
+	int64_t RoomMemory() const;
+	const Histogram& DuelMemoryPeak() const;
+	uint64_t MemoryCompactions() const;
+	uint64_t MemorySpectatorsDropped() const;
+	uint64_t MemoryDuelsEnded() const;
+	uint64_t IdleClosed() const;
+	uint64_t Admitted() const;
+	uint64_t Rejected() const;
+	uint64_t Joined() const;
+	uint64_t HandshakeErrors() const;
+	int64_t ReplaysQueued() const;
+	uint64_t ReplaysDropped() const;
+	// NOTE: Histograms are never removed, so they outlive the returned
+	// vector.
+	std::vector<std::pair<std::string, const Histogram*>> ReloadMs() const;
+	int64_t RoomThreads() const;
+	int64_t RoomThreadsBusyPercent() const;
+	int64_t RoomThreadsBlockedPercent() const;
+	uint64_t RoomThreadsResizes() const;
+private:
+	std::array<Counter, STATE_COUNT> roomsInState;
+	Histogram sliceUs;
+	Counter sliceCoreUs;
+	Histogram yieldsPerDuel;
+	Histogram sendQueueMsgs;
+	Histogram sendQueueBytes;
+	Counter yields;
+	Counter roomMemory;
+	Histogram duelMemoryPeak;
+	Counter memoryCompactions;
+	Counter memorySpectatorsDropped;
+	Counter memoryDuelsEnded;
+	Counter idleClosed;
+	Counter admitted;
+	Counter rejected;
+	Counter joined;
+	Counter handshakeErrors;
+	Counter replaysQueued;
+	Counter replaysDropped;
+	std::atomic<int64_t> roomThreads{};
+	std::atomic<int64_t> roomThreadsBusyPercent{};
+	std::atomic<int64_t> roomThreadsBlockedPercent{};
+	Counter roomThreadsResizes;
+	mutable std::mutex mReloadMs;
+	std::map<std::string, Histogram, std::less<>> reloadMs;
+
+	Stats() = default;
+};
+
+} // namespace Ignis::Multirole::Room
+
+#endif // ROOM_STATS_HPP
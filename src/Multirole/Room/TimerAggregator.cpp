@@ -1,6 +1,6 @@
 #include "TimerAggregator.hpp"
 
-#include <boost/asio/bind_executor.hpp>
+#include <boost/asio/post.hpp>
 
 #include "Instance.hpp"
 
@@ -9,33 +9,63 @@ namespace Ignis::Multirole::Room
 
 TimerAggregator::TimerAggregator(Instance& room) :
 	room(room),
-	strand(room.Strand()),
-	timers({AsioTimer(strand.context()), AsioTimer(strand.context())})
+	wheel(boost::asio::use_service<TimerWheel>(room.Strand().context())),
+	timers{{Timer(*this, 0U), Timer(*this, 1U)}}
 {}
 
+TimerAggregator::~TimerAggregator()
+{
+	wheel.Cancel(timers[0U]);
+	wheel.Cancel(timers[1U]);
+}
+
 void TimerAggregator::Cancel(uint8_t team)
 {
 	assert(team <= 1U);
-	timers[team].cancel();
+	timers[team].generation++;
+	wheel.Cancel(timers[team]);
 }
 
-void TimerAggregator::ExpiresAfter(uint8_t team, const AsioTimer::duration& expiryTime)
+void TimerAggregator::ExpiresAfter(uint8_t team, const Clock::duration& expiryTime)
 {
 	assert(team <= 1U);
-	timers[team].expires_after(expiryTime);
-	timers[team].async_wait(boost::asio::bind_executor(strand,
-	[this, team](const boost::system::error_code& ec)
-	{
-		if(!ec)
-			room.Dispatch(Event::TimerExpired{team});
-	}));
+	timers[team].expiry = Clock::now() + expiryTime;
+	timers[team].generation++;
+	wheel.Arm(timers[team], expiryTime);
 }
 
-AsioTimer::time_point TimerAggregator::Expiry(uint8_t team) const
+TimerAggregator::Clock::time_point TimerAggregator::Expiry(uint8_t team) const
 {
 	assert(team <= 1U);
-	return timers[team].expiry();
+	return timers[team].expiry;
 }
 
+// private
+
+TimerAggregator::Timer::Timer(TimerAggregator& tagg, uint8_t team) :
+	expiry(),
+	generation(0U),
+	tagg(tagg),
+	team(team)
+{}
+
+std::function<void()> TimerAggregator::Timer::Expire()
+{
+	// NOTE: The wheel being locked keeps the aggregator from finishing its
+	// destruction, but the room might be already going away, in which case
+	// it can't be kept alive anymore and the expiry is dropped.
+	return [wroom = tagg.room.weak_from_this(), &tagg = tagg, team = team, gen = generation.load()]()
+	{
+		auto room = wroom.lock();
+		if(!room)
+			return;
+		auto& strand = room->Strand();
+		boost::asio::post(strand, [room = std::move(room), &tagg, team, gen]()
+		{
+			if(tagg.timers[team].generation == gen)
+				room->Dispatch(Event::TimerExpired{team});
+		});
+	};
+}
 
 } // Ignis::Multirole::Room
@@ -1,21 +1,23 @@
 #ifndef ROOM_TIMER_AGGREGATOR_HPP
 #define ROOM_TIMER_AGGREGATOR_HPP
 #include <array>
+#include <atomic>
+#include <chrono>
 
-#include <boost/asio/io_context_strand.hpp>
-#include <boost/asio/system_timer.hpp>
+#include "TimerWheel.hpp"
 
 namespace Ignis::Multirole::Room
 {
 
 class Instance;
 
-using AsioTimer = boost::asio::system_timer;
-
 class TimerAggregator final
 {
 public:
+	using Clock = std::chrono::system_clock;
+
 	TimerAggregator(Instance& room);
+	~TimerAggregator();
 
 	// Cancels one timer's asynchronous operations that were set by
 	// calling ExpireAfter.
@@ -23,14 +25,30 @@ public:
 
 	// Sets one timer's expiry time relative to now, also sets
 	// asynchronous operation to dispatch time-out event to room instance.
-	void ExpiresAfter(uint8_t team, const AsioTimer::duration& expiryTime);
+	void ExpiresAfter(uint8_t team, const Clock::duration& expiryTime);
 
 	// Gets one timer's expiry time as an absolute time.
-	AsioTimer::time_point Expiry(uint8_t team) const;
+	Clock::time_point Expiry(uint8_t team) const;
 private:
+	class Timer final : public TimerWheel::Entry
+	{
+	public:
+		Timer(TimerAggregator& tagg, uint8_t team);
+
+		Clock::time_point expiry;
+		// Bumped whenever the timer is armed or cancelled, so that an
+		// expiry already on its way to the strand can be told stale.
+		std::atomic<uint64_t> generation;
+	private:
+		TimerAggregator& tagg;
+		const uint8_t team;
+
+		std::function<void()> Expire() override;
+	};
+
 	Instance& room;
-	boost::asio::io_context::strand& strand;
-	std::array<AsioTimer, 2U> timers;
+	TimerWheel& wheel;
+	std::array<Timer, 2U> timers;
 };
 
 } // Ignis::Multirole::Room
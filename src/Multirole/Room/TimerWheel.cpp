@@ -0,0 +1,131 @@
+#include "TimerWheel.hpp"
+
+#include <algorithm>
+#include <vector>
+
+namespace Ignis::Multirole::Room
+{
+
+boost::asio::io_context::id TimerWheel::id;
+
+TimerWheel::TimerWheel(boost::asio::io_context& ioCtx) :
+	boost::asio::io_context::service(ioCtx),
+	timer(ioCtx),
+	epoch(Clock::now()),
+	current(0U),
+	armed(0U),
+	ticking(false),
+	stopped(false),
+	slots()
+{}
+
+void TimerWheel::Arm(Entry& e, Clock::duration expiryTime)
+{
+	const auto now = Clock::now() - epoch;
+	// Rounded up, so that entries never expire before their time.
+	const auto deadline = (now + expiryTime + TICK - Clock::duration(1)) / TICK;
+	std::scoped_lock lock(mtx);
+	if(e.linked)
+		Unlink(e);
+	// Ticks are not processed while nothing is armed, skip them.
+	if(!ticking)
+		current = uint64_t(now / TICK);
+	e.deadline = std::max(uint64_t(std::max<Clock::rep>(deadline, 0)), current + 1U);
+	Link(e);
+	if(!ticking && !stopped)
+	{
+		ticking = true;
+		ScheduleTick();
+	}
+}
+
+void TimerWheel::Cancel(Entry& e)
+{
+	std::scoped_lock lock(mtx);
+	if(e.linked)
+		Unlink(e);
+}
+
+// private
+
+void TimerWheel::shutdown()
+{
+	std::scoped_lock lock(mtx);
+	stopped = true;
+	timer.cancel();
+}
+
+void TimerWheel::Link(Entry& e)
+{
+	auto& head = slots[e.deadline % SLOT_COUNT];
+	e.prev = nullptr;
+	e.next = head;
+	if(head != nullptr)
+		head->prev = &e;
+	head = &e;
+	e.linked = true;
+	armed++;
+}
+
+void TimerWheel::Unlink(Entry& e)
+{
+	if(e.prev != nullptr)
+		e.prev->next = e.next;
+	else
+		slots[e.deadline % SLOT_COUNT] = e.next;
+	if(e.next != nullptr)
+		e.next->prev = e.prev;
+	e.prev = e.next = nullptr;
+	e.linked = false;
+	armed--;
+}
+
+void TimerWheel::ScheduleTick()
+{
+	timer.expires_at(epoch + (current + 1U) * TICK);
+	timer.async_wait([this](const boost::system::error_code& ec)
+	{
+		OnTick(ec);
+	});
+}
+
+void TimerWheel::OnTick(const boost::system::error_code& ec)
+{
+	std::vector<std::function<void()>> due;
+	{
+		std::scoped_lock lock(mtx);
+		if(ec || stopped)
+		{
+			ticking = false;
+			return;
+		}
+		// Catch up with every tick that went by if this handler ran late.
+		const auto now = uint64_t((Clock::now() - epoch) / TICK);
+		while(current < now && armed != 0U)
+		{
+			current++;
+			// Entries sharing the slot but not due yet are from later
+			// rotations of the wheel, those are left alone.
+			for(Entry* e = slots[current % SLOT_COUNT]; e != nullptr;)
+			{
+				Entry* next = e->next;
+				if(e->deadline <= current)
+				{
+					Unlink(*e);
+					due.emplace_back(e->Expire());
+				}
+				e = next;
+			}
+		}
+		current = std::max(current, now);
+		if(armed != 0U)
+			ScheduleTick();
+		else
+			ticking = false;
+	}
+	for(auto& f : due)
+		if(f)
+			f();
+}
+
+} // Ignis::Multirole::Room
@@ -0,0 +1,75 @@
+#ifndef ROOM_TIMER_WHEEL_HPP
+#define ROOM_TIMER_WHEEL_HPP
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+namespace Ignis::Multirole::Room
+{
+
+// Hashed timing wheel shared by all the rooms of an io_context, obtained
+// with boost::asio::use_service. Arming and cancelling are constant time
+// list operations, and a single asio timer drives the whole wheel, only
+// while there is something armed on it.
+class TimerWheel final : public boost::asio::io_context::service
+{
+public:
+	using Clock = std::chrono::steady_clock;
+
+	static constexpr auto TICK = std::chrono::milliseconds(100);
+	static constexpr std::size_t SLOT_COUNT = 1024U;
+
+	// Intrusive node of the wheel, owned by whoever arms it.
+	class Entry
+	{
+	public:
+		virtual ~Entry() = default;
+	protected:
+		// Called with the wheel locked once the entry is due, after it was
+		// unlinked. The returned function is called once the wheel is
+		// unlocked again, so it is the one that should do the actual work.
+		virtual std::function<void()> Expire() = 0;
+	private:
+		friend class TimerWheel;
+		Entry* prev{};
+		Entry* next{};
+		uint64_t deadline{};
+		bool linked{};
+	};
+
+	static boost::asio::io_context::id id;
+
+	explicit TimerWheel(boost::asio::io_context& ioCtx);
+
+	// Links the entry so that it expires after the given time, unlinking
+	// it first if it was already armed.
+	void Arm(Entry& e, Clock::duration expiryTime);
+
+	// Unlinks the entry, does nothing if it was not armed.
+	void Cancel(Entry& e);
+private:
+	std::mutex mtx;
+	boost::asio::steady_timer timer;
+	const Clock::time_point epoch;
+	uint64_t current; // Last tick that was processed.
+	std::size_t armed;
+	bool ticking;
+	bool stopped;
+	std::array<Entry*, SLOT_COUNT> slots;
+
+	void shutdown() override;
+
+	void Link(Entry& e);
+	void Unlink(Entry& e);
+	void ScheduleTick();
+	void OnTick(const boost::system::error_code& ec);
+};
+
+} // Ignis::Multirole::Room
+
+#endif // ROOM_TIMER_WHEEL_HPP
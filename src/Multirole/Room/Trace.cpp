@@ -0,0 +1,105 @@
+#include "Trace.hpp"
+
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <set>
+
+#include <fmt/format.h>
+#include <spdlog/spdlog.h>
+
+#include "../I18N.hpp"
+
+namespace Ignis::Multirole::Room
+{
+
+namespace
+{
+
+// Keeps a runaway duel from taking all the memory while traced.
+constexpr std::size_t MAX_EVENTS = 1U << 20U;
+
+std::mutex mOptions;
+DuelTrace::Options options;
+std::set<uint32_t> requested;
+std::atomic<uint64_t> duelsStarted;
+
+} // namespace
+
+void DuelTrace::Configure(Options opts)
+{
+	if(COMPILED)
+	{
+		std::error_code ignore;
+		std::filesystem::create_directories(opts.path, ignore);
+	}
+	std::scoped_lock lock(mOptions);
+	options = std::move(opts);
+}
+
+bool DuelTrace::Request(uint32_t roomId)
+{
+	if(!COMPILED)
+		return false;
+	std::scoped_lock lock(mOptions);
+	requested.insert(roomId);
+	return true;
+}
+
+void DuelTrace::Start(uint32_t room, uint64_t replay)
+{
+	if(!COMPILED)
+		return;
+	Finish();
+	const uint64_t n = duelsStarted++;
+	{
+		std::scoped_lock lock(mOptions);
+		active = requested.erase(room) != 0U ||
+			(options.sampleEvery != 0U && n % options.sampleEvery == 0U);
+	}
+	roomId = room;
+	replayId = replay;
+	origin = Clock::now();
+}
+
+void DuelTrace::Finish()
+{
+	if(!Active())
+		return;
+	active = false;
+	std::filesystem::path path;
+	{
+		std::scoped_lock lock(mOptions);
+		path = options.path;
+	}
+	path /= fmt::format("{}.trace.json", replayId);
+	auto Us = [&](Clock::duration d)
+	{
+		return std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+	};
+	std::ofstream f(path, std::ios::binary);
+	f << R"({"displayTimeUnit":"ms","traceEvents":[)";
+	f << fmt::format(R"({{"name":"process_name","ph":"M","pid":{},"tid":0,"args":{{"name":"Room {} - Replay {}"}}}})",
+		roomId, roomId, replayId);
+	for(const auto& e : events)
+	{
+		f << fmt::format(R"(,{{"name":"{}","ph":"X","pid":{},"tid":0,"ts":{},"dur":{}}})",
+			e.name, roomId, Us(e.start - origin), Us(e.end - e.start));
+	}
+	f << "]}\n";
+	if(!f)
+		spdlog::error(I18N::ROOM_TRACE_COULD_NOT_WRITE, roomId, replayId, path.string());
+	events.clear();
+	events.shrink_to_fit();
+}
+
+// private
+
+void DuelTrace::Record(const char* name, Clock::time_point start, Clock::time_point end)
+{
+	if(events.size() < MAX_EVENTS)
+		events.push_back({name, start, end});
+}
+
+} // Ignis::Multirole::Room
@@ -0,0 +1,109 @@
+#ifndef ROOM_TRACE_HPP
+#define ROOM_TRACE_HPP
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Ignis::Multirole::Room
+{
+
+// Spans of what a single duel spent its time on, written once the duel
+// ends in the Trace Event Format (loadable by chrome://tracing or
+// Perfetto) to `<path>/<replay ID>.trace.json`. Duels are picked every
+// `sampleEvery` duels or when requested for a given room. Does nothing
+// unless built with MULTIROLE_TRACING, in which case everything reduces
+// to a branch on a flag for duels that are not traced.
+// NOTE: Like the room context that owns it, only used from the strand.
+class DuelTrace final
+{
+public:
+#ifdef MULTIROLE_TRACING
+	static constexpr bool COMPILED = true;
+#else
+	static constexpr bool COMPILED = false;
+#endif // MULTIROLE_TRACING
+	using Clock = std::chrono::steady_clock;
+
+	// Process-wide selection of the duels to trace.
+	struct Options
+	{
+		std::string path;
+		uint64_t sampleEvery; // Zero means only when requested.
+	};
+
+	// Span measured from construction to destruction.
+	class Span final
+	{
+	public:
+		Span(DuelTrace& trace, const char* name) :
+			trace(trace.Active() ? &trace : nullptr),
+			name(name),
+			start(trace.Now())
+		{}
+
+		~Span()
+		{
+			if(trace != nullptr)
+				trace->Complete(name, start);
+		}
+
+		Span(const Span&) = delete;
+		Span& operator=(const Span&) = delete;
+	private:
+		DuelTrace* trace;
+		const char* name;
+		Clock::time_point start;
+	};
+
+	static void Configure(Options opts);
+
+	// Traces the next duel started by the given room, returns false if
+	// tracing was not built in.
+	static bool Request(uint32_t roomId);
+
+	// Starts tracing a duel if it was picked, ending the previous one.
+	void Start(uint32_t roomId, uint64_t replayId);
+
+	// Writes and ends the trace of the current duel, if any.
+	void Finish();
+
+	inline bool Active() const
+	{
+		return COMPILED && active;
+	}
+
+	// Start time of a span, for spans that can't be scoped.
+	inline Clock::time_point Now() const
+	{
+		return Active() ? Clock::now() : Clock::time_point{};
+	}
+
+	// Records a span started at `start` (as returned by Now) ending now,
+	// unless it started while the duel was not traced.
+	// NOTE: `name` must outlive the trace, i.e. be a string literal.
+	inline void Complete(const char* name, Clock::time_point start)
+	{
+		if(Active() && start != Clock::time_point{})
+			Record(name, start, Clock::now());
+	}
+private:
+	struct Event
+	{
+		const char* name;
+		Clock::time_point start;
+		Clock::time_point end;
+	};
+
+	bool active{};
+	uint32_t roomId{};
+	uint64_t replayId{};
+	Clock::time_point origin;
+	std::vector<Event> events;
+
+	void Record(const char* name, Clock::time_point start, Clock::time_point end);
+};
+
+} // Ignis::Multirole::Room
+
+#endif // ROOM_TRACE_HPP
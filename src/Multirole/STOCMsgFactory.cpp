@@ -1,5 +1,7 @@
 #include "STOCMsgFactory.hpp"
 
+#include <cstddef> // offsetof
+
 #include "YGOPro/StringUtils.hpp"
 
 namespace Ignis::Multirole
@@ -7,6 +9,14 @@ namespace Ignis::Multirole
 
 using namespace YGOPro;
 
+// Chat is sent only up to the terminator of its text, clients zero the
+// rest of the message.
+inline STOCMsg TrimmedChat(const STOCMsg::Chat2& proto, std::size_t length)
+{
+	const std::size_t size = offsetof(STOCMsg::Chat2, msg) + (length + 1U) * sizeof(uint16_t);
+	return STOCMsg{STOCMsg::Chat2::MSG_TYPE, reinterpret_cast<const uint8_t*>(&proto), size};
+}
+
 // public
 
 STOCMsgFactory::STOCMsgFactory(uint8_t t1max) : t1max(t1max)
@@ -33,11 +43,20 @@ STOCMsg STOCMsgFactory::MakeChat(const Room::Client& c, bool isTeam, std::string
 	else
 		proto.type = STOCMsg::Chat2::PTYPE_DUELIST;
 	proto.isTeam = static_cast<uint8_t>(isTeam);
-	auto str16 = UTF8ToUTF16(c.Name());
-	std::memcpy(&proto.clientName[0U], str16.data(), UTF16ByteCount(str16));
-	str16 = UTF8ToUTF16(str);
-	std::memcpy(&proto.msg[0U], str16.data(), UTF16ByteCount(str16));
-	return {proto};
+	UTF8ToUTF16(c.Name(), proto.clientName);
+	return TrimmedChat(proto, UTF8ToUTF16(str, proto.msg));
+}
+
+std::pair<STOCMsg, STOCMsg> STOCMsgFactory::MakeDuelistChat(const Room::Client& c, std::string_view str)
+{
+	STOCMsg::Chat2 proto{};
+	proto.type = STOCMsg::Chat2::PTYPE_DUELIST;
+	proto.isTeam = 1U;
+	UTF8ToUTF16(c.Name(), proto.clientName);
+	const std::size_t length = UTF8ToUTF16(str, proto.msg);
+	auto team = TrimmedChat(proto, length);
+	proto.isTeam = 0U;
+	return {std::move(team), TrimmedChat(proto, length)};
 }
 
 STOCMsg STOCMsgFactory::MakeChat(ChatMsgType type, std::string_view str)
@@ -49,16 +68,13 @@ STOCMsg STOCMsgFactory::MakeChat(ChatMsgType type, std::string_view str)
 		proto.type = STOCMsg::Chat2::PTYPE_SYSTEM_ERROR;
 	else // if(type == PTYPE_SYSTEM_SHOUT)
 		proto.type = STOCMsg::Chat2::PTYPE_SYSTEM_SHOUT;
-	const auto str16 = UTF8ToUTF16(str);
-	std::memcpy(&proto.msg[0U], str16.data(), UTF16ByteCount(str16));
-	return {proto};
+	return TrimmedChat(proto, UTF8ToUTF16(str, proto.msg));
 }
 
 STOCMsg STOCMsgFactory::MakePlayerEnter(const Room::Client& c) const
 {
-	const auto& str16 = UTF8ToUTF16(c.Name());
 	STOCMsg::PlayerEnter proto{};
-	std::memcpy(&proto.name, str16.data(), UTF16ByteCount(str16));
+	UTF8ToUTF16(c.Name(), proto.name);
 	proto.pos = EncodePosition(c.Position());
 	return {proto};
 }
@@ -124,6 +140,11 @@ STOCMsg STOCMsgFactory::MakeGameMsg(const std::vector<uint8_t>& msg)
 	return STOCMsg{STOCMsg::MsgType::GAME_MSG, msg};
 }
 
+STOCMsg STOCMsgFactory::MakeGameMsg(YGOPro::CoreUtils::MsgView msg)
+{
+	return STOCMsg{STOCMsg::MsgType::GAME_MSG, msg.data(), msg.size()};
+}
+
 STOCMsg STOCMsgFactory::MakeAskIfRematch()
 {
 	return {STOCMsg::MsgType::REMATCH};
@@ -149,6 +170,11 @@ STOCMsg STOCMsgFactory::MakeCatchUp(bool catchingUp)
 	return {STOCMsg::CatchUp{static_cast<uint8_t>(catchingUp)}};
 }
 
+STOCMsg STOCMsgFactory::MakeRelaySnapshot(bool begin)
+{
+	return {STOCMsg::RelaySnapshot{static_cast<uint8_t>(begin)}};
+}
+
 STOCMsg STOCMsgFactory::MakeTimeLimit(uint8_t team, uint16_t timeLeft)
 {
 	return {STOCMsg::TimeLimit{team, timeLeft}};
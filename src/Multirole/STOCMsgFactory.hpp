@@ -1,6 +1,7 @@
 #ifndef STOCMSGFACTORY_HPP
 #define STOCMSGFACTORY_HPP
 #include "Room/Client.hpp"
+#include "YGOPro/CoreUtils.hpp"
 #include "YGOPro/STOCMsg.hpp"
 
 namespace Ignis::Multirole
@@ -57,6 +58,9 @@ public:
 
 	// Creates chat message from client (client message)
 	static YGOPro::STOCMsg MakeChat(const Room::Client& c, bool isTeam, std::string_view str);
+	// Creates the chat message of a duelist as seen by its team and by
+	// everyone else, respectively, converting the text only once.
+	static std::pair<YGOPro::STOCMsg, YGOPro::STOCMsg> MakeDuelistChat(const Room::Client& c, std::string_view str);
 	// Creates chat message from specific type (system message)
 	static YGOPro::STOCMsg MakeChat(ChatMsgType type, std::string_view str);
 	// Creates a message used to inform players entering the room
@@ -81,6 +85,7 @@ public:
 	static YGOPro::STOCMsg MakeRPSResult(uint8_t t0, uint8_t t1);
 	// Creates a message that wraps around a core message
 	static YGOPro::STOCMsg MakeGameMsg(const std::vector<uint8_t>& msg);
+	static YGOPro::STOCMsg MakeGameMsg(YGOPro::CoreUtils::MsgView msg);
 	// Creates a message to ask a client if he desires to rematch
 	static YGOPro::STOCMsg MakeAskIfRematch();
 	// Creates a message signaling client to wait for rematch answers
@@ -92,6 +97,9 @@ public:
 	// Creates a message that tells clients to catch up the following
 	// next messages
 	static YGOPro::STOCMsg MakeCatchUp(bool catchingUp);
+	// Creates a message that tells a relay where a snapshot of the room
+	// begins or ends
+	static YGOPro::STOCMsg MakeRelaySnapshot(bool begin);
 	// Creates a message that tells clients how much time a particular
 	// team has left
 	static YGOPro::STOCMsg MakeTimeLimit(uint8_t team, uint16_t timeLeft);
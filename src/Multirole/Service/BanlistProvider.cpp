@@ -4,6 +4,7 @@
 
 #include <spdlog/spdlog.h>
 
+#include "Loading.hpp"
 #include "../I18N.hpp"
 #define YGOPRO_BANLIST_PARSER_IMPLEMENTATION
 #include "../YGOPro/BanlistParser.hpp"
@@ -12,55 +13,75 @@ namespace Ignis::Multirole
 {
 
 Service::BanlistProvider::BanlistProvider(std::string_view fnRegexStr) :
-	fnRegex(fnRegexStr.data())
+	fnRegex(fnRegexStr.data()),
+	banlists(std::make_shared<const YGOPro::BanlistMap>())
 {}
 
 YGOPro::BanlistPtr Service::BanlistProvider::GetBanlistByHash(YGOPro::BanlistHash hash) const
 {
-	std::shared_lock lock(mBanlists);
-	if(auto search = banlists.find(hash); search != banlists.end())
+	const auto b = std::atomic_load(&banlists);
+	if(auto search = b->find(hash); search != b->end())
 		return search->second;
 	return nullptr;
 }
 
-void Service::BanlistProvider::OnAdd(std::string_view path, const PathVector& fileList)
+void Service::BanlistProvider::OnAdd(std::string_view path, const PathVector& fileList, const BlobIdVector& ids)
 {
-	LoadBanlists(path, fileList);
+	LoadBanlists(path, fileList, ids);
 }
 
 void Service::BanlistProvider::OnDiff(std::string_view path, const GitDiff& diff)
 {
-	LoadBanlists(path, diff.added);
+	LoadBanlists(path, diff.added, diff.addedIds);
 }
 
 // private
 
-void Service::BanlistProvider::LoadBanlists(std::string_view path, const PathVector& fileList)
+void Service::BanlistProvider::LoadBanlists(std::string_view path, const PathVector& fileList, const BlobIdVector& ids)
 {
-	std::string fullPath(path);
-	YGOPro::BanlistMap tmp;
-	for(const auto& fn : fileList)
+	std::vector<std::pair<std::string, BlobId>> matched; // Full paths.
 	{
-		if(!std::regex_match(fn, fnRegex))
-			continue;
-		fullPath.resize(path.size());
-		fullPath += fn;
+		std::scoped_lock lock(mBanlists);
+		for(std::size_t i = 0U; i < fileList.size(); i++)
+		{
+			if(!std::regex_match(fileList[i], fnRegex))
+				continue;
+			std::string fullPath(path);
+			fullPath += fileList[i];
+			if(auto search = loaded.find(fullPath); search != loaded.end() && search->second == ids[i])
+				continue;
+			matched.emplace_back(std::move(fullPath), ids[i]);
+		}
+	}
+	// Files are parsed without holding any lock, in parallel.
+	std::vector<YGOPro::BanlistMap> parsed(matched.size());
+	Loading::ForEach(matched.size(), [&](std::size_t i)
+	{
+		const auto& fullPath = matched[i].first;
 		spdlog::info(I18N::BANLIST_PROVIDER_LOADING_ONE, fullPath);
 		try
 		{
 			std::ifstream f(fullPath);
-			YGOPro::ParseForBanlists(f, tmp);
+			YGOPro::ParseForBanlists(f, parsed[i]);
 		}
 		catch(const std::exception& e)
 		{
 			spdlog::error(I18N::BANLIST_PROVIDER_COULD_NOT_LOAD_ONE, e.what());
 		}
-	}
+	});
+	// NOTE: Merged in file order, the first banlist with a hash is kept.
+	YGOPro::BanlistMap tmp;
+	for(auto& p : parsed)
+		tmp.merge(p);
 	std::scoped_lock lock(mBanlists);
+	for(const auto& [fullPath, id] : matched)
+		loaded[fullPath] = id;
+	auto b = std::make_shared<YGOPro::BanlistMap>(*banlists);
 	// Delete banlists that have the same hash (`merge` does not replace them)
 	for(const auto& kv : tmp)
-		banlists.erase(kv.first);
-	banlists.merge(tmp);
+		b->erase(kv.first);
+	b->merge(tmp);
+	std::atomic_store(&banlists, std::shared_ptr<const YGOPro::BanlistMap>(std::move(b)));
 }
 
 } // namespace Ignis::Multirole
@@ -3,7 +3,8 @@
 #include "../Service.hpp"
 
 #include <regex>
-#include <shared_mutex>
+#include <map>
+#include <mutex>
 
 #include "../IGitRepoObserver.hpp"
 #include "../YGOPro/BanlistParser.hpp"
@@ -19,14 +20,18 @@ public:
 	YGOPro::BanlistPtr GetBanlistByHash(YGOPro::BanlistHash hash) const;
 
 	// IGitRepoObserver overrides
-	void OnAdd(std::string_view path, const PathVector& fileList) override;
+	void OnAdd(std::string_view path, const PathVector& fileList, const BlobIdVector& ids) override;
 	void OnDiff(std::string_view path, const GitDiff& diff) override;
 private:
 	const std::regex fnRegex;
-	YGOPro::BanlistMap banlists;
-	mutable std::shared_mutex mBanlists;
-
-	void LoadBanlists(std::string_view path, const PathVector& fileList);
+	// Replaced as a whole on every load so that reading never locks.
+	std::shared_ptr<const YGOPro::BanlistMap> banlists;
+	std::map<std::string, BlobId> loaded; // Blob of each file loaded.
+	std::mutex mBanlists; // Held while loading, used for loaded.
+
+	// Files whose blob is the same as the one already loaded from their
+	// path are not parsed again.
+	void LoadBanlists(std::string_view path, const PathVector& fileList, const BlobIdVector& ids);
 };
 
 } // namespace Ignis::Multirole
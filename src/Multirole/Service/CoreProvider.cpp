@@ -1,50 +1,164 @@
 #include "CoreProvider.hpp"
 
 #include <fstream>
+#include <utility> // std::exchange
 
 #include <boost/filesystem.hpp>
 #include <fmt/format.h>
 #include <spdlog/spdlog.h>
 
 #include "../I18N.hpp"
+#include "../Placement.hpp"
 #include "../Core/DLWrapper.hpp"
 #include "../Core/HornetWrapper.hpp"
+#include "../Core/HornetZygote.hpp"
 
 namespace Ignis::Multirole
 {
 
-Service::CoreProvider::CoreProvider(std::string_view fnRegexStr, std::string_view tmpDirStr, CoreType type, bool loadPerCall)
+Service::CoreProvider::CoreProvider(std::string_view fnRegexStr, std::string_view tmpDirStr, CoreType type, bool loadPerCall, std::size_t poolSize, std::size_t duelsPerHornet, bool useZygote, std::chrono::milliseconds hangTimeout, bool anonymousSegments, bool hugePages, HybridOptions&& hybrid, const Placement& placement)
 	:
 	fnRegex(fnRegexStr.data()),
 	tmpDir(tmpDirStr.data()),
 	type(type),
-	loadPerCall(loadPerCall),
+	loadPerCall(type == CoreType::HYBRID || loadPerCall),
 	uniqueId(std::chrono::system_clock::now().time_since_epoch().count()),
 	loadCount(0U),
-	shouldTest(true)
+	shouldTest(true),
+	poolSize((type != CoreType::SHARED && this->loadPerCall) ? poolSize : 0U),
+	poolGen(0U),
+	poolQuit(false),
+	duelsPerHornet(std::max<std::size_t>(duelsPerHornet, 1U)),
+	groupLaunching(false),
+	groupWaiters(0U),
+#ifndef _WIN32
+	useZygote(type != CoreType::SHARED && this->loadPerCall && useZygote)
+#else
+	useZygote(false)
+#endif // _WIN32
+	,
+	hangTimeout(hangTimeout),
+	anonymousSegments(anonymousSegments),
+	hugePages(hugePages),
+	placement(placement),
+	registry((type == CoreType::HYBRID) ? hybrid.crashRegistryPath : std::string_view{}),
+	isolateExtraRules(hybrid.isolateExtraRules),
+	isolateBanlists(hybrid.isolateBanlists.begin(), hybrid.isolateBanlists.end())
 {
 	using namespace boost::filesystem;
 	if(!exists(tmpDir) && !create_directory(tmpDir))
 		throw std::runtime_error(I18N::CORE_PROVIDER_COULD_NOT_CREATE_TMP_DIR);
 	if(!is_directory(tmpDir))
 		throw std::runtime_error(I18N::CORE_PROVIDER_PATH_IS_FILE_NOT_DIR);
+	if(this->poolSize > 0U)
+		poolThread = std::thread(&CoreProvider::PoolRefillLoop, this);
+	if(type == CoreType::HYBRID)
+		registry.CatchFatalSignals();
 }
 
 Service::CoreProvider::~CoreProvider()
 {
-	for(const auto& fn : pLocs)
-		boost::filesystem::remove(fn);
+	if(poolThread.joinable())
+	{
+		{
+			std::scoped_lock plock(mPool);
+			poolQuit = true;
+		}
+		cvPool.notify_one();
+		poolThread.join();
+	}
+	pool.clear();
+	// Remove files of generations still in use, nothing should be
+	// launching cores from them anymore.
+	for(const auto& w : gens)
+	{
+		if(auto g = w.lock(); g)
+		{
+			boost::system::error_code ec;
+			boost::filesystem::remove(g->loc, ec);
+		}
+	}
 }
 
-Service::CoreProvider::CorePtr Service::CoreProvider::GetCore() const
+Service::CoreProvider::CorePtr Service::CoreProvider::GetCore(const DuelTraits& traits) const
 {
-	std::shared_lock lock(mCore);
-	if(loadPerCall)
-		return LoadCore();
-	return core;
+	if(type == CoreType::HYBRID && !ShouldIsolate(traits))
+	{
+		std::shared_lock lock(mCore);
+		return core;
+	}
+	if(!loadPerCall)
+	{
+		std::shared_lock lock(mCore);
+		return core;
+	}
+	if(type != CoreType::SHARED && duelsPerHornet > 1U)
+	{
+		std::unique_lock plock(mPool);
+		for(;;)
+		{
+			// NOTE: use_count includes the reference we just made.
+			if(auto c = group.lock(); c && static_cast<std::size_t>(c.use_count()) <= duelsPerHornet)
+				return c;
+			// The core being launched for the group has a slot for each
+			// caller waiting on it besides the one launching it, only once
+			// those are taken is another core launched meanwhile.
+			if(!groupLaunching || groupWaiters + 1U >= duelsPerHornet)
+				break;
+			groupWaiters++;
+			cvGroup.wait(plock, [&](){return !groupLaunching;});
+			groupWaiters--;
+		}
+		const bool launcher = !std::exchange(groupLaunching, true);
+		plock.unlock();
+		auto Done = [&](const CorePtr& c)
+		{
+			plock.lock();
+			if(c)
+				group = c;
+			if(launcher)
+				groupLaunching = false;
+			plock.unlock();
+			cvGroup.notify_all();
+		};
+		CorePtr c;
+		try
+		{
+			c = TakeOrLoadCore();
+		}
+		catch(...)
+		{
+			Done(nullptr);
+			throw;
+		}
+		Done(c);
+		return c;
+	}
+	return TakeOrLoadCore();
 }
 
-void Service::CoreProvider::OnAdd(std::string_view path, const PathVector& fileList)
+bool Service::CoreProvider::ShouldIsolate(const DuelTraits& traits) const
+{
+	if(type != CoreType::HYBRID)
+		return false;
+	return (isolateExtraRules && traits.extraRules != 0U) ||
+		isolateBanlists.count(traits.banlistHash) != 0U ||
+		registry.Contains(traits.sig);
+}
+
+void Service::CoreProvider::ReportCrash(const Core::CrashRegistry::Signature& sig)
+{
+	if(type == CoreType::HYBRID)
+		registry.Add(sig);
+}
+
+std::size_t Service::CoreProvider::Generation() const
+{
+	std::scoped_lock plock(mPool);
+	return poolGen;
+}
+
+void Service::CoreProvider::OnAdd(std::string_view path, const PathVector& fileList, const BlobIdVector& /*unused*/)
 {
 	OnGitUpdate(path, fileList);
 }
@@ -56,15 +170,73 @@ void Service::CoreProvider::OnDiff(std::string_view path, const GitDiff& diff)
 
 // private
 
-Service::CoreProvider::CorePtr Service::CoreProvider::LoadCore() const
+Service::CoreProvider::CoreGeneration::CoreGeneration(std::size_t id, boost::filesystem::path loc) :
+	id(id),
+	loc(std::move(loc)),
+	version()
+{}
+
+Service::CoreProvider::CoreGeneration::~CoreGeneration()
+{
+	spdlog::info(I18N::CORE_PROVIDER_GENERATION_UNUSED, id, version.first, version.second, loc.string());
+	boost::system::error_code ec;
+	boost::filesystem::remove(loc, ec);
+}
+
+Service::CoreProvider::CorePtr Service::CoreProvider::LoadCore(CoreType t) const
 {
-	if(type == CoreType::SHARED)
-		return std::make_shared<Core::DLWrapper>(coreLoc.string());
-	if (type == CoreType::HORNET)
-		return std::make_shared<Core::HornetWrapper>(coreLoc.string());
+	// NOTE: The core is released before the generation it was loaded from.
+	auto Tie = [g = gen](auto c) -> CorePtr
+	{
+		auto* ptr = c.get();
+		return CorePtr(ptr, [c = std::move(c), g](Core::IWrapper* /*unused*/) mutable
+		{
+			c.reset();
+			g.reset();
+		});
+	};
+	if(t == CoreType::SHARED)
+		return Tie(std::make_shared<Core::DLWrapper>(coreLoc.string()));
+	if(t == CoreType::HORNET || t == CoreType::HYBRID)
+	{
+		if(zygote)
+		{
+			try
+			{
+				auto c = std::make_shared<Core::HornetWrapper>(coreLoc.string(), duelsPerHornet, zygote.get(), hangTimeout, anonymousSegments, hugePages);
+				placement.PlaceHornet(c->Proc());
+				return Tie(std::move(c));
+			}
+			catch(const std::runtime_error& e)
+			{
+				spdlog::warn(I18N::CORE_PROVIDER_ZYGOTE_FORK_FAILED, e.what());
+			}
+		}
+		auto c = std::make_shared<Core::HornetWrapper>(coreLoc.string(), duelsPerHornet, nullptr, hangTimeout, anonymousSegments, hugePages);
+		placement.PlaceHornet(c->Proc());
+		return Tie(std::move(c));
+	}
 	throw std::runtime_error(I18N::CORE_PROVIDER_WRONG_CORE_TYPE);
 }
 
+Service::CoreProvider::CorePtr Service::CoreProvider::TakeOrLoadCore() const
+{
+	if(poolSize > 0U)
+	{
+		std::unique_lock plock(mPool);
+		if(!pool.empty())
+		{
+			CorePtr c = std::move(pool.front());
+			pool.pop_front();
+			plock.unlock();
+			cvPool.notify_one();
+			return c;
+		}
+	}
+	std::shared_lock lock(mCore);
+	return LoadCore(type);
+}
+
 void Service::CoreProvider::OnGitUpdate(std::string_view path, const PathVector& fl)
 {
 	auto it = fl.begin();
@@ -78,27 +250,42 @@ void Service::CoreProvider::OnGitUpdate(std::string_view path, const PathVector&
 		return;
 	}
 	std::scoped_lock lock(mCore);
+	// Test the new core with a freshly launched process.
+	zygote.reset();
 	const boost::filesystem::path oldCoreLoc = coreLoc;
+	const auto oldGen = gen;
 	const boost::filesystem::path repoCore = [&]()
 	{
 		boost::filesystem::path fullFn(path.data());
 		fullFn /= *it;
 		return fullFn;
 	}();
-	coreLoc = tmpDir / fmt::format("{}-{}-{}", uniqueId, loadCount++, repoCore.filename().string());
+	const std::size_t genId = loadCount++;
+	coreLoc = tmpDir / fmt::format("{}-{}-{}", uniqueId, genId, repoCore.filename().string());
 	spdlog::info(I18N::CORE_PROVIDER_COPYING_CORE_FILE, repoCore.string(), coreLoc.string());
-	pLocs.emplace_back(coreLoc);
-	boost::filesystem::copy_file(repoCore, coreLoc);
-	if(!boost::filesystem::exists(coreLoc))
+	// NOTE: The generation is only made once the copy is there, so a failed
+	// copy doesn't get reported as an unused generation.
+	boost::system::error_code ec;
+	boost::filesystem::copy_file(repoCore, coreLoc, ec);
+	if(ec || !boost::filesystem::exists(coreLoc))
 	{
-		spdlog::error(I18N::CORE_PROVIDER_FAILED_TO_COPY_CORE_FILE);
+		spdlog::error(I18N::CORE_PROVIDER_FAILED_TO_COPY_CORE_FILE, ec.message());
+		boost::filesystem::remove(coreLoc, ec);
 		coreLoc = oldCoreLoc;
 	}
+	else
+	{
+		gen = std::make_shared<CoreGeneration>(genId, coreLoc);
+		gens.remove_if([](const std::weak_ptr<CoreGeneration>& w){return w.expired();});
+		gens.emplace_back(gen);
+	}
 	try
 	{
-		auto core = LoadCore();
+		auto core = LoadCore(type);
 		const auto ver = core->Version();
-		spdlog::info(I18N::CORE_PROVIDER_VERSION_REPORTED, ver.first, ver.second);
+		if(gen)
+			gen->version = ver;
+		spdlog::info(I18N::CORE_PROVIDER_VERSION_REPORTED, ver.first, ver.second, gen ? gen->id : 0U);
 	}
 	catch(Core::Exception& e)
 	{
@@ -106,11 +293,84 @@ void Service::CoreProvider::OnGitUpdate(std::string_view path, const PathVector&
 			throw;
 		spdlog::error(I18N::CORE_PROVIDER_ERROR_WHILE_TESTING, coreLoc.string(), e.what());
 		coreLoc = oldCoreLoc;
+		gen = oldGen;
+		ResetZygote();
 		return;
 	}
 	shouldTest = false;
+	ResetZygote();
 	if(!loadPerCall)
-		core = LoadCore();
+		core = LoadCore(type);
+	else if(type == CoreType::HYBRID)
+		core = LoadCore(CoreType::SHARED);
+	// Drain cores loaded from the previous location, they get destroyed
+	// outside of the pool lock so GetCore isn't held back by them.
+	std::deque<CorePtr> oldPool;
+	{
+		std::scoped_lock plock(mPool);
+		oldPool.swap(pool);
+		group.reset();
+		poolGen++;
+	}
+	cvPool.notify_one();
+}
+
+void Service::CoreProvider::ResetZygote()
+{
+	zygote.reset();
+	if(!useZygote || coreLoc.empty())
+		return;
+	try
+	{
+		zygote = std::make_unique<Core::HornetZygote>(coreLoc.string());
+		placement.PlaceHornet(zygote->Proc());
+	}
+	catch(const std::runtime_error& e)
+	{
+		spdlog::error(I18N::CORE_PROVIDER_ZYGOTE_LAUNCH_FAILED, e.what());
+	}
+}
+
+void Service::CoreProvider::PoolRefillLoop()
+{
+	std::unique_lock plock(mPool);
+	for(;;)
+	{
+		cvPool.wait(plock, [&]()
+		{
+			return poolQuit || (poolGen > 0U && pool.size() < poolSize);
+		});
+		if(poolQuit)
+			return;
+		const std::size_t gen = poolGen;
+		plock.unlock();
+		CorePtr c;
+		try
+		{
+			std::shared_lock lock(mCore);
+			c = LoadCore(type);
+		}
+		catch(const std::exception& e)
+		{
+			spdlog::error(I18N::CORE_PROVIDER_POOL_LOAD_FAILED, e.what());
+		}
+		plock.lock();
+		if(!c)
+		{
+			// Avoid hammering the system if cores can't be launched.
+			cvPool.wait_for(plock, std::chrono::seconds(1), [&](){return poolQuit;});
+			continue;
+		}
+		if(gen != poolGen)
+		{
+			// Core changed while this one was loading, discard it.
+			plock.unlock();
+			c.reset();
+			plock.lock();
+			continue;
+		}
+		pool.emplace_back(std::move(c));
+	}
 }
 
 } // namespace Ignis::Multirole
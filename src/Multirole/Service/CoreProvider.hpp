@@ -3,14 +3,21 @@
 #include "../Service.hpp"
 
 #include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <list>
 #include <regex>
 #include <memory>
+#include <mutex>
+#include <set>
 #include <shared_mutex>
+#include <thread>
+#include <vector>
 
 #include <boost/filesystem/path.hpp>
 
 #include "../IGitRepoObserver.hpp"
+#include "../Core/CrashRegistry.hpp"
 
 namespace Ignis::Multirole
 {
@@ -18,10 +25,13 @@ namespace Ignis::Multirole
 namespace Core
 {
 
+class HornetZygote;
 class IWrapper;
 
 } // namespace Core
 
+class Placement;
+
 class Service::CoreProvider final : public IGitRepoObserver
 {
 public:
@@ -29,18 +39,48 @@ public:
 	{
 		SHARED,
 		HORNET,
+		// Duels run on a shared core, except the ones deemed risky, which
+		// run on per-call hornet cores.
+		HYBRID,
 	};
 
 	using CorePtr = std::shared_ptr<Core::IWrapper>;
 
-	CoreProvider(std::string_view fnRegexStr, std::string_view tmpDirStr, CoreType type, bool loadPerCall);
+	// Options that decide which duels are risky on HYBRID.
+	struct HybridOptions
+	{
+		std::string_view crashRegistryPath;
+		bool isolateExtraRules; // Rooms with any extra rule are risky.
+		std::vector<uint32_t> isolateBanlists; // Rooms with these are risky.
+	};
+
+	// What the core is requested for, only used by HYBRID.
+	struct DuelTraits
+	{
+		Core::CrashRegistry::Signature sig;
+		uint16_t extraRules;
+		uint32_t banlistHash;
+	};
+
+	CoreProvider(std::string_view fnRegexStr, std::string_view tmpDirStr, CoreType type, bool loadPerCall, std::size_t poolSize, std::size_t duelsPerHornet, bool useZygote, std::chrono::milliseconds hangTimeout, bool anonymousSegments, bool hugePages, HybridOptions&& hybrid, const Placement& placement);
 	~CoreProvider();
 
 	// Will return a core instance based on the options set.
-	CorePtr GetCore() const;
+	CorePtr GetCore(const DuelTraits& traits = {}) const;
+
+	// Whether or not a duel with the given traits gets an isolated core.
+	bool ShouldIsolate(const DuelTraits& traits) const;
+
+	// Remembers that a duel with the given signature crashed its core, so
+	// that similar duels are isolated from now on.
+	void ReportCrash(const Core::CrashRegistry::Signature& sig);
+
+	// Changes each time the core file is replaced, cores obtained with a
+	// different generation are outdated.
+	std::size_t Generation() const;
 
 	// IGitRepoObserver overrides
-	void OnAdd(std::string_view path, const PathVector& fileList) override;
+	void OnAdd(std::string_view path, const PathVector& fileList, const BlobIdVector& ids) override;
 	void OnDiff(std::string_view path, const GitDiff& diff) override;
 private:
 	const std::regex fnRegex;
@@ -52,10 +92,75 @@ private:
 	bool shouldTest;
 	boost::filesystem::path coreLoc;
 	CorePtr core;
-	std::list<boost::filesystem::path> pLocs; // Previous locations for core file.
-	mutable std::shared_mutex mCore; // used for both corePath and core.
+	mutable std::shared_mutex mCore; // used for coreLoc, core and gen.
+
+	// Each core file copied onto tmpDir is a generation, every core loaded
+	// from it holds a reference to it, the file is removed once the last
+	// one is gone.
+	struct CoreGeneration
+	{
+		const std::size_t id;
+		const boost::filesystem::path loc;
+		std::pair<int, int> version;
+
+		CoreGeneration(std::size_t id, boost::filesystem::path loc);
+		~CoreGeneration();
+	};
+	std::shared_ptr<CoreGeneration> gen; // Generation coreLoc belongs to.
+	std::list<std::weak_ptr<CoreGeneration>> gens; // All generations, for cleanup.
+
+	// Pool of already launched cores, only used for per-call hornet cores.
+	const std::size_t poolSize;
+	mutable std::deque<CorePtr> pool;
+	std::size_t poolGen; // Incremented each time the core is changed.
+	bool poolQuit;
+	mutable std::mutex mPool; // used for pool, poolGen and poolQuit.
+	mutable std::condition_variable cvPool;
+	std::thread poolThread;
+
+	// Per-call hornet cores can be shared by up to this many duels, which
+	// are served concurrently by the same process.
+	const std::size_t duelsPerHornet;
+	mutable std::weak_ptr<Core::IWrapper> group; // Protected by mPool.
+	mutable bool groupLaunching; // Protected by mPool.
+	mutable std::size_t groupWaiters; // Protected by mPool.
+	mutable std::condition_variable cvGroup; // Signaled once launched.
+
+	// Per-call hornet cores can be forked off a zygote that has the core
+	// already loaded instead of launching and loading it each time.
+	const bool useZygote;
+	std::unique_ptr<Core::HornetZygote> zygote; // Protected by mCore.
+
+
+	// Hornet cores that don't reply to a call within this are hanged.
+	const std::chrono::milliseconds hangTimeout;
+
+	// Whether or not hornet cores are launched with an anonymous segment.
+	const bool anonymousSegments;
+
+	// Whether or not hornet cores advise huge pages for their payloads.
+	const bool hugePages;
+
+	// Where hornet cores are moved onto once launched.
+	const Placement& placement;
+
+	// Decides which duels are risky when HYBRID.
+	Core::CrashRegistry registry;
+	const bool isolateExtraRules;
+	const std::set<uint32_t> isolateBanlists;
+
+	// Loads a core from the current location, tied to its generation.
+	CorePtr LoadCore(CoreType t) const;
+
+	// Replaces the zygote with one that loads the core from the current
+	// location, if zygotes are used at all. Expects mCore to be locked.
+	void ResetZygote();
+
+	// Takes a core out of the pool if there is any, otherwise loads one.
+	CorePtr TakeOrLoadCore() const;
 
-	CorePtr LoadCore() const;
+	// Keeps the pool filled up with cores loaded from the current location.
+	void PoolRefillLoop();
 
 	void OnGitUpdate(std::string_view path, const PathVector& fl);
 };
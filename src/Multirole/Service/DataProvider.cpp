@@ -1,8 +1,13 @@
 #include "DataProvider.hpp"
 
+#include <array>
+#include <set>
 #include <cstring> // std::memset
+#include <fstream>
 #include <stdexcept> // std::runtime_error
 
+#include <boost/filesystem/operations.hpp>
+#include <fmt/format.h>
 #include <sqlite3.h>
 #include <spdlog/spdlog.h>
 
@@ -12,11 +17,39 @@
 namespace Ignis::Multirole
 {
 
+constexpr std::string_view SNAPSHOT_EXTENSION = ".cards";
+
+// FNV-1a of the contents of the file, throws if it can't be read.
+inline uint64_t HashFile(const std::string& path)
+{
+	constexpr uint64_t FNV_OFFSET_BASIS = 0xCBF29CE484222325U;
+	constexpr uint64_t FNV_PRIME = 0x100000001B3U;
+	std::ifstream f(path, std::ios_base::binary);
+	if(!f.is_open())
+		throw std::runtime_error(I18N::DATA_PROVIDER_COULD_NOT_READ);
+	uint64_t h = FNV_OFFSET_BASIS;
+	std::array<char, 65536U> buffer;
+	while(f.read(buffer.data(), buffer.size()) || f.gcount() > 0)
+	{
+		const auto count = static_cast<std::size_t>(f.gcount());
+		for(std::size_t i = 0U; i < count; i++)
+			h = (h ^ static_cast<uint8_t>(buffer[i])) * FNV_PRIME;
+	}
+	return h;
+}
+
 // public
 
-Service::DataProvider::DataProvider(std::string_view fnRegexStr) :
-	fnRegex(fnRegexStr.data())
-{}
+Service::DataProvider::DataProvider(std::string_view fnRegexStr, std::string_view snapshotDirStr) :
+	fnRegex(fnRegexStr.data()),
+	snapshotDir(snapshotDirStr.data())
+{
+	using namespace boost::filesystem;
+	if(snapshotDir.empty())
+		return;
+	if(!exists(snapshotDir) && !create_directories(snapshotDir))
+		throw std::runtime_error(I18N::DATA_PROVIDER_COULD_NOT_CREATE_SNAPSHOT_DIR);
+}
 
 std::shared_ptr<YGOPro::CardDatabase> Service::DataProvider::GetDatabase() const
 {
@@ -24,24 +57,32 @@ std::shared_ptr<YGOPro::CardDatabase> Service::DataProvider::GetDatabase() const
 	return db;
 }
 
-void Service::DataProvider::OnAdd(std::string_view path, const PathVector& fileList)
+void Service::DataProvider::OnAdd(std::string_view path, const PathVector& fileList, const BlobIdVector& ids)
 {
+	std::scoped_lock lock(mPaths);
 	std::string fullPath(path);
-	// Filter and add to set of dbs
-	for(const auto& fn : fileList)
+	// Filter and add to set of dbs, unless they are loaded already
+	for(std::size_t i = 0U; i < fileList.size(); i++)
 	{
-		if(!std::regex_match(fn, fnRegex))
+		if(!std::regex_match(fileList[i], fnRegex))
 			continue;
 		fullPath.resize(path.size());
-		fullPath += fn;
-		paths.insert(fullPath);
+		fullPath += fileList[i];
+		if(auto search = blobs.find(fullPath); search != blobs.end() && search->second == ids[i])
+			continue;
+		paths[fullPath] = nullptr;
+		blobs[fullPath] = ids[i];
 	}
 	ReloadDatabases();
 }
 
 void Service::DataProvider::OnDiff(std::string_view path, const GitDiff& diff)
 {
+	std::scoped_lock lock(mPaths);
 	std::string fullPath(path);
+	// Databases of removed files, by blob, which are used again for files
+	// added with the same contents (i.e: moved or renamed).
+	std::map<BlobId, std::pair<std::shared_ptr<const YGOPro::CardDatabase>, boost::filesystem::path>> removed;
 	// Filter and remove from sets of dbs
 	for(const auto& fn : diff.removed)
 	{
@@ -49,16 +90,30 @@ void Service::DataProvider::OnDiff(std::string_view path, const GitDiff& diff)
 			continue;
 		fullPath.resize(path.size());
 		fullPath += fn;
+		if(auto search = paths.find(fullPath); search != paths.end() && search->second)
+			removed[blobs[fullPath]] = {std::move(search->second), snapshots[fullPath]};
 		paths.erase(fullPath);
+		blobs.erase(fullPath);
+		snapshots.erase(fullPath);
 	}
-	// Filter and add to set of dbs
-	for(const auto& fn : diff.added)
+	// Filter and add to set of dbs, modified ones are loaded again too
+	for(std::size_t i = 0U; i < diff.added.size(); i++)
 	{
-		if(!std::regex_match(fn, fnRegex))
+		if(!std::regex_match(diff.added[i], fnRegex))
 			continue;
 		fullPath.resize(path.size());
-		fullPath += fn;
-		paths.insert(fullPath);
+		fullPath += diff.added[i];
+		const auto& id = diff.addedIds[i];
+		blobs[fullPath] = id;
+		auto search = removed.find(id);
+		if(search == removed.end())
+		{
+			paths[fullPath] = nullptr;
+			continue;
+		}
+		paths[fullPath] = search->second.first;
+		if(!search->second.second.empty())
+			snapshots[fullPath] = search->second.second;
 	}
 	ReloadDatabases();
 }
@@ -67,15 +122,101 @@ void Service::DataProvider::OnDiff(std::string_view path, const GitDiff& diff)
 
 void Service::DataProvider::ReloadDatabases()
 {
-	auto newDb = std::make_shared<YGOPro::CardDatabase>();
-	for(const auto& path : paths)
+	std::vector<std::shared_ptr<const YGOPro::CardDatabase>> layers;
+	for(auto& [path, part] : paths)
 	{
-		spdlog::info(I18N::DATA_PROVIDER_LOADING_ONE, path);
-		if(!newDb->Merge(path))
-			spdlog::error(I18N::DATA_PROVIDER_COULD_NOT_MERGE);
+		if(!part)
+		{
+			spdlog::info(I18N::DATA_PROVIDER_LOADING_ONE, path);
+			try
+			{
+				part = LoadDatabase(path);
+			}
+			catch(const std::exception& e)
+			{
+				spdlog::error(I18N::DATA_PROVIDER_COULD_NOT_SEAL, e.what());
+			}
+		}
+		if(part)
+			layers.push_back(part);
+	}
+	RemoveStaleSnapshots();
+	// NOTE: Layers go in path order, same as they used to be merged.
+	auto newDb = std::make_shared<YGOPro::CardDatabase>(std::move(layers));
+	try
+	{
+		newDb->PublishSharedTable();
+	}
+	catch(const std::exception& e)
+	{
+		spdlog::error(I18N::DATA_PROVIDER_COULD_NOT_PUBLISH, e.what());
 	}
 	std::scoped_lock lock(mDb);
 	db = newDb;
 }
 
+std::shared_ptr<const YGOPro::CardDatabase> Service::DataProvider::LoadDatabase(const std::string& path)
+{
+	uint64_t hash = 0U;
+	boost::filesystem::path snapshot;
+	if(!snapshotDir.empty())
+	{
+		hash = HashFile(path);
+		snapshot = snapshotDir / fmt::format("{:016X}{}", hash, SNAPSHOT_EXTENSION);
+		snapshots[path] = snapshot;
+		try
+		{
+			if(boost::filesystem::exists(snapshot))
+				return YGOPro::CardDatabase::MapSnapshot(snapshot.string(), hash);
+		}
+		catch(const std::exception& e)
+		{
+			spdlog::warn(I18N::DATA_PROVIDER_BAD_SNAPSHOT, snapshot.string(), e.what());
+		}
+	}
+	auto cdb = std::make_shared<YGOPro::CardDatabase>();
+	if(!cdb->Merge(path))
+	{
+		spdlog::error(I18N::DATA_PROVIDER_COULD_NOT_MERGE);
+		return nullptr;
+	}
+	cdb->Seal();
+	if(snapshot.empty())
+		return cdb;
+	try
+	{
+		cdb->WriteSnapshot(snapshot.string(), hash);
+	}
+	catch(const std::exception& e)
+	{
+		spdlog::warn(I18N::DATA_PROVIDER_COULD_NOT_WRITE_SNAPSHOT, snapshot.string(), e.what());
+	}
+	return cdb;
+}
+
+void Service::DataProvider::RemoveStaleSnapshots()
+{
+	using namespace boost::filesystem;
+	if(snapshotDir.empty())
+		return;
+	std::set<path> inUse;
+	for(auto it = snapshots.begin(); it != snapshots.end();)
+	{
+		if(paths.count(it->first) == 0U)
+		{
+			it = snapshots.erase(it);
+			continue;
+		}
+		inUse.insert(it->second);
+		++it;
+	}
+	boost::system::error_code ec;
+	for(const auto& entry : directory_iterator(snapshotDir, ec))
+	{
+		const auto& p = entry.path();
+		if(p.extension() == SNAPSHOT_EXTENSION.data() && inUse.count(p) == 0U)
+			remove(p, ec);
+	}
+}
+
 } // namespace Ignis::Multirole
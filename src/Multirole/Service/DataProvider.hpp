@@ -2,10 +2,13 @@
 #define SERVICE_DATAPROVIDER_HPP
 #include "../Service.hpp"
 
+#include <map>
 #include <regex>
 #include <memory>
+#include <mutex>
 #include <shared_mutex>
-#include <set>
+
+#include <boost/filesystem/path.hpp>
 
 #include "../IGitRepoObserver.hpp"
 
@@ -22,20 +25,41 @@ namespace Ignis::Multirole
 class Service::DataProvider final : public IGitRepoObserver
 {
 public:
-	DataProvider(std::string_view fnRegexStr);
+	// Each database is compiled once into a snapshot kept on
+	// `snapshotDirStr`, named after the hash of its contents, which is
+	// mapped instead of loading the database again. Snapshots are not
+	// used if `snapshotDirStr` is empty.
+	DataProvider(std::string_view fnRegexStr, std::string_view snapshotDirStr);
 
 	std::shared_ptr<YGOPro::CardDatabase> GetDatabase() const;
 
 	// IGitRepoObserver overrides
-	void OnAdd(std::string_view path, const PathVector& fileList) override;
+	void OnAdd(std::string_view path, const PathVector& fileList, const BlobIdVector& ids) override;
 	void OnDiff(std::string_view path, const GitDiff& diff) override;
 private:
 	const std::regex fnRegex;
-	std::set<std::string> paths;
+	const boost::filesystem::path snapshotDir;
+	// Each database file loaded on its own, null if it couldn't be, so
+	// that only files that changed need to be loaded again.
+	std::map<std::string, std::shared_ptr<const YGOPro::CardDatabase>> paths;
+	std::map<std::string, boost::filesystem::path> snapshots; // Of each path.
+	std::map<std::string, BlobId> blobs; // Of each path.
+	// Held while updating, as each observed repository updates on its own
+	// thread. Used for paths, snapshots and blobs.
+	std::mutex mPaths;
 	std::shared_ptr<YGOPro::CardDatabase> db;
 	mutable std::shared_mutex mDb;
 
+	// Loads the files whose database is missing, and then publishes a new
+	// database made of all of them.
 	void ReloadDatabases();
+
+	// Maps the snapshot of the database file, compiling it first if it is
+	// not there or out of date.
+	std::shared_ptr<const YGOPro::CardDatabase> LoadDatabase(const std::string& path);
+
+	// Deletes snapshots of databases that are gone or changed.
+	void RemoveStaleSnapshots();
 };
 
 } // namespace Ignis::Multirole
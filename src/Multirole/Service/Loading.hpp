@@ -0,0 +1,52 @@
+#ifndef SERVICE_LOADING_HPP
+#define SERVICE_LOADING_HPP
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <boost/asio/post.hpp>
+#include <boost/asio/thread_pool.hpp>
+
+namespace Ignis::Multirole::Loading
+{
+
+// Reads the whole file with a single read, false if it couldn't be read.
+inline bool ReadFile(const std::string& path, std::string& out)
+{
+	std::FILE* f = std::fopen(path.data(), "rb");
+	if(f == nullptr)
+		return false;
+	bool ok = std::fseek(f, 0, SEEK_END) == 0;
+	const long size = ok ? std::ftell(f) : -1;
+	ok = size >= 0 && std::fseek(f, 0, SEEK_SET) == 0;
+	if(ok)
+	{
+		out.resize(static_cast<std::size_t>(size));
+		ok = std::fread(out.data(), 1U, out.size(), f) == out.size();
+	}
+	std::fclose(f);
+	return ok;
+}
+
+// Calls `f` with every index from 0 to `count` - 1 on a pool of threads,
+// returning once all calls are done. `f` must not throw.
+template<typename F>
+void ForEach(std::size_t count, F&& f)
+{
+	const auto threads = std::min<std::size_t>(count,
+		std::max(1U, std::thread::hardware_concurrency()));
+	if(threads <= 1U)
+	{
+		for(std::size_t i = 0U; i < count; i++)
+			f(i);
+		return;
+	}
+	boost::asio::thread_pool pool(threads);
+	for(std::size_t i = 0U; i < count; i++)
+		boost::asio::post(pool, [&f, i](){f(i);});
+	pool.join();
+}
+
+} // namespace Ignis::Multirole::Loading
+
+#endif // SERVICE_LOADING_HPP
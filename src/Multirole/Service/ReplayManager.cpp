@@ -1,12 +1,22 @@
 #include "ReplayManager.hpp"
 
+#include <algorithm>
+#include <vector>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif // _WIN32
+
+#include <boost/asio/post.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <boost/interprocess/sync/scoped_lock.hpp>
 #include <spdlog/spdlog.h>
+#include <sqlite3.h>
 
 #include "../I18N.hpp"
-#include "../YGOPro/Replay.hpp"
+#include "../../ReplayPack.hpp"
+#include "../Room/Stats.hpp"
 
 namespace Ignis::Multirole
 {
@@ -15,12 +25,87 @@ constexpr auto IOS_BINARY = std::ios_base::binary;
 constexpr auto IOS_BINARY_IN = IOS_BINARY | std::ios_base::in;
 constexpr auto IOS_BINARY_OUT = IOS_BINARY | std::ios_base::out;
 
-Service::ReplayManager::ReplayManager(bool save, std::string_view dirStr) :
+static constexpr const char* INDEX_SCHEMA =
+R"(
+CREATE TABLE IF NOT EXISTS "replays" (
+	"id"        INTEGER,
+	"room"      INTEGER,
+	"timestamp" INTEGER,
+	"banlist"   INTEGER,
+	"reason"    TEXT,
+	"size"      INTEGER,
+	"pack"      INTEGER,
+	PRIMARY KEY("id")
+);
+CREATE TABLE IF NOT EXISTS "duelists" (
+	"replay" INTEGER,
+	"team"   INTEGER,
+	"pos"    INTEGER,
+	"name"   TEXT
+);
+CREATE INDEX IF NOT EXISTS "replays_room" ON "replays"("room");
+CREATE INDEX IF NOT EXISTS "replays_timestamp" ON "replays"("timestamp");
+CREATE INDEX IF NOT EXISTS "duelists_replay" ON "duelists"("replay");
+CREATE INDEX IF NOT EXISTS "duelists_name" ON "duelists"("name");
+)";
+
+static constexpr const char* INSERT_REPLAY_STMT =
+R"(
+INSERT OR REPLACE INTO "replays" VALUES(?,?,?,?,?,?,?);
+)";
+
+static constexpr const char* INSERT_DUELIST_STMT =
+R"(
+INSERT INTO "duelists" VALUES(?,?,?,?);
+)";
+
+namespace
+{
+
+// Flushes the file all the way to disk.
+void Sync(std::FILE* f)
+{
+	std::fflush(f);
+#ifndef _WIN32
+	fsync(fileno(f));
+#endif // _WIN32
+}
+
+} // namespace
+
+Service::ReplayManager::ReplayManager(
+	bool save,
+	std::string_view dirStr,
+	uint64_t blockSize,
+	const WriteOptions& wopts,
+	const Compression& clientComp,
+	const Compression& diskComp,
+	const PackOptions& popts,
+	bool indexed)
+	:
 	save(save),
 	dir(dirStr.data()),
 	lastId(dir / "lastId"),
-	mLastId()
+	blockSize(std::max<uint64_t>(1U, blockSize)),
+	nextId(0U),
+	leaseEnd(0U),
+	mLastId(),
+	wopts(wopts),
+	clientComp(clientComp),
+	diskComp(diskComp),
+	popts(popts),
+	queued(0U),
+	maxQueued(wopts.maxQueued),
+	pack(nullptr),
+	index(nullptr),
+	packSize(0U),
+	packId(0U),
+	indexDb(nullptr),
+	insertReplay(nullptr),
+	insertDuelist(nullptr)
 {
+	if(clientComp.codec != YGOPro::Replay::Codec::LZMA)
+		throw std::runtime_error(I18N::REPLAY_MANAGER_CLIENT_CODEC_NOT_LZMA);
 	if(!save)
 	{
 		spdlog::info(I18N::REPLAY_MANAGER_NOT_SAVING_REPLAYS);
@@ -31,6 +116,9 @@ Service::ReplayManager::ReplayManager(bool save, std::string_view dirStr) :
 		throw std::runtime_error(I18N::REPLAY_MANAGER_COULD_NOT_CREATE_DIR);
 	if(!is_directory(dir))
 		throw std::runtime_error(I18N::REPLAY_MANAGER_PATH_IS_FILE_NOT_DIR);
+	writers = std::make_unique<boost::asio::thread_pool>(std::max<std::size_t>(1U, wopts.threads));
+	if(indexed)
+		OpenIndex();
 	uint64_t id = 1U;
 	if(!exists(lastId))
 	{
@@ -57,25 +145,231 @@ Service::ReplayManager::ReplayManager(bool save, std::string_view dirStr) :
 	}
 }
 
-void Service::ReplayManager::Save(uint64_t id, const YGOPro::Replay& replay) const
+Service::ReplayManager::~ReplayManager()
+{
+	if(writers)
+		writers->join();
+	ClosePack();
+	sqlite3_finalize(insertReplay);
+	sqlite3_finalize(insertDuelist);
+	sqlite3_close(indexDb);
+}
+
+void Service::ReplayManager::Save(uint64_t id, const YGOPro::Replay& replay, const Metadata& meta)
+{
+	if(!save)
+		return;
+	Record rec{id, replay.Timestamp(), meta, {}};
+	if(indexDb != nullptr)
+	{
+		replay.ForEachDuelist([&](uint8_t team, uint8_t pos, const YGOPro::Replay::Duelist& d)
+		{
+			rec.duelists.push_back({team, pos, d.name});
+		});
+	}
+	// Compressed again by the writers if stored with different settings.
+	const bool raw = diskComp.codec != clientComp.codec || diskComp.level != clientComp.level;
+	const auto& bytes = raw ? replay.Uncompressed() : replay.Bytes();
+	auto& stats = Room::Stats::Get();
+	if(queued.load(std::memory_order_relaxed) >= maxQueued.load(std::memory_order_relaxed))
+	{
+		if(wopts.whenFull == QueueFullPolicy::DROP)
+		{
+			spdlog::error(I18N::REPLAY_MANAGER_QUEUE_FULL_DROPPING, id);
+			stats.RecordReplayDropped();
+			return;
+		}
+		Write(rec, bytes, raw);
+		return;
+	}
+	queued.fetch_add(1U, std::memory_order_relaxed);
+	stats.AddReplaysQueued(1);
+	boost::asio::post(*writers, [this, rec = std::move(rec), data = std::vector<uint8_t>(bytes), raw]()
+	{
+		Write(rec, data, raw);
+		queued.fetch_sub(1U, std::memory_order_relaxed);
+		Room::Stats::Get().AddReplaysQueued(-1);
+	});
+}
+
+void Service::ReplayManager::SetMaxQueued(std::size_t n)
+{
+	maxQueued.store(n, std::memory_order_relaxed);
+}
+
+const Service::ReplayManager::Compression& Service::ReplayManager::ClientCompression() const
+{
+	return clientComp;
+}
+
+uint64_t Service::ReplayManager::NewId()
 {
 	if(!save)
+		return 0U;
+	std::scoped_lock tlock(mLastId);
+	if(nextId == leaseEnd && !Lease())
+		return 0U;
+	return nextId++;
+}
+
+// private
+
+void Service::ReplayManager::Write(const Record& rec, const std::vector<uint8_t>& data, bool raw)
+{
+	std::vector<uint8_t> compressed;
+	if(raw)
+		compressed = YGOPro::Replay::Compress(data, diskComp);
+	const auto& out = raw ? compressed : data;
+	if(popts.enabled)
+	{
+		if(const uint64_t pack = Append(rec.id, out); pack != 0U)
+			AddToIndex(rec, out.size(), pack);
 		return;
-	const auto fn = dir / (std::to_string(id) + ".yrpX");
-	const auto& bytes = replay.Bytes();
+	}
+	const auto fn = dir / (std::to_string(rec.id) + ".yrpX");
 	if(std::fstream f(fn, IOS_BINARY_OUT); f.is_open())
-		f.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+	{
+		f.write(reinterpret_cast<const char*>(out.data()), static_cast<std::streamsize>(out.size()));
+		AddToIndex(rec, out.size(), 0U);
+	}
 	else
+	{
 		spdlog::error(I18N::REPLAY_MANAGER_UNABLE_TO_SAVE, fn.string());
+	}
 }
 
-uint64_t Service::ReplayManager::NewId()
+uint64_t Service::ReplayManager::Append(uint64_t id, const std::vector<uint8_t>& data)
 {
-	if(!save)
+	std::scoped_lock lock(mPack);
+	if(pack != nullptr &&
+	   (packSize + data.size() > popts.maxSize ||
+	    std::chrono::steady_clock::now() - packOpened > popts.maxAge))
+		ClosePack();
+	if(pack == nullptr && !OpenPack(id))
+	{
+		spdlog::error(I18N::REPLAY_MANAGER_UNABLE_TO_OPEN_PACK, id);
+		return 0U;
+	}
+	const ReplayPack::Entry entry{id, packSize, static_cast<uint32_t>(data.size()), 0U};
+	if(std::fwrite(data.data(), 1U, data.size(), pack) != data.size() ||
+	   std::fflush(pack) != 0 ||
+	   std::fwrite(&entry, sizeof(entry), 1U, index) != 1U ||
+	   std::fflush(index) != 0)
+	{
+		// Start over on a new pack, as the offsets on this one are now
+		// not reliable.
+		spdlog::error(I18N::REPLAY_MANAGER_UNABLE_TO_SAVE, id);
+		ClosePack();
 		return 0U;
-	uint64_t prevId = 0U;
+	}
+	packSize += data.size();
+	if(popts.fsync == FsyncPolicy::ALWAYS)
+	{
+		Sync(pack);
+		Sync(index);
+	}
+	return packId;
+}
+
+bool Service::ReplayManager::OpenPack(uint64_t firstId)
+{
+	const auto packFn = (dir / ReplayPack::DataName(firstId)).string();
+	const auto indexFn = (dir / ReplayPack::IndexName(firstId)).string();
+	pack = std::fopen(packFn.data(), "ab");
+	index = std::fopen(indexFn.data(), "ab");
+	if(pack == nullptr || index == nullptr)
+	{
+		ClosePack();
+		return false;
+	}
+	std::fseek(pack, 0, SEEK_END);
+	packSize = static_cast<uint64_t>(std::ftell(pack));
+	packOpened = std::chrono::steady_clock::now();
+	packId = firstId;
+	return true;
+}
+
+void Service::ReplayManager::ClosePack()
+{
+	for(auto* f : {pack, index})
+	{
+		if(f == nullptr)
+			continue;
+		if(popts.fsync != FsyncPolicy::NEVER)
+			Sync(f);
+		std::fclose(f);
+	}
+	pack = nullptr;
+	index = nullptr;
+	packSize = 0U;
+}
+
+void Service::ReplayManager::OpenIndex()
+{
+	const auto fn = (dir / "index.db").string();
+	if(sqlite3_open(fn.data(), &indexDb) != SQLITE_OK)
+	{
+		std::string errStr(sqlite3_errmsg(indexDb));
+		sqlite3_close(indexDb);
+		indexDb = nullptr;
+		throw std::runtime_error(errStr);
+	}
+	// Other processes saving onto the same directory share the index.
+	sqlite3_busy_timeout(indexDb, 5000); // NOLINT
+	char* err = nullptr;
+	if(sqlite3_exec(indexDb, INDEX_SCHEMA, nullptr, nullptr, &err) != SQLITE_OK ||
+	   sqlite3_prepare_v2(indexDb, INSERT_REPLAY_STMT, -1, &insertReplay, nullptr) != SQLITE_OK ||
+	   sqlite3_prepare_v2(indexDb, INSERT_DUELIST_STMT, -1, &insertDuelist, nullptr) != SQLITE_OK)
+	{
+		std::string errStr((err != nullptr) ? err : sqlite3_errmsg(indexDb));
+		sqlite3_free(err);
+		sqlite3_finalize(insertReplay);
+		sqlite3_finalize(insertDuelist);
+		sqlite3_close(indexDb);
+		insertReplay = insertDuelist = nullptr;
+		indexDb = nullptr;
+		throw std::runtime_error(errStr);
+	}
+}
+
+void Service::ReplayManager::AddToIndex(const Record& rec, std::size_t size, uint64_t pack)
+{
+	if(indexDb == nullptr)
+		return;
+	std::scoped_lock lock(mIndex);
+	auto Run = [](sqlite3_stmt* stmt) -> bool
+	{
+		const bool ok = sqlite3_step(stmt) == SQLITE_DONE;
+		sqlite3_reset(stmt);
+		sqlite3_clear_bindings(stmt);
+		return ok;
+	};
+	sqlite3_exec(indexDb, "BEGIN;", nullptr, nullptr, nullptr);
+	sqlite3_bind_int64(insertReplay, 1, static_cast<sqlite3_int64>(rec.id));
+	sqlite3_bind_int64(insertReplay, 2, rec.meta.roomId);
+	sqlite3_bind_int64(insertReplay, 3, rec.timestamp);
+	sqlite3_bind_int64(insertReplay, 4, rec.meta.banlistHash);
+	sqlite3_bind_text(insertReplay, 5, rec.meta.finishReason, -1, SQLITE_STATIC);
+	sqlite3_bind_int64(insertReplay, 6, static_cast<sqlite3_int64>(size));
+	if(pack != 0U)
+		sqlite3_bind_int64(insertReplay, 7, static_cast<sqlite3_int64>(pack));
+	bool ok = Run(insertReplay);
+	for(const auto& d : rec.duelists)
+	{
+		sqlite3_bind_int64(insertDuelist, 1, static_cast<sqlite3_int64>(rec.id));
+		sqlite3_bind_int(insertDuelist, 2, d.team);
+		sqlite3_bind_int(insertDuelist, 3, d.pos);
+		sqlite3_bind_text(insertDuelist, 4, d.name.data(), static_cast<int>(d.name.size()), SQLITE_STATIC);
+		ok = Run(insertDuelist) && ok;
+	}
+	sqlite3_exec(indexDb, ok ? "COMMIT;" : "ROLLBACK;", nullptr, nullptr, nullptr);
+	if(!ok)
+		spdlog::error(I18N::REPLAY_MANAGER_UNABLE_TO_INDEX, rec.id, sqlite3_errmsg(indexDb));
+}
+
+bool Service::ReplayManager::Lease()
+{
 	uint64_t id = 0U;
-	std::scoped_lock tlock(mLastId);
 	boost::interprocess::scoped_lock<boost::interprocess::file_lock> plock(lLastId);
 	if(std::fstream f(lastId, IOS_BINARY_IN); f.is_open())
 	{
@@ -85,7 +379,7 @@ uint64_t Service::ReplayManager::NewId()
 		if(fsize != sizeof(id))
 		{
 			spdlog::error(I18N::REPLAY_MANAGER_LASTID_SIZE_CORRUPTED, fsize, sizeof(id));
-			return 0U;
+			return false;
 		}
 		f.seekg(0, std::ios_base::beg);
 		f.read(reinterpret_cast<char*>(&id), sizeof(id));
@@ -93,16 +387,18 @@ uint64_t Service::ReplayManager::NewId()
 	else
 	{
 		spdlog::error(I18N::REPLAY_MANAGER_CANNOT_OPEN_LASTID);
-		return 0U;
+		return false;
 	}
-	prevId = id++;
+	uint64_t end = id + blockSize;
 	if(std::fstream f(lastId, IOS_BINARY_OUT); f.is_open())
 	{
-		f.write(reinterpret_cast<char*>(&id), sizeof(id));
-		return prevId;
+		f.write(reinterpret_cast<char*>(&end), sizeof(end));
+		nextId = id;
+		leaseEnd = end;
+		return true;
 	}
 	spdlog::error(I18N::REPLAY_MANAGER_CANNOT_WRITE_ID);
-	return 0U;
+	return false;
 }
 
 } // namespace Ignis::Multirole
@@ -2,19 +2,23 @@
 #define SERVICE_REPLAYMANAGER_HPP
 #include "../Service.hpp"
 
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <string_view>
+#include <vector>
 
+#include <boost/asio/thread_pool.hpp>
 #include <boost/filesystem/path.hpp>
 #include <boost/interprocess/sync/file_lock.hpp>
 
-namespace YGOPro
-{
-
-class Replay;
+#include "../YGOPro/Replay.hpp"
 
-} // namespace YGOPro
+struct sqlite3;
+struct sqlite3_stmt;
 
 namespace Ignis::Multirole
 {
@@ -22,17 +26,139 @@ namespace Ignis::Multirole
 class Service::ReplayManager
 {
 public:
-	ReplayManager(bool save, std::string_view dirStr);
+	// What to do with a replay saved while `maxQueued` are already being
+	// written.
+	enum class QueueFullPolicy
+	{
+		WRITE_INLINE, // Write it on the calling thread.
+		DROP, // Don't save it at all.
+	};
+
+	using Compression = YGOPro::Replay::Compression;
+
+	struct WriteOptions
+	{
+		std::size_t threads;
+		std::size_t maxQueued;
+		QueueFullPolicy whenFull;
+	};
+
+	// When pack files are flushed onto disk.
+	enum class FsyncPolicy
+	{
+		NEVER,
+		ON_ROTATE, // Once a pack is done with.
+		ALWAYS, // After every replay.
+	};
+
+	// If enabled, replays are appended onto packs (see ReplayPack.hpp)
+	// instead of each going to its own file. A new pack is started once
+	// the current one would exceed `maxSize` or is older than `maxAge`.
+	struct PackOptions
+	{
+		bool enabled;
+		uint64_t maxSize;
+		std::chrono::seconds maxAge;
+		FsyncPolicy fsync;
+	};
+
+	// What is known of a replay besides its contents, recorded along with
+	// the data of the replay itself onto the index.
+	struct Metadata
+	{
+		uint32_t roomId;
+		uint32_t banlistHash;
+		const char* finishReason;
+	};
+
+	// Replays are serialized with `clientComp`, and compressed again with
+	// `diskComp` by the writers if it differs. If `indexed`, every replay
+	// saved is also recorded onto "index.db", a sqlite database with the
+	// `replays` and `duelists` tables, to look them up.
+	ReplayManager(
+		bool save,
+		std::string_view dirStr,
+		uint64_t blockSize,
+		const WriteOptions& wopts,
+		const Compression& clientComp,
+		const Compression& diskComp,
+		const PackOptions& popts,
+		bool indexed);
 
-	void Save(uint64_t id, const YGOPro::Replay& replay) const;
+	// Finishes writing every replay queued and closes the current pack
+	// and the index.
+	~ReplayManager();
 
+	// Queues the serialized replay to be written to disk by the writer
+	// threads, the replay itself can be discarded once this returns.
+	void Save(uint64_t id, const YGOPro::Replay& replay, const Metadata& meta);
+
+	// Replays saved from then on are written inline or dropped once
+	// `n` are queued, see QueueFullPolicy.
+	void SetMaxQueued(std::size_t n);
+
+	const Compression& ClientCompression() const;
+
+	// IDs are leased from `lastId` in blocks of `blockSize`, so that it is
+	// only read and written once every `blockSize` IDs. IDs of a block
+	// that were not handed out yet are skipped if the process stops.
 	uint64_t NewId();
 private:
+	// Everything put on the index about a replay.
+	struct Record
+	{
+		struct Duelist
+		{
+			uint8_t team;
+			uint8_t pos;
+			std::string name;
+		};
+		uint64_t id;
+		uint32_t timestamp;
+		Metadata meta;
+		std::vector<Duelist> duelists;
+	};
+
 	const bool save;
 	const boost::filesystem::path dir;
 	const boost::filesystem::path lastId;
-	std::mutex mLastId; // guarantees thread-safety
+	const uint64_t blockSize;
+	uint64_t nextId; // Next ID of the leased block.
+	uint64_t leaseEnd; // One past the last ID of the leased block.
+	std::mutex mLastId; // guarantees thread-safety, used for lease.
 	boost::interprocess::file_lock lLastId; // guarantees process-safety
+	const WriteOptions wopts;
+	const Compression clientComp;
+	const Compression diskComp;
+	const PackOptions popts;
+	std::unique_ptr<boost::asio::thread_pool> writers; // Null if not saving.
+	std::atomic<std::size_t> queued;
+	std::atomic<std::size_t> maxQueued; // Starts as wopts.maxQueued.
+	std::mutex mPack; // Writers append onto the same pack.
+	std::FILE* pack;
+	std::FILE* index;
+	uint64_t packSize;
+	std::chrono::steady_clock::time_point packOpened;
+	uint64_t packId; // ID of the first replay on the current pack.
+	std::mutex mIndex; // Writers share the connection and statements.
+	sqlite3* indexDb;
+	sqlite3_stmt* insertReplay;
+	sqlite3_stmt* insertDuelist;
+
+	// Compresses `data` with `diskComp` first if `raw`.
+	void Write(const Record& rec, const std::vector<uint8_t>& data, bool raw);
+
+	// Returns the ID of the pack the replay was added to, 0 if it wasn't.
+	uint64_t Append(uint64_t id, const std::vector<uint8_t>& data);
+	bool OpenPack(uint64_t firstId);
+	void ClosePack();
+
+	void OpenIndex();
+	// `pack` is 0 if the replay is on its own file.
+	void AddToIndex(const Record& rec, std::size_t size, uint64_t pack);
+
+	// Takes the next block of IDs from `lastId`, false if it couldn't.
+	bool Lease();
 };
 
 } // namespace Ignis::Multirole
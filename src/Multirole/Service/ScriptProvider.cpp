@@ -1,77 +1,216 @@
 #include "ScriptProvider.hpp"
 
 #include <stdexcept> // std::runtime_error
-#include <fstream>
-#include <sstream>
+#include <set>
 
+#include <boost/filesystem/operations.hpp>
+#include <fmt/format.h>
 #include <spdlog/spdlog.h>
 
+#include "Loading.hpp"
 #include "../I18N.hpp"
+#include "../Core/SharedScriptTable.hpp"
+#define PROCESS_IMPLEMENTATION
+#include "../../Process.hpp"
 
 namespace Ignis::Multirole
 {
 
+constexpr std::string_view BYTECODE_EXTENSION = ".luac";
+// Every precompiled Lua chunk starts with this.
+constexpr std::string_view LUA_SIGNATURE = "\x1bLua";
+
+// FNV-1a of the script.
+inline uint64_t HashScript(std::string_view script)
+{
+	constexpr uint64_t FNV_OFFSET_BASIS = 0xCBF29CE484222325U;
+	constexpr uint64_t FNV_PRIME = 0x100000001B3U;
+	uint64_t h = FNV_OFFSET_BASIS;
+	for(const auto c : script)
+		h = (h ^ static_cast<uint8_t>(c)) * FNV_PRIME;
+	return h;
+}
+
+
 // public
 
-Service::ScriptProvider::ScriptProvider(std::string_view fnRegexStr) :
-	fnRegex(fnRegexStr.data())
-{}
+Service::ScriptProvider::ScriptProvider(
+	std::string_view fnRegexStr,
+	std::string_view compilerStr,
+	std::string_view bytecodeDirStr) :
+	fnRegex(fnRegexStr.data()),
+	compiler(compilerStr),
+	bytecodeDir(compilerStr.empty() ? std::string() : std::string(bytecodeDirStr)),
+	scripts(std::make_shared<const FileMap>()),
+	tableVersion(0U)
+{
+	using namespace boost::filesystem;
+	if(bytecodeDir.empty())
+		return;
+	if(!exists(bytecodeDir) && !create_directories(bytecodeDir))
+		throw std::runtime_error(I18N::SCRIPT_PROVIDER_COULD_NOT_CREATE_BYTECODE_DIR);
+}
+
+Service::ScriptProvider::~ScriptProvider() = default;
 
-void Service::ScriptProvider::OnAdd(std::string_view path, const PathVector& fileList)
+void Service::ScriptProvider::OnAdd(std::string_view path, const PathVector& fileList, const BlobIdVector& ids)
 {
-	LoadScripts(path, fileList);
+	LoadScripts(path, fileList, ids);
 }
 
 void Service::ScriptProvider::OnDiff(std::string_view path, const GitDiff& diff)
 {
-	LoadScripts(path, diff.added);
+	LoadScripts(path, diff.added, diff.addedIds);
 }
 
-std::string Service::ScriptProvider::ScriptFromFilePath(std::string_view fp) const
+Service::ScriptProvider::Script Service::ScriptProvider::ScriptFromFilePath(std::string_view fp) const
 {
-	std::shared_lock lock(mScripts);
-	if(auto search = scripts.find(fp.data()); search != scripts.end())
-		return search->second;
-	return std::string();
+	const auto s = std::atomic_load(&scripts);
+	if(auto search = s->find(fp); search != s->end())
+		return Script(search->second, &search->second->script);
+	return nullptr;
+}
+
+std::string Service::ScriptProvider::SharedTableName() const
+{
+	std::scoped_lock lock(mScripts);
+	if(!sharedTable)
+		return std::string();
+	return std::string(sharedTable->Name());
 }
 
 // private
 
-void Service::ScriptProvider::LoadScripts(std::string_view path, const PathVector& fileList)
+void Service::ScriptProvider::LoadScripts(std::string_view path, const PathVector& fileList, const BlobIdVector& ids)
 {
 	int total = 0;
 	spdlog::info(I18N::SCRIPT_PROVIDER_LOADING_FILES, fileList.size());
-	std::string fullPath(path);
-	std::scoped_lock lock(mScripts);
-	for(const auto& fn : fileList)
+	// Lambda to remove all subdirectories of a given filename
+	auto FilenameFromPath = [](std::string_view str) -> std::string
 	{
-		if(!std::regex_match(fn, fnRegex))
-			continue;
-		fullPath.resize(path.size());
+		static const auto npos = std::string::npos;
+		std::size_t pos = str.rfind('/');
+		if(pos != npos || (pos = str.rfind('\\')) != npos)
+			return std::string(str.substr(pos + 1U));
+		return std::string(str);
+	};
+	std::vector<std::size_t> matched; // Positions on `fileList`.
+	{
+		const auto current = std::atomic_load(&scripts);
+		for(std::size_t i = 0U; i < fileList.size(); i++)
+		{
+			const auto& fn = fileList[i];
+			if(!std::regex_match(fn, fnRegex))
+				continue;
+			if(auto search = current->find(FilenameFromPath(fn));
+			   search != current->end() && search->second->blob == ids[i])
+				continue;
+			matched.push_back(i);
+		}
+	}
+	// Files are read and compiled without holding any lock, in parallel.
+	std::vector<FilePtr> loaded(matched.size());
+	Loading::ForEach(matched.size(), [&](std::size_t i)
+	{
+		const auto& fn = fileList[matched[i]];
+		std::string fullPath(path);
 		fullPath += fn;
-		// Open file, checking if it exists
-		std::ifstream file(fullPath, std::ifstream::binary);
-		if(!file.is_open())
+		std::string script;
+		if(!Loading::ReadFile(fullPath, script))
 		{
 			spdlog::error(I18N::SCRIPT_PROVIDER_COULD_NOT_OPEN, fullPath);
-			continue;
+			return;
 		}
-		// Lambda to remove all subdirectories of a given filename
-		auto FilenameFromPath = [](std::string_view str) -> std::string
-		{
-			static const auto npos = std::string::npos;
-			std::size_t pos = str.rfind('/');
-			if(pos != npos || (pos = str.rfind('\\')) != npos)
-				return std::string(str.substr(pos + 1U));
-			return std::string(str);
-		};
-		// Read actual file into memory and place into script map
-		std::stringstream buffer;
-		buffer << file.rdbuf();
-		scripts.insert_or_assign(FilenameFromPath(fn), buffer.str());
+		const auto hash = HashScript(script);
+		if(auto bytecode = Bytecode(fullPath, hash); !bytecode.empty())
+			script = std::move(bytecode);
+		loaded[i] = std::make_shared<const File>(File{FilenameFromPath(fn), std::move(script), hash, ids[matched[i]]});
+	});
+	std::scoped_lock lock(mScripts);
+	auto s = std::make_shared<FileMap>(*scripts);
+	for(auto& f : loaded)
+	{
+		if(!f)
+			continue;
+		// Erased first as the old key views the old file's name.
+		const std::string_view key = f->name;
+		s->erase(key);
+		s->emplace(key, std::move(f));
 		total++;
 	}
 	spdlog::info(I18N::SCRIPT_PROVIDER_TOTAL_FILES_LOADED, total);
+	std::atomic_store(&scripts, std::shared_ptr<const FileMap>(s));
+	RemoveStaleBytecode(*s);
+	try
+	{
+		const auto name = fmt::format("HornetScripts0x{:X}-{}",
+			reinterpret_cast<uintptr_t>(this), tableVersion);
+		Core::SharedScriptTable::ScriptMap views;
+		views.reserve(s->size());
+		for(const auto& kv : *s)
+			views.emplace(kv.first, kv.second->script);
+		sharedTable.reset(); // Free up the older version first.
+		sharedTable = std::make_unique<Core::SharedScriptTable>(name, tableVersion++, views);
+	}
+	catch(const std::exception& e)
+	{
+		spdlog::error(I18N::SCRIPT_PROVIDER_COULD_NOT_PUBLISH, e.what());
+	}
+}
+
+std::string Service::ScriptProvider::Bytecode(const std::string& fullPath, uint64_t hash) const
+{
+	if(bytecodeDir.empty())
+		return std::string();
+	const auto cached = bytecodeDir / fmt::format("{:016X}{}", hash, BYTECODE_EXTENSION);
+	auto IsBytecode = [](std::string_view chunk)
+	{
+		return chunk.substr(0U, LUA_SIGNATURE.size()) == LUA_SIGNATURE;
+	};
+	if(std::string chunk; Loading::ReadFile(cached.string(), chunk) && IsBytecode(chunk))
+		return chunk;
+	// NOTE: Compiled to a temporary file first so a crashing or
+	// mismatched compiler never leaves a bad chunk under the final name.
+	// The name is unique so that compiling the same script at once from
+	// several threads or instances doesn't race on it.
+	boost::system::error_code ec;
+	const auto tmp = bytecodeDir / boost::filesystem::unique_path(
+		cached.filename().string() + ".%%%%-%%%%-%%%%-%%%%.tmp", ec);
+	if(ec)
+	{
+		spdlog::warn(I18N::SCRIPT_PROVIDER_COULD_NOT_COMPILE, fullPath);
+		return std::string();
+	}
+	const auto tmpStr = tmp.string();
+	std::string chunk;
+	// NOTE: A compiler that fails might still leave a partial chunk
+	// behind, so its exit status has the final word.
+	if(!Process::Run(compiler.data(), "-o", tmpStr.data(), fullPath.data()) ||
+	   !Loading::ReadFile(tmpStr, chunk) || !IsBytecode(chunk))
+	{
+		spdlog::warn(I18N::SCRIPT_PROVIDER_COULD_NOT_COMPILE, fullPath);
+		boost::filesystem::remove(tmp, ec);
+		return std::string();
+	}
+	boost::filesystem::rename(tmp, cached, ec);
+	return chunk;
+}
+
+void Service::ScriptProvider::RemoveStaleBytecode(const FileMap& files) const
+{
+	using namespace boost::filesystem;
+	if(bytecodeDir.empty())
+		return;
+	std::set<path> inUse;
+	for(const auto& kv : files)
+		inUse.insert(bytecodeDir / fmt::format("{:016X}{}", kv.second->hash, BYTECODE_EXTENSION));
+	boost::system::error_code ec;
+	for(const auto& entry : directory_iterator(bytecodeDir, ec))
+	{
+		const auto& p = entry.path();
+		if(p.extension() == BYTECODE_EXTENSION.data() && inUse.count(p) == 0U)
+			remove(p, ec);
+	}
 }
 
 } // namespace Ignis::Multirole
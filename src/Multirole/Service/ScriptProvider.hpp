@@ -2,9 +2,12 @@
 #define SERVICE_SCRIPTPROVIDER_HPP
 #include "../Service.hpp"
 
+#include <memory>
+#include <mutex>
 #include <regex>
+#include <string_view>
 #include <unordered_map>
-#include <shared_mutex>
+#include <boost/filesystem/path.hpp>
 
 #include "../IGitRepoObserver.hpp"
 #include "../Core/IScriptSupplier.hpp"
@@ -12,23 +15,61 @@
 namespace Ignis::Multirole
 {
 
+namespace Core
+{
+
+class SharedScriptTable;
+
+} // namespace Core
+
 class Service::ScriptProvider final : public IGitRepoObserver, public Core::IScriptSupplier
 {
 public:
-	ScriptProvider(std::string_view fnRegexStr);
+	// If `compilerStr` is not empty, it names a luac matching the Lua
+	// version of the core, and scripts are served as bytecode compiled by
+	// it, kept on `bytecodeDirStr` by content hash.
+	ScriptProvider(
+		std::string_view fnRegexStr,
+		std::string_view compilerStr,
+		std::string_view bytecodeDirStr);
+	~ScriptProvider();
 
 	// IGitRepoObserver overrides
-	void OnAdd(std::string_view path, const PathVector& fileList) override;
+	void OnAdd(std::string_view path, const PathVector& fileList, const BlobIdVector& ids) override;
 	void OnDiff(std::string_view path, const GitDiff& diff) override;
 
 	// Core::IScriptSupplier overrides
-	std::string ScriptFromFilePath(std::string_view fp) const override;
+	Script ScriptFromFilePath(std::string_view fp) const override;
+	std::string SharedTableName() const override;
 private:
+	struct File
+	{
+		std::string name;
+		std::string script; // Either source or bytecode.
+		uint64_t hash; // Of the source, tells which bytecode is in use.
+		BlobId blob;
+	};
+	using FilePtr = std::shared_ptr<const File>;
+	// Keyed by views of each file's own name.
+	using FileMap = std::unordered_map<std::string_view, FilePtr>;
+
 	const std::regex fnRegex;
-	std::unordered_map<std::string, std::string> scripts;
-	mutable std::shared_mutex mScripts;
+	const std::string compiler;
+	const boost::filesystem::path bytecodeDir;
+	// Replaced as a whole on every load so that reading never locks.
+	std::shared_ptr<const FileMap> scripts;
+	uint32_t tableVersion;
+	std::unique_ptr<Core::SharedScriptTable> sharedTable;
+	mutable std::mutex mScripts; // used for loading and sharedTable.
+
+	// Files whose blob is the same as the one already loaded under their
+	// name are not read again.
+	void LoadScripts(std::string_view path, const PathVector& fileList, const BlobIdVector& ids);
 
-	void LoadScripts(std::string_view path, const PathVector& fileList);
+	// Gets the bytecode for the given script, compiling it if there is
+	// none cached yet, empty if it couldn't be compiled.
+	std::string Bytecode(const std::string& fullPath, uint64_t hash) const;
+	void RemoveStaleBytecode(const FileMap& files) const;
 };
 
 } // namespace Ignis::Multirole
@@ -1,5 +1,10 @@
 #ifndef MULTIROLE_WORKAROUND_HPP
 #define MULTIROLE_WORKAROUND_HPP
+#ifndef _WIN32
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#endif // _WIN32
 
 namespace Ignis::Multirole::Workaround
 {
@@ -8,12 +13,43 @@ namespace Ignis::Multirole::Workaround
 template<typename NativeHandle>
 inline void SetCloseOnExec([[maybe_unused]]NativeHandle handle)
 {}
+
+template<typename NativeHandle>
+inline void SetReusePort([[maybe_unused]]NativeHandle handle)
+{}
+
+template<typename NativeHandle>
+inline void SetKeepAliveTiming(
+	[[maybe_unused]]NativeHandle handle,
+	[[maybe_unused]]int idle,
+	[[maybe_unused]]int interval,
+	[[maybe_unused]]int count)
+{}
 #else
 #include <fcntl.h>
 inline void SetCloseOnExec(int fd)
 {
 	fcntl(fd, F_SETFD, fcntl(fd, F_GETFD) | FD_CLOEXEC);
 }
+
+inline void SetReusePort(int fd)
+{
+	const int enable = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable));
+}
+
+// Seconds without traffic before the first keep-alive probe, seconds
+// between probes and unanswered probes before dropping the connection.
+inline void SetKeepAliveTiming(int fd, int idle, int interval, int count)
+{
+#ifdef TCP_KEEPIDLE
+	setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+#else
+	setsockopt(fd, IPPROTO_TCP, TCP_KEEPALIVE, &idle, sizeof(idle));
+#endif // TCP_KEEPIDLE
+	setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval));
+	setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count));
+}
 #endif // _WIN32
 
 } // namespace Ignis::Multirole::Workaround
@@ -1,21 +1,32 @@
 #include "Banlist.hpp"
 
+#include <algorithm>
+
 namespace YGOPro
 {
 
-Banlist::Banlist(bool whitelist, DictType dict) :
+Banlist::Banlist(bool whitelist, const DictType& dict) :
 	whitelist(whitelist),
-	dict(std::move(dict))
-{}
+	limits(dict.begin(), dict.end())
+{
+	std::sort(limits.begin(), limits.end());
+}
 
 bool Banlist::IsWhitelist() const
 {
 	return whitelist;
 }
 
-const Banlist::DictType& Banlist::Dict() const
+const int32_t* Banlist::Limit(uint32_t code) const
 {
-	return dict;
+	auto it = std::lower_bound(limits.begin(), limits.end(), code,
+	[](const auto& l, uint32_t c)
+	{
+		return l.first < c;
+	});
+	if(it == limits.end() || it->first != code)
+		return nullptr;
+	return &it->second;
 }
 
 } // namespace YGOPro
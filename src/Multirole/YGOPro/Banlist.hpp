@@ -3,6 +3,8 @@
 #include <cstdint>
 #include <memory>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 namespace YGOPro
 {
@@ -12,13 +14,17 @@ class Banlist final
 public:
 	using DictType = std::unordered_map<uint32_t /*code*/, int32_t /*count*/>;
 
-	Banlist(bool whitelist, DictType dict);
+	// Freezes the dictionary into a flat table sorted by code.
+	Banlist(bool whitelist, const DictType& dict);
 
 	bool IsWhitelist() const;
-	const DictType& Dict() const;
+
+	// Gets how many copies of the card are allowed or null if the card
+	// is not listed.
+	const int32_t* Limit(uint32_t code) const;
 private:
 	const bool whitelist;
-	DictType dict;
+	std::vector<std::pair<uint32_t /*code*/, int32_t /*count*/>> limits;
 };
 
 using BanlistPtr = std::shared_ptr<Banlist>;
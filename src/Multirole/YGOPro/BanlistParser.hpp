@@ -49,7 +49,7 @@ void ParseForBanlists(Stream& stream, BanlistMap& banlists)
 	{
 		if(hash == Detail::BANLIST_HASH_MAGIC)
 			return;
-		auto banlist = std::make_shared<Banlist>(whitelist, std::move(dict));
+		auto banlist = std::make_shared<Banlist>(whitelist, dict);
 		banlists.emplace(std::piecewise_construct,
 			std::forward_as_tuple(hash),
 			std::forward_as_tuple(std::move(banlist))
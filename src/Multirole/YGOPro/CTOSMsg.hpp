@@ -36,6 +36,7 @@ public:
 		TRY_KICK      = 0x24,
 		TRY_START     = 0x25,
 		REMATCH       = 0xF0,
+		RELAY_SUBSCRIBE = 0xF1,
 	};
 
 	struct RPSChoice
@@ -79,6 +80,14 @@ public:
 		uint8_t answer;
 	};
 
+	// Sent by a relay instead of JOIN_GAME to spectate a room on behalf of
+	// its own spectators, see Endpoint::SpectatorRelay.
+	struct RelaySubscribe
+	{
+		uint32_t id;
+		char token[64U];
+	};
+
 	inline LengthType GetLength() const
 	{
 		LengthType v{};
@@ -95,7 +104,7 @@ public:
 
 	inline bool IsHeaderValid() const
 	{
-		if(GetLength() > MSG_MAX_LENGTH)
+		if(GetLength() < 0 || GetLength() > MSG_MAX_LENGTH)
 			return false;
 		switch(GetType())
 		{
@@ -117,6 +126,7 @@ public:
 		case MsgType::TRY_KICK:
 		case MsgType::TRY_START:
 		case MsgType::REMATCH:
+		case MsgType::RELAY_SUBSCRIBE:
 			return true;
 		default:
 			return false;
@@ -140,6 +150,7 @@ public:
 	X(JoinGame)
 	X(TryKick)
 	X(Rematch)
+	X(RelaySubscribe)
 #undef X
 
 	constexpr const uint8_t* Body() const
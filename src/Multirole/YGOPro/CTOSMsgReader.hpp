@@ -0,0 +1,73 @@
+#ifndef YGOPRO_CTOSMSGREADER_HPP
+#define YGOPRO_CTOSMSGREADER_HPP
+#include <array>
+#include <cassert>
+#include <cstring>
+#include <utility>
+
+#include "CTOSMsg.hpp"
+
+namespace YGOPro
+{
+
+// Accumulates bytes read from a connection and splits them into CTOS
+// messages, so that as many messages as are available can be taken with a
+// single read instead of reading the header and body of each separately.
+class CTOSMsgReader
+{
+public:
+	enum class Result
+	{
+		INCOMPLETE, // More bytes are needed to complete the next message.
+		READY,      // The next message was extracted.
+		INVALID,    // The next message has an invalid header.
+	};
+
+	// Area where the next bytes should be read onto, never empty as long
+	// as every complete message was extracted beforehand.
+	std::pair<uint8_t*, std::size_t> WritableArea()
+	{
+		if(first != 0U)
+		{
+			// Move what is left of an incomplete message to the front.
+			std::memmove(bytes.data(), bytes.data() + first, last - first);
+			last -= first;
+			first = 0U;
+		}
+		assert(last < bytes.size());
+		return {bytes.data() + last, bytes.size() - last};
+	}
+
+	// Marks `count` bytes as read onto the writable area.
+	void Commit(std::size_t count)
+	{
+		last += count;
+	}
+
+	// Extracts the next complete message onto `msg`, if there is one.
+	// Messages are validated with CTOSMsg::IsHeaderValid.
+	Result Next(CTOSMsg& msg)
+	{
+		const std::size_t available = last - first;
+		if(available < CTOSMsg::HEADER_LENGTH)
+			return Result::INCOMPLETE;
+		std::memcpy(msg.Data(), bytes.data() + first, CTOSMsg::HEADER_LENGTH);
+		if(!msg.IsHeaderValid())
+			return Result::INVALID;
+		const auto length = static_cast<std::size_t>(msg.GetLength());
+		if(available < CTOSMsg::HEADER_LENGTH + length)
+			return Result::INCOMPLETE;
+		std::memcpy(msg.Body(), bytes.data() + first + CTOSMsg::HEADER_LENGTH, length);
+		first += CTOSMsg::HEADER_LENGTH + length;
+		return Result::READY;
+	}
+private:
+	// Fits a few messages of maximum length at once.
+	std::array<uint8_t, 4U * (CTOSMsg::HEADER_LENGTH + CTOSMsg::MSG_MAX_LENGTH)> bytes;
+	std::size_t first{}; // Start of the bytes not extracted yet.
+	std::size_t last{}; // End of the bytes read.
+};
+
+} // namespace YGOPro
+
+#endif // YGOPRO_CTOSMSGREADER_HPP
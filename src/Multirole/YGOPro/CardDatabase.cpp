@@ -1,12 +1,22 @@
 #include "CardDatabase.hpp"
 
+#include <algorithm>
+#include <atomic>
 #include <cstring>
 #include <stdexcept> // std::runtime_error
 #include <string>
+#include <vector>
 
+#include <boost/filesystem/fstream.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <fmt/format.h>
 #include <sqlite3.h>
 
 #include "Constants.hpp"
+#include "LegalityTable.hpp"
+#include "../Core/SharedCardTable.hpp"
 
 namespace YGOPro
 {
@@ -61,27 +71,36 @@ R"(
 INSERT OR REPLACE INTO datas SELECT * FROM toMerge.datas;
 )";
 
-static constexpr const char* MERGE_TEXTS_STMT =
-R"(
-INSERT OR REPLACE INTO texts SELECT * FROM toMerge.texts;
-)";
-
 static constexpr const char* DETACH_STMT =
 R"(
 DETACH toMerge;
 )";
 
-static constexpr const char* SEARCH_STMT =
+static constexpr const char* ALL_CARDS_STMT =
 R"(
-SELECT id,alias,setcode,type,atk,def,level,race,attribute
-FROM datas WHERE datas.id = ?;
+SELECT id,alias,setcode,type,atk,def,level,race,attribute,ot,category
+FROM datas ORDER BY id;
 )";
 
-static constexpr const char* SEARCH2_STMT =
-R"(
-SELECT ot,category
-FROM datas WHERE datas.id = ?;
-)";
+// Returned for codes that aren't on the table.
+static constexpr uint16_t NO_SETCODES = 0U;
+
+// Snapshot layout: SnapshotHeader, `count` entries sorted by card code, as
+// laid out in memory but with the index of their setcodes in place of the
+// pointer, and then `setcodesCount` setcodes. Entries are fixed up in
+// place on a private mapping of the file.
+struct SnapshotHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t sourceHash;
+	uint32_t entrySize; // Guards against snapshots from other builds.
+	uint32_t count;
+	uint64_t setcodesCount;
+};
+
+static constexpr uint32_t SNAPSHOT_MAGIC = 0x4E534443U; // "CDSN"
+static constexpr uint32_t SNAPSHOT_VERSION = 1U;
 
 CardDatabase::CardDatabase() : CardDatabase(":memory:")
 {}
@@ -107,29 +126,85 @@ CardDatabase::CardDatabase(std::string_view absFilePath)
 		sqlite3_close(db);
 		throw std::runtime_error(errStr);
 	}
-	// Prepare card data search by id statement
-	if(sqlite3_prepare_v2(db, SEARCH_STMT, -1, &sStmt, nullptr) != SQLITE_OK)
+}
+
+CardDatabase::CardDatabase(std::vector<std::shared_ptr<const CardDatabase>> layers) :
+	layers(std::move(layers))
+{
+	std::vector<Entry> merged;
+	for(const auto& layer : this->layers)
 	{
-		std::string errStr(sqlite3_errmsg(db));
-		sqlite3_finalize(aStmt);
-		sqlite3_close(db);
-		throw std::runtime_error(errStr);
+		if(cards.empty())
+		{
+			cards.assign(layer->first, layer->last);
+			continue;
+		}
+		// Both are sorted, so a single pass merges them.
+		merged.clear();
+		merged.reserve(cards.size() + static_cast<std::size_t>(layer->last - layer->first));
+		auto it1 = cards.cbegin();
+		const auto* it2 = layer->first;
+		while(it1 != cards.cend() && it2 != layer->last)
+		{
+			if(it1->data.code < it2->data.code)
+			{
+				merged.push_back(*it1++);
+				continue;
+			}
+			if(it1->data.code == it2->data.code)
+				++it1; // Replaced by the one on the layer.
+			merged.push_back(*it2++);
+		}
+		merged.insert(merged.end(), it1, cards.cend());
+		merged.insert(merged.end(), it2, layer->last);
+		cards.swap(merged);
 	}
-	// Prepare extra data search by id statement
-	if(sqlite3_prepare_v2(db, SEARCH2_STMT, -1, &s2Stmt, nullptr) != SQLITE_OK)
+	first = cards.data();
+	last = first + cards.size();
+}
+
+std::shared_ptr<const CardDatabase> CardDatabase::MapSnapshot(
+	std::string_view absFilePath,
+	uint64_t sourceHash)
+{
+	namespace ipc = boost::interprocess;
+	const ipc::file_mapping file(absFilePath.data(), ipc::read_only);
+	auto region = std::make_unique<ipc::mapped_region>(file, ipc::copy_on_write);
+	const auto size = region->get_size();
+	auto* base = static_cast<uint8_t*>(region->get_address());
+	SnapshotHeader header{};
+	if(size < sizeof(header))
+		throw std::runtime_error("Snapshot is truncated");
+	std::memcpy(&header, base, sizeof(header));
+	if(header.magic != SNAPSHOT_MAGIC || header.version != SNAPSHOT_VERSION ||
+	   header.entrySize != sizeof(Entry))
+		throw std::runtime_error("Snapshot has an unknown format");
+	if(header.sourceHash != sourceHash)
+		throw std::runtime_error("Snapshot is out of date");
+	const auto entriesSize = sizeof(Entry) * header.count;
+	if(size != sizeof(header) + entriesSize + sizeof(uint16_t) * header.setcodesCount)
+		throw std::runtime_error("Snapshot is truncated");
+	auto* entries = reinterpret_cast<Entry*>(base + sizeof(header));
+	auto* sc = reinterpret_cast<uint16_t*>(base + sizeof(header) + entriesSize);
+	for(auto* e = entries; e != entries + header.count; e++)
 	{
-		std::string errStr(sqlite3_errmsg(db));
-		sqlite3_finalize(sStmt);
-		sqlite3_finalize(aStmt);
-		sqlite3_close(db);
-		throw std::runtime_error(errStr);
+		const auto index = reinterpret_cast<uintptr_t>(e->data.setcodes);
+		if(index >= header.setcodesCount)
+			throw std::runtime_error("Snapshot is corrupted");
+		e->data.setcodes = sc + index;
 	}
+	std::shared_ptr<CardDatabase> cdb(new CardDatabase(std::move(region)));
+	cdb->first = entries;
+	cdb->last = entries + header.count;
+	return cdb;
 }
 
+CardDatabase::CardDatabase(std::unique_ptr<boost::interprocess::mapped_region> mapping) :
+	mapping(std::move(mapping))
+{}
+
 CardDatabase::~CardDatabase()
 {
-	sqlite3_finalize(s2Stmt);
-	sqlite3_finalize(sStmt);
 	sqlite3_finalize(aStmt);
 	sqlite3_close(db);
 }
@@ -140,70 +215,228 @@ bool CardDatabase::Merge(std::string_view absFilePath)
 	sqlite3_bind_text(aStmt, 1, absFilePath.data(), -1, SQLITE_TRANSIENT);
 	if(sqlite3_step(aStmt) != SQLITE_DONE)
 		return false;
+	// NOTE: Texts are never read, so they aren't merged.
 	sqlite3_exec(db, MERGE_DATAS_STMT, nullptr, nullptr, nullptr);
-	sqlite3_exec(db, MERGE_TEXTS_STMT, nullptr, nullptr, nullptr);
 	sqlite3_exec(db, DETACH_STMT, nullptr, nullptr, nullptr);
 	return true;
 }
 
-const OCG_CardData& CardDatabase::DataFromCode(uint32_t code) const
+void CardDatabase::Seal()
 {
-	std::scoped_lock lock(mDataCache);
-	if(auto search = dataCache.find(code); search != dataCache.end())
-		return search->second;
-	auto AllocSetcodes = [&](uint64_t dbVal) -> uint16_t*
+	static constexpr std::size_t SETCODES = 4U;
+	sqlite3_stmt* stmt = nullptr;
+	if(sqlite3_prepare_v2(db, ALL_CARDS_STMT, -1, &stmt, nullptr) != SQLITE_OK)
+		throw std::runtime_error(sqlite3_errmsg(db));
+	cards.clear();
+	setcodes.clear();
+	// Entries keep the position of their setcodes until all are read, as
+	// the vector might move them around while growing.
+	std::vector<std::size_t> setcodesIndices;
+	while(sqlite3_step(stmt) == SQLITE_ROW)
 	{
-		static constexpr std::size_t SETCODES = 4U;
-		auto p = decltype(scCache)::value_type(code, std::make_unique<uint16_t[]>(SETCODES + 1U));
-		auto& setcodes = scCache.emplace(std::move(p)).first->second;
+		auto& e = cards.emplace_back();
+		auto& cd = e.data;
+		cd.code = sqlite3_column_int(stmt, 0);
+		cd.alias = sqlite3_column_int(stmt, 1);
+		setcodesIndices.push_back(setcodes.size());
+		const auto dbSetcodes = static_cast<uint64_t>(sqlite3_column_int64(stmt, 2));
 		for(std::size_t i = 0U; i < SETCODES; i++)
-			setcodes[i] = (dbVal >> (i * 16U)) & 0xFFFF;
-		setcodes[SETCODES] = 0U;
-		return setcodes.get();
-	};
-	OCG_CardData& cd = dataCache[code]; // implicit insertion
-	sqlite3_reset(sStmt);
-	sqlite3_bind_int(sStmt, 1, code);
-	if(sqlite3_step(sStmt) == SQLITE_ROW)
-	{
-		cd.code = sqlite3_column_int(sStmt, 0);
-		cd.alias = sqlite3_column_int(sStmt, 1);
-		cd.setcodes = AllocSetcodes(sqlite3_column_int64(sStmt, 2));
-		cd.type = sqlite3_column_int(sStmt, 3);
-		cd.attack = sqlite3_column_int(sStmt, 4);
-		cd.defense = sqlite3_column_int(sStmt, 5);
+			if(const uint16_t sc = (dbSetcodes >> (i * 16U)) & 0xFFFF; sc != 0U)
+				setcodes.push_back(sc);
+		setcodes.push_back(0U);
+		cd.type = sqlite3_column_int(stmt, 3);
+		cd.attack = sqlite3_column_int(stmt, 4);
+		cd.defense = sqlite3_column_int(stmt, 5);
 		cd.link_marker = (cd.type & TYPE_LINK) != 0U ? cd.defense : 0;
 		cd.defense = (cd.type & TYPE_LINK) != 0U ? 0 : cd.defense;
-		const auto dbLevel = sqlite3_column_int(sStmt, 6);
+		const auto dbLevel = sqlite3_column_int(stmt, 6);
 		cd.level = dbLevel & 0x800000FF;
 		cd.lscale = (dbLevel >> 24U) & 0xFF;
 		cd.rscale = (dbLevel >> 16U) & 0xFF;
-		cd.race = sqlite3_column_int(sStmt, 7);
-		cd.attribute = sqlite3_column_int(sStmt, 8);
+		cd.race = sqlite3_column_int(stmt, 7);
+		cd.attribute = sqlite3_column_int(stmt, 8);
+		e.extra.scope = sqlite3_column_int(stmt, 9);
+		e.extra.category = sqlite3_column_int(stmt, 10);
 	}
-	return cd;
+	sqlite3_finalize(stmt);
+	for(std::size_t i = 0U; i < cards.size(); i++)
+		cards[i].data.setcodes = &setcodes[setcodesIndices[i]];
+	first = cards.data();
+	last = first + cards.size();
+}
+
+void CardDatabase::WriteSnapshot(std::string_view absFilePath, uint64_t sourceHash) const
+{
+	// Setcodes are written again for each card, as the table might come
+	// from several layers.
+	std::vector<Entry> entries(first, last);
+	std::vector<uint16_t> sc;
+	for(auto& e : entries)
+	{
+		const auto index = static_cast<uintptr_t>(sc.size());
+		for(const uint16_t* p = e.data.setcodes; *p != 0U; p++)
+			sc.push_back(*p);
+		sc.push_back(0U);
+		e.data.setcodes = reinterpret_cast<uint16_t*>(index);
+	}
+	const SnapshotHeader header
+	{
+		SNAPSHOT_MAGIC,
+		SNAPSHOT_VERSION,
+		sourceHash,
+		static_cast<uint32_t>(sizeof(Entry)),
+		static_cast<uint32_t>(entries.size()),
+		static_cast<uint64_t>(sc.size())
+	};
+	// Written aside and then moved over, so that a partially written
+	// snapshot is never mapped.
+	const boost::filesystem::path path(absFilePath.data());
+	auto tmpPath = path;
+	tmpPath += ".tmp";
+	{
+		boost::filesystem::ofstream f(tmpPath, std::ios_base::binary | std::ios_base::trunc);
+		f.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		f.write(reinterpret_cast<const char*>(entries.data()),
+			static_cast<std::streamsize>(sizeof(Entry) * entries.size()));
+		f.write(reinterpret_cast<const char*>(sc.data()),
+			static_cast<std::streamsize>(sizeof(uint16_t) * sc.size()));
+		if(!f)
+			throw std::runtime_error("Could not write snapshot");
+	}
+	boost::filesystem::rename(tmpPath, path);
+}
+
+void CardDatabase::PublishSharedTable()
+{
+	static std::atomic<uint32_t> tableCount{0U};
+	std::vector<OCG_CardData> data;
+	data.reserve(static_cast<std::size_t>(last - first));
+	for(const auto* e = first; e != last; e++)
+		data.push_back(e->data);
+	const auto name = fmt::format("HornetCards0x{:X}-{}",
+		reinterpret_cast<uintptr_t>(this), tableCount++);
+	sharedTable = std::make_unique<Ignis::Multirole::Core::SharedCardTable>(name, std::move(data));
+}
+
+const OCG_CardData& CardDatabase::DataFromCode(uint32_t code) const
+{
+	return Find(code).data;
 }
 
 void CardDatabase::DataUsageDone([[maybe_unused]] const OCG_CardData& data) const
 {
-	// We could remove the elements here, but then what would be the
-	// the point of the cache?
+	// Nothing to do, the table outlives every lookup.
+}
+
+std::string_view CardDatabase::SharedTableName() const
+{
+	if(!sharedTable)
+		return {};
+	return sharedTable->Name();
+}
+
+const CardExtraData& CardDatabase::ExtraFromCode(uint32_t code) const
+{
+	return Find(code).extra;
 }
 
-const CardExtraData& CardDatabase::ExtraFromCode(uint32_t code)
+std::size_t CardDatabase::Size() const
 {
-	std::scoped_lock lock(mExtraCache);
-	if(auto search = extraCache.find(code); search != extraCache.end())
-		return search->second;
-	CardExtraData& ced = extraCache[code]; // implicit insertion
-	sqlite3_reset(s2Stmt);
-	sqlite3_bind_int(s2Stmt, 1, code);
-	if(sqlite3_step(s2Stmt) == SQLITE_ROW)
+	return static_cast<std::size_t>(last - first);
+}
+
+std::size_t CardDatabase::IndexOf(uint32_t code) const
+{
+	const auto* it = std::lower_bound(first, last, code,
+	[](const Entry& e, uint32_t c)
 	{
-		ced.scope = sqlite3_column_int(s2Stmt, 0);
-		ced.category = sqlite3_column_int(s2Stmt, 1);
+		return e.data.code < c;
+	});
+	if(it == last || it->data.code != code)
+		return Size();
+	return static_cast<std::size_t>(it - first);
+}
+
+void CardDatabase::IndicesOf(const uint32_t* codes, std::size_t count, std::size_t* out) const
+{
+	const auto* it = first;
+	for(std::size_t i = 0U; i < count; i++)
+	{
+		it = std::lower_bound(it, last, codes[i],
+		[](const Entry& e, uint32_t c)
+		{
+			return e.data.code < c;
+		});
+		out[i] = (it == last || it->data.code != codes[i]) ? Size() : static_cast<std::size_t>(it - first);
 	}
-	return ced;
+}
+
+std::vector<CardSummary> CardDatabase::Summarize(const std::vector<uint32_t>& codes) const
+{
+	// Codes sorted along with where they go on the result.
+	std::vector<std::pair<uint32_t, std::size_t>> sorted;
+	sorted.reserve(codes.size());
+	for(std::size_t i = 0U; i < codes.size(); i++)
+		sorted.emplace_back(codes[i], i);
+	std::sort(sorted.begin(), sorted.end());
+	std::vector<CardSummary> summaries(codes.size(), CardSummary{});
+	const auto* it = first;
+	for(const auto& [code, pos] : sorted)
+	{
+		it = std::lower_bound(it, last, code,
+		[](const Entry& e, uint32_t c)
+		{
+			return e.data.code < c;
+		});
+		if(it == last || it->data.code != code)
+			continue;
+		summaries[pos] = {code, it->data.alias, it->data.type};
+	}
+	return summaries;
+}
+
+const OCG_CardData& CardDatabase::DataAt(std::size_t index) const
+{
+	return first[index].data;
+}
+
+const CardExtraData& CardDatabase::ExtraAt(std::size_t index) const
+{
+	return first[index].extra;
+}
+
+std::shared_ptr<const LegalityTable> CardDatabase::Legality(
+	const BanlistPtr& banlist,
+	uint8_t allowed,
+	int32_t forb) const
+{
+	std::scoped_lock lock(mLegalities);
+	legalities.erase(std::remove_if(legalities.begin(), legalities.end(), [](const auto& kv)
+	{
+		return kv.first.banlistPtr != nullptr && kv.first.banlist.expired();
+	}), legalities.end());
+	for(const auto& [key, table] : legalities)
+		if(key.banlistPtr == banlist.get() && key.allowed == allowed && key.forb == forb)
+			return table;
+	auto table = std::make_shared<const LegalityTable>(*this, banlist.get(), allowed, forb);
+	legalities.emplace_back(LegalityKey{banlist, banlist.get(), allowed, forb}, table);
+	return table;
+}
+
+// private
+
+const CardDatabase::Entry& CardDatabase::Find(uint32_t code) const
+{
+	static const Entry NOT_FOUND = []()
+	{
+		Entry e{};
+		e.data.setcodes = const_cast<uint16_t*>(&NO_SETCODES);
+		return e;
+	}();
+	const auto index = IndexOf(code);
+	if(index == Size())
+		return NOT_FOUND;
+	return first[index];
 }
 
 } // namespace YGOPro
@@ -3,10 +3,26 @@
 #include <string_view>
 #include <memory>
 #include <mutex>
-#include <unordered_map>
+#include <vector>
+
+#include "Banlist.hpp"
 
 #include "../Core/IDataSupplier.hpp"
 
+namespace Ignis::Multirole::Core
+{
+
+class SharedCardTable;
+
+} // namespace Ignis::Multirole::Core
+
+namespace boost::interprocess
+{
+
+class mapped_region;
+
+} // namespace boost::interprocess
+
 struct sqlite3;
 struct sqlite3_stmt;
 
@@ -19,6 +35,16 @@ struct CardExtraData
 	uint32_t category;
 };
 
+// What decks need to know about each of their cards.
+struct CardSummary
+{
+	uint32_t code; // Zero if the card isn't on the database.
+	uint32_t alias;
+	uint32_t type;
+};
+
+class LegalityTable;
+
 class CardDatabase final : public Ignis::Multirole::Core::IDataSupplier
 {
 public:
@@ -31,27 +57,99 @@ public:
 	// Opens or creates a disk database
 	CardDatabase(std::string_view absFilePath);
 
+	// Makes a sealed database out of other sealed ones, which are kept
+	// alive and shared rather than copied. If a code is on several layers
+	// the last one takes precedence. Nothing can be merged into it.
+	CardDatabase(std::vector<std::shared_ptr<const CardDatabase>> layers);
+
+	// Maps a snapshot written by WriteSnapshot as a sealed database,
+	// throws if it can't be read or wasn't made out of a database whose
+	// contents hash to `sourceHash`.
+	static std::shared_ptr<const CardDatabase> MapSnapshot(
+		std::string_view absFilePath,
+		uint64_t sourceHash);
+
 	// Add a new database to the amalgamation
 	bool Merge(std::string_view absFilePath);
 
+	// Reads every merged card into an immutable table which is used for
+	// all lookups from then on, so that they don't need any locking or
+	// database access. Cards merged afterwards are not seen unless this
+	// is called again, which must not happen while lookups are running.
+	void Seal();
+
+	// Writes the sealed cards to a file that MapSnapshot can map, tagged
+	// with the hash of the database they came from. Throws on failure.
+	void WriteSnapshot(std::string_view absFilePath, uint64_t sourceHash) const;
+
+	// Copies all cards into a read-only shared memory table that hornet
+	// processes can map. Meant to be called once sealed.
+	void PublishSharedTable();
+
 	// Core::IDataSupplier overrides
 	const OCG_CardData& DataFromCode(uint32_t code) const override;
 	void DataUsageDone(const OCG_CardData& data) const override;
+	std::string_view SharedTableName() const override;
 
 	// Query extra data
-	const CardExtraData& ExtraFromCode(uint32_t code);
+	const CardExtraData& ExtraFromCode(uint32_t code) const;
+
+	// Cards by their dense index, which goes from 0 to Size() - 1 in code
+	// order. IndexOf gives Size() for codes that aren't on the table.
+	std::size_t Size() const;
+	std::size_t IndexOf(uint32_t code) const;
+	const OCG_CardData& DataAt(std::size_t index) const;
+	const CardExtraData& ExtraAt(std::size_t index) const;
+
+	// Finds the index of each of `count` sorted codes in a single pass,
+	// each search starting where the last one ended.
+	void IndicesOf(const uint32_t* codes, std::size_t count, std::size_t* out) const;
+
+	// Summarizes every given card at once, in the same order.
+	std::vector<CardSummary> Summarize(const std::vector<uint32_t>& codes) const;
+
+	// Gets the legality of every card under the given banlist and host
+	// options, made the first time they are asked for and shared after.
+	std::shared_ptr<const LegalityTable> Legality(
+		const BanlistPtr& banlist,
+		uint8_t allowed,
+		int32_t forb) const;
 private:
+	struct Entry
+	{
+		OCG_CardData data; // Setcodes point into `setcodes`.
+		CardExtraData extra;
+	};
+
 	sqlite3* db{};
 	sqlite3_stmt* aStmt{};
-	sqlite3_stmt* sStmt{};
-	sqlite3_stmt* s2Stmt{};
 
-	mutable std::unordered_map<uint32_t, OCG_CardData> dataCache;
-	mutable std::unordered_map<uint32_t, std::unique_ptr<uint16_t[]>> scCache;
-	mutable std::mutex mDataCache;
+	std::unique_ptr<Ignis::Multirole::Core::SharedCardTable> sharedTable;
+
+	std::vector<Entry> cards; // Sorted by code.
+	std::vector<uint16_t> setcodes; // Zero-terminated lists of each card.
+	// Databases this one is made of, setcodes of their cards point there.
+	std::vector<std::shared_ptr<const CardDatabase>> layers;
+	// Snapshot holding the cards and setcodes instead of the vectors.
+	std::unique_ptr<boost::interprocess::mapped_region> mapping;
+	// Table used for lookups, either `cards` or within `mapping`.
+	const Entry* first{};
+	const Entry* last{};
+
+	struct LegalityKey
+	{
+		std::weak_ptr<const Banlist> banlist; // Entry is dropped once gone.
+		const Banlist* banlistPtr;
+		uint8_t allowed;
+		int32_t forb;
+	};
+	mutable std::vector<std::pair<LegalityKey, std::shared_ptr<const LegalityTable>>> legalities;
+	mutable std::mutex mLegalities;
+
+	CardDatabase(std::unique_ptr<boost::interprocess::mapped_region> mapping);
 
-	mutable std::unordered_map<uint32_t, CardExtraData> extraCache;
-	mutable std::mutex mExtraCache;
+	// Gets the entry matching the code or a zeroed one if there's none.
+	const Entry& Find(uint32_t code) const;
 };
 
 } // namespace YGOPro
@@ -1,7 +1,10 @@
 #include "CoreUtils.hpp"
 
+#include <algorithm> // std::min
+#include <array>
 #include <cstring> // std::memcpy
 #include <stdexcept> // std::out_of_range
+#include <utility> // std::pair
 
 #include "Constants.hpp"
 
@@ -23,30 +26,297 @@ constexpr LocInfo Read(const uint8_t*& ptr)
 	};
 }
 
-/*** Query utility functions ***/
+/*** Message descriptors ***/
+
+// How the codes to strip off a message are laid out, see ForEachHiddenCode.
+enum class StripLayout : uint8_t
+{
+	NONE,
+	SET,
+	SHUFFLE, // MSG_SHUFFLE_HAND and MSG_SHUFFLE_EXTRA.
+	MOVE,
+	DRAW,
+	TAG_SWAP,
+	SELECT_CARD,
+	SELECT_TRIBUTE,
+	SELECT_UNSELECT_CARD,
+};
+
+// Location queried for both players at once, see REFRESH_QUERIES.
+enum class Refresh : uint8_t
+{
+	NONE,
+	DECKS,
+	EXTRAS,
+	HANDS,
+	MZONES,
+	SZONES,
+};
+
+// Queries that depend on the contents of a message, see AddRecipeQueries.
+enum class QueryRecipe : uint8_t
+{
+	NONE,
+	FLIPSUMMONING,
+	PLAYER_HAND, // Of the player on the first byte.
+	PLAYER_EXTRA,
+	PLAYER_GRAVE,
+	SHUFFLE_SET_CARD,
+	MOVE,
+	POS_CHANGE,
+	SWAP,
+	TAG_SWAP,
+};
 
-inline void AddRefreshAllDecks(std::vector<QueryRequest>& qreqs)
+// Whether the distribution of a message depends on its contents.
+enum class DistRule : uint8_t
 {
-	qreqs.emplace_back(QueryLocationRequest{0U, LOCATION_DECK, 0x1181FFF});
-	qreqs.emplace_back(QueryLocationRequest{1U, LOCATION_DECK, 0x1181FFF});
+	FIXED,
+	HINT,
+	CONFIRM_CARDS,
+};
+
+struct QueryPlan
+{
+	QueryRecipe recipe;
+	std::array<Refresh, 4U> refreshes; // Done after the recipe, in order.
+};
+
+// Everything that can be told about a message by its type alone.
+struct MsgDescriptor
+{
+	MsgDistType dist = MsgDistType::MSG_DIST_TYPE_EVERYONE; // Unless distRule says otherwise.
+	DistRule distRule = DistRule::FIXED;
+	bool requiresAnswer = false;
+	uint8_t teamOffset = 1U; // Byte holding the receiving team.
+	StripLayout strip = StripLayout::NONE;
+	QueryPlan preDist{};
+	QueryPlan postDist{};
+};
+
+constexpr std::array<MsgDescriptor, 256U> MakeMsgDescriptors()
+{
+	using DT = MsgDistType;
+	std::array<MsgDescriptor, 256U> t{};
+	for(const uint8_t type : {
+		MSG_SELECT_BATTLECMD, MSG_SELECT_IDLECMD, MSG_SELECT_EFFECTYN,
+		MSG_SELECT_YESNO, MSG_SELECT_OPTION, MSG_SELECT_CHAIN,
+		MSG_SELECT_PLACE, MSG_SELECT_DISFIELD, MSG_SELECT_POSITION,
+		MSG_SORT_CARD, MSG_SORT_CHAIN, MSG_SELECT_COUNTER, MSG_SELECT_SUM,
+		MSG_ROCK_PAPER_SCISSORS, MSG_ANNOUNCE_RACE, MSG_ANNOUNCE_ATTRIB,
+		MSG_ANNOUNCE_CARD, MSG_ANNOUNCE_NUMBER, MSG_ANNOUNCE_CARD_FILTER})
+	{
+		t[type].dist = DT::MSG_DIST_TYPE_SPECIFIC_TEAM_DUELIST;
+		t[type].requiresAnswer = true;
+	}
+	auto StrippedAnswer = [&t](uint8_t type, StripLayout strip)
+	{
+		t[type].dist = DT::MSG_DIST_TYPE_SPECIFIC_TEAM_DUELIST_STRIPPED;
+		t[type].requiresAnswer = true;
+		t[type].strip = strip;
+	};
+	StrippedAnswer(MSG_SELECT_CARD, StripLayout::SELECT_CARD);
+	StrippedAnswer(MSG_SELECT_TRIBUTE, StripLayout::SELECT_TRIBUTE);
+	StrippedAnswer(MSG_SELECT_UNSELECT_CARD, StripLayout::SELECT_UNSELECT_CARD);
+	auto Stripped = [&t](uint8_t type, StripLayout strip)
+	{
+		t[type].dist = DT::MSG_DIST_TYPE_EVERYONE_STRIPPED;
+		t[type].strip = strip;
+	};
+	Stripped(MSG_SHUFFLE_HAND, StripLayout::SHUFFLE);
+	Stripped(MSG_SHUFFLE_EXTRA, StripLayout::SHUFFLE);
+	Stripped(MSG_SET, StripLayout::SET);
+	Stripped(MSG_MOVE, StripLayout::MOVE);
+	Stripped(MSG_DRAW, StripLayout::DRAW);
+	Stripped(MSG_TAG_SWAP, StripLayout::TAG_SWAP);
+	t[MSG_MISSED_EFFECT].dist = DT::MSG_DIST_TYPE_SPECIFIC_TEAM_DUELIST;
+	t[MSG_HINT].distRule = DistRule::HINT;
+	t[MSG_HINT].teamOffset = 2U;
+	t[MSG_CONFIRM_CARDS].distRule = DistRule::CONFIRM_CARDS;
+	// Queries done before distributing.
+	using R = Refresh;
+	t[MSG_SELECT_BATTLECMD].preDist = {QueryRecipe::NONE, {R::HANDS, R::MZONES, R::SZONES}};
+	t[MSG_SELECT_IDLECMD].preDist = {QueryRecipe::NONE, {R::HANDS, R::MZONES, R::SZONES}};
+	t[MSG_SELECT_CHAIN].preDist = {QueryRecipe::NONE, {R::MZONES, R::SZONES}};
+	t[MSG_NEW_TURN].preDist = {QueryRecipe::NONE, {R::MZONES, R::SZONES}};
+	t[MSG_FLIPSUMMONING].preDist = {QueryRecipe::FLIPSUMMONING, {}};
+	// Queries done after distributing.
+	t[MSG_SHUFFLE_HAND].postDist = {QueryRecipe::PLAYER_HAND, {}};
+	t[MSG_DRAW].postDist = {QueryRecipe::PLAYER_HAND, {}};
+	t[MSG_SHUFFLE_EXTRA].postDist = {QueryRecipe::PLAYER_EXTRA, {}};
+	t[MSG_SWAP_GRAVE_DECK].postDist = {QueryRecipe::PLAYER_GRAVE, {}};
+	t[MSG_REVERSE_DECK].postDist = {QueryRecipe::NONE, {R::DECKS}};
+	t[MSG_SHUFFLE_SET_CARD].postDist = {QueryRecipe::SHUFFLE_SET_CARD, {}};
+	t[MSG_DAMAGE_STEP_START].postDist = {QueryRecipe::NONE, {R::MZONES}};
+	t[MSG_DAMAGE_STEP_END].postDist = {QueryRecipe::NONE, {R::MZONES}};
+	t[MSG_SUMMONED].postDist = {QueryRecipe::NONE, {R::MZONES, R::SZONES}};
+	t[MSG_SPSUMMONED].postDist = {QueryRecipe::NONE, {R::MZONES, R::SZONES}};
+	t[MSG_FLIPSUMMONED].postDist = {QueryRecipe::NONE, {R::MZONES, R::SZONES}};
+	t[MSG_NEW_PHASE].postDist = {QueryRecipe::NONE, {R::MZONES, R::SZONES, R::HANDS}};
+	t[MSG_CHAINED].postDist = {QueryRecipe::NONE, {R::MZONES, R::SZONES, R::HANDS}};
+	t[MSG_CHAIN_END].postDist = {QueryRecipe::NONE, {R::DECKS, R::MZONES, R::SZONES, R::HANDS}};
+	t[MSG_MOVE].postDist = {QueryRecipe::MOVE, {}};
+	t[MSG_POS_CHANGE].postDist = {QueryRecipe::POS_CHANGE, {}};
+	t[MSG_SWAP].postDist = {QueryRecipe::SWAP, {}};
+	t[MSG_TAG_SWAP].postDist = {QueryRecipe::TAG_SWAP, {}};
+	t[MSG_RELOAD_FIELD].postDist = {QueryRecipe::NONE, {R::EXTRAS}};
+	return t;
+}
+
+constexpr auto MSG_DESCRIPTORS = MakeMsgDescriptors();
+
+// Catches descriptors that contradict each other when adding messages.
+constexpr bool AreMsgDescriptorsConsistent()
+{
+	using DT = MsgDistType;
+	for(const auto& d : MSG_DESCRIPTORS)
+	{
+		const bool isStripped =
+			d.dist == DT::MSG_DIST_TYPE_SPECIFIC_TEAM_DUELIST_STRIPPED ||
+			d.dist == DT::MSG_DIST_TYPE_EVERYONE_STRIPPED;
+		if(d.distRule == DistRule::FIXED && isStripped != (d.strip != StripLayout::NONE))
+			return false;
+		if(d.requiresAnswer && d.dist != DT::MSG_DIST_TYPE_SPECIFIC_TEAM_DUELIST &&
+		   d.dist != DT::MSG_DIST_TYPE_SPECIFIC_TEAM_DUELIST_STRIPPED)
+			return false;
+	}
+	return true;
 }
 
-inline void AddRefreshAllHands(std::vector<QueryRequest>& qreqs)
+static_assert(AreMsgDescriptorsConsistent());
+
+constexpr const MsgDescriptor& Describe(MsgView msg)
 {
-	qreqs.emplace_back(QueryLocationRequest{0U, LOCATION_HAND, 0x3781FFF});
-	qreqs.emplace_back(QueryLocationRequest{1U, LOCATION_HAND, 0x3781FFF});
+	return MSG_DESCRIPTORS[msg[0U]];
 }
 
-inline void AddRefreshAllMZones(std::vector<QueryRequest>& qreqs)
+/*** Query utility functions ***/
+
+// Location and query flags of each Refresh.
+constexpr std::array<std::pair<uint32_t, uint32_t>, 6U> REFRESH_QUERIES =
+{{
+	{0U, 0U},
+	{LOCATION_DECK, 0x1181FFF},
+	{LOCATION_EXTRA, 0x381FFF},
+	{LOCATION_HAND, 0x3781FFF},
+	{LOCATION_MZONE, 0x3881FFF},
+	{LOCATION_SZONE, 0x3E81FFF},
+}};
+
+inline void AddRefresh(std::vector<QueryRequest>& qreqs, Refresh r)
 {
-	qreqs.emplace_back(QueryLocationRequest{0U, LOCATION_MZONE, 0x3881FFF});
-	qreqs.emplace_back(QueryLocationRequest{1U, LOCATION_MZONE, 0x3881FFF});
+	const auto& [loc, flags] = REFRESH_QUERIES[static_cast<std::size_t>(r)];
+	qreqs.emplace_back(QueryLocationRequest{0U, loc, flags});
+	qreqs.emplace_back(QueryLocationRequest{1U, loc, flags});
 }
 
-inline void AddRefreshAllSZones(std::vector<QueryRequest>& qreqs)
+inline void AddRecipeQueries(MsgView msg, QueryRecipe recipe, std::vector<QueryRequest>& qreqs)
 {
-	qreqs.emplace_back(QueryLocationRequest{0U, LOCATION_SZONE, 0x3E81FFF});
-	qreqs.emplace_back(QueryLocationRequest{1U, LOCATION_SZONE, 0x3E81FFF});
+	const auto* ptr = msg.data();
+	ptr++; // type ignored
+	switch(recipe)
+	{
+	case QueryRecipe::NONE:
+	{
+		break;
+	}
+	case QueryRecipe::FLIPSUMMONING:
+	{
+		ptr += 4U; // Card code
+		const auto i = Read<LocInfo>(ptr);
+		qreqs.emplace_back(QuerySingleRequest{i.con, i.loc, i.seq, 0x3F81FFF});
+		break;
+	}
+	case QueryRecipe::PLAYER_HAND:
+	{
+		auto player = Read<uint8_t>(ptr);
+		qreqs.emplace_back(QueryLocationRequest{player, LOCATION_HAND, 0x3781FFF});
+		break;
+	}
+	case QueryRecipe::PLAYER_EXTRA:
+	{
+		auto player = Read<uint8_t>(ptr);
+		qreqs.emplace_back(QueryLocationRequest{player, LOCATION_EXTRA, 0x381FFF});
+		break;
+	}
+	case QueryRecipe::PLAYER_GRAVE:
+	{
+		auto player = Read<uint8_t>(ptr);
+		qreqs.emplace_back(QueryLocationRequest{player, LOCATION_GRAVE, 0x381FFF});
+		break;
+	}
+	case QueryRecipe::SHUFFLE_SET_CARD:
+	{
+		auto loc = Read<uint8_t>(ptr);
+		qreqs.emplace_back(QueryLocationRequest{0U, loc, 0x3181FFF});
+		qreqs.emplace_back(QueryLocationRequest{1U, loc, 0x3181FFF});
+		break;
+	}
+	case QueryRecipe::MOVE:
+	{
+		ptr += 4U; // Card code
+		const auto previous = Read<LocInfo>(ptr);
+		const auto current = Read<LocInfo>(ptr);
+		if((previous.con != current.con || previous.loc != current.loc) &&
+		   current.loc != 0U && (current.loc & LOCATION_OVERLAY) == 0U)
+		{
+			qreqs.emplace_back(QuerySingleRequest{
+				current.con,
+				current.loc,
+				current.seq,
+				0x3F81FFF});
+		}
+		break;
+	}
+	case QueryRecipe::POS_CHANGE:
+	{
+		ptr += 4U; // Card code
+		auto cc = Read<uint8_t>(ptr); // Current controller
+		auto cl = Read<uint8_t>(ptr); // Current location
+		auto cs = Read<uint8_t>(ptr); // Current sequence
+		auto pp = Read<uint8_t>(ptr); // Previous position
+		auto cp = Read<uint8_t>(ptr); // Current position
+		if((pp & POS_FACEDOWN) && (cp & POS_FACEUP))
+			qreqs.emplace_back(QuerySingleRequest{cc, cl, cs, 0x3F81FFF});
+		break;
+	}
+	case QueryRecipe::SWAP:
+	{
+		ptr += 4U; // Previous card code
+		const auto p = Read<LocInfo>(ptr);
+		ptr += 4U; // Current card code
+		const auto c = Read<LocInfo>(ptr);
+		qreqs.emplace_back(QuerySingleRequest{p.con, p.loc, p.seq, 0x3F81FFF});
+		qreqs.emplace_back(QuerySingleRequest{c.con, c.loc, c.seq, 0x3F81FFF});
+		break;
+	}
+	case QueryRecipe::TAG_SWAP:
+	{
+		auto player = Read<uint8_t>(ptr);
+		qreqs.reserve(8U);
+		qreqs.emplace_back(QueryLocationRequest{player, LOCATION_DECK, 0x1181FFF});
+		qreqs.emplace_back(QueryLocationRequest{player, LOCATION_EXTRA, 0x381FFF});
+		AddRefresh(qreqs, Refresh::HANDS);
+		qreqs.emplace_back(QueryLocationRequest{0U, LOCATION_MZONE, 0x3081FFF});
+		qreqs.emplace_back(QueryLocationRequest{1U, LOCATION_MZONE, 0x3081FFF});
+		qreqs.emplace_back(QueryLocationRequest{0U, LOCATION_SZONE, 0x30681FFF});
+		qreqs.emplace_back(QueryLocationRequest{1U, LOCATION_SZONE, 0x30681FFF});
+		break;
+	}
+	}
+}
+
+inline std::vector<QueryRequest> MakeQueryRequests(MsgView msg, const QueryPlan& plan)
+{
+	std::vector<QueryRequest> qreqs;
+	AddRecipeQueries(msg, plan.recipe, qreqs);
+	for(const auto r : plan.refreshes)
+	{
+		if(r == Refresh::NONE)
+			break;
+		AddRefresh(qreqs, r);
+	}
+	return qreqs;
 }
 
 inline QueryOpt DeserializeOneQuery(const uint8_t*& ptr)
@@ -117,172 +387,118 @@ inline QueryOpt DeserializeOneQuery(const uint8_t*& ptr)
 	}
 }
 
-/*** Header implementations ***/
-
-std::vector<Msg> SplitToMsgs(const Buffer& buffer)
+// Whether or not a query of type `flag` can be seen by everyone, regardless
+// of the card being revealed or not.
+constexpr bool IsAlwaysPublicQuery(uint32_t flag)
 {
-	using length_t = uint32_t;
-	static constexpr std::size_t sizeOfLength = sizeof(length_t);
-	std::vector<Msg> msgs;
-	if(buffer.empty())
-		return msgs;
-	const std::size_t bufSize = buffer.size();
-	const uint8_t* const bufData = buffer.data();
-	for(std::size_t pos = 0U; pos != bufSize; )
+	switch(flag)
 	{
-		// Retrieve length of this message
-		length_t l = 0U;
-		std::memcpy(&l, bufData + pos, sizeOfLength);
-		pos += sizeOfLength;
-		// Copy message data to a new message
-		auto& msg = msgs.emplace_back(l);
-		std::memcpy(msg.data(), bufData + pos, l);
-		pos += l;
-	}
-	return msgs;
-}
-
-uint8_t GetMessageType(const Msg& msg)
-{
-	return msg[0U];
-}
-
-bool DoesMessageRequireAnswer(uint8_t msgType)
-{
-	switch(msgType)
-	{
-	case MSG_SELECT_CARD:
-	case MSG_SELECT_TRIBUTE:
-	case MSG_SELECT_UNSELECT_CARD:
-	case MSG_SELECT_BATTLECMD:
-	case MSG_SELECT_IDLECMD:
-	case MSG_SELECT_EFFECTYN:
-	case MSG_SELECT_YESNO:
-	case MSG_SELECT_OPTION:
-	case MSG_SELECT_CHAIN:
-	case MSG_SELECT_PLACE:
-	case MSG_SELECT_DISFIELD:
-	case MSG_SELECT_POSITION:
-	case MSG_SORT_CARD:
-	case MSG_SORT_CHAIN:
-	case MSG_SELECT_COUNTER:
-	case MSG_SELECT_SUM:
-	case MSG_ROCK_PAPER_SCISSORS:
-	case MSG_ANNOUNCE_RACE:
-	case MSG_ANNOUNCE_ATTRIB:
-	case MSG_ANNOUNCE_CARD:
-	case MSG_ANNOUNCE_NUMBER:
-	case MSG_ANNOUNCE_CARD_FILTER:
-	{
-		return true;
-	}
-	default:
-	{
-		return false;
-	}
-	}
-}
-
-MsgDistType GetMessageDistributionType(const Msg& msg)
-{
-	switch(GetMessageType(msg))
-	{
-	case MSG_SELECT_CARD:
-	case MSG_SELECT_TRIBUTE:
-	case MSG_SELECT_UNSELECT_CARD:
-	{
-		return MsgDistType::MSG_DIST_TYPE_SPECIFIC_TEAM_DUELIST_STRIPPED;
-	}
-	case MSG_SELECT_BATTLECMD:
-	case MSG_SELECT_IDLECMD:
-	case MSG_SELECT_EFFECTYN:
-	case MSG_SELECT_YESNO:
-	case MSG_SELECT_OPTION:
-	case MSG_SELECT_CHAIN:
-	case MSG_SELECT_PLACE:
-	case MSG_SELECT_DISFIELD:
-	case MSG_SELECT_POSITION:
-	case MSG_SORT_CARD:
-	case MSG_SORT_CHAIN:
-	case MSG_SELECT_COUNTER:
-	case MSG_SELECT_SUM:
-	case MSG_ROCK_PAPER_SCISSORS:
-	case MSG_ANNOUNCE_RACE:
-	case MSG_ANNOUNCE_ATTRIB:
-	case MSG_ANNOUNCE_CARD:
-	case MSG_ANNOUNCE_NUMBER:
-	case MSG_ANNOUNCE_CARD_FILTER:
-	case MSG_MISSED_EFFECT:
-	{
-		return MsgDistType::MSG_DIST_TYPE_SPECIFIC_TEAM_DUELIST;
-	}
-	case MSG_HINT:
-	{
-		switch(msg[1U])
+		case QUERY_CODE:
+		case QUERY_ALIAS:
+		case QUERY_TYPE:
+		case QUERY_LEVEL:
+		case QUERY_RANK:
+		case QUERY_ATTRIBUTE:
+		case QUERY_RACE:
+		case QUERY_ATTACK:
+		case QUERY_DEFENSE:
+		case QUERY_BASE_ATTACK:
+		case QUERY_BASE_DEFENSE:
+		case QUERY_STATUS:
+		case QUERY_LSCALE:
+		case QUERY_RSCALE:
+		case QUERY_LINK:
 		{
-		case 1U: case 2U: case 3U: case 5U:
-		{
-			return MsgDistType::MSG_DIST_TYPE_SPECIFIC_TEAM_DUELIST;
-		}
-		case 200U:
-		{
-			return MsgDistType::MSG_DIST_TYPE_SPECIFIC_TEAM;
+			return false;
 		}
-		case 4U: case 6U: case 7U: case 8U: case 9U: case 11U:
+		default:
 		{
-			return MsgDistType::MSG_DIST_TYPE_EVERYONE_EXCEPT_TEAM_DUELIST;
-		}
-		default: /*case 10U: case 201U: case 202U: case 203U:*/
-		{
-			return MsgDistType::MSG_DIST_TYPE_EVERYONE;
-		}
+			return true;
 		}
 	}
-	case MSG_CONFIRM_CARDS:
+}
+
+// Appends the owner's view and the public view of the query pointed by
+// `ptr` onto their respective buffers, advancing `ptr` past it. Records are
+// copied as-is from the core, skipping the ones a view should not see.
+inline void TranscodeOneQuery(const uint8_t*& ptr, QueryBuffer& owner, QueryBuffer& pub)
+{
+	auto Append = [](QueryBuffer& qb, const uint8_t* first, const uint8_t* last)
 	{
-		const auto* ptr = msg.data() + 2U;
-		// if count(uint32_t) is not 0 and location(uint8_t) is LOCATION_DECK
-		// then send to specific team duelist.
-		if(Read<uint32_t>(ptr) != 0U)
-		{
-			ptr += 4U + 1U;
-			if(Read<uint8_t>(ptr) == LOCATION_DECK)
-				return MsgDistType::MSG_DIST_TYPE_SPECIFIC_TEAM_DUELIST;
-		}
-		return MsgDistType::MSG_DIST_TYPE_EVERYONE;
-	}
-	case MSG_SHUFFLE_HAND:
-	case MSG_SHUFFLE_EXTRA:
-	case MSG_SET:
-	case MSG_MOVE:
-	case MSG_DRAW:
-	case MSG_TAG_SWAP:
+		qb.insert(qb.end(), first, last);
+	};
+	const auto* const start = ptr;
+	if(Read<uint16_t>(ptr) == 0U)
 	{
-		return MsgDistType::MSG_DIST_TYPE_EVERYONE_STRIPPED;
+		Append(owner, start, ptr);
+		Append(pub, start, ptr);
+		return;
 	}
-	default:
+	// Visibility of every record depends on a few of them, which are not
+	// necessarily at the front, so these are looked up beforehand by only
+	// hopping through the record headers.
+	bool isRevealed = false;
+	bool isHidden = false;
+	for(ptr = start;;)
 	{
-		return MsgDistType::MSG_DIST_TYPE_EVERYONE;
+		const auto size = Read<uint16_t>(ptr);
+		const auto* const next = ptr + size;
+		const auto flag = Read<uint32_t>(ptr);
+		if(flag == QUERY_END)
+			break;
+		if(flag == QUERY_POSITION && (Read<uint32_t>(ptr) & POS_FACEUP))
+			isRevealed = true;
+		else if(flag == QUERY_IS_PUBLIC && Read<uint8_t>(ptr))
+			isRevealed = true;
+		else if(flag == QUERY_IS_HIDDEN && Read<uint8_t>(ptr))
+			isHidden = true;
+		ptr = next;
 	}
+	for(ptr = start;;)
+	{
+		const auto* const record = ptr;
+		const auto size = Read<uint16_t>(ptr);
+		const auto* const next = ptr + size;
+		const auto flag = Read<uint32_t>(ptr);
+		ptr = next;
+		const bool isPublic = isRevealed || IsAlwaysPublicQuery(flag);
+		if((flag == QUERY_REASON_CARD || flag == QUERY_EQUIP_CARD) &&
+		   record[sizeof(uint16_t) + sizeof(uint32_t) + 1U] == 0U)
+			continue; // Location of referenced card is not valid.
+		if(isPublic || !isHidden)
+			Append(owner, record, next);
+		if(isPublic)
+			Append(pub, record, next);
+		if(flag == QUERY_END)
+			return;
 	}
 }
 
-uint8_t GetMessageReceivingTeam(const Msg& msg)
+/*** Strip utility functions ***/
+
+// Bitmask of the teams that should not know a card owned by `team`.
+constexpr uint8_t HiddenFromAllBut(uint8_t team)
 {
-	switch(GetMessageType(msg))
+	switch(team)
 	{
-	case MSG_HINT:
-	{
-		return msg[2U];
-	}
-	default:
-	{
-		return msg[1U];
-	}
+	case 0U: return 2U;
+	case 1U: return 1U;
+	default: return 3U;
 	}
 }
 
-Msg StripMessageForTeam(uint8_t team, Msg msg)
+inline void ClearCode(Msg& msg, std::size_t offset)
+{
+	auto* ptr = msg.data() + offset;
+	Write<uint32_t>(ptr, 0U);
+}
+
+// Calls `f(offset, hiddenFrom)` for each card code within the message that
+// should be cleared, `hiddenFrom` being a bitmask of the teams (bit 0 for
+// team 0 and bit 1 for team 1) that should not know it. A spectator doesn't
+// know any of them.
+template<typename F>
+void ForEachHiddenCode(MsgView msg, F&& f)
 {
 	auto IsLocInfoPublic = [](const LocInfo& info)
 	{
@@ -293,297 +509,283 @@ Msg StripMessageForTeam(uint8_t team, Msg msg)
 			return true;
 		return false;
 	};
-	auto ClearPositionArray = [](uint32_t count, uint8_t*& ptr)
+	const auto* const base = msg.data();
+	const auto* ptr = base;
+	auto Offset = [&base](const uint8_t* p) -> std::size_t
+	{
+		return static_cast<std::size_t>(p - base);
+	};
+	auto ClearPositionArray = [&](uint32_t count, uint8_t hiddenFrom)
 	{
 		for(uint32_t i = 0U; i < count; i++)
 		{
+			const auto* const code = ptr;
 			ptr += 4U; // Card code
-			auto pos = Read<uint32_t>(ptr);
-			if(!(pos & POS_FACEUP))
-			{
-				ptr -= 4U + 4U;
-				Write<uint32_t>(ptr, 0U);
-				ptr += 4U;
-			}
+			if(!(Read<uint32_t>(ptr) & POS_FACEUP))
+				f(Offset(code), hiddenFrom);
 		}
 	};
-	auto ClearLocInfoArray = [](uint32_t count, uint8_t team, uint8_t*& ptr)
+	auto ClearLocInfoArray = [&](uint32_t count)
 	{
 		for(uint32_t i = 0U; i < count; i++)
 		{
+			const auto* const code = ptr;
 			ptr += 4U; // Card code
-			const auto info = Read<LocInfo>(ptr);
-			if(team != info.con)
-			{
-				ptr -= LocInfo::SIZE + 4U;
-				Write<uint32_t>(ptr, 0U);
-				ptr += LocInfo::SIZE;
-			}
+			f(Offset(code), HiddenFromAllBut(Read<LocInfo>(ptr).con));
 		}
 	};
-	auto* ptr = msg.data();
 	ptr++; // type ignored
-	switch(GetMessageType(msg))
+	switch(Describe(msg).strip)
 	{
-	case MSG_SET:
+	case StripLayout::NONE:
 	{
-		Write<uint32_t>(ptr, 0U);
 		break;
 	}
-	case MSG_SHUFFLE_HAND:
-	case MSG_SHUFFLE_EXTRA:
+	case StripLayout::SET:
 	{
-		if(Read<uint8_t>(ptr) == team)
-			break;
+		f(Offset(ptr), 3U);
+		break;
+	}
+	case StripLayout::SHUFFLE:
+	{
+		const auto hiddenFrom = HiddenFromAllBut(Read<uint8_t>(ptr));
 		auto count = Read<uint32_t>(ptr);
-		for(uint32_t i = 0U; i < count; i++)
-			Write<uint32_t>(ptr, 0U);
+		for(uint32_t i = 0U; i < count; i++, ptr += 4U)
+			f(Offset(ptr), hiddenFrom);
 		break;
 	}
-	case MSG_MOVE:
+	case StripLayout::MOVE:
 	{
+		const auto* const code = ptr;
 		ptr += 4U; // Card code
 		ptr += LocInfo::SIZE; // Previous location
 		const auto current = Read<LocInfo>(ptr);
-		if(current.con == team || IsLocInfoPublic(current))
-			break;
-		ptr -= 4U + (LocInfo::SIZE * 2U);
-		Write<uint32_t>(ptr, 0U);
+		if(!IsLocInfoPublic(current))
+			f(Offset(code), HiddenFromAllBut(current.con));
 		break;
 	}
-	case MSG_DRAW:
+	case StripLayout::DRAW:
 	{
-		if(Read<uint8_t>(ptr) == team)
-			break;
+		const auto hiddenFrom = HiddenFromAllBut(Read<uint8_t>(ptr));
 		auto count = Read<uint32_t>(ptr);
-		ClearPositionArray(count, ptr);
+		ClearPositionArray(count, hiddenFrom);
 		break;
 	}
-	case MSG_TAG_SWAP:
+	case StripLayout::TAG_SWAP:
 	{
-		if(Read<uint8_t>(ptr) == team)
-			break;
+		const auto hiddenFrom = HiddenFromAllBut(Read<uint8_t>(ptr));
 		ptr        += 4U;                   // Main deck count
 		auto count  = Read<uint32_t>(ptr);  // Extra deck count
 		ptr        += 4U;                   // Face-up pendulum count
 		count      += Read<uint32_t>(ptr);  // Hand count
 		ptr        += 4U;                   // Top-deck card code
-		ClearPositionArray(count, ptr);
+		ClearPositionArray(count, hiddenFrom);
 		break;
 	}
-	case MSG_SELECT_CARD:
+	case StripLayout::SELECT_CARD:
 	{
 		ptr += 1U + 1U + 4U + 4U;
 		auto count = Read<uint32_t>(ptr);
-		ClearLocInfoArray(count, team, ptr);
+		ClearLocInfoArray(count);
 		break;
 	}
-	case MSG_SELECT_TRIBUTE:
+	case StripLayout::SELECT_TRIBUTE:
 	{
 		ptr += 1U + 1U + 4U + 4U;
 		auto count = Read<uint32_t>(ptr);
 		for(uint32_t i = 0; i < count; i++)
 		{
+			const auto* const code = ptr;
 			ptr += 4U; // Card code
-			const auto con = Read<uint8_t>(ptr);
-			if(team != con)
-			{
-				ptr -= 4U + 1U;
-				Write<uint32_t>(ptr, 0U);
-				ptr += 1U;
-			}
+			f(Offset(code), HiddenFromAllBut(Read<uint8_t>(ptr)));
 			ptr += 1U + 4U + 1U; // loc, seq, release_param
 		}
 		break;
 	}
-	case MSG_SELECT_UNSELECT_CARD:
+	case StripLayout::SELECT_UNSELECT_CARD:
 	{
 		ptr += 1U + 1U + 1U + 4U + 4U;
 		auto count1 = Read<uint32_t>(ptr);
-		ClearLocInfoArray(count1, team, ptr);
+		ClearLocInfoArray(count1);
 		auto count2 = Read<uint32_t>(ptr);
-		ClearLocInfoArray(count2, team, ptr);
+		ClearLocInfoArray(count2);
 		break;
 	}
 	}
-	return msg;
 }
 
-Msg MakeStartMsg(const MsgStartCreateInfo& info)
+/*** Header implementations ***/
+
+std::vector<Msg> SplitToMsgs(const Buffer& buffer)
 {
-	Msg msg(18U);
-	auto* ptr = msg.data();
-	Write<uint8_t>(ptr, MSG_START);
-	Write<uint8_t>(ptr, 0U);
-	Write<uint32_t>(ptr, info.lp);
-	Write<uint32_t>(ptr, info.lp);
-	Write(ptr, static_cast<uint16_t>(info.t0DSz));
-	Write(ptr, static_cast<uint16_t>(info.t0EdSz));
-	Write(ptr, static_cast<uint16_t>(info.t1DSz));
-	Write(ptr, static_cast<uint16_t>(info.t1EdSz));
-	return msg;
+	return SplitToMsgs(buffer.data(), buffer.size());
 }
 
-std::vector<QueryRequest> GetPreDistQueryRequests(const Msg& msg)
+std::vector<Msg> SplitToMsgs(const uint8_t* data, std::size_t size)
 {
-	std::vector<QueryRequest> qreqs;
-	switch(GetMessageType(msg))
-	{
-	case MSG_SELECT_BATTLECMD:
-	case MSG_SELECT_IDLECMD:
-	{
-		AddRefreshAllHands(qreqs);
-		AddRefreshAllMZones(qreqs);
-		AddRefreshAllSZones(qreqs);
-		break;
-	}
-	case MSG_SELECT_CHAIN:
-	case MSG_NEW_TURN:
-	{
-		AddRefreshAllMZones(qreqs);
-		AddRefreshAllSZones(qreqs);
-		break;
-	}
-	case MSG_FLIPSUMMONING:
+	using length_t = uint32_t;
+	static constexpr std::size_t sizeOfLength = sizeof(length_t);
+	std::vector<Msg> msgs;
+	if(size == 0U)
+		return msgs;
+	const std::size_t bufSize = size;
+	const uint8_t* const bufData = data;
+	for(std::size_t pos = 0U; pos != bufSize; )
 	{
-		const auto* ptr = msg.data();
-		ptr++; // type ignored
-		ptr += 4U; // Card code
-		const auto i = Read<LocInfo>(ptr);
-		qreqs.emplace_back(QuerySingleRequest{i.con, i.loc, i.seq, 0x3F81FFF});
-		break;
-	}
+		// Retrieve length of this message
+		length_t l = 0U;
+		std::memcpy(&l, bufData + pos, sizeOfLength);
+		pos += sizeOfLength;
+		// Copy message data to a new message
+		auto& msg = msgs.emplace_back(l);
+		std::memcpy(msg.data(), bufData + pos, l);
+		pos += l;
 	}
-	return qreqs;
+	return msgs;
 }
 
-std::vector<QueryRequest> GetPostDistQueryRequests(const Msg& msg)
+MsgView MsgRange::Iterator::operator*() const
 {
-	const auto* ptr = msg.data();
-	ptr++; // type ignored
-	std::vector<QueryRequest> qreqs;
-	switch(GetMessageType(msg))
-	{
-	case MSG_SHUFFLE_HAND:
-	case MSG_DRAW:
-	{
-		auto player = Read<uint8_t>(ptr);
-		qreqs.emplace_back(QueryLocationRequest{player, LOCATION_HAND, 0x3781FFF});
-		break;
-	}
-	case MSG_SHUFFLE_EXTRA:
-	{
-		auto player = Read<uint8_t>(ptr);
-		qreqs.emplace_back(QueryLocationRequest{player, LOCATION_EXTRA, 0x381FFF});
-		break;
-	}
-	case MSG_SWAP_GRAVE_DECK:
-	{
-		auto player = Read<uint8_t>(ptr);
-		qreqs.emplace_back(QueryLocationRequest{player, LOCATION_GRAVE, 0x381FFF});
-		break;
-	}
-	case MSG_REVERSE_DECK:
-	{
-		AddRefreshAllDecks(qreqs);
-		break;
-	}
-	case MSG_SHUFFLE_SET_CARD:
-	{
-		auto loc = Read<uint8_t>(ptr);
-		qreqs.emplace_back(QueryLocationRequest{0U, loc, 0x3181FFF});
-		qreqs.emplace_back(QueryLocationRequest{1U, loc, 0x3181FFF});
-		break;
-	}
-	case MSG_DAMAGE_STEP_START:
-	case MSG_DAMAGE_STEP_END:
-	{
-		AddRefreshAllMZones(qreqs);
-		break;
-	}
-	case MSG_SUMMONED:
-	case MSG_SPSUMMONED:
-	case MSG_FLIPSUMMONED:
+	uint32_t l = 0U;
+	std::memcpy(&l, pos, sizeof(l));
+	return {pos + sizeof(l), static_cast<std::size_t>(l)};
+}
+
+MsgRange::Iterator& MsgRange::Iterator::operator++()
+{
+	uint32_t l = 0U;
+	std::memcpy(&l, pos, sizeof(l));
+	pos += sizeof(l) + l;
+	return *this;
+}
+
+MsgRange IterateMsgs(const uint8_t* data, std::size_t size)
+{
+	return {data, size};
+}
+
+uint8_t GetMessageType(MsgView msg)
+{
+	return msg[0U];
+}
+
+bool DoesMessageRequireAnswer(uint8_t msgType)
+{
+	return MSG_DESCRIPTORS[msgType].requiresAnswer;
+}
+
+MsgDistType GetMessageDistributionType(MsgView msg)
+{
+	const auto& d = Describe(msg);
+	switch(d.distRule)
 	{
-		AddRefreshAllMZones(qreqs);
-		AddRefreshAllSZones(qreqs);
-		break;
-	}
-	case MSG_NEW_PHASE:
-	case MSG_CHAINED:
+	case DistRule::FIXED:
 	{
-		AddRefreshAllMZones(qreqs);
-		AddRefreshAllSZones(qreqs);
-		AddRefreshAllHands(qreqs);
-		break;
+		return d.dist;
 	}
-	case MSG_CHAIN_END:
+	case DistRule::HINT:
 	{
-		AddRefreshAllDecks(qreqs);
-		AddRefreshAllMZones(qreqs);
-		AddRefreshAllSZones(qreqs);
-		AddRefreshAllHands(qreqs);
-		break;
+		switch(msg[1U])
+		{
+		case 1U: case 2U: case 3U: case 5U:
+		{
+			return MsgDistType::MSG_DIST_TYPE_SPECIFIC_TEAM_DUELIST;
+		}
+		case 200U:
+		{
+			return MsgDistType::MSG_DIST_TYPE_SPECIFIC_TEAM;
+		}
+		case 4U: case 6U: case 7U: case 8U: case 9U: case 11U:
+		{
+			return MsgDistType::MSG_DIST_TYPE_EVERYONE_EXCEPT_TEAM_DUELIST;
+		}
+		default: /*case 10U: case 201U: case 202U: case 203U:*/
+		{
+			return MsgDistType::MSG_DIST_TYPE_EVERYONE;
+		}
+		}
 	}
-	case MSG_MOVE:
+	case DistRule::CONFIRM_CARDS:
 	{
-		ptr += 4U; // Card code
-		const auto previous = Read<LocInfo>(ptr);
-		const auto current = Read<LocInfo>(ptr);
-		if((previous.con != current.con || previous.loc != current.loc) &&
-		   current.loc != 0U && (current.loc & LOCATION_OVERLAY) == 0U)
+		const auto* ptr = msg.data() + 2U;
+		// if count(uint32_t) is not 0 and location(uint8_t) is LOCATION_DECK
+		// then send to specific team duelist.
+		if(Read<uint32_t>(ptr) != 0U)
 		{
-			qreqs.emplace_back(QuerySingleRequest{
-				current.con,
-				current.loc,
-				current.seq,
-				0x3F81FFF});
+			ptr += 4U + 1U;
+			if(Read<uint8_t>(ptr) == LOCATION_DECK)
+				return MsgDistType::MSG_DIST_TYPE_SPECIFIC_TEAM_DUELIST;
 		}
-		break;
+		return MsgDistType::MSG_DIST_TYPE_EVERYONE;
 	}
-	case MSG_POS_CHANGE:
-	{
-		ptr += 4U; // Card code
-		auto cc = Read<uint8_t>(ptr); // Current controller
-		auto cl = Read<uint8_t>(ptr); // Current location
-		auto cs = Read<uint8_t>(ptr); // Current sequence
-		auto pp = Read<uint8_t>(ptr); // Previous position
-		auto cp = Read<uint8_t>(ptr); // Current position
-		if((pp & POS_FACEDOWN) && (cp & POS_FACEUP))
-			qreqs.emplace_back(QuerySingleRequest{cc, cl, cs, 0x3F81FFF});
-		break;
 	}
-	case MSG_SWAP:
+	return d.dist;
+}
+
+uint8_t GetMessageReceivingTeam(MsgView msg)
+{
+	return msg[Describe(msg).teamOffset];
+}
+
+Msg StripMessageForTeam(uint8_t team, Msg msg)
+{
+	ForEachHiddenCode(msg, [&](std::size_t offset, uint8_t hiddenFrom)
 	{
-		ptr += 4U; // Previous card code
-		const auto p = Read<LocInfo>(ptr);
-		ptr += 4U; // Current card code
-		const auto c = Read<LocInfo>(ptr);
-		qreqs.emplace_back(QuerySingleRequest{p.con, p.loc, p.seq, 0x3F81FFF});
-		qreqs.emplace_back(QuerySingleRequest{c.con, c.loc, c.seq, 0x3F81FFF});
-		break;
-	}
-	case MSG_TAG_SWAP:
+		if(hiddenFrom & (1U << team))
+			ClearCode(msg, offset);
+	});
+	return msg;
+}
+
+void StripMessageForTeam(uint8_t team, MsgView msg, Msg& out)
+{
+	out.assign(msg.begin(), msg.end());
+	ForEachHiddenCode(msg, [&](std::size_t offset, uint8_t hiddenFrom)
 	{
-		auto player = Read<uint8_t>(ptr);
-		qreqs.reserve(8U);
-		qreqs.emplace_back(QueryLocationRequest{player, LOCATION_DECK, 0x1181FFF});
-		qreqs.emplace_back(QueryLocationRequest{player, LOCATION_EXTRA, 0x381FFF});
-		AddRefreshAllHands(qreqs);
-		qreqs.emplace_back(QueryLocationRequest{0U, LOCATION_MZONE, 0x3081FFF});
-		qreqs.emplace_back(QueryLocationRequest{1U, LOCATION_MZONE, 0x3081FFF});
-		qreqs.emplace_back(QueryLocationRequest{0U, LOCATION_SZONE, 0x30681FFF});
-		qreqs.emplace_back(QueryLocationRequest{1U, LOCATION_SZONE, 0x30681FFF});
-		break;
-	}
-	case MSG_RELOAD_FIELD:
+		if(hiddenFrom & (1U << team))
+			ClearCode(out, offset);
+	});
+}
+
+void StripMessageForEveryone(MsgView msg, Msg& team0, Msg& team1, Msg& spectator)
+{
+	team0.assign(msg.begin(), msg.end());
+	team1.assign(msg.begin(), msg.end());
+	spectator.assign(msg.begin(), msg.end());
+	ForEachHiddenCode(msg, [&](std::size_t offset, uint8_t hiddenFrom)
 	{
-		qreqs.emplace_back(QueryLocationRequest{0U, LOCATION_EXTRA, 0x381FFF});
-		qreqs.emplace_back(QueryLocationRequest{1U, LOCATION_EXTRA, 0x381FFF});
-		break;
-	}
-	}
-	return qreqs;
+		if(hiddenFrom & 1U)
+			ClearCode(team0, offset);
+		if(hiddenFrom & 2U)
+			ClearCode(team1, offset);
+		if(hiddenFrom != 0U)
+			ClearCode(spectator, offset);
+	});
+}
+
+Msg MakeStartMsg(const MsgStartCreateInfo& info)
+{
+	Msg msg(18U);
+	auto* ptr = msg.data();
+	Write<uint8_t>(ptr, MSG_START);
+	Write<uint8_t>(ptr, 0U);
+	Write<uint32_t>(ptr, info.lp);
+	Write<uint32_t>(ptr, info.lp);
+	Write(ptr, static_cast<uint16_t>(info.t0DSz));
+	Write(ptr, static_cast<uint16_t>(info.t0EdSz));
+	Write(ptr, static_cast<uint16_t>(info.t1DSz));
+	Write(ptr, static_cast<uint16_t>(info.t1EdSz));
+	return msg;
+}
+
+std::vector<QueryRequest> GetPreDistQueryRequests(MsgView msg)
+{
+	return MakeQueryRequests(msg, Describe(msg).preDist);
+}
+
+std::vector<QueryRequest> GetPostDistQueryRequests(MsgView msg)
+{
+	return MakeQueryRequests(msg, Describe(msg).postDist);
 }
 
 Msg MakeUpdateCardMsg(uint8_t con, uint32_t loc, uint32_t seq, const QueryBuffer& qb)
@@ -659,31 +861,7 @@ QueryBuffer SerializeSingleQuery(const QueryOpt& q, bool isPublic)
 			return true;
 		if((q->flags & QUERY_POSITION) && (q->pos & POS_FACEUP))
 			return true;
-		switch(flag)
-		{
-			case QUERY_CODE:
-			case QUERY_ALIAS:
-			case QUERY_TYPE:
-			case QUERY_LEVEL:
-			case QUERY_RANK:
-			case QUERY_ATTRIBUTE:
-			case QUERY_RACE:
-			case QUERY_ATTACK:
-			case QUERY_DEFENSE:
-			case QUERY_BASE_ATTACK:
-			case QUERY_BASE_DEFENSE:
-			case QUERY_STATUS:
-			case QUERY_LSCALE:
-			case QUERY_RSCALE:
-			case QUERY_LINK:
-			{
-				return false;
-			}
-			default:
-			{
-				return true;
-			}
-		}
+		return IsAlwaysPublicQuery(static_cast<uint32_t>(flag));
 	};
 	auto ComputeQuerySize = [&q](uint64_t flag) constexpr -> std::size_t
 	{
@@ -821,4 +999,31 @@ QueryBuffer SerializeLocationQuery(const QueryOptVector& qs, bool isPublic)
 	return qb;
 }
 
+void TranscodeSingleQuery(const QueryBuffer& qb, QueryBuffer& owner, QueryBuffer& pub)
+{
+	owner.clear();
+	pub.clear();
+	const auto* ptr = qb.data();
+	TranscodeOneQuery(ptr, owner, pub);
+}
+
+void TranscodeLocationQuery(const QueryBuffer& qb, QueryBuffer& owner, QueryBuffer& pub)
+{
+	using length_t = uint32_t;
+	owner.assign(sizeof(length_t), 0U);
+	pub.assign(sizeof(length_t), 0U);
+	const auto* ptr = qb.data();
+	const auto length = Read<length_t>(ptr);
+	const auto* const ptrMax = std::min(ptr + length, qb.data() + qb.size());
+	while(ptr < ptrMax)
+		TranscodeOneQuery(ptr, owner, pub);
+	auto WriteLength = [](QueryBuffer& out)
+	{
+		auto* wptr = out.data();
+		Write(wptr, static_cast<length_t>(out.size() - sizeof(length_t)));
+	};
+	WriteLength(owner);
+	WriteLength(pub);
+}
+
 } // namespace YGOPro::CoreUtils
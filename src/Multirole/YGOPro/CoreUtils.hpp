@@ -83,6 +83,16 @@ struct Query
 	std::vector<uint32_t> counters;
 };
 
+constexpr bool operator==(const QuerySingleRequest& a, const QuerySingleRequest& b)
+{
+	return a.con == b.con && a.loc == b.loc && a.seq == b.seq && a.flags == b.flags;
+}
+
+constexpr bool operator==(const QueryLocationRequest& a, const QueryLocationRequest& b)
+{
+	return a.con == b.con && a.loc == b.loc && a.flags == b.flags;
+}
+
 using Buffer = std::vector<uint8_t>;
 using Msg = std::vector<uint8_t>;
 using QueryBuffer = std::vector<uint8_t>;
@@ -90,14 +100,68 @@ using QueryRequest = std::variant<QuerySingleRequest, QueryLocationRequest>;
 using QueryOpt = std::optional<Query>;
 using QueryOptVector = std::vector<QueryOpt>;
 
+// Non-owning view over a single core message, either inside a buffer you
+// would get from OCG_DuelGetMessage or owned by a Msg.
+class MsgView
+{
+public:
+	constexpr MsgView(const uint8_t* data, std::size_t size) : ptr(data), len(size)
+	{}
+
+	MsgView(const Msg& msg) : ptr(msg.data()), len(msg.size())
+	{}
+
+	constexpr const uint8_t* data() const { return ptr; }
+	constexpr std::size_t size() const { return len; }
+	constexpr const uint8_t* begin() const { return ptr; }
+	constexpr const uint8_t* end() const { return ptr + len; }
+	constexpr const uint8_t& operator[](std::size_t i) const { return ptr[i]; }
+private:
+	const uint8_t* ptr;
+	std::size_t len;
+};
+
+// Range over the core messages of a buffer you would get from
+// OCG_DuelGetMessage, which are parsed in place while iterating, the
+// buffer must outlive the range and the views it hands out.
+class MsgRange
+{
+public:
+	class Iterator
+	{
+	public:
+		constexpr Iterator(const uint8_t* pos) : pos(pos)
+		{}
+
+		MsgView operator*() const;
+		Iterator& operator++();
+		constexpr bool operator!=(const Iterator& other) const { return pos != other.pos; }
+	private:
+		const uint8_t* pos;
+	};
+
+	constexpr MsgRange(const uint8_t* data, std::size_t size) : first(data), last(data + size)
+	{}
+
+	constexpr Iterator begin() const { return Iterator(first); }
+	constexpr Iterator end() const { return Iterator(last); }
+private:
+	const uint8_t* first;
+	const uint8_t* last;
+};
+
 // Takes the buffer you would get from OCG_DuelGetMessage and splits it
 // into individual core messages (which are still just buffers).
 // This operation also removes the length bytes (first 2 bytes) as that
 // can be retrieved back from Msg's size() method.
 std::vector<Msg> SplitToMsgs(const Buffer& buffer);
+std::vector<Msg> SplitToMsgs(const uint8_t* data, std::size_t size);
+
+// Same as above but without copying anything, see MsgRange.
+MsgRange IterateMsgs(const uint8_t* data, std::size_t size);
 
 // Takes any core message, reads and returns its type (1st byte)
-uint8_t GetMessageType(const Msg& msg);
+uint8_t GetMessageType(MsgView msg);
 
 // Tells if the message requires an answer (setting a response)
 // from a user/duelist before processing can continue.
@@ -105,16 +169,25 @@ bool DoesMessageRequireAnswer(uint8_t msgType);
 
 // Takes any core message and determines how the message should be
 // distributed to clients and if it should have knowledge stripped.
-MsgDistType GetMessageDistributionType(const Msg& msg);
+MsgDistType GetMessageDistributionType(MsgView msg);
 
 // Tells which team should receive this message.
 // The behavior is undefined if the message is not for a specific team.
-uint8_t GetMessageReceivingTeam(const Msg& msg);
+uint8_t GetMessageReceivingTeam(MsgView msg);
 
 // Removes knowledge from a message if it shouldn't be known
 // by the argument `team`, returns a new copy of the message, modified.
 Msg StripMessageForTeam(uint8_t team, Msg msg);
 
+// Same as above but writes the modified copy onto `out`, reusing its
+// capacity.
+void StripMessageForTeam(uint8_t team, MsgView msg, Msg& out);
+
+// Writes the copies of a message that each team and spectators should
+// receive in a single pass, reusing the capacity of the passed buffers.
+// Spectators don't get to know anything that either team shouldn't.
+void StripMessageForEveryone(MsgView msg, Msg& team0, Msg& team1, Msg& spectator);
+
 // Creates MSG_START, which is the first message recorded onto the replay
 // and the first one sent to clients, it setups the piles with the correct
 // amount of cards and sets the LP to the correct amount.
@@ -122,8 +195,8 @@ Msg MakeStartMsg(const MsgStartCreateInfo& info);
 
 // The following functions process the message and acquires the query requests
 // that are necessary either before distribution or after, respectively.
-std::vector<QueryRequest> GetPreDistQueryRequests(const Msg& msg);
-std::vector<QueryRequest> GetPostDistQueryRequests(const Msg& msg);
+std::vector<QueryRequest> GetPreDistQueryRequests(MsgView msg);
+std::vector<QueryRequest> GetPostDistQueryRequests(MsgView msg);
 
 // Creates MSG_UPDATE_CARD, which is a message that wraps around a single card
 // query from a duel.
@@ -148,6 +221,15 @@ QueryBuffer SerializeSingleQuery(const QueryOpt& q, bool isPublic);
 // Same as the above function, but for all the queries in the vector.
 QueryBuffer SerializeLocationQuery(const QueryOptVector& qs, bool isPublic);
 
+// Writes both the owner's view and the public view of the passed QueryBuffer
+// in a single pass, without building intermediate query objects. Equivalent
+// to serializing the deserialized query twice. Output buffers are overwritten
+// but keep their capacity, so they can be reused across calls.
+void TranscodeSingleQuery(const QueryBuffer& qb, QueryBuffer& owner, QueryBuffer& pub);
+
+// Same as the above function, but for a buffer with multiple queries.
+void TranscodeLocationQuery(const QueryBuffer& qb, QueryBuffer& owner, QueryBuffer& pub);
+
 } // namespace YGOPro::CoreUtils
 
 #endif // YGOPRO_COREUTILS_HPP
@@ -0,0 +1,169 @@
+#include "LegalityTable.hpp"
+
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <mutex>
+#include <utility>
+
+#include "Banlist.hpp"
+#include "CardDatabase.hpp"
+#include "Constants.hpp"
+#include "Deck.hpp"
+#include "MsgCommon.hpp"
+
+namespace YGOPro
+{
+
+// Most cards a deck can have, so that its codes can be counted without
+// allocating.
+constexpr std::size_t MAX_COUNTED = 256U;
+
+// Checked decks kept by each table, all are forgotten once there are more.
+constexpr std::size_t MAX_CHECKED = 4096U;
+
+// FNV-1a, mixing in each code as a whole.
+inline uint64_t HashCodes(const uint32_t* codes, std::size_t count)
+{
+	constexpr uint64_t FNV_OFFSET_BASIS = 0xCBF29CE484222325U;
+	constexpr uint64_t FNV_PRIME = 0x100000001B3U;
+	uint64_t h = FNV_OFFSET_BASIS;
+	for(std::size_t i = 0U; i < count; i++)
+		h = (h ^ codes[i]) * FNV_PRIME;
+	return h;
+}
+
+inline LegalityTable::Verdict ScopeVerdict(uint32_t scope, uint8_t allowed)
+{
+	using Verdict = LegalityTable::Verdict;
+	switch(allowed)
+	{
+	case ALLOWED_CARDS_OCG_ONLY:
+	case ALLOWED_CARDS_TCG_ONLY:
+	case ALLOWED_CARDS_OCG_TCG:
+		if(scope > SCOPE_OCG_TCG)
+			return Verdict::UNOFFICIAL;
+		break;
+	default:
+		break;
+	}
+	if(allowed == ALLOWED_CARDS_WITH_PRERELEASE && ((scope & SCOPE_OFFICIAL) == 0U))
+		return Verdict::UNOFFICIAL;
+	if(allowed == ALLOWED_CARDS_OCG_ONLY && ((scope & SCOPE_OCG) == 0U))
+		return Verdict::TCG_ONLY;
+	if(allowed == ALLOWED_CARDS_TCG_ONLY && ((scope & SCOPE_TCG) == 0U))
+		return Verdict::OCG_ONLY;
+	return Verdict::OK;
+}
+
+LegalityTable::LegalityTable(const CardDatabase& cdb, const Banlist* banlist, uint8_t allowed, int32_t forb) :
+	cdb(cdb),
+	cards(cdb.Size())
+{
+	constexpr int32_t NO_LIMIT = std::numeric_limits<int32_t>::max();
+	for(std::size_t i = 0U; i < cards.size(); i++)
+	{
+		const auto& data = cdb.DataAt(i);
+		const auto& extra = cdb.ExtraAt(i);
+		auto& c = cards[i];
+		c.group = (data.alias != 0U) ? data.alias : data.code;
+		c.verdict = ((data.type & static_cast<uint32_t>(forb)) != 0U) ?
+			Verdict::FORBIDDEN_TYPE : ScopeVerdict(extra.scope, allowed);
+		c.limit = NO_LIMIT;
+		if(banlist == nullptr)
+			continue;
+		const auto* limit = banlist->Limit(data.code);
+		if(limit == nullptr && data.alias != 0U)
+			limit = banlist->Limit(data.alias);
+		if(limit != nullptr)
+			c.limit = *limit;
+		else if(banlist->IsWhitelist())
+			c.limit = -1;
+	}
+}
+
+LegalityTable::Result LegalityTable::Check(const Deck& deck) const
+{
+	// Every code of the deck in order, main, extra and side alike, as
+	// none of the checks tell them apart.
+	std::array<uint32_t, MAX_COUNTED> codes;
+	std::size_t count = 0U;
+	for(const auto* v : {&deck.Main(), &deck.Extra(), &deck.Side()})
+	{
+		for(const auto code : *v)
+		{
+			if(count == MAX_COUNTED)
+				return {Verdict::MORE_THAN_3, code};
+			codes[count++] = code;
+		}
+	}
+	std::sort(codes.begin(), codes.begin() + count);
+	const auto hash = HashCodes(codes.data(), count);
+	const auto SameCodes = [&](const Checked& c)
+	{
+		return std::equal(c.codes.begin(), c.codes.end(), codes.begin(), codes.begin() + count);
+	};
+	{
+		std::shared_lock lock(mChecked);
+		if(auto search = checked.find(hash); search != checked.end() && SameCodes(search->second))
+			return search->second.result;
+	}
+	const auto result = Compute(codes.data(), count);
+	std::scoped_lock lock(mChecked);
+	if(checked.size() >= MAX_CHECKED)
+		checked.clear();
+	checked[hash] = Checked{std::vector<uint32_t>(codes.begin(), codes.begin() + count), result};
+	return result;
+}
+
+// private
+
+LegalityTable::Result LegalityTable::Compute(const uint32_t* codes, std::size_t count) const
+{
+	// Position of each code on the database.
+	std::array<std::size_t, MAX_COUNTED> indices;
+	// Copies of each group, kept sorted by group.
+	std::array<std::pair<uint32_t, uint32_t>, MAX_COUNTED> groups;
+	std::size_t groupCount = 0U;
+	cdb.IndicesOf(codes, count, indices.data());
+	for(std::size_t i = 0U; i < count; i++)
+	{
+		if(indices[i] == cdb.Size())
+			return {Verdict::UNKNOWN, codes[i]};
+		const auto group = cards[indices[i]].group;
+		const auto last = groups.begin() + groupCount;
+		auto it = std::lower_bound(groups.begin(), last, group,
+		[](const auto& g, uint32_t c)
+		{
+			return g.first < c;
+		});
+		if(it == last || it->first != group)
+		{
+			std::move_backward(it, last, last + 1);
+			*it = {group, 0U};
+			groupCount++;
+		}
+		it->second++;
+	}
+	for(std::size_t i = 0U; i < count; i++)
+	{
+		if(i > 0U && codes[i] == codes[i - 1U])
+			continue;
+		const auto code = codes[i];
+		const auto& c = cards[indices[i]];
+		const auto copies = std::lower_bound(groups.begin(), groups.begin() + groupCount, c.group,
+		[](const auto& g, uint32_t gc)
+		{
+			return g.first < gc;
+		})->second;
+		if(copies > 3U)
+			return {Verdict::MORE_THAN_3, code};
+		if(c.verdict != Verdict::OK)
+			return {c.verdict, code};
+		if(static_cast<int64_t>(copies) > c.limit)
+			return {Verdict::BANLISTED, code};
+	}
+	return {Verdict::OK, 0U};
+}
+
+} // namespace YGOPro
@@ -0,0 +1,71 @@
+#ifndef YGOPRO_LEGALITYTABLE_HPP
+#define YGOPRO_LEGALITYTABLE_HPP
+#include <cstdint>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace YGOPro
+{
+
+class Banlist;
+class CardDatabase;
+class Deck;
+
+// What is allowed of each card of a database under a given banlist and
+// host options, worked out once so that checking a deck only has to count
+// its cards and look them up.
+class LegalityTable final
+{
+public:
+	enum class Verdict : uint8_t
+	{
+		OK,
+		UNKNOWN,
+		MORE_THAN_3,
+		FORBIDDEN_TYPE,
+		UNOFFICIAL,
+		TCG_ONLY,
+		OCG_ONLY,
+		BANLISTED,
+	};
+
+	struct Result
+	{
+		Verdict verdict;
+		uint32_t code; // Card at fault, if any.
+	};
+
+	LegalityTable(const CardDatabase& cdb, const Banlist* banlist, uint8_t allowed, int32_t forb);
+
+	// Gets the first card, by code, that can't be used in the deck and
+	// why, or Verdict::OK if every card can be used. Results are kept for
+	// decks with the same cards, as the table never changes.
+	Result Check(const Deck& deck) const;
+private:
+	struct Card
+	{
+		uint32_t group; // Code whose copies count towards this card.
+		int32_t limit; // Copies allowed by the banlist.
+		Verdict verdict; // Whether the card can be used at all.
+	};
+	// Result for a deck along with its sorted codes, compared on lookup
+	// so that a crafted hash collision can't pass a deck as another.
+	struct Checked
+	{
+		std::vector<uint32_t> codes;
+		Result result;
+	};
+	const CardDatabase& cdb;
+	std::vector<Card> cards; // By index on `cdb`.
+	mutable std::unordered_map<uint64_t, Checked> checked; // By codes hash.
+	mutable std::shared_mutex mChecked;
+
+	// Check without looking at or storing into `checked`, `codes` must
+	// be sorted.
+	Result Compute(const uint32_t* codes, std::size_t count) const;
+};
+
+} // namespace YGOPro
+
+#endif // YGOPRO_LEGALITYTABLE_HPP
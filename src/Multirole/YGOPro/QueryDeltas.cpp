@@ -0,0 +1,146 @@
+#include "QueryDeltas.hpp"
+
+#include <algorithm> // std::equal, std::min
+#include <cstring> // std::memcpy
+
+#include "Constants.hpp"
+
+namespace YGOPro
+{
+
+#include "../../Read.inl"
+#include "../../Write.inl"
+
+using length_t = uint32_t;
+
+// Records are laid out as: size (uint16_t), flag (uint32_t) and payload,
+// with size accounting for both the flag and payload.
+inline const uint8_t* NextRecord(const uint8_t* record)
+{
+	auto* ptr = record;
+	const auto size = Read<uint16_t>(ptr);
+	return ptr + size;
+}
+
+inline uint32_t RecordFlag(const uint8_t* record)
+{
+	auto* ptr = record + sizeof(uint16_t);
+	return Read<uint32_t>(ptr);
+}
+
+inline const uint8_t* FindRecord(const uint8_t* first, const uint8_t* last, uint32_t flag)
+{
+	for(; first < last; first = NextRecord(first))
+		if(RecordFlag(first) == flag)
+			return first;
+	return nullptr;
+}
+
+// Moves `ptr` past the query it points to.
+inline void SkipQuery(const uint8_t*& ptr)
+{
+	const auto* const start = ptr;
+	if(Read<uint16_t>(ptr) == 0U)
+		return;
+	for(ptr = start;; ptr = NextRecord(ptr))
+	{
+		if(RecordFlag(ptr) == QUERY_END)
+		{
+			ptr = NextRecord(ptr);
+			return;
+		}
+	}
+}
+
+bool QueryDeltas::EncodeSingle(uint8_t con, uint32_t loc, uint32_t seq, QueryBuffer& qb)
+{
+	auto search = locations.find({con, loc});
+	if(search == locations.end() || seq >= search->second.size())
+		return true; // Nothing to compare against.
+	out.clear();
+	const auto* ptr = qb.data();
+	if(!EncodeCard(ptr, search->second[seq]))
+		return false;
+	qb.swap(out);
+	return true;
+}
+
+bool QueryDeltas::EncodeLocation(uint8_t con, uint32_t loc, QueryBuffer& qb)
+{
+	const auto* ptr = qb.data();
+	const auto length = Read<length_t>(ptr);
+	const auto* const ptrMax = std::min<const uint8_t*>(ptr + length, qb.data() + qb.size());
+	std::size_t count = 0U;
+	for(const auto* p = ptr; p < ptrMax; count++)
+		SkipQuery(p);
+	auto [it, changed] = locations.try_emplace({con, loc});
+	auto& cards = it->second;
+	// Should not happen, but if the amount of cards does not match there
+	// is no telling which card is which anymore.
+	if(cards.size() != count)
+		cards.assign(count, Card{});
+	out.assign(sizeof(length_t), 0U);
+	for(auto& card : cards)
+		changed = EncodeCard(ptr, card) || changed;
+	if(!changed)
+		return false;
+	auto* wptr = out.data();
+	Write(wptr, static_cast<length_t>(out.size() - sizeof(length_t)));
+	qb.swap(out);
+	return true;
+}
+
+void QueryDeltas::Clear()
+{
+	locations.clear();
+}
+
+// private
+
+bool QueryDeltas::EncodeCard(const uint8_t*& ptr, Card& card)
+{
+	const auto* const start = ptr;
+	if(Read<uint16_t>(ptr) == 0U)
+	{
+		out.insert(out.end(), start, ptr);
+		const bool changed = card.state != Card::State::EMPTY;
+		card.state = Card::State::EMPTY;
+		card.records.clear();
+		return changed;
+	}
+	const bool known = card.state == Card::State::PRESENT;
+	const auto* const oldFirst = card.records.data();
+	const auto* const oldLast = oldFirst + card.records.size();
+	bool changed = !known;
+	merged.clear();
+	for(ptr = start;;)
+	{
+		const auto* const record = ptr;
+		ptr = NextRecord(record);
+		const auto flag = RecordFlag(record);
+		if(flag == QUERY_END)
+		{
+			out.insert(out.end(), record, ptr);
+			break;
+		}
+		merged.insert(merged.end(), record, ptr);
+		if(known)
+		{
+			const auto* old = FindRecord(oldFirst, oldLast, flag);
+			if(old != nullptr && std::equal(record, ptr, old, NextRecord(old)))
+				continue;
+		}
+		out.insert(out.end(), record, ptr);
+		changed = true;
+	}
+	// Keep the records clients still know from before.
+	const std::size_t newSize = merged.size();
+	for(const auto* old = oldFirst; known && old < oldLast; old = NextRecord(old))
+		if(FindRecord(merged.data(), merged.data() + newSize, RecordFlag(old)) == nullptr)
+			merged.insert(merged.end(), old, NextRecord(old));
+	card.records.swap(merged);
+	card.state = Card::State::PRESENT;
+	return changed;
+}
+
+} // namespace YGOPro
@@ -0,0 +1,53 @@
+#ifndef YGOPRO_QUERYDELTAS_HPP
+#define YGOPRO_QUERYDELTAS_HPP
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "CoreUtils.hpp"
+
+namespace YGOPro
+{
+
+// Remembers the card queries a view (the owner or everyone else) was sent,
+// as they should stand on its clients, and turns new query buffers into
+// deltas against them: records that did not change are left out, which
+// clients already take as the card keeping its previous value.
+class QueryDeltas
+{
+public:
+	using QueryBuffer = CoreUtils::QueryBuffer;
+
+	// Rewrites `qb`, as passed to MakeUpdateCardMsg and MakeUpdateDataMsg
+	// respectively, into its delta. Returns false if nothing changed, in
+	// which case there is no need to send the update at all.
+	bool EncodeSingle(uint8_t con, uint32_t loc, uint32_t seq, QueryBuffer& qb);
+	bool EncodeLocation(uint8_t con, uint32_t loc, QueryBuffer& qb);
+
+	// Forgets everything that was sent, to be used whenever clients could
+	// have changed their cards by other means.
+	void Clear();
+private:
+	struct Card
+	{
+		enum class State : uint8_t
+		{
+			UNKNOWN,
+			EMPTY,
+			PRESENT,
+		} state{State::UNKNOWN};
+		QueryBuffer records; // Every record known, except for QUERY_END.
+	};
+
+	std::map<std::pair<uint8_t, uint32_t>, std::vector<Card>> locations;
+	QueryBuffer out;
+	QueryBuffer merged;
+
+	// Appends the delta of the query pointed by `ptr` onto `out`, advancing
+	// `ptr` past it and updating `card`. Returns whether it changed.
+	bool EncodeCard(const uint8_t*& ptr, Card& card);
+};
+
+} // namespace YGOPro
+
+#endif // YGOPRO_QUERYDELTAS_HPP
@@ -1,7 +1,11 @@
 #include "Replay.hpp"
 
+#include <algorithm>
 #include <cassert>
 #include <cstring>
+#ifdef MULTIROLE_ZSTD
+#include <zstd.h>
+#endif // MULTIROLE_ZSTD
 
 #include "Config.hpp"
 #include "Constants.hpp"
@@ -20,6 +24,7 @@ constexpr auto ENCODED_SERVER_VERSION = [](const auto& v) constexpr -> uint32_t
 	       ((v.core.minor   & 0xFF) << 24);
 }(SERVER_VERSION);
 
+#include "../../Read.inl"
 #include "../../Write.inl"
 
 enum ReplayTypes
@@ -39,6 +44,8 @@ enum ReplayFlags
 	REPLAY_HAND_TEST      = 0x40,
 	REPLAY_DIRECT_SEED    = 0x80,
 	REPLAY_64BIT_DUELFLAG = 0x100,
+	// Only used by the copies saved by the server, clients can't read it.
+	REPLAY_ZSTD_COMPRESSED = 0x80000000,
 };
 
 struct ReplayHeader
@@ -52,6 +59,69 @@ struct ReplayHeader
 	uint8_t props[8]; // Used for LZMA compression (check their apis)
 };
 
+// LZMA encoder kept by each thread that compresses replays. Its match
+// finder, range coder buffer and probability tables are reused by the
+// next replay compressed on the same thread instead of being allocated,
+// page faulted in and freed every time. The dictionary is the smallest
+// power of two fitting the replay, so that replays of similar sizes need
+// the same allocations, and isn't kept past MAX_KEPT_DICT_SIZE.
+class LzmaEncoder final
+{
+public:
+	static constexpr UInt32 MIN_DICT_SIZE = 1U << 16U;
+	static constexpr UInt32 MAX_KEPT_DICT_SIZE = 1U << 22U;
+
+	static LzmaEncoder& ForThisThread()
+	{
+		thread_local LzmaEncoder encoder;
+		return encoder;
+	}
+
+	~LzmaEncoder()
+	{
+		Reset();
+	}
+
+	// Compresses `src` onto `dest`, `destLen` being its capacity and set
+	// to what was written, and the encoded properties onto `props`.
+	SRes Encode(uint8_t* dest, std::size_t& destLen, const uint8_t* src, std::size_t srcLen, int level, uint8_t* props)
+	{
+		CLzmaEncProps p;
+		LzmaEncProps_Init(&p);
+		p.level = level;
+		p.numThreads = 1; // NOLINT: built with _7ZIP_ST
+		const UInt32 levelDictSize = LzmaEncProps_GetDictSize(&p);
+		UInt32 dictSize = MIN_DICT_SIZE;
+		while(dictSize < srcLen && dictSize < levelDictSize)
+			dictSize <<= 1U;
+		p.dictSize = std::min(dictSize, levelDictSize);
+		if(handle == nullptr && (handle = LzmaEnc_Create(&g_Alloc)) == nullptr)
+			return SZ_ERROR_MEM;
+		SizeT propsSize = LZMA_PROPS_SIZE;
+		SizeT len = destLen;
+		SRes res = LzmaEnc_SetProps(handle, &p);
+		if(res == SZ_OK)
+			res = LzmaEnc_WriteProperties(handle, props, &propsSize);
+		if(res == SZ_OK)
+			res = LzmaEnc_MemEncode(handle, dest, &len, src, srcLen, 0, nullptr, &g_Alloc, &g_Alloc);
+		destLen = len;
+		// Don't hold onto big dictionaries, nor reuse what failed.
+		if(res != SZ_OK || p.dictSize > MAX_KEPT_DICT_SIZE)
+			Reset();
+		return res;
+	}
+private:
+	CLzmaEncHandle handle{};
+
+	void Reset()
+	{
+		if(handle == nullptr)
+			return;
+		LzmaEnc_Destroy(handle, &g_Alloc, &g_Alloc);
+		handle = nullptr;
+	}
+};
+
 // ***** YRPX Binary format *****
 // ReplayHeader
 // team0Count [uint32_t]
@@ -90,7 +160,8 @@ Replay::Replay(
 	uint32_t unixTimestamp,
 	uint32_t seed,
 	const HostInfo& info,
-	const CodeVector& extraCards)
+	const CodeVector& extraCards,
+	std::pmr::memory_resource* mr)
 	:
 	unixTimestamp(unixTimestamp),
 	seed(seed),
@@ -98,7 +169,9 @@ Replay::Replay(
 	startingDrawCount(info.startingDrawCount),
 	drawCountPerTurn(info.drawCountPerTurn),
 	duelFlags(HostInfo::OrDuelFlags(info.duelFlagsHigh, info.duelFlagsLow)),
-	extraCards(extraCards)
+	extraCards(extraCards),
+	responses(mr),
+	responseOffsets(mr)
 {}
 
 const std::vector<uint8_t>& Replay::Bytes() const
@@ -106,19 +179,119 @@ const std::vector<uint8_t>& Replay::Bytes() const
 	return bytes;
 }
 
+const std::vector<uint8_t>& Replay::Uncompressed() const
+{
+	return uncompressed;
+}
+
+std::size_t Replay::MemoryUsage() const
+{
+	return uncompressed.capacity() + bytes.capacity() + responses.capacity() +
+		responseOffsets.capacity() * sizeof(std::size_t);
+}
+
+std::vector<uint8_t> Replay::Compress(const std::vector<uint8_t>& raw, const Compression& comp)
+{
+	assert(raw.size() >= sizeof(ReplayHeader));
+	const uint8_t* src = raw.data();
+	auto header = Read<ReplayHeader>(src);
+	const std::size_t srcLen = raw.size() - sizeof(ReplayHeader);
+	std::vector<uint8_t> out;
+	std::size_t destLen = 0U;
+	switch(comp.codec)
+	{
+	case Codec::NONE:
+		break;
+	case Codec::LZMA:
+	{
+		// Worst case output size as recommended by the lzma SDK.
+		out.resize(sizeof(ReplayHeader) + srcLen + srcLen / 3U + 128U);
+		std::size_t lzmaLen = out.size() - sizeof(ReplayHeader);
+		const SRes res = LzmaEncoder::ForThisThread().Encode
+		(
+			out.data() + sizeof(ReplayHeader),
+			lzmaLen,
+			src,
+			srcLen,
+			comp.level,
+			header.props
+		);
+		if(res != SZ_OK)
+			break;
+		header.flags |= REPLAY_COMPRESSED;
+		destLen = lzmaLen;
+		break;
+	}
+	case Codec::ZSTD:
+	{
+#ifdef MULTIROLE_ZSTD
+		out.resize(sizeof(ReplayHeader) + ZSTD_compressBound(srcLen));
+		const std::size_t zstdLen = ZSTD_compress
+		(
+			out.data() + sizeof(ReplayHeader),
+			out.size() - sizeof(ReplayHeader),
+			src,
+			srcLen,
+			comp.level
+		);
+		if(ZSTD_isError(zstdLen) != 0U)
+			break;
+		header.flags |= REPLAY_ZSTD_COMPRESSED;
+		destLen = zstdLen;
+#endif // MULTIROLE_ZSTD
+		break;
+	}
+	}
+	// Leave the data uncompressed if the codec couldn't compress it.
+	if((header.flags & (REPLAY_COMPRESSED | REPLAY_ZSTD_COMPRESSED)) == 0U)
+		return raw;
+	out.resize(sizeof(ReplayHeader) + destLen);
+	uint8_t* ptr = out.data();
+	Write<ReplayHeader>(ptr, header);
+	return out;
+}
+
+uint32_t Replay::Timestamp() const
+{
+	return unixTimestamp;
+}
+
+uint32_t Replay::Seed() const
+{
+	return seed;
+}
+
+const CodeVector& Replay::ExtraCards() const
+{
+	return extraCards;
+}
+
+std::size_t Replay::ResponseCount() const
+{
+	return responseOffsets.size();
+}
+
+std::pair<const uint8_t*, std::size_t> Replay::Response(std::size_t i) const
+{
+	const std::size_t first = responseOffsets[i];
+	const std::size_t last = (i + 1U < responseOffsets.size()) ? responseOffsets[i + 1U] : responses.size();
+	return {responses.data() + first, last - first};
+}
+
 void Replay::AddDuelist(uint8_t team, uint8_t pos, Duelist&& duelist)
 {
-	duelists[team].insert_or_assign(pos, duelist);
+	if(duelists[team].insert_or_assign(pos, duelist).second)
+		duelistsOrder.emplace_back(team, pos);
 }
 
-void Replay::RecordMsg(const std::vector<uint8_t>& msg)
+void Replay::RecordMsg(const uint8_t* data, std::size_t size)
 {
 	// Filter out some useless messages.
-	switch(msg[0U])
+	switch(data[0U])
 	{
 		case MSG_HINT:
 		{
-			switch(msg[1U])
+			switch(data[1U])
 			{
 				// Do not record player specific hints.
 				case 1U: case 2U:
@@ -150,38 +323,38 @@ void Replay::RecordMsg(const std::vector<uint8_t>& msg)
 		case MSG_SELECT_UNSELECT_CARD:
 			return;
 	}
-	messages.emplace_back(msg);
+	ReservePrefix();
+	const std::size_t bodyLength = size - 1U;
+	const std::size_t offset = uncompressed.size();
+	uncompressed.resize(offset + 5U + bodyLength); // msgType<1> + length<4>
+	uint8_t* ptr = uncompressed.data() + offset;
+	Write<uint8_t>(ptr, data[0U]);
+	Write(ptr, static_cast<uint32_t>(bodyLength));
+	std::memcpy(ptr, data + 1U, bodyLength);
 }
 
-void Replay::RecordResponse(const std::vector<uint8_t>& response)
+void Replay::RecordResponse(const uint8_t* data, std::size_t size)
 {
-	responses.emplace_back(response);
+	responseOffsets.push_back(responses.size());
+	responses.insert(responses.end(), data, data + size);
 }
 
 void Replay::PopBackResponse()
 {
-	responses.pop_back();
+	responses.resize(responseOffsets.back());
+	responseOffsets.pop_back();
 }
 
-void Replay::Serialize()
+void Replay::Serialize(const Compression& comp)
 {
-	auto YRPXPastHeaderSize = [&]() -> std::size_t
-	{
-		std::size_t size =
-			8U + // team0Count<4> + team1Count<4>
-			8U;  // duelFlags<8>
-		// Size occupied by each duelist
-		size += 40U * (duelists[0U].size() + duelists[1U].size());
-		// Size occupied by all core messages
-		size += [&]() -> std::size_t
-		{
-			std::size_t v{};
-			for(const auto& msg : messages)
-				v += msg.size() + 4U; // length
-			return v;
-		}();
-		return size;
-	};
+	ReservePrefix();
+	// Make room for duelists added after the first message was recorded.
+	if(const std::size_t needed = PrefixSize(); needed > prefixSize)
+		uncompressed.insert(uncompressed.begin(), needed - prefixSize, 0U);
+	else if(needed < prefixSize)
+		uncompressed.erase(uncompressed.begin(), uncompressed.begin() + (prefixSize - needed));
+	prefixSize = PrefixSize();
+	std::fill_n(uncompressed.begin(), prefixSize, 0U);
 	auto YRPPastHeaderSize = [&]() -> std::size_t
 	{
 		std::size_t size =
@@ -203,8 +376,7 @@ void Replay::Serialize()
 		// Size occupied by extra cards
 		size += 4U + extraCards.size() * 4U;
 		// Size occupied by all player responses
-		for(const auto& r : responses)
-			size += r.size() + 1U; // length
+		size += responses.size() + responseOffsets.size(); // data + length
 		return size;
 	};
 	// Write duelists count and their names
@@ -215,19 +387,21 @@ void Replay::Serialize()
 			Write(ptr, static_cast<uint32_t>(duelists[team].size()));
 			for(const auto& d : duelists[team])
 			{
-				const auto str16 = UTF8ToUTF16(d.second.name);
-				std::memcpy(ptr, str16.data(), UTF16ByteCount(str16));
-				ptr += 40U; // NOTE: Assuming all bytes were initialized to 0
+				std::array<char16_t, 20U> name{};
+				UTF8ToUTF16(d.second.name, name.data(), name.size());
+				std::memcpy(ptr, name.data(), sizeof(name));
+				ptr += sizeof(name);
 			}
 		}
 	};
-	// YRP replay is appended as a CORE message onto the YRPX messages list,
-	// for that reason, we serialize it first and as last step we serialize
-	// the whole YRPX past-the-header data.
-	[&](std::vector<uint8_t>& vec)
+	// YRP replay is appended as a CORE message onto the YRPX messages, it
+	// is written right after them, and as last step the space reserved at
+	// the start for the YRPX header and duelists is filled.
+	[&](std::size_t offset)
 	{
-		vec.resize(1U + sizeof(ReplayHeader) + YRPPastHeaderSize());
-		uint8_t* ptr = vec.data();
+		const std::size_t bodyLength = sizeof(ReplayHeader) + YRPPastHeaderSize();
+		uncompressed.resize(offset + 5U + bodyLength); // msgType<1> + length<4>
+		uint8_t* ptr = uncompressed.data() + offset;
 		auto WriteCodeVector = [&ptr](const std::vector<uint32_t>& vec)
 		{
 			Write(ptr, static_cast<uint32_t>(vec.size()));
@@ -236,6 +410,7 @@ void Replay::Serialize()
 		};
 		// NOLINTNEXTLINE: Message type, Called OLD_REPLAY_FORMAT in common.h
 		Write<uint8_t>(ptr, 231U);
+		Write(ptr, static_cast<uint32_t>(bodyLength));
 		// Replay header for YRP replay format
 		Write(ptr, ReplayHeader
 		{
@@ -266,78 +441,53 @@ void Replay::Serialize()
 		// Extra Cards
 		WriteCodeVector(extraCards);
 		// Core responses
-		for(const auto& r : responses)
+		for(std::size_t i = 0U; i < responseOffsets.size(); i++)
 		{
-			Write(ptr, static_cast<uint8_t>(r.size()));
-			std::memcpy(ptr, r.data(), r.size());
-			ptr += r.size();
+			const auto [data, size] = Response(i);
+			Write(ptr, static_cast<uint8_t>(size));
+			std::memcpy(ptr, data, size);
+			ptr += size;
 		}
-		// Number of bytes written shall equal vec.size()
-		assert(static_cast<std::size_t>(ptr - vec.data()) == vec.size());
-	}(messages.emplace_back());
-	// Write past-the-header data for YRPX replay format
-	auto pthData = [&]() -> std::vector<uint8_t>
+		// Number of bytes written shall equal uncompressed.size()
+		assert(static_cast<std::size_t>(ptr - uncompressed.data()) == uncompressed.size());
+	}(uncompressed.size());
+	[&](uint8_t* ptr)
 	{
-		std::vector<uint8_t> vec(YRPXPastHeaderSize());
-		uint8_t* ptr = vec.data();
+		// Replay header for YRPX replay format
+		Write(ptr, ReplayHeader
+		{
+			REPLAY_YRPX,
+			ENCODED_SERVER_VERSION,
+			REPLAY_LUA64 | REPLAY_NEWREPLAY | REPLAY_64BIT_DUELFLAG,
+			unixTimestamp,
+			static_cast<uint32_t>(uncompressed.size() - sizeof(ReplayHeader)),
+			0U,
+			{}
+		});
 		WriteDuelists(ptr);
 		// Duel flags
 		Write<uint64_t>(ptr, duelFlags);
-		// Core messages
-		for(const auto& msg : messages)
-		{
-			const std::size_t bodyLength = msg.size() - 1U;
-			Write<uint8_t>(ptr, msg[0U]);
-			Write(ptr, static_cast<uint32_t>(bodyLength));
-			std::memcpy(ptr, msg.data() + 1U, bodyLength);
-			ptr += bodyLength;
-		}
-		// Number of bytes written shall equal vec.size()
-		assert(static_cast<std::size_t>(ptr - vec.data()) == vec.size());
-		return vec;
-	}();
-	// Replay header for YRPX replay format
-	ReplayHeader header
-	{
-		REPLAY_YRPX,
-		ENCODED_SERVER_VERSION,
-		REPLAY_LUA64 | REPLAY_NEWREPLAY | REPLAY_64BIT_DUELFLAG,
-		unixTimestamp,
-		static_cast<uint32_t>(pthData.size()),
-		0U,
-		{}
-	};
-	// Compress past-the-header data
-	std::vector<uint8_t> compData(pthData.size() * 2U);
-	CLzmaEncProps props;
-	LzmaEncProps_Init(&props);
-	props.numThreads = 1; // NOLINT: no multithreading
-	SizeT destLen = compData.size();
-	SizeT outPropSize = 5U; // NOLINT: must be 5 according to lzma SDK
-	LzmaEncode
-	(
-		compData.data(),
-		&destLen,
-		pthData.data(),
-		pthData.size(),
-		&props,
-		header.props,
-		&outPropSize,
-		0,
-		nullptr,
-		&g_Alloc,
-		&g_Alloc
-	);
-	compData.resize(destLen);
-	header.flags |= REPLAY_COMPRESSED;
-	pthData = std::move(compData);
-	// Write final binary replay
-	bytes.resize(sizeof(ReplayHeader) + pthData.size());
-	uint8_t* ptr = bytes.data();
-	Write<ReplayHeader>(ptr, header);
-	std::memcpy(ptr, pthData.data(), pthData.size());
-	// Remove message that was appended for serializing purposes.
-	messages.pop_back();
+		// Number of bytes written shall equal the space reserved for them
+		assert(static_cast<std::size_t>(ptr - uncompressed.data()) == prefixSize);
+	}(uncompressed.data());
+	bytes = Compress(uncompressed, comp);
+}
+
+std::size_t Replay::PrefixSize() const
+{
+	return
+		sizeof(ReplayHeader) +
+		8U + // team0Count<4> + team1Count<4>
+		40U * (duelists[0U].size() + duelists[1U].size()) + // names<2 * 20>
+		8U;  // duelFlags<8>
+}
+
+void Replay::ReservePrefix()
+{
+	if(!uncompressed.empty())
+		return;
+	prefixSize = PrefixSize();
+	uncompressed.resize(prefixSize);
 }
 
 } // namespace YGOPro
@@ -2,9 +2,10 @@
 #define YGOPRO_REPLAY_HPP
 #include <array>
 #include <cstdint>
-#include <list>
 #include <map>
+#include <memory_resource>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "Deck.hpp"
@@ -16,6 +17,19 @@ namespace YGOPro
 class Replay final
 {
 public:
+	enum class Codec
+	{
+		NONE,
+		LZMA,
+		ZSTD, // Only if built with zstd, otherwise left uncompressed.
+	};
+
+	struct Compression
+	{
+		Codec codec;
+		int level; // Codec specific, -1 for its default.
+	};
+
 	struct Duelist
 	{
 		std::string name;
@@ -23,22 +37,66 @@ public:
 		CodeVector extra;
 	};
 
+	// `mr` is where the responses are recorded, it must outlive the replay.
 	Replay(
 		uint32_t unixTimestamp,
 		uint32_t seed,
 		const HostInfo& info,
-		const CodeVector& extraCards);
+		const CodeVector& extraCards,
+		std::pmr::memory_resource* mr = std::pmr::get_default_resource());
 
+	// Replay compressed as given to `Serialize`.
 	const std::vector<uint8_t>& Bytes() const;
 
+	// Replay with the data past its header left uncompressed, can be given
+	// to `Compress` to store it with a different codec.
+	const std::vector<uint8_t>& Uncompressed() const;
+
+	// Bytes allocated for the messages, responses and serialized replay.
+	std::size_t MemoryUsage() const;
+
+	static std::vector<uint8_t> Compress(const std::vector<uint8_t>& raw, const Compression& comp);
+
+	uint32_t Timestamp() const;
+
+	// Data needed to rebuild the duel this replay is recording.
+	uint32_t Seed() const;
+	const CodeVector& ExtraCards() const;
+	std::size_t ResponseCount() const;
+	std::pair<const uint8_t*, std::size_t> Response(std::size_t i) const;
+
+	// Calls `f(team, pos, duelist)` for each duelist, in the same order
+	// they were added to the replay (and thus to the core).
+	template<typename F>
+	void ForEachDuelist(F&& f) const
+	{
+		for(const auto& [team, pos] : duelistsOrder)
+			f(team, pos, duelists[team].at(pos));
+	}
+
 	void AddDuelist(uint8_t team, uint8_t pos, Duelist&& duelist);
 
-	void RecordMsg(const std::vector<uint8_t>& msg);
-	void RecordResponse(const std::vector<uint8_t>& response);
+	void RecordMsg(const uint8_t* data, std::size_t size);
+
+	template<typename ContiguousContainer>
+	void RecordMsg(const ContiguousContainer& msg)
+	{
+		RecordMsg(msg.data(), msg.size());
+	}
+
+	void RecordResponse(const uint8_t* data, std::size_t size);
+
+	template<typename ContiguousContainer>
+	void RecordResponse(const ContiguousContainer& response)
+	{
+		RecordResponse(response.data(), response.size());
+	}
 
 	void PopBackResponse();
 
-	void Serialize();
+	// NOTE: Clients only understand replays compressed with LZMA.
+	// NOTE: Nothing should be recorded after serializing.
+	void Serialize(const Compression& comp);
 private:
 	const uint32_t unixTimestamp;
 	const uint32_t seed;
@@ -49,10 +107,21 @@ private:
 	const CodeVector extraCards;
 
 	std::array<std::map<uint8_t, Duelist>, 2U> duelists;
-	std::list<std::vector<uint8_t>> messages;
-	std::list<std::vector<uint8_t>> responses;
+	std::vector<std::pair<uint8_t, uint8_t>> duelistsOrder;
+	// Responses are stored back to back, `responseOffsets` has where each
+	// one starts within `responses`.
+	std::pmr::vector<uint8_t> responses;
+	std::pmr::vector<std::size_t> responseOffsets;
 
+	// Uncompressed replay, core messages are appended onto it as they are
+	// recorded, after `prefixSize` bytes reserved for the header and
+	// duelists that are only written when serializing.
+	std::vector<uint8_t> uncompressed;
+	std::size_t prefixSize{};
 	std::vector<uint8_t> bytes;
+
+	std::size_t PrefixSize() const;
+	void ReservePrefix();
 };
 
 } // namespace YGOPro
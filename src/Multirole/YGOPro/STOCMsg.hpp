@@ -1,11 +1,13 @@
 #ifndef YGOPRO_STOCMSG_HPP
 #define YGOPRO_STOCMSG_HPP
 #include <array>
+#include <atomic>
 #include <cassert>
 #include <cstring>
 #include <limits>
 #include <memory>
 #include <type_traits>
+#include <utility>
 
 #include "MsgCommon.hpp"
 
@@ -44,6 +46,8 @@ public:
 		REMATCH       = 0xF1,
 		REMATCH_WAIT  = 0xF2,
 		CHAT_2        = 0xF3,
+		REPLAY_CHUNK  = 0xF4,
+		RELAY_SNAPSHOT = 0xF5,
 	};
 	static constexpr std::size_t MAX_PAYLOAD_SIZE =
 		std::numeric_limits<LengthType>::max() -
@@ -154,6 +158,22 @@ public:
 		uint16_t msg[256U];
 	};
 
+	// Only sent to relays, brackets what a spectator joining right then
+	// would get, which replaces everything the relay got before.
+	struct RelaySnapshot
+	{
+		static constexpr auto MSG_TYPE = MsgType::RELAY_SNAPSHOT;
+		uint8_t begin;
+	};
+
+	// Prefixes each part of data too big for a single message, see
+	// Room::Client::SendChunked.
+	struct ChunkHeader
+	{
+		uint32_t total;
+		uint32_t offset;
+	};
+
 	STOCMsg() = delete;
 
 	~STOCMsg()
@@ -197,9 +217,9 @@ public:
 	{
 		assert(this != &other);
 		if(IsStackArray(this->length = other.length))
-			new (&this->stackA) StackArray(other.stackA);
+			this->stackA = other.stackA;
 		else
-			new (&this->refCntA) RefCntArray(other.refCntA);
+			this->payload = PayloadPool::Acquire(other.payload);
 	}
 
 	STOCMsg& operator=(const STOCMsg& other) // Copy assignment
@@ -209,7 +229,7 @@ public:
 		if(IsStackArray(this->length = other.length))
 			this->stackA = other.stackA;
 		else
-			this->refCntA = other.refCntA;
+			this->payload = PayloadPool::Acquire(other.payload);
 		return *this;
 	}
 
@@ -217,9 +237,9 @@ public:
 	{
 		assert(this != &other);
 		if(IsStackArray(this->length = other.length))
-			new (&this->stackA) StackArray(std::move(other.stackA));
+			this->stackA = other.stackA;
 		else
-			new (&this->refCntA) RefCntArray(std::move(other.refCntA));
+			this->payload = std::exchange(other.payload, nullptr);
 	}
 
 	STOCMsg& operator=(STOCMsg&& other) // Move assignment
@@ -227,9 +247,9 @@ public:
 		assert(this != &other);
 		DestroyUnion();
 		if(IsStackArray(this->length = other.length))
-			this->stackA = std::move(other.stackA);
+			this->stackA = other.stackA;
 		else
-			this->refCntA = std::move(other.refCntA);
+			this->payload = std::exchange(other.payload, nullptr);
 		return *this;
 	}
 
@@ -243,24 +263,135 @@ public:
 		if(IsStackArray(length))
 			return stackA.data();
 		else
-			return refCntA.get();
+			return payload->Data();
 	}
 
 private:
-	// Reference counted dynamic array.
-	using RefCntArray = std::shared_ptr<uint8_t[]>;
+	// Messages too big to be stored inline are stored in one of these, a
+	// reference count followed by the message itself.
+	struct Payload
+	{
+		std::atomic<uint32_t> refs;
+		uint8_t sizeClass;
 
-	// Stack array that has the same size as RefCntArray.
-	using StackArray = std::array<uint8_t, sizeof(RefCntArray)>;
+		uint8_t* Data()
+		{
+			return reinterpret_cast<uint8_t*>(this + 1);
+		}
+	};
+
+	// Payloads are rounded up to a size class and kept around once freed
+	// in a cache of the thread that freed them, so that after warming up
+	// most messages are built without going through the global allocator.
+	// Payloads bigger than the largest class are allocated as they are.
+	class PayloadPool final
+	{
+	public:
+		static Payload* Allocate(std::size_t size)
+		{
+			const uint8_t sc = SizeClass(size);
+			Payload* p = nullptr;
+			if(sc != NO_SIZE_CLASS && !cacheDestroyed && ThisThreadCache().heads[sc] != nullptr)
+			{
+				auto& cache = ThisThreadCache();
+				p = cache.heads[sc];
+				cache.heads[sc] = NextOf(p);
+				cache.counts[sc]--;
+			}
+			else
+			{
+				const std::size_t blockSize = (sc == NO_SIZE_CLASS) ? size : ClassSize(sc);
+				p = static_cast<Payload*>(::operator new(sizeof(Payload) + blockSize));
+			}
+			new (p) Payload{{1U}, sc};
+			return p;
+		}
 
-	// Make sure they are both the same length.
-	static_assert(sizeof(RefCntArray) == sizeof(StackArray));
+		static Payload* Acquire(Payload* p)
+		{
+			p->refs.fetch_add(1U, std::memory_order_relaxed);
+			return p;
+		}
+
+		static void Release(Payload* p)
+		{
+			if(p == nullptr || p->refs.fetch_sub(1U, std::memory_order_acq_rel) != 1U)
+				return;
+			const uint8_t sc = p->sizeClass;
+			p->~Payload();
+			if(sc == NO_SIZE_CLASS || cacheDestroyed)
+			{
+				::operator delete(p);
+				return;
+			}
+			auto& cache = ThisThreadCache();
+			if(cache.counts[sc] >= MAX_CACHED_BYTES / ClassSize(sc))
+			{
+				::operator delete(p);
+				return;
+			}
+			NextOf(p) = cache.heads[sc];
+			cache.heads[sc] = p;
+			cache.counts[sc]++;
+		}
+	private:
+		static constexpr uint8_t NO_SIZE_CLASS = UINT8_MAX;
+		static constexpr std::size_t MIN_CLASS_SIZE_LOG2 = 6U; // 64 bytes
+		static constexpr std::size_t CLASS_COUNT = 7U; // Up to 4096 bytes
+		static constexpr std::size_t MAX_CACHED_BYTES = 256U * 1024U; // Per class
+
+		struct Cache
+		{
+			std::array<Payload*, CLASS_COUNT> heads{};
+			std::array<std::size_t, CLASS_COUNT> counts{};
+
+			~Cache()
+			{
+				cacheDestroyed = true;
+				for(Payload* p : heads)
+					while(p != nullptr)
+						::operator delete(std::exchange(p, NextOf(p)));
+			}
+		};
+
+		// Messages might still be released by this thread after its cache
+		// is gone, such as while other thread locals are destroyed.
+		inline static thread_local bool cacheDestroyed = false;
+
+		static Cache& ThisThreadCache()
+		{
+			thread_local Cache cache;
+			return cache;
+		}
+
+		static constexpr std::size_t ClassSize(uint8_t sc)
+		{
+			return std::size_t{1U} << (MIN_CLASS_SIZE_LOG2 + sc);
+		}
+
+		static constexpr uint8_t SizeClass(std::size_t size)
+		{
+			for(uint8_t sc = 0U; sc < CLASS_COUNT; sc++)
+				if(size <= ClassSize(sc))
+					return sc;
+			return NO_SIZE_CLASS;
+		}
+
+		// Freed payloads are linked through their own data.
+		static Payload*& NextOf(Payload* p)
+		{
+			return *reinterpret_cast<Payload**>(p->Data());
+		}
+	};
+
+	// Stack array big enough for the smallest messages.
+	using StackArray = std::array<uint8_t, 16U>;
 
 	std::size_t length;
 	union
 	{
 		StackArray stackA;
-		RefCntArray refCntA;
+		Payload* payload;
 	};
 
 	constexpr bool IsStackArray(std::size_t size) const
@@ -272,22 +403,21 @@ private:
 	{
 		if(IsStackArray(length = size))
 		{
-			new (&stackA) StackArray{0U};
+			stackA = StackArray{0U};
 			return stackA.data();
 		}
 		else
 		{
-			new (&refCntA) RefCntArray{new uint8_t[size]{0U}};
-			return refCntA.get();
+			// NOTE: Not zeroed, constructors write the whole message.
+			payload = PayloadPool::Allocate(size);
+			return payload->Data();
 		}
 	}
 
 	inline void DestroyUnion()
 	{
-		if(length <= std::tuple_size<StackArray>::value)
-			stackA.~StackArray();
-		else
-			refCntA.~RefCntArray();
+		if(!IsStackArray(length))
+			PayloadPool::Release(payload);
 	}
 };
 
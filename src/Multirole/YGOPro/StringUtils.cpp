@@ -1,53 +1,202 @@
 #include "StringUtils.hpp"
 
+#include <algorithm>
+#include <array>
+#include <cstdint>
 #include <cstring>
-#include <codecvt>
-#include <locale>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif // __SSE2__
 
 namespace YGOPro
 {
 
-std::u16string BufferToUTF16(const void* data, std::size_t maxByteCount)
+constexpr char32_t REPLACEMENT_CHAR = 0xFFFDU;
+
+constexpr bool IsHighSurrogate(char16_t c)
 {
-	const auto* p = reinterpret_cast<const char16_t*>(data);
-	const auto* p2 = p;
-	std::size_t bytesForwarded = 0U;
-	while(bytesForwarded <= maxByteCount && (*p != 0U))
-	{
-		p++;
-		bytesForwarded += 2U;
-	}
-	return std::u16string(p2, p - p2);
+	return c >= 0xD800U && c <= 0xDBFFU;
 }
 
+constexpr bool IsLowSurrogate(char16_t c)
+{
+	return c >= 0xDC00U && c <= 0xDFFFU;
+}
 
-constexpr const char* ERROR_STR = "Invalid String";
+// Length of a null-terminated string of 16-bit units in unaligned memory.
+inline std::size_t BufferUnitCount(const void* data, std::size_t maxByteCount)
+{
+	const auto* p = static_cast<const uint8_t*>(data);
+	const std::size_t maxCount = maxByteCount / sizeof(char16_t);
+	std::size_t count = 0U;
+	while(count < maxCount && (p[count * 2U] | p[count * 2U + 1U]) != 0U)
+		count++;
+	return count;
+}
+
+std::u16string BufferToUTF16(const void* data, std::size_t maxByteCount)
+{
+	std::u16string ret(BufferUnitCount(data, maxByteCount), u'\0');
+	std::memcpy(ret.data(), data, ret.size() * sizeof(char16_t));
+	return ret;
+}
 
-#if defined(_MSC_VER) && _MSC_VER >= 1900 && _MSC_VER < 1920
-using Wsc = std::wstring_convert<std::codecvt_utf8_utf16<int16_t>, int16_t>;
-#else
-using Wsc = std::wstring_convert<std::codecvt_utf8_utf16<char16_t>, char16_t>;
-#endif // defined(_MSC_VER) && _MSC_VER >= 1900 && _MSC_VER < 1920
+std::string UTF16BufferToUTF8(const void* data, std::size_t maxByteCount)
+{
+	// Copied onto aligned memory in chunks, without splitting pairs.
+	std::array<char16_t, 256U> chunk;
+	const auto* p = static_cast<const uint8_t*>(data);
+	std::size_t left = BufferUnitCount(data, maxByteCount);
+	std::string ret;
+	ret.reserve(left);
+	while(left != 0U)
+	{
+		std::size_t count = std::min(left, chunk.size());
+		std::memcpy(chunk.data(), p, count * sizeof(char16_t));
+		if(count != left && IsHighSurrogate(chunk[count - 1U]))
+			count--;
+		UTF16ToUTF8({chunk.data(), count}, ret);
+		p += count * sizeof(char16_t);
+		left -= count;
+	}
+	return ret;
+}
 
-using WscElem = Wsc::wide_string::value_type;
+void UTF16ToUTF8(std::u16string_view str, std::string& out)
+{
+	const std::size_t offset = out.size();
+	out.resize(offset + str.size() * 3U); // Worst case.
+	auto* o = reinterpret_cast<uint8_t*>(out.data() + offset);
+	const char16_t* p = str.data();
+	const char16_t* const end = p + str.size();
+	while(p != end)
+	{
+#ifdef __SSE2__
+		// Narrow runs of ASCII 8 units at a time.
+		while(end - p >= 8)
+		{
+			const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+			const __m128i high = _mm_and_si128(v, _mm_set1_epi16(static_cast<int16_t>(0xFF80U)));
+			if(_mm_movemask_epi8(_mm_cmpeq_epi16(high, _mm_setzero_si128())) != 0xFFFF)
+				break;
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(o), _mm_packus_epi16(v, v));
+			p += 8;
+			o += 8;
+		}
+		if(p == end)
+			break;
+#endif // __SSE2__
+		char32_t c = *p++;
+		if(IsHighSurrogate(static_cast<char16_t>(c)) && p != end && IsLowSurrogate(*p))
+			c = 0x10000U + ((c - 0xD800U) << 10U) + (*p++ - 0xDC00U);
+		else if(IsHighSurrogate(static_cast<char16_t>(c)) || IsLowSurrogate(static_cast<char16_t>(c)))
+			c = REPLACEMENT_CHAR;
+		if(c < 0x80U)
+		{
+			*o++ = static_cast<uint8_t>(c);
+		}
+		else if(c < 0x800U)
+		{
+			*o++ = static_cast<uint8_t>(0xC0U | (c >> 6U));
+			*o++ = static_cast<uint8_t>(0x80U | (c & 0x3FU));
+		}
+		else if(c < 0x10000U)
+		{
+			*o++ = static_cast<uint8_t>(0xE0U | (c >> 12U));
+			*o++ = static_cast<uint8_t>(0x80U | ((c >> 6U) & 0x3FU));
+			*o++ = static_cast<uint8_t>(0x80U | (c & 0x3FU));
+		}
+		else // NOTE: Only from a pair, which is 2 units for 4 bytes.
+		{
+			*o++ = static_cast<uint8_t>(0xF0U | (c >> 18U));
+			*o++ = static_cast<uint8_t>(0x80U | ((c >> 12U) & 0x3FU));
+			*o++ = static_cast<uint8_t>(0x80U | ((c >> 6U) & 0x3FU));
+			*o++ = static_cast<uint8_t>(0x80U | (c & 0x3FU));
+		}
+	}
+	out.resize(static_cast<std::size_t>(o - reinterpret_cast<uint8_t*>(out.data())));
+}
 
-inline Wsc MakeWsc()
+std::size_t UTF8ToUTF16(std::string_view str, char16_t* out, std::size_t outSize)
 {
-	return Wsc{ERROR_STR};
+	if(outSize == 0U)
+		return 0U;
+	const auto* p = reinterpret_cast<const uint8_t*>(str.data());
+	const auto* const end = p + str.size();
+	char16_t* o = out;
+	char16_t* const oEnd = out + outSize - 1U; // Room for the terminator.
+	while(p != end && o != oEnd)
+	{
+#ifdef __SSE2__
+		// Widen runs of ASCII 16 bytes at a time.
+		while(end - p >= 16 && oEnd - o >= 16)
+		{
+			const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+			if(_mm_movemask_epi8(v) != 0)
+				break;
+			const __m128i zero = _mm_setzero_si128();
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(o), _mm_unpacklo_epi8(v, zero));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(o + 8), _mm_unpackhi_epi8(v, zero));
+			p += 16;
+			o += 16;
+		}
+		if(p == end || o == oEnd)
+			break;
+#endif // __SSE2__
+		const uint8_t lead = *p;
+		char32_t c = REPLACEMENT_CHAR;
+		std::size_t len = 1U;
+		char32_t min = 0U;
+		if(lead < 0x80U)
+			c = lead;
+		else if(lead >= 0xC2U && lead <= 0xDFU)
+			len = 2U, c = lead & 0x1FU, min = 0x80U;
+		else if(lead >= 0xE0U && lead <= 0xEFU)
+			len = 3U, c = lead & 0x0FU, min = 0x800U;
+		else if(lead >= 0xF0U && lead <= 0xF4U)
+			len = 4U, c = lead & 0x07U, min = 0x10000U;
+		if(len > 1U)
+		{
+			std::size_t i = 1U;
+			for(; i < len && p + i != end && (p[i] & 0xC0U) == 0x80U; i++)
+				c = (c << 6U) | (p[i] & 0x3FU);
+			// Bad sequences are skipped up to the first byte that breaks
+			// them, which is decoded on its own afterwards.
+			if(i != len || c < min || c > 0x10FFFFU || (c >= 0xD800U && c <= 0xDFFFU))
+				c = REPLACEMENT_CHAR;
+			len = i;
+		}
+		if(c >= 0x10000U)
+		{
+			if(oEnd - o < 2)
+				break;
+			c -= 0x10000U;
+			*o++ = static_cast<char16_t>(0xD800U + (c >> 10U));
+			*o++ = static_cast<char16_t>(0xDC00U + (c & 0x3FFU));
+		}
+		else
+		{
+			*o++ = static_cast<char16_t>(c);
+		}
+		p += len;
+	}
+	*o = u'\0';
+	return static_cast<std::size_t>(o - out);
 }
 
 std::string UTF16ToUTF8(std::u16string_view str)
 {
-	const auto* p = reinterpret_cast<const WscElem*>(str.data());
-	return MakeWsc().to_bytes(p, p + str.size());
+	std::string ret;
+	UTF16ToUTF8(str, ret);
+	return ret;
 }
 
 std::u16string UTF8ToUTF16(std::string_view str)
 {
-	if constexpr(std::is_same_v<char16_t, WscElem>)
-		return MakeWsc().from_bytes(str.data());
-	const auto r = MakeWsc().from_bytes(str.data(), str.data() + str.size());
-	return std::u16string(reinterpret_cast<const char16_t*>(r.data()), r.length());
+	// UTF-8 never takes less code units than UTF-16.
+	std::u16string ret(str.size(), u'\0');
+	ret.resize(UTF8ToUTF16(str, ret.data(), ret.size() + 1U));
+	return ret;
 }
 
 } // namespace YGOPro
@@ -10,8 +10,31 @@ constexpr std::size_t UTF16ByteCount(std::u16string_view str)
 	return (str.size() + 1U) * sizeof(char16_t);
 }
 
+// Reads a null-terminated UTF-16 string from a buffer of the given size,
+// which needs neither be aligned nor terminated.
 std::u16string BufferToUTF16(const void* data, std::size_t maxByteCount);
 
+// Same as above, but converting straight to UTF-8.
+std::string UTF16BufferToUTF8(const void* data, std::size_t maxByteCount);
+
+// Transcoders writing onto caller memory. Invalid input (such as unpaired
+// surrogates, overlong or truncated sequences) is replaced by U+FFFD
+// instead of failing the whole string.
+// Appends `str` onto `out`.
+void UTF16ToUTF8(std::u16string_view str, std::string& out);
+// Writes at most `outSize - 1` code units onto `out` and terminates it,
+// never splitting a surrogate pair. Returns the code units written, not
+// counting the terminator.
+std::size_t UTF8ToUTF16(std::string_view str, char16_t* out, std::size_t outSize);
+
+// Same as above, for the fixed size arrays of protocol messages.
+template<typename T, std::size_t N>
+inline std::size_t UTF8ToUTF16(std::string_view str, T (&out)[N])
+{
+	static_assert(sizeof(T) == sizeof(char16_t));
+	return UTF8ToUTF16(str, reinterpret_cast<char16_t*>(out), N);
+}
+
 std::string UTF16ToUTF8(std::u16string_view str);
 std::u16string UTF8ToUTF16(std::string_view str);
 
@@ -6,15 +6,40 @@
 #include <cstdlib> // Exit flags
 #include <fstream> // std::ifstream
 #include <optional> // std::optional
+#include <string_view>
 
 #include <boost/json/src.hpp>
 #include <fmt/format.h>
+#include <spdlog/async.h>
 #include <spdlog/spdlog.h>
 #include <git2.h>
 
 #include "Instance.hpp"
 #include "I18N.hpp"
 
+// Replaces the default logger with an asynchronous one that writes to the
+// same sinks from a background thread, so that logging on io threads only
+// formats and enqueues the message instead of doing the I/O itself.
+inline void SetupLogging(const boost::json::value& cfg)
+{
+	using namespace Ignis::Multirole;
+	if(!cfg.at("async").as_bool())
+		return;
+	const std::string_view whenFull = cfg.at("whenQueueFull").as_string();
+	if(whenFull != "block" && whenFull != "overrunOldest")
+		throw std::runtime_error(I18N::MAIN_INCORRECT_LOG_OVERFLOW_POLICY);
+	const auto policy = (whenFull == "block") ?
+		spdlog::async_overflow_policy::block :
+		spdlog::async_overflow_policy::overrun_oldest;
+	spdlog::init_thread_pool(cfg.at("queueSize").to_number<std::size_t>(), 1U);
+	auto sync = spdlog::default_logger();
+	auto async = std::make_shared<spdlog::async_logger>(sync->name(),
+		sync->sinks().begin(), sync->sinks().end(), spdlog::thread_pool(), policy);
+	async->set_level(sync->level());
+	async->flush_on(spdlog::level::err);
+	spdlog::set_default_logger(std::move(async));
+}
+
 inline int CreateAndRunServerInstance()
 {
 	using namespace Ignis::Multirole;
@@ -27,7 +52,9 @@ inline int CreateAndRunServerInstance()
 		for(std::string l; std::getline(f, l);)
 			p.write(l);
 		p.finish();
-		server.emplace(p.release());
+		const auto cfg = p.release();
+		SetupLogging(cfg.at("logging"));
+		server.emplace(cfg);
 	}
 	catch(const std::exception& e)
 	{
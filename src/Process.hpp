@@ -1,16 +1,20 @@
 #ifndef PROCESS_HPP
 #define PROCESS_HPP
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/types.h>
+#endif // _WIN32
+
 namespace Process
 {
 
 #ifdef _WIN32
-#define WIN32_LEAN_AND_MEAN
-#include <windows.h>
 
 using Data = HANDLE;
 
 #else
-#include <sys/types.h>
 
 using Data = pid_t;
 
@@ -23,12 +27,19 @@ using Data = pid_t;
 #ifdef PROCESS_IMPLEMENTATION
 #ifndef PROCESS_IMPL_HPP
 #define PROCESS_IMPL_HPP
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#endif // _WIN32
+
 namespace Process
 {
 
 #ifdef _WIN32
-#define WIN32_LEAN_AND_MEAN
-#include <windows.h>
 
 namespace Detail
 {
@@ -66,34 +77,59 @@ std::pair<Data, bool> Launch(const char* program, Args&& ...args)
 	return data;
 }
 
-bool IsRunning(const Data& data)
+// Launches a process and waits for it to exit, returns whether or not it
+// could be launched and exited successfully.
+template<typename... Args>
+bool Run(const char* program, Args&& ...args)
+{
+	const auto [data, launched] = Launch(program, std::forward<Args>(args)...);
+	if(!launched)
+		return false;
+	WaitForSingleObject(data, INFINITE);
+	DWORD exitCode = 1U;
+	GetExitCodeProcess(data, &exitCode);
+	CloseHandle(data);
+	return exitCode == 0U;
+}
+
+inline bool IsRunning(const Data& data)
 {
 	DWORD lpExitCode{};
 	GetExitCodeProcess(data, &lpExitCode);
 	return lpExitCode == STILL_ACTIVE;
 }
 
-void CleanUp(const Data& data)
+inline void CleanUp(const Data& data)
 {
 	WaitForSingleObject(data, INFINITE);
 	CloseHandle(data);
 }
 
-void Kill(const Data& data)
+inline void Kill(const Data& data)
 {
 	TerminateProcess(data, 1U);
 }
 
+// NOTE: There is no zygote on this platform, every process is a child.
+inline bool IsAlive(const Data& data)
+{
+	return IsRunning(data);
+}
+
+inline void WaitUntilGone(const Data& data)
+{
+	CleanUp(data);
+}
+
 #else
-#include <unistd.h>
-#include <sys/signal.h>
-#include <sys/types.h>
-#include <sys/wait.h>
 
-bool IsRunning(const Data& data);
+inline bool IsRunning(const Data& data);
 
+// Same as Launch, but `fd` is inherited by the new process even if it is
+// marked close-on-exec, which keeps it from leaking onto processes that
+// other threads launch meanwhile.
 template<typename... Args>
-std::pair<Data, bool> Launch(const char* program, Args&& ...args)
+std::pair<Data, bool> LaunchWithFd(int fd, const char* program, Args&& ...args)
 {
 	constexpr const char* NULL_CHAR_PTR = nullptr;
 	pid_t id = vfork();
@@ -102,26 +138,69 @@ std::pair<Data, bool> Launch(const char* program, Args&& ...args)
 	else if(id > 0)
 		return std::pair<Data, bool>(id, IsRunning(id));
 	// Child continues execution...
+	if(fd >= 0 && fcntl(fd, F_SETFD, 0) == -1)
+		_exit(1);
 	execlp(program, program, std::forward<Args>(args)..., NULL_CHAR_PTR);
 	// Immediately die if unable to change process image.
 	_exit(1);
 }
 
-bool IsRunning(const Data& data)
+template<typename... Args>
+std::pair<Data, bool> Launch(const char* program, Args&& ...args)
+{
+	return LaunchWithFd(-1, program, std::forward<Args>(args)...);
+}
+
+// Launches a process and waits for it to exit, returns whether or not it
+// could be launched and exited successfully.
+template<typename... Args>
+bool Run(const char* program, Args&& ...args)
+{
+	constexpr const char* NULL_CHAR_PTR = nullptr;
+	pid_t id = vfork();
+	if(id == -1)
+		return false;
+	if(id == 0)
+	{
+		execlp(program, program, std::forward<Args>(args)..., NULL_CHAR_PTR);
+		_exit(1);
+	}
+	int status = 0;
+	while(waitpid(id, &status, 0) == -1)
+		if(errno != EINTR)
+			return false;
+	return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+inline bool IsRunning(const Data& data)
 {
 	return waitpid(data, NULL, WNOHANG) == 0;
 }
 
-void CleanUp(const Data& data)
+inline void CleanUp(const Data& data)
 {
 	waitpid(data, NULL, 0);
 }
 
-void Kill(const Data& data)
+inline void Kill(const Data& data)
 {
 	kill(data, SIGKILL);
 }
 
+// Same as IsRunning and CleanUp but for processes that are not children
+// of this one (and thus can't be waited on), such as the ones forked by
+// a hornet zygote. Those are reaped by whoever their parent is.
+inline bool IsAlive(const Data& data)
+{
+	return kill(data, 0) == 0;
+}
+
+inline void WaitUntilGone(const Data& data)
+{
+	while(IsAlive(data))
+		usleep(1000U);
+}
+
 #endif // _WIN32
 
 } // namespace Process
@@ -0,0 +1,39 @@
+#ifndef REPLAYPACK_HPP
+#define REPLAYPACK_HPP
+#include <cstdint>
+#include <string>
+
+namespace Ignis::ReplayPack
+{
+
+// ***** Pack format *****
+// Replays are appended back to back onto `<firstId>.yrpp`, the ID of the
+// first replay stored in it. Their entries are appended onto the index
+// `<firstId>.yrpi` only after the replay was written, so every entry on an
+// index refers to a replay complete on its pack.
+constexpr const char* DATA_EXTENSION = ".yrpp";
+constexpr const char* INDEX_EXTENSION = ".yrpi";
+
+struct Entry
+{
+	uint64_t id;
+	uint64_t offset; // Where the replay starts within the pack.
+	uint32_t size;
+	uint32_t unused;
+};
+
+static_assert(sizeof(Entry) == 24U);
+
+inline std::string DataName(uint64_t firstId)
+{
+	return std::to_string(firstId) + DATA_EXTENSION;
+}
+
+inline std::string IndexName(uint64_t firstId)
+{
+	return std::to_string(firstId) + INDEX_EXTENSION;
+}
+
+} // namespace Ignis::ReplayPack
+
+#endif // REPLAYPACK_HPP
@@ -0,0 +1,75 @@
+// Extracts replays out of the packs written by multirole's replay manager
+// onto `<id>.yrpX` files, as if they had been saved one file per replay.
+// Usage: replay-unpack <index.yrpi> <output dir> [id...]
+// If no IDs are given every replay on the pack is extracted.
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "../ReplayPack.hpp"
+
+int main(int argc, char* argv[])
+{
+	using namespace Ignis::ReplayPack;
+	if(argc < 3)
+	{
+		std::fprintf(stderr, "Usage: %s <index%s> <output dir> [id...]\n", argv[0], INDEX_EXTENSION);
+		return 1;
+	}
+	const std::string indexFn = argv[1];
+	const std::string outDir = argv[2];
+	const std::size_t extPos = indexFn.rfind(INDEX_EXTENSION);
+	if(extPos == std::string::npos)
+	{
+		std::fprintf(stderr, "%s is not an index\n", indexFn.data());
+		return 1;
+	}
+	const std::string packFn = indexFn.substr(0U, extPos) + DATA_EXTENSION;
+	std::unordered_set<uint64_t> wanted;
+	for(int i = 3; i < argc; i++)
+		wanted.insert(std::strtoull(argv[i], nullptr, 10));
+	std::FILE* index = std::fopen(indexFn.data(), "rb");
+	std::FILE* pack = std::fopen(packFn.data(), "rb");
+	if(index == nullptr || pack == nullptr)
+	{
+		std::fprintf(stderr, "Unable to open %s or %s\n", indexFn.data(), packFn.data());
+		return 1;
+	}
+	int ret = 0;
+	std::size_t extracted = 0U;
+	std::vector<char> data;
+	// NOTE: A trailing partial entry left by a crash is ignored.
+	for(Entry e{}; std::fread(&e, sizeof(e), 1U, index) == 1U;)
+	{
+		if(!wanted.empty() && wanted.count(e.id) == 0U)
+			continue;
+		data.resize(e.size);
+		const auto offset = static_cast<long>(e.offset);
+		if(std::fseek(pack, offset, SEEK_SET) != 0 ||
+		   std::fread(data.data(), 1U, data.size(), pack) != data.size())
+		{
+			std::fprintf(stderr, "Replay %llu is cut short on the pack\n", static_cast<unsigned long long>(e.id));
+			ret = 1;
+			continue;
+		}
+		const std::string outFn = outDir + "/" + std::to_string(e.id) + ".yrpX";
+		std::FILE* out = std::fopen(outFn.data(), "wb");
+		if(out == nullptr || std::fwrite(data.data(), 1U, data.size(), out) != data.size())
+		{
+			std::fprintf(stderr, "Unable to write %s\n", outFn.data());
+			ret = 1;
+		}
+		else
+		{
+			extracted++;
+		}
+		if(out != nullptr)
+			std::fclose(out);
+	}
+	std::fclose(pack);
+	std::fclose(index);
+	std::printf("Extracted %zu replays\n", extracted);
+	return ret;
+}